@@ -63,6 +63,7 @@
 #include <sys/zfs_fuid.h>
 #include <sys/arc.h>
 #include <sys/ddt.h>
+#include <sys/brt.h>
 #include <sys/zfeature.h>
 #include <sys/abd.h>
 #include <sys/blkptr.h>
@@ -949,7 +950,7 @@ dump_metaslab_stats(metaslab_t *msp)
 {
 	char maxbuf[32];
 	range_tree_t *rt = msp->ms_allocatable;
-	avl_tree_t *t = &msp->ms_allocatable_by_size;
+	zfs_btree_t *t = &msp->ms_allocatable_by_size;
 	int free_pct = range_tree_space(rt) * 100 / msp->ms_size;
 
 	/* max sure nicenum has enough space */
@@ -958,7 +959,7 @@ dump_metaslab_stats(metaslab_t *msp)
 	zdb_nicenum(metaslab_largest_allocatable(msp), maxbuf, sizeof (maxbuf));
 
 	(void) printf("\t %25s %10lu   %7s  %6s   %4s %4d%%\n",
-	    "segments", avl_numnodes(t), "maxsize", maxbuf,
+	    "segments", zfs_btree_numnodes(t), "maxsize", maxbuf,
 	    "freepct", free_pct);
 	(void) printf("\tIn-memory histogram:\n");
 	dump_histogram(rt->rt_histogram, RANGE_TREE_HISTOGRAM_SIZE, 0);
@@ -1229,10 +1230,11 @@ dump_log_spacemaps(spa_t *spa)
 }
 
 static void
-dump_dde(const ddt_t *ddt, const ddt_entry_t *dde, uint64_t index)
+dump_dde(const ddt_t *ddt, const ddt_lightweight_entry_t *ddlwe,
+    uint64_t index)
 {
-	const ddt_phys_t *ddp = dde->dde_phys;
-	const ddt_key_t *ddk = &dde->dde_key;
+	const ddt_phys_t *ddp = ddlwe->ddlwe_phys;
+	const ddt_key_t *ddk = &ddlwe->ddlwe_key;
 	const char *types[4] = { "ditto", "single", "double", "triple" };
 	char blkbuf[BP_SPRINTF_LEN];
 	blkptr_t blk;
@@ -1275,7 +1277,7 @@ static void
 dump_ddt(ddt_t *ddt, enum ddt_type type, enum ddt_class class)
 {
 	char name[DDT_NAMELEN];
-	ddt_entry_t dde;
+	ddt_lightweight_entry_t ddlwe;
 	uint64_t walk = 0;
 	dmu_object_info_t doi;
 	uint64_t count, dspace, mspace;
@@ -1316,8 +1318,8 @@ dump_ddt(ddt_t *ddt, enum ddt_type type, enum ddt_class class)
 
 	(void) printf("%s contents:\n\n", name);
 
-	while ((error = ddt_object_walk(ddt, type, class, &walk, &dde)) == 0)
-		dump_dde(ddt, &dde, walk);
+	while ((error = ddt_object_walk(ddt, type, class, &walk, &ddlwe)) == 0)
+		dump_dde(ddt, &ddlwe, walk);
 
 	ASSERT3U(error, ==, ENOENT);
 
@@ -1341,6 +1343,15 @@ dump_all_ddts(spa_t *spa)
 				dump_ddt(ddt, type, class);
 			}
 		}
+		if (ddt_log_exists(ddt)) {
+			(void) printf("DDT-log-%s: %llu active, "
+			    "%llu flushing entries\n",
+			    zio_checksum_table[c].ci_name,
+			    (u_longlong_t)avl_numnodes(
+			    &ddt->ddt_log_active->ddl_tree),
+			    (u_longlong_t)avl_numnodes(
+			    &ddt->ddt_log_flushing->ddl_tree));
+		}
 	}
 
 	ddt_get_dedup_stats(spa, &dds_total);
@@ -3649,6 +3660,10 @@ typedef struct zdb_cb {
 	uint64_t	zcb_checkpoint_size;
 	uint64_t	zcb_dedup_asize;
 	uint64_t	zcb_dedup_blocks;
+	uint64_t	zcb_clone_asize;
+	uint64_t	zcb_clone_blocks;
+	boolean_t	zcb_brt_is_active;
+	avl_tree_t	zcb_brt;
 	uint64_t	zcb_embedded_blocks[NUM_BP_EMBEDDED_TYPES];
 	uint64_t	zcb_embedded_histogram[NUM_BP_EMBEDDED_TYPES]
 	    [BPE_PAYLOAD_SIZE + 1];
@@ -3662,6 +3677,30 @@ typedef struct zdb_cb {
 	uint32_t	**zcb_vd_obsolete_counts;
 } zdb_cb_t;
 
+/*
+ * A cloned block seen during traversal, with the number of references
+ * still expected.
+ */
+typedef struct zdb_brt_entry {
+	dva_t		zbre_dva;
+	uint64_t	zbre_refcount;
+	avl_node_t	zbre_node;
+} zdb_brt_entry_t;
+
+static int
+zdb_brt_entry_compare(const void *zcn1, const void *zcn2)
+{
+	const dva_t *dva1 = &((const zdb_brt_entry_t *)zcn1)->zbre_dva;
+	const dva_t *dva2 = &((const zdb_brt_entry_t *)zcn2)->zbre_dva;
+	int cmp;
+
+	cmp = AVL_CMP(DVA_GET_VDEV(dva1), DVA_GET_VDEV(dva2));
+	if (cmp == 0)
+		cmp = AVL_CMP(DVA_GET_OFFSET(dva1), DVA_GET_OFFSET(dva2));
+
+	return (cmp);
+}
+
 /* test if two DVA offsets from same vdev are within the same metaslab */
 static boolean_t
 same_metaslab(spa_t *spa, uint64_t vdev, uint64_t off1, uint64_t off2)
@@ -3769,6 +3808,41 @@ zdb_count_block(zdb_cb_t *zcb, zilog_t *zilog, const blkptr_t *bp,
 	if (dump_opt['L'])
 		return;
 
+	if (zcb->zcb_brt_is_active && brt_maybe_exists(zcb->zcb_spa, bp)) {
+		/*
+		 * A cloned block is referenced more than once; it is only
+		 * claimed with its last reference.
+		 */
+		zdb_brt_entry_t *zbre, zbre_search;
+		avl_index_t where;
+		uint64_t brtrefcnt;
+
+		zbre_search.zbre_dva = bp->blk_dva[0];
+		zbre = avl_find(&zcb->zcb_brt, &zbre_search, &where);
+		if (zbre == NULL) {
+			brtrefcnt = brt_entry_get_refcount(zcb->zcb_spa, bp);
+			if (brtrefcnt > 0) {
+				zbre = umem_zalloc(sizeof (zdb_brt_entry_t),
+				    UMEM_NOFAIL);
+				zbre->zbre_dva = bp->blk_dva[0];
+				zbre->zbre_refcount = brtrefcnt;
+				avl_insert(&zcb->zcb_brt, zbre, where);
+			}
+		} else {
+			if (--zbre->zbre_refcount == 0) {
+				avl_remove(&zcb->zcb_brt, zbre);
+				umem_free(zbre, sizeof (zdb_brt_entry_t));
+				zbre = NULL;
+			}
+		}
+
+		if (zbre != NULL) {
+			zcb->zcb_clone_asize += BP_GET_ASIZE(bp);
+			zcb->zcb_clone_blocks++;
+			return;
+		}
+	}
+
 	if (BP_GET_DEDUP(bp)) {
 		ddt_t *ddt;
 		ddt_entry_t *dde;
@@ -4063,7 +4137,7 @@ zdb_claim_removing(spa_t *spa, zdb_cb_t *zcb)
 
 	ASSERT0(range_tree_space(svr->svr_allocd_segs));
 
-	range_tree_t *allocs = range_tree_create(NULL, NULL);
+	range_tree_t *allocs = range_tree_create(NULL, RANGE_SEG64, NULL, 0, 0);
 	for (uint64_t msi = 0; msi < vd->vdev_ms_count; msi++) {
 		metaslab_t *msp = vd->vdev_ms[msi];
 
@@ -4153,46 +4227,68 @@ zdb_load_obsolete_counts(vdev_t *vd)
 	return (counts);
 }
 
+static void
+zdb_ddt_leak_entry(spa_t *spa, zdb_cb_t *zcb, enum zio_checksum checksum,
+    ddt_lightweight_entry_t *ddlwe)
+{
+	ddt_t *ddt = spa->spa_ddt[checksum];
+	ddt_phys_t *ddp = ddlwe->ddlwe_phys;
+	uint64_t refcnt = 0;
+	blkptr_t blk;
+
+	for (int p = 0; p < DDT_PHYS_TYPES; p++, ddp++) {
+		if (p != DDT_PHYS_DITTO)
+			refcnt += ddp->ddp_refcnt;
+		if (ddp->ddp_phys_birth == 0)
+			continue;
+		ddt_bp_create(checksum, &ddlwe->ddlwe_key, ddp, &blk);
+		if (p == DDT_PHYS_DITTO) {
+			zdb_count_block(zcb, NULL, &blk, ZDB_OT_DITTO);
+		} else {
+			zcb->zcb_dedup_asize +=
+			    BP_GET_ASIZE(&blk) * (ddp->ddp_refcnt - 1);
+			zcb->zcb_dedup_blocks++;
+		}
+	}
+	ASSERT(refcnt > 1);
+
+	ddt_enter(ddt);
+	VERIFY(ddt_lookup(ddt, &blk, B_TRUE) != NULL);
+	ddt_exit(ddt);
+}
+
 static void
 zdb_ddt_leak_init(spa_t *spa, zdb_cb_t *zcb)
 {
 	ddt_bookmark_t ddb;
-	ddt_entry_t dde;
+	ddt_lightweight_entry_t ddlwe;
 	int error;
-	int p;
 
 	ASSERT(!dump_opt['L']);
 
 	bzero(&ddb, sizeof (ddb));
-	while ((error = ddt_walk(spa, &ddb, &dde)) == 0) {
-		blkptr_t blk;
-		ddt_phys_t *ddp = dde.dde_phys;
-
+	while ((error = ddt_walk(spa, &ddb, &ddlwe)) == 0) {
 		if (ddb.ddb_class == DDT_CLASS_UNIQUE)
-			return;
+			break;
+		zdb_ddt_leak_entry(spa, zcb, ddb.ddb_checksum, &ddlwe);
+	}
+	ASSERT(error == 0 || error == ENOENT);
 
-		ASSERT(ddt_phys_total_refcnt(&dde) > 1);
+	/*
+	 * ddt_walk() skips the entries in the dedup log, so look there
+	 * for the rest of the duplicated blocks.
+	 */
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		uint64_t walk = 0;
 
-		for (p = 0; p < DDT_PHYS_TYPES; p++, ddp++) {
-			if (ddp->ddp_phys_birth == 0)
-				continue;
-			ddt_bp_create(ddb.ddb_checksum,
-			    &dde.dde_key, ddp, &blk);
-			if (p == DDT_PHYS_DITTO) {
-				zdb_count_block(zcb, NULL, &blk, ZDB_OT_DITTO);
-			} else {
-				zcb->zcb_dedup_asize +=
-				    BP_GET_ASIZE(&blk) * (ddp->ddp_refcnt - 1);
-				zcb->zcb_dedup_blocks++;
-			}
+		if (ddt == NULL)
+			continue;
+		while (ddt_log_walk(ddt, &walk, &ddlwe) == 0) {
+			if (ddlwe.ddlwe_class < DDT_CLASS_UNIQUE)
+				zdb_ddt_leak_entry(spa, zcb, c, &ddlwe);
 		}
-		ddt_t *ddt = spa->spa_ddt[ddb.ddb_checksum];
-		ddt_enter(ddt);
-		VERIFY(ddt_lookup(ddt, &blk, B_TRUE) != NULL);
-		ddt_exit(ddt);
 	}
-
-	ASSERT(error == ENOENT);
 }
 
 typedef struct checkpoint_sm_exclude_entry_arg {
@@ -4852,6 +4948,11 @@ dump_block_stats(spa_t *spa)
 	bzero(&zcb, sizeof (zdb_cb_t));
 	zdb_leak_init(spa, &zcb);
 
+	zcb.zcb_brt_is_active = spa_feature_is_active(spa,
+	    SPA_FEATURE_BLOCK_CLONING);
+	avl_create(&zcb.zcb_brt, zdb_brt_entry_compare,
+	    sizeof (zdb_brt_entry_t), offsetof(zdb_brt_entry_t, zbre_node));
+
 	/*
 	 * If there's a deferred-free bplist, process that first.
 	 */
@@ -4919,6 +5020,12 @@ dump_block_stats(spa_t *spa)
 	 */
 	leaks |= zdb_leak_fini(spa, &zcb);
 
+	zdb_brt_entry_t *zbre;
+	void *cookie = NULL;
+	while ((zbre = avl_destroy_nodes(&zcb.zcb_brt, &cookie)) != NULL)
+		umem_free(zbre, sizeof (zdb_brt_entry_t));
+	avl_destroy(&zcb.zcb_brt);
+
 	tzb = &zcb.zcb_type[ZB_TOTAL][ZDB_OT_TOTAL];
 
 	norm_alloc = metaslab_class_get_alloc(spa_normal_class(spa));
@@ -4929,8 +5036,9 @@ dump_block_stats(spa_t *spa)
 	    metaslab_class_get_alloc(spa_special_class(spa)) +
 	    metaslab_class_get_alloc(spa_dedup_class(spa)) +
 	    get_unflushed_alloc_space(spa);
-	total_found = tzb->zb_asize - zcb.zcb_dedup_asize +
-	    zcb.zcb_removing_size + zcb.zcb_checkpoint_size;
+	total_found = tzb->zb_asize - zcb.zcb_dedup_asize -
+	    zcb.zcb_clone_asize + zcb.zcb_removing_size +
+	    zcb.zcb_checkpoint_size;
 
 	if (total_found == total_alloc && !dump_opt['L']) {
 		(void) printf("\n\tNo leaks (block sum matches space"
@@ -4968,6 +5076,9 @@ dump_block_stats(spa_t *spa)
 	    "bp deduped:", (u_longlong_t)zcb.zcb_dedup_asize,
 	    (u_longlong_t)zcb.zcb_dedup_blocks,
 	    (double)zcb.zcb_dedup_asize / tzb->zb_asize + 1.0);
+	(void) printf("\t%-16s %14llu    count: %6llu\n",
+	    "bp cloned:", (u_longlong_t)zcb.zcb_clone_asize,
+	    (u_longlong_t)zcb.zcb_clone_blocks);
 	(void) printf("\t%-16s %14llu     used: %5.2f%%\n", "Normal class:",
 	    (u_longlong_t)norm_alloc, 100.0 * norm_alloc / norm_space);
 
@@ -5944,6 +6055,23 @@ dump_mos_leaks(spa_t *spa)
 		}
 	}
 
+	if (spa->spa_brt != NULL) {
+		brt_t *brt = spa->spa_brt;
+		for (uint64_t vdevid = 0; vdevid < brt->brt_nvdevs; vdevid++) {
+			brt_vdev_t *bv = brt->brt_vdevs[vdevid];
+			if (bv == NULL)
+				continue;
+			mos_obj_refd(bv->bv_mos_brtvdev);
+			mos_obj_refd(bv->bv_mos_entries);
+		}
+	}
+
+	for (uint64_t cksum = 0; cksum < ZIO_CHECKSUM_FUNCTIONS; cksum++) {
+		ddt_t *ddt = spa->spa_ddt[cksum];
+		mos_obj_refd(ddt->ddt_log[0].ddl_object);
+		mos_obj_refd(ddt->ddt_log[1].ddl_object);
+	}
+
 	/*
 	 * Visit all allocated objects and make sure they are referenced.
 	 */
@@ -6088,7 +6216,8 @@ dump_zpool(spa_t *spa)
 
 	if (dump_opt['d'] || dump_opt['i']) {
 		spa_feature_t f;
-		mos_refd_objs = range_tree_create(NULL, NULL);
+		mos_refd_objs = range_tree_create(NULL, RANGE_SEG64, NULL,
+		    0, 0);
 		dump_objset(dp->dp_meta_objset);
 
 		if (dump_opt['d'] >= 3) {
@@ -6529,9 +6658,9 @@ zdb_read_block(char *thing, spa_t *spa)
 				VERIFY0(random_get_pseudo_bytes(lbuf2, lsize));
 
 				if (zio_decompress_data(c, pabd,
-				    lbuf, psize, lsize) == 0 &&
+				    lbuf, psize, lsize, NULL) == 0 &&
 				    zio_decompress_data(c, pabd,
-				    lbuf2, psize, lsize) == 0 &&
+				    lbuf2, psize, lsize, NULL) == 0 &&
 				    bcmp(lbuf, lbuf2, lsize) == 0)
 					break;
 			}
@@ -118,6 +118,7 @@ static int zpool_do_get(int, char **);
 static int zpool_do_set(int, char **);
 
 static int zpool_do_sync(int, char **);
+static int zpool_do_ddt_prune(int, char **);
 
 static int zpool_do_version(int, char **);
 
@@ -171,6 +172,7 @@ typedef enum {
 	HELP_SET,
 	HELP_SPLIT,
 	HELP_SYNC,
+	HELP_DDT_PRUNE,
 	HELP_REGUID,
 	HELP_REOPEN,
 	HELP_VERSION,
@@ -315,6 +317,7 @@ static zpool_command_t command_table[] = {
 	{ "get",	zpool_do_get,		HELP_GET		},
 	{ "set",	zpool_do_set,		HELP_SET		},
 	{ "sync",	zpool_do_sync,		HELP_SYNC		},
+	{ "ddtprune",	zpool_do_ddt_prune,	HELP_DDT_PRUNE		},
 	{ NULL },
 	{ "wait",	zpool_do_wait,		HELP_WAIT		},
 };
@@ -336,7 +339,7 @@ get_usage(zpool_help_t idx)
 		return (gettext("\tadd [-fgLnP] [-o property=value] "
 		    "<pool> <vdev> ...\n"));
 	case HELP_ATTACH:
-		return (gettext("\tattach [-fw] [-o property=value] "
+		return (gettext("\tattach [-fsw] [-o property=value] "
 		    "<pool> <device> <new-device>\n"));
 	case HELP_CLEAR:
 		return (gettext("\tclear [-nF] <pool> [device]\n"));
@@ -379,7 +382,7 @@ get_usage(zpool_help_t idx)
 	case HELP_ONLINE:
 		return (gettext("\tonline [-e] <pool> <device> ...\n"));
 	case HELP_REPLACE:
-		return (gettext("\treplace [-fw] [-o property=value] "
+		return (gettext("\treplace [-fsw] [-o property=value] "
 		    "<pool> <device> [new-device]\n"));
 	case HELP_REMOVE:
 		return (gettext("\tremove [-npsw] <pool> <device> ...\n"));
@@ -418,6 +421,8 @@ get_usage(zpool_help_t idx)
 		return (gettext("\treguid <pool>\n"));
 	case HELP_SYNC:
 		return (gettext("\tsync [pool] ...\n"));
+	case HELP_DDT_PRUNE:
+		return (gettext("\tddtprune -p <percent> <pool>\n"));
 	case HELP_VERSION:
 		return (gettext("\tversion\n"));
 	case HELP_WAIT:
@@ -3499,6 +3504,76 @@ zpool_do_sync(int argc, char **argv)
 	return (ret);
 }
 
+/*
+ * zpool ddtprune -p <percent> <pool>
+ *
+ *	-p	Percentage of the unique entries to remove.
+ *
+ * Remove the oldest unique (single reference) entries from the pool's
+ * dedup tables.  The blocks they describe are kept, but are no longer
+ * deduplicated.
+ */
+static int
+zpool_do_ddt_prune(int argc, char **argv)
+{
+	zpool_handle_t *zhp;
+	uint64_t percentage = 0;
+	char *end;
+	int c, err;
+
+	while ((c = getopt(argc, argv, "p:")) != -1) {
+		switch (c) {
+		case 'p':
+			errno = 0;
+			percentage = strtoull(optarg, &end, 10);
+			if (errno != 0 || *end != '\0' ||
+			    percentage == 0 || percentage > 100) {
+				(void) fprintf(stderr, gettext("invalid "
+				    "percentage '%s': must be between 1 and "
+				    "100\n"), optarg);
+				usage(B_FALSE);
+			}
+			break;
+		case ':':
+			(void) fprintf(stderr, gettext("missing argument for "
+			    "'%c' option\n"), optopt);
+			usage(B_FALSE);
+			break;
+		case '?':
+			(void) fprintf(stderr, gettext("invalid option '%c'\n"),
+			    optopt);
+			usage(B_FALSE);
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (percentage == 0) {
+		(void) fprintf(stderr, gettext("missing -p option\n"));
+		usage(B_FALSE);
+	}
+
+	if (argc < 1) {
+		(void) fprintf(stderr, gettext("missing pool argument\n"));
+		usage(B_FALSE);
+	}
+
+	if (argc > 1) {
+		(void) fprintf(stderr, gettext("too many arguments\n"));
+		usage(B_FALSE);
+	}
+
+	if ((zhp = zpool_open(g_zfs, argv[0])) == NULL)
+		return (1);
+
+	err = (zpool_ddt_prune(zhp, percentage) != 0);
+
+	zpool_close(zhp);
+
+	return (err);
+}
+
 typedef struct iostat_cbdata {
 	uint64_t cb_flags;
 	int cb_name_flags;
@@ -6009,6 +6084,7 @@ static int
 zpool_do_attach_or_replace(int argc, char **argv, int replacing)
 {
 	boolean_t force = B_FALSE;
+	boolean_t rebuild = B_FALSE;
 	boolean_t wait = B_FALSE;
 	int c;
 	nvlist_t *nvroot;
@@ -6019,7 +6095,7 @@ zpool_do_attach_or_replace(int argc, char **argv, int replacing)
 	int ret;
 
 	/* check options */
-	while ((c = getopt(argc, argv, "fo:w")) != -1) {
+	while ((c = getopt(argc, argv, "fo:sw")) != -1) {
 		switch (c) {
 		case 'f':
 			force = B_TRUE;
@@ -6037,6 +6113,9 @@ zpool_do_attach_or_replace(int argc, char **argv, int replacing)
 			    (add_prop_list(optarg, propval, &props, B_TRUE)))
 				usage(B_FALSE);
 			break;
+		case 's':
+			rebuild = B_TRUE;
+			break;
 		case 'w':
 			wait = B_TRUE;
 			break;
@@ -6121,7 +6200,8 @@ zpool_do_attach_or_replace(int argc, char **argv, int replacing)
 		return (1);
 	}
 
-	ret = zpool_vdev_attach(zhp, old_disk, new_disk, nvroot, replacing);
+	ret = zpool_vdev_attach(zhp, old_disk, new_disk, nvroot, replacing,
+	    rebuild);
 
 	if (ret == 0 && wait)
 		ret = zpool_wait(zhp,
@@ -6135,9 +6215,10 @@ zpool_do_attach_or_replace(int argc, char **argv, int replacing)
 }
 
 /*
- * zpool replace [-fw] [-o property=value] <pool> <device> <new_device>
+ * zpool replace [-fsw] [-o property=value] <pool> <device> <new_device>
  *
  *	-f	Force attach, even if <new_device> appears to be in use.
+ *	-s	Use sequential instead of healing reconstruction for resilver.
  *	-o	Set property=value.
  *	-w	Wait for replacing to complete before returning
  *
@@ -6151,9 +6232,10 @@ zpool_do_replace(int argc, char **argv)
 }
 
 /*
- * zpool attach [-fw] [-o property=value] <pool> <device> <new_device>
+ * zpool attach [-fsw] [-o property=value] <pool> <device> <new_device>
  *
  *	-f	Force attach, even if <new_device> appears to be in use.
+ *	-s	Use sequential instead of healing reconstruction for resilver.
  *	-o	Set property=value.
  *	-w	Wait for resilvering to complete before returning
  *
@@ -7010,10 +7092,11 @@ zpool_do_trim(int argc, char **argv)
 }
 
 /*
- * Print out detailed scrub status.
+ * Print out detailed scrub status.  When 'rebuilding' is set and no scan has
+ * ever been requested the sequential rebuild status is reported instead.
  */
 static void
-print_scan_status(pool_scan_stat_t *ps)
+print_scan_status(pool_scan_stat_t *ps, boolean_t rebuilding)
 {
 	time_t start, end, pause;
 	uint64_t total_secs_left;
@@ -7024,15 +7107,16 @@ print_scan_status(pool_scan_stat_t *ps)
 	char processed_buf[7], scanned_buf[7], issued_buf[7], total_buf[7];
 	char srate_buf[7], irate_buf[7];
 
-	(void) printf(gettext("  scan: "));
-
 	/* If there's never been a scan, there's not much to say. */
 	if (ps == NULL || ps->pss_func == POOL_SCAN_NONE ||
 	    ps->pss_func >= POOL_SCAN_FUNCS) {
-		(void) printf(gettext("none requested\n"));
+		if (!rebuilding)
+			(void) printf(gettext("  scan: none requested\n"));
 		return;
 	}
 
+	(void) printf(gettext("  scan: "));
+
 	start = ps->pss_start_time;
 	end = ps->pss_end_time;
 	pause = ps->pss_pass_scrub_pause;
@@ -7160,6 +7244,146 @@ print_scan_status(pool_scan_stat_t *ps)
 	}
 }
 
+/*
+ * Print out the sequential rebuild status of a single top-level vdev.
+ */
+static void
+print_rebuild_status_impl(vdev_rebuild_stat_t *vrs, char *vdev_name)
+{
+	time_t start = vrs->vrs_start_time;
+	time_t end = vrs->vrs_end_time;
+	uint64_t total_secs_left;
+	uint64_t days_left, hours_left, mins_left, secs_left;
+	char bytes_rebuilt_buf[7], scanned_buf[7], issued_buf[7];
+	char total_buf[7], srate_buf[7], irate_buf[7];
+
+	zfs_nicebytes(vrs->vrs_bytes_rebuilt, bytes_rebuilt_buf,
+	    sizeof (bytes_rebuilt_buf));
+
+	(void) printf(gettext("  scan: "));
+
+	if (vrs->vrs_state == VDEV_REBUILD_COMPLETE) {
+		total_secs_left = vrs->vrs_scan_time_ms / 1000;
+		days_left = total_secs_left / 60 / 60 / 24;
+		hours_left = (total_secs_left / 60 / 60) % 24;
+		mins_left = (total_secs_left / 60) % 60;
+		secs_left = (total_secs_left % 60);
+
+		(void) printf(gettext("resilvered (%s) %s in %llu days "
+		    "%02llu:%02llu:%02llu with %llu errors on %s"), vdev_name,
+		    bytes_rebuilt_buf, (u_longlong_t)days_left,
+		    (u_longlong_t)hours_left, (u_longlong_t)mins_left,
+		    (u_longlong_t)secs_left, (u_longlong_t)vrs->vrs_errors,
+		    ctime(&end));
+		return;
+	} else if (vrs->vrs_state == VDEV_REBUILD_CANCELED) {
+		(void) printf(gettext("resilver (%s) canceled on %s"),
+		    vdev_name, ctime(&end));
+		return;
+	}
+
+	assert(vrs->vrs_state == VDEV_REBUILD_ACTIVE);
+
+	(void) printf(gettext("resilver (%s) in progress since %s"),
+	    vdev_name, ctime(&start));
+
+	uint64_t scanned = vrs->vrs_bytes_scanned;
+	uint64_t issued = vrs->vrs_bytes_issued;
+	uint64_t total = vrs->vrs_bytes_est;
+	uint64_t elapsed = vrs->vrs_pass_time_ms / 1000;
+	elapsed = (elapsed != 0) ? elapsed : 1;
+
+	uint64_t scan_rate = vrs->vrs_pass_bytes_scanned / elapsed;
+	uint64_t issue_rate = vrs->vrs_pass_bytes_issued / elapsed;
+	double fraction_done = (total != 0) ? (double)scanned / total : 0;
+
+	total_secs_left = (issue_rate != 0 && total >= scanned) ?
+	    ((total - scanned) / issue_rate) : UINT64_MAX;
+	days_left = total_secs_left / 60 / 60 / 24;
+	hours_left = (total_secs_left / 60 / 60) % 24;
+	mins_left = (total_secs_left / 60) % 60;
+	secs_left = (total_secs_left % 60);
+
+	zfs_nicebytes(scanned, scanned_buf, sizeof (scanned_buf));
+	zfs_nicebytes(issued, issued_buf, sizeof (issued_buf));
+	zfs_nicebytes(total, total_buf, sizeof (total_buf));
+	zfs_nicebytes(scan_rate, srate_buf, sizeof (srate_buf));
+	zfs_nicebytes(issue_rate, irate_buf, sizeof (irate_buf));
+
+	(void) printf(gettext("\t%s scanned at %s/s, %s issued at %s/s, "
+	    "%s total\n"), scanned_buf, srate_buf, issued_buf, irate_buf,
+	    total_buf);
+	(void) printf(gettext("\t%s resilvered, %.2f%% done"),
+	    bytes_rebuilt_buf, 100 * fraction_done);
+
+	if (total_secs_left != UINT64_MAX && issue_rate >= 10 * 1024 * 1024) {
+		(void) printf(gettext(", %llu days %02llu:%02llu:%02llu "
+		    "to go\n"), (u_longlong_t)days_left,
+		    (u_longlong_t)hours_left, (u_longlong_t)mins_left,
+		    (u_longlong_t)secs_left);
+	} else {
+		(void) printf(gettext(", no estimated completion time\n"));
+	}
+}
+
+/*
+ * Print the sequential rebuild status for every top-level vdev which has
+ * been rebuilt.
+ */
+static void
+print_rebuild_status(zpool_handle_t *zhp, nvlist_t *nvroot)
+{
+	nvlist_t **child;
+	uint_t children;
+
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		children = 0;
+
+	for (uint_t c = 0; c < children; c++) {
+		vdev_rebuild_stat_t *vrs;
+		uint_t i;
+
+		if (nvlist_lookup_uint64_array(child[c],
+		    ZPOOL_CONFIG_REBUILD_STATS, (uint64_t **)&vrs, &i) != 0)
+			continue;
+
+		if (vrs->vrs_state == VDEV_REBUILD_NONE)
+			continue;
+
+		char *name = zpool_vdev_name(g_zfs, zhp, child[c],
+		    VDEV_NAME_TYPE_ID);
+		print_rebuild_status_impl(vrs, name);
+		free(name);
+	}
+}
+
+/*
+ * Returns B_TRUE if any top-level vdev reports sequential rebuild stats.
+ */
+static boolean_t
+has_rebuild_status(nvlist_t *nvroot)
+{
+	nvlist_t **child;
+	uint_t children;
+
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		return (B_FALSE);
+
+	for (uint_t c = 0; c < children; c++) {
+		vdev_rebuild_stat_t *vrs;
+		uint_t i;
+
+		if (nvlist_lookup_uint64_array(child[c],
+		    ZPOOL_CONFIG_REBUILD_STATS, (uint64_t **)&vrs, &i) == 0 &&
+		    vrs->vrs_state != VDEV_REBUILD_NONE)
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
 /*
  * As we don't scrub checkpointed blocks, we want to warn the
  * user that we skipped scanning some blocks if a checkpoint exists
@@ -7299,6 +7523,91 @@ print_removal_status(zpool_handle_t *zhp, pool_removal_stat_t *prs)
 	}
 }
 
+/*
+ * Print out the expansion status of every raidz vdev which has been
+ * expanded.
+ */
+static void
+print_raidz_expand_status(zpool_handle_t *zhp, nvlist_t *nvroot)
+{
+	nvlist_t **child;
+	uint_t children;
+
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		children = 0;
+
+	for (uint_t c = 0; c < children; c++) {
+		vdev_raidz_expand_stat_t *vres;
+		char copied_buf[7], total_buf[7], rate_buf[7];
+		time_t start, end;
+		uint_t i;
+
+		if (nvlist_lookup_uint64_array(child[c],
+		    ZPOOL_CONFIG_RAIDZ_EXPAND_STATS, (uint64_t **)&vres,
+		    &i) != 0 || vres->vres_state == VDEV_RAIDZ_EXPAND_NONE)
+			continue;
+
+		char *name = zpool_vdev_name(g_zfs, zhp, child[c],
+		    VDEV_NAME_TYPE_ID);
+
+		(void) printf(gettext("expand: "));
+
+		start = vres->vres_start_time;
+		end = vres->vres_end_time;
+		zfs_nicenum(vres->vres_reflowed, copied_buf,
+		    sizeof (copied_buf));
+
+		if (vres->vres_state == VDEV_RAIDZ_EXPAND_COMPLETE) {
+			uint64_t minutes_taken = (end - start) / 60;
+
+			(void) printf(gettext("Expansion of %s to %llu "
+			    "devices copied %s in %lluh%um with %llu errors, "
+			    "completed on %s"), name,
+			    (u_longlong_t)vres->vres_children, copied_buf,
+			    (u_longlong_t)(minutes_taken / 60),
+			    (uint_t)(minutes_taken % 60),
+			    (u_longlong_t)vres->vres_errors, ctime(&end));
+			free(name);
+			continue;
+		}
+
+		assert(vres->vres_state == VDEV_RAIDZ_EXPAND_ACTIVE);
+
+		(void) printf(gettext("Expansion of %s to %llu devices in "
+		    "progress since %s"), name,
+		    (u_longlong_t)vres->vres_children, ctime(&start));
+
+		uint64_t copied = vres->vres_reflowed > 0 ?
+		    vres->vres_reflowed : 1;
+		uint64_t total = MAX(vres->vres_to_reflow, copied);
+		double fraction_done = (double)copied / total;
+
+		uint64_t elapsed = time(NULL) - start;
+		elapsed = elapsed > 0 ? elapsed : 1;
+		uint64_t rate = copied / elapsed;
+		rate = rate > 0 ? rate : 1;
+		uint64_t mins_left = ((total - copied) / rate) / 60;
+		uint64_t hours_left = mins_left / 60;
+
+		zfs_nicenum(copied, copied_buf, sizeof (copied_buf));
+		zfs_nicenum(total, total_buf, sizeof (total_buf));
+		zfs_nicenum(rate, rate_buf, sizeof (rate_buf));
+
+		(void) printf(gettext("    %s copied out of %s at %s/s, "
+		    "%.2f%% done"), copied_buf, total_buf, rate_buf,
+		    100 * fraction_done);
+		if (hours_left < (30 * 24)) {
+			(void) printf(gettext(", %lluh%um to go\n"),
+			    (u_longlong_t)hours_left, (uint_t)(mins_left % 60));
+		} else {
+			(void) printf(gettext(
+			    ", (copy is slow, no estimated time)\n"));
+		}
+		free(name);
+	}
+}
+
 static void
 print_checkpoint_status(pool_checkpoint_stat_t *pcs)
 {
@@ -7783,9 +8092,11 @@ status_callback(zpool_handle_t *zhp, void *data)
 		(void) nvlist_lookup_uint64_array(nvroot,
 		    ZPOOL_CONFIG_REMOVAL_STATS, (uint64_t **)&prs, &c);
 
-		print_scan_status(ps);
+		print_scan_status(ps, has_rebuild_status(nvroot));
+		print_rebuild_status(zhp, nvroot);
 		print_checkpoint_scan_warning(ps, pcs);
 		print_removal_status(zhp, prs);
+		print_raidz_expand_status(zhp, nvroot);
 		print_checkpoint_status(pcs);
 
 		cbp->cb_namewidth = max_width(zhp, nvroot, 0, 0,
@@ -9342,6 +9653,34 @@ vdev_initialize_remaining(nvlist_t *nv)
 	return (bytes_remaining);
 }
 
+/* Add up the total number of bytes left to rebuild across top-level vdevs */
+static uint64_t
+vdev_rebuild_remaining(nvlist_t *nvroot)
+{
+	uint64_t bytes_remaining = 0;
+	nvlist_t **child;
+	uint_t c, children;
+
+	if (nvlist_lookup_nvlist_array(nvroot, ZPOOL_CONFIG_CHILDREN,
+	    &child, &children) != 0)
+		children = 0;
+
+	for (c = 0; c < children; c++) {
+		vdev_rebuild_stat_t *vrs;
+		uint_t i;
+
+		if (nvlist_lookup_uint64_array(child[c],
+		    ZPOOL_CONFIG_REBUILD_STATS, (uint64_t **)&vrs, &i) == 0 &&
+		    vrs->vrs_state == VDEV_REBUILD_ACTIVE &&
+		    vrs->vrs_bytes_est > vrs->vrs_bytes_scanned) {
+			bytes_remaining += vrs->vrs_bytes_est -
+			    vrs->vrs_bytes_scanned;
+		}
+	}
+
+	return (bytes_remaining);
+}
+
 /* Whether any vdevs are 'spare' or 'replacing' vdevs */
 static boolean_t
 vdev_any_spare_replacing(nvlist_t *nv)
@@ -9451,6 +9790,7 @@ print_wait_status_row(wait_data_t *wd, zpool_handle_t *zhp, int row)
 			bytes_rem[ZPOOL_WAIT_RESILVER] = rem;
 	}
 
+	bytes_rem[ZPOOL_WAIT_RESILVER] += vdev_rebuild_remaining(nvroot);
 	bytes_rem[ZPOOL_WAIT_INITIALIZE] = vdev_initialize_remaining(nvroot);
 
 	/*
@@ -115,6 +115,7 @@
 #include <sys/dsl_dataset.h>
 #include <sys/dsl_destroy.h>
 #include <sys/dsl_scan.h>
+#include <sys/ddt.h>
 #include <sys/zio_checksum.h>
 #include <sys/refcount.h>
 #include <sys/zfeature.h>
@@ -268,9 +269,9 @@ typedef struct bufwad {
  * still need to map from object ID to rangelock_t.
  */
 typedef enum {
-	RL_READER,
-	RL_WRITER,
-	RL_APPEND
+	ZTRL_READER,
+	ZTRL_WRITER,
+	ZTRL_APPEND
 } rl_type_t;
 
 typedef struct rll {
@@ -354,6 +355,8 @@ ztest_func_t ztest_zil_remount;
 ztest_func_t ztest_dmu_read_write_zcopy;
 ztest_func_t ztest_dmu_objset_create_destroy;
 ztest_func_t ztest_dmu_prealloc;
+ztest_func_t ztest_dmu_direct;
+ztest_func_t ztest_bclone;
 ztest_func_t ztest_fzap;
 ztest_func_t ztest_dmu_snapshot_create_destroy;
 ztest_func_t ztest_dsl_prop_get_set;
@@ -363,6 +366,7 @@ ztest_func_t ztest_fault_inject;
 ztest_func_t ztest_dmu_snapshot_hold;
 ztest_func_t ztest_mmp_enable_disable;
 ztest_func_t ztest_scrub;
+ztest_func_t ztest_ddt_prune;
 ztest_func_t ztest_dsl_dataset_promote_busy;
 ztest_func_t ztest_vdev_attach_detach;
 ztest_func_t ztest_vdev_LUN_growth;
@@ -371,6 +375,7 @@ ztest_func_t ztest_vdev_class_add;
 ztest_func_t ztest_vdev_aux_add_remove;
 ztest_func_t ztest_split_pool;
 ztest_func_t ztest_reguid;
+ztest_func_t ztest_arc_read_hits;
 ztest_func_t ztest_spa_upgrade;
 ztest_func_t ztest_device_removal;
 ztest_func_t ztest_spa_checkpoint_create_discard;
@@ -410,6 +415,8 @@ ztest_info_t ztest_info[] = {
 #if 0
 	ZTI_INIT(ztest_dmu_prealloc, 1, &zopt_sometimes),
 #endif
+	ZTI_INIT(ztest_dmu_direct, 1, &zopt_sometimes),
+	ZTI_INIT(ztest_bclone, 1, &zopt_often),
 	ZTI_INIT(ztest_fzap, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_dmu_snapshot_create_destroy, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_spa_create_destroy, 1, &zopt_sometimes),
@@ -417,7 +424,9 @@ ztest_info_t ztest_info[] = {
 	ZTI_INIT(ztest_dmu_snapshot_hold, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_mmp_enable_disable, 1, &zopt_sometimes),
 	ZTI_INIT(ztest_reguid, 1, &zopt_rarely),
+	ZTI_INIT(ztest_arc_read_hits, 1, &zopt_rarely),
 	ZTI_INIT(ztest_scrub, 1, &zopt_rarely),
+	ZTI_INIT(ztest_ddt_prune, 1, &zopt_rarely),
 	ZTI_INIT(ztest_spa_upgrade, 1, &zopt_rarely),
 	ZTI_INIT(ztest_dsl_dataset_promote_busy, 1, &zopt_rarely),
 	ZTI_INIT(ztest_vdev_attach_detach, 1, &zopt_sometimes),
@@ -1379,7 +1388,7 @@ ztest_rll_lock(rll_t *rll, rl_type_t type)
 {
 	mutex_enter(&rll->rll_lock);
 
-	if (type == RL_READER) {
+	if (type == ZTRL_READER) {
 		while (rll->rll_writer != NULL)
 			(void) cv_wait(&rll->rll_cv, &rll->rll_lock);
 		rll->rll_readers++;
@@ -1835,7 +1844,7 @@ ztest_replay_remove(void *arg1, void *arg2, boolean_t byteswap)
 	    zap_lookup(os, lr->lr_doid, name, sizeof (object), 1, &object));
 	ASSERT(object != 0);
 
-	ztest_object_lock(zd, object, RL_WRITER);
+	ztest_object_lock(zd, object, ZTRL_WRITER);
 
 	VERIFY3U(0, ==, dmu_object_info(os, object, &doi));
 
@@ -1905,8 +1914,8 @@ ztest_replay_write(void *arg1, void *arg2, boolean_t byteswap)
 	if (bt->bt_magic != BT_MAGIC)
 		bt = NULL;
 
-	ztest_object_lock(zd, lr->lr_foid, RL_READER);
-	rl = ztest_range_lock(zd, lr->lr_foid, offset, length, RL_WRITER);
+	ztest_object_lock(zd, lr->lr_foid, ZTRL_READER);
+	rl = ztest_range_lock(zd, lr->lr_foid, offset, length, ZTRL_WRITER);
 
 	VERIFY3U(0, ==, dmu_bonus_hold(os, lr->lr_foid, FTAG, &db));
 
@@ -2008,9 +2017,9 @@ ztest_replay_truncate(void *arg1, void *arg2, boolean_t byteswap)
 	if (byteswap)
 		byteswap_uint64_array(lr, sizeof (*lr));
 
-	ztest_object_lock(zd, lr->lr_foid, RL_READER);
+	ztest_object_lock(zd, lr->lr_foid, ZTRL_READER);
 	rl = ztest_range_lock(zd, lr->lr_foid, lr->lr_offset, lr->lr_length,
-	    RL_WRITER);
+	    ZTRL_WRITER);
 
 	tx = dmu_tx_create(os);
 
@@ -2050,7 +2059,7 @@ ztest_replay_setattr(void *arg1, void *arg2, boolean_t byteswap)
 	if (byteswap)
 		byteswap_uint64_array(lr, sizeof (*lr));
 
-	ztest_object_lock(zd, lr->lr_foid, RL_WRITER);
+	ztest_object_lock(zd, lr->lr_foid, ZTRL_WRITER);
 
 	VERIFY3U(0, ==, dmu_bonus_hold(os, lr->lr_foid, FTAG, &db));
 
@@ -2174,7 +2183,7 @@ ztest_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb,
 	ASSERT3P(zio, !=, NULL);
 	ASSERT3U(size, !=, 0);
 
-	ztest_object_lock(zd, object, RL_READER);
+	ztest_object_lock(zd, object, ZTRL_READER);
 	error = dmu_bonus_hold(os, object, FTAG, &db);
 	if (error) {
 		ztest_object_unlock(zd, object);
@@ -2199,7 +2208,7 @@ ztest_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb,
 
 	if (buf != NULL) {	/* immediate write */
 		zgd->zgd_lr = (struct locked_range *)ztest_range_lock(zd,
-		    object, offset, size, RL_READER);
+		    object, offset, size, ZTRL_READER);
 
 		error = dmu_read(os, object, offset, size, buf,
 		    DMU_READ_NO_PREFETCH);
@@ -2214,7 +2223,7 @@ ztest_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb,
 		}
 
 		zgd->zgd_lr = (struct locked_range *)ztest_range_lock(zd,
-		    object, offset, size, RL_READER);
+		    object, offset, size, ZTRL_READER);
 
 		error = dmu_buf_hold(os, object, offset, zgd, &db,
 		    DMU_READ_NO_PREFETCH);
@@ -2291,7 +2300,7 @@ ztest_lookup(ztest_ds_t *zd, ztest_od_t *od, int count)
 			ASSERT(od->od_object != 0);
 			ASSERT(missing == 0);	/* there should be no gaps */
 
-			ztest_object_lock(zd, od->od_object, RL_READER);
+			ztest_object_lock(zd, od->od_object, ZTRL_READER);
 			VERIFY3U(0, ==, dmu_bonus_hold(zd->zd_os,
 			    od->od_object, FTAG, &db));
 			dmu_object_info_from_db(db, &doi);
@@ -2464,8 +2473,8 @@ ztest_prealloc(ztest_ds_t *zd, uint64_t object, uint64_t offset, uint64_t size)
 
 	txg_wait_synced(dmu_objset_pool(os), 0);
 
-	ztest_object_lock(zd, object, RL_READER);
-	rl = ztest_range_lock(zd, object, offset, size, RL_WRITER);
+	ztest_object_lock(zd, object, ZTRL_READER);
+	rl = ztest_range_lock(zd, object, offset, size, ZTRL_WRITER);
 
 	tx = dmu_tx_create(os);
 
@@ -3341,6 +3350,7 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 	int newvd_is_spare = B_FALSE;
 	int oldvd_is_log;
 	int error, expected_error;
+	int rebuilding = B_FALSE;
 
 	if (ztest_opts.zo_mmp_test)
 		return;
@@ -3370,6 +3380,12 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 	 */
 	replacing = ztest_random(2);
 
+	/*
+	 * Decide whether to do a healing or sequential resilver.
+	 */
+	if (spa_feature_is_enabled(spa, SPA_FEATURE_DEVICE_REBUILD))
+		rebuilding = ztest_random(2);
+
 	/*
 	 * Pick a random top-level vdev.
 	 */
@@ -3482,6 +3498,9 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 	    pvd->vdev_ops == &vdev_replacing_ops ||
 	    pvd->vdev_ops == &vdev_spare_ops))
 		expected_error = ENOTSUP;
+	else if (rebuilding && (ztest_opts.zo_raidz > 1 ||
+	    (pvd != rvd && pvd->vdev_top->vdev_ops != &vdev_mirror_ops)))
+		expected_error = ENOTSUP;
 	else if (newvd_is_spare && (!replacing || oldvd_is_log))
 		expected_error = ENOTSUP;
 	else if (newvd == oldvd)
@@ -3503,7 +3522,7 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 	root = make_vdev_root(newpath, NULL, NULL, newvd == NULL ? newsize : 0,
 	    ashift, NULL, 0, 0, 1);
 
-	error = spa_vdev_attach(spa, oldguid, root, replacing);
+	error = spa_vdev_attach(spa, oldguid, root, replacing, rebuilding);
 
 	nvlist_free(root);
 
@@ -3523,15 +3542,17 @@ ztest_vdev_attach_detach(ztest_ds_t *zd, uint64_t id)
 		expected_error = error;
 
 	if (error == ZFS_ERR_CHECKPOINT_EXISTS ||
-	    error == ZFS_ERR_DISCARDING_CHECKPOINT)
+	    error == ZFS_ERR_DISCARDING_CHECKPOINT ||
+	    error == ZFS_ERR_RESILVER_IN_PROGRESS ||
+	    error == ZFS_ERR_REBUILD_IN_PROGRESS)
 		expected_error = error;
 
 	/* XXX workaround 6690467 */
 	if (error != expected_error && expected_error != EBUSY) {
-		fatal(0, "attach (%s %llu, %s %llu, %d) "
+		fatal(0, "attach (%s %llu, %s %llu, %d, %d) "
 		    "returned %d, expected %d",
 		    oldpath, oldsize, newpath,
-		    newsize, replacing, error, expected_error);
+		    newsize, replacing, rebuilding, error, expected_error);
 	}
 out:
 	mutex_exit(&ztest_vdev_lock);
@@ -4959,6 +4980,206 @@ ztest_dmu_prealloc(ztest_ds_t *zd, uint64_t id)
 	umem_free(od, sizeof (ztest_od_t));
 }
 
+/*
+ * Write whole blocks with dmu_write_direct(), optionally overwrite part of
+ * them through the dbuf in the same txg, and verify both the buffered and
+ * the direct read paths return the same data before and after the txg
+ * syncs.
+ */
+void
+ztest_dmu_direct(ztest_ds_t *zd, uint64_t id)
+{
+	objset_t *os = zd->zd_os;
+	ztest_od_t *od;
+	dmu_object_info_t doi;
+	dnode_t *dn;
+	dmu_tx_t *tx;
+	rl_t *rl;
+	uint64_t blocksize, size, offset, txg, seed;
+	uint64_t *data, *rdata;
+
+	if (os->os_encrypted)
+		return;
+
+	od = umem_alloc(sizeof (ztest_od_t), UMEM_NOFAIL);
+	ztest_od_init(od, id, FTAG, 0, DMU_OT_UINT64_OTHER,
+	    ztest_random_blocksize(), 0, 0);
+
+	if (ztest_object_init(zd, od, sizeof (ztest_od_t), B_FALSE) != 0) {
+		umem_free(od, sizeof (ztest_od_t));
+		return;
+	}
+
+	VERIFY0(dmu_object_info(os, od->od_object, &doi));
+	blocksize = doi.doi_data_block_size;
+	size = (ztest_random(4) + 1) * blocksize;
+	offset = ztest_random(64) * blocksize;
+	seed = ztest_random(-1ULL);
+
+	data = umem_alloc_aligned(size, SPA_MINBLOCKSIZE, UMEM_NOFAIL);
+	rdata = umem_alloc_aligned(size, SPA_MINBLOCKSIZE, UMEM_NOFAIL);
+	for (uint64_t i = 0; i < size / sizeof (uint64_t); i++)
+		data[i] = seed ^ (offset + i);
+
+	ztest_object_lock(zd, od->od_object, ZTRL_READER);
+	rl = ztest_range_lock(zd, od->od_object, offset, size, ZTRL_WRITER);
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_write(tx, od->od_object, offset, size);
+	txg = ztest_tx_assign(tx, TXG_MIGHTWAIT, FTAG);
+	if (txg == 0)
+		goto out;
+
+	VERIFY0(dnode_hold(os, od->od_object, FTAG, &dn));
+	if (dmu_write_direct(dn, offset, size, data, tx) != 0)
+		dmu_write(os, od->od_object, offset, size, data, tx);
+
+	if (ztest_random(2) == 0) {
+		uint64_t woff = ztest_random(size / sizeof (uint64_t));
+
+		data[woff] = ~data[woff];
+		dmu_write(os, od->od_object, offset + woff * sizeof (uint64_t),
+		    sizeof (uint64_t), &data[woff], tx);
+	}
+	dmu_tx_commit(tx);
+
+	for (int pass = 0; pass < 2; pass++) {
+		VERIFY0(dmu_read(os, od->od_object, offset, size, rdata,
+		    DMU_READ_NO_PREFETCH));
+		VERIFY0(bcmp(data, rdata, size));
+
+		bzero(rdata, size);
+		VERIFY0(dmu_read_direct(dn, offset, size, rdata));
+		VERIFY0(bcmp(data, rdata, size));
+
+		txg_wait_synced(dmu_objset_pool(os), txg);
+	}
+	dnode_rele(dn, FTAG);
+out:
+	ztest_range_unlock(rl);
+	ztest_object_unlock(zd, od->od_object);
+
+	umem_free(rdata, size);
+	umem_free(data, size);
+	umem_free(od, sizeof (ztest_od_t));
+}
+
+/*
+ * Verify that a cloned range reads back like its source, both before and
+ * after the clone has synced, and that it survives the source being
+ * freed or overwritten.
+ */
+void
+ztest_bclone(ztest_ds_t *zd, uint64_t id)
+{
+	objset_t *os = zd->zd_os;
+	ztest_od_t *od;
+	dmu_object_info_t doi;
+	dmu_tx_t *tx;
+	rl_t *rl1, *rl2;
+	blkptr_t *bps;
+	size_t nbps;
+	uint64_t blocksize, size, srcoff, dstoff, txg, seed;
+	uint64_t *data, *rdata;
+	int error;
+
+	if (os->os_encrypted || !spa_feature_is_enabled(dmu_objset_spa(os),
+	    SPA_FEATURE_BLOCK_CLONING))
+		return;
+
+	/* Only file data can be cloned. */
+	od = umem_alloc(sizeof (ztest_od_t), UMEM_NOFAIL);
+	ztest_od_init(od, id, FTAG, 0, DMU_OT_PLAIN_FILE_CONTENTS,
+	    ztest_random_blocksize(), 0, 0);
+
+	if (ztest_object_init(zd, od, sizeof (ztest_od_t), B_FALSE) != 0) {
+		umem_free(od, sizeof (ztest_od_t));
+		return;
+	}
+
+	VERIFY0(dmu_object_info(os, od->od_object, &doi));
+	blocksize = doi.doi_data_block_size;
+	nbps = ztest_random(4) + 1;
+	size = nbps * blocksize;
+	srcoff = ztest_random(32) * blocksize;
+	dstoff = (32 + ztest_random(32)) * blocksize;
+	seed = ztest_random(-1ULL);
+
+	bps = umem_alloc(nbps * sizeof (blkptr_t), UMEM_NOFAIL);
+	data = umem_alloc(size, UMEM_NOFAIL);
+	rdata = umem_alloc(size, UMEM_NOFAIL);
+	for (uint64_t i = 0; i < size / sizeof (uint64_t); i++)
+		data[i] = seed ^ (srcoff + i);
+
+	ztest_object_lock(zd, od->od_object, ZTRL_READER);
+	rl1 = ztest_range_lock(zd, od->od_object, srcoff, size, ZTRL_WRITER);
+	rl2 = ztest_range_lock(zd, od->od_object, dstoff, size, ZTRL_WRITER);
+
+	/* Write the source and let it reach disk, so it can be cloned. */
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_write(tx, od->od_object, srcoff, size);
+	txg = ztest_tx_assign(tx, TXG_MIGHTWAIT, FTAG);
+	if (txg == 0)
+		goto out;
+	dmu_write(os, od->od_object, srcoff, size, data, tx);
+	dmu_tx_commit(tx);
+	txg_wait_synced(dmu_objset_pool(os), txg);
+
+	error = dmu_read_l0_bps(os, od->od_object, srcoff, size, bps, &nbps);
+	if (error != 0) {
+		/* The pool may have dedup turned on by another test. */
+		VERIFY(error == EOPNOTSUPP || error == EAGAIN);
+		goto out;
+	}
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_write(tx, od->od_object, dstoff, size);
+	txg = ztest_tx_assign(tx, TXG_MIGHTWAIT, FTAG);
+	if (txg == 0)
+		goto out;
+	VERIFY0(dmu_brt_clone(os, od->od_object, dstoff, size, tx, bps,
+	    nbps));
+	dmu_tx_commit(tx);
+
+	for (int pass = 0; pass < 2; pass++) {
+		VERIFY0(dmu_read(os, od->od_object, dstoff, size, rdata,
+		    DMU_READ_NO_PREFETCH));
+		VERIFY0(bcmp(data, rdata, size));
+		txg_wait_synced(dmu_objset_pool(os), txg);
+	}
+
+	/*
+	 * Drop the source's references; the clone must keep the blocks.
+	 */
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_free(tx, od->od_object, srcoff, size);
+	dmu_tx_hold_write(tx, od->od_object, srcoff, size);
+	txg = ztest_tx_assign(tx, TXG_MIGHTWAIT, FTAG);
+	if (txg == 0)
+		goto out;
+	if (ztest_random(2) == 0) {
+		VERIFY0(dmu_free_range(os, od->od_object, srcoff, size, tx));
+	} else {
+		bzero(rdata, size);
+		dmu_write(os, od->od_object, srcoff, size, rdata, tx);
+	}
+	dmu_tx_commit(tx);
+	txg_wait_synced(dmu_objset_pool(os), txg);
+
+	VERIFY0(dmu_read(os, od->od_object, dstoff, size, rdata,
+	    DMU_READ_NO_PREFETCH));
+	VERIFY0(bcmp(data, rdata, size));
+out:
+	ztest_range_unlock(rl2);
+	ztest_range_unlock(rl1);
+	ztest_object_unlock(zd, od->od_object);
+
+	umem_free(rdata, size);
+	umem_free(data, size);
+	umem_free(bps, (size / blocksize) * sizeof (blkptr_t));
+	umem_free(od, sizeof (ztest_od_t));
+}
+
 /*
  * Verify that zap_{create,destroy,add,remove,update} work as expected.
  */
@@ -5498,7 +5719,7 @@ ztest_verify_dnode_bt(ztest_ds_t *zd, uint64_t id)
 		dmu_object_info_t doi;
 		dmu_buf_t *db;
 
-		ztest_object_lock(zd, obj, RL_READER);
+		ztest_object_lock(zd, obj, ZTRL_READER);
 		if (dmu_bonus_hold(os, obj, FTAG, &db) != 0) {
 			ztest_object_unlock(zd, obj);
 			continue;
@@ -5553,6 +5774,8 @@ ztest_spa_prop_get_set(ztest_ds_t *zd, uint64_t id)
 	(void) pthread_rwlock_rdlock(&ztest_name_lock);
 
 	(void) ztest_spa_prop_set_uint64(ZPOOL_PROP_AUTOTRIM, ztest_random(2));
+	(void) ztest_spa_prop_set_uint64(ZPOOL_PROP_DEDUP_TABLE_QUOTA,
+	    ztest_random(2) == 0 ? 0 : DDT_ENTRY_SIZE * ztest_random(1000));
 
 	VERIFY0(spa_prop_get(ztest_spa, &props));
 
@@ -6046,6 +6269,19 @@ ztest_scrub(ztest_ds_t *zd, uint64_t id)
 	ASSERT0(error);
 }
 
+/*
+ * Prune the oldest unique entries from the DDTs.
+ */
+/* ARGSUSED */
+void
+ztest_ddt_prune(ztest_ds_t *zd, uint64_t id)
+{
+	int error;
+
+	error = ddt_prune_unique_entries(ztest_spa, 1 + ztest_random(100));
+	VERIFY(error == 0 || error == ENOSPC);
+}
+
 /*
  * Change the guid for the pool.
  */
@@ -6079,6 +6315,124 @@ ztest_reguid(ztest_ds_t *zd, uint64_t id)
 	VERIFY3U(load, ==, spa_load_guid(spa));
 }
 
+/*
+ * Hammer a single cached block with arc_read() from several threads at
+ * once.  Every read is an ARC hit, so this exercises the hash table
+ * lookup path under contention and reports its cost at verbose level 3.
+ */
+typedef struct ztest_arc_hits {
+	spa_t		*zah_spa;
+	blkptr_t	zah_bp;
+	zbookmark_phys_t zah_zb;
+	void		*zah_data;
+	uint64_t	zah_size;
+	uint64_t	zah_reads;
+} ztest_arc_hits_t;
+
+#define	ZTEST_ARC_HITS_THREADS	8
+#define	ZTEST_ARC_HITS_READS	10000
+
+static void
+ztest_arc_read_hits_thread(void *arg)
+{
+	ztest_arc_hits_t *zah = arg;
+
+	for (int i = 0; i < ZTEST_ARC_HITS_READS; i++) {
+		arc_flags_t aflags = ARC_FLAG_WAIT;
+		arc_buf_t *abuf = NULL;
+
+		if (arc_read(NULL, zah->zah_spa, &zah->zah_bp, arc_getbuf_func,
+		    &abuf, ZIO_PRIORITY_SYNC_READ, ZIO_FLAG_CANFAIL, &aflags,
+		    &zah->zah_zb) != 0 || abuf == NULL)
+			break;
+
+		VERIFY3U(arc_buf_size(abuf), ==, zah->zah_size);
+		VERIFY0(bcmp(abuf->b_data, zah->zah_data, zah->zah_size));
+		arc_buf_destroy(abuf, &abuf);
+		atomic_inc_64(&zah->zah_reads);
+	}
+
+	thread_exit();
+}
+
+void
+ztest_arc_read_hits(ztest_ds_t *zd, uint64_t id)
+{
+	objset_t *os = zd->zd_os;
+	kthread_t *threads[ZTEST_ARC_HITS_THREADS];
+	ztest_arc_hits_t zah;
+	ztest_od_t *od;
+	dmu_buf_t *db;
+	dmu_tx_t *tx;
+	uint64_t blocksize, txg;
+	hrtime_t start, delta;
+
+	od = umem_alloc(sizeof (ztest_od_t), UMEM_NOFAIL);
+	ztest_od_init(od, id, FTAG, 0, DMU_OT_UINT64_OTHER, 0, 0, 0);
+
+	if (ztest_object_init(zd, od, sizeof (ztest_od_t), B_FALSE) != 0) {
+		umem_free(od, sizeof (ztest_od_t));
+		return;
+	}
+	blocksize = od->od_blocksize;
+
+	ztest_object_lock(zd, od->od_object, ZTRL_WRITER);
+
+	bzero(&zah, sizeof (zah));
+	zah.zah_spa = dmu_objset_spa(os);
+	zah.zah_size = blocksize;
+	zah.zah_data = umem_alloc(blocksize, UMEM_NOFAIL);
+	for (uint64_t i = 0; i < blocksize / sizeof (uint64_t); i++)
+		((uint64_t *)zah.zah_data)[i] = ztest_random(-1ULL);
+
+	tx = dmu_tx_create(os);
+	dmu_tx_hold_write(tx, od->od_object, 0, blocksize);
+	txg = ztest_tx_assign(tx, TXG_WAIT, FTAG);
+	if (txg == 0)
+		goto out;
+	dmu_write(os, od->od_object, 0, blocksize, zah.zah_data, tx);
+	dmu_tx_commit(tx);
+	txg_wait_synced(dmu_objset_pool(os), txg);
+
+	if (dmu_buf_hold(os, od->od_object, 0, FTAG, &db,
+	    DMU_READ_NO_PREFETCH) != 0)
+		goto out;
+	if (((dmu_buf_impl_t *)db)->db_blkptr == NULL ||
+	    db->db_size != blocksize) {
+		dmu_buf_rele(db, FTAG);
+		goto out;
+	}
+	zah.zah_bp = *((dmu_buf_impl_t *)db)->db_blkptr;
+	dmu_buf_rele(db, FTAG);
+
+	if (BP_IS_HOLE(&zah.zah_bp) || BP_IS_EMBEDDED(&zah.zah_bp))
+		goto out;
+
+	SET_BOOKMARK(&zah.zah_zb, dmu_objset_id(os), od->od_object, 0, 0);
+
+	start = gethrtime();
+	for (int t = 0; t < ZTEST_ARC_HITS_THREADS; t++) {
+		threads[t] = thread_create(NULL, 0, ztest_arc_read_hits_thread,
+		    &zah, 0, NULL, TS_RUN | TS_JOINABLE, defclsyspri);
+	}
+	for (int t = 0; t < ZTEST_ARC_HITS_THREADS; t++)
+		VERIFY0(thread_join(threads[t]));
+	delta = gethrtime() - start;
+
+	if (ztest_opts.zo_verbose >= 3 && zah.zah_reads != 0) {
+		(void) printf("arc_read hits: %d threads, %llu reads, "
+		    "%llu ns/read\n", ZTEST_ARC_HITS_THREADS,
+		    (u_longlong_t)zah.zah_reads,
+		    (u_longlong_t)(delta * ZTEST_ARC_HITS_THREADS /
+		    zah.zah_reads));
+	}
+
+out:
+	ztest_object_unlock(zd, od->od_object);
+	umem_free(zah.zah_data, blocksize);
+	umem_free(od, sizeof (ztest_od_t));
+}
+
 void
 ztest_fletcher(ztest_ds_t *zd, uint64_t id)
 {
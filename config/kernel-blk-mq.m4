@@ -0,0 +1,38 @@
+dnl #
+dnl # 4.13 API change
+dnl # The blk-mq queue_rq() callback returns a blk_status_t.  Together with
+dnl # BLK_MQ_F_BLOCKING (4.10), which allows queue_rq() to sleep, this is
+dnl # the interface zvols require to be registered as blk-mq devices.
+dnl #
+AC_DEFUN([ZFS_AC_KERNEL_BLK_MQ], [
+	AC_MSG_CHECKING([whether blk-mq is usable for zvols])
+	ZFS_LINUX_TRY_COMPILE([
+		#include <linux/blk-mq.h>
+
+		static blk_status_t
+		queue_rq(struct blk_mq_hw_ctx *hctx,
+		    const struct blk_mq_queue_data *bd)
+		{
+			return (BLK_STS_OK);
+		}
+
+		static const struct blk_mq_ops mq_ops __attribute__ ((unused))
+		    = {
+			.queue_rq = queue_rq,
+		};
+	],[
+		struct blk_mq_tag_set tag_set __attribute__ ((unused)) = {
+			.flags = BLK_MQ_F_BLOCKING,
+		};
+		struct request_queue *q __attribute__ ((unused));
+
+		(void) blk_mq_alloc_tag_set(&tag_set);
+		q = blk_mq_init_queue(&tag_set);
+		blk_mq_free_tag_set(&tag_set);
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_BLK_MQ, 1, [blk-mq is usable for zvols])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
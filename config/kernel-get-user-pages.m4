@@ -0,0 +1,27 @@
+dnl #
+dnl # 4.9 API change
+dnl # get_user_pages_unlocked() takes gup_flags instead of the task,
+dnl # mm, write and force arguments.  Direct I/O is only supported with
+dnl # this interface since get_user_pages_fast() is a GPL-only symbol.
+dnl #
+AC_DEFUN([ZFS_AC_KERNEL_GET_USER_PAGES_UNLOCKED], [
+	AC_MSG_CHECKING([whether get_user_pages_unlocked() takes gup_flags])
+	ZFS_LINUX_TRY_COMPILE([
+		#include <linux/mm.h>
+	],[
+		unsigned long start = 0;
+		unsigned long nr_pages = 1;
+		struct page **pages = NULL;
+		unsigned int gup_flags = FOLL_WRITE;
+		long ret __attribute__ ((unused));
+
+		ret = get_user_pages_unlocked(start, nr_pages, pages,
+		    gup_flags);
+	],[
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_GET_USER_PAGES_UNLOCKED_GUP_FLAGS, 1,
+		    [get_user_pages_unlocked() takes gup_flags])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
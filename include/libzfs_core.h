@@ -133,6 +133,11 @@ int lzc_pool_checkpoint_discard(const char *);
 int lzc_wait(const char *, zpool_wait_activity_t, boolean_t *);
 int lzc_wait_tag(const char *, zpool_wait_activity_t, uint64_t, boolean_t *);
 
+int lzc_ddt_prune(const char *, uint64_t);
+
+int lzc_create_files(const char *, uint64_t, char * const *, uint_t, uint64_t,
+    nvlist_t **);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -45,7 +45,10 @@
 #define	zfs_totalhigh_pages	totalhigh_pages
 #endif
 
+#define	membar_enter()			smp_mb()
+#define	membar_exit()			smp_mb()
 #define	membar_producer()		smp_wmb()
+#define	membar_consumer()		smp_rmb()
 #define	physmem				zfs_totalram_pages
 #define	freemem			(nr_free_pages() + \
 				global_page_state(NR_INACTIVE_FILE) + \
@@ -37,16 +37,30 @@
 extern "C" {
 #endif
 
+/*
+ * Statistics returned by zfs_create_batch().
+ */
+typedef struct zfs_create_batch_stats {
+	uint64_t	zcbs_created;	/* files created */
+	uint64_t	zcbs_failed;	/* names which could not be created */
+	uint64_t	zcbs_txs;	/* transactions committed */
+	uint64_t	zcbs_time_ns;	/* time taken by the whole batch */
+} zfs_create_batch_stats_t;
+
 extern int zfs_open(struct inode *ip, int mode, int flag, cred_t *cr);
 extern int zfs_close(struct inode *ip, int flag, cred_t *cr);
 extern int zfs_holey(struct inode *ip, int cmd, loff_t *off);
 extern int zfs_read(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr);
 extern int zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr);
+extern int zfs_clone_range(struct inode *inip, uint64_t *inoffp,
+    struct inode *outip, uint64_t *outoffp, uint64_t *lenp, cred_t *cr);
 extern int zfs_access(struct inode *ip, int mode, int flag, cred_t *cr);
 extern int zfs_lookup(struct inode *dip, char *nm, struct inode **ipp,
     int flags, cred_t *cr, int *direntflags, pathname_t *realpnp);
 extern int zfs_create(struct inode *dip, char *name, vattr_t *vap, int excl,
     int mode, struct inode **ipp, cred_t *cr, int flag, vsecattr_t *vsecp);
+extern int zfs_create_batch(struct inode *dip, char **names, uint_t count,
+    vattr_t *vap, cred_t *cr, int *errors, zfs_create_batch_stats_t *zcbs);
 extern int zfs_tmpfile(struct inode *dip, vattr_t *vap, int excl,
     int mode, struct inode **ipp, cred_t *cr, int flag, vsecattr_t *vsecp);
 extern int zfs_remove(struct inode *dip, char *name, cred_t *cr, int flags);
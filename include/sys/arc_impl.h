@@ -204,6 +204,136 @@ typedef struct arc_buf_hdr_crypt {
 	uint8_t			b_mac[ZIO_DATA_MAC_LEN];
 } arc_buf_hdr_crypt_t;
 
+/*
+ * Persistent L2ARC
+ *
+ * The L2ARC contents are described on the cache device itself by a chain
+ * of log blocks.  Each log block holds up to L2ARC_LOG_BLK_MAX_ENTRIES
+ * entries, one for every ARC buffer written to the device, and points
+ * back at the previously written log block.  The most recently written
+ * log block is referenced from the device header, which lives at the
+ * start of the usable device space, right after the front vdev labels:
+ *
+ *	+------+----------+----------------------------------------+------+
+ *	| L0L1 | dev hdr  | bufs ... log blk ... bufs ... log blk  | L2L3 |
+ *	+------+----------+----------------------------------------+------+
+ *	                    ^                          |
+ *	                    +--------------------------+ lb_prev_lbp
+ *
+ * When a cache device is added back to a pool (at import or open) the
+ * chain is walked from the newest log block to the oldest, and an
+ * L2-only ARC header is reconstructed for each entry, so that the
+ * device is warm again without having to refill it from the main pool.
+ * Every restored buffer is still checksum-verified against its block
+ * pointer when read, so stale entries are harmless.
+ */
+#define	L2ARC_DEV_HDR_MAGIC		0x5a46534341434845LLU	/* ZFSCACHE */
+#define	L2ARC_LOG_BLK_MAGIC		0x4c4f47424c4b4844LLU	/* LOGBLKHD */
+#define	L2ARC_PERSISTENT_VERSION	1
+#define	L2ARC_LOG_BLK_MAX_ENTRIES	1022	/* max # of log entries */
+#define	L2ARC_LOG_BLK_FULL(dev)	((dev)->l2ad_log_ent_idx == \
+	(dev)->l2ad_log_entries)
+
+/* dh_flags: the device has wrapped at least once */
+#define	L2ARC_DEV_HDR_EVICT_FIRST	(1ULL << 0)
+
+/*
+ * A pointer to a log block.  lbp_prop packs the sizes, compression and
+ * checksum of the log block using the L2BLK_* accessors below.
+ */
+typedef struct l2arc_log_blkptr {
+	uint64_t	lbp_daddr;		/* device address of log blk */
+	uint64_t	lbp_payload_asize;	/* aligned size of its bufs */
+	uint64_t	lbp_payload_start;	/* offset of its first buf */
+	uint64_t	lbp_prop;		/* encoded properties */
+	zio_cksum_t	lbp_cksum;		/* fletcher4 of the log blk */
+} l2arc_log_blkptr_t;
+
+/*
+ * One entry in a log block, describing one ARC buffer on the device.
+ * le_prop uses the same L2BLK_* encoding as lbp_prop.
+ */
+typedef struct l2arc_log_ent_phys {
+	dva_t		le_dva;		/* dva of buffer */
+	uint64_t	le_birth;	/* birth txg of buffer */
+	uint64_t	le_prop;	/* encoded properties */
+	uint64_t	le_daddr;	/* buf location on l2dev */
+	uint64_t	le_complevel;	/* compression level, see zstd.h */
+	uint64_t	le_pad[2];	/* pad to 64 bytes */
+} l2arc_log_ent_phys_t;
+
+/* The on-disk log block, exactly 64K long */
+typedef struct l2arc_log_blk_phys {
+	uint64_t		lb_magic;	/* L2ARC_LOG_BLK_MAGIC */
+	l2arc_log_blkptr_t	lb_prev_lbp;	/* previous log blk */
+	uint64_t		lb_pad[7];	/* pad to 128 bytes */
+	l2arc_log_ent_phys_t	lb_entries[L2ARC_LOG_BLK_MAX_ENTRIES];
+} l2arc_log_blk_phys_t;
+
+CTASSERT_GLOBAL(sizeof (l2arc_log_blk_phys_t) == SPA_OLD_MAXBLOCKSIZE / 2);
+
+/* The on-disk device header, padded to 512 bytes */
+typedef struct l2arc_dev_hdr_phys {
+	uint64_t	dh_magic;	/* L2ARC_DEV_HDR_MAGIC */
+	uint64_t	dh_version;	/* L2ARC_PERSISTENT_VERSION */
+	uint64_t	dh_spa_guid;
+	uint64_t	dh_vdev_guid;
+	uint64_t	dh_log_entries;	/* entries per log blk */
+	uint64_t	dh_evict;	/* evicted offset in bytes */
+	uint64_t	dh_flags;	/* L2ARC_DEV_HDR_* flags */
+	uint64_t	dh_start;	/* mirror of l2ad_start */
+	uint64_t	dh_end;		/* mirror of l2ad_end */
+	l2arc_log_blkptr_t dh_start_lbp;	/* newest log blk */
+	uint64_t	dh_pad[42];	/* pad to 512 bytes */
+	zio_eck_t	dh_tail;
+} l2arc_dev_hdr_phys_t;
+
+CTASSERT_GLOBAL(sizeof (l2arc_dev_hdr_phys_t) == SPA_MINBLOCKSIZE);
+
+#define	L2BLK_GET_LSIZE(field)	\
+	BF64_GET_SB((field), 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2BLK_SET_LSIZE(field, x)	\
+	BF64_SET_SB((field), 0, SPA_LSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2BLK_GET_PSIZE(field)	\
+	BF64_GET_SB((field), 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1)
+#define	L2BLK_SET_PSIZE(field, x)	\
+	BF64_SET_SB((field), 16, SPA_PSIZEBITS, SPA_MINBLOCKSHIFT, 1, x)
+#define	L2BLK_GET_COMPRESS(field)	\
+	BF64_GET((field), 32, SPA_COMPRESSBITS)
+#define	L2BLK_SET_COMPRESS(field, x)	\
+	BF64_SET((field), 32, SPA_COMPRESSBITS, x)
+#define	L2BLK_GET_CHECKSUM(field)	BF64_GET((field), 40, 8)
+#define	L2BLK_SET_CHECKSUM(field, x)	BF64_SET((field), 40, 8, x)
+#define	L2BLK_GET_TYPE(field)		BF64_GET((field), 48, 8)
+#define	L2BLK_SET_TYPE(field, x)	BF64_SET((field), 48, 8, x)
+#define	L2BLK_GET_PROTECTED(field)	BF64_GET((field), 56, 1)
+#define	L2BLK_SET_PROTECTED(field, x)	BF64_SET((field), 56, 1, x)
+
+/* In-memory record of a log block written to (or restored from) a device */
+typedef struct l2arc_lb_ptr_buf {
+	l2arc_log_blkptr_t	*lb_ptr;
+	list_node_t		node;
+} l2arc_lb_ptr_buf_t;
+
+/* A compressed log block pending write; freed in l2arc_write_done() */
+typedef struct l2arc_lb_abd_buf {
+	abd_t		*abd;
+	list_node_t	node;
+} l2arc_lb_abd_buf_t;
+
+/*
+ * Per-device feed statistics, exported as the zfs/<pool>/l2arc-0x<guid>
+ * kstat.  Only updated by the device's own feed thread.
+ */
+typedef struct l2arc_dev_feed_stats {
+	kstat_named_t	lfs_feeds;		/* feed cycles completed */
+	kstat_named_t	lfs_abort_busy;		/* skipped, config lock busy */
+	kstat_named_t	lfs_abort_lowmem;	/* skipped, memory pressure */
+	kstat_named_t	lfs_write_target;	/* bytes budgeted for writing */
+	kstat_named_t	lfs_write_bytes;	/* bytes written (asize) */
+	kstat_named_t	lfs_feed_time_ns;	/* time spent feeding */
+} l2arc_dev_feed_stats_t;
+
 typedef struct l2arc_dev {
 	vdev_t			*l2ad_vdev;	/* vdev */
 	spa_t			*l2ad_spa;	/* spa */
@@ -216,6 +346,35 @@ typedef struct l2arc_dev {
 	list_t			l2ad_buflist;	/* buffer list */
 	list_node_t		l2ad_node;	/* device list node */
 	zfs_refcount_t		l2ad_alloc;	/* allocated bytes */
+	/*
+	 * Persistence-related fields.
+	 */
+	l2arc_dev_hdr_phys_t	*l2ad_dev_hdr;	/* in-core device header */
+	uint64_t		l2ad_dev_hdr_asize; /* aligned hdr size */
+	l2arc_log_blk_phys_t	l2ad_log_blk;	/* log blk being built */
+	int			l2ad_log_ent_idx; /* index into log blk */
+	/* entries per log blk; zero when persistence is disabled */
+	uint64_t		l2ad_log_entries;
+	/* aligned size and first address of the bufs in the log blk */
+	uint64_t		l2ad_log_blk_payload_asize;
+	uint64_t		l2ad_log_blk_payload_start;
+	uint64_t		l2ad_evict;	/* evicted up to here */
+	boolean_t		l2ad_rebuild;	/* rebuild pending */
+	boolean_t		l2ad_rebuild_cancel;
+	boolean_t		l2ad_rebuild_began;
+	/* log blks on the device, newest first, protected by l2ad_mtx */
+	list_t			l2ad_lbptr_list;
+	zfs_refcount_t		l2ad_lb_asize;	/* aligned size of log blks */
+	zfs_refcount_t		l2ad_lb_count;	/* number of log blks */
+	/*
+	 * Feed thread state; every cache device is fed by its own thread.
+	 */
+	kthread_t		*l2ad_feed_thread;
+	kmutex_t		l2ad_feed_lock;	/* protects feed thread state */
+	kcondvar_t		l2ad_feed_cv;
+	boolean_t		l2ad_feed_exit;	/* feed thread should exit */
+	kstat_t			*l2ad_feed_ksp;
+	l2arc_dev_feed_stats_t	l2ad_feed_stats;
 } l2arc_dev_t;
 
 typedef struct l2arc_buf_hdr {
@@ -230,6 +389,8 @@ typedef struct l2arc_buf_hdr {
 typedef struct l2arc_write_callback {
 	l2arc_dev_t	*l2wcb_dev;		/* device info */
 	arc_buf_hdr_t	*l2wcb_head;		/* head of write buflist */
+	/* compressed log blks written along with this batch */
+	list_t		l2wcb_abd_list;
 } l2arc_write_callback_t;
 
 struct arc_buf_hdr {
@@ -238,6 +399,7 @@ struct arc_buf_hdr {
 	uint64_t		b_birth;
 
 	arc_buf_contents_t	b_type;
+	uint8_t			b_complevel;
 	arc_buf_hdr_t		*b_hash_next;
 	arc_flags_t		b_flags;
 
@@ -0,0 +1,129 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef _SYS_BRT_H
+#define	_SYS_BRT_H
+
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <sys/fs/zfs.h>
+#include <sys/zio.h>
+#include <sys/dmu.h>
+#include <sys/avl.h>
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Name of the MOS directory entry for the BRT of a top-level vdev; the
+ * vdev id is appended in decimal.
+ */
+#define	BRT_OBJECT_VDEV_PREFIX		"org.openzfs:brt:vdev:"
+
+/*
+ * Size of the regions tracked by the per-vdev entry count array.
+ */
+#define	BRT_RANGESIZE			(64 * 1024 * 1024)
+
+/*
+ * On-disk per-vdev BRT header, kept in the bonus buffer of the object
+ * holding the entry count array.
+ */
+typedef struct brt_vdev_phys {
+	uint64_t	bvp_mos_entries;	/* ZAP of entries */
+	uint64_t	bvp_size;		/* entries in the count array */
+	uint64_t	bvp_byteorder;		/* byte order of the array */
+	uint64_t	bvp_totalcount;		/* number of BRT entries */
+	uint64_t	bvp_rangesize;		/* bytes covered per count */
+	uint64_t	bvp_usedspace;		/* space of cloned blocks */
+	uint64_t	bvp_savedspace;		/* space saved by cloning */
+} brt_vdev_phys_t;
+
+/*
+ * In-core BRT entry.  The refcount counts the references in addition to
+ * the one held by the block's original owner, so a block without an
+ * entry has a single reference and is freed as usual.
+ */
+typedef struct brt_entry {
+	uint64_t	bre_offset;	/* DVA[0] offset, the key */
+	uint64_t	bre_refcount;	/* additional references */
+	avl_node_t	bre_node;
+} brt_entry_t;
+
+/*
+ * Clone of a block not yet applied to the BRT; kept per txg so that it
+ * can be dropped again if the dirty record referencing it is undone.
+ */
+typedef struct brt_pending_entry {
+	blkptr_t	bpe_bp;
+	int		bpe_count;
+	avl_node_t	bpe_node;
+} brt_pending_entry_t;
+
+typedef struct brt_vdev {
+	uint64_t	bv_vdevid;
+	uint64_t	bv_rangesize;	/* bytes covered per count */
+	uint64_t	bv_mos_brtvdev;	/* object holding the count array */
+	uint64_t	bv_mos_entries;	/* ZAP of entries */
+	uint64_t	bv_size;	/* entries in bv_entcount */
+	uint16_t	*bv_entcount;	/* entries per region, saturating */
+	boolean_t	bv_meta_dirty;
+	boolean_t	bv_entcount_dirty;
+	uint64_t	bv_totalcount;
+	uint64_t	bv_usedspace;
+	uint64_t	bv_savedspace;
+	avl_tree_t	bv_tree;	/* entries changed in this txg */
+} brt_vdev_t;
+
+struct brt {
+	krwlock_t	brt_lock;	/* protects the tables below */
+	spa_t		*brt_spa;
+	uint64_t	brt_nvdevs;
+	brt_vdev_t	**brt_vdevs;	/* indexed by top-level vdev id */
+	kmutex_t	brt_pending_lock[TXG_SIZE];
+	avl_tree_t	brt_pending_tree[TXG_SIZE];
+};
+
+extern boolean_t brt_maybe_exists(spa_t *spa, const blkptr_t *bp);
+extern boolean_t brt_entry_decref(spa_t *spa, const blkptr_t *bp);
+extern uint64_t brt_entry_get_refcount(spa_t *spa, const blkptr_t *bp);
+
+extern uint64_t brt_get_used(spa_t *spa);
+extern uint64_t brt_get_saved(spa_t *spa);
+extern uint64_t brt_get_ratio(spa_t *spa);
+
+extern void brt_pending_add(spa_t *spa, const blkptr_t *bp, dmu_tx_t *tx);
+extern void brt_pending_remove(spa_t *spa, const blkptr_t *bp, uint64_t txg);
+extern void brt_pending_apply(spa_t *spa, uint64_t txg);
+
+extern void brt_init(void);
+extern void brt_fini(void);
+extern void brt_create(spa_t *spa);
+extern int brt_load(spa_t *spa);
+extern void brt_unload(spa_t *spa);
+extern void brt_sync(spa_t *spa, uint64_t txg);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _SYS_BRT_H */
@@ -56,10 +56,19 @@ typedef struct dataset_kstat_values {
 	 * entry is removed from the unlinked set
 	 */
 	kstat_named_t dkv_nunlinked;
+	/*
+	 * Predictive prefetch statistics, see dmu_zfetch()
+	 */
+	kstat_named_t dkv_zfetch_hits;
+	kstat_named_t dkv_zfetch_misses;
+	kstat_named_t dkv_zfetch_stride_hits;
+	kstat_named_t dkv_zfetch_reverse_hits;
+	kstat_named_t dkv_zfetch_issued;
 } dataset_kstat_values_t;
 
 typedef struct dataset_kstats {
 	dataset_aggsum_stats_t dk_aggsums;
+	struct zfetch_ds_stats *dk_zfetch;
 	kstat_t *dk_kstats;
 } dataset_kstats_t;
 
@@ -162,6 +162,18 @@ typedef struct dbuf_dirty_record {
 			boolean_t dr_nopwrite;
 			boolean_t dr_has_raw_params;
 
+			/*
+			 * Set when dr_overridden_by was written by Direct
+			 * I/O; the dbuf holds no copy of the data.
+			 */
+			boolean_t dr_diowrite;
+
+			/*
+			 * Set when dr_overridden_by is a clone of an existing
+			 * block (with dr_diowrite, as no data is held).
+			 */
+			boolean_t dr_brtwrite;
+
 			/*
 			 * If dr_has_raw_params is set, the following crypt
 			 * params will be set on the BP that's written.
@@ -349,6 +361,9 @@ void dmu_buf_write_embedded(dmu_buf_t *dbuf, void *data,
     int uncompressed_size, int compressed_size, int byteorder, dmu_tx_t *tx);
 
 void dmu_buf_redact(dmu_buf_t *dbuf, dmu_tx_t *tx);
+int dmu_buf_write_direct(dmu_buf_t *dbuf, const blkptr_t *bp, int copies,
+    dmu_tx_t *tx);
+int dmu_buf_clone(dmu_buf_t *dbuf, const blkptr_t *bp, dmu_tx_t *tx);
 void dbuf_destroy(dmu_buf_impl_t *db);
 
 void dbuf_unoverride(dbuf_dirty_record_t *dr);
@@ -94,8 +94,9 @@ typedef struct ddt_key {
 
 #define	DDT_KEY_WORDS	(sizeof (ddt_key_t) / sizeof (uint64_t))
 
-#define	DDE_GET_NDVAS(dde) (DDK_GET_CRYPT(&dde->dde_key) \
+#define	DDK_GET_NDVAS(ddk) (DDK_GET_CRYPT(ddk) \
 	? SPA_DVAS_PER_BP - 1 : SPA_DVAS_PER_BP)
+#define	DDE_GET_NDVAS(dde)	DDK_GET_NDVAS(&(dde)->dde_key)
 
 typedef struct ddt_phys {
 	dva_t		ddp_dva[SPA_DVAS_PER_BP];
@@ -117,27 +118,129 @@ enum ddt_phys_type {
 
 /*
  * In-core ddt entry
+ *
+ * dde_type and dde_class give the table the entry belongs to.  With the
+ * dedup log the entry may not have reached that table yet; dde_zap_type
+ * and dde_zap_class then give the table still holding the older version
+ * of the entry, which the log flush must remove it from.
+ *
+ * Most entries only ever use one of their phys slots, so the slots are
+ * allocated separately, as they are filled in.  An unused slot is NULL.
  */
 struct ddt_entry {
 	ddt_key_t	dde_key;
-	ddt_phys_t	dde_phys[DDT_PHYS_TYPES];
+	ddt_phys_t	*dde_phys[DDT_PHYS_TYPES];
 	zio_t		*dde_lead_zio[DDT_PHYS_TYPES];
 	struct abd	*dde_repair_abd;
-	enum ddt_type	dde_type;
-	enum ddt_class	dde_class;
+	uint8_t		dde_type;	/* enum ddt_type */
+	uint8_t		dde_class;	/* enum ddt_class */
+	uint8_t		dde_zap_type;	/* enum ddt_type */
+	uint8_t		dde_zap_class;	/* enum ddt_class */
 	uint8_t		dde_loading;
 	uint8_t		dde_loaded;
 	kcondvar_t	dde_cv;
-	avl_node_t	dde_node;
+	ddt_entry_t	*dde_next;	/* hash chain */
 };
 
+/*
+ * An entry as stored in the tables, with every phys slot in place.  Walks
+ * of the tables and the dedup log return entries in this form.
+ */
+typedef struct ddt_lightweight_entry {
+	ddt_key_t	ddlwe_key;
+	ddt_phys_t	ddlwe_phys[DDT_PHYS_TYPES];
+	enum ddt_type	ddlwe_type;
+	enum ddt_class	ddlwe_class;
+} ddt_lightweight_entry_t;
+
+/*
+ * Hash table of in-core entries, indexed by the first word of the key's
+ * checksum and grown by doubling as entries are added.
+ */
+typedef struct ddt_hash {
+	ddt_entry_t	**dh_buckets;
+	uint64_t	dh_shift;	/* log2 of the number of buckets */
+	uint64_t	dh_count;	/* number of entries */
+} ddt_hash_t;
+
+#define	DDT_HASH_MIN_SHIFT	6
+#define	DDT_HASH_MAX_SHIFT	20
+
+/*
+ * On-disk dedup log record.  The log is a plain object of records
+ * appended in txg order; a later record for a key replaces the earlier
+ * ones.  A record whose type is DDT_TYPES is a tombstone for an entry
+ * whose last reference was freed.
+ */
+typedef struct ddt_log_record {
+	ddt_key_t	dlr_key;
+	/*
+	 * Encoded with the target type and class of the entry and the type
+	 * and class of the table still holding its older version:
+	 *   +-------+-------+-------+-------+-------+-------+-------+-------+
+	 *   |   0   |   0   |   0   |   0   | zclass| ztype | class | type  |
+	 *   +-------+-------+-------+-------+-------+-------+-------+-------+
+	 */
+	uint64_t	dlr_info;
+	ddt_phys_t	dlr_phys[DDT_PHYS_TYPES];
+} ddt_log_record_t;
+
+#define	DLR_GET_TYPE(dlr)		BF64_GET((dlr)->dlr_info, 0, 8)
+#define	DLR_SET_TYPE(dlr, x)		BF64_SET((dlr)->dlr_info, 0, 8, x)
+#define	DLR_GET_CLASS(dlr)		BF64_GET((dlr)->dlr_info, 8, 8)
+#define	DLR_SET_CLASS(dlr, x)		BF64_SET((dlr)->dlr_info, 8, 8, x)
+#define	DLR_GET_ZAP_TYPE(dlr)		BF64_GET((dlr)->dlr_info, 16, 8)
+#define	DLR_SET_ZAP_TYPE(dlr, x)	BF64_SET((dlr)->dlr_info, 16, 8, x)
+#define	DLR_GET_ZAP_CLASS(dlr)		BF64_GET((dlr)->dlr_info, 24, 8)
+#define	DLR_SET_ZAP_CLASS(dlr, x)	BF64_SET((dlr)->dlr_info, 24, 8, x)
+
+/*
+ * On-disk dedup log header, kept in the bonus buffer of the log object.
+ */
+typedef struct ddt_log_header {
+	uint64_t	dlh_flags;	/* DDT_LOG_FLAG_* */
+	uint64_t	dlh_length;	/* bytes of records */
+	uint64_t	dlh_first_txg;	/* txg of the first record */
+	ddt_key_t	dlh_checkpoint;	/* last key flushed to the tables */
+} ddt_log_header_t;
+
+#define	DDT_LOG_FLAG_FLUSHING	(1ULL << 0)	/* being flushed */
+#define	DDT_LOG_FLAG_CHECKPOINT	(1ULL << 1)	/* dlh_checkpoint is valid */
+
+/*
+ * In-core dedup log entry: the latest record for a key.
+ */
+typedef struct ddt_log_entry {
+	ddt_key_t	dle_key;
+	ddt_phys_t	dle_phys[DDT_PHYS_TYPES];
+	uint8_t		dle_type;
+	uint8_t		dle_class;
+	uint8_t		dle_zap_type;
+	uint8_t		dle_zap_class;
+	avl_node_t	dle_node;
+} ddt_log_entry_t;
+
+/*
+ * In-core dedup log.  Each DDT has two: new entries are appended to the
+ * active one while the other is flushed into the tables.
+ */
+typedef struct ddt_log {
+	avl_tree_t	ddl_tree;	/* latest entry per key */
+	uint64_t	ddl_object;
+	uint64_t	ddl_flags;
+	uint64_t	ddl_length;
+	uint64_t	ddl_first_txg;
+	ddt_key_t	ddl_checkpoint;
+	uint64_t	ddl_flush_rate;	/* entries to flush per txg */
+} ddt_log_t;
+
 /*
  * In-core ddt
  */
 struct ddt {
 	kmutex_t	ddt_lock;
-	avl_tree_t	ddt_tree;
-	avl_tree_t	ddt_repair_tree;
+	ddt_hash_t	ddt_tree;
+	ddt_hash_t	ddt_repair_tree;
 	enum zio_checksum ddt_checksum;
 	spa_t		*ddt_spa;
 	objset_t	*ddt_os;
@@ -146,6 +249,11 @@ struct ddt {
 	ddt_histogram_t	ddt_histogram[DDT_TYPES][DDT_CLASSES];
 	ddt_histogram_t	ddt_histogram_cache[DDT_TYPES][DDT_CLASSES];
 	ddt_object_t	ddt_object_stats[DDT_TYPES][DDT_CLASSES];
+	ddt_log_t	ddt_log[2];
+	ddt_log_t	*ddt_log_active;	/* being appended to */
+	ddt_log_t	*ddt_log_flushing;	/* being flushed */
+	void		*ddt_log_buf;		/* records not yet written */
+	uint64_t	ddt_log_buf_count;
 	avl_node_t	ddt_node;
 };
 
@@ -167,24 +275,50 @@ typedef struct ddt_ops {
 	int (*ddt_op_create)(objset_t *os, uint64_t *object, dmu_tx_t *tx,
 	    boolean_t prehash);
 	int (*ddt_op_destroy)(objset_t *os, uint64_t object, dmu_tx_t *tx);
-	int (*ddt_op_lookup)(objset_t *os, uint64_t object, ddt_entry_t *dde);
+	int (*ddt_op_lookup)(objset_t *os, uint64_t object,
+	    const ddt_key_t *ddk, ddt_phys_t *phys);
 	void (*ddt_op_prefetch)(objset_t *os, uint64_t object,
-	    ddt_entry_t *dde);
-	int (*ddt_op_update)(objset_t *os, uint64_t object, ddt_entry_t *dde,
-	    dmu_tx_t *tx);
-	int (*ddt_op_remove)(objset_t *os, uint64_t object, ddt_entry_t *dde,
-	    dmu_tx_t *tx);
-	int (*ddt_op_walk)(objset_t *os, uint64_t object, ddt_entry_t *dde,
-	    uint64_t *walk);
+	    const ddt_key_t *ddk);
+	int (*ddt_op_update)(objset_t *os, uint64_t object,
+	    const ddt_key_t *ddk, const ddt_phys_t *phys, dmu_tx_t *tx);
+	int (*ddt_op_remove)(objset_t *os, uint64_t object,
+	    const ddt_key_t *ddk, dmu_tx_t *tx);
+	int (*ddt_op_walk)(objset_t *os, uint64_t object, ddt_key_t *ddk,
+	    ddt_phys_t *phys, uint64_t *walk);
 	int (*ddt_op_count)(objset_t *os, uint64_t object, uint64_t *count);
 } ddt_ops_t;
 
 #define	DDT_NAMELEN	80
 
+/*
+ * Size of the full set of phys slots of an entry, as stored in the tables.
+ */
+#define	DDT_PHYS_SIZE	(DDT_PHYS_TYPES * sizeof (ddt_phys_t))
+
+/*
+ * Number of records ddt_log_entry() collects before writing them out.
+ */
+#define	DDT_LOG_BUF_RECORDS	\
+	(SPA_OLD_MAXBLOCKSIZE / sizeof (ddt_log_record_t))
+
+/*
+ * Logical size of an entry, counted against the dedup_table_quota.
+ */
+#define	DDT_ENTRY_SIZE		\
+	(sizeof (ddt_key_t) + DDT_PHYS_TYPES * sizeof (ddt_phys_t))
+
+/*
+ * Number of age buckets the unique entries are sorted into when pruning,
+ * and how far below its quota (as a power-of-two fraction) the DDT is
+ * pruned once it reaches it.
+ */
+#define	DDT_PRUNE_BUCKETS	256
+#define	DDT_PRUNE_QUOTA_SHIFT	4
+
 extern void ddt_object_name(ddt_t *ddt, enum ddt_type type,
     enum ddt_class class, char *name);
 extern int ddt_object_walk(ddt_t *ddt, enum ddt_type type,
-    enum ddt_class class, uint64_t *walk, ddt_entry_t *dde);
+    enum ddt_class class, uint64_t *walk, ddt_lightweight_entry_t *ddlwe);
 extern int ddt_object_count(ddt_t *ddt, enum ddt_type type,
     enum ddt_class class, uint64_t *count);
 extern int ddt_object_info(ddt_t *ddt, enum ddt_type type,
@@ -207,6 +341,12 @@ extern void ddt_phys_free(ddt_t *ddt, ddt_key_t *ddk, ddt_phys_t *ddp,
     uint64_t txg);
 extern ddt_phys_t *ddt_phys_select(const ddt_entry_t *dde, const blkptr_t *bp);
 extern uint64_t ddt_phys_total_refcnt(const ddt_entry_t *dde);
+extern ddt_phys_t *ddt_phys_slot(ddt_entry_t *dde, enum ddt_phys_type p);
+
+extern void ddt_entry_set_phys(ddt_entry_t *dde, const ddt_phys_t *phys);
+extern void ddt_entry_get_phys(const ddt_entry_t *dde, ddt_phys_t *phys);
+extern void ddt_entry_to_lightweight(const ddt_entry_t *dde,
+    ddt_lightweight_entry_t *ddlwe);
 
 extern void ddt_stat_add(ddt_stat_t *dst, const ddt_stat_t *src, uint64_t neg);
 
@@ -219,6 +359,8 @@ extern void ddt_get_dedup_stats(spa_t *spa, ddt_stat_t *dds_total);
 
 extern uint64_t ddt_get_dedup_dspace(spa_t *spa);
 extern uint64_t ddt_get_pool_dedup_ratio(spa_t *spa);
+extern uint64_t ddt_get_ddt_size(spa_t *spa);
+extern boolean_t ddt_over_quota(spa_t *spa);
 
 extern size_t ddt_compress(void *src, uchar_t *dst, size_t s_len, size_t d_len);
 extern void ddt_decompress(uchar_t *src, void *dst, size_t s_len, size_t d_len);
@@ -238,15 +380,38 @@ extern boolean_t ddt_class_contains(spa_t *spa, enum ddt_class max_class,
 extern ddt_entry_t *ddt_repair_start(ddt_t *ddt, const blkptr_t *bp);
 extern void ddt_repair_done(ddt_t *ddt, ddt_entry_t *dde);
 
+extern int ddt_key_compare(const ddt_key_t *k1, const ddt_key_t *k2);
 extern int ddt_entry_compare(const void *x1, const void *x2);
 
 extern void ddt_create(spa_t *spa);
 extern int ddt_load(spa_t *spa);
 extern void ddt_unload(spa_t *spa);
 extern void ddt_sync(spa_t *spa, uint64_t txg);
-extern int ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde);
+extern int ddt_walk(spa_t *spa, ddt_bookmark_t *ddb,
+    ddt_lightweight_entry_t *ddlwe);
+extern int ddt_prune_unique_entries(spa_t *spa, uint64_t percentage);
 extern int ddt_object_update(ddt_t *ddt, enum ddt_type type,
-    enum ddt_class class, ddt_entry_t *dde, dmu_tx_t *tx);
+    enum ddt_class class, const ddt_key_t *ddk, const ddt_phys_t *phys,
+    dmu_tx_t *tx);
+extern int ddt_object_remove(ddt_t *ddt, enum ddt_type type,
+    enum ddt_class class, const ddt_key_t *ddk, dmu_tx_t *tx);
+
+extern void ddt_log_init(void);
+extern void ddt_log_fini(void);
+extern boolean_t ddt_log_exists(ddt_t *ddt);
+extern boolean_t ddt_log_empty(ddt_t *ddt);
+extern boolean_t ddt_log_contains(ddt_t *ddt, const ddt_key_t *ddk);
+extern boolean_t ddt_log_lookup(ddt_t *ddt, ddt_entry_t *dde);
+extern int ddt_log_walk(ddt_t *ddt, uint64_t *walk,
+    ddt_lightweight_entry_t *ddlwe);
+extern void ddt_log_alloc(ddt_t *ddt);
+extern void ddt_log_free(ddt_t *ddt);
+extern int ddt_log_load(ddt_t *ddt);
+extern void ddt_log_create(ddt_t *ddt, dmu_tx_t *tx);
+extern void ddt_log_destroy(ddt_t *ddt, dmu_tx_t *tx);
+extern void ddt_log_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx);
+extern void ddt_log_commit(ddt_t *ddt, dmu_tx_t *tx);
+extern void ddt_log_flush(ddt_t *ddt, dmu_tx_t *tx);
 
 extern const ddt_ops_t ddt_zap_ops;
 
@@ -70,7 +70,7 @@ extern "C" {
  * os_obj_lock
  *   must be held before:
  *   	everything except dp_config_rwlock
- *   protects os_obj_next
+ *   protects os_obj_next_chunk and the refill of os_obj_cursor chunks
  *   held from:
  *   	dmu_object_alloc: dn_dbufs_mtx, db_mtx, hash_mutexes, dn_struct_rwlock
  *
@@ -253,8 +253,6 @@ typedef struct dmu_sendstatus {
 
 void dmu_object_zapify(objset_t *, uint64_t, dmu_object_type_t, dmu_tx_t *);
 void dmu_object_free_zapified(objset_t *, uint64_t, dmu_tx_t *);
-int dmu_buf_hold_noread(objset_t *, uint64_t, uint64_t,
-    void *, dmu_buf_t **);
 
 #ifdef	__cplusplus
 }
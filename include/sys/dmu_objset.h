@@ -59,6 +59,19 @@ struct dmu_tx;
 #define	OBJSET_BUF_HAS_PROJECTUSED(buf) \
 	(arc_buf_size(buf) >= OBJSET_PHYS_SIZE_V3)
 
+/*
+ * Each CPU allocates new objects from its own chunk of whole dnode blocks,
+ * [doc_start, doc_end).  doc_next is advanced with atomic ops, and all
+ * three are reset under os_obj_lock when the chunk is used up.  Cursors
+ * are cache line aligned so CPUs allocating concurrently do not share a
+ * line.
+ */
+typedef struct dmu_obj_cursor {
+	uint64_t	doc_next;	/* next object to allocate */
+	uint64_t	doc_start;	/* start of this CPU's chunk */
+	uint64_t	doc_end;	/* end of this CPU's chunk */
+} ____cacheline_aligned dmu_obj_cursor_t;
+
 #define	OBJSET_FLAG_USERACCOUNTING_COMPLETE	(1ULL << 0)
 #define	OBJSET_FLAG_USEROBJACCOUNTING_COMPLETE	(1ULL << 1)
 #define	OBJSET_FLAG_PROJECTQUOTA_COMPLETE	(1ULL << 2)
@@ -118,10 +131,12 @@ struct objset {
 	uint64_t os_dnodesize; /* default dnode size for new objects */
 	enum zio_checksum os_checksum;
 	enum zio_compress os_compress;
+	uint8_t os_complevel;
 	uint8_t os_copies;
 	enum zio_checksum os_dedup_checksum;
 	boolean_t os_dedup_verify;
 	zfs_logbias_op_t os_logbias;
+	zfs_direct_t os_direct;
 	zfs_cache_type_t os_primary_cache;
 	zfs_cache_type_t os_secondary_cache;
 	zfs_sync_type_t os_sync;
@@ -165,9 +180,12 @@ struct objset {
 	kmutex_t os_obj_lock;
 	uint64_t os_obj_next_chunk;
 
-	/* Per-CPU next object to allocate, protected by atomic ops. */
-	uint64_t *os_obj_next_percpu;
-	int os_obj_next_percpu_len;
+	/* Per-CPU object allocation cursors, see dmu_object_alloc_impl(). */
+	dmu_obj_cursor_t *os_obj_cursor;
+	int os_obj_cursor_len;
+
+	/* Prefetch statistics of the dataset, updated by atomic ops. */
+	struct zfetch_ds_stats *os_zfetch_stats;
 
 	/* Protected by os_lock */
 	kmutex_t os_lock;
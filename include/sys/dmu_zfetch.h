@@ -39,6 +39,7 @@ extern "C" {
 extern unsigned long	zfetch_array_rd_sz;
 
 struct dnode;				/* so we can reference dnode */
+struct spa;
 
 typedef struct zstream {
 	uint64_t	zs_blkid;	/* expect next access at this blkid */
@@ -50,6 +51,24 @@ typedef struct zstream {
 	 */
 	uint64_t	zs_ipf_blkid;
 
+	/*
+	 * A stream is sequential when zs_stride is zero, and each access
+	 * may start wherever the previous one ended.  Otherwise accesses of
+	 * zs_len blocks start zs_stride blocks apart, which is negative for
+	 * backward streams, and zs_pf_ahead of them starting at zs_blkid
+	 * have been prefetched.
+	 */
+	int64_t		zs_stride;
+	uint64_t	zs_len;
+	uint64_t	zs_pf_ahead;
+
+	uint64_t	zs_last;	/* first blkid of the last access */
+	uint64_t	zs_hits;	/* accesses predicted by this stream */
+
+	/* Stride being confirmed, and the access which suggested it */
+	int64_t		zs_cand_stride;
+	uint64_t	zs_cand_last;
+
 	kmutex_t	zs_lock;	/* protects stream */
 	hrtime_t	zs_atime;	/* time last prefetch issued */
 	list_node_t	zs_node;	/* link for zf_stream */
@@ -59,8 +78,29 @@ typedef struct zfetch {
 	kmutex_t	zf_lock;	/* protects zfetch structure */
 	list_t		zf_stream;	/* list of zstream_t's */
 	struct dnode	*zf_dnode;	/* dnode that owns this zfetch */
+	uint32_t	zf_max_streams;	/* streams allowed for this dnode */
+	int32_t		zf_dist_shift;	/* scales zfetch_max_distance */
+	uint32_t	zf_hits;	/* hits in the current window */
+	uint32_t	zf_misses;	/* misses in the current window */
 } zfetch_t;
 
+/*
+ * Prefetch statistics of a dataset.  They are shared by every instance of
+ * the dataset's objset and by its dataset kstat, each of which holds a
+ * reference, so they survive the objset being evicted and reopened.
+ */
+typedef struct zfetch_ds_stats {
+	avl_node_t	zds_node;
+	struct spa	*zds_spa;
+	uint64_t	zds_objset;
+	uint64_t	zds_refcnt;	/* protected by zfetch_ds_lock */
+	uint64_t	zds_hits;
+	uint64_t	zds_misses;
+	uint64_t	zds_stride_hits;
+	uint64_t	zds_reverse_hits;
+	uint64_t	zds_issued;
+} zfetch_ds_stats_t;
+
 void		zfetch_init(void);
 void		zfetch_fini(void);
 
@@ -69,6 +109,9 @@ void		dmu_zfetch_fini(zfetch_t *);
 void		dmu_zfetch(zfetch_t *, uint64_t, uint64_t, boolean_t,
     boolean_t);
 
+zfetch_ds_stats_t	*dmu_zfetch_ds_stats_hold(struct spa *, uint64_t);
+void		dmu_zfetch_ds_stats_rele(zfetch_ds_stats_t *);
+
 
 #ifdef	__cplusplus
 }
@@ -565,6 +565,16 @@ typedef struct dnode_stats {
 	 * next meta dnode dbuf due to an error from  dmu_object_next().
 	 */
 	kstat_named_t dnode_alloc_next_block;
+	/*
+	 * Number of times dmu_object_alloc*() tried to allocate a dnode
+	 * slot which was already in use or being allocated.
+	 */
+	kstat_named_t dnode_alloc_collision;
+	/*
+	 * Number of times dmu_object_alloc*() gave up on the rest of its
+	 * CPU's chunk rather than skipping into a block beyond it.
+	 */
+	kstat_named_t dnode_alloc_chunk_abandon;
 	/*
 	 * Statistics for tracking dnodes which have been moved.
 	 */
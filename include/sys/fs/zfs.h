@@ -186,6 +186,7 @@ typedef enum {
 	ZFS_PROP_IVSET_GUID,		/* not exposed to the user */
 	ZFS_PROP_REDACTED,
 	ZFS_PROP_REDACT_SNAPS,
+	ZFS_PROP_DIRECT,
 	ZFS_NUM_PROPS
 } zfs_prop_t;
 
@@ -246,6 +247,10 @@ typedef enum {
 	ZPOOL_PROP_CHECKPOINT,
 	ZPOOL_PROP_LOAD_GUID,
 	ZPOOL_PROP_AUTOTRIM,
+	ZPOOL_PROP_BCLONEUSED,
+	ZPOOL_PROP_BCLONESAVED,
+	ZPOOL_PROP_BCLONERATIO,
+	ZPOOL_PROP_DEDUP_TABLE_QUOTA,
 	ZPOOL_NUM_PROPS
 } zpool_prop_t;
 
@@ -378,6 +383,12 @@ typedef enum {
 	ZFS_LOGBIAS_THROUGHPUT = 1
 } zfs_logbias_op_t;
 
+typedef enum {
+	ZFS_DIRECT_DISABLED = 0,
+	ZFS_DIRECT_STANDARD = 1,
+	ZFS_DIRECT_ALWAYS = 2
+} zfs_direct_t;
+
 typedef enum zfs_share_op {
 	ZFS_SHARE_NFS = 0,
 	ZFS_UNSHARE_NFS = 1,
@@ -699,6 +710,7 @@ typedef struct zpool_load_policy {
 #define	ZPOOL_CONFIG_SPLIT_LIST		"guid_list"
 #define	ZPOOL_CONFIG_REMOVING		"removing"
 #define	ZPOOL_CONFIG_RESILVER_TXG	"resilver_txg"
+#define	ZPOOL_CONFIG_REBUILD_TXG	"rebuild_txg"
 #define	ZPOOL_CONFIG_COMMENT		"comment"
 #define	ZPOOL_CONFIG_SUSPENDED		"suspended"	/* not stored on disk */
 #define	ZPOOL_CONFIG_SUSPENDED_REASON	"suspended_reason"	/* not stored */
@@ -717,6 +729,11 @@ typedef struct zpool_load_policy {
 #define	ZPOOL_CONFIG_VDEV_LEAF_ZAP	"com.delphix:vdev_zap_leaf"
 #define	ZPOOL_CONFIG_HAS_PER_VDEV_ZAPS	"com.delphix:has_per_vdev_zaps"
 #define	ZPOOL_CONFIG_RESILVER_DEFER	"com.datto:resilver_defer"
+#define	ZPOOL_CONFIG_REBUILD_STATS	"org.openzfs:rebuild_stats"
+#define	ZPOOL_CONFIG_RAIDZ_EXPANDING	"org.openzfs:raidz_expanding"
+#define	ZPOOL_CONFIG_RAIDZ_EXPAND_OFFSET "org.openzfs:raidz_expand_offset"
+#define	ZPOOL_CONFIG_RAIDZ_EXPAND_TXGS	"org.openzfs:raidz_expand_txgs"
+#define	ZPOOL_CONFIG_RAIDZ_EXPAND_STATS	"org.openzfs:raidz_expand_stats"
 #define	ZPOOL_CONFIG_CACHEFILE		"cachefile"	/* not stored on disk */
 #define	ZPOOL_CONFIG_MMP_STATE		"mmp_state"	/* not stored on disk */
 #define	ZPOOL_CONFIG_MMP_TXG		"mmp_txg"	/* not stored on disk */
@@ -776,6 +793,12 @@ typedef struct zpool_load_policy {
 #define	VDEV_TOP_ZAP_ALLOCATION_BIAS \
 	"org.zfsonlinux:allocation_bias"
 
+#define	VDEV_TOP_ZAP_VDEV_REBUILD_PHYS \
+	"org.openzfs:vdev_rebuild"
+
+#define	VDEV_TOP_ZAP_RAIDZ_EXPAND_PHYS \
+	"org.openzfs:raidz_expand"
+
 /* vdev metaslab allocation bias */
 #define	VDEV_ALLOC_BIAS_LOG		"log"
 #define	VDEV_ALLOC_BIAS_SPECIAL		"special"
@@ -978,6 +1001,53 @@ typedef struct pool_removal_stat {
 	uint64_t prs_mapping_memory;
 } pool_removal_stat_t;
 
+typedef enum vdev_rebuild_state {
+	VDEV_REBUILD_NONE,
+	VDEV_REBUILD_ACTIVE,
+	VDEV_REBUILD_CANCELED,
+	VDEV_REBUILD_COMPLETE,
+} vdev_rebuild_state_t;
+
+/*
+ * Sequential rebuild statistics for a top-level vdev, exported to
+ * userland as ZPOOL_CONFIG_REBUILD_STATS.  New fields must be appended.
+ */
+typedef struct vdev_rebuild_stat {
+	uint64_t vrs_state;		/* vdev_rebuild_state_t */
+	uint64_t vrs_start_time;	/* time_t */
+	uint64_t vrs_end_time;		/* time_t */
+	uint64_t vrs_scan_time_ms;	/* total run time (millisecs) */
+	uint64_t vrs_bytes_scanned;	/* allocated bytes scanned */
+	uint64_t vrs_bytes_issued;	/* read bytes issued */
+	uint64_t vrs_bytes_rebuilt;	/* rebuilt bytes */
+	uint64_t vrs_bytes_est;		/* total bytes to scan */
+	uint64_t vrs_errors;		/* scanning errors */
+	uint64_t vrs_pass_time_ms;	/* pass run time (millisecs) */
+	uint64_t vrs_pass_bytes_scanned; /* bytes scanned since start/resume */
+	uint64_t vrs_pass_bytes_issued;	/* bytes rebuilt since start/resume */
+} vdev_rebuild_stat_t;
+
+typedef enum vdev_raidz_expand_state {
+	VDEV_RAIDZ_EXPAND_NONE,
+	VDEV_RAIDZ_EXPAND_ACTIVE,
+	VDEV_RAIDZ_EXPAND_COMPLETE,
+} vdev_raidz_expand_state_t;
+
+/*
+ * RAIDZ expansion statistics for a top-level vdev, exported to
+ * userland as ZPOOL_CONFIG_RAIDZ_EXPAND_STATS.  New fields must be appended.
+ */
+typedef struct vdev_raidz_expand_stat {
+	uint64_t vres_state;		/* vdev_raidz_expand_state_t */
+	uint64_t vres_start_time;	/* time_t */
+	uint64_t vres_end_time;		/* time_t */
+	uint64_t vres_to_reflow;	/* bytes to be reflowed */
+	uint64_t vres_reflowed;		/* bytes reflowed so far */
+	uint64_t vres_offset;		/* reflow offset on the vdev */
+	uint64_t vres_errors;		/* reflow errors */
+	uint64_t vres_children;		/* children after expansion */
+} vdev_raidz_expand_stat_t;
+
 typedef enum dsl_scan_state {
 	DSS_NONE,
 	DSS_SCANNING,
@@ -1278,14 +1348,16 @@ typedef enum zfs_ioc {
 	ZFS_IOC_REDACT,				/* 0x5a51 */
 	ZFS_IOC_GET_BOOKMARK_PROPS,		/* 0x5a52 */
 	ZFS_IOC_WAIT,				/* 0x5a53 */
+	ZFS_IOC_DDT_PRUNE,			/* 0x5a54 */
 
 	/*
-	 * Linux - 3/64 numbers reserved.
+	 * Linux - 4/64 numbers reserved.
 	 */
 	ZFS_IOC_LINUX = ('Z' << 8) + 0x80,
 	ZFS_IOC_EVENTS_NEXT,			/* 0x5a81 */
 	ZFS_IOC_EVENTS_CLEAR,			/* 0x5a82 */
 	ZFS_IOC_EVENTS_SEEK,			/* 0x5a83 */
+	ZFS_IOC_CREATE_FILES,			/* 0x5a84 */
 
 	/*
 	 * FreeBSD - 1/64 numbers reserved.
@@ -1326,6 +1398,9 @@ typedef enum {
 	ZFS_ERR_SPILL_BLOCK_FLAG_MISSING,
 	ZFS_ERR_UNKNOWN_SEND_STREAM_FEATURE,
 	ZFS_ERR_EXPORT_IN_PROGRESS,
+	ZFS_ERR_RESILVER_IN_PROGRESS,
+	ZFS_ERR_REBUILD_IN_PROGRESS,
+	ZFS_ERR_RAIDZ_EXPAND_IN_PROGRESS,
 } zfs_errno_t;
 
 /*
@@ -1409,6 +1484,28 @@ typedef enum {
 #define	ZPOOL_WAIT_TAG			"wait_tag"
 #define	ZPOOL_WAIT_WAITED		"wait_waited"
 
+/*
+ * The following are names used when invoking ZFS_IOC_DDT_PRUNE.
+ */
+#define	ZPOOL_DDT_PRUNE_PERCENTAGE	"ddt_prune_percentage"
+
+/*
+ * The following are names used when invoking ZFS_IOC_CREATE_FILES.
+ */
+#define	ZFS_CREATE_FILES_DIR_OBJ	"dir_obj"
+#define	ZFS_CREATE_FILES_NAMES		"names"
+#define	ZFS_CREATE_FILES_MODE		"mode"
+#define	ZFS_CREATE_FILES_CREATED	"created"
+#define	ZFS_CREATE_FILES_FAILED		"failed"
+#define	ZFS_CREATE_FILES_TXS		"txs"
+#define	ZFS_CREATE_FILES_TIME_NS	"time_ns"
+#define	ZFS_CREATE_FILES_ERRORS		"errors"
+
+/*
+ * Maximum number of names accepted by a single ZFS_IOC_CREATE_FILES.
+ */
+#define	ZFS_CREATE_FILES_MAX		65536
+
 /*
  * Flags for ZFS_IOC_VDEV_SET_STATE
  */
@@ -39,6 +39,8 @@
 #include <sys/vdev_indirect_mapping.h>
 #include <sys/vdev_indirect_births.h>
 #include <sys/vdev_removal.h>
+#include <sys/vdev_rebuild.h>
+#include <sys/vdev_raidz.h>
 #include <sys/zfs_ratelimit.h>
 
 #ifdef	__cplusplus
@@ -70,7 +72,8 @@ extern uint32_t zfs_vdev_async_write_max_active;
 typedef int	vdev_open_func_t(vdev_t *vd, uint64_t *size, uint64_t *max_size,
     uint64_t *ashift);
 typedef void	vdev_close_func_t(vdev_t *vd);
-typedef uint64_t vdev_asize_func_t(vdev_t *vd, uint64_t psize);
+typedef uint64_t vdev_asize_func_t(vdev_t *vd, uint64_t psize,
+    uint64_t txg);
 typedef void	vdev_io_start_func_t(zio_t *zio);
 typedef void	vdev_io_done_func_t(zio_t *zio);
 typedef void	vdev_state_change_func_t(vdev_t *vd, int, int);
@@ -86,8 +89,8 @@ typedef void	vdev_remap_func_t(vdev_t *vd, uint64_t offset, uint64_t size,
  * Given a target vdev, translates the logical range "in" to the physical
  * range "res"
  */
-typedef void vdev_xlation_func_t(vdev_t *cvd, const range_seg_t *in,
-    range_seg_t *res);
+typedef void vdev_xlation_func_t(vdev_t *cvd, const range_seg64_t *in,
+    range_seg64_t *res);
 
 typedef const struct vdev_ops {
 	vdev_open_func_t		*vdev_op_open;
@@ -149,6 +152,13 @@ struct vdev_queue {
 	uint64_t	vq_last_offset;
 	hrtime_t	vq_io_complete_ts; /* time last i/o completed */
 	hrtime_t	vq_io_delta_ts;
+	hrtime_t	vq_read_ewma;	/* average read service time */
+	hrtime_t	vq_read_ewma_ts; /* time of last read sampled */
+	uint64_t	vq_read_samples; /* reads sampled into vq_read_ewma */
+	hrtime_t	vq_write_ewma;	/* average write service time */
+	hrtime_t	vq_write_ewma_ts; /* time of last write sampled */
+	uint64_t	vq_write_samples; /* writes in vq_write_ewma */
+	kstat_t		*vq_ksp;	/* latency kstat, for leaves */
 	zio_t		vq_io_search; /* used as local for stack reduction */
 	kmutex_t	vq_lock;
 };
@@ -297,6 +307,25 @@ struct vdev {
 	uint64_t	vdev_trim_secure;	/* requested secure TRIM */
 	time_t		vdev_trim_action_time;	/* start and end time */
 
+	/* Rebuild related */
+	boolean_t	vdev_rebuilding;
+	boolean_t	vdev_rebuild_exit_wanted;
+	boolean_t	vdev_rebuild_reset_wanted;
+	/* Protects vdev_rebuild_thread and vdev_rebuild_config. */
+	kmutex_t	vdev_rebuild_lock;
+	kcondvar_t	vdev_rebuild_cv;
+	kthread_t	*vdev_rebuild_thread;
+	vdev_rebuild_t	vdev_rebuild_config;
+
+	/* RAIDZ expansion related */
+	boolean_t	vdev_raidz_expanding;
+	boolean_t	vdev_raidz_expand_exit_wanted;
+	/* Protects vdev_raidz_expand_thread. */
+	kmutex_t	vdev_raidz_expand_lock;
+	kcondvar_t	vdev_raidz_expand_cv;
+	kthread_t	*vdev_raidz_expand_thread;
+	vdev_raidz_expand_t vdev_raidz_expand;
+
 	/* for limiting outstanding I/Os (initialize and TRIM) */
 	kmutex_t	vdev_initialize_io_lock;
 	kcondvar_t	vdev_initialize_io_cv;
@@ -360,6 +389,7 @@ struct vdev {
 	uint64_t	vdev_degraded;	/* persistent degraded state	*/
 	uint64_t	vdev_removed;	/* persistent removed state	*/
 	uint64_t	vdev_resilver_txg; /* persistent resilvering state */
+	uint64_t	vdev_rebuild_txg; /* persistent rebuilding state */
 	uint64_t	vdev_nparity;	/* number of parity devices for raidz */
 	char		*vdev_path;	/* vdev path (if any)		*/
 	char		*vdev_devid;	/* vdev devid (if any)		*/
@@ -526,9 +556,10 @@ extern vdev_ops_t vdev_indirect_ops;
 /*
  * Common size functions
  */
-extern void vdev_default_xlate(vdev_t *vd, const range_seg_t *in,
-    range_seg_t *out);
-extern uint64_t vdev_default_asize(vdev_t *vd, uint64_t psize);
+extern void vdev_default_xlate(vdev_t *vd, const range_seg64_t *in,
+    range_seg64_t *out);
+extern uint64_t vdev_default_asize(vdev_t *vd, uint64_t psize,
+    uint64_t txg);
 extern uint64_t vdev_get_min_asize(vdev_t *vd);
 extern void vdev_set_min_asize(vdev_t *vd);
 
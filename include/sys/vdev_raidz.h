@@ -26,6 +26,10 @@
 #define	_SYS_VDEV_RAIDZ_H
 
 #include <sys/types.h>
+#include <sys/nvpair.h>
+#include <sys/fs/zfs.h>
+#include <sys/txg.h>
+#include <sys/zfs_rlock.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -33,10 +37,66 @@ extern "C" {
 
 struct zio;
 struct raidz_map;
+struct vdev;
+struct spa;
 #if !defined(_KERNEL)
 struct kernel_param {};
 #endif
 
+/*
+ * Number of entries in the physical vdev_raidz_expand_phys structure.  This
+ * state is stored per top-level as VDEV_TOP_ZAP_RAIDZ_EXPAND_PHYS.
+ */
+#define	RAIDZ_EXPAND_PHYS_ENTRIES	7
+
+/*
+ * On-disk raidz expansion state.  When adding new fields they must be
+ * added to the end of the structure.
+ */
+typedef struct vdev_raidz_expand_phys {
+	uint64_t	vrep_state;		/* vdev_raidz_expand_state_t */
+	uint64_t	vrep_start_time;	/* start time */
+	uint64_t	vrep_end_time;		/* end time */
+	uint64_t	vrep_bytes_to_reflow;	/* allocated bytes at start */
+	uint64_t	vrep_bytes_reflowed;	/* allocated bytes reflowed */
+	uint64_t	vrep_errors;		/* errors during reflow */
+	uint64_t	vrep_children;		/* children after expansion */
+} vdev_raidz_expand_phys_t;
+
+/*
+ * The vdev_raidz_expand_t describes the geometry of a raidz vdev which has
+ * had disks attached to it, and the progress of an expansion in flight.
+ *
+ * Every block is laid out in logical rows of the width the vdev had when
+ * the block was born, vre_width0 plus the number of vre_txgs entries that
+ * are not after its birth txg.  The resulting stream of sectors, which is
+ * what DVA offsets address, is stored in physical rows across all children.
+ * While expanding, the sectors below vre_offset have already been reflowed
+ * onto all children and the rest still use one child fewer.  The geometry
+ * is kept in the vdev config since the MOS may be stored on this vdev.
+ */
+typedef struct vdev_raidz_expand {
+	uint64_t	vre_width0;		/* width of the oldest blocks */
+	uint64_t	*vre_txgs;		/* txgs at which the width grew */
+	uint64_t	vre_ntxgs;		/* valid entries in vre_txgs */
+	uint64_t	vre_txgs_max;		/* allocated entries in vre_txgs */
+
+	/* Reflow progress, the synced offset is also in the config */
+	uint64_t	vre_offset;		/* in-core reflow offset */
+	uint64_t	vre_offset_phys;	/* offset in the config */
+	uint64_t	vre_offset_phys_txg;	/* txg writing offset_phys */
+	uint64_t	vre_offset_prev;	/* previous offset_phys */
+	uint64_t	vre_offset_pertxg[TXG_SIZE];
+
+	/* Serializes logical I/O with the reflow of the same sectors */
+	rangelock_t	vre_rangelock;
+
+	/* On-disk state updated by vdev_raidz_expand_zap_update() */
+	vdev_raidz_expand_phys_t vre_phys;
+} vdev_raidz_expand_t;
+
+extern unsigned long raidz_expand_max_copy_bytes;
+
 /*
  * vdev_raidz interface
  */
@@ -46,6 +106,23 @@ void vdev_raidz_map_free(struct raidz_map *);
 void vdev_raidz_generate_parity(struct raidz_map *);
 int vdev_raidz_reconstruct(struct raidz_map *, const int *, int);
 
+/*
+ * vdev_raidz expansion interface
+ */
+uint64_t vdev_raidz_logical_width(struct vdev *, uint64_t);
+uint64_t vdev_raidz_physical_width(struct vdev *);
+void vdev_raidz_expand_config_init(struct vdev *, uint64_t, uint64_t,
+    uint64_t *, uint_t);
+void vdev_raidz_expand_config_generate(struct vdev *, nvlist_t *);
+void vdev_raidz_expand_fini(struct vdev *);
+void vdev_raidz_expand_start(struct vdev *);
+void vdev_raidz_expand_stop_wait(struct vdev *);
+void vdev_raidz_expand_stop_all(struct spa *);
+void vdev_raidz_expand_restart(struct spa *);
+boolean_t vdev_raidz_expand_active(struct vdev *);
+int vdev_raidz_expand_load(struct vdev *);
+int vdev_raidz_expand_get_stats(struct vdev *, vdev_raidz_expand_stat_t *);
+
 /*
  * vdev_raidz_math interface
  */
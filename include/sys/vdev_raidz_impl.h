@@ -127,6 +127,8 @@ typedef struct raidz_map {
 	uint8_t	rm_freed;		/* map no longer has referencing ZIO */
 	uint8_t	rm_ecksuminjected;	/* checksum error was injected */
 	const raidz_impl_ops_t *rm_ops;	/* RAIDZ math operations */
+	struct raidz_xmap *rm_xmap;	/* sector layout, if not in columns */
+	struct locked_range *rm_lr;	/* expansion range lock, if held */
 	raidz_col_t rm_col[1];		/* Flexible array of I/O columns */
 } raidz_map_t;
 
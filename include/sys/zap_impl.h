@@ -31,7 +31,6 @@
 
 #include <sys/zap.h>
 #include <sys/zfs_context.h>
-#include <sys/avl.h>
 
 #ifdef	__cplusplus
 extern "C" {
@@ -65,15 +64,24 @@ typedef struct mzap_phys {
 	/* actually variable size depending on block size */
 } mzap_phys_t;
 
+/*
+ * The in-core index of a microzap is an open-addressed hash table of
+ * mzap_ent_t, using linear probing.  An entry's home slot is given by the
+ * high bits of its hash, and the table is kept at most half full.  Since
+ * a microzap hash only uses zap_hashbits() (28) bits, the high 32 bits of
+ * the hash are stored exactly.
+ */
 typedef struct mzap_ent {
-	avl_node_t mze_node;
-	int mze_chunkid;
-	uint64_t mze_hash;
-	uint32_t mze_cd; /* copy from mze_phys->mze_cd */
+	uint32_t mze_hash;	/* high 32 bits of the hash */
+	uint16_t mze_cd;	/* copy from mze_phys->mze_cd */
+	uint16_t mze_chunkid;	/* chunk number + 1, 0 if the slot is free */
 } mzap_ent_t;
 
+#define	MZE_TBL_MIN_SHIFT	4
+
+#define	MZE_HASH(mze)	((uint64_t)(mze)->mze_hash << 32)
 #define	MZE_PHYS(zap, mze) \
-	(&zap_m_phys(zap)->mz_chunk[(mze)->mze_chunkid])
+	(&zap_m_phys(zap)->mz_chunk[(mze)->mze_chunkid - 1])
 
 /*
  * The (fat) zap is stored in one object. It is an array of
@@ -154,8 +162,9 @@ typedef struct zap {
 	union {
 		struct {
 			/*
-			 * zap_num_entries_mtx protects
-			 * zap_num_entries
+			 * zap_num_entries_mtx protects zap_num_entries,
+			 * zap_num_leafs and zap_freeblk, which may be
+			 * modified while zap_rwlock is only held as reader
 			 */
 			kmutex_t zap_num_entries_mtx;
 			int zap_block_shift;
@@ -164,7 +173,15 @@ typedef struct zap {
 			int16_t zap_num_entries;
 			int16_t zap_num_chunks;
 			int16_t zap_alloc_next;
-			avl_tree_t zap_avl;
+			int16_t zap_mze_shift;
+			/*
+			 * zap_mze_tbl is built on first use, which may be
+			 * with zap_rwlock held as reader, so building it is
+			 * serialized by zap_mze_lock.  Once built it is only
+			 * modified with zap_rwlock held as writer.
+			 */
+			mzap_ent_t *zap_mze_tbl;
+			kmutex_t zap_mze_lock;
 		} zap_micro;
 	} zap_u;
 } zap_t;
@@ -462,6 +462,25 @@ extern zil_stats_t zil_stats;
 #define	ZIL_STAT_BUMP(stat) \
     ZIL_STAT_INCR(stat, 1);
 
+/*
+ * Stages of a ZIL commit for which latency histograms are kept, both per
+ * pool (zfs/<pool>/zil_latency) and per dataset with an open ZIL
+ * (zfs/<pool>/objset-0x<id>-zil). Each stage has ZIL_LAT_BUCKETS power
+ * of two buckets, from 1us up to 64s and above.
+ */
+typedef enum zil_lat_stage {
+	ZIL_LAT_COMMIT,		/* zil_commit(), start to finish */
+	ZIL_LAT_COMMIT_LIST,	/* zil_get_commit_list() */
+	ZIL_LAT_ASSIGN,		/* assigning itxs to lwbs */
+	ZIL_LAT_ALLOC,		/* zio_alloc_zil() */
+	ZIL_LAT_WRITE,		/* lwb write, from issue to done */
+	ZIL_LAT_FLUSH,		/* vdev cache flushes after the write */
+	ZIL_LAT_STAGES
+} zil_lat_stage_t;
+
+#define	ZIL_LAT_BUCKETS	27
+#define	ZIL_LAT_NSTATS	(ZIL_LAT_STAGES * ZIL_LAT_BUCKETS)
+
 typedef int zil_parse_blk_func_t(zilog_t *zilog, blkptr_t *bp, void *arg,
     uint64_t txg);
 typedef int zil_parse_lr_func_t(zilog_t *zilog, lr_t *lr, void *arg,
@@ -492,11 +511,17 @@ extern void	zil_destroy_sync(zilog_t *zilog, dmu_tx_t *tx);
 extern itx_t	*zil_itx_create(uint64_t txtype, size_t lrsize);
 extern void	zil_itx_destroy(itx_t *itx);
 extern void	zil_itx_assign(zilog_t *zilog, itx_t *itx, dmu_tx_t *tx);
+extern void	zil_add_unlogged_txg(zilog_t *zilog, uint64_t txg);
 
 extern void	zil_commit(zilog_t *zilog, uint64_t oid);
 extern void	zil_commit_impl(zilog_t *zilog, uint64_t oid);
 
 extern int	zil_reset(const char *osname, void *txarg);
+
+extern void	zil_lat_kstat_init(kstat_named_t *ks);
+extern int	zil_lat_kstat_update(kstat_t *ksp, int rw);
+extern void	zil_lat_kstat_add(kstat_named_t *ks, zil_lat_stage_t stage,
+    hrtime_t nsecs);
 extern int	zil_claim(struct dsl_pool *dp,
     struct dsl_dataset *ds, void *txarg);
 extern int 	zil_check_log_chain(struct dsl_pool *dp,
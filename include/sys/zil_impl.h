@@ -38,14 +38,30 @@ extern "C" {
 /*
  * Possible states for a given lwb structure.
  *
- * An lwb will start out in the "closed" state, and then transition to
- * the "opened" state via a call to zil_lwb_write_open(). When
- * transitioning from "closed" to "opened" the zilog's "zl_issuer_lock"
- * must be held.
+ * An lwb will start out in the "new" state, and transition to the
+ * "opened" state via a call to zil_lwb_write_open() on first itx
+ * assignment. While "opened", itxs are assigned to the lwb; i.e. space
+ * in its buffer is reserved for their log records, in commit list
+ * order. When transitioning from "new" to "opened" and from "opened"
+ * to "closed" the zilog's "zl_issuer_lock" must be held.
  *
- * After the lwb is "opened", it can transition into the "issued" state
- * via zil_lwb_write_issue(). Again, the zilog's "zl_issuer_lock" must
- * be held when making this transition.
+ * Once the lwb has no more room, or a commit waiter times out on it,
+ * it transitions to the "closed" state via zil_lwb_write_close(). No
+ * further itxs may be assigned to a "closed" lwb, and the next lwb in
+ * the chain is created to take over. The thread that closed the lwb
+ * then drops the "zl_issuer_lock" and copies the assigned log records
+ * (and any WR_NEED_COPY data) into the lwb's buffer via
+ * zil_lwb_write_issue(), after which the lwb is "ready". Since the
+ * expensive copying happens outside of the "zl_issuer_lock", multiple
+ * committing threads can fill consecutive lwbs of the chain at the
+ * same time.
+ *
+ * A "ready" lwb transitions to "issued" as soon as its own block has
+ * been allocated, which happens when the previous lwb in the chain is
+ * issued; lwbs are thus always issued in chain order, by whichever
+ * thread gets there last. The "ready" and "issued" transitions, and
+ * the allocation of the next block, are done while holding the
+ * zilog's "zl_lock", *not* the "zl_issuer_lock".
  *
  * After the lwb's write zio completes, it transitions into the "write
  * done" state via zil_lwb_write_done(); and then into the "flush done"
@@ -54,25 +70,28 @@ extern "C" {
  * the zilog's "zl_lock" must be held, *not* the "zl_issuer_lock".
  *
  * The zilog's "zl_issuer_lock" can become heavily contended in certain
- * workloads, so we specifically avoid acquiring that lock when
- * transitioning an lwb from "issued" to "done". This allows us to avoid
- * having to acquire the "zl_issuer_lock" for each lwb ZIO completion,
- * which would have added more lock contention on an already heavily
- * contended lock.
+ * workloads, so we specifically avoid acquiring that lock when filling
+ * and issuing an lwb, and when transitioning an lwb from "issued" to
+ * "done". This allows us to avoid having to acquire the
+ * "zl_issuer_lock" for each lwb ZIO completion, which would have added
+ * more lock contention on an already heavily contended lock.
  *
  * Additionally, correctness when reading an lwb's state is often
  * achieved by exploiting the fact that these state transitions occur in
- * this specific order; i.e. "closed" to "opened" to "issued" to "done".
+ * this specific order; i.e. "new" to "opened" to "closed" to "ready" to
+ * "issued" to "done".
  *
- * Thus, if an lwb is in the "closed" or "opened" state, holding the
+ * Thus, if an lwb is in the "new" or "opened" state, holding the
  * "zl_issuer_lock" will prevent a concurrent thread from transitioning
- * that lwb to the "issued" state. Likewise, if an lwb is already in the
+ * that lwb to the "closed" state. Likewise, if an lwb is already in the
  * "issued" state, holding the "zl_lock" will prevent a concurrent
  * thread from transitioning that lwb to the "write done" state.
  */
 typedef enum {
-    LWB_STATE_CLOSED,
+    LWB_STATE_NEW,
     LWB_STATE_OPENED,
+    LWB_STATE_CLOSED,
+    LWB_STATE_READY,
     LWB_STATE_ISSUED,
     LWB_STATE_WRITE_DONE,
     LWB_STATE_FLUSH_DONE,
@@ -82,31 +101,39 @@ typedef enum {
 /*
  * Log write block (lwb)
  *
- * Prior to an lwb being issued to disk via zil_lwb_write_issue(), it
- * will be protected by the zilog's "zl_issuer_lock". Basically, prior
- * to it being issued, it will only be accessed by the thread that's
- * holding the "zl_issuer_lock". After the lwb is issued, the zilog's
- * "zl_lock" is used to protect the lwb against concurrent access.
+ * Prior to an lwb being closed via zil_lwb_write_close(), it will be
+ * protected by the zilog's "zl_issuer_lock". Basically, prior to it
+ * being closed, it will only be accessed by the thread that's holding
+ * the "zl_issuer_lock". A closed lwb is owned by the thread that closed
+ * it until it is "ready"; after that, the zilog's "zl_lock" is used to
+ * protect the lwb against concurrent access.
  */
 typedef struct lwb {
 	zilog_t		*lwb_zilog;	/* back pointer to log struct */
 	blkptr_t	lwb_blk;	/* on disk address of this log blk */
+	boolean_t	lwb_slim;	/* log block has ZILOG2 header */
 	boolean_t	lwb_fastwrite;	/* is blk marked for fastwrite? */
 	boolean_t	lwb_slog;	/* lwb_blk is on SLOG device */
+	int		lwb_error;	/* log block allocation error */
 	int		lwb_nused;	/* # used bytes in buffer */
+	int		lwb_nfilled;	/* # filled bytes in buffer */
 	int		lwb_sz;		/* size of block and buffer */
 	lwb_state_t	lwb_state;	/* the state of this lwb */
 	char		*lwb_buf;	/* log write buffer */
+	zio_t		*lwb_child_zio;	/* parent zio for lwb data writes */
 	zio_t		*lwb_write_zio;	/* zio for the lwb buffer */
 	zio_t		*lwb_root_zio;	/* root zio for lwb write and flushes */
-	dmu_tx_t	*lwb_tx;	/* tx for log block allocation */
+	dmu_tx_t	*lwb_tx;	/* tx for next log block allocation */
+	uint64_t	lwb_alloc_txg;	/* txg when lwb_blk was allocated */
 	uint64_t	lwb_max_txg;	/* highest txg in this lwb */
 	list_node_t	lwb_node;	/* zilog->zl_lwb_list linkage */
+	list_node_t	lwb_issue_node;	/* linkage on list of lwbs to issue */
 	list_t		lwb_itxs;	/* list of itx's */
 	list_t		lwb_waiters;	/* list of zil_commit_waiter's */
 	avl_tree_t	lwb_vdev_tree;	/* vdevs to flush after lwb write */
 	kmutex_t	lwb_vdev_lock;	/* protects lwb_vdev_tree */
 	hrtime_t	lwb_issued_timestamp; /* when was the lwb issued? */
+	hrtime_t	lwb_write_done_timestamp; /* write done time */
 } lwb_t;
 
 /*
@@ -164,7 +191,7 @@ typedef struct zil_vdev_node {
 	avl_node_t	zv_node;	/* AVL tree linkage */
 } zil_vdev_node_t;
 
-#define	ZIL_PREV_BLKS 16
+#define	ZIL_PREV_COMMITS 16
 
 /*
  * Stable storage intent log management structure.  One per dataset.
@@ -189,7 +216,7 @@ struct zilog {
 	uint8_t		zl_keep_first;	/* keep first log block in destroy */
 	uint8_t		zl_replay;	/* replaying records while set */
 	uint8_t		zl_stop_sync;	/* for debugging */
-	kmutex_t	zl_issuer_lock;	/* single writer, per ZIL, at a time */
+	kmutex_t	zl_issuer_lock;	/* single assigner per ZIL at a time */
 	uint8_t		zl_logbias;	/* latency or throughput */
 	uint8_t		zl_sync;	/* synchronous or asynchronous */
 	int		zl_parse_error;	/* last zil_parse() error */
@@ -205,10 +232,14 @@ struct zilog {
 	clock_t		zl_replay_time;	/* lbolt of when replay started */
 	uint64_t	zl_replay_blks;	/* number of log blocks replayed */
 	zil_header_t	zl_old_header;	/* debugging aid */
-	uint_t		zl_prev_blks[ZIL_PREV_BLKS]; /* size - sector rounded */
-	uint_t		zl_prev_rotor;	/* rotor for zl_prev[] */
+	uint64_t	zl_cur_size;	/* log data of the current commit */
+	uint64_t	zl_cur_max;	/* largest record of current commit */
+	uint64_t	zl_prev_commits[ZIL_PREV_COMMITS]; /* recent sizes */
+	uint_t		zl_prev_rotor;	/* rotor for zl_prev_commits[] */
 	txg_node_t	zl_dirty_link;	/* protected by dp_dirty_zilogs list */
 	uint64_t	zl_dirty_max_txg; /* highest txg used to dirty zilog */
+	uint64_t	zl_unlogged_txg; /* highest txg with unlogged changes */
+	kstat_t		*zl_lat_kstat;	/* latency histograms, while open */
 	/*
 	 * Max block size for this ZIL.  Note that this can not be changed
 	 * while the ZIL is in use because consumers (ZPL/zvol) need to take
@@ -0,0 +1,66 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#ifndef	_ZFS_ZSTD_H
+#define	_ZFS_ZSTD_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Every zstd compressed block begins with this header.  The block pointer
+ * has no room for the compression level, so it is kept here instead,
+ * next to the version of the library that produced the block.  Both
+ * fields are stored big endian:
+ *
+ *	c_len			size of the compressed payload in bytes
+ *	raw_version_level	bits 31-8: ZSTD_VERSION_NUMBER
+ *				bits  7-0: enum zio_zstd_levels
+ */
+typedef struct zfs_zstd_header {
+	uint32_t	c_len;
+	uint32_t	raw_version_level;
+	char		data[];
+} zfs_zstdhdr_t;
+
+#define	ZFS_ZSTD_HDR_VERSION(raw)	((raw) >> 8)
+#define	ZFS_ZSTD_HDR_LEVEL(raw)		((uint8_t)((raw) & 0xff))
+#define	ZFS_ZSTD_HDR_RAW(version, level)	\
+	(((uint32_t)(version) << 8) | ((level) & 0xff))
+
+/* (de)init for user space / kernel emulation */
+extern int zstd_init(void);
+extern void zstd_fini(void);
+
+extern size_t zfs_zstd_compress(void *s_start, void *d_start, size_t s_len,
+    size_t d_len, int level);
+extern int zfs_zstd_get_level(void *s_start, size_t s_len, uint8_t *level);
+extern int zfs_zstd_decompress_level(void *s_start, void *d_start,
+    size_t s_len, size_t d_len, uint8_t *level);
+extern int zfs_zstd_decompress(void *s_start, void *d_start, size_t s_len,
+    size_t d_len, int n);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif /* _ZFS_ZSTD_H */
@@ -72,6 +72,11 @@ typedef enum spa_feature {
 	SPA_FEATURE_BOOKMARK_WRITTEN,
 	SPA_FEATURE_LOG_SPACEMAP,
 	SPA_FEATURE_LIVELIST,
+	SPA_FEATURE_ZSTD_COMPRESS,
+	SPA_FEATURE_DEVICE_REBUILD,
+	SPA_FEATURE_BLOCK_CLONING,
+	SPA_FEATURE_DEDUP_LOG,
+	SPA_FEATURE_RAIDZ_EXPANSION,
 	SPA_FEATURES
 } spa_feature_t;
 
@@ -46,6 +46,7 @@
 #include <fcntl.h>
 #include <sys/mntent.h>
 #include <sys/mount.h>
+#include <sys/stat.h>
 #include <pwd.h>
 #include <grp.h>
 #include <stddef.h>
@@ -4494,6 +4495,80 @@ zfs_rollback(zfs_handle_t *zhp, zfs_handle_t *snap, boolean_t force)
 	return (err);
 }
 
+/*
+ * Creates empty regular files with the given names in the directory 'dir'
+ * of the mounted filesystem 'zhp', many per transaction.  Names which could
+ * not be created (for example because they already exist) do not cause a
+ * failure.  If 'statsp' is not NULL it is set to an nvlist with the summed
+ * "created", "failed", "txs" and "time_ns" counts and an "errors" nvlist
+ * mapping each failed name to its errno.
+ */
+int
+zfs_create_files(zfs_handle_t *zhp, const char *dir, char * const *names,
+    uint_t count, mode_t mode, nvlist_t **statsp)
+{
+	libzfs_handle_t *hdl = zhp->zfs_hdl;
+	static const char *counters[] = { ZFS_CREATE_FILES_CREATED,
+	    ZFS_CREATE_FILES_FAILED, ZFS_CREATE_FILES_TXS,
+	    ZFS_CREATE_FILES_TIME_NS };
+	nvlist_t *stats, *errors, *result, *nvl;
+	struct stat64 statbuf;
+	char errbuf[1024];
+	uint_t i, n;
+	int error = 0;
+
+	(void) snprintf(errbuf, sizeof (errbuf), dgettext(TEXT_DOMAIN,
+	    "cannot create files in '%s'"), dir);
+
+	if (zhp->zfs_type != ZFS_TYPE_FILESYSTEM)
+		return (zfs_error(hdl, EZFS_BADTYPE, errbuf));
+
+	if (stat64(dir, &statbuf) != 0)
+		return (zfs_standard_error(hdl, errno, errbuf));
+
+	if (!S_ISDIR(statbuf.st_mode))
+		return (zfs_standard_error(hdl, ENOTDIR, errbuf));
+
+	stats = fnvlist_alloc();
+	errors = fnvlist_alloc();
+	for (i = 0; i < ARRAY_SIZE(counters); i++)
+		fnvlist_add_uint64(stats, counters[i], 0);
+
+	/* The object number of a ZFS directory is its inode number */
+	for (i = 0; i < count && error == 0; i += n) {
+		n = MIN(count - i, ZFS_CREATE_FILES_MAX);
+		result = NULL;
+		error = lzc_create_files(zhp->zfs_name, statbuf.st_ino,
+		    &names[i], n, mode, &result);
+		if (result == NULL)
+			continue;
+
+		for (uint_t c = 0; c < ARRAY_SIZE(counters); c++) {
+			uint64_t val = 0;
+
+			(void) nvlist_lookup_uint64(result, counters[c], &val);
+			fnvlist_add_uint64(stats, counters[c],
+			    fnvlist_lookup_uint64(stats, counters[c]) + val);
+		}
+		if (nvlist_lookup_nvlist(result, ZFS_CREATE_FILES_ERRORS,
+		    &nvl) == 0)
+			fnvlist_merge(errors, nvl);
+		fnvlist_free(result);
+	}
+	fnvlist_add_nvlist(stats, ZFS_CREATE_FILES_ERRORS, errors);
+	fnvlist_free(errors);
+
+	if (statsp != NULL)
+		*statsp = stats;
+	else
+		fnvlist_free(stats);
+
+	if (error != 0)
+		return (zfs_standard_error(hdl, error, errbuf));
+
+	return (0);
+}
+
 /*
  * Renames the given dataset.
  */
@@ -1615,3 +1615,58 @@ lzc_wait_tag(const char *pool, zpool_wait_activity_t activity, uint64_t tag,
 {
 	return (wait_common(pool, activity, B_TRUE, tag, waited));
 }
+
+/*
+ * Remove the given percentage (1-100) of the unique entries from the
+ * pool's dedup tables, oldest first.  The blocks they describe remain but
+ * are no longer deduplicated.
+ */
+int
+lzc_ddt_prune(const char *pool, uint64_t percentage)
+{
+	int error;
+
+	nvlist_t *result = NULL;
+	nvlist_t *args = fnvlist_alloc();
+
+	fnvlist_add_uint64(args, ZPOOL_DDT_PRUNE_PERCENTAGE, percentage);
+
+	error = lzc_ioctl(ZFS_IOC_DDT_PRUNE, pool, args, &result);
+
+	fnvlist_free(args);
+	fnvlist_free(result);
+
+	return (error);
+}
+
+/*
+ * Create empty regular files with the given names and permission bits in
+ * the directory with object number "dirobj" of the mounted filesystem
+ * "fsname".  Many files are created per transaction, which is much faster
+ * than creating them one at a time.  At most ZFS_CREATE_FILES_MAX names
+ * may be passed.
+ *
+ * Names which could not be created do not cause the call to fail.  The
+ * result nvlist reports the number of files created and failed, the
+ * number of transactions and the time used, and an "errors" nvlist
+ * mapping each failed name to its errno.  When there are too many failed
+ * names to return, "errors" is omitted.  The caller must free the result.
+ */
+int
+lzc_create_files(const char *fsname, uint64_t dirobj, char * const *names,
+    uint_t count, uint64_t mode, nvlist_t **resultp)
+{
+	int error;
+
+	nvlist_t *args = fnvlist_alloc();
+
+	fnvlist_add_uint64(args, ZFS_CREATE_FILES_DIR_OBJ, dirobj);
+	fnvlist_add_string_array(args, ZFS_CREATE_FILES_NAMES, names, count);
+	fnvlist_add_uint64(args, ZFS_CREATE_FILES_MODE, mode);
+
+	error = lzc_ioctl(ZFS_IOC_CREATE_FILES, fsname, args, resultp);
+
+	fnvlist_free(args);
+
+	return (error);
+}
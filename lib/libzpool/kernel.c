@@ -43,6 +43,7 @@
 #include <sys/systeminfo.h>
 #include <zfs_fletcher.h>
 #include <sys/crypto/icp.h>
+#include <sys/zstd/zstd.h>
 
 /*
  * Emulation of kernel services in userland.
@@ -1117,6 +1118,8 @@ kernel_init(int mode)
 	system_taskq_init();
 	icp_init();
 
+	zstd_init();
+
 	spa_init(mode);
 
 	fletcher_4_init();
@@ -1130,6 +1133,8 @@ kernel_fini(void)
 	fletcher_4_fini();
 	spa_fini();
 
+	zstd_fini();
+
 	icp_fini();
 	system_taskq_fini();
 
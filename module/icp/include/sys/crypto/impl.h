@@ -238,7 +238,9 @@ typedef struct kcf_provider_list {
 } kcf_provider_list_t;
 
 /* atomic operations in linux implicitly form a memory barrier */
+#ifndef membar_exit
 #define	membar_exit()
+#endif
 
 /*
  * If a component has a reference to a kcf_provider_desc_t,
@@ -191,6 +191,76 @@ z_uncompress(void *dest, size_t *destLen, const void *source, size_t sourceLen)
 }
 EXPORT_SYMBOL(z_uncompress);
 
+/*
+ * Streaming interface for callers which supply their input in several
+ * pieces, e.g. one page of a scatter ABD at a time.  The init functions
+ * attach a workspace to the stream and the end functions release it; in
+ * between the caller drives the stream with zlib_deflate()/zlib_inflate().
+ */
+int
+z_deflate_init(z_stream *stream, int level)
+{
+	int err;
+
+	stream->workspace = zlib_workspace_alloc(KM_SLEEP);
+	if (!stream->workspace)
+		return (Z_MEM_ERROR);
+
+	err = zlib_deflateInit(stream, level);
+	if (err != Z_OK) {
+		zlib_workspace_free(stream->workspace);
+		stream->workspace = NULL;
+	}
+
+	return (err);
+}
+EXPORT_SYMBOL(z_deflate_init);
+
+int
+z_deflate_end(z_stream *stream)
+{
+	int err;
+
+	err = zlib_deflateEnd(stream);
+	zlib_workspace_free(stream->workspace);
+	stream->workspace = NULL;
+
+	return (err);
+}
+EXPORT_SYMBOL(z_deflate_end);
+
+int
+z_inflate_init(z_stream *stream)
+{
+	int err;
+
+	stream->workspace = zlib_workspace_alloc(KM_SLEEP);
+	if (!stream->workspace)
+		return (Z_MEM_ERROR);
+
+	err = zlib_inflateInit(stream);
+	if (err != Z_OK) {
+		zlib_workspace_free(stream->workspace);
+		stream->workspace = NULL;
+	}
+
+	return (err);
+}
+EXPORT_SYMBOL(z_inflate_init);
+
+int
+z_inflate_end(z_stream *stream)
+{
+	int err;
+
+	err = zlib_inflateEnd(stream);
+	zlib_workspace_free(stream->workspace);
+	stream->workspace = NULL;
+
+	return (err);
+}
+EXPORT_SYMBOL(z_inflate_end);
+
 int
 spl_zlib_init(void)
 {
@@ -23,6 +23,7 @@
 #include <sys/spa_impl.h>
 #include <sys/vdev_impl.h>
 #include <sys/spa.h>
+#include <sys/zil.h>
 #include <zfs_comutil.h>
 
 /*
@@ -989,6 +990,58 @@ spa_iostats_destroy(spa_t *spa)
 	mutex_destroy(&shk->lock);
 }
 
+/*
+ * ==========================================================================
+ * SPA ZIL Latency Histogram Routines
+ * ==========================================================================
+ */
+
+/*
+ * Latency histograms of the ZIL commit stages, aggregated over all the
+ * datasets of the pool; see zil_lat_add().
+ */
+static void
+spa_zil_latency_init(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.zil_latency;
+
+	mutex_init(&shk->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	shk->count = ZIL_LAT_NSTATS;
+	shk->size = shk->count * sizeof (kstat_named_t);
+	shk->private = kmem_alloc(shk->size, KM_SLEEP);
+	zil_lat_kstat_init(shk->private);
+
+	char *name = kmem_asprintf("zfs/%s", spa_name(spa));
+	kstat_t *ksp = kstat_create(name, 0, "zil_latency", "misc",
+	    KSTAT_TYPE_NAMED, 0, KSTAT_FLAG_VIRTUAL);
+
+	shk->kstat = ksp;
+	if (ksp) {
+		ksp->ks_lock = &shk->lock;
+		ksp->ks_data = shk->private;
+		ksp->ks_ndata = shk->count;
+		ksp->ks_data_size = shk->size;
+		ksp->ks_private = spa;
+		ksp->ks_update = zil_lat_kstat_update;
+		kstat_install(ksp);
+	}
+
+	strfree(name);
+}
+
+static void
+spa_zil_latency_destroy(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.zil_latency;
+	kstat_t *ksp = shk->kstat;
+	if (ksp)
+		kstat_delete(ksp);
+
+	kmem_free(shk->private, shk->size);
+	mutex_destroy(&shk->lock);
+}
+
 void
 spa_stats_init(spa_t *spa)
 {
@@ -999,11 +1052,13 @@ spa_stats_init(spa_t *spa)
 	spa_mmp_history_init(spa);
 	spa_state_init(spa);
 	spa_iostats_init(spa);
+	spa_zil_latency_init(spa);
 }
 
 void
 spa_stats_destroy(spa_t *spa)
 {
+	spa_zil_latency_destroy(spa);
 	spa_iostats_destroy(spa);
 	spa_health_destroy(spa);
 	spa_tx_assign_destroy(spa);
@@ -54,6 +54,8 @@
 #include <sys/fs/zfs.h>
 #include <sys/zfs_ctldir.h>
 #include <sys/zfs_dir.h>
+#include <sys/zfs_vnops.h>
+#include <sys/zfs_znode.h>
 #include <sys/zfs_onexit.h>
 #include <sys/zvol.h>
 #include <sys/fm/util.h>
@@ -205,9 +207,174 @@ zfsdev_getminor(struct file *filp, minor_t *minorp)
 	return (SET_ERROR(EBADF));
 }
 
+/*
+ * Drop any negative dentries cached for the newly created names, they
+ * were added behind the back of the dcache.  The caller holds the
+ * directory's inode lock so no new lookups can race with this.
+ */
+static void
+zfs_create_files_prune_dentries(struct inode *dip, char **names,
+    uint_t count, int *errors)
+{
+	struct dentry *parent, *dentry;
+	struct qstr name;
+	uint_t i;
+
+	parent = d_find_alias(dip);
+	if (parent == NULL)
+		return;
+
+	for (i = 0; i < count; i++) {
+		if (errors[i] != 0)
+			continue;
+
+		name.name = names[i];
+		name.len = strlen(names[i]);
+		dentry = d_hash_and_lookup(parent, &name);
+		if (IS_ERR_OR_NULL(dentry))
+			continue;
+
+		if (dentry->d_inode == NULL)
+			d_drop(dentry);
+		dput(dentry);
+	}
+
+	dput(parent);
+}
+
+/*
+ * Create many empty regular files in one directory of a mounted
+ * filesystem, see zfs_create_batch().  The directory is given by object
+ * number rather than path so that no path traversal is required.
+ *
+ * innvl: {
+ *     "dir_obj" -> uint64_t (object number of the directory)
+ *     "names" -> string array (names of the files to create)
+ *     (optional) "mode" -> uint64_t (permission bits, default 0644)
+ * }
+ *
+ * outnvl: {
+ *     "created" -> uint64_t (files created)
+ *     "failed" -> uint64_t (names which could not be created)
+ *     "txs" -> uint64_t (transactions used)
+ *     "time_ns" -> uint64_t (time spent creating the files)
+ *     "errors" -> { name -> int32_t (errno) } (only failed names)
+ * }
+ *
+ * If the "errors" nvlist does not fit in the output buffer it is
+ * replaced by "N_MORE_ERRORS".
+ */
+static const zfs_ioc_key_t zfs_keys_create_files[] = {
+	{ZFS_CREATE_FILES_DIR_OBJ,	DATA_TYPE_UINT64,	0},
+	{ZFS_CREATE_FILES_NAMES,	DATA_TYPE_STRING_ARRAY,	0},
+	{ZFS_CREATE_FILES_MODE,		DATA_TYPE_UINT64,	ZK_OPTIONAL},
+};
+
+static int
+zfs_ioc_create_files(const char *fsname, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	zfs_create_batch_stats_t zcbs;
+	zfsvfs_t *zfsvfs;
+	znode_t *dzp;
+	struct inode *dip;
+	cred_t *cr = CRED();
+	fstrans_cookie_t cookie;
+	vattr_t vattr;
+	nvlist_t *errlist;
+	char **names;
+	uint64_t dirobj, mode = 0644;
+	uint_t count, i;
+	int *errors;
+	int error;
+
+	if (nvlist_lookup_uint64(innvl, ZFS_CREATE_FILES_DIR_OBJ,
+	    &dirobj) != 0 ||
+	    nvlist_lookup_string_array(innvl, ZFS_CREATE_FILES_NAMES,
+	    &names, &count) != 0)
+		return (SET_ERROR(EINVAL));
+
+	(void) nvlist_lookup_uint64(innvl, ZFS_CREATE_FILES_MODE, &mode);
+	if (count == 0 || count > ZFS_CREATE_FILES_MAX || (mode & ~07777))
+		return (SET_ERROR(EINVAL));
+
+	if ((error = getzfsvfs(fsname, &zfsvfs)) != 0)
+		return (error);
+
+	rrm_enter_read(&zfsvfs->z_teardown_lock, FTAG);
+	if (zfsvfs->z_unmounted)
+		error = SET_ERROR(EIO);
+	else
+		error = zfs_zget(zfsvfs, dirobj, &dzp);
+	rrm_exit(&zfsvfs->z_teardown_lock, FTAG);
+	if (error != 0) {
+		deactivate_super(zfsvfs->z_sb);
+		return (error);
+	}
+	dip = ZTOI(dzp);
+
+	if (!S_ISDIR(dip->i_mode)) {
+		iput(dip);
+		deactivate_super(zfsvfs->z_sb);
+		return (SET_ERROR(ENOTDIR));
+	}
+
+	crhold(cr);
+	bzero(&vattr, sizeof (vattr));
+	zpl_vap_init(&vattr, dip, S_IFREG | mode, cr);
+	errors = kmem_zalloc(count * sizeof (int), KM_SLEEP);
+
+	/*
+	 * Hold the directory's inode lock as the VFS does for a create,
+	 * this serializes the batch with lookups through the dcache.
+	 * Security labels and inherited POSIX ACLs are not applied to
+	 * the new files.
+	 */
+	spl_inode_lock(dip);
+	cookie = spl_fstrans_mark();
+	error = zfs_create_batch(dip, names, count, &vattr, cr, errors, &zcbs);
+	spl_fstrans_unmark(cookie);
+	if (zcbs.zcbs_created != 0)
+		zfs_create_files_prune_dentries(dip, names, count, errors);
+	spl_inode_unlock(dip);
+
+	fnvlist_add_uint64(outnvl, ZFS_CREATE_FILES_CREATED,
+	    zcbs.zcbs_created);
+	fnvlist_add_uint64(outnvl, ZFS_CREATE_FILES_FAILED, zcbs.zcbs_failed);
+	fnvlist_add_uint64(outnvl, ZFS_CREATE_FILES_TXS, zcbs.zcbs_txs);
+	fnvlist_add_uint64(outnvl, ZFS_CREATE_FILES_TIME_NS,
+	    zcbs.zcbs_time_ns);
+	if (zcbs.zcbs_failed != 0) {
+		errlist = fnvlist_alloc();
+		for (i = 0; i < count; i++) {
+			if (errors[i] != 0)
+				fnvlist_add_int32(errlist, names[i], errors[i]);
+		}
+		fnvlist_add_nvlist(outnvl, ZFS_CREATE_FILES_ERRORS, errlist);
+		fnvlist_free(errlist);
+	}
+
+	kmem_free(errors, count * sizeof (int));
+	crfree(cr);
+	iput(dip);
+	deactivate_super(zfsvfs->z_sb);
+
+	return (error);
+}
+
 void
 zfs_ioctl_init_os(void)
 {
+	/*
+	 * Creating files by directory object number bypasses the usual
+	 * path based permission checks, so this is limited to root.  The
+	 * files are created whether or not the output fits, so rather than
+	 * failing with ENOMEM (and being retried) the "errors" nvlist is
+	 * dropped if it is too large.
+	 */
+	zfs_ioctl_register("create_files", ZFS_IOC_CREATE_FILES,
+	    zfs_ioc_create_files, zfs_secpolicy_config, DATASET_NAME,
+	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_TRUE, B_FALSE,
+	    zfs_keys_create_files, ARRAY_SIZE(zfs_keys_create_files));
 }
 
 #ifdef CONFIG_COMPAT
@@ -52,6 +52,7 @@
 #include <sys/dmu.h>
 #include <sys/dmu_objset.h>
 #include <sys/spa.h>
+#include <sys/zfeature.h>
 #include <sys/txg.h>
 #include <sys/dbuf.h>
 #include <sys/zap.h>
@@ -69,6 +70,7 @@
 #include <sys/zpl.h>
 #include <sys/zil.h>
 #include <sys/sa_impl.h>
+#include <linux/vmalloc.h>
 
 /*
  * Programming rules.
@@ -412,6 +414,131 @@ mappedread(struct inode *ip, int nbytes, uio_t *uio)
 	}
 	return (error);
 }
+
+/*
+ * Direct I/O pins the caller's pages and maps them into a contiguous
+ * kernel address range so that whole blocks can be handed to
+ * dmu_read_direct() and dmu_write_direct() without copying them through
+ * the ARC.  Only user buffers whose current iovec covers the request are
+ * handled; anything else is left to the buffered path.
+ */
+typedef struct zfs_dio_map {
+	struct page	**zdm_pages;
+	int		zdm_npages;
+	void		*zdm_vaddr;
+	void		*zdm_buf;
+} zfs_dio_map_t;
+
+static int
+zfs_dio_map(uio_t *uio, size_t len, boolean_t for_read, zfs_dio_map_t *zdm)
+{
+#ifdef HAVE_GET_USER_PAGES_UNLOCKED_GUP_FLAGS
+	const struct iovec *iov = uio->uio_iov;
+	unsigned long addr;
+	long npinned;
+
+	if (uio->uio_segflg != UIO_USERSPACE ||
+	    iov->iov_len - uio->uio_skip < len)
+		return (SET_ERROR(ENOTSUP));
+
+	addr = (unsigned long)iov->iov_base + uio->uio_skip;
+	if (!IS_P2ALIGNED(addr, SPA_MINBLOCKSIZE))
+		return (SET_ERROR(ENOTSUP));
+	zdm->zdm_npages = (P2ROUNDUP(addr + len, PAGE_SIZE) -
+	    P2ALIGN(addr, PAGE_SIZE)) >> PAGE_SHIFT;
+	zdm->zdm_pages = kmem_alloc(zdm->zdm_npages * sizeof (struct page *),
+	    KM_SLEEP);
+
+	/* A read from the file writes into the user pages. */
+	npinned = get_user_pages_unlocked(addr & PAGE_MASK, zdm->zdm_npages,
+	    zdm->zdm_pages, for_read ? FOLL_WRITE : 0);
+	if (npinned != zdm->zdm_npages) {
+		for (int i = 0; i < npinned; i++)
+			put_page(zdm->zdm_pages[i]);
+		kmem_free(zdm->zdm_pages,
+		    zdm->zdm_npages * sizeof (struct page *));
+		return (SET_ERROR(npinned < 0 ? -npinned : EFAULT));
+	}
+
+	zdm->zdm_vaddr = vmap(zdm->zdm_pages, zdm->zdm_npages, VM_MAP,
+	    PAGE_KERNEL);
+	if (zdm->zdm_vaddr == NULL) {
+		for (int i = 0; i < npinned; i++)
+			put_page(zdm->zdm_pages[i]);
+		kmem_free(zdm->zdm_pages,
+		    zdm->zdm_npages * sizeof (struct page *));
+		return (SET_ERROR(ENOMEM));
+	}
+	zdm->zdm_buf = (char *)zdm->zdm_vaddr + (addr & ~PAGE_MASK);
+
+	return (0);
+#else
+	return (SET_ERROR(ENOTSUP));
+#endif
+}
+
+static void
+zfs_dio_unmap(zfs_dio_map_t *zdm, boolean_t dirty)
+{
+	vunmap(zdm->zdm_vaddr);
+	for (int i = 0; i < zdm->zdm_npages; i++) {
+		if (dirty)
+			set_page_dirty_lock(zdm->zdm_pages[i]);
+		put_page(zdm->zdm_pages[i]);
+	}
+	kmem_free(zdm->zdm_pages, zdm->zdm_npages * sizeof (struct page *));
+}
+
+/*
+ * Returns B_TRUE if I/O to this file should bypass the ARC where the
+ * request allows it.  Mapped files must stay coherent with the page
+ * cache, and encrypted blocks cannot be written without the ARC.
+ */
+static boolean_t
+zfs_dio_enabled(znode_t *zp, int ioflag)
+{
+	objset_t *os = ZTOZSB(zp)->z_os;
+
+	if (zp->z_is_mapped || os->os_encrypted || !ISP2(zp->z_blksz))
+		return (B_FALSE);
+
+	switch (os->os_direct) {
+	case ZFS_DIRECT_ALWAYS:
+		return (B_TRUE);
+	case ZFS_DIRECT_STANDARD:
+		return ((ioflag & O_DIRECT) != 0);
+	default:
+		return (B_FALSE);
+	}
+}
+
+/*
+ * Read len bytes, a multiple of the file's block size, straight into the
+ * caller's buffer.  ENOTSUP means the buffer could not be mapped and the
+ * caller should use the buffered path instead.
+ */
+static int
+zfs_dio_read(znode_t *zp, uio_t *uio, size_t len)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)sa_get_db(zp->z_sa_hdl);
+	zfs_dio_map_t zdm;
+	int error;
+
+	error = zfs_dio_map(uio, len, B_TRUE, &zdm);
+	if (error != 0)
+		return (error);
+
+	DB_DNODE_ENTER(db);
+	error = dmu_read_direct(DB_DNODE(db), uio->uio_loffset, len,
+	    zdm.zdm_buf);
+	DB_DNODE_EXIT(db);
+
+	zfs_dio_unmap(&zdm, error == 0);
+	if (error == 0)
+		uioskip(uio, len);
+
+	return (error);
+}
 #endif /* _KERNEL */
 
 unsigned long zfs_read_chunk_size = 1024 * 1024; /* Tunable */
@@ -500,6 +627,7 @@ zfs_read(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 	ASSERT(uio->uio_loffset < zp->z_size);
 	ssize_t n = MIN(uio->uio_resid, zp->z_size - uio->uio_loffset);
 	ssize_t start_resid = n;
+	boolean_t direct = zfs_dio_enabled(zp, ioflag);
 
 #ifdef HAVE_UIO_ZEROCOPY
 	xuio_t *xuio = NULL;
@@ -537,7 +665,14 @@ zfs_read(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 		ssize_t nbytes = MIN(n, zfs_read_chunk_size -
 		    P2PHASE(uio->uio_loffset, zfs_read_chunk_size));
 
-		if (zp->z_is_mapped && !(ioflag & O_DIRECT)) {
+		ssize_t dbytes = 0;
+		if (direct && P2PHASE(uio->uio_loffset, zp->z_blksz) == 0)
+			dbytes = P2ALIGN(nbytes, (ssize_t)zp->z_blksz);
+
+		if (dbytes > 0 &&
+		    (error = zfs_dio_read(zp, uio, dbytes)) != ENOTSUP) {
+			nbytes = dbytes;
+		} else if (zp->z_is_mapped && !(ioflag & O_DIRECT)) {
 			error = mappedread(ip, nbytes, uio);
 		} else {
 			error = dmu_read_uio_dbuf(sa_get_db(zp->z_sa_hdl),
@@ -734,6 +869,8 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 
 		arc_buf_t *abuf = NULL;
 		const iovec_t *aiov = NULL;
+		zfs_dio_map_t zdm;
+		boolean_t dio = B_FALSE;
 		if (xuio) {
 #ifdef HAVE_UIO_ZEROCOPY
 			ASSERT(i_iov < iovcnt);
@@ -746,6 +883,16 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 			    aiov->iov_len == arc_buf_size(abuf)));
 			i_iov++;
 #endif
+		} else if (n >= max_blksz && P2PHASE(woff, max_blksz) == 0 &&
+		    zp->z_blksz == max_blksz && lr->lr_length != UINT64_MAX &&
+		    zfs_dio_enabled(zp, ioflag)) {
+			/*
+			 * This write covers a full block and may bypass the
+			 * ARC.  Pin the caller's pages before entering the
+			 * transaction for the same reason we borrow a buffer
+			 * below; if that fails fall back to a buffered write.
+			 */
+			dio = (zfs_dio_map(uio, max_blksz, B_FALSE, &zdm) == 0);
 		} else if (n >= max_blksz && woff >= zp->z_size &&
 		    P2PHASE(woff, max_blksz) == 0 &&
 		    zp->z_blksz == max_blksz) {
@@ -786,6 +933,8 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 			dmu_tx_abort(tx);
 			if (abuf != NULL)
 				dmu_return_arcbuf(abuf);
+			if (dio)
+				zfs_dio_unmap(&zdm, B_FALSE);
 			break;
 		}
 
@@ -820,8 +969,24 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 		 */
 		ssize_t nbytes = MIN(n, max_blksz - P2PHASE(woff, max_blksz));
 
+		/*
+		 * A failed direct write leaves nothing behind which the
+		 * buffered write of the same range will not replace.
+		 */
+		if (dio) {
+			ASSERT3S(nbytes, ==, max_blksz);
+			DB_DNODE_ENTER(db);
+			dio = (dmu_write_direct(DB_DNODE(db), woff, nbytes,
+			    zdm.zdm_buf, tx) == 0);
+			DB_DNODE_EXIT(db);
+			zfs_dio_unmap(&zdm, B_FALSE);
+		}
+
 		ssize_t tx_bytes;
-		if (abuf == NULL) {
+		if (dio) {
+			tx_bytes = nbytes;
+			uioskip(uio, tx_bytes);
+		} else if (abuf == NULL) {
 			tx_bytes = uio->uio_resid;
 			uio->uio_fault_disable = B_TRUE;
 			error = dmu_write_uio_dbuf(sa_get_db(zp->z_sa_hdl),
@@ -973,6 +1138,263 @@ zfs_write(struct inode *ip, uio_t *uio, int ioflag, cred_t *cr)
 	return (0);
 }
 
+/*
+ * Clone a range of one file into another by making the destination
+ * reference the source's blocks (see brt.c), without reading or writing
+ * any data.
+ *
+ *	IN:	inip	- inode of the file to clone from.
+ *		inoffp	- offset to clone from.
+ *		outip	- inode of the file to clone to.
+ *		outoffp	- offset to clone to.
+ *		lenp	- bytes to clone; cut short at the end of inip.
+ *		cr	- credentials of caller.
+ *
+ *	OUT:	inoffp, outoffp	- advanced past the cloned range.
+ *		lenp	- number of bytes cloned.
+ *
+ *	RETURN:	0 on success, error code on failure.  EXDEV and EOPNOTSUPP
+ *		tell the caller to copy the data instead.
+ *
+ * The offsets and length must be multiples of the source's block size,
+ * except that the range may end at the end of the source if it does not
+ * end before the end of the destination.  Clones are not logged in the
+ * ZIL; zil_commit() waits for their txg to sync instead.
+ *
+ * Timestamps:
+ *	outip - ctime|mtime updated if byte count > 0
+ */
+/* ARGSUSED */
+int
+zfs_clone_range(struct inode *inip, uint64_t *inoffp, struct inode *outip,
+    uint64_t *outoffp, uint64_t *lenp, cred_t *cr)
+{
+	znode_t *inzp = ITOZ(inip);
+	znode_t *outzp = ITOZ(outip);
+	zfsvfs_t *inzfsvfs = ZTOZSB(inzp);
+	zfsvfs_t *outzfsvfs = ZTOZSB(outzp);
+	objset_t *inos = inzfsvfs->z_os;
+	objset_t *outos = outzfsvfs->z_os;
+	uint64_t inoff = *inoffp, outoff = *outoffp, len = *lenp;
+	uint64_t inblksz, maxblocks, done = 0;
+	locked_range_t *inlr, *outlr;
+	sa_bulk_attr_t bulk[3];
+	uint64_t mtime[2], ctime[2];
+	int count = 0;
+	blkptr_t *bps;
+	int error = 0;
+
+	if (dmu_objset_spa(inos) != dmu_objset_spa(outos))
+		return (SET_ERROR(EXDEV));
+
+	if (!spa_feature_is_enabled(dmu_objset_spa(outos),
+	    SPA_FEATURE_BLOCK_CLONING))
+		return (SET_ERROR(EOPNOTSUPP));
+
+	/*
+	 * Encrypted blocks can only be read with the keys of their own
+	 * dataset.
+	 */
+	if (inos->os_encrypted || outos->os_encrypted)
+		return (SET_ERROR(EOPNOTSUPP));
+
+	ZFS_ENTER(inzfsvfs);
+	ZFS_VERIFY_ZP(inzp);
+	if (outzfsvfs != inzfsvfs) {
+		rrm_enter_read(&outzfsvfs->z_teardown_lock, FTAG);
+		if (outzfsvfs->z_unmounted) {
+			error = SET_ERROR(EIO);
+			goto out_exit;
+		}
+	}
+	if (outzp->z_sa_hdl == NULL) {
+		error = SET_ERROR(EIO);
+		goto out_exit;
+	}
+
+	if (zfs_is_readonly(outzfsvfs)) {
+		error = SET_ERROR(EROFS);
+		goto out_exit;
+	}
+
+	if (outzp->z_pflags & (ZFS_IMMUTABLE | ZFS_READONLY | ZFS_APPENDONLY)) {
+		error = SET_ERROR(EPERM);
+		goto out_exit;
+	}
+
+	/*
+	 * Lock the ranges in a fixed order, so that concurrent clones
+	 * between the same files cannot deadlock.
+	 */
+	if (inzp < outzp || (inzp == outzp && inoff < outoff)) {
+		inlr = rangelock_enter(&inzp->z_rangelock, inoff, len,
+		    RL_READER);
+		outlr = rangelock_enter(&outzp->z_rangelock, outoff, len,
+		    RL_WRITER);
+	} else {
+		outlr = rangelock_enter(&outzp->z_rangelock, outoff, len,
+		    RL_WRITER);
+		inlr = rangelock_enter(&inzp->z_rangelock, inoff, len,
+		    RL_READER);
+	}
+
+	if (inoff >= inzp->z_size) {
+		len = 0;
+		goto out_unlock;
+	}
+	if (len > inzp->z_size - inoff)
+		len = inzp->z_size - inoff;
+
+	if (inzp == outzp && inoff < outoff + len && outoff < inoff + len) {
+		error = SET_ERROR(EINVAL);
+		goto out_unlock;
+	}
+
+	inblksz = inzp->z_blksz;
+	if ((inoff % inblksz) != 0 || (outoff % inblksz) != 0 ||
+	    ((len % inblksz) != 0 && (inoff + len != inzp->z_size ||
+	    outoff + len < outzp->z_size))) {
+		error = SET_ERROR(EINVAL);
+		goto out_unlock;
+	}
+
+	/*
+	 * The destination must have the same block size, which it can
+	 * only be given while it has at most one block.
+	 */
+	if (inblksz != outzp->z_blksz && (outzp->z_size > outzp->z_blksz ||
+	    outzp->z_blksz > inblksz)) {
+		error = SET_ERROR(EINVAL);
+		goto out_unlock;
+	}
+
+	if (zfs_id_overblockquota(outzfsvfs, DMU_USERUSED_OBJECT,
+	    KUID_TO_SUID(outip->i_uid)) ||
+	    zfs_id_overblockquota(outzfsvfs, DMU_GROUPUSED_OBJECT,
+	    KGID_TO_SGID(outip->i_gid)) ||
+	    (outzp->z_projid != ZFS_DEFAULT_PROJID &&
+	    zfs_id_overblockquota(outzfsvfs, DMU_PROJECTUSED_OBJECT,
+	    outzp->z_projid))) {
+		error = SET_ERROR(EDQUOT);
+		goto out_unlock;
+	}
+
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_MTIME(outzfsvfs), NULL,
+	    &mtime, 16);
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_CTIME(outzfsvfs), NULL,
+	    &ctime, 16);
+	SA_ADD_BULK_ATTR(bulk, count, SA_ZPL_SIZE(outzfsvfs), NULL,
+	    &outzp->z_size, 8);
+
+	/*
+	 * Clone at most 1GB (and 1024 blocks) in each transaction, which
+	 * bounds both the block pointer array and the indirect blocks
+	 * dirtied.
+	 */
+	maxblocks = MIN(1024, (1ULL << 30) / inblksz);
+	bps = kmem_alloc(sizeof (blkptr_t) * maxblocks, KM_SLEEP);
+
+	while (len > 0) {
+		uint64_t size = MIN(len, maxblocks * inblksz);
+		uint64_t end_size;
+		size_t nbps = maxblocks;
+		dmu_buf_impl_t *db;
+		dmu_tx_t *tx;
+
+		/*
+		 * Blocks still dirty in memory have no block pointer to
+		 * clone yet; wait for them to be written once.
+		 */
+		error = dmu_read_l0_bps(inos, inzp->z_id, inoff, size, bps,
+		    &nbps);
+		if (error == EAGAIN) {
+			txg_wait_synced(dmu_objset_pool(inos), 0);
+			error = dmu_read_l0_bps(inos, inzp->z_id, inoff, size,
+			    bps, &nbps);
+		}
+		if (error != 0)
+			break;
+
+		tx = dmu_tx_create(outos);
+		dmu_tx_hold_sa(tx, outzp->z_sa_hdl, B_FALSE);
+		db = (dmu_buf_impl_t *)sa_get_db(outzp->z_sa_hdl);
+		DB_DNODE_ENTER(db);
+		dmu_tx_hold_clone_by_dnode(tx, DB_DNODE(db), outoff, size);
+		DB_DNODE_EXIT(db);
+		zfs_sa_upgrade_txholds(tx, outzp);
+		error = dmu_tx_assign(tx, TXG_WAIT);
+		if (error != 0) {
+			dmu_tx_abort(tx);
+			break;
+		}
+
+		if (outzp->z_blksz < inblksz)
+			zfs_grow_blocksize(outzp, inblksz, tx);
+
+		error = dmu_brt_clone(outos, outzp->z_id, outoff, size, tx,
+		    bps, nbps);
+		if (error != 0) {
+			dmu_tx_commit(tx);
+			break;
+		}
+
+		if (outzp->z_is_mapped) {
+			update_pages(outip, outoff, size, outos,
+			    outzp->z_id);
+		}
+
+		zfs_tstamp_update_setup(outzp, CONTENT_MODIFIED, mtime, ctime);
+
+		/*
+		 * Update the file size (zp_size) if it has changed;
+		 * account for possible concurrent updates.
+		 */
+		while ((end_size = outzp->z_size) < outoff + size) {
+			(void) atomic_cas_64(&outzp->z_size, end_size,
+			    outoff + size);
+		}
+
+		error = sa_bulk_update(outzp->z_sa_hdl, bulk, count, tx);
+
+		zil_add_unlogged_txg(outzfsvfs->z_log, dmu_tx_get_txg(tx));
+		dmu_tx_commit(tx);
+
+		if (error != 0)
+			break;
+
+		inoff += size;
+		outoff += size;
+		len -= size;
+		done += size;
+	}
+
+	kmem_free(bps, sizeof (blkptr_t) * maxblocks);
+	zfs_inode_update(outzp);
+
+out_unlock:
+	rangelock_exit(outlr);
+	rangelock_exit(inlr);
+
+	/* Partial progress is a success. */
+	if (done > 0)
+		error = 0;
+	if (error == 0) {
+		*inoffp += done;
+		*outoffp += done;
+		*lenp = done;
+	}
+
+	if (error == 0 && outzfsvfs->z_os->os_sync == ZFS_SYNC_ALWAYS)
+		zil_commit(outzfsvfs->z_log, outzp->z_id);
+
+out_exit:
+	if (outzfsvfs != inzfsvfs)
+		ZFS_EXIT(outzfsvfs);
+	ZFS_EXIT(inzfsvfs);
+
+	return (error);
+}
+
 /*
  * Drop a reference on the passed inode asynchronously. This ensures
  * that the caller will never drop the last reference on an inode in
@@ -1102,9 +1524,14 @@ zfs_get_data(void *arg, lr_write_t *lr, char *buf, struct lwb *lwb, zio_t *zio)
 			zil_fault_io = 0;
 		}
 #endif
+		/*
+		 * dmu_sync() only needs the dirty record, so don't read the
+		 * block in; a Direct I/O write can then be logged by its
+		 * block pointer without reading the data back.
+		 */
 		if (error == 0)
-			error = dmu_buf_hold(os, object, offset, zgd, &db,
-			    DMU_READ_NO_PREFETCH);
+			error = dmu_buf_hold_noread(os, object, offset, zgd,
+			    &db);
 
 		if (error == 0) {
 			blkptr_t *bp = &lr->lr_blkptr;
@@ -1554,6 +1981,253 @@ out:
 	return (error);
 }
 
+/*
+ * Maximum number of files created under a single transaction by
+ * zfs_create_batch().  Each file adds a new dnode and a directory entry
+ * to the transaction, so very large values only inflate the space which
+ * must be reserved up front.
+ */
+int zfs_create_batch_txsize = 256;
+
+/*
+ * Create one transaction's worth of the files for zfs_create_batch().
+ * Entries of errors[] which are already set are skipped.
+ */
+static int
+zfs_create_batch_tx(znode_t *dzp, char **names, uint_t count, vattr_t *vap,
+    cred_t *cr, int *errors, zfs_create_batch_stats_t *zcbs)
+{
+	zfsvfs_t	*zfsvfs = ZTOZSB(dzp);
+	zilog_t		*zilog = zfsvfs->z_log;
+	zfs_acl_ids_t	*acl_ids;
+	znode_t		**zpp;
+	zfs_dirlock_t	*dl;
+	dmu_tx_t	*tx;
+	uint64_t	projid, txtype;
+	boolean_t	fuid_dirtied;
+	int		error;
+	uint_t		i, holds = 0;
+
+	acl_ids = kmem_alloc(count * sizeof (zfs_acl_ids_t), KM_SLEEP);
+	zpp = kmem_zalloc(count * sizeof (znode_t *), KM_SLEEP);
+	projid = zfs_inherit_projid(dzp);
+
+	for (i = 0; i < count; i++) {
+		if (errors[i] != 0)
+			continue;
+
+		if ((error = zfs_acl_ids_create(dzp, 0, vap, cr, NULL,
+		    &acl_ids[i])) != 0) {
+			errors[i] = error;
+			continue;
+		}
+
+		if (zfs_acl_ids_overquota(zfsvfs, &acl_ids[i], projid)) {
+			zfs_acl_ids_free(&acl_ids[i]);
+			errors[i] = SET_ERROR(EDQUOT);
+			continue;
+		}
+		holds++;
+	}
+
+	if (holds == 0) {
+		error = 0;
+		goto out;
+	}
+
+	/*
+	 * No directory entry locks are held while assigning, so unlike
+	 * zfs_create() it is safe to wait for the next open txg here.
+	 */
+	tx = dmu_tx_create(zfsvfs->z_os);
+	for (i = 0; i < count; i++) {
+		if (errors[i] != 0)
+			continue;
+
+		dmu_tx_hold_sa_create(tx, acl_ids[i].z_aclp->z_acl_bytes +
+		    ZFS_SA_BASE_ATTR_SIZE);
+		dmu_tx_hold_zap(tx, dzp->z_id, TRUE, names[i]);
+		if (!zfsvfs->z_use_sa &&
+		    acl_ids[i].z_aclp->z_acl_bytes > ZFS_ACE_SPACE) {
+			dmu_tx_hold_write(tx, DMU_NEW_OBJECT,
+			    0, acl_ids[i].z_aclp->z_acl_bytes);
+		}
+	}
+	fuid_dirtied = zfsvfs->z_fuid_dirty;
+	if (fuid_dirtied)
+		zfs_fuid_txhold(zfsvfs, tx);
+	dmu_tx_hold_sa(tx, dzp->z_sa_hdl, B_FALSE);
+
+	error = dmu_tx_assign(tx, TXG_WAIT);
+	if (error) {
+		dmu_tx_abort(tx);
+		for (i = 0; i < count; i++) {
+			if (errors[i] == 0) {
+				zfs_acl_ids_free(&acl_ids[i]);
+				errors[i] = error;
+			}
+		}
+		goto out;
+	}
+
+	txtype = zfs_log_create_txtype(Z_FILE, NULL, vap);
+	for (i = 0; i < count; i++) {
+		if (errors[i] != 0)
+			continue;
+
+		error = zfs_dirent_lock(&dl, dzp, names[i], &zpp[i], ZNEW,
+		    NULL, NULL);
+		if (error) {
+			zfs_acl_ids_free(&acl_ids[i]);
+			errors[i] = error;
+			continue;
+		}
+
+		zfs_mknode(dzp, vap, tx, cr, 0, &zpp[i], &acl_ids[i]);
+
+		error = zfs_link_create(dl, zpp[i], tx, ZNEW);
+		if (error != 0) {
+			/*
+			 * Since, we failed to add the directory entry for it,
+			 * delete the newly created dnode.
+			 */
+			zfs_znode_delete(zpp[i], tx);
+			remove_inode_hash(ZTOI(zpp[i]));
+			zfs_acl_ids_free(&acl_ids[i]);
+			zfs_dirent_unlock(dl);
+			errors[i] = error;
+			continue;
+		}
+
+		zfs_log_create(zilog, tx, txtype, dzp, zpp[i], names[i],
+		    NULL, acl_ids[i].z_fuidp, vap);
+		zfs_acl_ids_free(&acl_ids[i]);
+		zfs_dirent_unlock(dl);
+		zcbs->zcbs_created++;
+	}
+
+	if (fuid_dirtied)
+		zfs_fuid_sync(zfsvfs, tx);
+
+	dmu_tx_commit(tx);
+	zcbs->zcbs_txs++;
+	error = 0;
+out:
+	for (i = 0; i < count; i++) {
+		if (zpp[i] == NULL)
+			continue;
+		if (errors[i] == 0)
+			zfs_inode_update(zpp[i]);
+		iput(ZTOI(zpp[i]));
+	}
+	kmem_free(zpp, count * sizeof (znode_t *));
+	kmem_free(acl_ids, count * sizeof (zfs_acl_ids_t));
+
+	return (error);
+}
+
+/*
+ * Create many new regular files in a single directory.  Rather than
+ * assigning a transaction per file as zfs_create() does, up to
+ * zfs_create_batch_txsize files share each transaction, and the
+ * permission check, teardown lock and ZIL commit are taken once for
+ * the whole batch.  A name which already exists or otherwise cannot be
+ * created does not abort the batch; its error is returned in errors[].
+ *
+ *	IN:	dip	- inode of directory to put new file entries in.
+ *		names	- names of new file entries.
+ *		count	- number of names.
+ *		vap	- attributes of new files.
+ *		cr	- credentials of caller.
+ *
+ *	OUT:	errors	- per-name error, 0 if the file was created.
+ *		zcbs	- batch statistics.
+ *
+ *	RETURN:	0 on success, error code if the batch was abandoned.
+ *
+ * Timestamps:
+ *	dip - ctime|mtime updated if any new entry created
+ *	 ip - ctime|mtime|atime of each new file
+ */
+int
+zfs_create_batch(struct inode *dip, char **names, uint_t count, vattr_t *vap,
+    cred_t *cr, int *errors, zfs_create_batch_stats_t *zcbs)
+{
+	znode_t		*dzp = ITOZ(dip);
+	zfsvfs_t	*zfsvfs = ITOZSB(dip);
+	hrtime_t	start = gethrtime();
+	int		error;
+	uint_t		i, n;
+
+	bzero(zcbs, sizeof (zfs_create_batch_stats_t));
+
+	if (!S_ISREG(vap->va_mode) || (vap->va_mask & ATTR_XVATTR))
+		return (SET_ERROR(EINVAL));
+
+	if (zfsvfs->z_use_fuids == B_FALSE &&
+	    (IS_EPHEMERAL(crgetuid(cr)) || IS_EPHEMERAL(crgetgid(cr))))
+		return (SET_ERROR(EINVAL));
+
+	ZFS_ENTER(zfsvfs);
+	ZFS_VERIFY_ZP(dzp);
+
+	if (!S_ISDIR(dip->i_mode)) {
+		ZFS_EXIT(zfsvfs);
+		return (SET_ERROR(ENOTDIR));
+	}
+
+	if ((error = zfs_zaccess(dzp, ACE_ADD_FILE, 0, B_FALSE, cr))) {
+		ZFS_EXIT(zfsvfs);
+		return (error);
+	}
+
+	for (i = 0; i < count; i++) {
+		size_t len = strnlen(names[i], MAXNAMELEN);
+
+		if (len == 0 || len >= MAXNAMELEN)
+			errors[i] = SET_ERROR(EINVAL);
+		else if (strcmp(names[i], ".") == 0 ||
+		    strcmp(names[i], "..") == 0)
+			errors[i] = SET_ERROR(EEXIST);
+		else if (strchr(names[i], '/') != NULL)
+			errors[i] = SET_ERROR(EINVAL);
+		else if (zfsvfs->z_utf8 && u8_validate(names[i], len,
+		    NULL, U8_VALIDATE_ENTIRE, &error) < 0)
+			errors[i] = SET_ERROR(EILSEQ);
+		else
+			errors[i] = 0;
+	}
+
+	error = 0;
+	for (i = 0; i < count && error == 0; i += n) {
+		n = MIN(count - i, MAX(zfs_create_batch_txsize, 1));
+		error = zfs_create_batch_tx(dzp, &names[i], n, vap, cr,
+		    &errors[i], zcbs);
+	}
+
+	/* Names after a failed transaction were never attempted */
+	for (; i < count; i++) {
+		if (errors[i] == 0)
+			errors[i] = error;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (errors[i] != 0)
+			zcbs->zcbs_failed++;
+	}
+
+	if (zcbs->zcbs_created != 0) {
+		zfs_inode_update(dzp);
+		if (zfsvfs->z_os->os_sync == ZFS_SYNC_ALWAYS)
+			zil_commit(zfsvfs->z_log, 0);
+	}
+
+	zcbs->zcbs_time_ns = gethrtime() - start;
+
+	ZFS_EXIT(zfsvfs);
+	return (error);
+}
+
 /* ARGSUSED */
 int
 zfs_tmpfile(struct inode *dip, vattr_t *vap, int excl,
@@ -5239,9 +5913,11 @@ EXPORT_SYMBOL(zfs_open);
 EXPORT_SYMBOL(zfs_close);
 EXPORT_SYMBOL(zfs_read);
 EXPORT_SYMBOL(zfs_write);
+EXPORT_SYMBOL(zfs_clone_range);
 EXPORT_SYMBOL(zfs_access);
 EXPORT_SYMBOL(zfs_lookup);
 EXPORT_SYMBOL(zfs_create);
+EXPORT_SYMBOL(zfs_create_batch);
 EXPORT_SYMBOL(zfs_tmpfile);
 EXPORT_SYMBOL(zfs_remove);
 EXPORT_SYMBOL(zfs_mkdir);
@@ -5266,6 +5942,8 @@ EXPORT_SYMBOL(zfs_dirty_inode);
 EXPORT_SYMBOL(zfs_map);
 
 /* BEGIN CSTYLED */
+module_param(zfs_create_batch_txsize, int, 0644);
+MODULE_PARM_DESC(zfs_create_batch_txsize, "Max files per tx for batched creates");
 module_param(zfs_delete_blocks, ulong, 0644);
 MODULE_PARM_DESC(zfs_delete_blocks, "Delete files larger than N blocks async");
 module_param(zfs_read_chunk_size, ulong, 0644);
@@ -814,6 +814,113 @@ zpl_fallocate(struct file *filp, int mode, loff_t offset, loff_t len)
 }
 #endif /* HAVE_FILE_FALLOCATE */
 
+#if defined(HAVE_VFS_COPY_FILE_RANGE) || \
+    defined(HAVE_VFS_REMAP_FILE_RANGE) || \
+    defined(HAVE_VFS_CLONE_FILE_RANGE)
+/*
+ * Clone the range by sharing the source's blocks (see zfs_clone_range()).
+ * Returns the number of bytes cloned, or a negative errno.
+ */
+static loff_t
+zpl_clone_file_range_impl(struct file *src_file, loff_t src_off,
+    struct file *dst_file, loff_t dst_off, uint64_t len)
+{
+	struct inode *src_i = file_inode(src_file);
+	struct inode *dst_i = file_inode(dst_file);
+	uint64_t src_off_o = (uint64_t)src_off;
+	uint64_t dst_off_o = (uint64_t)dst_off;
+	uint64_t len_o = len;
+	cred_t *cr = CRED();
+	fstrans_cookie_t cookie;
+	int error;
+
+	if (src_off < 0 || dst_off < 0)
+		return (-EINVAL);
+
+	crhold(cr);
+	cookie = spl_fstrans_mark();
+	error = -zfs_clone_range(src_i, &src_off_o, dst_i, &dst_off_o,
+	    &len_o, cr);
+	spl_fstrans_unmark(cookie);
+	crfree(cr);
+
+	ASSERT3S(error, <=, 0);
+	if (error != 0)
+		return (error);
+
+	return ((loff_t)len_o);
+}
+#endif
+
+#ifdef HAVE_VFS_COPY_FILE_RANGE
+/*
+ * copy_file_range(2) clones whenever the range allows it.  Otherwise
+ * -EOPNOTSUPP makes the kernel copy the data itself.
+ */
+static ssize_t
+zpl_copy_file_range(struct file *src_file, loff_t src_off,
+    struct file *dst_file, loff_t dst_off, size_t len, unsigned int flags)
+{
+	loff_t ret;
+
+	if (flags != 0)
+		return (-EINVAL);
+
+	ret = zpl_clone_file_range_impl(src_file, src_off, dst_file, dst_off,
+	    len);
+	if (ret == -EINVAL || ret == -EXDEV || ret == -EAGAIN)
+		ret = -EOPNOTSUPP;
+
+	return (ret);
+}
+#endif /* HAVE_VFS_COPY_FILE_RANGE */
+
+#ifdef HAVE_VFS_REMAP_FILE_RANGE
+/*
+ * FICLONE and FICLONERANGE (Linux 4.20+).  A length of zero means up to
+ * the end of the source.  Deduplication is not supported.
+ */
+static loff_t
+zpl_remap_file_range(struct file *src_file, loff_t src_off,
+    struct file *dst_file, loff_t dst_off, loff_t len, unsigned int flags)
+{
+	if (flags & ~(REMAP_FILE_DEDUP | REMAP_FILE_CAN_SHORTEN))
+		return (-EINVAL);
+
+	if (flags & REMAP_FILE_DEDUP)
+		return (-EOPNOTSUPP);
+
+	if (len == 0)
+		len = i_size_read(file_inode(src_file)) - src_off;
+
+	return (zpl_clone_file_range_impl(src_file, src_off, dst_file,
+	    dst_off, len));
+}
+#endif /* HAVE_VFS_REMAP_FILE_RANGE */
+
+#ifdef HAVE_VFS_CLONE_FILE_RANGE
+/*
+ * FICLONE and FICLONERANGE (Linux 4.5 - 4.19), which must clone the
+ * whole range.
+ */
+static int
+zpl_clone_file_range(struct file *src_file, loff_t src_off,
+    struct file *dst_file, loff_t dst_off, uint64_t len)
+{
+	loff_t ret;
+
+	if (len == 0)
+		len = i_size_read(file_inode(src_file)) - src_off;
+
+	ret = zpl_clone_file_range_impl(src_file, src_off, dst_file, dst_off,
+	    len);
+	if (ret < 0)
+		return (ret);
+
+	return (ret == len ? 0 : -EINVAL);
+}
+#endif /* HAVE_VFS_CLONE_FILE_RANGE */
+
 #define	ZFS_FL_USER_VISIBLE	(FS_FL_USER_VISIBLE | ZFS_PROJINHERIT_FL)
 #define	ZFS_FL_USER_MODIFIABLE	(FS_FL_USER_MODIFIABLE | ZFS_PROJINHERIT_FL)
 
@@ -1051,6 +1158,15 @@ const struct file_operations zpl_file_operations = {
 #ifdef HAVE_FILE_FALLOCATE
 	.fallocate	= zpl_fallocate,
 #endif /* HAVE_FILE_FALLOCATE */
+#ifdef HAVE_VFS_COPY_FILE_RANGE
+	.copy_file_range = zpl_copy_file_range,
+#endif
+#ifdef HAVE_VFS_REMAP_FILE_RANGE
+	.remap_file_range = zpl_remap_file_range,
+#endif
+#ifdef HAVE_VFS_CLONE_FILE_RANGE
+	.clone_file_range = zpl_clone_file_range,
+#endif
 	.unlocked_ioctl	= zpl_ioctl,
 #ifdef CONFIG_COMPAT
 	.compat_ioctl	= zpl_compat_ioctl,
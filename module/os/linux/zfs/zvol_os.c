@@ -37,29 +37,88 @@
 
 #include <linux/blkdev_compat.h>
 #include <linux/task_io_accounting_ops.h>
+#ifdef HAVE_BLK_MQ
+#include <linux/blk-mq.h>
+#endif
 
 unsigned int zvol_major = ZVOL_MAJOR;
 unsigned int zvol_request_sync = 0;
 unsigned int zvol_prefetch_bytes = (128 * 1024);
 unsigned long zvol_max_discard_blocks = 16384;
 unsigned int zvol_threads = 32;
+unsigned int zvol_use_blk_mq = 1;
+unsigned int zvol_blk_mq_queue_depth = 128;
+unsigned int zvol_blk_mq_hw_queues = 0;
 
 struct zvol_state_os {
 	struct gendisk		*zvo_disk;	/* generic disk */
 	struct request_queue	*zvo_queue;	/* request queue */
 	dataset_kstats_t	zvo_kstat;	/* zvol kstats */
 	dev_t			zvo_dev;	/* device id */
+#ifdef HAVE_BLK_MQ
+	boolean_t		zvo_use_blk_mq;	/* queue is blk-mq */
+	struct blk_mq_tag_set	zvo_tag_set;	/* blk-mq tag set */
+#endif
 };
 
 taskq_t *zvol_taskq;
 static struct ida zvol_ida;
 
+/*
+ * A zvol request is either a single bio submitted through zvol_request(),
+ * or, when the zvol uses blk-mq, a struct request handed to
+ * zvol_mq_queue_rq().  In the latter case the zv_request_t lives in the
+ * request's driver private data, bio is the first bio of the request and
+ * the remaining ones are reached through bi_next.
+ */
 typedef struct zv_request {
 	zvol_state_t	*zv;
 	struct bio	*bio;
+	struct request	*rq;
 	locked_range_t	*lr;
 } zv_request_t;
 
+static inline struct bio *
+zvr_next_bio(zv_request_t *zvr, struct bio *bio)
+{
+	return (zvr->rq != NULL ? bio->bi_next : NULL);
+}
+
+static inline uint64_t
+zvr_offset(zv_request_t *zvr)
+{
+	if (zvr->rq != NULL)
+		return (blk_rq_pos(zvr->rq) << 9);
+
+	return (BIO_BI_SECTOR(zvr->bio) << 9);
+}
+
+static inline uint64_t
+zvr_size(zv_request_t *zvr)
+{
+	if (zvr->rq != NULL)
+		return (blk_rq_bytes(zvr->rq));
+
+	return (BIO_BI_SIZE(zvr->bio));
+}
+
+/*
+ * Complete a request.  Bio requests are allocated by zvol_request() and
+ * freed here, blk-mq requests own their zv_request_t.
+ */
+static void
+zvol_end_io(zv_request_t *zvr, int error)
+{
+#ifdef HAVE_BLK_MQ
+	if (zvr->rq != NULL) {
+		blk_mq_end_request(zvr->rq, errno_to_bi_status(error));
+		return;
+	}
+#endif
+	BIO_END_IO(zvr->bio, -error);
+	kmem_free(zvr, sizeof (zv_request_t));
+}
+
 /*
  * Given a path, return TRUE if path is a ZVOL.
  */
@@ -102,49 +161,58 @@ zvol_write(void *arg)
 	zv_request_t *zvr = arg;
 	struct bio *bio = zvr->bio;
 	uio_t uio = { { 0 }, 0 };
-	uio_from_bio(&uio, bio);
 
 	zvol_state_t *zv = zvr->zv;
 	ASSERT(zv && zv->zv_open_count > 0);
 	ASSERT(zv->zv_zilog != NULL);
 
-	ssize_t start_resid = uio.uio_resid;
+	/* blk-mq does its own I/O accounting. */
 	unsigned long start_jif = jiffies;
-	blk_generic_start_io_acct(zv->zv_zso->zvo_queue, WRITE,
-	    bio_sectors(bio), &zv->zv_zso->zvo_disk->part0);
+	if (zvr->rq == NULL) {
+		blk_generic_start_io_acct(zv->zv_zso->zvo_queue, WRITE,
+		    bio_sectors(bio), &zv->zv_zso->zvo_disk->part0);
+	}
 
 	boolean_t sync =
 	    bio_is_fua(bio) || zv->zv_objset->os_sync == ZFS_SYNC_ALWAYS;
 
+	int64_t nwritten = 0;
 	uint64_t volsize = zv->zv_volsize;
-	while (uio.uio_resid > 0 && uio.uio_loffset < volsize) {
-		uint64_t bytes = MIN(uio.uio_resid, DMU_MAX_ACCESS >> 1);
-		uint64_t off = uio.uio_loffset;
-		dmu_tx_t *tx = dmu_tx_create(zv->zv_objset);
-
-		if (bytes > volsize - off)	/* don't write past the end */
-			bytes = volsize - off;
-
-		dmu_tx_hold_write(tx, ZVOL_OBJ, off, bytes);
+	for (; bio != NULL && error == 0; bio = zvr_next_bio(zvr, bio)) {
+		uio_from_bio(&uio, bio);
+		ssize_t start_resid = uio.uio_resid;
+
+		while (uio.uio_resid > 0 && uio.uio_loffset < volsize) {
+			uint64_t bytes =
+			    MIN(uio.uio_resid, DMU_MAX_ACCESS >> 1);
+			uint64_t off = uio.uio_loffset;
+			dmu_tx_t *tx = dmu_tx_create(zv->zv_objset);
+
+			/* don't write past the end */
+			if (bytes > volsize - off)
+				bytes = volsize - off;
+
+			dmu_tx_hold_write(tx, ZVOL_OBJ, off, bytes);
+
+			/* This will only fail for ENOSPC */
+			error = dmu_tx_assign(tx, TXG_WAIT);
+			if (error) {
+				dmu_tx_abort(tx);
+				break;
+			}
+			error = dmu_write_uio_dnode(zv->zv_dn, &uio, bytes, tx);
+			if (error == 0) {
+				zvol_log_write(zv, tx, off, bytes, sync);
+			}
+			dmu_tx_commit(tx);
 
-		/* This will only fail for ENOSPC */
-		error = dmu_tx_assign(tx, TXG_WAIT);
-		if (error) {
-			dmu_tx_abort(tx);
-			break;
-		}
-		error = dmu_write_uio_dnode(zv->zv_dn, &uio, bytes, tx);
-		if (error == 0) {
-			zvol_log_write(zv, tx, off, bytes, sync);
+			if (error)
+				break;
 		}
-		dmu_tx_commit(tx);
-
-		if (error)
-			break;
+		nwritten += start_resid - uio.uio_resid;
 	}
 	rangelock_exit(zvr->lr);
 
-	int64_t nwritten = start_resid - uio.uio_resid;
 	dataset_kstats_update_write_kstats(&zv->zv_zso->zvo_kstat, nwritten);
 	task_io_account_write(nwritten);
 
@@ -152,10 +220,11 @@ zvol_write(void *arg)
 		zil_commit(zv->zv_zilog, ZVOL_OBJ);
 
 	rw_exit(&zv->zv_suspend_lock);
-	blk_generic_end_io_acct(zv->zv_zso->zvo_queue,
-	    WRITE, &zv->zv_zso->zvo_disk->part0, start_jif);
-	BIO_END_IO(bio, -error);
-	kmem_free(zvr, sizeof (zv_request_t));
+	if (zvr->rq == NULL) {
+		blk_generic_end_io_acct(zv->zv_zso->zvo_queue,
+		    WRITE, &zv->zv_zso->zvo_disk->part0, start_jif);
+	}
+	zvol_end_io(zvr, error);
 }
 
 static void
@@ -164,8 +233,8 @@ zvol_discard(void *arg)
 	zv_request_t *zvr = arg;
 	struct bio *bio = zvr->bio;
 	zvol_state_t *zv = zvr->zv;
-	uint64_t start = BIO_BI_SECTOR(bio) << 9;
-	uint64_t size = BIO_BI_SIZE(bio);
+	uint64_t start = zvr_offset(zvr);
+	uint64_t size = zvr_size(zvr);
 	uint64_t end = start + size;
 	boolean_t sync;
 	int error = 0;
@@ -176,8 +245,10 @@ zvol_discard(void *arg)
 	ASSERT(zv->zv_zilog != NULL);
 
 	start_jif = jiffies;
-	blk_generic_start_io_acct(zv->zv_zso->zvo_queue, WRITE,
-	    bio_sectors(bio), &zv->zv_zso->zvo_disk->part0);
+	if (zvr->rq == NULL) {
+		blk_generic_start_io_acct(zv->zv_zso->zvo_queue, WRITE,
+		    bio_sectors(bio), &zv->zv_zso->zvo_disk->part0);
+	}
 
 	sync = bio_is_fua(bio) || zv->zv_objset->os_sync == ZFS_SYNC_ALWAYS;
 
@@ -219,10 +290,11 @@ unlock:
 		zil_commit(zv->zv_zilog, ZVOL_OBJ);
 
 	rw_exit(&zv->zv_suspend_lock);
-	blk_generic_end_io_acct(zv->zv_zso->zvo_queue, WRITE,
-	    &zv->zv_zso->zvo_disk->part0, start_jif);
-	BIO_END_IO(bio, -error);
-	kmem_free(zvr, sizeof (zv_request_t));
+	if (zvr->rq == NULL) {
+		blk_generic_end_io_acct(zv->zv_zso->zvo_queue, WRITE,
+		    &zv->zv_zso->zvo_disk->part0, start_jif);
+	}
+	zvol_end_io(zvr, error);
 }
 
 static void
@@ -233,54 +305,70 @@ zvol_read(void *arg)
 	zv_request_t *zvr = arg;
 	struct bio *bio = zvr->bio;
 	uio_t uio = { { 0 }, 0 };
-	uio_from_bio(&uio, bio);
 
 	zvol_state_t *zv = zvr->zv;
 	ASSERT(zv && zv->zv_open_count > 0);
 
-	ssize_t start_resid = uio.uio_resid;
 	unsigned long start_jif = jiffies;
-	blk_generic_start_io_acct(zv->zv_zso->zvo_queue, READ, bio_sectors(bio),
-	    &zv->zv_zso->zvo_disk->part0);
+	if (zvr->rq == NULL) {
+		blk_generic_start_io_acct(zv->zv_zso->zvo_queue, READ,
+		    bio_sectors(bio), &zv->zv_zso->zvo_disk->part0);
+	}
 
+	int64_t nread = 0;
 	uint64_t volsize = zv->zv_volsize;
-	while (uio.uio_resid > 0 && uio.uio_loffset < volsize) {
-		uint64_t bytes = MIN(uio.uio_resid, DMU_MAX_ACCESS >> 1);
-
-		/* don't read past the end */
-		if (bytes > volsize - uio.uio_loffset)
-			bytes = volsize - uio.uio_loffset;
-
-		error = dmu_read_uio_dnode(zv->zv_dn, &uio, bytes);
-		if (error) {
-			/* convert checksum errors into IO errors */
-			if (error == ECKSUM)
-				error = SET_ERROR(EIO);
-			break;
+	for (; bio != NULL && error == 0; bio = zvr_next_bio(zvr, bio)) {
+		uio_from_bio(&uio, bio);
+		ssize_t start_resid = uio.uio_resid;
+
+		while (uio.uio_resid > 0 && uio.uio_loffset < volsize) {
+			uint64_t bytes =
+			    MIN(uio.uio_resid, DMU_MAX_ACCESS >> 1);
+
+			/* don't read past the end */
+			if (bytes > volsize - uio.uio_loffset)
+				bytes = volsize - uio.uio_loffset;
+
+			error = dmu_read_uio_dnode(zv->zv_dn, &uio, bytes);
+			if (error) {
+				/* convert checksum errors into IO errors */
+				if (error == ECKSUM)
+					error = SET_ERROR(EIO);
+				break;
+			}
 		}
+		nread += start_resid - uio.uio_resid;
 	}
 	rangelock_exit(zvr->lr);
 
-	int64_t nread = start_resid - uio.uio_resid;
 	dataset_kstats_update_read_kstats(&zv->zv_zso->zvo_kstat, nread);
 	task_io_account_read(nread);
 
 	rw_exit(&zv->zv_suspend_lock);
-	blk_generic_end_io_acct(zv->zv_zso->zvo_queue, READ,
-	    &zv->zv_zso->zvo_disk->part0, start_jif);
-	BIO_END_IO(bio, -error);
-	kmem_free(zvr, sizeof (zv_request_t));
+	if (zvr->rq == NULL) {
+		blk_generic_end_io_acct(zv->zv_zso->zvo_queue, READ,
+		    &zv->zv_zso->zvo_disk->part0, start_jif);
+	}
+	zvol_end_io(zvr, error);
 }
 
-static MAKE_REQUEST_FN_RET
-zvol_request(struct request_queue *q, struct bio *bio)
+/*
+ * Common request handling for zvol_request() and zvol_mq_queue_rq().
+ * Bios are handed to zvol_taskq unless they must be handled
+ * synchronously.  Requests from blk-mq are always handled in the calling
+ * context: blk-mq already spreads them over per-CPU hardware queues, and
+ * going through the shared taskq would only add a context switch and a
+ * point of contention.
+ */
+static void
+zvol_request_impl(zv_request_t *zvr)
 {
-	zvol_state_t *zv = q->queuedata;
-	fstrans_cookie_t cookie = spl_fstrans_mark();
-	uint64_t offset = BIO_BI_SECTOR(bio) << 9;
-	uint64_t size = BIO_BI_SIZE(bio);
+	zvol_state_t *zv = zvr->zv;
+	struct bio *bio = zvr->bio;
+	uint64_t offset = zvr_offset(zvr);
+	uint64_t size = zvr_size(zvr);
 	int rw = bio_data_dir(bio);
-	zv_request_t *zvr;
+	boolean_t force_sync = (zvr->rq != NULL || zvol_request_sync);
 
 	if (bio_has_data(bio) && offset + size > zv->zv_volsize) {
 		printk(KERN_INFO
@@ -289,16 +377,16 @@ zvol_request(struct request_queue *q, struct bio *bio)
 		    (long long unsigned)offset,
 		    (long unsigned)size);
 
-		BIO_END_IO(bio, -SET_ERROR(EIO));
-		goto out;
+		zvol_end_io(zvr, SET_ERROR(EIO));
+		return;
 	}
 
 	if (rw == WRITE) {
 		boolean_t need_sync = B_FALSE;
 
 		if (unlikely(zv->zv_flags & ZVOL_RDONLY)) {
-			BIO_END_IO(bio, -SET_ERROR(EROFS));
-			goto out;
+			zvol_end_io(zvr, SET_ERROR(EROFS));
+			return;
 		}
 
 		/*
@@ -331,14 +419,10 @@ zvol_request(struct request_queue *q, struct bio *bio)
 		/* Some requests are just for flush and nothing else. */
 		if (size == 0) {
 			rw_exit(&zv->zv_suspend_lock);
-			BIO_END_IO(bio, 0);
-			goto out;
+			zvol_end_io(zvr, 0);
+			return;
 		}
 
-		zvr = kmem_alloc(sizeof (zv_request_t), KM_SLEEP);
-		zvr->zv = zv;
-		zvr->bio = bio;
-
 		/*
 		 * To be released in the I/O function. Since the I/O functions
 		 * are asynchronous, we take it here synchronously to make
@@ -356,12 +440,12 @@ zvol_request(struct request_queue *q, struct bio *bio)
 		need_sync = bio_is_fua(bio) ||
 		    zv->zv_objset->os_sync == ZFS_SYNC_ALWAYS;
 		if (bio_is_discard(bio) || bio_is_secure_erase(bio)) {
-			if (zvol_request_sync || need_sync ||
+			if (force_sync || need_sync ||
 			    taskq_dispatch(zvol_taskq, zvol_discard, zvr,
 			    TQ_SLEEP) == TASKQID_INVALID)
 				zvol_discard(zvr);
 		} else {
-			if (zvol_request_sync || need_sync ||
+			if (force_sync || need_sync ||
 			    taskq_dispatch(zvol_taskq, zvol_write, zvr,
 			    TQ_SLEEP) == TASKQID_INVALID)
 				zvol_write(zvr);
@@ -373,24 +457,32 @@ zvol_request(struct request_queue *q, struct bio *bio)
 		 * data and require no additional handling.
 		 */
 		if (size == 0) {
-			BIO_END_IO(bio, 0);
-			goto out;
+			zvol_end_io(zvr, 0);
+			return;
 		}
 
-		zvr = kmem_alloc(sizeof (zv_request_t), KM_SLEEP);
-		zvr->zv = zv;
-		zvr->bio = bio;
-
 		rw_enter(&zv->zv_suspend_lock, RW_READER);
 
 		zvr->lr = rangelock_enter(&zv->zv_rangelock, offset, size,
 		    RL_READER);
-		if (zvol_request_sync || taskq_dispatch(zvol_taskq,
+		if (force_sync || taskq_dispatch(zvol_taskq,
 		    zvol_read, zvr, TQ_SLEEP) == TASKQID_INVALID)
 			zvol_read(zvr);
 	}
+}
+
+static MAKE_REQUEST_FN_RET
+zvol_request(struct request_queue *q, struct bio *bio)
+{
+	fstrans_cookie_t cookie = spl_fstrans_mark();
+	zv_request_t *zvr;
+
+	zvr = kmem_alloc(sizeof (zv_request_t), KM_SLEEP);
+	zvr->zv = q->queuedata;
+	zvr->bio = bio;
+	zvr->rq = NULL;
+	zvol_request_impl(zvr);
 
-out:
 	spl_fstrans_unmark(cookie);
 #ifdef HAVE_MAKE_REQUEST_FN_RET_INT
 	return (0);
@@ -399,6 +491,57 @@ out:
 #endif
 }
 
+#ifdef HAVE_BLK_MQ
+/*
+ * blk-mq entry point.  The tag set is created with BLK_MQ_F_BLOCKING, so
+ * this may sleep and the request is handed straight to the DMU.
+ */
+static blk_status_t
+zvol_mq_queue_rq(struct blk_mq_hw_ctx *hctx,
+    const struct blk_mq_queue_data *bd)
+{
+	struct request *rq = bd->rq;
+	zv_request_t *zvr = blk_mq_rq_to_pdu(rq);
+	zvol_state_t *zv = hctx->queue->queuedata;
+	fstrans_cookie_t cookie;
+
+	blk_mq_start_request(rq);
+
+	/*
+	 * The flush machinery sends cache flushes as separate requests
+	 * which carry no bio; they only need the ZIL to be committed.
+	 */
+	if (req_op(rq) == REQ_OP_FLUSH) {
+		cookie = spl_fstrans_mark();
+		rw_enter(&zv->zv_suspend_lock, RW_READER);
+		if (zv->zv_zilog != NULL)
+			zil_commit(zv->zv_zilog, ZVOL_OBJ);
+		rw_exit(&zv->zv_suspend_lock);
+		spl_fstrans_unmark(cookie);
+		blk_mq_end_request(rq, BLK_STS_OK);
+		return (BLK_STS_OK);
+	}
+
+	if (rq->bio == NULL) {
+		blk_mq_end_request(rq, BLK_STS_OK);
+		return (BLK_STS_OK);
+	}
+
+	cookie = spl_fstrans_mark();
+	zvr->zv = zv;
+	zvr->bio = rq->bio;
+	zvr->rq = rq;
+	zvol_request_impl(zvr);
+	spl_fstrans_unmark(cookie);
+
+	return (BLK_STS_OK);
+}
+
+static const struct blk_mq_ops zvol_blk_mq_ops = {
+	.queue_rq	= zvol_mq_queue_rq,
+};
+#endif /* HAVE_BLK_MQ */
+
 static int
 zvol_open(struct block_device *bdev, fmode_t flag)
 {
@@ -751,6 +894,64 @@ static struct block_device_operations zvol_ops = {
 	.owner			= THIS_MODULE,
 };
 
+/*
+ * Set up the request queue of a new zvol.  With blk-mq each CPU gets its
+ * own hardware queue (unless zvol_blk_mq_hw_queues limits their number),
+ * each zvol_blk_mq_queue_depth requests deep; otherwise bios are passed
+ * to zvol_request() as they are submitted.
+ */
+static int
+zvol_alloc_queue(zvol_state_t *zv)
+{
+	struct zvol_state_os *zso = zv->zv_zso;
+
+#ifdef HAVE_BLK_MQ
+	if (zvol_use_blk_mq) {
+		struct blk_mq_tag_set *set = &zso->zvo_tag_set;
+		unsigned int nr_hw_queues = num_online_cpus();
+
+		if (zvol_blk_mq_hw_queues != 0)
+			nr_hw_queues = MIN(nr_hw_queues, zvol_blk_mq_hw_queues);
+
+		set->ops = &zvol_blk_mq_ops;
+		set->nr_hw_queues = nr_hw_queues;
+		set->queue_depth = MIN(MAX(zvol_blk_mq_queue_depth, 1),
+		    BLK_MQ_MAX_DEPTH);
+		set->numa_node = NUMA_NO_NODE;
+		set->cmd_size = sizeof (zv_request_t);
+		set->flags = BLK_MQ_F_BLOCKING;
+
+		if (blk_mq_alloc_tag_set(set) != 0)
+			return (SET_ERROR(ENOMEM));
+
+		zso->zvo_queue = blk_mq_init_queue(set);
+		if (IS_ERR(zso->zvo_queue)) {
+			blk_mq_free_tag_set(set);
+			zso->zvo_queue = NULL;
+			return (SET_ERROR(ENOMEM));
+		}
+		zso->zvo_use_blk_mq = B_TRUE;
+		return (0);
+	}
+#endif
+	zso->zvo_queue = blk_alloc_queue(GFP_ATOMIC);
+	if (zso->zvo_queue == NULL)
+		return (SET_ERROR(ENOMEM));
+
+	blk_queue_make_request(zso->zvo_queue, zvol_request);
+	return (0);
+}
+
+static void
+zvol_free_queue(zvol_state_t *zv)
+{
+	blk_cleanup_queue(zv->zv_zso->zvo_queue);
+#ifdef HAVE_BLK_MQ
+	if (zv->zv_zso->zvo_use_blk_mq)
+		blk_mq_free_tag_set(&zv->zv_zso->zvo_tag_set);
+#endif
+}
+
 /*
  * Allocate memory for a new zvol_state_t and setup the required
  * request queue and generic disk structures for the block device.
@@ -777,11 +978,9 @@ zvol_alloc(dev_t dev, const char *name)
 
 	mutex_init(&zv->zv_state_lock, NULL, MUTEX_DEFAULT, NULL);
 
-	zv->zv_zso->zvo_queue = blk_alloc_queue(GFP_ATOMIC);
-	if (zv->zv_zso->zvo_queue == NULL)
+	if (zvol_alloc_queue(zv) != 0)
 		goto out_kmem;
 
-	blk_queue_make_request(zv->zv_zso->zvo_queue, zvol_request);
 	blk_queue_set_write_cache(zv->zv_zso->zvo_queue, B_TRUE, B_TRUE);
 
 	/* Limit read-ahead to a single page to prevent over-prefetching. */
@@ -833,7 +1032,7 @@ zvol_alloc(dev_t dev, const char *name)
 	return (zv);
 
 out_queue:
-	blk_cleanup_queue(zv->zv_zso->zvo_queue);
+	zvol_free_queue(zv);
 out_kmem:
 	kmem_free(zv->zv_zso, sizeof (struct zvol_state_os));
 	kmem_free(zv, sizeof (zvol_state_t));
@@ -859,7 +1058,7 @@ zvol_free(zvol_state_t *zv)
 	rangelock_fini(&zv->zv_rangelock);
 
 	del_gendisk(zv->zv_zso->zvo_disk);
-	blk_cleanup_queue(zv->zv_zso->zvo_queue);
+	zvol_free_queue(zv);
 	put_disk(zv->zv_zso->zvo_disk);
 
 	ida_simple_remove(&zvol_ida,
@@ -1109,6 +1308,16 @@ MODULE_PARM_DESC(zvol_threads, "Max number of threads to handle I/O requests");
 module_param(zvol_request_sync, uint, 0644);
 MODULE_PARM_DESC(zvol_request_sync, "Synchronously handle bio requests");
 
+module_param(zvol_use_blk_mq, uint, 0644);
+MODULE_PARM_DESC(zvol_use_blk_mq, "Use the blk-mq API for new zvols");
+
+module_param(zvol_blk_mq_queue_depth, uint, 0644);
+MODULE_PARM_DESC(zvol_blk_mq_queue_depth, "Depth of each blk-mq queue");
+
+module_param(zvol_blk_mq_hw_queues, uint, 0644);
+MODULE_PARM_DESC(zvol_blk_mq_hw_queues,
+	"Max number of blk-mq hardware queues, 0 for one per CPU");
+
 module_param(zvol_max_discard_blocks, ulong, 0444);
 MODULE_PARM_DESC(zvol_max_discard_blocks, "Max number of blocks to discard");
 
@@ -88,7 +88,10 @@
  *
  * buf_hash_find() returns the appropriate mutex (held) when it
  * locates the requested buffer in the hash table.  It returns
- * NULL for the mutex if the buffer was not in the table.
+ * NULL for the mutex if the buffer was not in the table.  The hash
+ * chains themselves are walked without the mutex; the mutex is only
+ * taken once a matching header has been found.  Lookups which miss
+ * never take it at all.  See buf_hash_find() for details.
  *
  * buf_hash_remove() expects the appropriate hash mutex to be
  * already held before it is invoked.
@@ -305,6 +308,7 @@
 #include <sys/trace_defs.h>
 #include <sys/aggsum.h>
 #include <sys/cityhash.h>
+#include <sys/zstd/zstd.h>
 
 #ifndef _KERNEL
 /* set with ZFS_DEBUG=watch, to enable watchpoints on frozen buffers */
@@ -706,6 +710,28 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_l2_psize;
 	/* Not updated directly; only synced in arc_kstat_update. */
 	kstat_named_t arcstat_l2_hdr_size;
+	/*
+	 * Number of log blocks written to L2ARC devices, their total
+	 * aligned size and the number currently present on the devices.
+	 */
+	kstat_named_t arcstat_l2_log_blk_writes;
+	kstat_named_t arcstat_l2_log_blk_asize;
+	kstat_named_t arcstat_l2_log_blk_count;
+	/*
+	 * L2ARC rebuild statistics: outcomes of rebuild attempts and the
+	 * amount of data restored from the log blocks.
+	 */
+	kstat_named_t arcstat_l2_rebuild_success;
+	kstat_named_t arcstat_l2_rebuild_unsupported;
+	kstat_named_t arcstat_l2_rebuild_io_errors;
+	kstat_named_t arcstat_l2_rebuild_dh_errors;
+	kstat_named_t arcstat_l2_rebuild_cksum_lb_errors;
+	kstat_named_t arcstat_l2_rebuild_lowmem;
+	kstat_named_t arcstat_l2_rebuild_size;
+	kstat_named_t arcstat_l2_rebuild_asize;
+	kstat_named_t arcstat_l2_rebuild_bufs;
+	kstat_named_t arcstat_l2_rebuild_bufs_precached;
+	kstat_named_t arcstat_l2_rebuild_log_blks;
 	kstat_named_t arcstat_memory_throttle_count;
 	kstat_named_t arcstat_memory_direct_count;
 	kstat_named_t arcstat_memory_indirect_count;
@@ -808,6 +834,20 @@ static arc_stats_t arc_stats = {
 	{ "l2_size",			KSTAT_DATA_UINT64 },
 	{ "l2_asize",			KSTAT_DATA_UINT64 },
 	{ "l2_hdr_size",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_writes",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_asize",		KSTAT_DATA_UINT64 },
+	{ "l2_log_blk_count",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_success",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_unsupported",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_io_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_dh_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_cksum_lb_errors",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_lowmem",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_size",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_asize",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_bufs_precached",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_log_blks",	KSTAT_DATA_UINT64 },
 	{ "memory_throttle_count",	KSTAT_DATA_UINT64 },
 	{ "memory_direct_count",	KSTAT_DATA_UINT64 },
 	{ "memory_indirect_count",	KSTAT_DATA_UINT64 },
@@ -996,10 +1036,16 @@ static taskq_t *arc_prune_taskq;
  */
 
 #define	HT_LOCK_ALIGN	64
-#define	HT_LOCK_PAD	(P2NPHASE(sizeof (kmutex_t), (HT_LOCK_ALIGN)))
+#define	HT_LOCK_PAD	\
+	(P2NPHASE(sizeof (kmutex_t) + sizeof (uint64_t), (HT_LOCK_ALIGN)))
 
 struct ht_lock {
 	kmutex_t	ht_lock;
+	/*
+	 * Bumped, under ht_lock, before and after every change to a hash
+	 * chain covered by this lock.  Odd while a change is in progress.
+	 */
+	volatile uint64_t ht_seq;
 #ifdef _KERNEL
 	unsigned char	pad[HT_LOCK_PAD];
 #endif
@@ -1021,6 +1067,33 @@ static buf_hash_table_t buf_hash_table;
 #define	HDR_LOCK(hdr) \
 	(BUF_HASH_LOCK(BUF_HASH_INDEX(hdr->b_spa, &hdr->b_dva, hdr->b_birth)))
 
+/*
+ * Lockless hash chain walks need the headers they may be looking at to
+ * stay allocated until the walk is over.  Readers announce themselves in
+ * one of two per-CPU counts, selected by the low bit of buf_hash_epoch.
+ * Headers which may have been visible to a reader are queued on a per-CPU
+ * free batch, and a full batch is only returned to its kmem cache after
+ * both counts have drained (see buf_hash_synchronize()).
+ */
+typedef struct buf_hash_readers {
+	uint64_t	bhr_count[2];
+	unsigned char	bhr_pad[HT_LOCK_ALIGN - 2 * sizeof (uint64_t)];
+} buf_hash_readers_t;
+
+#define	BUF_HASH_FREE_BATCH	128
+
+typedef struct buf_hash_free {
+	kmutex_t	bhf_lock;
+	int		bhf_count;
+	kmem_cache_t	*bhf_cache[BUF_HASH_FREE_BATCH];
+	arc_buf_hdr_t	*bhf_hdr[BUF_HASH_FREE_BATCH];
+} buf_hash_free_t;
+
+static buf_hash_readers_t *buf_hash_readers;
+static buf_hash_free_t *buf_hash_free;
+static volatile uint64_t buf_hash_epoch;
+static kmutex_t buf_hash_sync_lock;
+
 uint64_t zfs_crc64_table[256];
 
 /*
@@ -1058,13 +1131,20 @@ int l2arc_noprefetch = B_TRUE;			/* don't cache prefetch bufs */
 int l2arc_feed_again = B_TRUE;			/* turbo warmup */
 int l2arc_norw = B_FALSE;			/* no reads during writes */
 
+/*
+ * Persistent L2ARC tunables.  Cache devices smaller than
+ * l2arc_rebuild_blocks_min_l2size do not get log blocks written to them,
+ * since the metadata overhead would outweigh the benefit.
+ */
+int l2arc_rebuild_enabled = B_TRUE;		/* rebuild L2ARC on import */
+unsigned long l2arc_rebuild_blocks_min_l2size = 1024 * 1024 * 1024;
+
 /*
  * L2ARC Internals
  */
 static list_t L2ARC_dev_list;			/* device list */
 static list_t *l2arc_dev_list;			/* device list pointer */
 static kmutex_t l2arc_dev_mtx;			/* device list mutex */
-static l2arc_dev_t *l2arc_dev_last;		/* last device used */
 static list_t L2ARC_free_on_write;		/* free after write buf list */
 static list_t *l2arc_free_on_write;		/* free after write list ptr */
 static kmutex_t l2arc_free_on_write_mtx;	/* mutex for list */
@@ -1083,6 +1163,7 @@ typedef struct l2arc_data_free {
 	abd_t		*l2df_abd;
 	size_t		l2df_size;
 	arc_buf_contents_t l2df_type;
+	l2arc_dev_t	*l2df_dev;	/* device whose write uses abd */
 	list_node_t	l2df_list_node;
 } l2arc_data_free_t;
 
@@ -1094,9 +1175,8 @@ typedef enum arc_fill_flags {
 	ARC_FILL_IN_PLACE	= 1 << 4  /* fill in place (special case) */
 } arc_fill_flags_t;
 
-static kmutex_t l2arc_feed_thr_lock;
-static kcondvar_t l2arc_feed_thr_cv;
-static uint8_t l2arc_thread_exit;
+static kmutex_t l2arc_rebuild_thr_lock;
+static kcondvar_t l2arc_rebuild_thr_cv;
 
 static abd_t *arc_get_data_abd(arc_buf_hdr_t *, uint64_t, void *);
 static void *arc_get_data_buf(arc_buf_hdr_t *, uint64_t, void *);
@@ -1120,6 +1200,27 @@ static inline void arc_hdr_clear_flags(arc_buf_hdr_t *hdr, arc_flags_t flags);
 static boolean_t l2arc_write_eligible(uint64_t, arc_buf_hdr_t *);
 static void l2arc_read_done(zio_t *);
 
+/*
+ * Persistent L2ARC routines.
+ */
+static void l2arc_dev_hdr_update(l2arc_dev_t *);
+static boolean_t l2arc_log_blkptr_valid(l2arc_dev_t *,
+    const l2arc_log_blkptr_t *);
+static boolean_t l2arc_log_blk_insert(l2arc_dev_t *, const arc_buf_hdr_t *);
+static uint64_t l2arc_log_blk_commit(l2arc_dev_t *, zio_t *,
+    l2arc_write_callback_t *);
+static void l2arc_lbptr_free(l2arc_dev_t *, l2arc_lb_ptr_buf_t *);
+static boolean_t l2arc_range_check_overlap(uint64_t, uint64_t, uint64_t);
+static void l2arc_rebuild_vdev(l2arc_dev_t *);
+static void l2arc_dev_rebuild_thread(void *);
+static int l2arc_rebuild(l2arc_dev_t *);
+static int l2arc_dev_hdr_read(l2arc_dev_t *);
+static int l2arc_log_blk_read(l2arc_dev_t *, const l2arc_log_blkptr_t *,
+    l2arc_log_blk_phys_t *);
+static void l2arc_log_blk_restore(l2arc_dev_t *,
+    const l2arc_log_blk_phys_t *, const l2arc_log_blkptr_t *);
+static void l2arc_hdr_restore(const l2arc_log_ent_phys_t *, l2arc_dev_t *);
+
 
 /*
  * We use Cityhash for this. It's fast, and has good hash properties without
@@ -1151,14 +1252,164 @@ buf_discard_identity(arc_buf_hdr_t *hdr)
 	hdr->b_birth = 0;
 }
 
+static uint64_t *
+buf_hash_read_enter(void)
+{
+	uint64_t *countp;
+
+	kpreempt_disable();
+	countp = &buf_hash_readers[CPU_SEQID].bhr_count[buf_hash_epoch & 1];
+	kpreempt_enable();
+
+	atomic_inc_64(countp);
+	membar_enter();
+
+	return (countp);
+}
+
+static void
+buf_hash_read_exit(uint64_t *countp)
+{
+	membar_exit();
+	atomic_dec_64(countp);
+}
+
+/*
+ * Wait until every lockless reader which may have seen a header that was
+ * removed from the hash table before this call has finished its walk.
+ * Readers never block while walking, so this does not wait for long.
+ */
+static void
+buf_hash_synchronize(void)
+{
+	mutex_enter(&buf_hash_sync_lock);
+	membar_enter();
+	for (int flip = 0; flip < 2; flip++) {
+		int old = buf_hash_epoch & 1;
+
+		atomic_inc_64((uint64_t *)&buf_hash_epoch);
+		membar_enter();
+
+		for (int c = 0; c < max_ncpus; c++) {
+			volatile uint64_t *countp =
+			    &buf_hash_readers[c].bhr_count[old];
+			while (*countp != 0)
+				cond_resched();
+		}
+	}
+	membar_enter();
+	mutex_exit(&buf_hash_sync_lock);
+}
+
+/*
+ * Return the headers of a free batch to their kmem caches.  The caller
+ * must hold bhf_lock.
+ */
+static void
+buf_hash_free_drain(buf_hash_free_t *bhf)
+{
+	ASSERT(MUTEX_HELD(&bhf->bhf_lock));
+
+	if (bhf->bhf_count == 0)
+		return;
+
+	buf_hash_synchronize();
+	for (int i = 0; i < bhf->bhf_count; i++)
+		kmem_cache_free(bhf->bhf_cache[i], bhf->bhf_hdr[i]);
+	bhf->bhf_count = 0;
+}
+
+/*
+ * Free a header which may still be visible to a lockless hash lookup.
+ */
+static void
+buf_hash_free_hdr(kmem_cache_t *cache, arc_buf_hdr_t *hdr)
+{
+	buf_hash_free_t *bhf;
+
+	ASSERT(!HDR_IN_HASH_TABLE(hdr));
+
+	kpreempt_disable();
+	bhf = &buf_hash_free[CPU_SEQID];
+	kpreempt_enable();
+
+	mutex_enter(&bhf->bhf_lock);
+	bhf->bhf_cache[bhf->bhf_count] = cache;
+	bhf->bhf_hdr[bhf->bhf_count] = hdr;
+	if (++bhf->bhf_count == BUF_HASH_FREE_BATCH)
+		buf_hash_free_drain(bhf);
+	mutex_exit(&bhf->bhf_lock);
+}
+
+/*
+ * Free every queued header, e.g. so the kmem caches can be reaped.
+ */
+static void
+buf_hash_free_flush(void)
+{
+	for (int c = 0; c < max_ncpus; c++) {
+		buf_hash_free_t *bhf = &buf_hash_free[c];
+
+		mutex_enter(&bhf->bhf_lock);
+		buf_hash_free_drain(bhf);
+		mutex_exit(&bhf->bhf_lock);
+	}
+}
+
 static arc_buf_hdr_t *
 buf_hash_find(uint64_t spa, const blkptr_t *bp, kmutex_t **lockp)
 {
 	const dva_t *dva = BP_IDENTITY(bp);
 	uint64_t birth = BP_PHYSICAL_BIRTH(bp);
 	uint64_t idx = BUF_HASH_INDEX(spa, dva, birth);
-	kmutex_t *hash_lock = BUF_HASH_LOCK(idx);
+	struct ht_lock *htl = &BUF_HASH_LOCK_NTRY(idx);
+	kmutex_t *hash_lock = &htl->ht_lock;
 	arc_buf_hdr_t *hdr;
+	uint64_t *countp, seq;
+
+	/*
+	 * Optimistically walk the chain without the hash lock.  The walk
+	 * is only trusted as long as ht_seq shows that no header has been
+	 * linked into or unlinked from a chain covered by this lock.  A
+	 * match is confirmed under the hash lock, which is only tried so
+	 * that the walk never blocks; on any doubt fall back to a locked
+	 * walk.
+	 */
+	countp = buf_hash_read_enter();
+	seq = htl->ht_seq;
+	membar_consumer();
+	if (seq & 1)
+		goto locked;
+
+	for (hdr = buf_hash_table.ht_table[idx]; hdr != NULL;
+	    hdr = hdr->b_hash_next) {
+		membar_consumer();
+		if (htl->ht_seq != seq)
+			goto locked;
+		if (!(HDR_EQUAL(spa, dva, birth, hdr)))
+			continue;
+
+		if (!mutex_tryenter(hash_lock))
+			goto locked;
+		if (!HDR_IN_HASH_TABLE(hdr) ||
+		    !(HDR_EQUAL(spa, dva, birth, hdr))) {
+			mutex_exit(hash_lock);
+			goto locked;
+		}
+		buf_hash_read_exit(countp);
+		*lockp = hash_lock;
+		return (hdr);
+	}
+
+	membar_consumer();
+	if (htl->ht_seq == seq) {
+		buf_hash_read_exit(countp);
+		*lockp = NULL;
+		return (NULL);
+	}
+
+locked:
+	buf_hash_read_exit(countp);
 
 	mutex_enter(hash_lock);
 	for (hdr = buf_hash_table.ht_table[idx]; hdr != NULL;
@@ -1205,8 +1456,12 @@ buf_hash_insert(arc_buf_hdr_t *hdr, kmutex_t **lockp)
 			return (fhdr);
 	}
 
+	BUF_HASH_LOCK_NTRY(idx).ht_seq++;
 	hdr->b_hash_next = buf_hash_table.ht_table[idx];
+	membar_producer();
 	buf_hash_table.ht_table[idx] = hdr;
+	membar_producer();
+	BUF_HASH_LOCK_NTRY(idx).ht_seq++;
 	arc_hdr_set_flags(hdr, ARC_FLAG_IN_HASH_TABLE);
 
 	/* collect some hash table performance data */
@@ -1238,8 +1493,12 @@ buf_hash_remove(arc_buf_hdr_t *hdr)
 		ASSERT3P(fhdr, !=, NULL);
 		hdrp = &fhdr->b_hash_next;
 	}
+	BUF_HASH_LOCK_NTRY(idx).ht_seq++;
+	membar_producer();
 	*hdrp = hdr->b_hash_next;
 	hdr->b_hash_next = NULL;
+	membar_producer();
+	BUF_HASH_LOCK_NTRY(idx).ht_seq++;
 	arc_hdr_clear_flags(hdr, ARC_FLAG_IN_HASH_TABLE);
 
 	/* collect some hash table performance data */
@@ -1277,6 +1536,14 @@ buf_fini(void)
 #endif
 	for (i = 0; i < BUF_LOCKS; i++)
 		mutex_destroy(&buf_hash_table.ht_locks[i].ht_lock);
+
+	buf_hash_free_flush();
+	for (i = 0; i < max_ncpus; i++)
+		mutex_destroy(&buf_hash_free[i].bhf_lock);
+	kmem_free(buf_hash_free, max_ncpus * sizeof (buf_hash_free_t));
+	kmem_free(buf_hash_readers, max_ncpus * sizeof (buf_hash_readers_t));
+	mutex_destroy(&buf_hash_sync_lock);
+
 	kmem_cache_destroy(hdr_full_cache);
 	kmem_cache_destroy(hdr_full_crypt_cache);
 	kmem_cache_destroy(hdr_l2only_cache);
@@ -1460,7 +1727,18 @@ retry:
 	for (i = 0; i < BUF_LOCKS; i++) {
 		mutex_init(&buf_hash_table.ht_locks[i].ht_lock,
 		    NULL, MUTEX_DEFAULT, NULL);
+		buf_hash_table.ht_locks[i].ht_seq = 0;
 	}
+
+	buf_hash_readers = kmem_zalloc(max_ncpus *
+	    sizeof (buf_hash_readers_t), KM_SLEEP);
+	buf_hash_free = kmem_zalloc(max_ncpus * sizeof (buf_hash_free_t),
+	    KM_SLEEP);
+	for (i = 0; i < max_ncpus; i++)
+		mutex_init(&buf_hash_free[i].bhf_lock, NULL, MUTEX_DEFAULT,
+		    NULL);
+	mutex_init(&buf_hash_sync_lock, NULL, MUTEX_DEFAULT, NULL);
+	buf_hash_epoch = 0;
 }
 
 #define	ARC_MINTIME	(hz>>4) /* 62 ms */
@@ -1925,7 +2203,7 @@ arc_hdr_authenticate(arc_buf_hdr_t *hdr, spa_t *spa, uint64_t dsobj)
 		abd_take_ownership_of_buf(abd, B_TRUE);
 
 		csize = zio_compress_data(HDR_GET_COMPRESS(hdr),
-		    hdr->b_l1hdr.b_pabd, tmpbuf, lsize);
+		    hdr->b_l1hdr.b_pabd, tmpbuf, lsize, hdr->b_complevel);
 		ASSERT3U(csize, <=, psize);
 		abd_zero_off(abd, csize, psize - csize);
 	}
@@ -2011,7 +2289,7 @@ arc_hdr_decrypt(arc_buf_hdr_t *hdr, spa_t *spa, const zbookmark_phys_t *zb)
 
 		ret = zio_decompress_data(HDR_GET_COMPRESS(hdr),
 		    hdr->b_l1hdr.b_pabd, tmp, HDR_GET_PSIZE(hdr),
-		    HDR_GET_LSIZE(hdr));
+		    HDR_GET_LSIZE(hdr), &hdr->b_complevel);
 		if (ret != 0) {
 			abd_return_buf(cabd, tmp, arc_hdr_size(hdr));
 			goto error;
@@ -2258,7 +2536,8 @@ arc_buf_fill(arc_buf_t *buf, spa_t *spa, const zbookmark_phys_t *zb,
 		} else {
 			error = zio_decompress_data(HDR_GET_COMPRESS(hdr),
 			    hdr->b_l1hdr.b_pabd, buf->b_data,
-			    HDR_GET_PSIZE(hdr), HDR_GET_LSIZE(hdr));
+			    HDR_GET_PSIZE(hdr), HDR_GET_LSIZE(hdr),
+			    &hdr->b_complevel);
 
 			/*
 			 * Absent hardware errors or software bugs, this should
@@ -3052,13 +3331,15 @@ arc_loan_inuse_buf(arc_buf_t *buf, void *tag)
 }
 
 static void
-l2arc_free_abd_on_write(abd_t *abd, size_t size, arc_buf_contents_t type)
+l2arc_free_abd_on_write(abd_t *abd, size_t size, arc_buf_contents_t type,
+    l2arc_dev_t *dev)
 {
 	l2arc_data_free_t *df = kmem_alloc(sizeof (*df), KM_SLEEP);
 
 	df->l2df_abd = abd;
 	df->l2df_size = size;
 	df->l2df_type = type;
+	df->l2df_dev = dev;
 	mutex_enter(&l2arc_free_on_write_mtx);
 	list_insert_head(l2arc_free_on_write, df);
 	mutex_exit(&l2arc_free_on_write_mtx);
@@ -3087,10 +3368,16 @@ arc_hdr_free_on_write(arc_buf_hdr_t *hdr, boolean_t free_rdata)
 		arc_space_return(size, ARC_SPACE_DATA);
 	}
 
+	/*
+	 * The l2hdr may already have been dropped by arc_release(), but
+	 * b_dev still names the device the in-flight write is going to.
+	 */
 	if (free_rdata) {
-		l2arc_free_abd_on_write(hdr->b_crypt_hdr.b_rabd, size, type);
+		l2arc_free_abd_on_write(hdr->b_crypt_hdr.b_rabd, size, type,
+		    hdr->b_l2hdr.b_dev);
 	} else {
-		l2arc_free_abd_on_write(hdr->b_l1hdr.b_pabd, size, type);
+		l2arc_free_abd_on_write(hdr->b_l1hdr.b_pabd, size, type,
+		    hdr->b_l2hdr.b_dev);
 	}
 }
 
@@ -3395,6 +3682,7 @@ arc_hdr_alloc(uint64_t spa, int32_t psize, int32_t lsize,
 	HDR_SET_LSIZE(hdr, lsize);
 	hdr->b_spa = spa;
 	hdr->b_type = type;
+	hdr->b_complevel = 0;
 	hdr->b_flags = 0;
 	arc_hdr_set_flags(hdr, arc_bufc_to_flags(type) | ARC_FLAG_HAS_L1HDR);
 	arc_hdr_set_compress(hdr, compression_type);
@@ -3525,7 +3813,7 @@ arc_hdr_realloc(arc_buf_hdr_t *hdr, kmem_cache_t *old, kmem_cache_t *new)
 	    arc_hdr_size(nhdr), nhdr);
 
 	buf_discard_identity(hdr);
-	kmem_cache_free(old, hdr);
+	buf_hash_free_hdr(old, hdr);
 
 	return (nhdr);
 }
@@ -3578,6 +3866,7 @@ arc_hdr_realloc_crypt(arc_buf_hdr_t *hdr, boolean_t need_crypt)
 	nhdr->b_dva = hdr->b_dva;
 	nhdr->b_birth = hdr->b_birth;
 	nhdr->b_type = hdr->b_type;
+	nhdr->b_complevel = hdr->b_complevel;
 	nhdr->b_flags = hdr->b_flags;
 	nhdr->b_psize = hdr->b_psize;
 	nhdr->b_lsize = hdr->b_lsize;
@@ -3651,7 +3940,7 @@ arc_hdr_realloc_crypt(arc_buf_hdr_t *hdr, boolean_t need_crypt)
 	}
 
 	buf_discard_identity(hdr);
-	kmem_cache_free(ocache, hdr);
+	buf_hash_free_hdr(ocache, hdr);
 
 	return (nhdr);
 }
@@ -3873,12 +4162,12 @@ arc_hdr_destroy(arc_buf_hdr_t *hdr)
 		ASSERT3P(hdr->b_l1hdr.b_acb, ==, NULL);
 
 		if (!HDR_PROTECTED(hdr)) {
-			kmem_cache_free(hdr_full_cache, hdr);
+			buf_hash_free_hdr(hdr_full_cache, hdr);
 		} else {
-			kmem_cache_free(hdr_full_crypt_cache, hdr);
+			buf_hash_free_hdr(hdr_full_crypt_cache, hdr);
 		}
 	} else {
-		kmem_cache_free(hdr_l2only_cache, hdr);
+		buf_hash_free_hdr(hdr_l2only_cache, hdr);
 	}
 }
 
@@ -5034,7 +5323,7 @@ arc_kmem_reap_soon(void)
 	kmem_cache_t		*prev_data_cache = NULL;
 	extern kmem_cache_t	*zio_buf_cache[];
 	extern kmem_cache_t	*zio_data_buf_cache[];
-	extern kmem_cache_t	*range_seg_cache;
+	extern kmem_cache_t	*zfs_btree_leaf_cache;
 
 #ifdef _KERNEL
 	if ((aggsum_compare(&arc_meta_used, arc_meta_limit) >= 0) &&
@@ -5069,9 +5358,10 @@ arc_kmem_reap_soon(void)
 		}
 	}
 	kmem_cache_reap_now(buf_cache);
+	buf_hash_free_flush();
 	kmem_cache_reap_now(hdr_full_cache);
 	kmem_cache_reap_now(hdr_l2only_cache);
-	kmem_cache_reap_now(range_seg_cache);
+	kmem_cache_reap_now(zfs_btree_leaf_cache);
 
 	if (zio_arena != NULL) {
 		/*
@@ -5980,6 +6270,29 @@ arc_read_done(zio_t *zio)
 		} else {
 			hdr->b_l1hdr.b_byteswap = DMU_BSWAP_NUMFUNCS;
 		}
+
+		/*
+		 * The zstd level is not in the bp.  Pick it up from the
+		 * decompression done by the zio pipeline, or from the
+		 * block's zstd header when the data is kept compressed,
+		 * so the L2ARC can reproduce the block later on.
+		 */
+		if (BP_GET_COMPRESS(bp) == ZIO_COMPRESS_ZSTD &&
+		    hdr->b_complevel == ZIO_COMPLEVEL_INHERIT) {
+			uint8_t complevel = zio->io_prop.zp_complevel;
+
+			if (complevel != ZIO_COMPLEVEL_INHERIT) {
+				hdr->b_complevel = complevel;
+			} else if (!BP_IS_PROTECTED(bp) &&
+			    BP_GET_PSIZE(bp) >= sizeof (zfs_zstdhdr_t)) {
+				void *zhdr = abd_borrow_buf_copy(zio->io_abd,
+				    sizeof (zfs_zstdhdr_t));
+				(void) zfs_zstd_get_level(zhdr,
+				    sizeof (zfs_zstdhdr_t), &hdr->b_complevel);
+				abd_return_buf(zio->io_abd, zhdr,
+				    sizeof (zfs_zstdhdr_t));
+			}
+		}
 	}
 
 	arc_hdr_clear_flags(hdr, ARC_FLAG_L2_EVICTED);
@@ -7073,6 +7386,7 @@ arc_write_ready(zio_t *zio)
 	}
 	HDR_SET_PSIZE(hdr, psize);
 	arc_hdr_set_compress(hdr, compress);
+	hdr->b_complevel = zio->io_prop.zp_complevel;
 
 	if (zio->io_error != 0 || psize == 0)
 		goto out;
@@ -7261,6 +7575,7 @@ arc_write(zio_t *pio, spa_t *spa, uint64_t txg,
 		ASSERT(ARC_BUF_COMPRESSED(buf));
 		localprop.zp_encrypt = B_TRUE;
 		localprop.zp_compress = HDR_GET_COMPRESS(hdr);
+		localprop.zp_complevel = hdr->b_complevel;
 		localprop.zp_byteorder =
 		    (hdr->b_l1hdr.b_byteswap == DMU_BSWAP_NUMFUNCS) ?
 		    ZFS_HOST_BYTEORDER : !ZFS_HOST_BYTEORDER;
@@ -7279,6 +7594,7 @@ arc_write(zio_t *pio, spa_t *spa, uint64_t txg,
 	} else if (ARC_BUF_COMPRESSED(buf)) {
 		ASSERT3U(HDR_GET_LSIZE(hdr), !=, arc_buf_size(buf));
 		localprop.zp_compress = HDR_GET_COMPRESS(hdr);
+		localprop.zp_complevel = hdr->b_complevel;
 		zio_flags |= ZIO_FLAG_RAW_COMPRESS;
 	}
 	callback = kmem_zalloc(sizeof (arc_write_callback_t), KM_SLEEP);
@@ -8027,7 +8343,11 @@ arc_fini(void)
  * sure we adapt to compression effects (which might significantly reduce
  * the data volume we write to L2ARC). The thread that does this is
  * l2arc_feed_thread(), illustrated below; example sizes are included to
- * provide a better sense of ratio than this diagram:
+ * provide a better sense of ratio than this diagram.  Every cache device
+ * has its own feed thread with its own write budget and headroom, so that
+ * pools with several fast cache devices can fill them in parallel.  The
+ * threads pick random ARC sublists and a buffer is only ever written to
+ * one device, as it is claimed under its hash lock:
  *
  *	       head -->                        tail
  *	        +---------------------+----------+
@@ -8083,10 +8403,18 @@ arc_fini(void)
  * 8. If an ARC buffer is written (and dirtied) which also exists in the
  * L2ARC, the now stale L2ARC buffer is immediately dropped.
  *
+ * 9. The L2ARC contents survive an export/import or a reboot.  Along with
+ * the buffers, log blocks describing them are written to each device and
+ * chained from a device header (see arc_impl.h).  When the device is added
+ * back to its pool, l2arc_rebuild() walks the chain and restores L2-only
+ * headers for the buffers, so the device does not have to be warmed up
+ * again.  Restored buffers are verified against their block pointer's
+ * checksum like any other L2ARC read.
+ *
  * The performance of the L2ARC can be tweaked by a number of tunables, which
  * may be necessary for different workloads:
  *
- *	l2arc_write_max		max write bytes per interval
+ *	l2arc_write_max		max write bytes per interval, per device
  *	l2arc_write_boost	extra write bytes during device warmup
  *	l2arc_noprefetch	skip caching prefetched buffers
  *	l2arc_headroom		number of max device writes to precache
@@ -8096,6 +8424,7 @@ arc_fini(void)
  *				since more compressed buffers are likely to
  *				be present
  *	l2arc_feed_secs		seconds between L2ARC writing
+ *	l2arc_rebuild_enabled	rebuild the L2ARC contents on import
  *
  * Tunables may be removed or added as future performance improvements are
  * integrated, and also may become zpool properties.
@@ -8127,8 +8456,26 @@ l2arc_write_eligible(uint64_t spa_guid, arc_buf_hdr_t *hdr)
 	return (B_TRUE);
 }
 
+/*
+ * Worst case space taken up on a device by the log blocks describing
+ * write_sz bytes of buffers.
+ */
 static uint64_t
-l2arc_write_size(void)
+l2arc_log_blk_overhead(uint64_t write_sz, l2arc_dev_t *dev)
+{
+	if (dev->l2ad_log_entries == 0)
+		return (0);
+
+	uint64_t log_entries = write_sz >> SPA_MINBLOCKSHIFT;
+	uint64_t log_blocks = (log_entries + dev->l2ad_log_entries - 1) /
+	    dev->l2ad_log_entries;
+
+	return (vdev_psize_to_asize(dev->l2ad_vdev,
+	    sizeof (l2arc_log_blk_phys_t)) * log_blocks);
+}
+
+static uint64_t
+l2arc_write_size(l2arc_dev_t *dev)
 {
 	uint64_t size;
 
@@ -8147,6 +8494,12 @@ l2arc_write_size(void)
 	if (arc_warm == B_FALSE)
 		size += l2arc_write_boost;
 
+	/*
+	 * Make room for the log blocks which will be written alongside the
+	 * buffers, so that l2arc_evict() clears enough space for both.
+	 */
+	size += l2arc_log_blk_overhead(size, dev);
+
 	return (size);
 
 }
@@ -8174,71 +8527,13 @@ l2arc_write_interval(clock_t began, uint64_t wanted, uint64_t wrote)
 }
 
 /*
- * Cycle through L2ARC devices.  This is how L2ARC load balances.
- * If a device is returned, this also returns holding the spa config lock.
- */
-static l2arc_dev_t *
-l2arc_dev_get_next(void)
-{
-	l2arc_dev_t *first, *next = NULL;
-
-	/*
-	 * Lock out the removal of spas (spa_namespace_lock), then removal
-	 * of cache devices (l2arc_dev_mtx).  Once a device has been selected,
-	 * both locks will be dropped and a spa config lock held instead.
-	 */
-	mutex_enter(&spa_namespace_lock);
-	mutex_enter(&l2arc_dev_mtx);
-
-	/* if there are no vdevs, there is nothing to do */
-	if (l2arc_ndev == 0)
-		goto out;
-
-	first = NULL;
-	next = l2arc_dev_last;
-	do {
-		/* loop around the list looking for a non-faulted vdev */
-		if (next == NULL) {
-			next = list_head(l2arc_dev_list);
-		} else {
-			next = list_next(l2arc_dev_list, next);
-			if (next == NULL)
-				next = list_head(l2arc_dev_list);
-		}
-
-		/* if we have come back to the start, bail out */
-		if (first == NULL)
-			first = next;
-		else if (next == first)
-			break;
-
-	} while (vdev_is_dead(next->l2ad_vdev));
-
-	/* if we were unable to find any usable vdevs, return NULL */
-	if (vdev_is_dead(next->l2ad_vdev))
-		next = NULL;
-
-	l2arc_dev_last = next;
-
-out:
-	mutex_exit(&l2arc_dev_mtx);
-
-	/*
-	 * Grab the config lock to prevent the 'next' device from being
-	 * removed while we are writing to it.
-	 */
-	if (next != NULL)
-		spa_config_enter(next->l2ad_spa, SCL_L2ARC, next, RW_READER);
-	mutex_exit(&spa_namespace_lock);
-
-	return (next);
-}
-
-/*
- * Free buffers that were tagged for destruction.
+ * Free buffers that were tagged for destruction.  Each device is fed by
+ * its own thread, so only the buffers of the device whose write has just
+ * completed may be freed; the others can still be in flight.  A NULL dev
+ * frees everything.
  */
 static void
-l2arc_do_free_on_write(void)
+l2arc_do_free_on_write(l2arc_dev_t *dev)
 {
 	list_t *buflist;
 	l2arc_data_free_t *df, *df_prev;
@@ -8248,6 +8543,8 @@ l2arc_do_free_on_write(void)
 
 	for (df = list_tail(buflist); df; df = df_prev) {
 		df_prev = list_prev(buflist, df);
+		if (dev != NULL && df->l2df_dev != dev)
+			continue;
 		ASSERT3P(df->l2df_abd, !=, NULL);
 		abd_free(df->l2df_abd);
 		list_remove(buflist, df);
@@ -8270,6 +8567,7 @@ l2arc_write_done(zio_t *zio)
 	arc_buf_hdr_t *head, *hdr, *hdr_prev;
 	kmutex_t *hash_lock;
 	int64_t bytes_dropped = 0;
+	l2arc_lb_abd_buf_t *abd_buf;
 
 	cb = zio->io_private;
 	ASSERT3P(cb, !=, NULL);
@@ -8374,7 +8672,16 @@ top:
 
 	vdev_space_update(dev->l2ad_vdev, -bytes_dropped, 0, 0);
 
-	l2arc_do_free_on_write();
+	/*
+	 * Free the compressed log blocks written along with the buffers.
+	 */
+	while ((abd_buf = list_remove_head(&cb->l2wcb_abd_list)) != NULL) {
+		abd_free(abd_buf->abd);
+		kmem_free(abd_buf, sizeof (l2arc_lb_abd_buf_t));
+	}
+	list_destroy(&cb->l2wcb_abd_list);
+
+	l2arc_do_free_on_write(dev);
 
 	kmem_free(cb, sizeof (l2arc_write_callback_t));
 }
@@ -8447,7 +8754,7 @@ l2arc_untransform(zio_t *zio, l2arc_read_callback_t *cb)
 
 		ret = zio_decompress_data(HDR_GET_COMPRESS(hdr),
 		    hdr->b_l1hdr.b_pabd, tmp, HDR_GET_PSIZE(hdr),
-		    HDR_GET_LSIZE(hdr));
+		    HDR_GET_LSIZE(hdr), &hdr->b_complevel);
 		if (ret != 0) {
 			abd_return_buf_copy(cabd, tmp, arc_hdr_size(hdr));
 			arc_free_data_abd(hdr, cabd, arc_hdr_size(hdr), hdr);
@@ -8656,6 +8963,7 @@ l2arc_evict(l2arc_dev_t *dev, uint64_t distance, boolean_t all)
 	arc_buf_hdr_t *hdr, *hdr_prev;
 	kmutex_t *hash_lock;
 	uint64_t taddr;
+	l2arc_lb_ptr_buf_t *lb_ptr_buf, *lb_ptr_buf_prev;
 
 	buflist = &dev->l2ad_buflist;
 
@@ -8679,6 +8987,30 @@ l2arc_evict(l2arc_dev_t *dev, uint64_t distance, boolean_t all)
 	DTRACE_PROBE4(l2arc__evict, l2arc_dev_t *, dev, list_t *, buflist,
 	    uint64_t, taddr, boolean_t, all);
 
+	/*
+	 * Record how far ahead of the write hand the device has been
+	 * cleared.  Log blocks in that region are dropped below and must
+	 * not be trusted by a rebuild either, see l2arc_log_blkptr_valid().
+	 */
+	if (!all)
+		dev->l2ad_evict = MAX(dev->l2ad_evict, taddr);
+
+	/*
+	 * Free the log blocks which are about to be overwritten.  The list
+	 * is ordered newest first, so stop at the first one still valid.
+	 */
+	mutex_enter(&dev->l2ad_mtx);
+	for (lb_ptr_buf = list_tail(&dev->l2ad_lbptr_list); lb_ptr_buf != NULL;
+	    lb_ptr_buf = lb_ptr_buf_prev) {
+		lb_ptr_buf_prev = list_prev(&dev->l2ad_lbptr_list, lb_ptr_buf);
+
+		if (!all && l2arc_log_blkptr_valid(dev, lb_ptr_buf->lb_ptr))
+			break;
+
+		l2arc_lbptr_free(dev, lb_ptr_buf);
+	}
+	mutex_exit(&dev->l2ad_mtx);
+
 top:
 	mutex_enter(&dev->l2ad_mtx);
 	for (hdr = list_tail(buflist); hdr; hdr = hdr_prev) {
@@ -8802,11 +9134,28 @@ l2arc_apply_transforms(spa_t *spa, arc_buf_hdr_t *hdr, uint64_t asize,
 	}
 
 	if (compress != ZIO_COMPRESS_OFF && !HDR_COMPRESSION_ENABLED(hdr)) {
+		/*
+		 * A zstd block can only be reproduced with the level it was
+		 * written at.  If we never learned the level, or the library
+		 * no longer produces a block that fits, skip the buffer.
+		 */
+		if (ZIO_COMPRESS_HASLEVEL(compress) &&
+		    hdr->b_complevel == ZIO_COMPLEVEL_INHERIT) {
+			ret = SET_ERROR(EINVAL);
+			goto error;
+		}
+
 		cabd = abd_alloc_for_io(asize, ismd);
 		tmp = abd_borrow_buf(cabd, asize);
 
-		psize = zio_compress_data(compress, to_write, tmp, size);
-		ASSERT3U(psize, <=, HDR_GET_PSIZE(hdr));
+		psize = zio_compress_data(compress, to_write, tmp, size,
+		    hdr->b_complevel);
+		if (psize > HDR_GET_PSIZE(hdr)) {
+			ASSERT(ZIO_COMPRESS_HASLEVEL(compress));
+			abd_return_buf(cabd, tmp, asize);
+			ret = SET_ERROR(EIO);
+			goto error;
+		}
 		if (psize < asize)
 			bzero((char *)tmp + psize, asize - psize);
 		psize = HDR_GET_PSIZE(hdr);
@@ -8885,12 +9234,20 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	arc_buf_hdr_t *hdr, *hdr_prev, *head;
 	uint64_t write_asize, write_psize, write_lsize, headroom;
 	boolean_t full;
-	l2arc_write_callback_t *cb;
+	l2arc_write_callback_t *cb = NULL;
 	zio_t *pio, *wzio;
 	uint64_t guid = spa_load_guid(spa);
+	uint64_t lb_reserve;
 
 	ASSERT3P(dev->l2ad_vdev, !=, NULL);
 
+	/*
+	 * When log blocks are in use, always leave room for committing one
+	 * more, so that a commit triggered by the last buffer still fits.
+	 */
+	lb_reserve = (dev->l2ad_log_entries == 0) ? 0 :
+	    vdev_psize_to_asize(dev->l2ad_vdev, sizeof (l2arc_log_blk_phys_t));
+
 	pio = NULL;
 	write_lsize = write_asize = write_psize = 0;
 	full = B_FALSE;
@@ -8968,7 +9325,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			uint64_t asize = vdev_psize_to_asize(dev->l2ad_vdev,
 			    psize);
 
-			if ((write_asize + asize) > target_sz) {
+			if ((write_asize + asize + lb_reserve) > target_sz) {
 				full = B_TRUE;
 				mutex_exit(hash_lock);
 				break;
@@ -9022,7 +9379,8 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 					continue;
 				}
 
-				l2arc_free_abd_on_write(to_write, asize, type);
+				l2arc_free_abd_on_write(to_write, asize, type,
+				    dev);
 			}
 
 			if (pio == NULL) {
@@ -9039,6 +9397,9 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 				    sizeof (l2arc_write_callback_t), KM_SLEEP);
 				cb->l2wcb_dev = dev;
 				cb->l2wcb_head = head;
+				list_create(&cb->l2wcb_abd_list,
+				    sizeof (l2arc_lb_abd_buf_t),
+				    offsetof(l2arc_lb_abd_buf_t, node));
 				pio = zio_root(spa, l2arc_write_done, cb,
 				    ZIO_FLAG_CANFAIL);
 			}
@@ -9056,6 +9417,14 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			(void) zfs_refcount_add_many(&dev->l2ad_alloc,
 			    arc_hdr_size(hdr), hdr);
 
+			/*
+			 * Record the buffer in the log block under
+			 * construction before the hand moves past it.
+			 */
+			boolean_t commit = B_FALSE;
+			if (dev->l2ad_log_entries > 0)
+				commit = l2arc_log_blk_insert(dev, hdr);
+
 			wzio = zio_write_phys(pio, dev->l2ad_vdev,
 			    hdr->b_l2hdr.b_daddr, asize, to_write,
 			    ZIO_CHECKSUM_OFF, NULL, hdr,
@@ -9074,6 +9443,15 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 			mutex_exit(hash_lock);
 
 			(void) zio_nowait(wzio);
+
+			/*
+			 * The log block is full; write it out right after
+			 * the buffers it describes.
+			 */
+			if (commit) {
+				write_asize +=
+				    l2arc_log_blk_commit(dev, pio, cb);
+			}
 		}
 
 		multilist_sublist_unlock(mls);
@@ -9087,6 +9465,15 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 		ASSERT0(write_lsize);
 		ASSERT(!HDR_HAS_L1HDR(head));
 		kmem_cache_free(hdr_l2only_cache, head);
+
+		/*
+		 * Although nothing was written, l2arc_evict() may have
+		 * advanced the evicted region; persist it.
+		 */
+		if (dev->l2ad_log_entries > 0 &&
+		    dev->l2ad_evict != dev->l2ad_dev_hdr->dh_evict)
+			l2arc_dev_hdr_update(dev);
+
 		return (0);
 	}
 
@@ -9102,6 +9489,7 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	 */
 	if (dev->l2ad_hand >= (dev->l2ad_end - target_sz)) {
 		dev->l2ad_hand = dev->l2ad_start;
+		dev->l2ad_evict = dev->l2ad_start;
 		dev->l2ad_first = B_FALSE;
 	}
 
@@ -9109,62 +9497,68 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	(void) zio_wait(pio);
 	dev->l2ad_writing = B_FALSE;
 
+	/*
+	 * Only now that the buffers and log blocks are on stable storage
+	 * can the device header be pointed at the newest log block.
+	 */
+	if (dev->l2ad_log_entries > 0)
+		l2arc_dev_hdr_update(dev);
+
 	return (write_asize);
 }
 
 /*
- * This thread feeds the L2ARC at regular intervals.  This is the beating
- * heart of the L2ARC.
+ * This thread feeds one L2ARC device at regular intervals.  This is the
+ * beating heart of the L2ARC.
  */
-/* ARGSUSED */
 static void
-l2arc_feed_thread(void *unused)
+l2arc_feed_thread(void *arg)
 {
+	l2arc_dev_t *dev = arg;
+	l2arc_dev_feed_stats_t *lfs = &dev->l2ad_feed_stats;
+	spa_t *spa = dev->l2ad_spa;
 	callb_cpr_t cpr;
-	l2arc_dev_t *dev;
-	spa_t *spa;
 	uint64_t size, wrote;
 	clock_t begin, next = ddi_get_lbolt();
+	hrtime_t start;
 	fstrans_cookie_t cookie;
 
-	CALLB_CPR_INIT(&cpr, &l2arc_feed_thr_lock, callb_generic_cpr, FTAG);
+	CALLB_CPR_INIT(&cpr, &dev->l2ad_feed_lock, callb_generic_cpr, FTAG);
 
-	mutex_enter(&l2arc_feed_thr_lock);
+	mutex_enter(&dev->l2ad_feed_lock);
 
 	cookie = spl_fstrans_mark();
-	while (l2arc_thread_exit == 0) {
+	while (!dev->l2ad_feed_exit) {
 		CALLB_CPR_SAFE_BEGIN(&cpr);
-		(void) cv_timedwait_sig(&l2arc_feed_thr_cv,
-		    &l2arc_feed_thr_lock, next);
-		CALLB_CPR_SAFE_END(&cpr, &l2arc_feed_thr_lock);
+		(void) cv_timedwait_sig(&dev->l2ad_feed_cv,
+		    &dev->l2ad_feed_lock, next);
+		CALLB_CPR_SAFE_END(&cpr, &dev->l2ad_feed_lock);
 		next = ddi_get_lbolt() + hz;
 
+		if (dev->l2ad_feed_exit)
+			break;
+
+		begin = ddi_get_lbolt();
+
 		/*
-		 * Quick check for L2ARC devices.
+		 * Hold the config lock to prevent the device from being
+		 * removed while we are writing to it.  Removal happens with
+		 * the config lock held as writer and then waits for this
+		 * thread to exit, so we must not block on it.
 		 */
-		mutex_enter(&l2arc_dev_mtx);
-		if (l2arc_ndev == 0) {
-			mutex_exit(&l2arc_dev_mtx);
+		if (!spa_config_tryenter(spa, SCL_L2ARC, dev, RW_READER)) {
+			lfs->lfs_abort_busy.value.ui64++;
 			continue;
 		}
-		mutex_exit(&l2arc_dev_mtx);
-		begin = ddi_get_lbolt();
 
 		/*
-		 * This selects the next l2arc device to write to, and in
-		 * doing so the next spa to feed from: dev->l2ad_spa.   This
-		 * will return NULL if there are now no l2arc devices or if
-		 * they are all faulted.
-		 *
-		 * If a device is returned, its spa's config lock is also
-		 * held to prevent device removal.  l2arc_dev_get_next()
-		 * will grab and release l2arc_dev_mtx.
+		 * Devices which are faulted or whose contents are still
+		 * being rebuilt are not written to.
 		 */
-		if ((dev = l2arc_dev_get_next()) == NULL)
+		if (vdev_is_dead(dev->l2ad_vdev) || dev->l2ad_rebuild) {
+			spa_config_exit(spa, SCL_L2ARC, dev);
 			continue;
-
-		spa = dev->l2ad_spa;
-		ASSERT3P(spa, !=, NULL);
+		}
 
 		/*
 		 * If the pool is read-only then force the feed thread to
@@ -9181,13 +9575,21 @@ l2arc_feed_thread(void *unused)
 		 */
 		if (arc_reclaim_needed()) {
 			ARCSTAT_BUMP(arcstat_l2_abort_lowmem);
+			lfs->lfs_abort_lowmem.value.ui64++;
 			spa_config_exit(spa, SCL_L2ARC, dev);
 			continue;
 		}
 
 		ARCSTAT_BUMP(arcstat_l2_feeds);
+		start = gethrtime();
 
-		size = l2arc_write_size();
+		/*
+		 * The feed lock only protects the thread state; drop it so
+		 * that stopping the thread does not wait for the writes.
+		 */
+		mutex_exit(&dev->l2ad_feed_lock);
+
+		size = l2arc_write_size(dev);
 
 		/*
 		 * Evict L2ARC buffers that will be overwritten.
@@ -9204,15 +9606,85 @@ l2arc_feed_thread(void *unused)
 		 */
 		next = l2arc_write_interval(begin, size, wrote);
 		spa_config_exit(spa, SCL_L2ARC, dev);
+
+		mutex_enter(&dev->l2ad_feed_lock);
+		lfs->lfs_feeds.value.ui64++;
+		lfs->lfs_write_target.value.ui64 += size;
+		lfs->lfs_write_bytes.value.ui64 += wrote;
+		lfs->lfs_feed_time_ns.value.ui64 += gethrtime() - start;
 	}
 	spl_fstrans_unmark(cookie);
 
-	l2arc_thread_exit = 0;
-	cv_broadcast(&l2arc_feed_thr_cv);
-	CALLB_CPR_EXIT(&cpr);		/* drops l2arc_feed_thr_lock */
+	dev->l2ad_feed_thread = NULL;
+	cv_broadcast(&dev->l2ad_feed_cv);
+	CALLB_CPR_EXIT(&cpr);		/* drops l2ad_feed_lock */
 	thread_exit();
 }
 
+static l2arc_dev_feed_stats_t l2arc_dev_feed_stats_template = {
+	{ "feeds",			KSTAT_DATA_UINT64 },
+	{ "abort_busy",			KSTAT_DATA_UINT64 },
+	{ "abort_lowmem",		KSTAT_DATA_UINT64 },
+	{ "write_target",		KSTAT_DATA_UINT64 },
+	{ "write_bytes",		KSTAT_DATA_UINT64 },
+	{ "feed_time_ns",		KSTAT_DATA_UINT64 },
+};
+
+/*
+ * Start the feed thread of a cache device and export its feed kstats.
+ * Nothing is fed when the pools are opened read-only.
+ */
+static void
+l2arc_feed_start(l2arc_dev_t *dev)
+{
+	char kstat_module[KSTAT_STRLEN], kstat_name[KSTAT_STRLEN];
+
+	mutex_init(&dev->l2ad_feed_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&dev->l2ad_feed_cv, NULL, CV_DEFAULT, NULL);
+	bcopy(&l2arc_dev_feed_stats_template, &dev->l2ad_feed_stats,
+	    sizeof (l2arc_dev_feed_stats_t));
+
+	if (!(spa_mode_global & FWRITE))
+		return;
+
+	(void) snprintf(kstat_module, sizeof (kstat_module), "zfs/%s",
+	    spa_name(dev->l2ad_spa));
+	(void) snprintf(kstat_name, sizeof (kstat_name), "l2arc-0x%llx",
+	    (u_longlong_t)dev->l2ad_vdev->vdev_guid);
+	dev->l2ad_feed_ksp = kstat_create(kstat_module, 0, kstat_name,
+	    "misc", KSTAT_TYPE_NAMED, sizeof (l2arc_dev_feed_stats_t) /
+	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
+	if (dev->l2ad_feed_ksp != NULL) {
+		dev->l2ad_feed_ksp->ks_data = &dev->l2ad_feed_stats;
+		kstat_install(dev->l2ad_feed_ksp);
+	}
+
+	dev->l2ad_feed_thread = thread_create(NULL, 0, l2arc_feed_thread,
+	    dev, 0, &p0, TS_RUN, defclsyspri);
+}
+
+/*
+ * Stop the feed thread of a cache device and wait for it to exit.
+ */
+static void
+l2arc_feed_stop(l2arc_dev_t *dev)
+{
+	mutex_enter(&dev->l2ad_feed_lock);
+	dev->l2ad_feed_exit = B_TRUE;
+	cv_broadcast(&dev->l2ad_feed_cv);
+	while (dev->l2ad_feed_thread != NULL)
+		cv_wait(&dev->l2ad_feed_cv, &dev->l2ad_feed_lock);
+	mutex_exit(&dev->l2ad_feed_lock);
+
+	if (dev->l2ad_feed_ksp != NULL) {
+		kstat_delete(dev->l2ad_feed_ksp);
+		dev->l2ad_feed_ksp = NULL;
+	}
+
+	mutex_destroy(&dev->l2ad_feed_lock);
+	cv_destroy(&dev->l2ad_feed_cv);
+}
+
 boolean_t
 l2arc_vdev_present(vdev_t *vd)
 {
@@ -9237,22 +9709,41 @@ void
 l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 {
 	l2arc_dev_t *adddev;
+	uint64_t l2dhdr_asize;
 
 	ASSERT(!l2arc_vdev_present(vd));
 
 	/*
-	 * Create a new l2arc device entry.
+	 * Create a new l2arc device entry.  The device header sits right
+	 * after the front labels and is excluded from the usable space.
 	 */
-	adddev = kmem_zalloc(sizeof (l2arc_dev_t), KM_SLEEP);
+	adddev = vmem_zalloc(sizeof (l2arc_dev_t), KM_SLEEP);
 	adddev->l2ad_spa = spa;
 	adddev->l2ad_vdev = vd;
-	adddev->l2ad_start = VDEV_LABEL_START_SIZE;
+	l2dhdr_asize = adddev->l2ad_dev_hdr_asize =
+	    MAX(sizeof (*adddev->l2ad_dev_hdr), 1ULL << vd->vdev_ashift);
+	adddev->l2ad_start = VDEV_LABEL_START_SIZE + l2dhdr_asize;
 	adddev->l2ad_end = VDEV_LABEL_START_SIZE + vdev_get_min_asize(vd);
 	adddev->l2ad_hand = adddev->l2ad_start;
+	adddev->l2ad_evict = adddev->l2ad_start;
 	adddev->l2ad_first = B_TRUE;
 	adddev->l2ad_writing = B_FALSE;
+	adddev->l2ad_dev_hdr = kmem_zalloc(l2dhdr_asize, KM_SLEEP);
 	list_link_init(&adddev->l2ad_node);
 
+	/*
+	 * Log blocks are only written to devices large enough to make
+	 * persistence worthwhile.  Each log block describes at most one
+	 * maximum sized block per SPA_MAXBLOCKSIZE of device space, so small
+	 * devices are not dominated by log block overhead.
+	 */
+	if (adddev->l2ad_end - adddev->l2ad_start >=
+	    l2arc_rebuild_blocks_min_l2size) {
+		adddev->l2ad_log_entries = MIN((adddev->l2ad_end -
+		    adddev->l2ad_start) >> SPA_MAXBLOCKSHIFT,
+		    L2ARC_LOG_BLK_MAX_ENTRIES);
+	}
+
 	mutex_init(&adddev->l2ad_mtx, NULL, MUTEX_DEFAULT, NULL);
 	/*
 	 * This is a list of all ARC buffers that are still valid on the
@@ -9261,8 +9752,24 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	list_create(&adddev->l2ad_buflist, sizeof (arc_buf_hdr_t),
 	    offsetof(arc_buf_hdr_t, b_l2hdr.b_l2node));
 
+	/*
+	 * This is a list of pointers to the log blocks that are still
+	 * present on the device, newest first.
+	 */
+	list_create(&adddev->l2ad_lbptr_list, sizeof (l2arc_lb_ptr_buf_t),
+	    offsetof(l2arc_lb_ptr_buf_t, node));
+
 	vdev_space_update(vd, 0, 0, adddev->l2ad_end - adddev->l2ad_hand);
 	zfs_refcount_create(&adddev->l2ad_alloc);
+	zfs_refcount_create(&adddev->l2ad_lb_asize);
+	zfs_refcount_create(&adddev->l2ad_lb_count);
+
+	/*
+	 * Decide whether the previous contents of the device can be
+	 * rebuilt.  The rebuild itself is deferred until the pool has
+	 * finished loading, see l2arc_spa_rebuild_start().
+	 */
+	l2arc_rebuild_vdev(adddev);
 
 	/*
 	 * Add device to global list
@@ -9271,6 +9778,8 @@ l2arc_add_vdev(spa_t *spa, vdev_t *vd)
 	list_insert_head(l2arc_dev_list, adddev);
 	atomic_inc_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
+
+	l2arc_feed_start(adddev);
 }
 
 /*
@@ -9298,30 +9807,49 @@ l2arc_remove_vdev(vdev_t *vd)
 	 * Remove device from global list
 	 */
 	list_remove(l2arc_dev_list, remdev);
-	l2arc_dev_last = NULL;		/* may have been invalidated */
 	atomic_dec_64(&l2arc_ndev);
 	mutex_exit(&l2arc_dev_mtx);
 
+	/*
+	 * Stop feeding the device before tearing it down.
+	 */
+	l2arc_feed_stop(remdev);
+
+	/*
+	 * Cancel any ongoing rebuild and wait for it to notice.
+	 */
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	if (remdev->l2ad_rebuild_began == B_TRUE) {
+		remdev->l2ad_rebuild_cancel = B_TRUE;
+		while (remdev->l2ad_rebuild == B_TRUE)
+			cv_wait(&l2arc_rebuild_thr_cv, &l2arc_rebuild_thr_lock);
+	}
+	mutex_exit(&l2arc_rebuild_thr_lock);
+
 	/*
 	 * Clear all buflists and ARC references.  L2ARC device flush.
 	 */
 	l2arc_evict(remdev, 0, B_TRUE);
 	list_destroy(&remdev->l2ad_buflist);
+	ASSERT(list_is_empty(&remdev->l2ad_lbptr_list));
+	list_destroy(&remdev->l2ad_lbptr_list);
 	mutex_destroy(&remdev->l2ad_mtx);
 	zfs_refcount_destroy(&remdev->l2ad_alloc);
-	kmem_free(remdev, sizeof (l2arc_dev_t));
+	zfs_refcount_destroy(&remdev->l2ad_lb_asize);
+	zfs_refcount_destroy(&remdev->l2ad_lb_count);
+	kmem_free(remdev->l2ad_dev_hdr, remdev->l2ad_dev_hdr_asize);
+	vmem_free(remdev, sizeof (l2arc_dev_t));
 }
 
 void
 l2arc_init(void)
 {
-	l2arc_thread_exit = 0;
 	l2arc_ndev = 0;
 	l2arc_writes_sent = 0;
 	l2arc_writes_done = 0;
 
-	mutex_init(&l2arc_feed_thr_lock, NULL, MUTEX_DEFAULT, NULL);
-	cv_init(&l2arc_feed_thr_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&l2arc_rebuild_thr_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&l2arc_rebuild_thr_cv, NULL, CV_DEFAULT, NULL);
 	mutex_init(&l2arc_dev_mtx, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&l2arc_free_on_write_mtx, NULL, MUTEX_DEFAULT, NULL);
 
@@ -9342,10 +9870,10 @@ l2arc_fini(void)
 	 * already been removed when the pools themselves were removed.
 	 */
 
-	l2arc_do_free_on_write();
+	l2arc_do_free_on_write(NULL);
 
-	mutex_destroy(&l2arc_feed_thr_lock);
-	cv_destroy(&l2arc_feed_thr_cv);
+	mutex_destroy(&l2arc_rebuild_thr_lock);
+	cv_destroy(&l2arc_rebuild_thr_cv);
 	mutex_destroy(&l2arc_dev_mtx);
 	mutex_destroy(&l2arc_free_on_write_mtx);
 
@@ -9353,28 +9881,647 @@ l2arc_fini(void)
 	list_destroy(l2arc_free_on_write);
 }
 
-void
-l2arc_start(void)
+/*
+ * Returns the l2arc_dev_t associated with a particular vdev_t or NULL if
+ * the vdev_t isn't an L2ARC device.
+ */
+static l2arc_dev_t *
+l2arc_vdev_get(vdev_t *vd)
 {
-	if (!(spa_mode_global & FWRITE))
+	l2arc_dev_t *dev;
+
+	mutex_enter(&l2arc_dev_mtx);
+	for (dev = list_head(l2arc_dev_list); dev != NULL;
+	    dev = list_next(l2arc_dev_list, dev)) {
+		if (dev->l2ad_vdev == vd)
+			break;
+	}
+	mutex_exit(&l2arc_dev_mtx);
+
+	return (dev);
+}
+
+/*
+ * Read the device header of a freshly added cache device and decide
+ * whether its contents can be rebuilt.  If not, a fresh header is written
+ * out (when the pool is writeable) so that stale log blocks from a
+ * previous life of the device are never trusted.
+ */
+static void
+l2arc_rebuild_vdev(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	spa_t *spa = dev->l2ad_spa;
+
+	if (dev->l2ad_log_entries > 0 && l2arc_dev_hdr_read(dev) == 0 &&
+	    l2arc_rebuild_enabled && l2dhdr->dh_start_lbp.lbp_daddr != 0) {
+		dev->l2ad_rebuild = B_TRUE;
 		return;
+	}
 
-	(void) thread_create(NULL, 0, l2arc_feed_thread, NULL, 0, &p0,
-	    TS_RUN, defclsyspri);
+	bzero(l2dhdr, dev->l2ad_dev_hdr_asize);
+	if (spa_writeable(spa))
+		l2arc_dev_hdr_update(dev);
 }
 
+/*
+ * Start rebuild threads for the cache devices of a pool which have a
+ * rebuild pending.  Called once the pool has been opened or imported.
+ */
 void
-l2arc_stop(void)
+l2arc_spa_rebuild_start(spa_t *spa)
 {
-	if (!(spa_mode_global & FWRITE))
+	for (int i = 0; i < spa->spa_l2cache.sav_count; i++) {
+		l2arc_dev_t *dev =
+		    l2arc_vdev_get(spa->spa_l2cache.sav_vdevs[i]);
+		if (dev == NULL) {
+			/* Don't attempt a rebuild if the vdev is UNAVAIL */
+			continue;
+		}
+
+		mutex_enter(&l2arc_rebuild_thr_lock);
+		if (dev->l2ad_rebuild && !dev->l2ad_rebuild_cancel &&
+		    !dev->l2ad_rebuild_began) {
+			dev->l2ad_rebuild_began = B_TRUE;
+			(void) thread_create(NULL, 0, l2arc_dev_rebuild_thread,
+			    dev, 0, &p0, TS_RUN, minclsyspri);
+		}
+		mutex_exit(&l2arc_rebuild_thr_lock);
+	}
+}
+
+/*
+ * Main entry point for L2ARC rebuilding.
+ */
+static void
+l2arc_dev_rebuild_thread(void *arg)
+{
+	l2arc_dev_t *dev = arg;
+
+	VERIFY(dev->l2ad_rebuild);
+	(void) l2arc_rebuild(dev);
+
+	mutex_enter(&l2arc_rebuild_thr_lock);
+	dev->l2ad_rebuild_began = B_FALSE;
+	dev->l2ad_rebuild = B_FALSE;
+	cv_broadcast(&l2arc_rebuild_thr_cv);
+	mutex_exit(&l2arc_rebuild_thr_lock);
+
+	thread_exit();
+}
+
+/*
+ * Walk the chain of log blocks of a device, newest to oldest, and restore
+ * an L2-only ARC header for every buffer they describe.  The walk stops at
+ * the first log block that is missing, damaged or already overwritten,
+ * when memory runs short, or when the device is being removed.
+ */
+static int
+l2arc_rebuild(l2arc_dev_t *dev)
+{
+	vdev_t *vd = dev->l2ad_vdev;
+	spa_t *spa = vd->vdev_spa;
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	l2arc_log_blk_phys_t *this_lb;
+	l2arc_log_blkptr_t lbp;
+	uint64_t walked = 0;
+	int err = 0;
+
+	/*
+	 * Restore the device state from the header.  Buffers written after
+	 * the newest log block are not described anywhere, so the write
+	 * hand resumes right after that log block.
+	 */
+	dev->l2ad_evict = MAX(l2dhdr->dh_evict, dev->l2ad_start);
+	dev->l2ad_hand = MAX(l2dhdr->dh_start_lbp.lbp_daddr +
+	    L2BLK_GET_PSIZE((&l2dhdr->dh_start_lbp)->lbp_prop),
+	    dev->l2ad_start);
+	dev->l2ad_first = !!(l2dhdr->dh_flags & L2ARC_DEV_HDR_EVICT_FIRST);
+
+	this_lb = vmem_zalloc(sizeof (*this_lb), KM_SLEEP);
+	lbp = l2dhdr->dh_start_lbp;
+
+	while (l2arc_log_blkptr_valid(dev, &lbp)) {
+		uint64_t asize = L2BLK_GET_PSIZE((&lbp)->lbp_prop);
+
+		/*
+		 * A chain longer than the device itself can only be the
+		 * result of damage; don't loop forever over it.
+		 */
+		walked += asize + lbp.lbp_payload_asize;
+		if (walked > dev->l2ad_end - dev->l2ad_start)
+			break;
+
+		/*
+		 * Avoid contributing to memory pressure.  The headers
+		 * restored so far remain usable.
+		 */
+		if (arc_reclaim_needed()) {
+			ARCSTAT_BUMP(arcstat_l2_rebuild_lowmem);
+			err = SET_ERROR(ENOMEM);
+			break;
+		}
+
+		/*
+		 * Hold the config lock to keep the vdev around while reading
+		 * from it.  l2arc_remove_vdev() may be waiting for us while
+		 * holding it as writer, so never block on it.
+		 */
+		boolean_t locked = B_FALSE;
+		while (!dev->l2ad_rebuild_cancel &&
+		    !(locked = spa_config_tryenter(spa, SCL_L2ARC, vd,
+		    RW_READER)))
+			delay(1);
+		if (dev->l2ad_rebuild_cancel) {
+			if (locked)
+				spa_config_exit(spa, SCL_L2ARC, vd);
+			err = SET_ERROR(ECANCELED);
+			break;
+		}
+
+		if (vdev_is_dead(vd)) {
+			err = SET_ERROR(ENXIO);
+		} else {
+			err = l2arc_log_blk_read(dev, &lbp, this_lb);
+		}
+		spa_config_exit(spa, SCL_L2ARC, vd);
+		if (err != 0)
+			break;
+
+		l2arc_log_blk_restore(dev, this_lb, &lbp);
+		lbp = this_lb->lb_prev_lbp;
+	}
+
+	if (err == 0)
+		ARCSTAT_BUMP(arcstat_l2_rebuild_success);
+
+	vmem_free(this_lb, sizeof (*this_lb));
+
+	return (err);
+}
+
+/*
+ * Read and validate the device header of an L2ARC device.  On success
+ * the in-core copy dev->l2ad_dev_hdr holds the on-disk header.
+ */
+static int
+l2arc_dev_hdr_read(l2arc_dev_t *dev)
+{
+	int err;
+	uint64_t guid;
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	const uint64_t l2dhdr_asize = dev->l2ad_dev_hdr_asize;
+	abd_t *abd;
+
+	guid = spa_guid(dev->l2ad_vdev->vdev_spa);
+
+	abd = abd_alloc_linear(l2dhdr_asize, B_TRUE);
+
+	err = zio_wait(zio_read_phys(NULL, dev->l2ad_vdev,
+	    VDEV_LABEL_START_SIZE, l2dhdr_asize, abd,
+	    ZIO_CHECKSUM_LABEL, NULL, NULL, ZIO_PRIORITY_SYNC_READ,
+	    ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY |
+	    ZIO_FLAG_SPECULATIVE, B_FALSE));
+
+	abd_copy_to_buf(l2dhdr, abd, l2dhdr_asize);
+	abd_free(abd);
+
+	if (err != 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_dh_errors);
+		zfs_dbgmsg("L2ARC IO error (%d) while reading device header, "
+		    "vdev guid: %llu", err,
+		    (u_longlong_t)dev->l2ad_vdev->vdev_guid);
+		return (err);
+	}
+
+	if (l2dhdr->dh_magic == BSWAP_64(L2ARC_DEV_HDR_MAGIC))
+		byteswap_uint64_array(l2dhdr, sizeof (*l2dhdr));
+
+	if (l2dhdr->dh_magic != L2ARC_DEV_HDR_MAGIC ||
+	    l2dhdr->dh_spa_guid != guid ||
+	    l2dhdr->dh_vdev_guid != dev->l2ad_vdev->vdev_guid ||
+	    l2dhdr->dh_version != L2ARC_PERSISTENT_VERSION ||
+	    l2dhdr->dh_log_entries != dev->l2ad_log_entries ||
+	    l2dhdr->dh_start != dev->l2ad_start ||
+	    l2dhdr->dh_end != dev->l2ad_end ||
+	    !l2arc_range_check_overlap(dev->l2ad_start, dev->l2ad_end,
+	    l2dhdr->dh_evict)) {
+		/*
+		 * Attempt to rebuild a device containing no actual dev hdr
+		 * or containing a header from some other pool or from another
+		 * version of persistent L2ARC.
+		 */
+		ARCSTAT_BUMP(arcstat_l2_rebuild_unsupported);
+		return (SET_ERROR(ENOTSUP));
+	}
+
+	return (0);
+}
+
+/*
+ * Read a log block, verify its checksum and decompress it into 'lb'.
+ */
+static int
+l2arc_log_blk_read(l2arc_dev_t *dev, const l2arc_log_blkptr_t *lbp,
+    l2arc_log_blk_phys_t *lb)
+{
+	uint64_t asize = L2BLK_GET_PSIZE((lbp)->lbp_prop);
+	zio_cksum_t cksum;
+	abd_t *abd;
+	int err;
+
+	abd = abd_alloc_linear(asize, B_TRUE);
+
+	err = zio_wait(zio_read_phys(NULL, dev->l2ad_vdev, lbp->lbp_daddr,
+	    asize, abd, ZIO_CHECKSUM_OFF, NULL, NULL, ZIO_PRIORITY_SYNC_READ,
+	    ZIO_FLAG_DONT_CACHE | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_DONT_RETRY, B_FALSE));
+	if (err != 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_io_errors);
+		goto out;
+	}
+
+	fletcher_4_native(abd_to_buf(abd), asize, NULL, &cksum);
+	if (!ZIO_CHECKSUM_EQUAL(cksum, lbp->lbp_cksum)) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_lb_errors);
+		zfs_dbgmsg("L2ARC log block cksum failed, offset: %llu, "
+		    "vdev guid: %llu", (u_longlong_t)lbp->lbp_daddr,
+		    (u_longlong_t)dev->l2ad_vdev->vdev_guid);
+		err = SET_ERROR(ECKSUM);
+		goto out;
+	}
+
+	switch (L2BLK_GET_COMPRESS((lbp)->lbp_prop)) {
+	case ZIO_COMPRESS_OFF:
+		abd_copy_to_buf(lb, abd, sizeof (*lb));
+		break;
+	case ZIO_COMPRESS_LZ4:
+		err = zio_decompress_data(ZIO_COMPRESS_LZ4, abd, lb, asize,
+		    sizeof (*lb), NULL);
+		break;
+	default:
+		err = SET_ERROR(EINVAL);
+		break;
+	}
+	if (err != 0) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_lb_errors);
+		goto out;
+	}
+
+	if (lb->lb_magic == BSWAP_64(L2ARC_LOG_BLK_MAGIC))
+		byteswap_uint64_array(lb, sizeof (*lb));
+	if (lb->lb_magic != L2ARC_LOG_BLK_MAGIC) {
+		ARCSTAT_BUMP(arcstat_l2_rebuild_cksum_lb_errors);
+		err = SET_ERROR(EINVAL);
+	}
+
+out:
+	abd_free(abd);
+	return (err);
+}
+
+/*
+ * Restore the buffers described by a log block, and account for the log
+ * block itself as present on the device.
+ */
+static void
+l2arc_log_blk_restore(l2arc_dev_t *dev, const l2arc_log_blk_phys_t *lb,
+    const l2arc_log_blkptr_t *lbp)
+{
+	uint64_t asize = L2BLK_GET_PSIZE((lbp)->lbp_prop);
+	l2arc_lb_ptr_buf_t *lb_ptr_buf;
+
+	/*
+	 * Entries are stored oldest first.  Walking them backwards and
+	 * appending to the buflist keeps it ordered newest to oldest, as
+	 * l2arc_evict() expects.
+	 */
+	for (int i = dev->l2ad_log_entries - 1; i >= 0; i--)
+		l2arc_hdr_restore(&lb->lb_entries[i], dev);
+
+	lb_ptr_buf = kmem_zalloc(sizeof (l2arc_lb_ptr_buf_t), KM_SLEEP);
+	lb_ptr_buf->lb_ptr = kmem_zalloc(sizeof (l2arc_log_blkptr_t),
+	    KM_SLEEP);
+	bcopy(lbp, lb_ptr_buf->lb_ptr, sizeof (l2arc_log_blkptr_t));
+
+	mutex_enter(&dev->l2ad_mtx);
+	list_insert_tail(&dev->l2ad_lbptr_list, lb_ptr_buf);
+	(void) zfs_refcount_add_many(&dev->l2ad_lb_asize, asize, lb_ptr_buf);
+	(void) zfs_refcount_add(&dev->l2ad_lb_count, lb_ptr_buf);
+	mutex_exit(&dev->l2ad_mtx);
+
+	ARCSTAT_INCR(arcstat_l2_log_blk_asize, asize);
+	ARCSTAT_BUMP(arcstat_l2_log_blk_count);
+	ARCSTAT_BUMP(arcstat_l2_rebuild_log_blks);
+	vdev_space_update(dev->l2ad_vdev, asize, 0, 0);
+}
+
+/*
+ * Create an L2-only ARC header for a log entry and insert it into the
+ * hash table and the device buflist, unless the ARC already knows about
+ * the block.
+ */
+static void
+l2arc_hdr_restore(const l2arc_log_ent_phys_t *le, l2arc_dev_t *dev)
+{
+	arc_buf_hdr_t *hdr, *exists;
+	kmutex_t *hash_lock;
+	arc_buf_contents_t type = L2BLK_GET_TYPE((le)->le_prop);
+	enum zio_compress compress = L2BLK_GET_COMPRESS((le)->le_prop);
+	uint64_t lsize = L2BLK_GET_LSIZE((le)->le_prop);
+	uint64_t psize = L2BLK_GET_PSIZE((le)->le_prop);
+	uint64_t asize = vdev_psize_to_asize(dev->l2ad_vdev, psize);
+
+	/*
+	 * The log block was checksummed, but don't let anything we can't
+	 * represent into the ARC.
+	 */
+	if ((type != ARC_BUFC_DATA && type != ARC_BUFC_METADATA) ||
+	    compress >= ZIO_COMPRESS_FUNCTIONS || psize > lsize ||
+	    lsize > SPA_MAXBLOCKSIZE || DVA_IS_EMPTY(&le->le_dva) ||
+	    le->le_birth == 0 || le->le_daddr < dev->l2ad_start ||
+	    le->le_daddr + asize > dev->l2ad_end)
 		return;
 
-	mutex_enter(&l2arc_feed_thr_lock);
-	cv_signal(&l2arc_feed_thr_cv);	/* kick thread out of startup */
-	l2arc_thread_exit = 1;
-	while (l2arc_thread_exit != 0)
-		cv_wait(&l2arc_feed_thr_cv, &l2arc_feed_thr_lock);
-	mutex_exit(&l2arc_feed_thr_lock);
+	hdr = kmem_cache_alloc(hdr_l2only_cache, KM_SLEEP);
+	bzero(hdr, HDR_L2ONLY_SIZE);
+
+	HDR_SET_PSIZE(hdr, psize);
+	HDR_SET_LSIZE(hdr, lsize);
+	hdr->b_type = type;
+	arc_hdr_set_flags(hdr, arc_bufc_to_flags(type) | ARC_FLAG_HAS_L2HDR);
+	if (L2BLK_GET_PROTECTED((le)->le_prop))
+		arc_hdr_set_flags(hdr, ARC_FLAG_PROTECTED);
+	arc_hdr_set_compress(hdr, compress);
+
+	hdr->b_l2hdr.b_dev = dev;
+	hdr->b_l2hdr.b_daddr = le->le_daddr;
+
+	hdr->b_spa = spa_load_guid(dev->l2ad_spa);
+	hdr->b_birth = le->le_birth;
+	hdr->b_complevel = (uint8_t)le->le_complevel;
+	hdr->b_dva = le->le_dva;
+
+	exists = buf_hash_insert(hdr, &hash_lock);
+	if (exists != NULL) {
+		/* Buffer was already cached, no need to restore it. */
+		mutex_exit(hash_lock);
+		kmem_cache_free(hdr_l2only_cache, hdr);
+		ARCSTAT_BUMP(arcstat_l2_rebuild_bufs_precached);
+		return;
+	}
+
+	mutex_enter(&dev->l2ad_mtx);
+	list_insert_tail(&dev->l2ad_buflist, hdr);
+	(void) zfs_refcount_add_many(&dev->l2ad_alloc, arc_hdr_size(hdr), hdr);
+	mutex_exit(&dev->l2ad_mtx);
+
+	vdev_space_update(dev->l2ad_vdev, asize, 0, 0);
+	ARCSTAT_INCR(arcstat_l2_lsize, lsize);
+	ARCSTAT_INCR(arcstat_l2_psize, psize);
+	ARCSTAT_INCR(arcstat_l2_rebuild_size, lsize);
+	ARCSTAT_INCR(arcstat_l2_rebuild_asize, asize);
+	ARCSTAT_BUMP(arcstat_l2_rebuild_bufs);
+
+	mutex_exit(hash_lock);
+}
+
+/*
+ * Write the in-core device header out to the device.  Failures are not
+ * fatal: at worst the next rebuild of this device is cut short.
+ */
+static void
+l2arc_dev_hdr_update(l2arc_dev_t *dev)
+{
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	const uint64_t l2dhdr_asize = dev->l2ad_dev_hdr_asize;
+	abd_t *abd;
+	int err;
+
+	l2dhdr->dh_magic = L2ARC_DEV_HDR_MAGIC;
+	l2dhdr->dh_version = L2ARC_PERSISTENT_VERSION;
+	l2dhdr->dh_spa_guid = spa_guid(dev->l2ad_vdev->vdev_spa);
+	l2dhdr->dh_vdev_guid = dev->l2ad_vdev->vdev_guid;
+	l2dhdr->dh_log_entries = dev->l2ad_log_entries;
+	l2dhdr->dh_evict = dev->l2ad_evict;
+	l2dhdr->dh_start = dev->l2ad_start;
+	l2dhdr->dh_end = dev->l2ad_end;
+	l2dhdr->dh_flags = 0;
+	if (dev->l2ad_first)
+		l2dhdr->dh_flags |= L2ARC_DEV_HDR_EVICT_FIRST;
+
+	abd = abd_get_from_buf(l2dhdr, l2dhdr_asize);
+
+	err = zio_wait(zio_write_phys(NULL, dev->l2ad_vdev,
+	    VDEV_LABEL_START_SIZE, l2dhdr_asize, abd, ZIO_CHECKSUM_LABEL, NULL,
+	    NULL, ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE));
+
+	abd_put(abd);
+
+	if (err != 0) {
+		zfs_dbgmsg("L2ARC IO error (%d) while writing device header, "
+		    "vdev guid: %llu", err,
+		    (u_longlong_t)dev->l2ad_vdev->vdev_guid);
+	}
+}
+
+/*
+ * Compress the log block under construction and issue its write as a
+ * child of 'pio' at the current write hand.  The log block is linked in
+ * front of the chain in the in-core device header, which is persisted by
+ * l2arc_write_buffers() once the write has completed.  Returns the
+ * aligned size of the log block on the device.
+ */
+static uint64_t
+l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio, l2arc_write_callback_t *cb)
+{
+	l2arc_log_blk_phys_t *lb = &dev->l2ad_log_blk;
+	l2arc_dev_hdr_phys_t *l2dhdr = dev->l2ad_dev_hdr;
+	l2arc_log_blkptr_t *lbp;
+	l2arc_lb_abd_buf_t *abd_buf;
+	l2arc_lb_ptr_buf_t *lb_ptr_buf;
+	enum zio_compress compress = ZIO_COMPRESS_LZ4;
+	uint64_t psize, asize;
+	abd_t *lb_abd;
+	uint8_t *tmpbuf;
+	zio_t *wzio;
+
+	VERIFY3S(dev->l2ad_log_ent_idx, ==, dev->l2ad_log_entries);
+
+	/* link the buffer into the block chain */
+	lb->lb_prev_lbp = l2dhdr->dh_start_lbp;
+	lb->lb_magic = L2ARC_LOG_BLK_MAGIC;
+
+	/* try to compress the buffer */
+	tmpbuf = zio_buf_alloc(sizeof (*lb));
+	lb_abd = abd_get_from_buf(lb, sizeof (*lb));
+	psize = zio_compress_data(compress, lb_abd, tmpbuf, sizeof (*lb), 0);
+	abd_put(lb_abd);
+	if (psize == 0 || psize >= sizeof (*lb)) {
+		compress = ZIO_COMPRESS_OFF;
+		psize = sizeof (*lb);
+		bcopy(lb, tmpbuf, psize);
+	}
+
+	/*
+	 * The log block is padded to the device sector size; the padding
+	 * is zeroed so that the checksum covers well defined contents.
+	 */
+	asize = vdev_psize_to_asize(dev->l2ad_vdev, psize);
+	ASSERT3U(asize, <=, sizeof (*lb));
+	bzero(tmpbuf + psize, asize - psize);
+
+	abd_buf = kmem_zalloc(sizeof (l2arc_lb_abd_buf_t), KM_SLEEP);
+	abd_buf->abd = abd_alloc_for_io(asize, B_TRUE);
+	abd_copy_from_buf(abd_buf->abd, tmpbuf, asize);
+	list_insert_tail(&cb->l2wcb_abd_list, abd_buf);
+
+	lbp = &l2dhdr->dh_start_lbp;
+	bzero(lbp, sizeof (*lbp));
+	lbp->lbp_daddr = dev->l2ad_hand;
+	lbp->lbp_payload_asize = dev->l2ad_log_blk_payload_asize;
+	lbp->lbp_payload_start = dev->l2ad_log_blk_payload_start;
+	L2BLK_SET_LSIZE((lbp)->lbp_prop, sizeof (*lb));
+	L2BLK_SET_PSIZE((lbp)->lbp_prop, asize);
+	L2BLK_SET_CHECKSUM((lbp)->lbp_prop, ZIO_CHECKSUM_FLETCHER_4);
+	L2BLK_SET_COMPRESS((lbp)->lbp_prop, compress);
+	fletcher_4_native(tmpbuf, asize, NULL, &lbp->lbp_cksum);
+
+	zio_buf_free(tmpbuf, sizeof (*lb));
+
+	wzio = zio_write_phys(pio, dev->l2ad_vdev, dev->l2ad_hand, asize,
+	    abd_buf->abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE);
+	DTRACE_PROBE2(l2arc__write, vdev_t *, dev->l2ad_vdev, zio_t *, wzio);
+	(void) zio_nowait(wzio);
+
+	/* remember the log block so l2arc_evict() can retire it */
+	lb_ptr_buf = kmem_zalloc(sizeof (l2arc_lb_ptr_buf_t), KM_SLEEP);
+	lb_ptr_buf->lb_ptr = kmem_zalloc(sizeof (l2arc_log_blkptr_t),
+	    KM_SLEEP);
+	bcopy(lbp, lb_ptr_buf->lb_ptr, sizeof (l2arc_log_blkptr_t));
+	mutex_enter(&dev->l2ad_mtx);
+	list_insert_head(&dev->l2ad_lbptr_list, lb_ptr_buf);
+	(void) zfs_refcount_add_many(&dev->l2ad_lb_asize, asize, lb_ptr_buf);
+	(void) zfs_refcount_add(&dev->l2ad_lb_count, lb_ptr_buf);
+	mutex_exit(&dev->l2ad_mtx);
+
+	ARCSTAT_BUMP(arcstat_l2_log_blk_writes);
+	ARCSTAT_INCR(arcstat_l2_log_blk_asize, asize);
+	ARCSTAT_BUMP(arcstat_l2_log_blk_count);
+	vdev_space_update(dev->l2ad_vdev, asize, 0, 0);
+
+	dev->l2ad_hand += asize;
+
+	/* start a new log block */
+	dev->l2ad_log_ent_idx = 0;
+	dev->l2ad_log_blk_payload_asize = 0;
+	dev->l2ad_log_blk_payload_start = 0;
+
+	return (asize);
+}
+
+/*
+ * Release a log block pointer, which must be on the device's list, and
+ * undo its space accounting.  Called with l2ad_mtx held.
+ */
+static void
+l2arc_lbptr_free(l2arc_dev_t *dev, l2arc_lb_ptr_buf_t *lb_ptr_buf)
+{
+	uint64_t asize = L2BLK_GET_PSIZE((lb_ptr_buf->lb_ptr)->lbp_prop);
+
+	ASSERT(MUTEX_HELD(&dev->l2ad_mtx));
+
+	list_remove(&dev->l2ad_lbptr_list, lb_ptr_buf);
+	(void) zfs_refcount_remove_many(&dev->l2ad_lb_asize, asize,
+	    lb_ptr_buf);
+	(void) zfs_refcount_remove(&dev->l2ad_lb_count, lb_ptr_buf);
+
+	ARCSTAT_INCR(arcstat_l2_log_blk_asize, -asize);
+	ARCSTAT_BUMPDOWN(arcstat_l2_log_blk_count);
+	vdev_space_update(dev->l2ad_vdev, -asize, 0, 0);
+
+	kmem_free(lb_ptr_buf->lb_ptr, sizeof (l2arc_log_blkptr_t));
+	kmem_free(lb_ptr_buf, sizeof (l2arc_lb_ptr_buf_t));
+}
+
+/*
+ * Checks whether 'check' lies within the circular range [bottom, top] of
+ * the device ring.
+ */
+static boolean_t
+l2arc_range_check_overlap(uint64_t bottom, uint64_t top, uint64_t check)
+{
+	if (bottom < top)
+		return (bottom <= check && check <= top);
+	else if (bottom > top)
+		return (check <= top || bottom <= check);
+	else
+		return (check == top);
+}
+
+/*
+ * Validates a log block pointer: the log block and the buffers it
+ * describes must lie on the device and must not have been overwritten,
+ * i.e. they must not overlap the region between the write hand and the
+ * evicted offset, unless the device hasn't been filled up yet.
+ */
+static boolean_t
+l2arc_log_blkptr_valid(l2arc_dev_t *dev, const l2arc_log_blkptr_t *lbp)
+{
+	uint64_t asize = L2BLK_GET_PSIZE((lbp)->lbp_prop);
+	uint64_t end = lbp->lbp_daddr + asize - 1;
+	uint64_t start = lbp->lbp_payload_start;
+	boolean_t evicted = B_FALSE;
+
+	if (lbp->lbp_daddr == 0 || asize == 0)
+		return (B_FALSE);
+
+	evicted =
+	    l2arc_range_check_overlap(start, end, dev->l2ad_hand) ||
+	    l2arc_range_check_overlap(start, end, dev->l2ad_evict) ||
+	    l2arc_range_check_overlap(dev->l2ad_hand, dev->l2ad_evict, start) ||
+	    l2arc_range_check_overlap(dev->l2ad_hand, dev->l2ad_evict, end);
+
+	return (start >= dev->l2ad_start && end < dev->l2ad_end &&
+	    lbp->lbp_daddr >= dev->l2ad_start &&
+	    asize <= sizeof (l2arc_log_blk_phys_t) &&
+	    (!evicted || dev->l2ad_first));
+}
+
+/*
+ * Add a buffer to the log block under construction.  Returns B_TRUE when
+ * the log block is full and should be committed.
+ */
+static boolean_t
+l2arc_log_blk_insert(l2arc_dev_t *dev, const arc_buf_hdr_t *hdr)
+{
+	l2arc_log_blk_phys_t *lb = &dev->l2ad_log_blk;
+	l2arc_log_ent_phys_t *le;
+	int index = dev->l2ad_log_ent_idx++;
+
+	ASSERT(HDR_HAS_L2HDR(hdr));
+	ASSERT3S(index, <, dev->l2ad_log_entries);
+
+	le = &lb->lb_entries[index];
+	bzero(le, sizeof (*le));
+	le->le_dva = hdr->b_dva;
+	le->le_birth = hdr->b_birth;
+	le->le_daddr = hdr->b_l2hdr.b_daddr;
+	if (index == 0)
+		dev->l2ad_log_blk_payload_start = le->le_daddr;
+	L2BLK_SET_LSIZE((le)->le_prop, HDR_GET_LSIZE(hdr));
+	L2BLK_SET_PSIZE((le)->le_prop, HDR_GET_PSIZE(hdr));
+	L2BLK_SET_COMPRESS((le)->le_prop, HDR_GET_COMPRESS(hdr));
+	L2BLK_SET_TYPE((le)->le_prop, hdr->b_type);
+	L2BLK_SET_PROTECTED((le)->le_prop, !!(HDR_PROTECTED(hdr)));
+	le->le_complevel = hdr->b_complevel;
+
+	dev->l2ad_log_blk_payload_asize += vdev_psize_to_asize(dev->l2ad_vdev,
+	    HDR_GET_PSIZE(hdr));
+
+	return (L2ARC_LOG_BLK_FULL(dev));
 }
 
 EXPORT_SYMBOL(arc_buf_size);
@@ -9464,6 +10611,12 @@ ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, feed_again, INT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, norw, INT, ZMOD_RW,
 	"No reads during writes");
 
+ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, rebuild_enabled, INT, ZMOD_RW,
+	"Rebuild the L2ARC when importing a pool");
+
+ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, rebuild_blocks_min_l2size, ULONG, ZMOD_RW,
+	"Min size in bytes to write rebuild log blocks in L2ARC");
+
 ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, lotsfree_percent, INT, ZMOD_RW,
 	"System free memory I/O throttle in bytes");
 
@@ -0,0 +1,820 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/zio.h>
+#include <sys/brt.h>
+#include <sys/zap.h>
+#include <sys/dmu_tx.h>
+#include <sys/dsl_pool.h>
+#include <sys/vdev_impl.h>
+#include <sys/zfeature.h>
+
+/*
+ * Block Reference Table.
+ *
+ * Cloning a range of a file (copy_file_range(2), FICLONE) copies the
+ * source block pointers into the destination instead of the data, so a
+ * single allocated block may be referenced from several places.  The
+ * BRT counts these additional references, so that the block is only
+ * freed once the last of them is gone.
+ *
+ * Unlike the DDT, no checksum is needed to find the entry of a block:
+ * the vdev and offset of its first DVA identify it uniquely.  There is
+ * one table per top-level vdev, stored in the MOS as a ZAP object which
+ * maps the DVA offset to the number of references beyond the original
+ * one.  A block without an entry has exactly one reference and is freed
+ * as usual.
+ *
+ * Consulting the ZAP for every block which is freed would be expensive,
+ * so each vdev also keeps an array counting the entries in each region
+ * of bv_rangesize bytes.  Only frees of blocks in a region with entries
+ * have to look in the ZAP.  The array is kept in memory and written
+ * to its own object whenever it changes.
+ *
+ * Clones are collected per txg in open context by brt_pending_add().
+ * If the dirty record of the cloned block is undone in the same txg,
+ * brt_pending_remove() drops it again.  The remaining clones are added
+ * to the tables by brt_pending_apply() at the start of spa_sync(),
+ * before any of the frees of the txg are processed.  Frees of blocks
+ * which may be cloned call brt_entry_decref() from zio_free_sync().
+ */
+
+static kmem_cache_t *brt_entry_cache;
+static kmem_cache_t *brt_pending_entry_cache;
+
+#define	BRT_BLOCKSIZE		(32 * 1024)
+
+/*
+ * The entry count array grows in steps of one of its blocks.
+ */
+#define	BRT_ENTCOUNT_CHUNK	(BRT_BLOCKSIZE / sizeof (uint16_t))
+
+static int
+brt_entry_compare(const void *x1, const void *x2)
+{
+	const brt_entry_t *bre1 = x1;
+	const brt_entry_t *bre2 = x2;
+
+	return (AVL_CMP(bre1->bre_offset, bre2->bre_offset));
+}
+
+static int
+brt_pending_entry_compare(const void *x1, const void *x2)
+{
+	const blkptr_t *bp1 = &((const brt_pending_entry_t *)x1)->bpe_bp;
+	const blkptr_t *bp2 = &((const brt_pending_entry_t *)x2)->bpe_bp;
+	int cmp;
+
+	cmp = AVL_CMP(DVA_GET_VDEV(&bp1->blk_dva[0]),
+	    DVA_GET_VDEV(&bp2->blk_dva[0]));
+	if (cmp == 0) {
+		cmp = AVL_CMP(DVA_GET_OFFSET(&bp1->blk_dva[0]),
+		    DVA_GET_OFFSET(&bp2->blk_dva[0]));
+	}
+
+	return (cmp);
+}
+
+static void
+brt_vdev_entcount_name(uint64_t vdevid, char *name, size_t len)
+{
+	(void) snprintf(name, len, "%s%llu", BRT_OBJECT_VDEV_PREFIX,
+	    (u_longlong_t)vdevid);
+}
+
+static brt_vdev_t *
+brt_vdev_alloc(uint64_t vdevid)
+{
+	brt_vdev_t *bv;
+
+	bv = kmem_zalloc(sizeof (brt_vdev_t), KM_SLEEP);
+	bv->bv_vdevid = vdevid;
+	bv->bv_rangesize = BRT_RANGESIZE;
+	avl_create(&bv->bv_tree, brt_entry_compare, sizeof (brt_entry_t),
+	    offsetof(brt_entry_t, bre_node));
+
+	return (bv);
+}
+
+static void
+brt_vdev_free(brt_vdev_t *bv)
+{
+	brt_entry_t *bre;
+	void *cookie = NULL;
+
+	while ((bre = avl_destroy_nodes(&bv->bv_tree, &cookie)) != NULL)
+		kmem_cache_free(brt_entry_cache, bre);
+	avl_destroy(&bv->bv_tree);
+
+	if (bv->bv_entcount != NULL)
+		kmem_free(bv->bv_entcount, bv->bv_size * sizeof (uint16_t));
+	kmem_free(bv, sizeof (brt_vdev_t));
+}
+
+static void
+brt_vdevs_expand(brt_t *brt, uint64_t nvdevs)
+{
+	brt_vdev_t **vdevs;
+
+	ASSERT(RW_WRITE_HELD(&brt->brt_lock));
+
+	if (nvdevs <= brt->brt_nvdevs)
+		return;
+
+	vdevs = kmem_zalloc(nvdevs * sizeof (brt_vdev_t *), KM_SLEEP);
+	if (brt->brt_nvdevs > 0) {
+		bcopy(brt->brt_vdevs, vdevs,
+		    brt->brt_nvdevs * sizeof (brt_vdev_t *));
+		kmem_free(brt->brt_vdevs,
+		    brt->brt_nvdevs * sizeof (brt_vdev_t *));
+	}
+	brt->brt_vdevs = vdevs;
+	brt->brt_nvdevs = nvdevs;
+}
+
+/*
+ * Return the table of the given top-level vdev, optionally creating its
+ * in-core state.
+ */
+static brt_vdev_t *
+brt_vdev(brt_t *brt, uint64_t vdevid, boolean_t alloc)
+{
+	ASSERT(RW_LOCK_HELD(&brt->brt_lock));
+
+	if (vdevid >= brt->brt_nvdevs) {
+		if (!alloc)
+			return (NULL);
+		brt_vdevs_expand(brt, vdevid + 1);
+	}
+
+	if (brt->brt_vdevs[vdevid] == NULL && alloc) {
+		ASSERT(RW_WRITE_HELD(&brt->brt_lock));
+		brt->brt_vdevs[vdevid] = brt_vdev_alloc(vdevid);
+	}
+
+	return (brt->brt_vdevs[vdevid]);
+}
+
+static void
+brt_vdev_entcount_grow(brt_vdev_t *bv, uint64_t idx)
+{
+	uint64_t size = P2ROUNDUP(idx + 1, BRT_ENTCOUNT_CHUNK);
+	uint16_t *entcount;
+
+	ASSERT3U(size, >, bv->bv_size);
+
+	entcount = kmem_zalloc(size * sizeof (uint16_t), KM_SLEEP);
+	if (bv->bv_entcount != NULL) {
+		bcopy(bv->bv_entcount, entcount,
+		    bv->bv_size * sizeof (uint16_t));
+		kmem_free(bv->bv_entcount, bv->bv_size * sizeof (uint16_t));
+	}
+	bv->bv_entcount = entcount;
+	bv->bv_size = size;
+	bv->bv_meta_dirty = B_TRUE;
+}
+
+static void
+brt_vdev_entcount_inc(brt_vdev_t *bv, uint64_t offset)
+{
+	uint64_t idx = offset / bv->bv_rangesize;
+
+	if (idx >= bv->bv_size)
+		brt_vdev_entcount_grow(bv, idx);
+
+	/* A saturated count stays saturated; the region is always checked. */
+	if (bv->bv_entcount[idx] < UINT16_MAX)
+		bv->bv_entcount[idx]++;
+	bv->bv_entcount_dirty = B_TRUE;
+}
+
+static void
+brt_vdev_entcount_dec(brt_vdev_t *bv, uint64_t offset)
+{
+	uint64_t idx = offset / bv->bv_rangesize;
+
+	ASSERT3U(idx, <, bv->bv_size);
+	ASSERT3U(bv->bv_entcount[idx], >, 0);
+
+	if (bv->bv_entcount[idx] < UINT16_MAX)
+		bv->bv_entcount[idx]--;
+	bv->bv_entcount_dirty = B_TRUE;
+}
+
+static int
+brt_vdev_load(brt_t *brt, brt_vdev_t *bv)
+{
+	objset_t *mos = brt->brt_spa->spa_meta_objset;
+	brt_vdev_phys_t *bvphys;
+	dmu_buf_t *db;
+	char name[64];
+	int error;
+
+	brt_vdev_entcount_name(bv->bv_vdevid, name, sizeof (name));
+	error = zap_lookup(mos, DMU_POOL_DIRECTORY_OBJECT, name,
+	    sizeof (uint64_t), 1, &bv->bv_mos_brtvdev);
+	if (error != 0)
+		return (error);
+
+	error = dmu_bonus_hold(mos, bv->bv_mos_brtvdev, FTAG, &db);
+	if (error != 0)
+		return (error);
+
+	bvphys = db->db_data;
+	bv->bv_mos_entries = bvphys->bvp_mos_entries;
+	bv->bv_rangesize = bvphys->bvp_rangesize;
+	bv->bv_totalcount = bvphys->bvp_totalcount;
+	bv->bv_usedspace = bvphys->bvp_usedspace;
+	bv->bv_savedspace = bvphys->bvp_savedspace;
+	bv->bv_size = bvphys->bvp_size;
+	boolean_t byteswap = (bvphys->bvp_byteorder != ZFS_HOST_BYTEORDER);
+	dmu_buf_rele(db, FTAG);
+
+	if (bv->bv_size == 0)
+		return (0);
+
+	bv->bv_entcount = kmem_alloc(bv->bv_size * sizeof (uint16_t),
+	    KM_SLEEP);
+	error = dmu_read(mos, bv->bv_mos_brtvdev, 0,
+	    bv->bv_size * sizeof (uint16_t), bv->bv_entcount,
+	    DMU_READ_PREFETCH);
+	if (error != 0)
+		return (error);
+
+	if (byteswap) {
+		for (uint64_t i = 0; i < bv->bv_size; i++)
+			bv->bv_entcount[i] = BSWAP_16(bv->bv_entcount[i]);
+	}
+
+	return (0);
+}
+
+static void
+brt_vdev_create(brt_t *brt, brt_vdev_t *bv, dmu_tx_t *tx)
+{
+	spa_t *spa = brt->brt_spa;
+	objset_t *mos = spa->spa_meta_objset;
+	char name[64];
+
+	ASSERT0(bv->bv_mos_brtvdev);
+	ASSERT0(bv->bv_mos_entries);
+
+	bv->bv_mos_entries = zap_create_flags(mos, 0,
+	    ZAP_FLAG_HASH64 | ZAP_FLAG_UINT64_KEY, DMU_OTN_ZAP_METADATA,
+	    12, 12, DMU_OT_NONE, 0, tx);
+	bv->bv_mos_brtvdev = dmu_object_alloc(mos, DMU_OTN_UINT8_METADATA,
+	    BRT_BLOCKSIZE, DMU_OTN_UINT64_METADATA, sizeof (brt_vdev_phys_t),
+	    tx);
+
+	brt_vdev_entcount_name(bv->bv_vdevid, name, sizeof (name));
+	VERIFY0(zap_add(mos, DMU_POOL_DIRECTORY_OBJECT, name,
+	    sizeof (uint64_t), 1, &bv->bv_mos_brtvdev, tx));
+
+	spa_feature_incr(spa, SPA_FEATURE_BLOCK_CLONING, tx);
+
+	bv->bv_meta_dirty = B_TRUE;
+	bv->bv_entcount_dirty = B_TRUE;
+}
+
+static void
+brt_vdev_destroy(brt_t *brt, brt_vdev_t *bv, dmu_tx_t *tx)
+{
+	spa_t *spa = brt->brt_spa;
+	objset_t *mos = spa->spa_meta_objset;
+	char name[64];
+
+	ASSERT0(bv->bv_totalcount);
+	ASSERT0(bv->bv_usedspace);
+	ASSERT0(bv->bv_savedspace);
+
+	VERIFY0(zap_destroy(mos, bv->bv_mos_entries, tx));
+	VERIFY0(dmu_object_free(mos, bv->bv_mos_brtvdev, tx));
+
+	brt_vdev_entcount_name(bv->bv_vdevid, name, sizeof (name));
+	VERIFY0(zap_remove(mos, DMU_POOL_DIRECTORY_OBJECT, name, tx));
+
+	spa_feature_decr(spa, SPA_FEATURE_BLOCK_CLONING, tx);
+
+	bv->bv_mos_entries = 0;
+	bv->bv_mos_brtvdev = 0;
+
+	/* Saturated counts can be reset now that the table is empty. */
+	if (bv->bv_entcount != NULL)
+		bzero(bv->bv_entcount, bv->bv_size * sizeof (uint16_t));
+	bv->bv_meta_dirty = B_FALSE;
+	bv->bv_entcount_dirty = B_FALSE;
+}
+
+static void
+brt_vdev_sync(brt_t *brt, brt_vdev_t *bv, dmu_tx_t *tx)
+{
+	objset_t *mos = brt->brt_spa->spa_meta_objset;
+	brt_entry_t *bre;
+	void *cookie = NULL;
+
+	if (bv->bv_mos_brtvdev == 0 && bv->bv_totalcount > 0)
+		brt_vdev_create(brt, bv, tx);
+
+	while ((bre = avl_destroy_nodes(&bv->bv_tree, &cookie)) != NULL) {
+		if (bv->bv_mos_entries != 0 && bv->bv_totalcount > 0) {
+			if (bre->bre_refcount == 0) {
+				int error = zap_remove_uint64(mos,
+				    bv->bv_mos_entries, &bre->bre_offset, 1,
+				    tx);
+				VERIFY(error == 0 || error == ENOENT);
+			} else {
+				VERIFY0(zap_update_uint64(mos,
+				    bv->bv_mos_entries, &bre->bre_offset, 1,
+				    sizeof (uint64_t), 1, &bre->bre_refcount,
+				    tx));
+			}
+		}
+		kmem_cache_free(brt_entry_cache, bre);
+	}
+
+	if (bv->bv_mos_brtvdev == 0)
+		return;
+
+	if (bv->bv_totalcount == 0) {
+		brt_vdev_destroy(brt, bv, tx);
+		return;
+	}
+
+	if (bv->bv_entcount_dirty) {
+		dmu_write(mos, bv->bv_mos_brtvdev, 0,
+		    bv->bv_size * sizeof (uint16_t), bv->bv_entcount, tx);
+		bv->bv_entcount_dirty = B_FALSE;
+	}
+
+	if (bv->bv_meta_dirty) {
+		brt_vdev_phys_t *bvphys;
+		dmu_buf_t *db;
+
+		VERIFY0(dmu_bonus_hold(mos, bv->bv_mos_brtvdev, FTAG, &db));
+		dmu_buf_will_dirty(db, tx);
+		bvphys = db->db_data;
+		bvphys->bvp_mos_entries = bv->bv_mos_entries;
+		bvphys->bvp_size = bv->bv_size;
+		bvphys->bvp_byteorder = ZFS_HOST_BYTEORDER;
+		bvphys->bvp_totalcount = bv->bv_totalcount;
+		bvphys->bvp_rangesize = bv->bv_rangesize;
+		bvphys->bvp_usedspace = bv->bv_usedspace;
+		bvphys->bvp_savedspace = bv->bv_savedspace;
+		dmu_buf_rele(db, FTAG);
+		bv->bv_meta_dirty = B_FALSE;
+	}
+}
+
+/*
+ * Find the entry of the block at the given offset, reading it from the
+ * ZAP if it was not changed in this txg yet.  Entries read from the ZAP
+ * and entries created with "add" are kept in bv_tree until brt_sync()
+ * writes them out.
+ */
+static brt_entry_t *
+brt_entry_lookup(brt_t *brt, brt_vdev_t *bv, uint64_t offset, boolean_t add)
+{
+	objset_t *mos = brt->brt_spa->spa_meta_objset;
+	brt_entry_t *bre, bre_search;
+	avl_index_t where;
+	uint64_t refcount = 0;
+
+	ASSERT(RW_WRITE_HELD(&brt->brt_lock));
+
+	bre_search.bre_offset = offset;
+	bre = avl_find(&bv->bv_tree, &bre_search, &where);
+	if (bre != NULL)
+		return (bre);
+
+	if (bv->bv_mos_entries != 0) {
+		int error = zap_lookup_uint64(mos, bv->bv_mos_entries, &offset,
+		    1, sizeof (uint64_t), 1, &refcount);
+		if (error != 0 && error != ENOENT)
+			return (NULL);
+	}
+
+	if (refcount == 0 && !add)
+		return (NULL);
+
+	bre = kmem_cache_alloc(brt_entry_cache, KM_SLEEP);
+	bre->bre_offset = offset;
+	bre->bre_refcount = refcount;
+	avl_insert(&bv->bv_tree, bre, where);
+
+	return (bre);
+}
+
+static void
+brt_entry_addref(brt_t *brt, const blkptr_t *bp, int count)
+{
+	uint64_t vdevid = DVA_GET_VDEV(&bp->blk_dva[0]);
+	uint64_t offset = DVA_GET_OFFSET(&bp->blk_dva[0]);
+	uint64_t dsize = bp_get_dsize_sync(brt->brt_spa, bp);
+	brt_vdev_t *bv;
+	brt_entry_t *bre;
+
+	ASSERT(RW_WRITE_HELD(&brt->brt_lock));
+
+	bv = brt_vdev(brt, vdevid, B_TRUE);
+	bre = brt_entry_lookup(brt, bv, offset, B_TRUE);
+	VERIFY3P(bre, !=, NULL);
+
+	if (bre->bre_refcount == 0) {
+		brt_vdev_entcount_inc(bv, offset);
+		bv->bv_totalcount++;
+		bv->bv_usedspace += dsize;
+	}
+	bre->bre_refcount += count;
+	bv->bv_savedspace += dsize * count;
+	bv->bv_meta_dirty = B_TRUE;
+}
+
+/*
+ * Called for every free of a block that brt_maybe_exists().  Returns
+ * B_TRUE if this was the last reference and the block must really be
+ * freed.
+ */
+boolean_t
+brt_entry_decref(spa_t *spa, const blkptr_t *bp)
+{
+	brt_t *brt = spa->spa_brt;
+	uint64_t vdevid = DVA_GET_VDEV(&bp->blk_dva[0]);
+	uint64_t offset = DVA_GET_OFFSET(&bp->blk_dva[0]);
+	brt_vdev_t *bv;
+	brt_entry_t *bre;
+
+	rw_enter(&brt->brt_lock, RW_WRITER);
+
+	bv = brt_vdev(brt, vdevid, B_FALSE);
+	bre = (bv != NULL) ? brt_entry_lookup(brt, bv, offset, B_FALSE) : NULL;
+	if (bre == NULL || bre->bre_refcount == 0) {
+		rw_exit(&brt->brt_lock);
+		return (B_TRUE);
+	}
+
+	uint64_t dsize = bp_get_dsize_sync(spa, bp);
+
+	bre->bre_refcount--;
+	bv->bv_savedspace -= dsize;
+	if (bre->bre_refcount == 0) {
+		brt_vdev_entcount_dec(bv, offset);
+		bv->bv_totalcount--;
+		bv->bv_usedspace -= dsize;
+	}
+	bv->bv_meta_dirty = B_TRUE;
+
+	rw_exit(&brt->brt_lock);
+
+	return (B_FALSE);
+}
+
+/*
+ * Return the number of additional references to the block.  This does
+ * not cache the entry, so it may be used from open context (e.g. zdb).
+ */
+uint64_t
+brt_entry_get_refcount(spa_t *spa, const blkptr_t *bp)
+{
+	brt_t *brt = spa->spa_brt;
+	uint64_t vdevid = DVA_GET_VDEV(&bp->blk_dva[0]);
+	uint64_t offset = DVA_GET_OFFSET(&bp->blk_dva[0]);
+	uint64_t refcount = 0;
+	brt_entry_t *bre, bre_search;
+	brt_vdev_t *bv;
+
+	rw_enter(&brt->brt_lock, RW_READER);
+
+	bv = brt_vdev(brt, vdevid, B_FALSE);
+	if (bv != NULL) {
+		bre_search.bre_offset = offset;
+		bre = avl_find(&bv->bv_tree, &bre_search, NULL);
+		if (bre != NULL) {
+			refcount = bre->bre_refcount;
+		} else if (bv->bv_mos_entries != 0) {
+			(void) zap_lookup_uint64(spa->spa_meta_objset,
+			    bv->bv_mos_entries, &offset, 1, sizeof (uint64_t),
+			    1, &refcount);
+		}
+	}
+
+	rw_exit(&brt->brt_lock);
+
+	return (refcount);
+}
+
+/*
+ * Cheap check whether the block may have a BRT entry.  Only level 0
+ * blocks of file data can be cloned (see dmu_read_l0_bps()).
+ */
+boolean_t
+brt_maybe_exists(spa_t *spa, const blkptr_t *bp)
+{
+	brt_t *brt = spa->spa_brt;
+	boolean_t mayexist = B_FALSE;
+	brt_vdev_t *bv;
+
+	if (brt == NULL || BP_IS_HOLE(bp) || BP_IS_EMBEDDED(bp) ||
+	    BP_GET_LEVEL(bp) != 0 || DMU_OT_IS_METADATA(BP_GET_TYPE(bp)))
+		return (B_FALSE);
+
+	rw_enter(&brt->brt_lock, RW_READER);
+
+	bv = brt_vdev(brt, DVA_GET_VDEV(&bp->blk_dva[0]), B_FALSE);
+	if (bv != NULL && bv->bv_totalcount > 0) {
+		uint64_t idx = DVA_GET_OFFSET(&bp->blk_dva[0]) /
+		    bv->bv_rangesize;
+		mayexist = (idx < bv->bv_size && bv->bv_entcount[idx] > 0);
+	}
+
+	rw_exit(&brt->brt_lock);
+
+	return (mayexist);
+}
+
+uint64_t
+brt_get_used(spa_t *spa)
+{
+	brt_t *brt = spa->spa_brt;
+	uint64_t used = 0;
+
+	if (brt == NULL)
+		return (0);
+
+	rw_enter(&brt->brt_lock, RW_READER);
+	for (uint64_t vdevid = 0; vdevid < brt->brt_nvdevs; vdevid++) {
+		if (brt->brt_vdevs[vdevid] != NULL)
+			used += brt->brt_vdevs[vdevid]->bv_usedspace;
+	}
+	rw_exit(&brt->brt_lock);
+
+	return (used);
+}
+
+uint64_t
+brt_get_saved(spa_t *spa)
+{
+	brt_t *brt = spa->spa_brt;
+	uint64_t saved = 0;
+
+	if (brt == NULL)
+		return (0);
+
+	rw_enter(&brt->brt_lock, RW_READER);
+	for (uint64_t vdevid = 0; vdevid < brt->brt_nvdevs; vdevid++) {
+		if (brt->brt_vdevs[vdevid] != NULL)
+			saved += brt->brt_vdevs[vdevid]->bv_savedspace;
+	}
+	rw_exit(&brt->brt_lock);
+
+	return (saved);
+}
+
+uint64_t
+brt_get_ratio(spa_t *spa)
+{
+	uint64_t used = brt_get_used(spa);
+
+	if (used == 0)
+		return (100);
+
+	return ((used + brt_get_saved(spa)) * 100 / used);
+}
+
+void
+brt_pending_add(spa_t *spa, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	brt_t *brt = spa->spa_brt;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	brt_pending_entry_t *bpe, *newbpe;
+	avl_index_t where;
+
+	if (BP_IS_HOLE(bp) || BP_IS_EMBEDDED(bp))
+		return;
+
+	newbpe = kmem_cache_alloc(brt_pending_entry_cache, KM_SLEEP);
+	newbpe->bpe_bp = *bp;
+	newbpe->bpe_count = 1;
+
+	mutex_enter(&brt->brt_pending_lock[txg & TXG_MASK]);
+	bpe = avl_find(&brt->brt_pending_tree[txg & TXG_MASK], newbpe, &where);
+	if (bpe == NULL) {
+		avl_insert(&brt->brt_pending_tree[txg & TXG_MASK], newbpe,
+		    where);
+		newbpe = NULL;
+	} else {
+		bpe->bpe_count++;
+	}
+	mutex_exit(&brt->brt_pending_lock[txg & TXG_MASK]);
+
+	if (newbpe != NULL)
+		kmem_cache_free(brt_pending_entry_cache, newbpe);
+}
+
+/*
+ * Drop a clone whose dirty record was undone.  If the txg is already
+ * syncing the clone has been applied to the BRT, so the reference is
+ * released like any other block being freed.
+ */
+void
+brt_pending_remove(spa_t *spa, const blkptr_t *bp, uint64_t txg)
+{
+	brt_t *brt = spa->spa_brt;
+	brt_pending_entry_t *bpe, bpe_search;
+
+	if (BP_IS_HOLE(bp) || BP_IS_EMBEDDED(bp))
+		return;
+
+	bpe_search.bpe_bp = *bp;
+
+	mutex_enter(&brt->brt_pending_lock[txg & TXG_MASK]);
+	bpe = avl_find(&brt->brt_pending_tree[txg & TXG_MASK], &bpe_search,
+	    NULL);
+	if (bpe != NULL && --bpe->bpe_count == 0) {
+		avl_remove(&brt->brt_pending_tree[txg & TXG_MASK], bpe);
+		kmem_cache_free(brt_pending_entry_cache, bpe);
+	}
+	mutex_exit(&brt->brt_pending_lock[txg & TXG_MASK]);
+
+	if (bpe == NULL) {
+		ASSERT3U(txg, ==, spa_syncing_txg(spa));
+		zio_free(spa, txg, bp);
+	}
+}
+
+void
+brt_pending_apply(spa_t *spa, uint64_t txg)
+{
+	brt_t *brt = spa->spa_brt;
+	avl_tree_t *pending_tree = &brt->brt_pending_tree[txg & TXG_MASK];
+	brt_pending_entry_t *bpe;
+	void *cookie = NULL;
+
+	ASSERT3U(txg, ==, spa_syncing_txg(spa));
+
+	mutex_enter(&brt->brt_pending_lock[txg & TXG_MASK]);
+	if (avl_numnodes(pending_tree) == 0) {
+		mutex_exit(&brt->brt_pending_lock[txg & TXG_MASK]);
+		return;
+	}
+
+	rw_enter(&brt->brt_lock, RW_WRITER);
+	while ((bpe = avl_destroy_nodes(pending_tree, &cookie)) != NULL) {
+		brt_entry_addref(brt, &bpe->bpe_bp, bpe->bpe_count);
+		kmem_cache_free(brt_pending_entry_cache, bpe);
+	}
+	rw_exit(&brt->brt_lock);
+	mutex_exit(&brt->brt_pending_lock[txg & TXG_MASK]);
+}
+
+void
+brt_sync(spa_t *spa, uint64_t txg)
+{
+	brt_t *brt = spa->spa_brt;
+	dmu_tx_t *tx;
+
+	ASSERT(spa_syncing_txg(spa) == txg);
+
+	tx = dmu_tx_create_assigned(spa->spa_dsl_pool, txg);
+
+	rw_enter(&brt->brt_lock, RW_WRITER);
+	for (uint64_t vdevid = 0; vdevid < brt->brt_nvdevs; vdevid++) {
+		brt_vdev_t *bv = brt->brt_vdevs[vdevid];
+
+		if (bv != NULL && (bv->bv_meta_dirty ||
+		    bv->bv_entcount_dirty || avl_numnodes(&bv->bv_tree) > 0))
+			brt_vdev_sync(brt, bv, tx);
+	}
+	rw_exit(&brt->brt_lock);
+
+	dmu_tx_commit(tx);
+}
+
+void
+brt_init(void)
+{
+	brt_entry_cache = kmem_cache_create("brt_entry_cache",
+	    sizeof (brt_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	brt_pending_entry_cache = kmem_cache_create("brt_pending_entry_cache",
+	    sizeof (brt_pending_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+brt_fini(void)
+{
+	kmem_cache_destroy(brt_pending_entry_cache);
+	kmem_cache_destroy(brt_entry_cache);
+}
+
+void
+brt_create(spa_t *spa)
+{
+	brt_t *brt;
+
+	ASSERT3P(spa->spa_brt, ==, NULL);
+
+	brt = kmem_zalloc(sizeof (brt_t), KM_SLEEP);
+	rw_init(&brt->brt_lock, NULL, RW_DEFAULT, NULL);
+	brt->brt_spa = spa;
+	for (int i = 0; i < TXG_SIZE; i++) {
+		mutex_init(&brt->brt_pending_lock[i], NULL, MUTEX_DEFAULT,
+		    NULL);
+		avl_create(&brt->brt_pending_tree[i], brt_pending_entry_compare,
+		    sizeof (brt_pending_entry_t),
+		    offsetof(brt_pending_entry_t, bpe_node));
+	}
+
+	spa->spa_brt = brt;
+}
+
+int
+brt_load(spa_t *spa)
+{
+	vdev_t *rvd = spa->spa_root_vdev;
+	brt_t *brt;
+	int error = 0;
+
+	brt_create(spa);
+	brt = spa->spa_brt;
+
+	rw_enter(&brt->brt_lock, RW_WRITER);
+	for (uint64_t vdevid = 0; vdevid < rvd->vdev_children; vdevid++) {
+		brt_vdev_t *bv = brt_vdev_alloc(vdevid);
+
+		error = brt_vdev_load(brt, bv);
+		if (error != 0) {
+			brt_vdev_free(bv);
+			if (error == ENOENT) {
+				error = 0;
+				continue;
+			}
+			break;
+		}
+
+		brt_vdevs_expand(brt, vdevid + 1);
+		brt->brt_vdevs[vdevid] = bv;
+	}
+	rw_exit(&brt->brt_lock);
+
+	return (error);
+}
+
+void
+brt_unload(spa_t *spa)
+{
+	brt_t *brt = spa->spa_brt;
+
+	if (brt == NULL)
+		return;
+
+	for (uint64_t vdevid = 0; vdevid < brt->brt_nvdevs; vdevid++) {
+		if (brt->brt_vdevs[vdevid] != NULL)
+			brt_vdev_free(brt->brt_vdevs[vdevid]);
+	}
+	if (brt->brt_nvdevs > 0) {
+		kmem_free(brt->brt_vdevs,
+		    brt->brt_nvdevs * sizeof (brt_vdev_t *));
+	}
+
+	for (int i = 0; i < TXG_SIZE; i++) {
+		brt_pending_entry_t *bpe;
+		void *cookie = NULL;
+
+		while ((bpe = avl_destroy_nodes(&brt->brt_pending_tree[i],
+		    &cookie)) != NULL)
+			kmem_cache_free(brt_pending_entry_cache, bpe);
+		avl_destroy(&brt->brt_pending_tree[i]);
+		mutex_destroy(&brt->brt_pending_lock[i]);
+	}
+	rw_destroy(&brt->brt_lock);
+	kmem_free(brt, sizeof (brt_t));
+
+	spa->spa_brt = NULL;
+}
+
+#if defined(_KERNEL)
+EXPORT_SYMBOL(brt_maybe_exists);
+EXPORT_SYMBOL(brt_get_used);
+EXPORT_SYMBOL(brt_get_saved);
+EXPORT_SYMBOL(brt_get_ratio);
+#endif
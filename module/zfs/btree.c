@@ -0,0 +1,929 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+ */
+
+#include	<sys/btree.h>
+#include	<sys/zfs_context.h>
+
+kmem_cache_t *zfs_btree_leaf_cache;
+
+/*
+ * Control the extent of the verification that occurs when zfs_btree_verify is
+ * called. Primarily used for debugging when extending the btree logic and
+ * functionality. As the intensity is increased, new verification steps are
+ * added. These steps are cumulative; intensity = 3 includes the intensity = 1
+ * and intensity = 2 steps as well.
+ *
+ * Intensity 1: Verify that the tree's height is consistent throughout.
+ * Intensity 2: Verify that a core node's children's parent pointers point
+ * to the core node.
+ * Intensity 3: Verify that the total number of elements in the tree matches
+ * the sum of the number of elements in each node. Also verifies that each
+ * node's count obeys the invariants (less than or equal to maximum value,
+ * greater than or equal to half the maximum minus one).
+ * Intensity 4: Verify that each element compares less than the element
+ * immediately after it and greater than the one immediately before it using
+ * the comparator function.
+ */
+uint_t zfs_btree_verify_intensity = 0;
+
+#define	BTREE_CORE_MIN		(BTREE_CORE_ELEMS / 2)
+#define	BTREE_LEAF_MIN(tree)	((tree)->bt_leaf_cap / 2)
+
+static inline uint8_t *
+bt_elems(zfs_btree_hdr_t *hdr)
+{
+	if (hdr->bth_core)
+		return (((zfs_btree_core_t *)hdr)->btc_elems);
+	return (((zfs_btree_leaf_t *)hdr)->btl_elems);
+}
+
+static inline void *
+bt_elem(zfs_btree_t *tree, zfs_btree_hdr_t *hdr, uint32_t idx)
+{
+	return (bt_elems(hdr) + (size_t)idx * tree->bt_elem_size);
+}
+
+static inline size_t
+bt_core_size(zfs_btree_t *tree)
+{
+	return (offsetof(zfs_btree_core_t, btc_elems) +
+	    BTREE_CORE_ELEMS * tree->bt_elem_size);
+}
+
+void
+zfs_btree_init(void)
+{
+	zfs_btree_leaf_cache = kmem_cache_create("zfs_btree_leaf_cache",
+	    BTREE_LEAF_SIZE, 0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+zfs_btree_fini(void)
+{
+	kmem_cache_destroy(zfs_btree_leaf_cache);
+}
+
+void
+zfs_btree_create(zfs_btree_t *tree, int (*compar) (const void *, const void *),
+    size_t size)
+{
+	/*
+	 * We need a minimum of 4 elements per leaf so that splitting and
+	 * merging always leave each node with at least one element.
+	 */
+	ASSERT3U(size, <=, (BTREE_LEAF_SIZE -
+	    offsetof(zfs_btree_leaf_t, btl_elems)) / 4);
+
+	bzero(tree, sizeof (*tree));
+	tree->bt_compar = compar;
+	tree->bt_elem_size = size;
+	tree->bt_leaf_cap = (BTREE_LEAF_SIZE -
+	    offsetof(zfs_btree_leaf_t, btl_elems)) / size;
+	tree->bt_height = -1;
+}
+
+static zfs_btree_hdr_t *
+bt_leaf_alloc(zfs_btree_t *tree, zfs_btree_core_t *parent)
+{
+	zfs_btree_leaf_t *leaf = kmem_cache_alloc(zfs_btree_leaf_cache,
+	    KM_SLEEP);
+
+	leaf->btl_hdr.bth_parent = parent;
+	leaf->btl_hdr.bth_core = B_FALSE;
+	leaf->btl_hdr.bth_count = 0;
+	tree->bt_num_nodes++;
+	return (&leaf->btl_hdr);
+}
+
+static zfs_btree_hdr_t *
+bt_core_alloc(zfs_btree_t *tree, zfs_btree_core_t *parent)
+{
+	zfs_btree_core_t *core = kmem_alloc(bt_core_size(tree), KM_SLEEP);
+
+	core->btc_hdr.bth_parent = parent;
+	core->btc_hdr.bth_core = B_TRUE;
+	core->btc_hdr.bth_count = 0;
+	tree->bt_num_nodes++;
+	return (&core->btc_hdr);
+}
+
+static void
+bt_node_free(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	ASSERT3U(tree->bt_num_nodes, >, 0);
+	tree->bt_num_nodes--;
+	if (hdr->bth_core)
+		kmem_free(hdr, bt_core_size(tree));
+	else
+		kmem_cache_free(zfs_btree_leaf_cache, hdr);
+}
+
+/*
+ * Binary search for the value within a node's element array. If a matching
+ * element is found it is returned and *idx is set to its position;
+ * otherwise NULL is returned and *idx is set to the position the value
+ * would be inserted at.
+ */
+static void *
+bt_find_in_buf(zfs_btree_t *tree, uint8_t *buf, uint32_t nelems,
+    const void *value, uint32_t *idx)
+{
+	uint32_t min = 0, max = nelems;
+	size_t size = tree->bt_elem_size;
+
+	while (max > min) {
+		uint32_t i = (min + max) / 2;
+		uint8_t *cur = buf + (size_t)i * size;
+		int comp = tree->bt_compar(cur, value);
+		if (comp < 0) {
+			min = i + 1;
+		} else if (comp > 0) {
+			max = i;
+		} else {
+			*idx = i;
+			return (cur);
+		}
+	}
+	*idx = max;
+	return (NULL);
+}
+
+void *
+zfs_btree_find(zfs_btree_t *tree, const void *value, zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *hdr = tree->bt_root;
+	uint32_t idx;
+
+	if (hdr == NULL) {
+		if (where != NULL) {
+			where->bti_node = NULL;
+			where->bti_offset = 0;
+			where->bti_before = B_TRUE;
+		}
+		return (NULL);
+	}
+
+	for (;;) {
+		void *d = bt_find_in_buf(tree, bt_elems(hdr), hdr->bth_count,
+		    value, &idx);
+		if (d != NULL) {
+			if (where != NULL) {
+				where->bti_node = hdr;
+				where->bti_offset = idx;
+				where->bti_before = B_FALSE;
+			}
+			return (d);
+		}
+		if (!hdr->bth_core)
+			break;
+		hdr = ((zfs_btree_core_t *)hdr)->btc_children[idx];
+	}
+
+	if (where != NULL) {
+		where->bti_node = hdr;
+		where->bti_offset = idx;
+		where->bti_before = B_TRUE;
+	}
+	return (NULL);
+}
+
+/*
+ * Find the position of the given child in its parent's children array.
+ */
+static uint32_t
+bt_child_index(zfs_btree_core_t *parent, zfs_btree_hdr_t *child)
+{
+	for (uint32_t i = 0; i <= parent->btc_hdr.bth_count; i++) {
+		if (parent->btc_children[i] == child)
+			return (i);
+	}
+	panic("btree child %p not found in parent %p", (void *)child,
+	    (void *)parent);
+	return (0);
+}
+
+/*
+ * Copy the elements [first, first + count) of the sequence obtained by
+ * inserting value at position idx of the array old into dst.
+ */
+static void
+bt_copy_with_insert(zfs_btree_t *tree, uint8_t *old, uint32_t idx,
+    const void *value, uint32_t first, uint32_t count, uint8_t *dst)
+{
+	size_t size = tree->bt_elem_size;
+	uint32_t i = first, end = first + count;
+
+	if (i < idx && i < end) {
+		uint32_t n = MIN(end, idx) - i;
+		bcopy(old + (size_t)i * size, dst, n * size);
+		dst += n * size;
+		i += n;
+	}
+	if (i < end && i == idx) {
+		bcopy(value, dst, size);
+		dst += size;
+		i++;
+	}
+	if (i < end)
+		bcopy(old + (size_t)(i - 1) * size, dst, (end - i) * size);
+}
+
+static void bt_insert_into_parent(zfs_btree_t *, zfs_btree_hdr_t *,
+    const void *, zfs_btree_hdr_t *);
+
+/*
+ * Insert the separator sep at position idx of the core node, with child
+ * becoming the child immediately to the right of sep. Splits the node if it
+ * is full.
+ */
+static void
+bt_insert_into_core(zfs_btree_t *tree, zfs_btree_core_t *core, uint32_t idx,
+    const void *sep, zfs_btree_hdr_t *child)
+{
+	size_t size = tree->bt_elem_size;
+	uint32_t n = core->btc_hdr.bth_count;
+	uint8_t *elems = core->btc_elems;
+
+	if (n < BTREE_CORE_ELEMS) {
+		bcopy(elems + idx * size, elems + (idx + 1) * size,
+		    (n - idx) * size);
+		bcopy(sep, elems + idx * size, size);
+		bcopy(&core->btc_children[idx + 1],
+		    &core->btc_children[idx + 2],
+		    (n - idx) * sizeof (zfs_btree_hdr_t *));
+		core->btc_children[idx + 1] = child;
+		child->bth_parent = core;
+		core->btc_hdr.bth_count++;
+		return;
+	}
+
+	/*
+	 * The node is full. Conceptually insert the new separator and child,
+	 * then keep the lower half here, move the upper half to a new node and
+	 * push the middle separator up into the parent.
+	 */
+	uint32_t keep = (n + 1) / 2;
+	uint32_t rcount = n - keep;
+	zfs_btree_core_t *right =
+	    (zfs_btree_core_t *)bt_core_alloc(tree, NULL);
+	uint8_t *up = kmem_alloc(size, KM_SLEEP);
+
+	bt_copy_with_insert(tree, elems, idx, sep, keep, 1, up);
+	bt_copy_with_insert(tree, elems, idx, sep, keep + 1, rcount,
+	    right->btc_elems);
+	for (uint32_t j = 0; j <= rcount; j++) {
+		uint32_t c = keep + 1 + j;
+		zfs_btree_hdr_t *cc;
+		if (c <= idx)
+			cc = core->btc_children[c];
+		else if (c == idx + 1)
+			cc = child;
+		else
+			cc = core->btc_children[c - 1];
+		right->btc_children[j] = cc;
+		cc->bth_parent = right;
+	}
+	right->btc_hdr.bth_count = rcount;
+
+	if (idx < keep) {
+		bcopy(elems + idx * size, elems + (idx + 1) * size,
+		    (keep - 1 - idx) * size);
+		bcopy(sep, elems + idx * size, size);
+		bcopy(&core->btc_children[idx + 1],
+		    &core->btc_children[idx + 2],
+		    (keep - 1 - idx) * sizeof (zfs_btree_hdr_t *));
+		core->btc_children[idx + 1] = child;
+		child->bth_parent = core;
+	}
+	core->btc_hdr.bth_count = keep;
+
+	bt_insert_into_parent(tree, &core->btc_hdr, up, &right->btc_hdr);
+	kmem_free(up, size);
+}
+
+/*
+ * After splitting left into left and right, insert the separator between
+ * them into their parent, growing a new root if left was the root.
+ */
+static void
+bt_insert_into_parent(zfs_btree_t *tree, zfs_btree_hdr_t *left,
+    const void *sep, zfs_btree_hdr_t *right)
+{
+	zfs_btree_core_t *parent = left->bth_parent;
+
+	if (parent == NULL) {
+		ASSERT3P(left, ==, tree->bt_root);
+		zfs_btree_core_t *root =
+		    (zfs_btree_core_t *)bt_core_alloc(tree, NULL);
+		bcopy(sep, root->btc_elems, tree->bt_elem_size);
+		root->btc_children[0] = left;
+		root->btc_children[1] = right;
+		root->btc_hdr.bth_count = 1;
+		left->bth_parent = root;
+		right->bth_parent = root;
+		tree->bt_root = &root->btc_hdr;
+		tree->bt_height++;
+		return;
+	}
+
+	bt_insert_into_core(tree, parent, bt_child_index(parent, left), sep,
+	    right);
+}
+
+static void
+bt_insert_into_leaf(zfs_btree_t *tree, zfs_btree_hdr_t *leaf,
+    const void *value, uint32_t idx)
+{
+	size_t size = tree->bt_elem_size;
+	uint32_t n = leaf->bth_count;
+	uint8_t *buf = bt_elems(leaf);
+
+	ASSERT3U(idx, <=, n);
+	if (n < tree->bt_leaf_cap) {
+		bcopy(buf + idx * size, buf + (idx + 1) * size,
+		    (n - idx) * size);
+		bcopy(value, buf + idx * size, size);
+		leaf->bth_count++;
+		return;
+	}
+
+	/*
+	 * The leaf is full; split it in half around the new value and push
+	 * the middle element up into the parent.
+	 */
+	uint32_t keep = (n + 1) / 2;
+	uint32_t rcount = n - keep;
+	zfs_btree_hdr_t *right = bt_leaf_alloc(tree, NULL);
+	uint8_t *up = kmem_alloc(size, KM_SLEEP);
+
+	bt_copy_with_insert(tree, buf, idx, value, keep, 1, up);
+	bt_copy_with_insert(tree, buf, idx, value, keep + 1, rcount,
+	    bt_elems(right));
+	right->bth_count = rcount;
+
+	if (idx < keep) {
+		bcopy(buf + idx * size, buf + (idx + 1) * size,
+		    (keep - 1 - idx) * size);
+		bcopy(value, buf + idx * size, size);
+	}
+	leaf->bth_count = keep;
+
+	bt_insert_into_parent(tree, leaf, up, right);
+	kmem_free(up, size);
+}
+
+void
+zfs_btree_add_idx(zfs_btree_t *tree, const void *value,
+    const zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *hdr = where->bti_node;
+	uint32_t idx = where->bti_offset;
+
+	if (tree->bt_root == NULL) {
+		ASSERT3P(hdr, ==, NULL);
+		ASSERT0(idx);
+		hdr = bt_leaf_alloc(tree, NULL);
+		tree->bt_root = hdr;
+		tree->bt_height = 0;
+	} else if (hdr->bth_core) {
+		/*
+		 * Inserting in front of a core element is the same as
+		 * appending to the rightmost leaf of the subtree to its left.
+		 */
+		ASSERT(!where->bti_before);
+		hdr = ((zfs_btree_core_t *)hdr)->btc_children[idx];
+		while (hdr->bth_core) {
+			hdr = ((zfs_btree_core_t *)hdr)->btc_children[
+			    hdr->bth_count];
+		}
+		idx = hdr->bth_count;
+	}
+
+	bt_insert_into_leaf(tree, hdr, value, idx);
+	tree->bt_num_elems++;
+}
+
+void
+zfs_btree_add(zfs_btree_t *tree, const void *node)
+{
+	zfs_btree_index_t where = {0};
+
+	VERIFY3P(zfs_btree_find(tree, node, &where), ==, NULL);
+	zfs_btree_add_idx(tree, node, &where);
+}
+
+void *
+zfs_btree_first(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *hdr = tree->bt_root;
+
+	if (hdr == NULL) {
+		ASSERT0(tree->bt_num_elems);
+		if (where != NULL) {
+			where->bti_node = NULL;
+			where->bti_offset = 0;
+			where->bti_before = B_TRUE;
+		}
+		return (NULL);
+	}
+	while (hdr->bth_core)
+		hdr = ((zfs_btree_core_t *)hdr)->btc_children[0];
+	if (where != NULL) {
+		where->bti_node = hdr;
+		where->bti_offset = 0;
+		where->bti_before = B_FALSE;
+	}
+	return (bt_elem(tree, hdr, 0));
+}
+
+void *
+zfs_btree_last(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	zfs_btree_hdr_t *hdr = tree->bt_root;
+
+	if (hdr == NULL) {
+		ASSERT0(tree->bt_num_elems);
+		if (where != NULL) {
+			where->bti_node = NULL;
+			where->bti_offset = 0;
+			where->bti_before = B_TRUE;
+		}
+		return (NULL);
+	}
+	while (hdr->bth_core)
+		hdr = ((zfs_btree_core_t *)hdr)->btc_children[hdr->bth_count];
+	if (where != NULL) {
+		where->bti_node = hdr;
+		where->bti_offset = hdr->bth_count - 1;
+		where->bti_before = B_FALSE;
+	}
+	return (bt_elem(tree, hdr, hdr->bth_count - 1));
+}
+
+static void *
+bt_set_idx(zfs_btree_t *tree, zfs_btree_hdr_t *hdr, uint32_t off,
+    zfs_btree_index_t *out)
+{
+	out->bti_node = hdr;
+	out->bti_offset = off;
+	out->bti_before = B_FALSE;
+	return (bt_elem(tree, hdr, off));
+}
+
+void *
+zfs_btree_next(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out_idx)
+{
+	zfs_btree_hdr_t *hdr = idx->bti_node;
+	uint32_t off = idx->bti_offset;
+	boolean_t before = idx->bti_before;
+
+	if (hdr == NULL)
+		return (NULL);
+
+	if (hdr->bth_core) {
+		zfs_btree_core_t *core = (zfs_btree_core_t *)hdr;
+		if (before)
+			return (bt_set_idx(tree, hdr, off, out_idx));
+		/* The next element is the leftmost one right of this one. */
+		hdr = core->btc_children[off + 1];
+		while (hdr->bth_core)
+			hdr = ((zfs_btree_core_t *)hdr)->btc_children[0];
+		return (bt_set_idx(tree, hdr, 0, out_idx));
+	}
+
+	uint32_t next = before ? off : off + 1;
+	if (next < hdr->bth_count)
+		return (bt_set_idx(tree, hdr, next, out_idx));
+
+	/*
+	 * We've run off the end of the leaf; climb until we come up from the
+	 * left of a separator.
+	 */
+	for (;;) {
+		zfs_btree_core_t *parent = hdr->bth_parent;
+		if (parent == NULL)
+			return (NULL);
+		uint32_t ci = bt_child_index(parent, hdr);
+		if (ci < parent->btc_hdr.bth_count)
+			return (bt_set_idx(tree, &parent->btc_hdr, ci,
+			    out_idx));
+		hdr = &parent->btc_hdr;
+	}
+}
+
+void *
+zfs_btree_prev(zfs_btree_t *tree, const zfs_btree_index_t *idx,
+    zfs_btree_index_t *out_idx)
+{
+	zfs_btree_hdr_t *hdr = idx->bti_node;
+	uint32_t off = idx->bti_offset;
+
+	if (hdr == NULL)
+		return (NULL);
+
+	if (hdr->bth_core) {
+		/* The previous element is the rightmost one left of this. */
+		hdr = ((zfs_btree_core_t *)hdr)->btc_children[off];
+		while (hdr->bth_core) {
+			hdr = ((zfs_btree_core_t *)hdr)->btc_children[
+			    hdr->bth_count];
+		}
+		return (bt_set_idx(tree, hdr, hdr->bth_count - 1, out_idx));
+	}
+
+	if (off > 0)
+		return (bt_set_idx(tree, hdr, off - 1, out_idx));
+
+	for (;;) {
+		zfs_btree_core_t *parent = hdr->bth_parent;
+		if (parent == NULL)
+			return (NULL);
+		uint32_t ci = bt_child_index(parent, hdr);
+		if (ci > 0) {
+			return (bt_set_idx(tree, &parent->btc_hdr, ci - 1,
+			    out_idx));
+		}
+		hdr = &parent->btc_hdr;
+	}
+}
+
+void *
+zfs_btree_get(zfs_btree_t *tree, zfs_btree_index_t *idx)
+{
+	ASSERT(!idx->bti_before);
+	ASSERT3U(idx->bti_offset, <, idx->bti_node->bth_count);
+	return (bt_elem(tree, idx->bti_node, idx->bti_offset));
+}
+
+static void bt_rebalance_core(zfs_btree_t *, zfs_btree_core_t *);
+
+/*
+ * Remove the separator at idx and the child to its right from a core node,
+ * then restore the node's invariants.
+ */
+static void
+bt_remove_from_core(zfs_btree_t *tree, zfs_btree_core_t *core, uint32_t idx)
+{
+	size_t size = tree->bt_elem_size;
+	uint32_t n = core->btc_hdr.bth_count;
+	uint8_t *elems = core->btc_elems;
+
+	bcopy(elems + (idx + 1) * size, elems + idx * size,
+	    (n - idx - 1) * size);
+	bcopy(&core->btc_children[idx + 2], &core->btc_children[idx + 1],
+	    (n - idx - 1) * sizeof (zfs_btree_hdr_t *));
+	core->btc_hdr.bth_count--;
+
+	if (core->btc_hdr.bth_parent == NULL) {
+		ASSERT3P(&core->btc_hdr, ==, tree->bt_root);
+		if (core->btc_hdr.bth_count == 0) {
+			/* The root has a single child left; it is the root. */
+			tree->bt_root = core->btc_children[0];
+			tree->bt_root->bth_parent = NULL;
+			tree->bt_height--;
+			bt_node_free(tree, &core->btc_hdr);
+		}
+		return;
+	}
+
+	if (core->btc_hdr.bth_count < BTREE_CORE_MIN)
+		bt_rebalance_core(tree, core);
+}
+
+/*
+ * A core node has dropped below the minimum. Take an element from a
+ * sibling with spares if possible, otherwise merge with a sibling.
+ */
+static void
+bt_rebalance_core(zfs_btree_t *tree, zfs_btree_core_t *core)
+{
+	size_t size = tree->bt_elem_size;
+	zfs_btree_core_t *parent = core->btc_hdr.bth_parent;
+	uint32_t ci = bt_child_index(parent, &core->btc_hdr);
+	uint32_t n = core->btc_hdr.bth_count;
+	zfs_btree_core_t *left = NULL, *right = NULL;
+
+	if (ci > 0)
+		left = (zfs_btree_core_t *)parent->btc_children[ci - 1];
+	if (ci < parent->btc_hdr.bth_count)
+		right = (zfs_btree_core_t *)parent->btc_children[ci + 1];
+
+	if (left != NULL && left->btc_hdr.bth_count > BTREE_CORE_MIN) {
+		uint32_t ln = left->btc_hdr.bth_count;
+
+		bcopy(core->btc_elems, core->btc_elems + size, n * size);
+		bcopy(&core->btc_children[0], &core->btc_children[1],
+		    (n + 1) * sizeof (zfs_btree_hdr_t *));
+		bcopy(parent->btc_elems + (ci - 1) * size, core->btc_elems,
+		    size);
+		core->btc_children[0] = left->btc_children[ln];
+		core->btc_children[0]->bth_parent = core;
+		bcopy(left->btc_elems + (ln - 1) * size,
+		    parent->btc_elems + (ci - 1) * size, size);
+		left->btc_hdr.bth_count--;
+		core->btc_hdr.bth_count++;
+		return;
+	}
+
+	if (right != NULL && right->btc_hdr.bth_count > BTREE_CORE_MIN) {
+		uint32_t rn = right->btc_hdr.bth_count;
+
+		bcopy(parent->btc_elems + ci * size, core->btc_elems + n * size,
+		    size);
+		core->btc_children[n + 1] = right->btc_children[0];
+		core->btc_children[n + 1]->bth_parent = core;
+		bcopy(right->btc_elems, parent->btc_elems + ci * size, size);
+		bcopy(right->btc_elems + size, right->btc_elems,
+		    (rn - 1) * size);
+		bcopy(&right->btc_children[1], &right->btc_children[0],
+		    rn * sizeof (zfs_btree_hdr_t *));
+		right->btc_hdr.bth_count--;
+		core->btc_hdr.bth_count++;
+		return;
+	}
+
+	/* Merge with a sibling; l absorbs the separator and r. */
+	zfs_btree_core_t *l, *r;
+	uint32_t sep;
+	if (left != NULL) {
+		l = left;
+		r = core;
+		sep = ci - 1;
+	} else {
+		ASSERT3P(right, !=, NULL);
+		l = core;
+		r = right;
+		sep = ci;
+	}
+	uint32_t ln = l->btc_hdr.bth_count;
+	uint32_t rn = r->btc_hdr.bth_count;
+	ASSERT3U(ln + rn + 1, <=, BTREE_CORE_ELEMS);
+
+	bcopy(parent->btc_elems + sep * size, l->btc_elems + ln * size, size);
+	bcopy(r->btc_elems, l->btc_elems + (ln + 1) * size, rn * size);
+	for (uint32_t i = 0; i <= rn; i++) {
+		l->btc_children[ln + 1 + i] = r->btc_children[i];
+		r->btc_children[i]->bth_parent = l;
+	}
+	l->btc_hdr.bth_count = ln + rn + 1;
+	bt_node_free(tree, &r->btc_hdr);
+
+	bt_remove_from_core(tree, parent, sep);
+}
+
+/*
+ * A leaf has dropped below the minimum. Take an element from a sibling with
+ * spares if possible, otherwise merge with a sibling.
+ */
+static void
+bt_rebalance_leaf(zfs_btree_t *tree, zfs_btree_hdr_t *leaf)
+{
+	size_t size = tree->bt_elem_size;
+	zfs_btree_core_t *parent = leaf->bth_parent;
+	uint32_t ci = bt_child_index(parent, leaf);
+	uint32_t n = leaf->bth_count;
+	uint8_t *buf = bt_elems(leaf);
+	zfs_btree_hdr_t *left = NULL, *right = NULL;
+
+	if (ci > 0)
+		left = parent->btc_children[ci - 1];
+	if (ci < parent->btc_hdr.bth_count)
+		right = parent->btc_children[ci + 1];
+
+	if (left != NULL && left->bth_count > BTREE_LEAF_MIN(tree)) {
+		bcopy(buf, buf + size, n * size);
+		bcopy(parent->btc_elems + (ci - 1) * size, buf, size);
+		bcopy(bt_elem(tree, left, left->bth_count - 1),
+		    parent->btc_elems + (ci - 1) * size, size);
+		left->bth_count--;
+		leaf->bth_count++;
+		return;
+	}
+
+	if (right != NULL && right->bth_count > BTREE_LEAF_MIN(tree)) {
+		uint8_t *rbuf = bt_elems(right);
+
+		bcopy(parent->btc_elems + ci * size, buf + n * size, size);
+		bcopy(rbuf, parent->btc_elems + ci * size, size);
+		bcopy(rbuf + size, rbuf, (right->bth_count - 1) * size);
+		right->bth_count--;
+		leaf->bth_count++;
+		return;
+	}
+
+	zfs_btree_hdr_t *l, *r;
+	uint32_t sep;
+	if (left != NULL) {
+		l = left;
+		r = leaf;
+		sep = ci - 1;
+	} else {
+		ASSERT3P(right, !=, NULL);
+		l = leaf;
+		r = right;
+		sep = ci;
+	}
+	uint32_t ln = l->bth_count;
+	uint32_t rn = r->bth_count;
+	ASSERT3U(ln + rn + 1, <=, tree->bt_leaf_cap);
+
+	bcopy(parent->btc_elems + sep * size, bt_elem(tree, l, ln), size);
+	bcopy(bt_elems(r), bt_elem(tree, l, ln + 1), rn * size);
+	l->bth_count = ln + rn + 1;
+	bt_node_free(tree, r);
+
+	bt_remove_from_core(tree, parent, sep);
+}
+
+void
+zfs_btree_remove_idx(zfs_btree_t *tree, zfs_btree_index_t *where)
+{
+	size_t size = tree->bt_elem_size;
+	zfs_btree_hdr_t *hdr = where->bti_node;
+	uint32_t idx = where->bti_offset;
+
+	ASSERT(!where->bti_before);
+	ASSERT3U(idx, <, hdr->bth_count);
+
+	if (hdr->bth_core) {
+		/*
+		 * Replace the separator with its in-order predecessor, which
+		 * always lives in a leaf, and remove that instead.
+		 */
+		zfs_btree_hdr_t *l =
+		    ((zfs_btree_core_t *)hdr)->btc_children[idx];
+		while (l->bth_core)
+			l = ((zfs_btree_core_t *)l)->btc_children[l->bth_count];
+		bcopy(bt_elem(tree, l, l->bth_count - 1),
+		    bt_elem(tree, hdr, idx), size);
+		hdr = l;
+		idx = l->bth_count - 1;
+	}
+
+	uint8_t *buf = bt_elems(hdr);
+	bcopy(buf + (idx + 1) * size, buf + idx * size,
+	    (hdr->bth_count - idx - 1) * size);
+	hdr->bth_count--;
+	tree->bt_num_elems--;
+
+	if (hdr->bth_parent == NULL) {
+		ASSERT3P(hdr, ==, tree->bt_root);
+		if (hdr->bth_count == 0) {
+			bt_node_free(tree, hdr);
+			tree->bt_root = NULL;
+			tree->bt_height = -1;
+		}
+		return;
+	}
+
+	if (hdr->bth_count < BTREE_LEAF_MIN(tree))
+		bt_rebalance_leaf(tree, hdr);
+}
+
+void
+zfs_btree_remove(zfs_btree_t *tree, const void *value)
+{
+	zfs_btree_index_t where = {0};
+
+	VERIFY3P(zfs_btree_find(tree, value, &where), !=, NULL);
+	zfs_btree_remove_idx(tree, &where);
+}
+
+ulong_t
+zfs_btree_numnodes(zfs_btree_t *tree)
+{
+	return (tree->bt_num_elems);
+}
+
+static void
+bt_clear_helper(zfs_btree_t *tree, zfs_btree_hdr_t *hdr)
+{
+	if (hdr->bth_core) {
+		zfs_btree_core_t *core = (zfs_btree_core_t *)hdr;
+		for (uint32_t i = 0; i <= hdr->bth_count; i++)
+			bt_clear_helper(tree, core->btc_children[i]);
+	}
+	bt_node_free(tree, hdr);
+}
+
+void
+zfs_btree_clear(zfs_btree_t *tree)
+{
+	if (tree->bt_root != NULL)
+		bt_clear_helper(tree, tree->bt_root);
+	ASSERT0(tree->bt_num_nodes);
+	tree->bt_root = NULL;
+	tree->bt_height = -1;
+	tree->bt_num_elems = 0;
+}
+
+/*
+ * The elements handed out remain in place until the final call, which frees
+ * all of the tree's nodes at once.
+ */
+void *
+zfs_btree_destroy_nodes(zfs_btree_t *tree, zfs_btree_index_t **cookie)
+{
+	void *value;
+
+	if (*cookie == NULL) {
+		*cookie = kmem_alloc(sizeof (**cookie), KM_SLEEP);
+		value = zfs_btree_first(tree, *cookie);
+	} else {
+		value = zfs_btree_next(tree, *cookie, *cookie);
+	}
+
+	if (value == NULL) {
+		kmem_free(*cookie, sizeof (**cookie));
+		*cookie = NULL;
+		zfs_btree_clear(tree);
+	}
+	return (value);
+}
+
+void
+zfs_btree_destroy(zfs_btree_t *tree)
+{
+	ASSERT0(tree->bt_num_elems);
+	ASSERT3P(tree->bt_root, ==, NULL);
+}
+
+static void
+bt_verify_node(zfs_btree_t *tree, zfs_btree_hdr_t *hdr, int64_t height,
+    uint64_t *count)
+{
+	if (zfs_btree_verify_intensity < 3) {
+		/* Only the height and parent pointers are checked. */
+	} else if (hdr->bth_parent != NULL) {
+		uint32_t min = hdr->bth_core ? BTREE_CORE_MIN :
+		    BTREE_LEAF_MIN(tree);
+		VERIFY3U(hdr->bth_count, >=, min);
+	} else {
+		VERIFY3U(hdr->bth_count, >, 0);
+	}
+	*count += hdr->bth_count;
+
+	if (!hdr->bth_core) {
+		VERIFY0(height);
+		VERIFY3U(hdr->bth_count, <=, tree->bt_leaf_cap);
+		return;
+	}
+
+	VERIFY3S(height, >, 0);
+	VERIFY3U(hdr->bth_count, <=, BTREE_CORE_ELEMS);
+	zfs_btree_core_t *core = (zfs_btree_core_t *)hdr;
+	for (uint32_t i = 0; i <= hdr->bth_count; i++) {
+		zfs_btree_hdr_t *child = core->btc_children[i];
+		if (zfs_btree_verify_intensity >= 2)
+			VERIFY3P(child->bth_parent, ==, core);
+		bt_verify_node(tree, child, height - 1, count);
+	}
+}
+
+void
+zfs_btree_verify(zfs_btree_t *tree)
+{
+	uint64_t count = 0;
+
+	if (zfs_btree_verify_intensity == 0)
+		return;
+
+	if (tree->bt_root == NULL) {
+		VERIFY3S(tree->bt_height, ==, -1);
+		VERIFY0(tree->bt_num_elems);
+		return;
+	}
+	VERIFY3P(tree->bt_root->bth_parent, ==, NULL);
+	bt_verify_node(tree, tree->bt_root, tree->bt_height, &count);
+	if (zfs_btree_verify_intensity >= 3)
+		VERIFY3U(count, ==, tree->bt_num_elems);
+
+	if (zfs_btree_verify_intensity >= 4) {
+		zfs_btree_index_t idx;
+		void *prev = zfs_btree_first(tree, &idx);
+		void *cur;
+		while ((cur = zfs_btree_next(tree, &idx, &idx)) != NULL) {
+			VERIFY3S(tree->bt_compar(prev, cur), ==, -1);
+			prev = cur;
+		}
+	}
+}
+
+/* BEGIN CSTYLED */
+ZFS_MODULE_PARAM(zfs, zfs_, btree_verify_intensity, UINT, ZMOD_RW,
+	"Enable btree verification. Levels 1-4 enable increasingly expensive "
+	"checks");
+/* END CSTYLED */
@@ -26,6 +26,7 @@
 
 #include <sys/dataset_kstats.h>
 #include <sys/dmu_objset.h>
+#include <sys/dmu_zfetch.h>
 #include <sys/dsl_dataset.h>
 #include <sys/spa.h>
 
@@ -37,6 +38,11 @@ static dataset_kstat_values_t empty_dataset_kstats = {
 	{ "nread",	KSTAT_DATA_UINT64 },
 	{ "nunlinks",	KSTAT_DATA_UINT64 },
 	{ "nunlinked",	KSTAT_DATA_UINT64 },
+	{ "zfetch_hits",	KSTAT_DATA_UINT64 },
+	{ "zfetch_misses",	KSTAT_DATA_UINT64 },
+	{ "zfetch_stride_hits",	KSTAT_DATA_UINT64 },
+	{ "zfetch_reverse_hits", KSTAT_DATA_UINT64 },
+	{ "zfetch_issued",	KSTAT_DATA_UINT64 },
 };
 
 static int
@@ -62,6 +68,13 @@ dataset_kstats_update(kstat_t *ksp, int rw)
 	dkv->dkv_nunlinked.value.ui64 =
 	    aggsum_value(&dk->dk_aggsums.das_nunlinked);
 
+	zfetch_ds_stats_t *zds = dk->dk_zfetch;
+	dkv->dkv_zfetch_hits.value.ui64 = zds->zds_hits;
+	dkv->dkv_zfetch_misses.value.ui64 = zds->zds_misses;
+	dkv->dkv_zfetch_stride_hits.value.ui64 = zds->zds_stride_hits;
+	dkv->dkv_zfetch_reverse_hits.value.ui64 = zds->zds_reverse_hits;
+	dkv->dkv_zfetch_issued.value.ui64 = zds->zds_issued;
+
 	return (0);
 }
 
@@ -137,6 +150,9 @@ dataset_kstats_create(dataset_kstats_t *dk, objset_t *objset)
 	kstat->ks_private = dk;
 	kstat->ks_data_size += ZFS_MAX_DATASET_NAME_LEN;
 
+	dk->dk_zfetch = dmu_zfetch_ds_stats_hold(dmu_objset_spa(objset),
+	    dmu_objset_id(objset));
+
 	kstat_install(kstat);
 	dk->dk_kstats = kstat;
 
@@ -162,6 +178,9 @@ dataset_kstats_destroy(dataset_kstats_t *dk)
 	kstat_delete(dk->dk_kstats);
 	dk->dk_kstats = NULL;
 
+	dmu_zfetch_ds_stats_rele(dk->dk_zfetch);
+	dk->dk_zfetch = NULL;
+
 	aggsum_fini(&dk->dk_aggsums.das_writes);
 	aggsum_fini(&dk->dk_aggsums.das_nwritten);
 	aggsum_fini(&dk->dk_aggsums.das_reads);
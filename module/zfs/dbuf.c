@@ -50,6 +50,7 @@
 #include <sys/vdev.h>
 #include <sys/cityhash.h>
 #include <sys/spa_impl.h>
+#include <sys/brt.h>
 
 kstat_t *dbuf_ksp;
 
@@ -1552,6 +1553,74 @@ dbuf_fix_old_data(dmu_buf_impl_t *db, uint64_t txg)
 	}
 }
 
+/*
+ * A dbuf whose latest contents were written by Direct I/O is left in
+ * DB_NOFILL with the data only on disk, at the dirty record's override
+ * bp.  Read that block back in so that buffered readers and partial
+ * writers see the same contents as the Direct I/O writer.  The dirty
+ * record keeps its override, just as after dmu_sync(), so the block is
+ * not written again unless it is modified.  The read is done holding
+ * db_mtx, which is fine since this only happens when Direct I/O and
+ * buffered access to the same block are mixed within a txg.
+ */
+static int
+dbuf_direct_fill(dmu_buf_impl_t *db)
+{
+	spa_t *spa = db->db_objset->os_spa;
+	dbuf_dirty_record_t *dr;
+	zbookmark_phys_t zb;
+	arc_buf_t *buf;
+	blkptr_t bp;
+
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+	ASSERT0(db->db_level);
+
+	/*
+	 * An older Direct I/O record may be being written out; once it is,
+	 * dbuf_write_done() may have made the dbuf DB_UNCACHED.
+	 */
+	while (db->db_state == DB_NOFILL && db->db_data_pending != NULL &&
+	    db->db_data_pending->dt.dl.dr_diowrite)
+		cv_wait(&db->db_changed, &db->db_mtx);
+
+	if (db->db_state != DB_NOFILL)
+		return (0);
+
+	dr = db->db_last_dirty;
+	if (dr == NULL || !dr->dt.dl.dr_diowrite)
+		return (SET_ERROR(EIO));
+
+	ASSERT3U(dr->dt.dl.dr_override_state, ==, DR_OVERRIDDEN);
+	ASSERT3P(dr->dt.dl.dr_data, ==, NULL);
+	bp = dr->dt.dl.dr_overridden_by;
+	ASSERT(!BP_IS_PROTECTED(&bp));
+
+	buf = arc_alloc_buf(spa, db, DBUF_GET_BUFC_TYPE(db), db->db.db_size);
+	if (BP_IS_HOLE(&bp)) {
+		bzero(buf->b_data, db->db.db_size);
+	} else {
+		abd_t *abd = abd_get_from_buf(buf->b_data, db->db.db_size);
+		int err;
+
+		SET_BOOKMARK(&zb, dmu_objset_id(db->db_objset),
+		    db->db.db_object, db->db_level, db->db_blkid);
+		err = zio_wait(zio_read(NULL, spa, &bp, abd, db->db.db_size,
+		    NULL, NULL, ZIO_PRIORITY_SYNC_READ, ZIO_FLAG_CANFAIL, &zb));
+		abd_put(abd);
+		if (err != 0) {
+			arc_buf_destroy(buf, db);
+			return (err);
+		}
+	}
+
+	dr->dt.dl.dr_data = buf;
+	dbuf_set_data(db, buf);
+	db->db_state = DB_CACHED;
+	cv_broadcast(&db->db_changed);
+
+	return (0);
+}
+
 int
 dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 {
@@ -1565,8 +1634,13 @@ dbuf_read(dmu_buf_impl_t *db, zio_t *zio, uint32_t flags)
 	 */
 	ASSERT(!zfs_refcount_is_zero(&db->db_holds));
 
-	if (db->db_state == DB_NOFILL)
-		return (SET_ERROR(EIO));
+	if (db->db_state == DB_NOFILL) {
+		mutex_enter(&db->db_mtx);
+		err = dbuf_direct_fill(db);
+		mutex_exit(&db->db_mtx);
+		if (err != 0)
+			return (err);
+	}
 
 	DB_DNODE_ENTER(db);
 	dn = DB_DNODE(db);
@@ -1730,13 +1804,21 @@ dbuf_unoverride(dbuf_dirty_record_t *dr)
 
 	ASSERT(db->db_data_pending != dr);
 
-	/* free this block */
-	if (!BP_IS_HOLE(bp) && !dr->dt.dl.dr_nopwrite)
+	/* free this block, or drop the clone of someone else's */
+	if (dr->dt.dl.dr_brtwrite)
+		brt_pending_remove(db->db_objset->os_spa, bp, txg);
+	else if (!BP_IS_HOLE(bp) && !dr->dt.dl.dr_nopwrite)
 		zio_free(db->db_objset->os_spa, txg, bp);
 
 	dr->dt.dl.dr_override_state = DR_NOT_OVERRIDDEN;
 	dr->dt.dl.dr_nopwrite = B_FALSE;
 	dr->dt.dl.dr_has_raw_params = B_FALSE;
+	dr->dt.dl.dr_diowrite = B_FALSE;
+	dr->dt.dl.dr_brtwrite = B_FALSE;
+
+	/* A Direct I/O write leaves no buffer behind to release. */
+	if (dr->dt.dl.dr_data == NULL)
+		return;
 
 	/*
 	 * Release the already-written buffer, so we leave it in
@@ -2305,7 +2387,13 @@ dbuf_undirty(dmu_buf_impl_t *db, dmu_tx_t *tx)
 	}
 	DB_DNODE_EXIT(db);
 
-	if (db->db_state != DB_NOFILL) {
+	if (db->db_state == DB_NOFILL) {
+		if (dr->dt.dl.dr_diowrite) {
+			dbuf_unoverride(dr);
+			if (db->db_last_dirty == NULL)
+				db->db_state = DB_UNCACHED;
+		}
+	} else {
 		dbuf_unoverride(dr);
 
 		ASSERT(db->db_buf != NULL);
@@ -2393,6 +2481,23 @@ dmu_buf_is_dirty(dmu_buf_t *db_fake, dmu_tx_t *tx)
 	return (B_FALSE);
 }
 
+static void
+dmu_buf_will_fill_impl(dmu_buf_t *db_fake, dmu_tx_t *tx)
+{
+	dmu_buf_impl_t *db = (dmu_buf_impl_t *)db_fake;
+
+	ASSERT(db->db_blkid != DMU_BONUS_BLKID);
+	ASSERT(tx->tx_txg != 0);
+	ASSERT(db->db_level == 0);
+	ASSERT(!zfs_refcount_is_zero(&db->db_holds));
+
+	ASSERT(db->db.db_object != DMU_META_DNODE_OBJECT ||
+	    dmu_tx_private_ok(tx));
+
+	dbuf_noread(db);
+	(void) dbuf_dirty(db, tx);
+}
+
 void
 dmu_buf_will_not_fill(dmu_buf_t *db_fake, dmu_tx_t *tx)
 {
@@ -2400,7 +2505,7 @@ dmu_buf_will_not_fill(dmu_buf_t *db_fake, dmu_tx_t *tx)
 
 	db->db_state = DB_NOFILL;
 
-	dmu_buf_will_fill(db_fake, tx);
+	dmu_buf_will_fill_impl(db_fake, tx);
 }
 
 void
@@ -2408,16 +2513,16 @@ dmu_buf_will_fill(dmu_buf_t *db_fake, dmu_tx_t *tx)
 {
 	dmu_buf_impl_t *db = (dmu_buf_impl_t *)db_fake;
 
-	ASSERT(db->db_blkid != DMU_BONUS_BLKID);
-	ASSERT(tx->tx_txg != 0);
-	ASSERT(db->db_level == 0);
-	ASSERT(!zfs_refcount_is_zero(&db->db_holds));
-
-	ASSERT(db->db.db_object != DMU_META_DNODE_OBJECT ||
-	    dmu_tx_private_ok(tx));
+	/*
+	 * The caller may fill only part of the block, so bring back the
+	 * contents of an earlier Direct I/O write first.
+	 */
+	mutex_enter(&db->db_mtx);
+	if (db->db_state == DB_NOFILL)
+		(void) dbuf_direct_fill(db);
+	mutex_exit(&db->db_mtx);
 
-	dbuf_noread(db);
-	(void) dbuf_dirty(db, tx);
+	dmu_buf_will_fill_impl(db_fake, tx);
 }
 
 /*
@@ -2555,6 +2660,123 @@ dmu_buf_redact(dmu_buf_t *dbuf, dmu_tx_t *tx)
 	dbuf_override_impl(db, &bp, tx);
 }
 
+/*
+ * Make bp the new contents of the dbuf without a copy of the data, as
+ * for Direct I/O writes and block clones.  Any cached copy of the old
+ * contents is dropped.  Returns EBUSY if someone else holds the dbuf.
+ */
+static int
+dbuf_override_nofill(dmu_buf_impl_t *db, const blkptr_t *bp, int copies,
+    boolean_t brtwrite, dmu_tx_t *tx)
+{
+	struct dirty_leaf *dl;
+
+	ASSERT0(db->db_level);
+	ASSERT(db->db_blkid != DMU_BONUS_BLKID);
+	ASSERT(!zfs_refcount_is_zero(&db->db_holds));
+
+	mutex_enter(&db->db_mtx);
+	while (db->db_state == DB_READ || db->db_state == DB_FILL)
+		cv_wait(&db->db_changed, &db->db_mtx);
+
+	if (zfs_refcount_count(&db->db_holds) > db->db_dirtycnt + 1) {
+		mutex_exit(&db->db_mtx);
+		return (SET_ERROR(EBUSY));
+	}
+
+	/*
+	 * Older txgs which are still being synced must have been Direct I/O
+	 * writes too, since the dbuf state is shared by all dirty records.
+	 */
+	for (dbuf_dirty_record_t *dr = db->db_last_dirty; dr != NULL;
+	    dr = dr->dr_next) {
+		if (dr->dr_txg != tx->tx_txg && (!dr->dt.dl.dr_diowrite ||
+		    dr->dt.dl.dr_data != NULL)) {
+			mutex_exit(&db->db_mtx);
+			return (SET_ERROR(EBUSY));
+		}
+	}
+
+	VERIFY(!dbuf_undirty(db, tx));
+
+	if (db->db_state == DB_CACHED) {
+		arc_buf_destroy(db->db_buf, db);
+		db->db_buf = NULL;
+		dbuf_clear_data(db);
+	}
+	ASSERT(db->db_state == DB_UNCACHED || db->db_state == DB_NOFILL);
+	db->db_state = DB_NOFILL;
+	mutex_exit(&db->db_mtx);
+
+	(void) dbuf_dirty(db, tx);
+
+	mutex_enter(&db->db_mtx);
+	dbuf_override_impl(db, bp, tx);
+	dl = &db->db_last_dirty->dt.dl;
+	dl->dr_copies = copies;
+	dl->dr_diowrite = B_TRUE;
+	if (brtwrite) {
+		spa_t *spa = db->db_objset->os_spa;
+
+		dl->dr_brtwrite = B_TRUE;
+		if (BP_IS_HOLE(bp)) {
+			/* Build the hole as zio_write_compress() would. */
+			BP_ZERO(&dl->dr_overridden_by);
+			if (spa_feature_is_active(spa,
+			    SPA_FEATURE_HOLE_BIRTH)) {
+				BP_SET_LSIZE(&dl->dr_overridden_by,
+				    db->db.db_size);
+				DB_DNODE_ENTER(db);
+				BP_SET_TYPE(&dl->dr_overridden_by,
+				    DB_DNODE(db)->dn_type);
+				DB_DNODE_EXIT(db);
+				BP_SET_LEVEL(&dl->dr_overridden_by, 0);
+				BP_SET_BIRTH(&dl->dr_overridden_by,
+				    tx->tx_txg, 0);
+			}
+		} else if (!BP_IS_EMBEDDED(bp)) {
+			/* The data keeps the birth txg of its original. */
+			BP_SET_BIRTH(&dl->dr_overridden_by, tx->tx_txg,
+			    BP_PHYSICAL_BIRTH(bp));
+			brt_pending_add(spa, bp, tx);
+		}
+	}
+	mutex_exit(&db->db_mtx);
+
+	return (0);
+}
+
+/*
+ * Make bp, which the caller has already written from a Direct I/O
+ * buffer in this txg with the given number of copies, the new contents
+ * of the dbuf.  Returns EBUSY if someone else holds the dbuf; the caller
+ * must then free bp and fall back to a buffered write.
+ */
+int
+dmu_buf_write_direct(dmu_buf_t *dbuf, const blkptr_t *bp, int copies,
+    dmu_tx_t *tx)
+{
+	return (dbuf_override_nofill((dmu_buf_impl_t *)dbuf, bp, copies,
+	    B_FALSE, tx));
+}
+
+/*
+ * Make the dbuf another reference to the existing level 0 block bp of
+ * a file, taken by dmu_read_l0_bps() in this or an earlier txg.  The
+ * reference is added to the BRT when the txg syncs.  Returns EBUSY if
+ * someone else holds the dbuf; the caller must then copy the data.
+ */
+int
+dmu_buf_clone(dmu_buf_t *dbuf, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	ASSERT0(BP_GET_LEVEL(bp));
+	ASSERT(BP_IS_HOLE(bp) || BP_IS_EMBEDDED(bp) ||
+	    BP_PHYSICAL_BIRTH(bp) < tx->tx_txg);
+
+	return (dbuf_override_nofill((dmu_buf_impl_t *)dbuf, bp,
+	    BP_IS_HOLE(bp) ? 0 : BP_GET_NDVAS(bp), B_TRUE, tx));
+}
+
 /*
  * Directly assign a provided arc buf to a given dbuf if it's not referenced
  * by anybody except our caller. Otherwise copy arcbuf's contents to dbuf.
@@ -4419,8 +4641,12 @@ dbuf_write_done(zio_t *zio, arc_buf_t *buf, void *vdb)
 		ASSERT(db->db_blkid != DMU_BONUS_BLKID);
 		ASSERT(dr->dt.dl.dr_override_state == DR_NOT_OVERRIDDEN);
 		if (db->db_state != DB_NOFILL) {
-			if (dr->dt.dl.dr_data != db->db_buf)
+			if (dr->dt.dl.dr_data != NULL &&
+			    dr->dt.dl.dr_data != db->db_buf)
 				arc_buf_destroy(dr->dt.dl.dr_data, db);
+		} else if (dr->dt.dl.dr_diowrite && db->db_last_dirty == NULL) {
+			/* The Direct I/O data is now simply on disk. */
+			db->db_state = DB_UNCACHED;
 		}
 	} else {
 		dnode_t *dn;
@@ -4717,6 +4943,16 @@ dbuf_write(dbuf_dirty_record_t *dr, arc_buf_t *data, dmu_tx_t *tx)
 		abd_t *contents = (data != NULL) ?
 		    abd_get_from_buf(data->b_data, arc_buf_size(data)) : NULL;
 
+		/*
+		 * Without the data (e.g. after a Direct I/O write) the block
+		 * cannot be verified or rewritten by dedup, so it must be
+		 * taken exactly as provided.
+		 */
+		if (contents == NULL) {
+			zp.zp_dedup = B_FALSE;
+			zp.zp_dedup_verify = B_FALSE;
+		}
+
 		dr->dr_zio = zio_write(zio, os->os_spa, txg,
 		    &dr->dr_bp_copy, contents, db->db.db_size, db->db.db_size,
 		    &zp, dbuf_write_override_ready, NULL, NULL,
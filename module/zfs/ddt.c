@@ -37,9 +37,12 @@
 #include <sys/zio_compress.h>
 #include <sys/dsl_scan.h>
 #include <sys/abd.h>
+#include <sys/zfeature.h>
+#include <sys/dsl_synctask.h>
 
 static kmem_cache_t *ddt_cache;
 static kmem_cache_t *ddt_entry_cache;
+static kmem_cache_t *ddt_phys_cache;
 
 /*
  * Enable/disable prefetching of dedup-ed blocks which are going to be freed.
@@ -172,54 +175,58 @@ ddt_object_sync(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
 
 static int
 ddt_object_lookup(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
-    ddt_entry_t *dde)
+    const ddt_key_t *ddk, ddt_phys_t *phys)
 {
 	if (!ddt_object_exists(ddt, type, class))
 		return (SET_ERROR(ENOENT));
 
 	return (ddt_ops[type]->ddt_op_lookup(ddt->ddt_os,
-	    ddt->ddt_object[type][class], dde));
+	    ddt->ddt_object[type][class], ddk, phys));
 }
 
 static void
 ddt_object_prefetch(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
-    ddt_entry_t *dde)
+    const ddt_key_t *ddk)
 {
 	if (!ddt_object_exists(ddt, type, class))
 		return;
 
 	ddt_ops[type]->ddt_op_prefetch(ddt->ddt_os,
-	    ddt->ddt_object[type][class], dde);
+	    ddt->ddt_object[type][class], ddk);
 }
 
 int
 ddt_object_update(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
-    ddt_entry_t *dde, dmu_tx_t *tx)
+    const ddt_key_t *ddk, const ddt_phys_t *phys, dmu_tx_t *tx)
 {
 	ASSERT(ddt_object_exists(ddt, type, class));
 
 	return (ddt_ops[type]->ddt_op_update(ddt->ddt_os,
-	    ddt->ddt_object[type][class], dde, tx));
+	    ddt->ddt_object[type][class], ddk, phys, tx));
 }
 
-static int
+int
 ddt_object_remove(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
-    ddt_entry_t *dde, dmu_tx_t *tx)
+    const ddt_key_t *ddk, dmu_tx_t *tx)
 {
 	ASSERT(ddt_object_exists(ddt, type, class));
 
 	return (ddt_ops[type]->ddt_op_remove(ddt->ddt_os,
-	    ddt->ddt_object[type][class], dde, tx));
+	    ddt->ddt_object[type][class], ddk, tx));
 }
 
 int
 ddt_object_walk(ddt_t *ddt, enum ddt_type type, enum ddt_class class,
-    uint64_t *walk, ddt_entry_t *dde)
+    uint64_t *walk, ddt_lightweight_entry_t *ddlwe)
 {
 	ASSERT(ddt_object_exists(ddt, type, class));
 
+	ddlwe->ddlwe_type = type;
+	ddlwe->ddlwe_class = class;
+
 	return (ddt_ops[type]->ddt_op_walk(ddt->ddt_os,
-	    ddt->ddt_object[type][class], dde, walk));
+	    ddt->ddt_object[type][class], &ddlwe->ddlwe_key,
+	    ddlwe->ddlwe_phys, walk));
 }
 
 int
@@ -360,10 +367,11 @@ ddt_phys_free(ddt_t *ddt, ddt_key_t *ddk, ddt_phys_t *ddp, uint64_t txg)
 ddt_phys_t *
 ddt_phys_select(const ddt_entry_t *dde, const blkptr_t *bp)
 {
-	ddt_phys_t *ddp = (ddt_phys_t *)dde->dde_phys;
+	for (int p = 0; p < DDT_PHYS_TYPES; p++) {
+		ddt_phys_t *ddp = dde->dde_phys[p];
 
-	for (int p = 0; p < DDT_PHYS_TYPES; p++, ddp++) {
-		if (DVA_EQUAL(BP_IDENTITY(bp), &ddp->ddp_dva[0]) &&
+		if (ddp != NULL &&
+		    DVA_EQUAL(BP_IDENTITY(bp), &ddp->ddp_dva[0]) &&
 		    BP_PHYSICAL_BIRTH(bp) == ddp->ddp_phys_birth)
 			return (ddp);
 	}
@@ -375,18 +383,76 @@ ddt_phys_total_refcnt(const ddt_entry_t *dde)
 {
 	uint64_t refcnt = 0;
 
-	for (int p = DDT_PHYS_SINGLE; p <= DDT_PHYS_TRIPLE; p++)
-		refcnt += dde->dde_phys[p].ddp_refcnt;
+	for (int p = DDT_PHYS_SINGLE; p <= DDT_PHYS_TRIPLE; p++) {
+		if (dde->dde_phys[p] != NULL)
+			refcnt += dde->dde_phys[p]->ddp_refcnt;
+	}
 
 	return (refcnt);
 }
 
+/*
+ * Returns phys slot p of the entry, allocating an empty one if the entry
+ * has not used that slot yet.  Slots are never moved or freed before the
+ * entry itself, so the pointer stays valid as long as the entry does.
+ */
+ddt_phys_t *
+ddt_phys_slot(ddt_entry_t *dde, enum ddt_phys_type p)
+{
+	if (dde->dde_phys[p] == NULL) {
+		dde->dde_phys[p] = kmem_cache_alloc(ddt_phys_cache, KM_SLEEP);
+		bzero(dde->dde_phys[p], sizeof (ddt_phys_t));
+	}
+
+	return (dde->dde_phys[p]);
+}
+
+/*
+ * Fill in the entry's phys slots from the full set stored in the tables,
+ * allocating only the slots which are in use.
+ */
+void
+ddt_entry_set_phys(ddt_entry_t *dde, const ddt_phys_t *phys)
+{
+	for (int p = 0; p < DDT_PHYS_TYPES; p++) {
+		if (phys[p].ddp_phys_birth != 0)
+			*ddt_phys_slot(dde, p) = phys[p];
+		else if (dde->dde_phys[p] != NULL)
+			ddt_phys_clear(dde->dde_phys[p]);
+	}
+}
+
+/*
+ * Expand the entry's phys slots into the full set stored in the tables.
+ */
+void
+ddt_entry_get_phys(const ddt_entry_t *dde, ddt_phys_t *phys)
+{
+	for (int p = 0; p < DDT_PHYS_TYPES; p++) {
+		if (dde->dde_phys[p] != NULL)
+			phys[p] = *dde->dde_phys[p];
+		else
+			ddt_phys_clear(&phys[p]);
+	}
+}
+
+void
+ddt_entry_to_lightweight(const ddt_entry_t *dde,
+    ddt_lightweight_entry_t *ddlwe)
+{
+	ddlwe->ddlwe_key = dde->dde_key;
+	ddlwe->ddlwe_type = dde->dde_type;
+	ddlwe->ddlwe_class = dde->dde_class;
+	ddt_entry_get_phys(dde, ddlwe->ddlwe_phys);
+}
+
 static void
-ddt_stat_generate(ddt_t *ddt, ddt_entry_t *dde, ddt_stat_t *dds)
+ddt_stat_generate(ddt_t *ddt, const ddt_lightweight_entry_t *ddlwe,
+    ddt_stat_t *dds)
 {
 	spa_t *spa = ddt->ddt_spa;
-	ddt_phys_t *ddp = dde->dde_phys;
-	ddt_key_t *ddk = &dde->dde_key;
+	const ddt_phys_t *ddp = ddlwe->ddlwe_phys;
+	const ddt_key_t *ddk = &ddlwe->ddlwe_key;
 	uint64_t lsize = DDK_GET_LSIZE(ddk);
 	uint64_t psize = DDK_GET_PSIZE(ddk);
 
@@ -399,7 +465,7 @@ ddt_stat_generate(ddt_t *ddt, ddt_entry_t *dde, ddt_stat_t *dds)
 		if (ddp->ddp_phys_birth == 0)
 			continue;
 
-		for (int d = 0; d < DDE_GET_NDVAS(dde); d++)
+		for (int d = 0; d < DDK_GET_NDVAS(ddk); d++)
 			dsize += dva_get_dsize_sync(spa, &ddp->ddp_dva[d]);
 
 		dds->dds_blocks += 1;
@@ -428,22 +494,32 @@ ddt_stat_add(ddt_stat_t *dst, const ddt_stat_t *src, uint64_t neg)
 }
 
 static void
-ddt_stat_update(ddt_t *ddt, ddt_entry_t *dde, uint64_t neg)
+ddt_stat_update_lightweight(ddt_t *ddt, const ddt_lightweight_entry_t *ddlwe,
+    uint64_t neg)
 {
 	ddt_stat_t dds;
 	ddt_histogram_t *ddh;
 	int bucket;
 
-	ddt_stat_generate(ddt, dde, &dds);
+	ddt_stat_generate(ddt, ddlwe, &dds);
 
 	bucket = highbit64(dds.dds_ref_blocks) - 1;
 	ASSERT(bucket >= 0);
 
-	ddh = &ddt->ddt_histogram[dde->dde_type][dde->dde_class];
+	ddh = &ddt->ddt_histogram[ddlwe->ddlwe_type][ddlwe->ddlwe_class];
 
 	ddt_stat_add(&ddh->ddh_stat[bucket], &dds, neg);
 }
 
+static void
+ddt_stat_update(ddt_t *ddt, ddt_entry_t *dde, uint64_t neg)
+{
+	ddt_lightweight_entry_t ddlwe;
+
+	ddt_entry_to_lightweight(dde, &ddlwe);
+	ddt_stat_update_lightweight(ddt, &ddlwe, neg);
+}
+
 void
 ddt_histogram_add(ddt_histogram_t *dst, const ddt_histogram_t *src)
 {
@@ -552,6 +628,34 @@ ddt_get_pool_dedup_ratio(spa_t *spa)
 	return (dds_total.dds_ref_dsize * 100 / dds_total.dds_dsize);
 }
 
+/*
+ * Size of the DDT as measured against the dedup_table_quota pool property.
+ * The ZAP objects never shrink when entries are removed, so rather than
+ * their allocated space this counts the logical size of the entries, which
+ * goes down again as entries are pruned.
+ */
+uint64_t
+ddt_get_ddt_size(spa_t *spa)
+{
+	ddt_object_t ddo_total = { 0 };
+
+	ddt_get_dedup_object_stats(spa, &ddo_total);
+
+	return (ddo_total.ddo_count * DDT_ENTRY_SIZE);
+}
+
+/*
+ * Once the DDT has reached its quota, new blocks are written without
+ * creating an entry until pruning makes room again.
+ */
+boolean_t
+ddt_over_quota(spa_t *spa)
+{
+	uint64_t quota = spa->spa_dedup_table_quota;
+
+	return (quota != 0 && ddt_get_ddt_size(spa) >= quota);
+}
+
 size_t
 ddt_compress(void *src, uchar_t *dst, size_t s_len, size_t d_len)
 {
@@ -625,15 +729,151 @@ ddt_init(void)
 	    sizeof (ddt_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
 	ddt_entry_cache = kmem_cache_create("ddt_entry_cache",
 	    sizeof (ddt_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	ddt_phys_cache = kmem_cache_create("ddt_phys_cache",
+	    sizeof (ddt_phys_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+	ddt_log_init();
 }
 
 void
 ddt_fini(void)
 {
+	ddt_log_fini();
+	kmem_cache_destroy(ddt_phys_cache);
 	kmem_cache_destroy(ddt_entry_cache);
 	kmem_cache_destroy(ddt_cache);
 }
 
+/*
+ * The first word of a dedup checksum is already well distributed, but
+ * multiplying it by the golden ratio spreads weaker checksums over the
+ * buckets as well.
+ */
+static uint64_t
+ddt_hash_bucket(const ddt_hash_t *dh, const ddt_key_t *ddk)
+{
+	return ((ddk->ddk_cksum.zc_word[0] * 0x9E3779B97F4A7C15ULL) >>
+	    (64 - dh->dh_shift));
+}
+
+static void
+ddt_hash_create(ddt_hash_t *dh, uint64_t shift)
+{
+	dh->dh_shift = shift;
+	dh->dh_count = 0;
+	dh->dh_buckets = vmem_zalloc(sizeof (ddt_entry_t *) << shift,
+	    KM_SLEEP);
+}
+
+static void
+ddt_hash_destroy(ddt_hash_t *dh)
+{
+	ASSERT0(dh->dh_count);
+
+	vmem_free(dh->dh_buckets, sizeof (ddt_entry_t *) << dh->dh_shift);
+	dh->dh_buckets = NULL;
+}
+
+/*
+ * Rehash the entries into a table of 1 << shift buckets.  The lookups
+ * which would have triggered this work fine with longer chains, so if
+ * memory is short the table is simply left as it is.
+ */
+static void
+ddt_hash_resize(ddt_hash_t *dh, uint64_t shift)
+{
+	ddt_entry_t **old = dh->dh_buckets;
+	uint64_t oshift = dh->dh_shift;
+
+	dh->dh_buckets = vmem_zalloc(sizeof (ddt_entry_t *) << shift,
+	    KM_NOSLEEP);
+	if (dh->dh_buckets == NULL) {
+		dh->dh_buckets = old;
+		return;
+	}
+	dh->dh_shift = shift;
+
+	for (uint64_t i = 0; i < (1ULL << oshift); i++) {
+		ddt_entry_t *dde, *next;
+
+		for (dde = old[i]; dde != NULL; dde = next) {
+			uint64_t b = ddt_hash_bucket(dh, &dde->dde_key);
+
+			next = dde->dde_next;
+			dde->dde_next = dh->dh_buckets[b];
+			dh->dh_buckets[b] = dde;
+		}
+	}
+
+	vmem_free(old, sizeof (ddt_entry_t *) << oshift);
+}
+
+static ddt_entry_t *
+ddt_hash_find(const ddt_hash_t *dh, const ddt_key_t *ddk)
+{
+	ddt_entry_t *dde = dh->dh_buckets[ddt_hash_bucket(dh, ddk)];
+
+	while (dde != NULL && ddt_key_compare(&dde->dde_key, ddk) != 0)
+		dde = dde->dde_next;
+
+	return (dde);
+}
+
+static void
+ddt_hash_insert(ddt_hash_t *dh, ddt_entry_t *dde)
+{
+	uint64_t b;
+
+	ASSERT3P(ddt_hash_find(dh, &dde->dde_key), ==, NULL);
+
+	if (dh->dh_count >= (1ULL << dh->dh_shift) &&
+	    dh->dh_shift < DDT_HASH_MAX_SHIFT)
+		ddt_hash_resize(dh, dh->dh_shift + 1);
+
+	b = ddt_hash_bucket(dh, &dde->dde_key);
+	dde->dde_next = dh->dh_buckets[b];
+	dh->dh_buckets[b] = dde;
+	dh->dh_count++;
+}
+
+static void
+ddt_hash_remove(ddt_hash_t *dh, ddt_entry_t *dde)
+{
+	ddt_entry_t **ddep;
+
+	ddep = &dh->dh_buckets[ddt_hash_bucket(dh, &dde->dde_key)];
+
+	while (*ddep != dde) {
+		ASSERT(*ddep != NULL);
+		ddep = &(*ddep)->dde_next;
+	}
+	*ddep = dde->dde_next;
+	dde->dde_next = NULL;
+	dh->dh_count--;
+}
+
+/*
+ * Remove and return the entries one at a time, in no particular order,
+ * like avl_destroy_nodes().  *cookie must be zero for the first call, and
+ * no entries may be added until NULL has been returned.
+ */
+static ddt_entry_t *
+ddt_hash_destroy_nodes(ddt_hash_t *dh, uint64_t *cookie)
+{
+	for (; *cookie < (1ULL << dh->dh_shift); (*cookie)++) {
+		ddt_entry_t *dde = dh->dh_buckets[*cookie];
+
+		if (dde != NULL) {
+			dh->dh_buckets[*cookie] = dde->dde_next;
+			dde->dde_next = NULL;
+			dh->dh_count--;
+			return (dde);
+		}
+	}
+
+	ASSERT0(dh->dh_count);
+	return (NULL);
+}
+
 static ddt_entry_t *
 ddt_alloc(const ddt_key_t *ddk)
 {
@@ -653,8 +893,11 @@ ddt_free(ddt_entry_t *dde)
 {
 	ASSERT(!dde->dde_loading);
 
-	for (int p = 0; p < DDT_PHYS_TYPES; p++)
+	for (int p = 0; p < DDT_PHYS_TYPES; p++) {
 		ASSERT(dde->dde_lead_zio[p] == NULL);
+		if (dde->dde_phys[p] != NULL)
+			kmem_cache_free(ddt_phys_cache, dde->dde_phys[p]);
+	}
 
 	if (dde->dde_repair_abd != NULL)
 		abd_free(dde->dde_repair_abd);
@@ -668,29 +911,30 @@ ddt_remove(ddt_t *ddt, ddt_entry_t *dde)
 {
 	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
 
-	avl_remove(&ddt->ddt_tree, dde);
+	ddt_hash_remove(&ddt->ddt_tree, dde);
 	ddt_free(dde);
 }
 
 ddt_entry_t *
 ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 {
-	ddt_entry_t *dde, dde_search;
+	ddt_entry_t *dde;
+	ddt_phys_t phys[DDT_PHYS_TYPES];
+	ddt_key_t ddk;
 	enum ddt_type type;
 	enum ddt_class class;
-	avl_index_t where;
 	int error;
 
 	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
 
-	ddt_key_fill(&dde_search.dde_key, bp);
+	ddt_key_fill(&ddk, bp);
 
-	dde = avl_find(&ddt->ddt_tree, &dde_search, &where);
+	dde = ddt_hash_find(&ddt->ddt_tree, &ddk);
 	if (dde == NULL) {
 		if (!add)
 			return (NULL);
-		dde = ddt_alloc(&dde_search.dde_key);
-		avl_insert(&ddt->ddt_tree, dde, where);
+		dde = ddt_alloc(&ddk);
+		ddt_hash_insert(&ddt->ddt_tree, dde);
 	}
 
 	while (dde->dde_loading)
@@ -701,13 +945,23 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 
 	dde->dde_loading = B_TRUE;
 
+	/*
+	 * The dedup log holds the newest version of the entry, if any, so
+	 * the ZAP objects only need to be searched if it has none.
+	 */
+	if (ddt_log_lookup(ddt, dde)) {
+		error = (dde->dde_type == DDT_TYPES) ? ENOENT : 0;
+		goto loaded;
+	}
+
 	ddt_exit(ddt);
 
 	error = ENOENT;
 
 	for (type = 0; type < DDT_TYPES; type++) {
 		for (class = 0; class < DDT_CLASSES; class++) {
-			error = ddt_object_lookup(ddt, type, class, dde);
+			error = ddt_object_lookup(ddt, type, class, &ddk,
+			    phys);
 			if (error != ENOENT) {
 				ASSERT0(error);
 				break;
@@ -719,11 +973,17 @@ ddt_lookup(ddt_t *ddt, const blkptr_t *bp, boolean_t add)
 
 	ddt_enter(ddt);
 
-	ASSERT(dde->dde_loaded == B_FALSE);
-	ASSERT(dde->dde_loading == B_TRUE);
+	if (error == 0)
+		ddt_entry_set_phys(dde, phys);
 
 	dde->dde_type = type;	/* will be DDT_TYPES if no entry found */
 	dde->dde_class = class;	/* will be DDT_CLASSES if no entry found */
+	dde->dde_zap_type = type;
+	dde->dde_zap_class = class;
+loaded:
+	ASSERT(dde->dde_loaded == B_FALSE);
+	ASSERT(dde->dde_loading == B_TRUE);
+
 	dde->dde_loaded = B_TRUE;
 	dde->dde_loading = B_FALSE;
 
@@ -739,7 +999,7 @@ void
 ddt_prefetch(spa_t *spa, const blkptr_t *bp)
 {
 	ddt_t *ddt;
-	ddt_entry_t dde;
+	ddt_key_t ddk;
 
 	if (!zfs_dedup_prefetch || bp == NULL || !BP_GET_DEDUP(bp))
 		return;
@@ -750,11 +1010,11 @@ ddt_prefetch(spa_t *spa, const blkptr_t *bp)
 	 * Thus no locking is required as the DDT can't disappear on us.
 	 */
 	ddt = ddt_select(spa, bp);
-	ddt_key_fill(&dde.dde_key, bp);
+	ddt_key_fill(&ddk, bp);
 
 	for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
 		for (enum ddt_class class = 0; class < DDT_CLASSES; class++) {
-			ddt_object_prefetch(ddt, type, class, &dde);
+			ddt_object_prefetch(ddt, type, class, &ddk);
 		}
 	}
 }
@@ -769,12 +1029,10 @@ typedef struct ddt_key_cmp {
 } ddt_key_cmp_t;
 
 int
-ddt_entry_compare(const void *x1, const void *x2)
+ddt_key_compare(const ddt_key_t *ddk1, const ddt_key_t *ddk2)
 {
-	const ddt_entry_t *dde1 = x1;
-	const ddt_entry_t *dde2 = x2;
-	const ddt_key_cmp_t *k1 = (const ddt_key_cmp_t *)&dde1->dde_key;
-	const ddt_key_cmp_t *k2 = (const ddt_key_cmp_t *)&dde2->dde_key;
+	const ddt_key_cmp_t *k1 = (const ddt_key_cmp_t *)ddk1;
+	const ddt_key_cmp_t *k2 = (const ddt_key_cmp_t *)ddk2;
 	int32_t cmp = 0;
 
 	for (int i = 0; i < DDT_KEY_CMP_LEN; i++) {
@@ -786,6 +1044,15 @@ ddt_entry_compare(const void *x1, const void *x2)
 	return (AVL_ISIGN(cmp));
 }
 
+int
+ddt_entry_compare(const void *x1, const void *x2)
+{
+	const ddt_entry_t *dde1 = x1;
+	const ddt_entry_t *dde2 = x2;
+
+	return (ddt_key_compare(&dde1->dde_key, &dde2->dde_key));
+}
+
 static ddt_t *
 ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 {
@@ -795,13 +1062,12 @@ ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 	bzero(ddt, sizeof (ddt_t));
 
 	mutex_init(&ddt->ddt_lock, NULL, MUTEX_DEFAULT, NULL);
-	avl_create(&ddt->ddt_tree, ddt_entry_compare,
-	    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
-	avl_create(&ddt->ddt_repair_tree, ddt_entry_compare,
-	    sizeof (ddt_entry_t), offsetof(ddt_entry_t, dde_node));
+	ddt_hash_create(&ddt->ddt_tree, DDT_HASH_MIN_SHIFT);
+	ddt_hash_create(&ddt->ddt_repair_tree, DDT_HASH_MIN_SHIFT);
 	ddt->ddt_checksum = c;
 	ddt->ddt_spa = spa;
 	ddt->ddt_os = spa->spa_meta_objset;
+	ddt_log_alloc(ddt);
 
 	return (ddt);
 }
@@ -809,10 +1075,9 @@ ddt_table_alloc(spa_t *spa, enum zio_checksum c)
 static void
 ddt_table_free(ddt_t *ddt)
 {
-	ASSERT(avl_numnodes(&ddt->ddt_tree) == 0);
-	ASSERT(avl_numnodes(&ddt->ddt_repair_tree) == 0);
-	avl_destroy(&ddt->ddt_tree);
-	avl_destroy(&ddt->ddt_repair_tree);
+	ddt_log_free(ddt);
+	ddt_hash_destroy(&ddt->ddt_tree);
+	ddt_hash_destroy(&ddt->ddt_repair_tree);
 	mutex_destroy(&ddt->ddt_lock);
 	kmem_cache_free(ddt_cache, ddt);
 }
@@ -851,6 +1116,10 @@ ddt_load(spa_t *spa)
 			}
 		}
 
+		error = ddt_log_load(ddt);
+		if (error != 0)
+			return (error);
+
 		/*
 		 * Seed the cached histograms.
 		 */
@@ -877,29 +1146,45 @@ boolean_t
 ddt_class_contains(spa_t *spa, enum ddt_class max_class, const blkptr_t *bp)
 {
 	ddt_t *ddt;
-	ddt_entry_t *dde;
+	ddt_phys_t *phys;
+	ddt_key_t ddk;
 
 	if (!BP_GET_DEDUP(bp))
 		return (B_FALSE);
 
-	if (max_class == DDT_CLASS_UNIQUE)
-		return (B_TRUE);
-
+	/*
+	 * ddt_walk() skips the entries in the dedup log, so their blocks
+	 * must be visited wherever they are found.
+	 */
 	ddt = spa->spa_ddt[BP_GET_CHECKSUM(bp)];
-	dde = kmem_cache_alloc(ddt_entry_cache, KM_SLEEP);
+	ddt_key_fill(&ddk, bp);
+	if (!ddt_log_empty(ddt)) {
+		boolean_t logged;
+
+		ddt_enter(ddt);
+		logged = ddt_log_contains(ddt, &ddk);
+		ddt_exit(ddt);
+		if (logged)
+			return (B_FALSE);
+	}
 
-	ddt_key_fill(&(dde->dde_key), bp);
+	/*
+	 * Even when every class is walked, the entry may since have been
+	 * pruned, so the tables must still be searched.
+	 */
+	phys = kmem_alloc(DDT_PHYS_SIZE, KM_SLEEP);
 
 	for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
 		for (enum ddt_class class = 0; class <= max_class; class++) {
-			if (ddt_object_lookup(ddt, type, class, dde) == 0) {
-				kmem_cache_free(ddt_entry_cache, dde);
+			if (ddt_object_lookup(ddt, type, class, &ddk,
+			    phys) == 0) {
+				kmem_free(phys, DDT_PHYS_SIZE);
 				return (B_TRUE);
 			}
 		}
 	}
 
-	kmem_cache_free(ddt_entry_cache, dde);
+	kmem_free(phys, DDT_PHYS_SIZE);
 	return (B_FALSE);
 }
 
@@ -908,11 +1193,25 @@ ddt_repair_start(ddt_t *ddt, const blkptr_t *bp)
 {
 	ddt_key_t ddk;
 	ddt_entry_t *dde;
+	ddt_phys_t phys[DDT_PHYS_TYPES];
+	boolean_t logged;
 
 	ddt_key_fill(&ddk, bp);
 
 	dde = ddt_alloc(&ddk);
 
+	ddt_enter(ddt);
+	logged = ddt_log_lookup(ddt, dde);
+	ddt_exit(ddt);
+	if (logged) {
+		if (dde->dde_type == DDT_TYPES ||
+		    dde->dde_class == DDT_CLASS_UNIQUE) {
+			bzero(phys, sizeof (phys));
+			ddt_entry_set_phys(dde, phys);
+		}
+		return (dde);
+	}
+
 	for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
 		for (enum ddt_class class = 0; class < DDT_CLASSES; class++) {
 			/*
@@ -921,26 +1220,25 @@ ddt_repair_start(ddt_t *ddt, const blkptr_t *bp)
 			 * there's definitely only one copy, so don't even try.
 			 */
 			if (class != DDT_CLASS_UNIQUE &&
-			    ddt_object_lookup(ddt, type, class, dde) == 0)
+			    ddt_object_lookup(ddt, type, class, &ddk,
+			    phys) == 0) {
+				ddt_entry_set_phys(dde, phys);
 				return (dde);
+			}
 		}
 	}
 
-	bzero(dde->dde_phys, sizeof (dde->dde_phys));
-
 	return (dde);
 }
 
 void
 ddt_repair_done(ddt_t *ddt, ddt_entry_t *dde)
 {
-	avl_index_t where;
-
 	ddt_enter(ddt);
 
 	if (dde->dde_repair_abd != NULL && spa_writeable(ddt->ddt_spa) &&
-	    avl_find(&ddt->ddt_repair_tree, dde, &where) == NULL)
-		avl_insert(&ddt->ddt_repair_tree, dde, where);
+	    ddt_hash_find(&ddt->ddt_repair_tree, &dde->dde_key) == NULL)
+		ddt_hash_insert(&ddt->ddt_repair_tree, dde);
 	else
 		ddt_free(dde);
 
@@ -958,8 +1256,6 @@ ddt_repair_entry_done(zio_t *zio)
 static void
 ddt_repair_entry(ddt_t *ddt, ddt_entry_t *dde, ddt_entry_t *rdde, zio_t *rio)
 {
-	ddt_phys_t *ddp = dde->dde_phys;
-	ddt_phys_t *rddp = rdde->dde_phys;
 	ddt_key_t *ddk = &dde->dde_key;
 	ddt_key_t *rddk = &rdde->dde_key;
 	zio_t *zio;
@@ -968,8 +1264,12 @@ ddt_repair_entry(ddt_t *ddt, ddt_entry_t *dde, ddt_entry_t *rdde, zio_t *rio)
 	zio = zio_null(rio, rio->io_spa, NULL,
 	    ddt_repair_entry_done, rdde, rio->io_flags);
 
-	for (int p = 0; p < DDT_PHYS_TYPES; p++, ddp++, rddp++) {
-		if (ddp->ddp_phys_birth == 0 ||
+	for (int p = 0; p < DDT_PHYS_TYPES; p++) {
+		ddt_phys_t *ddp = dde->dde_phys[p];
+		ddt_phys_t *rddp = rdde->dde_phys[p];
+
+		if (ddp == NULL || rddp == NULL ||
+		    ddp->ddp_phys_birth == 0 ||
 		    ddp->ddp_phys_birth != rddp->ddp_phys_birth ||
 		    bcmp(ddp->ddp_dva, rddp->ddp_dva, sizeof (ddp->ddp_dva)))
 			continue;
@@ -986,44 +1286,56 @@ static void
 ddt_repair_table(ddt_t *ddt, zio_t *rio)
 {
 	spa_t *spa = ddt->ddt_spa;
-	ddt_entry_t *dde, *rdde_next, *rdde;
-	avl_tree_t *t = &ddt->ddt_repair_tree;
+	ddt_entry_t *dde, *rdde_next, *rdde, *list = NULL;
+	uint64_t cookie = 0;
 	blkptr_t blk;
 
 	if (spa_sync_pass(spa) > 1)
 		return;
 
+	/*
+	 * Take all the entries at once, as more may be added while the
+	 * lock is dropped below.
+	 */
 	ddt_enter(ddt);
-	for (rdde = avl_first(t); rdde != NULL; rdde = rdde_next) {
-		rdde_next = AVL_NEXT(t, rdde);
-		avl_remove(&ddt->ddt_repair_tree, rdde);
-		ddt_exit(ddt);
+	while ((rdde = ddt_hash_destroy_nodes(&ddt->ddt_repair_tree,
+	    &cookie)) != NULL) {
+		rdde->dde_next = list;
+		list = rdde;
+	}
+	ddt_exit(ddt);
+
+	for (rdde = list; rdde != NULL; rdde = rdde_next) {
+		rdde_next = rdde->dde_next;
+		rdde->dde_next = NULL;
 		ddt_bp_create(ddt->ddt_checksum, &rdde->dde_key, NULL, &blk);
 		dde = ddt_repair_start(ddt, &blk);
 		ddt_repair_entry(ddt, dde, rdde, rio);
 		ddt_repair_done(ddt, dde);
-		ddt_enter(ddt);
 	}
-	ddt_exit(ddt);
 }
 
 static void
 ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 {
 	dsl_pool_t *dp = ddt->ddt_spa->spa_dsl_pool;
-	ddt_phys_t *ddp = dde->dde_phys;
 	ddt_key_t *ddk = &dde->dde_key;
 	enum ddt_type otype = dde->dde_type;
 	enum ddt_type ntype = DDT_TYPE_CURRENT;
 	enum ddt_class oclass = dde->dde_class;
 	enum ddt_class nclass;
+	ddt_lightweight_entry_t ddlwe;
 	uint64_t total_refcnt = 0;
 
 	ASSERT(dde->dde_loaded);
 	ASSERT(!dde->dde_loading);
 
-	for (int p = 0; p < DDT_PHYS_TYPES; p++, ddp++) {
+	for (int p = 0; p < DDT_PHYS_TYPES; p++) {
+		ddt_phys_t *ddp = dde->dde_phys[p];
+
 		ASSERT(dde->dde_lead_zio[p] == NULL);
+		if (ddp == NULL)
+			continue;
 		if (ddp->ddp_phys_birth == 0) {
 			ASSERT(ddp->ddp_refcnt == 0);
 			continue;
@@ -1042,25 +1354,40 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 	}
 
 	/* We do not create new DDT-DITTO blocks. */
-	ASSERT0(dde->dde_phys[DDT_PHYS_DITTO].ddp_phys_birth);
+	ASSERT(dde->dde_phys[DDT_PHYS_DITTO] == NULL ||
+	    dde->dde_phys[DDT_PHYS_DITTO]->ddp_phys_birth == 0);
 	if (total_refcnt > 1)
 		nclass = DDT_CLASS_DUPLICATE;
 	else
 		nclass = DDT_CLASS_UNIQUE;
 
-	if (otype != DDT_TYPES &&
+	if (ddt_log_exists(ddt)) {
+		/*
+		 * The entry is moved between the ZAP objects when the
+		 * dedup log is flushed.
+		 */
+		if (total_refcnt == 0) {
+			dde->dde_type = DDT_TYPES;
+			dde->dde_class = DDT_CLASSES;
+		}
+	} else if (otype != DDT_TYPES &&
 	    (otype != ntype || oclass != nclass || total_refcnt == 0)) {
-		VERIFY(ddt_object_remove(ddt, otype, oclass, dde, tx) == 0);
-		ASSERT(ddt_object_lookup(ddt, otype, oclass, dde) == ENOENT);
+		VERIFY(ddt_object_remove(ddt, otype, oclass, ddk, tx) == 0);
+		ASSERT(ddt_object_lookup(ddt, otype, oclass, ddk,
+		    ddlwe.ddlwe_phys) == ENOENT);
 	}
 
 	if (total_refcnt != 0) {
 		dde->dde_type = ntype;
 		dde->dde_class = nclass;
-		ddt_stat_update(ddt, dde, 0);
+		ddt_entry_to_lightweight(dde, &ddlwe);
+		ddt_stat_update_lightweight(ddt, &ddlwe, 0);
 		if (!ddt_object_exists(ddt, ntype, nclass))
 			ddt_object_create(ddt, ntype, nclass, tx);
-		VERIFY(ddt_object_update(ddt, ntype, nclass, dde, tx) == 0);
+		if (!ddt_log_exists(ddt)) {
+			VERIFY(ddt_object_update(ddt, ntype, nclass, ddk,
+			    ddlwe.ddlwe_phys, tx) == 0);
+		}
 
 		/*
 		 * If the class changes, the order that we scan this bp
@@ -1071,9 +1398,12 @@ ddt_sync_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx, uint64_t txg)
 		 */
 		if (nclass < oclass) {
 			dsl_scan_ddt_entry(dp->dp_scan,
-			    ddt->ddt_checksum, dde, tx);
+			    ddt->ddt_checksum, &ddlwe, tx);
 		}
 	}
+
+	if (ddt_log_exists(ddt))
+		ddt_log_entry(ddt, dde, tx);
 }
 
 static void
@@ -1081,9 +1411,15 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 {
 	spa_t *spa = ddt->ddt_spa;
 	ddt_entry_t *dde;
-	void *cookie = NULL;
+	uint64_t cookie = 0, count;
+	boolean_t empty = B_TRUE;
 
-	if (avl_numnodes(&ddt->ddt_tree) == 0)
+	/*
+	 * The dedup log is flushed a little every txg, but only in the
+	 * first pass so that the later passes still converge.
+	 */
+	if (ddt->ddt_tree.dh_count == 0 &&
+	    (spa_sync_pass(spa) > 1 || ddt_log_empty(ddt)))
 		return;
 
 	ASSERT(spa->spa_uberblock.ub_version >= SPA_VERSION_DEDUP);
@@ -1094,11 +1430,31 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 		    DMU_POOL_DDT_STATS, tx);
 	}
 
-	while ((dde = avl_destroy_nodes(&ddt->ddt_tree, &cookie)) != NULL) {
+	if (!ddt_log_exists(ddt) &&
+	    spa_feature_is_enabled(spa, SPA_FEATURE_DEDUP_LOG))
+		ddt_log_create(ddt, tx);
+
+	count = ddt->ddt_tree.dh_count;
+	while ((dde = ddt_hash_destroy_nodes(&ddt->ddt_tree, &cookie)) !=
+	    NULL) {
 		ddt_sync_entry(ddt, dde, tx, txg);
 		ddt_free(dde);
 	}
 
+	/*
+	 * Shrink the table a step at a time once a burst of dedup writes
+	 * is over.
+	 */
+	if (count < (1ULL << ddt->ddt_tree.dh_shift) / 4 &&
+	    ddt->ddt_tree.dh_shift > DDT_HASH_MIN_SHIFT)
+		ddt_hash_resize(&ddt->ddt_tree, ddt->ddt_tree.dh_shift - 1);
+
+	if (ddt_log_exists(ddt)) {
+		ddt_log_commit(ddt, tx);
+		if (spa_sync_pass(spa) == 1)
+			ddt_log_flush(ddt, tx);
+	}
+
 	for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
 		uint64_t add, count = 0;
 		for (enum ddt_class class = 0; class < DDT_CLASSES; class++) {
@@ -1110,16 +1466,173 @@ ddt_sync_table(ddt_t *ddt, dmu_tx_t *tx, uint64_t txg)
 			}
 		}
 		for (enum ddt_class class = 0; class < DDT_CLASSES; class++) {
-			if (count == 0 && ddt_object_exists(ddt, type, class))
+			if (!ddt_object_exists(ddt, type, class))
+				continue;
+			if (count == 0 && ddt_log_empty(ddt))
 				ddt_object_destroy(ddt, type, class, tx);
+			else
+				empty = B_FALSE;
 		}
 	}
 
+	if (empty && ddt_log_exists(ddt) && ddt_log_empty(ddt))
+		ddt_log_destroy(ddt, tx);
+
 	bcopy(ddt->ddt_histogram, &ddt->ddt_histogram_cache,
 	    sizeof (ddt->ddt_histogram));
 	spa->spa_dedup_dspace = ~0ULL;
 }
 
+/*
+ * Returns the age bucket of a unique entry that may be pruned, or -1 if it
+ * must be kept.  Entries superseded by the dedup log or loaded for the txg
+ * being synced are left alone, as are the few still holding a ditto copy.
+ */
+static int
+ddt_prune_bucket(ddt_t *ddt, const ddt_lightweight_entry_t *ddlwe,
+    uint64_t txg)
+{
+	const ddt_phys_t *phys = ddlwe->ddlwe_phys;
+	uint64_t birth = 0, refcnt = 0;
+
+	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
+
+	for (int p = DDT_PHYS_SINGLE; p <= DDT_PHYS_TRIPLE; p++) {
+		birth = MAX(birth, phys[p].ddp_phys_birth);
+		refcnt += phys[p].ddp_refcnt;
+	}
+
+	if (phys[DDT_PHYS_DITTO].ddp_phys_birth != 0 || refcnt != 1)
+		return (-1);
+
+	if (ddt_hash_find(&ddt->ddt_tree, &ddlwe->ddlwe_key) != NULL ||
+	    ddt_log_contains(ddt, &ddlwe->ddlwe_key))
+		return (-1);
+
+	ASSERT3U(birth, <=, txg);
+	return (birth * DDT_PRUNE_BUCKETS / (txg + 1));
+}
+
+/*
+ * Visit the unique entries of every DDT.  When given a histogram, count
+ * them by age; otherwise remove all entries older than the cutoff bucket,
+ * and up to *nleft of those in the cutoff bucket itself.  Returns the
+ * number of entries removed.
+ */
+static uint64_t
+ddt_prune_walk(spa_t *spa, uint64_t *hist, int cutoff, uint64_t *nleft,
+    dmu_tx_t *tx)
+{
+	enum ddt_class class = DDT_CLASS_UNIQUE;
+	ddt_lightweight_entry_t *ddlwe;
+	uint64_t pruned = 0;
+
+	ddlwe = kmem_alloc(sizeof (ddt_lightweight_entry_t), KM_SLEEP);
+
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		uint64_t removed = 0;
+
+		if (ddt == NULL)
+			continue;
+
+		for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
+			uint64_t walk = 0, count = 0;
+
+			if (!ddt_object_exists(ddt, type, class))
+				continue;
+
+			while (ddt_object_walk(ddt, type, class, &walk,
+			    ddlwe) == 0) {
+				int bucket;
+
+				ddt_enter(ddt);
+				bucket = ddt_prune_bucket(ddt, ddlwe,
+				    tx->tx_txg);
+				if (bucket < 0) {
+					/* keep it */
+				} else if (hist != NULL) {
+					hist[bucket]++;
+				} else if (bucket < cutoff ||
+				    (bucket == cutoff && *nleft > 0)) {
+					if (bucket == cutoff)
+						(*nleft)--;
+					VERIFY0(ddt_object_remove(ddt, type,
+					    class, &ddlwe->ddlwe_key, tx));
+					ddt_stat_update_lightweight(ddt, ddlwe,
+					    -1ULL);
+					count++;
+				}
+				ddt_exit(ddt);
+			}
+
+			if (count != 0) {
+				ddt_object_sync(ddt, type, class, tx);
+				removed += count;
+			}
+		}
+
+		if (removed != 0) {
+			bcopy(ddt->ddt_histogram, &ddt->ddt_histogram_cache,
+			    sizeof (ddt->ddt_histogram));
+			pruned += removed;
+		}
+	}
+
+	kmem_free(ddlwe, sizeof (ddt_lightweight_entry_t));
+
+	if (pruned != 0)
+		spa->spa_dedup_dspace = ~0ULL;
+
+	return (pruned);
+}
+
+/*
+ * Remove up to count of the oldest unique entries from the DDTs.  Their
+ * blocks stay where they are but are no longer deduplicated: writing the
+ * same data again creates a new entry, and zio_ddt_free() frees them like
+ * any other block.  Entries are ordered by birth txg, sorted into
+ * DDT_PRUNE_BUCKETS buckets so that memory use does not grow with the
+ * size of the table.
+ */
+static uint64_t
+ddt_prune(spa_t *spa, uint64_t count, dmu_tx_t *tx)
+{
+	uint64_t *hist, nleft = count;
+	int cutoff;
+
+	ASSERT(dmu_tx_is_syncing(tx));
+
+	if (count == 0)
+		return (0);
+
+	hist = kmem_zalloc(DDT_PRUNE_BUCKETS * sizeof (uint64_t), KM_SLEEP);
+	(void) ddt_prune_walk(spa, hist, 0, NULL, tx);
+
+	for (cutoff = 0; cutoff < DDT_PRUNE_BUCKETS; cutoff++) {
+		if (hist[cutoff] >= nleft)
+			break;
+		nleft -= hist[cutoff];
+	}
+	kmem_free(hist, DDT_PRUNE_BUCKETS * sizeof (uint64_t));
+
+	return (ddt_prune_walk(spa, NULL, cutoff, &nleft, tx));
+}
+
+/*
+ * Prune the DDT back to just below its quota, leaving some room so that
+ * the tables aren't walked again as soon as a few new entries are added.
+ */
+static void
+ddt_prune_quota(spa_t *spa, dmu_tx_t *tx)
+{
+	uint64_t quota = spa->spa_dedup_table_quota;
+	uint64_t target = quota - (quota >> DDT_PRUNE_QUOTA_SHIFT);
+	uint64_t size = ddt_get_ddt_size(spa);
+
+	(void) ddt_prune(spa, (size - target) / DDT_ENTRY_SIZE + 1, tx);
+}
+
 void
 ddt_sync(spa_t *spa, uint64_t txg)
 {
@@ -1151,6 +1664,9 @@ ddt_sync(spa_t *spa, uint64_t txg)
 		ddt_repair_table(ddt, rio);
 	}
 
+	if (spa_sync_pass(spa) == 1 && ddt_over_quota(spa))
+		ddt_prune_quota(spa, tx);
+
 	(void) zio_wait(rio);
 	scn->scn_zio_root = NULL;
 
@@ -1158,21 +1674,32 @@ ddt_sync(spa_t *spa, uint64_t txg)
 }
 
 int
-ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde)
+ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_lightweight_entry_t *ddlwe)
 {
 	do {
 		do {
 			do {
 				ddt_t *ddt = spa->spa_ddt[ddb->ddb_checksum];
+				boolean_t logged;
 				int error = ENOENT;
-				if (ddt_object_exists(ddt, ddb->ddb_type,
+				while (ddt_object_exists(ddt, ddb->ddb_type,
 				    ddb->ddb_class)) {
 					error = ddt_object_walk(ddt,
 					    ddb->ddb_type, ddb->ddb_class,
-					    &ddb->ddb_cursor, dde);
+					    &ddb->ddb_cursor, ddlwe);
+					/*
+					 * Skip the entries superseded by
+					 * the dedup log.
+					 */
+					if (error != 0 || ddt_log_empty(ddt))
+						break;
+					ddt_enter(ddt);
+					logged = ddt_log_contains(ddt,
+					    &ddlwe->ddlwe_key);
+					ddt_exit(ddt);
+					if (!logged)
+						break;
 				}
-				dde->dde_type = ddb->ddb_type;
-				dde->dde_class = ddb->ddb_class;
 				if (error == 0)
 					return (0);
 				if (error != ENOENT)
@@ -1187,6 +1714,45 @@ ddt_walk(spa_t *spa, ddt_bookmark_t *ddb, ddt_entry_t *dde)
 	return (SET_ERROR(ENOENT));
 }
 
+static void
+ddt_prune_sync(void *arg, dmu_tx_t *tx)
+{
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	uint64_t percentage = *(uint64_t *)arg;
+	uint64_t count = 0, pruned;
+
+	for (enum zio_checksum c = 0; c < ZIO_CHECKSUM_FUNCTIONS; c++) {
+		ddt_t *ddt = spa->spa_ddt[c];
+		if (ddt == NULL)
+			continue;
+		for (enum ddt_type type = 0; type < DDT_TYPES; type++) {
+			count += ddt->ddt_object_stats[type]
+			    [DDT_CLASS_UNIQUE].ddo_count;
+		}
+	}
+
+	pruned = ddt_prune(spa, count * percentage / 100, tx);
+
+	spa_history_log_internal(spa, "ddt prune", tx,
+	    "%llu%% of %llu unique entries, %llu removed",
+	    (u_longlong_t)percentage, (u_longlong_t)count,
+	    (u_longlong_t)pruned);
+}
+
+/*
+ * Remove the given percentage of the unique entries from the DDTs,
+ * oldest first.
+ */
+int
+ddt_prune_unique_entries(spa_t *spa, uint64_t percentage)
+{
+	if (percentage == 0 || percentage > 100)
+		return (SET_ERROR(EINVAL));
+
+	return (dsl_sync_task(spa_name(spa), NULL, ddt_prune_sync,
+	    &percentage, 0, ZFS_SPACE_CHECK_EXTRA_RESERVED));
+}
+
 /* BEGIN CSTYLED */
 ZFS_MODULE_PARAM(zfs, zfs_, dedup_prefetch, INT, ZMOD_RW,
 	"Enable prefetching dedup-ed blks");
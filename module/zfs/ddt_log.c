@@ -0,0 +1,629 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/zfs_context.h>
+#include <sys/spa.h>
+#include <sys/spa_impl.h>
+#include <sys/zio.h>
+#include <sys/ddt.h>
+#include <sys/zap.h>
+#include <sys/dmu_tx.h>
+#include <sys/dsl_pool.h>
+#include <sys/dsl_scan.h>
+#include <sys/zio_checksum.h>
+#include <sys/zfeature.h>
+
+/*
+ * Dedup log.
+ *
+ * Without the log, every DDT entry changed in a txg is written to its
+ * ZAP object in that txg.  Entries are keyed by checksum, so each of them
+ * lands in a random leaf block, and once the DDT no longer fits in the
+ * ARC every txg turns into a stream of random reads and writes of DDT
+ * leaves.
+ *
+ * With the dedup_log feature, ddt_sync() instead appends the changed
+ * entries to a log: a plain object of ddt_log_record_t, written
+ * sequentially.  An in-core AVL tree holds the latest version of every
+ * logged entry, and ddt_lookup() consults it before the ZAP objects.
+ *
+ * Each DDT has two logs.  New entries go to the active log.  Once the
+ * active log has collected zfs_dedup_log_txg_max txgs of changes and the
+ * other log is empty, the two swap roles, and the entries of the now
+ * flushing log are moved into the ZAP objects in key order over the
+ * following txgs, at least zfs_dedup_log_flush_entries_min per txg.  An
+ * entry changed many times while in the log is written to its ZAP object
+ * only once, and the writes of a txg are spread over fewer leaves as
+ * they are sorted.
+ *
+ * An entry which is also in the active log is not flushed: the newer
+ * version will be flushed when its turn comes.  This also guarantees
+ * that the ZAP object recorded as holding the older version of an entry
+ * (dle_zap_type/dle_zap_class) is still accurate when it is flushed.
+ *
+ * The last key flushed is recorded in the header of the flushing log, so
+ * that the entries already moved to the ZAP objects are not loaded again
+ * after an import.  The histograms already account for logged entries in
+ * their target class, so flushing does not change them.
+ */
+
+static kmem_cache_t *ddt_log_entry_cache;
+
+/*
+ * Number of txgs the active log collects before it is flushed.
+ */
+int zfs_dedup_log_txg_max = 8;
+
+/*
+ * Minimum number of entries flushed from the log per txg.
+ */
+int zfs_dedup_log_flush_entries_min = 1000;
+
+static int
+ddt_log_entry_compare(const void *x1, const void *x2)
+{
+	const ddt_log_entry_t *dle1 = x1;
+	const ddt_log_entry_t *dle2 = x2;
+
+	return (ddt_key_compare(&dle1->dle_key, &dle2->dle_key));
+}
+
+static void
+ddt_log_name(ddt_t *ddt, uint_t n, char *name)
+{
+	(void) sprintf(name, DMU_POOL_DDT_LOG,
+	    zio_checksum_table[ddt->ddt_checksum].ci_name, n);
+}
+
+static ddt_log_entry_t *
+ddt_log_find(ddt_log_t *ddl, const ddt_key_t *ddk, avl_index_t *where)
+{
+	ddt_log_entry_t dle_search;
+
+	dle_search.dle_key = *ddk;
+	return (avl_find(&ddl->ddl_tree, &dle_search, where));
+}
+
+static void
+ddt_log_insert(ddt_log_t *ddl, const ddt_log_record_t *dlr)
+{
+	ddt_log_entry_t *dle;
+	avl_index_t where;
+
+	dle = ddt_log_find(ddl, &dlr->dlr_key, &where);
+	if (dle == NULL) {
+		dle = kmem_cache_alloc(ddt_log_entry_cache, KM_SLEEP);
+		dle->dle_key = dlr->dlr_key;
+		avl_insert(&ddl->ddl_tree, dle, where);
+	}
+
+	bcopy(dlr->dlr_phys, dle->dle_phys, sizeof (dle->dle_phys));
+	dle->dle_type = DLR_GET_TYPE(dlr);
+	dle->dle_class = DLR_GET_CLASS(dlr);
+	dle->dle_zap_type = DLR_GET_ZAP_TYPE(dlr);
+	dle->dle_zap_class = DLR_GET_ZAP_CLASS(dlr);
+}
+
+static void
+ddt_log_empty_tree(ddt_log_t *ddl)
+{
+	ddt_log_entry_t *dle;
+	void *cookie = NULL;
+
+	while ((dle = avl_destroy_nodes(&ddl->ddl_tree, &cookie)) != NULL)
+		kmem_cache_free(ddt_log_entry_cache, dle);
+}
+
+static void
+ddt_log_set_flush_rate(ddt_log_t *ddl)
+{
+	ddl->ddl_flush_rate = MAX(zfs_dedup_log_flush_entries_min,
+	    howmany(avl_numnodes(&ddl->ddl_tree),
+	    MAX(zfs_dedup_log_txg_max, 1)));
+}
+
+static void
+ddt_log_sync_header(ddt_t *ddt, ddt_log_t *ddl, dmu_tx_t *tx)
+{
+	ddt_log_header_t *dlh;
+	dmu_buf_t *db;
+
+	VERIFY0(dmu_bonus_hold(ddt->ddt_os, ddl->ddl_object, FTAG, &db));
+	dmu_buf_will_dirty(db, tx);
+	dlh = db->db_data;
+	dlh->dlh_flags = ddl->ddl_flags;
+	dlh->dlh_length = ddl->ddl_length;
+	dlh->dlh_first_txg = ddl->ddl_first_txg;
+	dlh->dlh_checkpoint = ddl->ddl_checkpoint;
+	dmu_buf_rele(db, FTAG);
+}
+
+boolean_t
+ddt_log_exists(ddt_t *ddt)
+{
+	return (ddt->ddt_log_active->ddl_object != 0);
+}
+
+boolean_t
+ddt_log_empty(ddt_t *ddt)
+{
+	return (avl_numnodes(&ddt->ddt_log_active->ddl_tree) == 0 &&
+	    avl_numnodes(&ddt->ddt_log_flushing->ddl_tree) == 0);
+}
+
+boolean_t
+ddt_log_contains(ddt_t *ddt, const ddt_key_t *ddk)
+{
+	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
+
+	return (ddt_log_find(ddt->ddt_log_active, ddk, NULL) != NULL ||
+	    ddt_log_find(ddt->ddt_log_flushing, ddk, NULL) != NULL);
+}
+
+static void
+ddt_log_entry_to_dde(const ddt_log_entry_t *dle, ddt_entry_t *dde)
+{
+	dde->dde_key = dle->dle_key;
+	ddt_entry_set_phys(dde, dle->dle_phys);
+	dde->dde_type = dle->dle_type;
+	dde->dde_class = dle->dle_class;
+	dde->dde_zap_type = dle->dle_zap_type;
+	dde->dde_zap_class = dle->dle_zap_class;
+}
+
+static void
+ddt_log_entry_to_lightweight(const ddt_log_entry_t *dle,
+    ddt_lightweight_entry_t *ddlwe)
+{
+	ddlwe->ddlwe_key = dle->dle_key;
+	bcopy(dle->dle_phys, ddlwe->ddlwe_phys, sizeof (ddlwe->ddlwe_phys));
+	ddlwe->ddlwe_type = dle->dle_type;
+	ddlwe->ddlwe_class = dle->dle_class;
+}
+
+/*
+ * Fill in the newest logged version of the entry.  Returns B_FALSE if
+ * the entry is not in the log, in which case the ZAP objects hold its
+ * current version.  A tombstone is returned with dde_type set to
+ * DDT_TYPES.
+ */
+boolean_t
+ddt_log_lookup(ddt_t *ddt, ddt_entry_t *dde)
+{
+	ddt_log_entry_t *dle;
+
+	ASSERT(MUTEX_HELD(&ddt->ddt_lock));
+
+	dle = ddt_log_find(ddt->ddt_log_active, &dde->dde_key, NULL);
+	if (dle == NULL)
+		dle = ddt_log_find(ddt->ddt_log_flushing, &dde->dde_key, NULL);
+	if (dle == NULL)
+		return (B_FALSE);
+
+	ddt_log_entry_to_dde(dle, dde);
+	return (B_TRUE);
+}
+
+static ddt_log_entry_t *
+ddt_log_next(ddt_log_t *ddl, const ddt_key_t *ddk)
+{
+	ddt_log_entry_t *dle;
+	avl_index_t where;
+
+	if (ddk == NULL)
+		return (avl_first(&ddl->ddl_tree));
+
+	dle = ddt_log_find(ddl, ddk, &where);
+	if (dle != NULL)
+		return (AVL_NEXT(&ddl->ddl_tree, dle));
+	return (avl_nearest(&ddl->ddl_tree, where, AVL_AFTER));
+}
+
+/*
+ * Walk the newest version of every logged entry, tombstones included, in
+ * key order.  *walk must be zero for the first call; afterwards the key
+ * of the previous entry in ddlwe is the cursor.
+ */
+int
+ddt_log_walk(ddt_t *ddt, uint64_t *walk, ddt_lightweight_entry_t *ddlwe)
+{
+	const ddt_key_t *ddk = (*walk == 0) ? NULL : &ddlwe->ddlwe_key;
+	ddt_log_entry_t *dle, *fdle;
+
+	ddt_enter(ddt);
+	dle = ddt_log_next(ddt->ddt_log_active, ddk);
+	fdle = ddt_log_next(ddt->ddt_log_flushing, ddk);
+	if (dle == NULL || (fdle != NULL &&
+	    ddt_key_compare(&fdle->dle_key, &dle->dle_key) < 0))
+		dle = fdle;
+	if (dle != NULL)
+		ddt_log_entry_to_lightweight(dle, ddlwe);
+	ddt_exit(ddt);
+
+	if (dle == NULL)
+		return (SET_ERROR(ENOENT));
+
+	*walk = 1;
+	return (0);
+}
+
+void
+ddt_log_alloc(ddt_t *ddt)
+{
+	for (int n = 0; n < 2; n++) {
+		ddt_log_t *ddl = &ddt->ddt_log[n];
+
+		avl_create(&ddl->ddl_tree, ddt_log_entry_compare,
+		    sizeof (ddt_log_entry_t),
+		    offsetof(ddt_log_entry_t, dle_node));
+	}
+
+	ddt->ddt_log_active = &ddt->ddt_log[0];
+	ddt->ddt_log_flushing = &ddt->ddt_log[1];
+	ddt->ddt_log_flushing->ddl_flags = DDT_LOG_FLAG_FLUSHING;
+}
+
+void
+ddt_log_free(ddt_t *ddt)
+{
+	ASSERT3P(ddt->ddt_log_buf, ==, NULL);
+
+	for (int n = 0; n < 2; n++) {
+		ddt_log_t *ddl = &ddt->ddt_log[n];
+
+		ddt_log_empty_tree(ddl);
+		avl_destroy(&ddl->ddl_tree);
+	}
+}
+
+static int
+ddt_log_load_one(ddt_t *ddt, ddt_log_t *ddl, uint_t n)
+{
+	ddt_log_header_t dlh;
+	ddt_log_record_t *dlr, *buf;
+	dmu_buf_t *db;
+	uint64_t bufsize = DDT_LOG_BUF_RECORDS * sizeof (ddt_log_record_t);
+	char name[DDT_NAMELEN];
+	int error;
+
+	ddt_log_name(ddt, n, name);
+	error = zap_lookup(ddt->ddt_os, DMU_POOL_DIRECTORY_OBJECT, name,
+	    sizeof (uint64_t), 1, &ddl->ddl_object);
+	if (error != 0)
+		return (error);
+
+	error = dmu_bonus_hold(ddt->ddt_os, ddl->ddl_object, FTAG, &db);
+	if (error != 0)
+		return (error);
+	bcopy(db->db_data, &dlh, sizeof (dlh));
+	dmu_buf_rele(db, FTAG);
+
+	ddl->ddl_flags = dlh.dlh_flags;
+	ddl->ddl_length = dlh.dlh_length;
+	ddl->ddl_first_txg = dlh.dlh_first_txg;
+	ddl->ddl_checkpoint = dlh.dlh_checkpoint;
+
+	buf = vmem_alloc(bufsize, KM_SLEEP);
+	for (uint64_t off = 0; off < ddl->ddl_length; off += bufsize) {
+		uint64_t len = MIN(bufsize, ddl->ddl_length - off);
+
+		error = dmu_read(ddt->ddt_os, ddl->ddl_object, off, len, buf,
+		    DMU_READ_PREFETCH);
+		if (error != 0)
+			break;
+
+		for (dlr = buf; (char *)dlr < (char *)buf + len; dlr++) {
+			/* Skip what was already flushed to the ZAP objects. */
+			if ((ddl->ddl_flags & DDT_LOG_FLAG_CHECKPOINT) &&
+			    ddt_key_compare(&dlr->dlr_key,
+			    &ddl->ddl_checkpoint) <= 0)
+				continue;
+			ddt_log_insert(ddl, dlr);
+		}
+	}
+	vmem_free(buf, bufsize);
+
+	return (error);
+}
+
+int
+ddt_log_load(ddt_t *ddt)
+{
+	int error;
+
+	for (uint_t n = 0; n < 2; n++) {
+		error = ddt_log_load_one(ddt, &ddt->ddt_log[n], n);
+		if (error == ENOENT && n == 0)
+			return (0);
+		if (error != 0)
+			return (error);
+	}
+
+	if (ddt->ddt_log[0].ddl_flags & DDT_LOG_FLAG_FLUSHING) {
+		ddt->ddt_log_active = &ddt->ddt_log[1];
+		ddt->ddt_log_flushing = &ddt->ddt_log[0];
+	}
+	ddt_log_set_flush_rate(ddt->ddt_log_flushing);
+
+	return (0);
+}
+
+void
+ddt_log_create(ddt_t *ddt, dmu_tx_t *tx)
+{
+	char name[DDT_NAMELEN];
+
+	ASSERT(!ddt_log_exists(ddt));
+
+	for (uint_t n = 0; n < 2; n++) {
+		ddt_log_t *ddl = &ddt->ddt_log[n];
+
+		ddl->ddl_object = dmu_object_alloc(ddt->ddt_os,
+		    DMU_OTN_UINT64_METADATA, SPA_OLD_MAXBLOCKSIZE,
+		    DMU_OTN_UINT64_METADATA, sizeof (ddt_log_header_t), tx);
+
+		ddt_log_name(ddt, n, name);
+		VERIFY0(zap_add(ddt->ddt_os, DMU_POOL_DIRECTORY_OBJECT, name,
+		    sizeof (uint64_t), 1, &ddl->ddl_object, tx));
+		ddt_log_sync_header(ddt, ddl, tx);
+	}
+
+	spa_feature_incr(ddt->ddt_spa, SPA_FEATURE_DEDUP_LOG, tx);
+}
+
+void
+ddt_log_destroy(ddt_t *ddt, dmu_tx_t *tx)
+{
+	char name[DDT_NAMELEN];
+
+	ASSERT(ddt_log_exists(ddt));
+	ASSERT(ddt_log_empty(ddt));
+
+	for (uint_t n = 0; n < 2; n++) {
+		ddt_log_t *ddl = &ddt->ddt_log[n];
+
+		ddt_log_name(ddt, n, name);
+		VERIFY0(zap_remove(ddt->ddt_os, DMU_POOL_DIRECTORY_OBJECT,
+		    name, tx));
+		VERIFY0(dmu_object_free(ddt->ddt_os, ddl->ddl_object, tx));
+
+		ddl->ddl_object = 0;
+		ddl->ddl_length = 0;
+		ddl->ddl_first_txg = 0;
+		ddl->ddl_flags &= DDT_LOG_FLAG_FLUSHING;
+	}
+
+	spa_feature_decr(ddt->ddt_spa, SPA_FEATURE_DEDUP_LOG, tx);
+}
+
+static void
+ddt_log_write(ddt_t *ddt, dmu_tx_t *tx)
+{
+	ddt_log_t *ddl = ddt->ddt_log_active;
+	uint64_t size = ddt->ddt_log_buf_count * sizeof (ddt_log_record_t);
+
+	if (size == 0)
+		return;
+
+	dmu_write(ddt->ddt_os, ddl->ddl_object, ddl->ddl_length, size,
+	    ddt->ddt_log_buf, tx);
+	ddl->ddl_length += size;
+	ddt->ddt_log_buf_count = 0;
+}
+
+/*
+ * Append the entry to the active log.  Called by ddt_sync_entry() in
+ * place of writing the entry to its ZAP object; dde_type is DDT_TYPES
+ * if the entry's last reference is gone.
+ */
+void
+ddt_log_entry(ddt_t *ddt, ddt_entry_t *dde, dmu_tx_t *tx)
+{
+	ddt_log_t *ddl = ddt->ddt_log_active;
+	ddt_log_record_t *dlr;
+
+	/*
+	 * An entry which is in neither the log nor the ZAP objects can
+	 * simply be forgotten once it goes away.
+	 */
+	if (dde->dde_type == DDT_TYPES && dde->dde_zap_type == DDT_TYPES) {
+		boolean_t logged;
+
+		ddt_enter(ddt);
+		logged = ddt_log_contains(ddt, &dde->dde_key);
+		ddt_exit(ddt);
+		if (!logged)
+			return;
+	}
+
+	if (ddt->ddt_log_buf == NULL) {
+		ddt->ddt_log_buf = vmem_alloc(DDT_LOG_BUF_RECORDS *
+		    sizeof (ddt_log_record_t), KM_SLEEP);
+	}
+
+	dlr = (ddt_log_record_t *)ddt->ddt_log_buf + ddt->ddt_log_buf_count;
+	dlr->dlr_key = dde->dde_key;
+	dlr->dlr_info = 0;
+	DLR_SET_TYPE(dlr, dde->dde_type);
+	DLR_SET_CLASS(dlr, dde->dde_class);
+	DLR_SET_ZAP_TYPE(dlr, dde->dde_zap_type);
+	DLR_SET_ZAP_CLASS(dlr, dde->dde_zap_class);
+	ddt_entry_get_phys(dde, dlr->dlr_phys);
+
+	ddt_enter(ddt);
+	ddt_log_insert(ddl, dlr);
+	ddt_exit(ddt);
+
+	if (ddl->ddl_first_txg == 0)
+		ddl->ddl_first_txg = tx->tx_txg;
+
+	if (++ddt->ddt_log_buf_count == DDT_LOG_BUF_RECORDS)
+		ddt_log_write(ddt, tx);
+}
+
+/*
+ * Write out the records collected by ddt_log_entry().
+ */
+void
+ddt_log_commit(ddt_t *ddt, dmu_tx_t *tx)
+{
+	if (ddt->ddt_log_buf == NULL)
+		return;
+
+	ddt_log_write(ddt, tx);
+	vmem_free(ddt->ddt_log_buf,
+	    DDT_LOG_BUF_RECORDS * sizeof (ddt_log_record_t));
+	ddt->ddt_log_buf = NULL;
+
+	ddt_log_sync_header(ddt, ddt->ddt_log_active, tx);
+}
+
+static void
+ddt_log_swap(ddt_t *ddt, dmu_tx_t *tx)
+{
+	ddt_log_t *ddl = ddt->ddt_log_active;
+
+	ASSERT0(avl_numnodes(&ddt->ddt_log_flushing->ddl_tree));
+	ASSERT0(ddt->ddt_log_flushing->ddl_length);
+
+	ddt_enter(ddt);
+	ddt->ddt_log_active = ddt->ddt_log_flushing;
+	ddt->ddt_log_flushing = ddl;
+	ddt_exit(ddt);
+
+	ddt->ddt_log_active->ddl_flags = 0;
+	ddt->ddt_log_active->ddl_first_txg = 0;
+	ddl->ddl_flags = DDT_LOG_FLAG_FLUSHING;
+	ddt_log_set_flush_rate(ddl);
+
+	ddt_log_sync_header(ddt, ddt->ddt_log_active, tx);
+}
+
+static void
+ddt_log_flush_entry(ddt_t *ddt, ddt_log_entry_t *dle,
+    ddt_lightweight_entry_t *ddlwe, dmu_tx_t *tx)
+{
+	dsl_scan_t *scn = ddt->ddt_spa->spa_dsl_pool->dp_scan;
+	enum ddt_type type = dle->dle_type;
+	enum ddt_class class = dle->dle_class;
+	enum ddt_type ztype = dle->dle_zap_type;
+	enum ddt_class zclass = dle->dle_zap_class;
+
+	ddt_log_entry_to_lightweight(dle, ddlwe);
+
+	if (ztype != DDT_TYPES && (ztype != type || zclass != class) &&
+	    ddt_object_exists(ddt, ztype, zclass)) {
+		int error = ddt_object_remove(ddt, ztype, zclass,
+		    &ddlwe->ddlwe_key, tx);
+		VERIFY(error == 0 || error == ENOENT);
+	}
+
+	if (type == DDT_TYPES)
+		return;
+
+	VERIFY0(ddt_object_update(ddt, type, class, &ddlwe->ddlwe_key,
+	    ddlwe->ddlwe_phys, tx));
+
+	/*
+	 * ddt_walk() skipped the entry while it was in the log, and from
+	 * now on the scan's traversal skips its blocks, so scan it now.
+	 */
+	if (class <= scn->scn_phys.scn_ddt_class_max)
+		dsl_scan_ddt_entry(scn, ddt->ddt_checksum, ddlwe, tx);
+}
+
+/*
+ * Move the next batch of entries from the flushing log to the ZAP
+ * objects, swapping the logs first if the flushing one is empty and the
+ * active one has collected enough txgs of changes.
+ */
+void
+ddt_log_flush(ddt_t *ddt, dmu_tx_t *tx)
+{
+	ddt_log_t *ddl = ddt->ddt_log_flushing;
+	ddt_log_t *active = ddt->ddt_log_active;
+	ddt_log_entry_t *dle;
+	ddt_lightweight_entry_t *ddlwe;
+	uint64_t count;
+
+	ASSERT(ddt_log_exists(ddt));
+
+	if (avl_numnodes(&ddl->ddl_tree) == 0) {
+		if (avl_numnodes(&active->ddl_tree) == 0 ||
+		    tx->tx_txg < active->ddl_first_txg + zfs_dedup_log_txg_max)
+			return;
+		ddt_log_swap(ddt, tx);
+		ddl = ddt->ddt_log_flushing;
+		active = ddt->ddt_log_active;
+	}
+
+	ddlwe = kmem_zalloc(sizeof (ddt_lightweight_entry_t), KM_SLEEP);
+	for (count = 0; count < ddl->ddl_flush_rate &&
+	    (dle = avl_first(&ddl->ddl_tree)) != NULL; count++) {
+		if (ddt_log_find(active, &dle->dle_key, NULL) == NULL)
+			ddt_log_flush_entry(ddt, dle, ddlwe, tx);
+
+		ddl->ddl_checkpoint = dle->dle_key;
+		ddl->ddl_flags |= DDT_LOG_FLAG_CHECKPOINT;
+
+		/*
+		 * The ZAP objects are up to date, so lookups may now
+		 * miss the entry in the log.
+		 */
+		ddt_enter(ddt);
+		avl_remove(&ddl->ddl_tree, dle);
+		ddt_exit(ddt);
+		kmem_cache_free(ddt_log_entry_cache, dle);
+	}
+	kmem_free(ddlwe, sizeof (ddt_lightweight_entry_t));
+
+	if (avl_numnodes(&ddl->ddl_tree) == 0) {
+		VERIFY0(dmu_free_range(ddt->ddt_os, ddl->ddl_object, 0,
+		    DMU_OBJECT_END, tx));
+		ddl->ddl_length = 0;
+		ddl->ddl_first_txg = 0;
+		ddl->ddl_flags &= ~DDT_LOG_FLAG_CHECKPOINT;
+		bzero(&ddl->ddl_checkpoint, sizeof (ddt_key_t));
+	}
+
+	ddt_log_sync_header(ddt, ddl, tx);
+}
+
+void
+ddt_log_init(void)
+{
+	ddt_log_entry_cache = kmem_cache_create("ddt_log_entry_cache",
+	    sizeof (ddt_log_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
+}
+
+void
+ddt_log_fini(void)
+{
+	kmem_cache_destroy(ddt_log_entry_cache);
+}
+
+/* BEGIN CSTYLED */
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, log_txg_max, INT, ZMOD_RW,
+	"Number of txgs the dedup log collects before it is flushed");
+
+ZFS_MODULE_PARAM(zfs_dedup, zfs_dedup_, log_flush_entries_min, INT, ZMOD_RW,
+	"Minimum number of dedup log entries flushed per txg");
+/* END CSTYLED */
@@ -56,63 +56,67 @@ ddt_zap_destroy(objset_t *os, uint64_t object, dmu_tx_t *tx)
 }
 
 static int
-ddt_zap_lookup(objset_t *os, uint64_t object, ddt_entry_t *dde)
+ddt_zap_lookup(objset_t *os, uint64_t object, const ddt_key_t *ddk,
+    ddt_phys_t *phys)
 {
 	uchar_t *cbuf;
 	uint64_t one, csize;
 	int error;
 
-	cbuf = kmem_alloc(sizeof (dde->dde_phys) + 1, KM_SLEEP);
+	cbuf = kmem_alloc(DDT_PHYS_SIZE + 1, KM_SLEEP);
 
-	error = zap_length_uint64(os, object, (uint64_t *)&dde->dde_key,
+	error = zap_length_uint64(os, object, (uint64_t *)ddk,
 	    DDT_KEY_WORDS, &one, &csize);
 	if (error)
 		goto out;
 
 	ASSERT(one == 1);
-	ASSERT(csize <= (sizeof (dde->dde_phys) + 1));
+	ASSERT(csize <= (DDT_PHYS_SIZE + 1));
 
-	error = zap_lookup_uint64(os, object, (uint64_t *)&dde->dde_key,
+	error = zap_lookup_uint64(os, object, (uint64_t *)ddk,
 	    DDT_KEY_WORDS, 1, csize, cbuf);
 	if (error)
 		goto out;
 
-	ddt_decompress(cbuf, dde->dde_phys, csize, sizeof (dde->dde_phys));
+	ddt_decompress(cbuf, phys, csize, DDT_PHYS_SIZE);
 out:
-	kmem_free(cbuf, sizeof (dde->dde_phys) + 1);
+	kmem_free(cbuf, DDT_PHYS_SIZE + 1);
 
 	return (error);
 }
 
 static void
-ddt_zap_prefetch(objset_t *os, uint64_t object, ddt_entry_t *dde)
+ddt_zap_prefetch(objset_t *os, uint64_t object, const ddt_key_t *ddk)
 {
-	(void) zap_prefetch_uint64(os, object, (uint64_t *)&dde->dde_key,
+	(void) zap_prefetch_uint64(os, object, (uint64_t *)ddk,
 	    DDT_KEY_WORDS);
 }
 
 static int
-ddt_zap_update(objset_t *os, uint64_t object, ddt_entry_t *dde, dmu_tx_t *tx)
+ddt_zap_update(objset_t *os, uint64_t object, const ddt_key_t *ddk,
+    const ddt_phys_t *phys, dmu_tx_t *tx)
 {
-	uchar_t cbuf[sizeof (dde->dde_phys) + 1];
+	uchar_t cbuf[DDT_PHYS_SIZE + 1];
 	uint64_t csize;
 
-	csize = ddt_compress(dde->dde_phys, cbuf,
-	    sizeof (dde->dde_phys), sizeof (cbuf));
+	csize = ddt_compress((void *)phys, cbuf, DDT_PHYS_SIZE,
+	    sizeof (cbuf));
 
-	return (zap_update_uint64(os, object, (uint64_t *)&dde->dde_key,
+	return (zap_update_uint64(os, object, (uint64_t *)ddk,
 	    DDT_KEY_WORDS, 1, csize, cbuf, tx));
 }
 
 static int
-ddt_zap_remove(objset_t *os, uint64_t object, ddt_entry_t *dde, dmu_tx_t *tx)
+ddt_zap_remove(objset_t *os, uint64_t object, const ddt_key_t *ddk,
+    dmu_tx_t *tx)
 {
-	return (zap_remove_uint64(os, object, (uint64_t *)&dde->dde_key,
+	return (zap_remove_uint64(os, object, (uint64_t *)ddk,
 	    DDT_KEY_WORDS, tx));
 }
 
 static int
-ddt_zap_walk(objset_t *os, uint64_t object, ddt_entry_t *dde, uint64_t *walk)
+ddt_zap_walk(objset_t *os, uint64_t object, ddt_key_t *ddk, ddt_phys_t *phys,
+    uint64_t *walk)
 {
 	zap_cursor_t zc;
 	zap_attribute_t za;
@@ -131,16 +135,15 @@ ddt_zap_walk(objset_t *os, uint64_t object, ddt_entry_t *dde, uint64_t *walk)
 		zap_cursor_init_serialized(&zc, os, object, *walk);
 	}
 	if ((error = zap_cursor_retrieve(&zc, &za)) == 0) {
-		uchar_t cbuf[sizeof (dde->dde_phys) + 1];
+		uchar_t cbuf[DDT_PHYS_SIZE + 1];
 		uint64_t csize = za.za_num_integers;
 		ASSERT(za.za_integer_length == 1);
 		error = zap_lookup_uint64(os, object, (uint64_t *)za.za_name,
 		    DDT_KEY_WORDS, 1, csize, cbuf);
 		ASSERT(error == 0);
 		if (error == 0) {
-			ddt_decompress(cbuf, dde->dde_phys, csize,
-			    sizeof (dde->dde_phys));
-			dde->dde_key = *(ddt_key_t *)za.za_name;
+			ddt_decompress(cbuf, phys, csize, DDT_PHYS_SIZE);
+			*ddk = *(ddt_key_t *)za.za_name;
 		}
 		zap_cursor_advance(&zc);
 		*walk = zap_cursor_serialize(&zc);
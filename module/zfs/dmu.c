@@ -1163,6 +1163,140 @@ dmu_redact(objset_t *os, uint64_t object, uint64_t offset, uint64_t size,
 	dmu_buf_rele_array(dbp, numbufs, FTAG);
 }
 
+/*
+ * Return the block pointers of the level 0 blocks in the given range of
+ * the object, for dmu_brt_clone().  Blocks which are not allocated are
+ * returned as holes.  Returns EAGAIN if a block is dirty, in which case
+ * the caller may retry after waiting for the txg to sync, and
+ * EOPNOTSUPP if a block cannot be cloned.
+ */
+int
+dmu_read_l0_bps(objset_t *os, uint64_t object, uint64_t offset,
+    uint64_t length, blkptr_t *bps, size_t *nbpsp)
+{
+	dmu_buf_t **dbp;
+	dnode_t *dn;
+	int numbufs, error;
+
+	error = dmu_buf_hold_array(os, object, offset, length, FALSE, FTAG,
+	    &numbufs, &dbp);
+	if (error != 0)
+		return (error);
+
+	for (int i = 0; i < numbufs; i++) {
+		dmu_buf_impl_t *db = (dmu_buf_impl_t *)dbp[i];
+		blkptr_t *bp = &bps[i];
+
+		mutex_enter(&db->db_mtx);
+		if (db->db_last_dirty != NULL) {
+			mutex_exit(&db->db_mtx);
+			error = SET_ERROR(EAGAIN);
+			break;
+		}
+
+		DB_DNODE_ENTER(db);
+		dn = DB_DNODE(db);
+		if (db->db_blkptr == NULL ||
+		    dnode_block_freed(dn, db->db_blkid)) {
+			BP_ZERO(bp);
+		} else {
+			*bp = *db->db_blkptr;
+		}
+		DB_DNODE_EXIT(db);
+		mutex_exit(&db->db_mtx);
+
+		if (BP_IS_HOLE(bp) || BP_IS_EMBEDDED(bp))
+			continue;
+
+		/*
+		 * The BRT does not know about dedup, and the encryption
+		 * parameters of a block are tied to its dataset.
+		 */
+		if (BP_GET_DEDUP(bp) || BP_IS_PROTECTED(bp) ||
+		    DMU_OT_IS_METADATA(BP_GET_TYPE(bp))) {
+			error = SET_ERROR(EOPNOTSUPP);
+			break;
+		}
+	}
+
+	if (error == 0)
+		*nbpsp = numbufs;
+	dmu_buf_rele_array(dbp, numbufs, FTAG);
+
+	return (error);
+}
+
+/*
+ * Copy the block, for when the destination dbuf cannot take the clone.
+ */
+static int
+dmu_brt_copy(dmu_buf_t *db, const blkptr_t *bp, dmu_tx_t *tx)
+{
+	spa_t *spa = dmu_objset_spa(((dmu_buf_impl_t *)db)->db_objset);
+	void *buf;
+	int error = 0;
+
+	buf = zio_buf_alloc(db->db_size);
+	if (BP_IS_HOLE(bp)) {
+		bzero(buf, db->db_size);
+	} else {
+		abd_t *abd = abd_get_from_buf(buf, db->db_size);
+
+		error = zio_wait(zio_read(NULL, spa, bp, abd, db->db_size,
+		    NULL, NULL, ZIO_PRIORITY_SYNC_READ, ZIO_FLAG_CANFAIL,
+		    NULL));
+		abd_put(abd);
+	}
+
+	if (error == 0) {
+		dmu_buf_will_fill(db, tx);
+		bcopy(buf, db->db_data, db->db_size);
+		dmu_buf_fill_done(db, tx);
+	}
+	zio_buf_free(buf, db->db_size);
+
+	return (error);
+}
+
+/*
+ * Make the given range of the object reference the blocks returned by
+ * dmu_read_l0_bps(), which must have the same block size.  Blocks held
+ * by someone else are copied instead.
+ */
+int
+dmu_brt_clone(objset_t *os, uint64_t object, uint64_t offset,
+    uint64_t length, dmu_tx_t *tx, const blkptr_t *bps, size_t nbps)
+{
+	dmu_buf_t **dbp;
+	int numbufs, error;
+
+	ASSERT(spa_feature_is_enabled(dmu_objset_spa(os),
+	    SPA_FEATURE_BLOCK_CLONING));
+
+	error = dmu_buf_hold_array(os, object, offset, length, FALSE, FTAG,
+	    &numbufs, &dbp);
+	if (error != 0)
+		return (error);
+	VERIFY3U(nbps, ==, numbufs);
+
+	for (int i = 0; i < numbufs && error == 0; i++) {
+		const blkptr_t *bp = &bps[i];
+
+		if (!BP_IS_HOLE(bp) &&
+		    BP_GET_LSIZE(bp) != dbp[i]->db_size) {
+			error = SET_ERROR(EINVAL);
+			break;
+		}
+
+		error = dmu_buf_clone(dbp[i], bp, tx);
+		if (error == EBUSY)
+			error = dmu_brt_copy(dbp[i], bp, tx);
+	}
+	dmu_buf_rele_array(dbp, numbufs, FTAG);
+
+	return (error);
+}
+
 /*
  * DMU support for xuio
  */
@@ -1791,6 +1925,16 @@ dmu_sync_late_arrival(zio_t *pio, objset_t *os, dmu_sync_cb_t *done, zgd_t *zgd,
 {
 	dmu_sync_arg_t *dsa;
 	dmu_tx_t *tx;
+	int err;
+
+	/*
+	 * zl_get_data() may hold the dbuf without reading it in, but we
+	 * are about to write out its current contents.
+	 */
+	err = dbuf_read((dmu_buf_impl_t *)zgd->zgd_db, NULL,
+	    DB_RF_CANFAIL | DB_RF_NOPREFETCH);
+	if (err != 0)
+		return (err);
 
 	tx = dmu_tx_create(os);
 	dmu_tx_hold_space(tx, zgd->zgd_db->db_size);
@@ -1983,6 +2127,28 @@ dmu_sync(zio_t *pio, uint64_t txg, dmu_sync_cb_t *done, zgd_t *zgd)
 	DB_DNODE_EXIT(db);
 
 	ASSERT(dr->dr_txg == txg);
+	if (dr->dt.dl.dr_brtwrite) {
+		/*
+		 * A clone's block is not ours to log; the caller has to
+		 * wait for the txg to sync instead.
+		 */
+		mutex_exit(&db->db_mtx);
+		return (SET_ERROR(EIO));
+	}
+
+	if (dr->dt.dl.dr_override_state == DR_OVERRIDDEN &&
+	    dr->dt.dl.dr_diowrite) {
+		/*
+		 * The data was already written by Direct I/O in this txg;
+		 * log its block pointer instead of writing it again.
+		 */
+		*zgd->zgd_bp = dr->dt.dl.dr_overridden_by;
+		mutex_exit(&db->db_mtx);
+		zil_lwb_add_block(zgd->zgd_lwb, zgd->zgd_bp);
+		done(zgd, 0);
+		return (0);
+	}
+
 	if (dr->dt.dl.dr_override_state == DR_IN_DMU_SYNC ||
 	    dr->dt.dl.dr_override_state == DR_OVERRIDDEN) {
 		/*
@@ -2111,6 +2277,7 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 	    (wp & WP_SPILL));
 	enum zio_checksum checksum = os->os_checksum;
 	enum zio_compress compress = os->os_compress;
+	uint8_t complevel = os->os_complevel;
 	enum zio_checksum dedup_checksum = os->os_dedup_checksum;
 	boolean_t dedup = B_FALSE;
 	boolean_t nopwrite = B_FALSE;
@@ -2167,6 +2334,8 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 	} else {
 		compress = zio_compress_select(os->os_spa, dn->dn_compress,
 		    compress);
+		complevel = zio_complevel_select(os->os_spa, compress,
+		    complevel, complevel);
 
 		checksum = (dedup_checksum == ZIO_CHECKSUM_OFF) ?
 		    zio_checksum_select(dn->dn_checksum, checksum) :
@@ -2225,6 +2394,7 @@ dmu_write_policy(objset_t *os, dnode_t *dn, int level, int wp, zio_prop_t *zp)
 	}
 
 	zp->zp_compress = compress;
+	zp->zp_complevel = complevel;
 	zp->zp_checksum = checksum;
 	zp->zp_type = (wp & WP_SPILL) ? dn->dn_bonustype : type;
 	zp->zp_level = level;
@@ -2504,6 +2674,7 @@ EXPORT_SYMBOL(dmu_return_arcbuf);
 EXPORT_SYMBOL(dmu_assign_arcbuf_by_dnode);
 EXPORT_SYMBOL(dmu_assign_arcbuf_by_dbuf);
 EXPORT_SYMBOL(dmu_buf_hold);
+EXPORT_SYMBOL(dmu_buf_hold_noread);
 EXPORT_SYMBOL(dmu_ot);
 
 /* BEGIN CSTYLED */
@@ -0,0 +1,267 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/dmu.h>
+#include <sys/dmu_impl.h>
+#include <sys/dmu_objset.h>
+#include <sys/dmu_tx.h>
+#include <sys/dbuf.h>
+#include <sys/dnode.h>
+#include <sys/zio.h>
+#include <sys/abd.h>
+
+/*
+ * Direct I/O moves whole blocks between the caller's buffer and disk
+ * without going through the ARC.  Writes are issued straight from the
+ * caller's buffer (the zio pipeline still compresses and checksums the
+ * data into its own buffers as needed) and the resulting block pointer
+ * is handed to the dbuf as an override, much like dmu_sync() does for
+ * the ZIL.  Reads of blocks which have no cached or dirty copy are
+ * issued straight into the caller's buffer.  Everything else, such as
+ * blocks which are cached, dirty, embedded or encrypted, is copied
+ * through the dbuf as usual so that the two paths stay coherent.
+ *
+ * The caller must hold a range lock covering the whole request, and the
+ * request must start and end on dn_datablksz boundaries.  Since the
+ * caller's buffer is handed to the vdevs as is, it must also be aligned
+ * to SPA_MINBLOCKSIZE (the vectorized raidz code relies on this); other
+ * buffers are refused with ENOTSUP.
+ */
+
+typedef struct dmu_direct_arg {
+	blkptr_t	dda_bp;
+	dmu_buf_impl_t	*dda_db;
+	uint64_t	dda_size;
+	int		dda_error;
+} dmu_direct_arg_t;
+
+static void
+dmu_direct_read_done(zio_t *zio)
+{
+	abd_put(zio->io_abd);
+}
+
+/*
+ * Decide whether the contents of db can be read straight from disk, and
+ * if so return the block pointer to read.  The caller holds db_mtx.
+ */
+static boolean_t
+dmu_direct_read_bp(dnode_t *dn, dmu_buf_impl_t *db, blkptr_t *bp)
+{
+	dbuf_dirty_record_t *dr = db->db_last_dirty;
+
+	ASSERT(MUTEX_HELD(&db->db_mtx));
+
+	if (db->db_state == DB_NOFILL && dr != NULL && dr->dt.dl.dr_diowrite) {
+		*bp = dr->dt.dl.dr_overridden_by;
+	} else if (db->db_state == DB_UNCACHED && dr == NULL) {
+		if (db->db_blkptr == NULL ||
+		    dnode_block_freed(dn, db->db_blkid)) {
+			BP_ZERO(bp);
+		} else {
+			*bp = *db->db_blkptr;
+		}
+	} else {
+		return (B_FALSE);
+	}
+
+	if (BP_IS_HOLE(bp))
+		return (B_TRUE);
+
+	return (!BP_IS_EMBEDDED(bp) && !BP_IS_PROTECTED(bp) &&
+	    !BP_IS_REDACTED(bp) && BP_GET_LSIZE(bp) == db->db.db_size);
+}
+
+int
+dmu_read_direct(dnode_t *dn, uint64_t offset, uint64_t size, void *buf)
+{
+	spa_t *spa = dn->dn_objset->os_spa;
+	uint64_t blksz = dn->dn_datablksz;
+	zio_t *rio;
+	int err = 0;
+
+	ASSERT0(offset % blksz);
+	ASSERT0(size % blksz);
+
+	if (!IS_P2ALIGNED(buf, SPA_MINBLOCKSIZE))
+		return (SET_ERROR(ENOTSUP));
+
+	rio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	rw_enter(&dn->dn_struct_rwlock, RW_READER);
+
+	for (uint64_t off = 0; off < size && err == 0; off += blksz) {
+		uint64_t blkid = dbuf_whichblock(dn, 0, offset + off);
+		char *data = (char *)buf + off;
+		zbookmark_phys_t zb;
+		dmu_buf_impl_t *db;
+		blkptr_t bp;
+		boolean_t direct;
+
+		db = dbuf_hold(dn, blkid, FTAG);
+		if (db == NULL) {
+			err = SET_ERROR(EIO);
+			break;
+		}
+
+		mutex_enter(&db->db_mtx);
+		direct = dmu_direct_read_bp(dn, db, &bp);
+		mutex_exit(&db->db_mtx);
+
+		if (!direct) {
+			err = dbuf_read(db, NULL, DB_RF_CANFAIL |
+			    DB_RF_NOPREFETCH | DB_RF_HAVESTRUCT);
+			if (err == 0)
+				bcopy(db->db.db_data, data, blksz);
+			dbuf_rele(db, FTAG);
+			continue;
+		}
+		dbuf_rele(db, FTAG);
+
+		if (BP_IS_HOLE(&bp)) {
+			bzero(data, blksz);
+			continue;
+		}
+
+		SET_BOOKMARK(&zb, dmu_objset_id(dn->dn_objset),
+		    dn->dn_object, 0, blkid);
+		zio_nowait(zio_read(rio, spa, &bp,
+		    abd_get_from_buf(data, blksz), blksz,
+		    dmu_direct_read_done, NULL, ZIO_PRIORITY_SYNC_READ,
+		    ZIO_FLAG_CANFAIL, &zb));
+	}
+
+	rw_exit(&dn->dn_struct_rwlock);
+
+	if (err != 0)
+		(void) zio_wait(rio);
+	else
+		err = zio_wait(rio);
+
+	return (err);
+}
+
+static void
+dmu_direct_write_ready(zio_t *zio)
+{
+	dmu_direct_arg_t *dda = zio->io_private;
+	blkptr_t *bp = zio->io_bp;
+
+	if (zio->io_error == 0) {
+		if (BP_IS_HOLE(bp)) {
+			BP_SET_LSIZE(bp, dda->dda_size);
+		} else if (!BP_IS_EMBEDDED(bp)) {
+			ASSERT(BP_GET_LEVEL(bp) == 0);
+			BP_SET_FILL(bp, 1);
+		}
+	}
+}
+
+static void
+dmu_direct_write_done(zio_t *zio)
+{
+	dmu_direct_arg_t *dda = zio->io_private;
+
+	dda->dda_error = zio->io_error;
+	abd_put(zio->io_abd);
+}
+
+/*
+ * Write whole blocks from buf, which must remain stable until this
+ * returns.  On failure nothing has been changed except possibly some of
+ * the blocks in the range, and the caller is expected to redo the whole
+ * range through the buffered path.
+ */
+int
+dmu_write_direct(dnode_t *dn, uint64_t offset, uint64_t size,
+    const void *buf, dmu_tx_t *tx)
+{
+	objset_t *os = dn->dn_objset;
+	spa_t *spa = os->os_spa;
+	uint64_t blksz = dn->dn_datablksz;
+	uint64_t nblks = size / blksz;
+	uint64_t txg = dmu_tx_get_txg(tx);
+	dmu_direct_arg_t *dda;
+	zio_prop_t zp;
+	zio_t *pio;
+	int err = 0;
+
+	ASSERT0(offset % blksz);
+	ASSERT0(size % blksz);
+	ASSERT(!os->os_encrypted);
+
+	/* Dedup works from the data at sync time, which we do not keep. */
+	if (os->os_dedup_checksum != ZIO_CHECKSUM_OFF ||
+	    !IS_P2ALIGNED(buf, SPA_MINBLOCKSIZE))
+		return (SET_ERROR(ENOTSUP));
+
+	dda = kmem_zalloc(nblks * sizeof (dmu_direct_arg_t), KM_SLEEP);
+
+	dmu_write_policy(os, dn, 0, WP_DMU_SYNC, &zp);
+	zp.zp_nopwrite = B_FALSE;
+
+	pio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	rw_enter(&dn->dn_struct_rwlock, RW_READER);
+	for (uint64_t i = 0; i < nblks; i++) {
+		uint64_t blkid = dbuf_whichblock(dn, 0, offset + i * blksz);
+		zbookmark_phys_t zb;
+
+		dda[i].dda_size = blksz;
+		dda[i].dda_db = dbuf_hold(dn, blkid, FTAG);
+		if (dda[i].dda_db == NULL) {
+			dda[i].dda_error = SET_ERROR(EIO);
+			continue;
+		}
+
+		SET_BOOKMARK(&zb, dmu_objset_id(os), dn->dn_object, 0, blkid);
+		zio_nowait(zio_write(pio, spa, txg, &dda[i].dda_bp,
+		    abd_get_from_buf((char *)buf + i * blksz, blksz),
+		    blksz, blksz, &zp, dmu_direct_write_ready, NULL, NULL,
+		    dmu_direct_write_done, &dda[i], ZIO_PRIORITY_SYNC_WRITE,
+		    ZIO_FLAG_CANFAIL, &zb));
+	}
+	rw_exit(&dn->dn_struct_rwlock);
+	(void) zio_wait(pio);
+
+	for (uint64_t i = 0; i < nblks; i++) {
+		blkptr_t *bp = &dda[i].dda_bp;
+
+		if (err == 0)
+			err = dda[i].dda_error;
+		if (err == 0) {
+			err = dmu_buf_write_direct(&dda[i].dda_db->db, bp,
+			    zp.zp_copies, tx);
+			if (err == 0)
+				bp = NULL;
+		}
+
+		/* Free any block we wrote but could not hand to the dbuf. */
+		if (bp != NULL && dda[i].dda_error == 0 &&
+		    !BP_IS_HOLE(bp) && !BP_IS_EMBEDDED(bp))
+			zio_free(spa, txg, bp);
+
+		if (dda[i].dda_db != NULL)
+			dbuf_rele(dda[i].dda_db, FTAG);
+	}
+
+	kmem_free(dda, nblks * sizeof (dmu_direct_arg_t));
+
+	return (err);
+}
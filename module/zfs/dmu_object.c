@@ -42,24 +42,106 @@
  */
 int dmu_object_alloc_chunk_shift = 7;
 
+/*
+ * Hand the CPU owning cursor 'cur' a new chunk of whole dnode blocks from
+ * the global allocator, unless another thread on the same CPU already did.
+ */
+static void
+dmu_object_alloc_next_chunk(objset_t *os, dmu_obj_cursor_t *cur,
+    int dn_slots, int dnodes_per_chunk, uint64_t L1_dnode_count,
+    boolean_t *restarted)
+{
+	uint64_t object;
+	int error;
+
+	mutex_enter(&os->os_obj_lock);
+	if (cur->doc_next + dn_slots <= cur->doc_end) {
+		mutex_exit(&os->os_obj_lock);
+		return;
+	}
+
+	DNODE_STAT_BUMP(dnode_alloc_next_chunk);
+	ASSERT0(P2PHASE(os->os_obj_next_chunk, dnodes_per_chunk));
+	object = os->os_obj_next_chunk;
+
+	/*
+	 * Each time we polish off a L1 bp worth of dnodes (2^12 objects),
+	 * move to another L1 bp that's still reasonably sparse (at most 1/4
+	 * full). Look from the beginning at most once per txg. If we still
+	 * can't allocate from that L1 block, search for an empty L0 block,
+	 * which will quickly skip to the end of the metadnode if no nearby
+	 * L0 blocks are empty. This fallback avoids a pathology where full
+	 * dnode blocks containing large dnodes appear sparse because they
+	 * have a low blk_fill, leading to many failed allocation attempts.
+	 * In the long term a better mechanism to search for sparse metadnode
+	 * regions, such as spacemaps, could be implemented.
+	 *
+	 * os_scan_dnodes is set during txg sync if enough objects have been
+	 * freed since the previous rescan to justify backfilling again.
+	 *
+	 * Note that dmu_traverse depends on the behavior that we use
+	 * multiple blocks of the dnode object before going back to reuse
+	 * objects.  Any change to this algorithm should preserve that
+	 * property or find another solution to the issues described in
+	 * traverse_visitbp.
+	 */
+	if (P2PHASE(object, L1_dnode_count) == 0) {
+		uint64_t offset;
+		uint64_t blkfill;
+		int minlvl;
+		if (os->os_rescan_dnodes) {
+			offset = 0;
+			os->os_rescan_dnodes = B_FALSE;
+		} else {
+			offset = object << DNODE_SHIFT;
+		}
+		blkfill = *restarted ? 1 : DNODES_PER_BLOCK >> 2;
+		minlvl = *restarted ? 1 : 2;
+		*restarted = B_TRUE;
+		error = dnode_next_offset(DMU_META_DNODE(os),
+		    DNODE_FIND_HOLE, &offset, minlvl, blkfill, 0);
+		if (error == 0) {
+			object = offset >> DNODE_SHIFT;
+		}
+	}
+
+	/*
+	 * If "restarted" we may have found a L0 that is not aligned to a
+	 * chunk, in which case this CPU only gets the rest of that chunk.
+	 * It always starts on a dnode block boundary, so no two CPUs are
+	 * handed slots in the same block.  The chunk is closed while it is
+	 * being replaced and the new end is published last, so a racing
+	 * allocation which sees the new end also sees the new start.
+	 */
+	object = P2ALIGN(object, DNODES_PER_BLOCK);
+	os->os_obj_next_chunk = P2ALIGN(object, dnodes_per_chunk) +
+	    dnodes_per_chunk;
+	cur->doc_end = 0;
+	membar_producer();
+	cur->doc_start = object;
+	(void) atomic_swap_64(&cur->doc_next, object);
+	membar_producer();
+	cur->doc_end = os->os_obj_next_chunk;
+	mutex_exit(&os->os_obj_lock);
+}
+
 static uint64_t
 dmu_object_alloc_impl(objset_t *os, dmu_object_type_t ot, int blocksize,
     int indirect_blockshift, dmu_object_type_t bonustype, int bonuslen,
     int dnodesize, dnode_t **allocated_dnode, void *tag, dmu_tx_t *tx)
 {
-	uint64_t object;
+	uint64_t object, next, end;
 	uint64_t L1_dnode_count = DNODES_PER_BLOCK <<
 	    (DMU_META_DNODE(os)->dn_indblkshift - SPA_BLKPTRSHIFT);
 	dnode_t *dn = NULL;
 	int dn_slots = dnodesize >> DNODE_SHIFT;
 	boolean_t restarted = B_FALSE;
-	uint64_t *cpuobj = NULL;
+	dmu_obj_cursor_t *cur = NULL;
 	int dnodes_per_chunk = 1 << dmu_object_alloc_chunk_shift;
 	int error;
 
 	kpreempt_disable();
-	cpuobj = &os->os_obj_next_percpu[CPU_SEQID %
-	    os->os_obj_next_percpu_len];
+	cur = &os->os_obj_cursor[CPU_SEQID % os->os_obj_cursor_len];
 	kpreempt_enable();
 
 	if (dn_slots == 0) {
@@ -74,7 +156,7 @@ dmu_object_alloc_impl(objset_t *os, dmu_object_type_t ot, int blocksize,
 	 * allocator needs to be at least one block's worth, to avoid
 	 * lock contention on the dbuf.  It can be at most one L1 block's
 	 * worth, so that the "rescan after polishing off a L1's worth"
-	 * logic below will be sure to kick in.
+	 * logic in dmu_object_alloc_next_chunk() will be sure to kick in.
 	 */
 	if (dnodes_per_chunk < DNODES_PER_BLOCK)
 		dnodes_per_chunk = DNODES_PER_BLOCK;
@@ -94,85 +176,23 @@ dmu_object_alloc_impl(objset_t *os, dmu_object_type_t ot, int blocksize,
 		tag = FTAG;
 	}
 
-	object = *cpuobj;
 	for (;;) {
 		/*
-		 * If we finished a chunk of dnodes, get a new one from
-		 * the global allocator.
-		 */
-		if ((P2PHASE(object, dnodes_per_chunk) == 0) ||
-		    (P2PHASE(object + dn_slots - 1, dnodes_per_chunk) <
-		    dn_slots)) {
-			DNODE_STAT_BUMP(dnode_alloc_next_chunk);
-			mutex_enter(&os->os_obj_lock);
-			ASSERT0(P2PHASE(os->os_obj_next_chunk,
-			    dnodes_per_chunk));
-			object = os->os_obj_next_chunk;
-
-			/*
-			 * Each time we polish off a L1 bp worth of dnodes
-			 * (2^12 objects), move to another L1 bp that's
-			 * still reasonably sparse (at most 1/4 full). Look
-			 * from the beginning at most once per txg. If we
-			 * still can't allocate from that L1 block, search
-			 * for an empty L0 block, which will quickly skip
-			 * to the end of the metadnode if no nearby L0
-			 * blocks are empty. This fallback avoids a
-			 * pathology where full dnode blocks containing
-			 * large dnodes appear sparse because they have a
-			 * low blk_fill, leading to many failed allocation
-			 * attempts. In the long term a better mechanism to
-			 * search for sparse metadnode regions, such as
-			 * spacemaps, could be implemented.
-			 *
-			 * os_scan_dnodes is set during txg sync if enough
-			 * objects have been freed since the previous
-			 * rescan to justify backfilling again.
-			 *
-			 * Note that dmu_traverse depends on the behavior
-			 * that we use multiple blocks of the dnode object
-			 * before going back to reuse objects.  Any change
-			 * to this algorithm should preserve that property
-			 * or find another solution to the issues described
-			 * in traverse_visitbp.
-			 */
-			if (P2PHASE(object, L1_dnode_count) == 0) {
-				uint64_t offset;
-				uint64_t blkfill;
-				int minlvl;
-				if (os->os_rescan_dnodes) {
-					offset = 0;
-					os->os_rescan_dnodes = B_FALSE;
-				} else {
-					offset = object << DNODE_SHIFT;
-				}
-				blkfill = restarted ? 1 : DNODES_PER_BLOCK >> 2;
-				minlvl = restarted ? 1 : 2;
-				restarted = B_TRUE;
-				error = dnode_next_offset(DMU_META_DNODE(os),
-				    DNODE_FIND_HOLE, &offset, minlvl,
-				    blkfill, 0);
-				if (error == 0) {
-					object = offset >> DNODE_SHIFT;
-				}
-			}
-			/*
-			 * Note: if "restarted", we may find a L0 that
-			 * is not suitably aligned.
-			 */
-			os->os_obj_next_chunk =
-			    P2ALIGN(object, dnodes_per_chunk) +
-			    dnodes_per_chunk;
-			(void) atomic_swap_64(cpuobj, object);
-			mutex_exit(&os->os_obj_lock);
-		}
-
-		/*
-		 * The value of (*cpuobj) before adding dn_slots is the object
+		 * The value of doc_next before adding dn_slots is the object
 		 * ID assigned to us.  The value afterwards is the object ID
-		 * assigned to whoever wants to do an allocation next.
+		 * assigned to whoever wants to do an allocation next.  If
+		 * that runs past the end of this CPU's chunk, get a new one
+		 * from the global allocator.
 		 */
-		object = atomic_add_64_nv(cpuobj, dn_slots) - dn_slots;
+		object = atomic_add_64_nv(&cur->doc_next, dn_slots) - dn_slots;
+		membar_consumer();
+		end = cur->doc_end;
+		membar_consumer();
+		if (object < cur->doc_start || object + dn_slots > end) {
+			dmu_object_alloc_next_chunk(os, cur, dn_slots,
+			    dnodes_per_chunk, L1_dnode_count, &restarted);
+			continue;
+		}
 
 		/*
 		 * XXX We should check for an i/o error here and return
@@ -210,16 +230,29 @@ dmu_object_alloc_impl(objset_t *os, dmu_object_type_t ot, int blocksize,
 			dnode_rele(dn, tag);
 			DNODE_STAT_BUMP(dnode_alloc_race);
 		}
+		DNODE_STAT_BUMP(dnode_alloc_collision);
 
 		/*
 		 * Skip to next known valid starting point on error.  This
-		 * is the start of the next block of dnodes.
+		 * is the start of the next block of dnodes.  Never skip
+		 * into a block beyond this CPU's chunk, which may belong to
+		 * another CPU; the free slots passed over are left for a
+		 * later rescan to reclaim.
 		 */
 		if (dmu_object_next(os, &object, B_TRUE, 0) != 0) {
 			object = P2ROUNDUP(object + 1, DNODES_PER_BLOCK);
 			DNODE_STAT_BUMP(dnode_alloc_next_block);
 		}
-		(void) atomic_swap_64(cpuobj, object);
+		if (object >= end) {
+			object = end;
+			DNODE_STAT_BUMP(dnode_alloc_chunk_abandon);
+		}
+
+		/* Only move the cursor forward, other threads may use it */
+		do {
+			next = cur->doc_next;
+		} while (next < object &&
+		    atomic_cas_64(&cur->doc_next, next, object) != next);
 	}
 }
 
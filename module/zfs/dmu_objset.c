@@ -193,8 +193,14 @@ compression_changed_cb(void *arg, uint64_t newval)
 	 */
 	ASSERT(newval != ZIO_COMPRESS_INHERIT);
 
-	os->os_compress = zio_compress_select(os->os_spa, newval,
-	    ZIO_COMPRESS_ON);
+	/*
+	 * The value may carry a compression level above the algorithm
+	 * bits, see ZIO_COMPRESS_RAW().
+	 */
+	os->os_compress = zio_compress_select(os->os_spa,
+	    ZIO_COMPRESS_ALGO(newval), ZIO_COMPRESS_ON);
+	os->os_complevel = zio_complevel_select(os->os_spa, os->os_compress,
+	    ZIO_COMPRESS_LEVEL(newval), ZIO_COMPLEVEL_DEFAULT);
 }
 
 static void
@@ -329,6 +335,20 @@ smallblk_changed_cb(void *arg, uint64_t newval)
 	os->os_zpl_special_smallblock = newval;
 }
 
+static void
+direct_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	/*
+	 * Inheritance and range checking should have been done by now.
+	 */
+	ASSERT(newval == ZFS_DIRECT_DISABLED ||
+	    newval == ZFS_DIRECT_STANDARD || newval == ZFS_DIRECT_ALWAYS);
+
+	os->os_direct = newval;
+}
+
 static void
 logbias_changed_cb(void *arg, uint64_t newval)
 {
@@ -551,6 +571,11 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 				    zfs_prop_to_name(ZFS_PROP_LOGBIAS),
 				    logbias_changed_cb, os);
 			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(ZFS_PROP_DIRECT),
+				    direct_changed_cb, os);
+			}
 			if (err == 0) {
 				err = dsl_prop_register(ds,
 				    zfs_prop_to_name(ZFS_PROP_SYNC),
@@ -590,11 +615,13 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 		/* It's the meta-objset. */
 		os->os_checksum = ZIO_CHECKSUM_FLETCHER_4;
 		os->os_compress = ZIO_COMPRESS_ON;
+		os->os_complevel = ZIO_COMPLEVEL_DEFAULT;
 		os->os_encrypted = B_FALSE;
 		os->os_copies = spa_max_replication(spa);
 		os->os_dedup_checksum = ZIO_CHECKSUM_OFF;
 		os->os_dedup_verify = B_FALSE;
 		os->os_logbias = ZFS_LOGBIAS_LATENCY;
+		os->os_direct = ZFS_DIRECT_DISABLED;
 		os->os_sync = ZFS_SYNC_STANDARD;
 		os->os_primary_cache = ZFS_CACHE_ALL;
 		os->os_secondary_cache = ZFS_CACHE_ALL;
@@ -621,9 +648,14 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 	mutex_init(&os->os_userused_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&os->os_obj_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&os->os_user_ptr_lock, NULL, MUTEX_DEFAULT, NULL);
-	os->os_obj_next_percpu_len = boot_ncpus;
-	os->os_obj_next_percpu = kmem_zalloc(os->os_obj_next_percpu_len *
-	    sizeof (os->os_obj_next_percpu[0]), KM_SLEEP);
+	os->os_obj_cursor_len = boot_ncpus;
+	os->os_obj_cursor = kmem_zalloc(os->os_obj_cursor_len *
+	    sizeof (dmu_obj_cursor_t), KM_SLEEP);
+
+	if (ds != NULL && !ds->ds_is_snapshot) {
+		os->os_zfetch_stats = dmu_zfetch_ds_stats_hold(spa,
+		    ds->ds_object);
+	}
 
 	dnode_special_open(os, &os->os_phys->os_meta_dnode,
 	    DMU_META_DNODE_OBJECT, &os->os_meta_dnode);
@@ -981,8 +1013,11 @@ dmu_objset_evict_done(objset_t *os)
 	rw_enter(&os_lock, RW_READER);
 	rw_exit(&os_lock);
 
-	kmem_free(os->os_obj_next_percpu,
-	    os->os_obj_next_percpu_len * sizeof (os->os_obj_next_percpu[0]));
+	kmem_free(os->os_obj_cursor,
+	    os->os_obj_cursor_len * sizeof (dmu_obj_cursor_t));
+
+	if (os->os_zfetch_stats != NULL)
+		dmu_zfetch_ds_stats_rele(os->os_zfetch_stats);
 
 	mutex_destroy(&os->os_lock);
 	mutex_destroy(&os->os_userused_lock);
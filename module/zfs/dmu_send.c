@@ -882,6 +882,9 @@ send_do_embed(dmu_send_cookie_t *dscp, const blkptr_t *bp)
 	if ((BP_GET_COMPRESS(bp) >= ZIO_COMPRESS_LEGACY_FUNCTIONS &&
 	    !(dscp->dsc_featureflags & DMU_BACKUP_FEATURE_LZ4)))
 		return (B_FALSE);
+	if (BP_GET_COMPRESS(bp) == ZIO_COMPRESS_ZSTD &&
+	    !(dscp->dsc_featureflags & DMU_BACKUP_FEATURE_ZSTD))
+		return (B_FALSE);
 
 	/*
 	 * Embed type must be explicitly enabled.
@@ -1952,6 +1955,13 @@ setup_featureflags(struct dmu_send_params *dspp, objset_t *os,
 		*featureflags |= DMU_BACKUP_FEATURE_LZ4;
 	}
 
+	if ((*featureflags &
+	    (DMU_BACKUP_FEATURE_EMBED_DATA | DMU_BACKUP_FEATURE_COMPRESSED |
+	    DMU_BACKUP_FEATURE_RAW)) != 0 &&
+	    dsl_dataset_feature_is_active(to_ds, SPA_FEATURE_ZSTD_COMPRESS)) {
+		*featureflags |= DMU_BACKUP_FEATURE_ZSTD;
+	}
+
 	if (dspp->resumeobj != 0 || dspp->resumeoff != 0) {
 		*featureflags |= DMU_BACKUP_FEATURE_RESUMING;
 	}
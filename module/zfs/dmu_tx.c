@@ -332,6 +332,31 @@ dmu_tx_hold_write_by_dnode(dmu_tx_t *tx, dnode_t *dn, uint64_t off, int len)
 	}
 }
 
+/*
+ * Hold a range of a file which will be made to reference existing blocks
+ * (see dmu_brt_clone()).  No data is written, only the indirect blocks
+ * above the range, so the range is not limited to DMU_MAX_ACCESS.
+ */
+void
+dmu_tx_hold_clone_by_dnode(dmu_tx_t *tx, dnode_t *dn, uint64_t off,
+    uint64_t len)
+{
+	dmu_tx_hold_t *txh;
+
+	ASSERT0(tx->tx_txg);
+	ASSERT(len == 0 || UINT64_MAX - off >= len - 1);
+
+	txh = dmu_tx_hold_dnode_impl(tx, dn, THT_CLONE, off, len);
+	if (txh != NULL) {
+		uint64_t nblocks = len / dn->dn_datablksz + 2;
+		int epb = 1 << (dn->dn_indblkshift - SPA_BLKPTRSHIFT);
+
+		(void) zfs_refcount_add_many(&txh->txh_space_towrite,
+		    (nblocks / epb + 2) << dn->dn_indblkshift, FTAG);
+		dmu_tx_count_dnode(txh);
+	}
+}
+
 /*
  * This function marks the transaction as being a "net free".  The end
  * result is that refquotas will be disabled for this transaction, and
@@ -653,6 +678,16 @@ dmu_tx_dirty_buf(dmu_tx_t *tx, dmu_buf_impl_t *db)
 				if (blkid == DMU_SPILL_BLKID)
 					match_offset = TRUE;
 				break;
+			case THT_CLONE:
+				if (blkid >= beginblk && blkid <= endblk)
+					match_offset = TRUE;
+				/*
+				 * The block size may be grown to that of
+				 * the source, dirtying lvl=0 blk=0.
+				 */
+				if (blkid == 0)
+					match_offset = TRUE;
+				break;
 			case THT_BONUS:
 				if (blkid == DMU_BONUS_BLKID)
 					match_offset = TRUE;
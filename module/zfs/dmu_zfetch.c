@@ -46,32 +46,81 @@ int zfs_prefetch_disable = B_FALSE;
 
 /* max # of streams per zfetch */
 unsigned int	zfetch_max_streams = 8;
+/* max # of streams per zfetch when many readers share a file */
+unsigned int	zfetch_max_streams_limit = 64;
 /* min time before stream reclaim */
 unsigned int	zfetch_min_sec_reap = 2;
 /* max bytes to prefetch per stream (default 8MB) */
 unsigned int	zfetch_max_distance = 8 * 1024 * 1024;
 /* max bytes to prefetch indirects for per stream (default 64MB) */
 unsigned int	zfetch_max_idistance = 64 * 1024 * 1024;
+/* max bytes between strided accesses which are detected (default 16MB) */
+unsigned int	zfetch_max_stride = 16 * 1024 * 1024;
 /* max number of bytes in an array_read in which we allow prefetching (1MB) */
 unsigned long	zfetch_array_rd_sz = 1024 * 1024;
 
+/*
+ * The prefetch distance of each dnode adapts to how many of its accesses
+ * are predicted.  Every ZFETCH_WINDOW accesses, zfetch_max_distance is
+ * doubled for this dnode if at least 7/8 of them were hits, and halved if
+ * fewer than half were, within the range given by the shifts below.
+ */
+#define	ZFETCH_WINDOW		64
+#define	ZFETCH_DIST_SHIFT_MIN	(-3)
+#define	ZFETCH_DIST_SHIFT_MAX	2
+
 typedef struct zfetch_stats {
 	kstat_named_t zfetchstat_hits;
 	kstat_named_t zfetchstat_misses;
 	kstat_named_t zfetchstat_max_streams;
+	kstat_named_t zfetchstat_stride_hits;
+	kstat_named_t zfetchstat_reverse_hits;
+	kstat_named_t zfetchstat_issued;
 } zfetch_stats_t;
 
 static zfetch_stats_t zfetch_stats = {
 	{ "hits",			KSTAT_DATA_UINT64 },
 	{ "misses",			KSTAT_DATA_UINT64 },
 	{ "max_streams",		KSTAT_DATA_UINT64 },
+	{ "stride_hits",		KSTAT_DATA_UINT64 },
+	{ "reverse_hits",		KSTAT_DATA_UINT64 },
+	{ "issued",			KSTAT_DATA_UINT64 },
 };
 
 #define	ZFETCHSTAT_BUMP(stat) \
 	atomic_inc_64(&zfetch_stats.stat.value.ui64);
+#define	ZFETCHSTAT_INCR(stat, val) \
+	atomic_add_64(&zfetch_stats.stat.value.ui64, (val));
+
+/*
+ * Bump both the global and, if the dnode's dataset has them, the
+ * per-dataset statistics.
+ */
+#define	ZFETCH_BUMP(zf, stat, dsstat) do { \
+	zfetch_ds_stats_t *zds = (zf)->zf_dnode->dn_objset->os_zfetch_stats; \
+	ZFETCHSTAT_BUMP(stat); \
+	if (zds != NULL) \
+		atomic_inc_64(&zds->dsstat); \
+} while (0)
 
 kstat_t		*zfetch_ksp;
 
+static kmutex_t	zfetch_ds_lock;
+static avl_tree_t zfetch_ds_tree;
+
+static int
+zfetch_ds_stats_compare(const void *x1, const void *x2)
+{
+	const zfetch_ds_stats_t *zds1 = x1;
+	const zfetch_ds_stats_t *zds2 = x2;
+
+	int cmp = AVL_PCMP(zds1->zds_spa, zds2->zds_spa);
+	if (likely(cmp))
+		return (cmp);
+
+	return (AVL_CMP(zds1->zds_objset, zds2->zds_objset));
+}
+
 void
 zfetch_init(void)
 {
@@ -83,6 +132,10 @@ zfetch_init(void)
 		zfetch_ksp->ks_data = &zfetch_stats;
 		kstat_install(zfetch_ksp);
 	}
+
+	mutex_init(&zfetch_ds_lock, NULL, MUTEX_DEFAULT, NULL);
+	avl_create(&zfetch_ds_tree, zfetch_ds_stats_compare,
+	    sizeof (zfetch_ds_stats_t), offsetof(zfetch_ds_stats_t, zds_node));
 }
 
 void
@@ -92,6 +145,48 @@ zfetch_fini(void)
 		kstat_delete(zfetch_ksp);
 		zfetch_ksp = NULL;
 	}
+
+	avl_destroy(&zfetch_ds_tree);
+	mutex_destroy(&zfetch_ds_lock);
+}
+
+/*
+ * Look up the prefetch statistics of an objset, creating them if this is
+ * the first reference.
+ */
+zfetch_ds_stats_t *
+dmu_zfetch_ds_stats_hold(spa_t *spa, uint64_t objset)
+{
+	zfetch_ds_stats_t search, *zds;
+	avl_index_t where;
+
+	search.zds_spa = spa;
+	search.zds_objset = objset;
+
+	mutex_enter(&zfetch_ds_lock);
+	zds = avl_find(&zfetch_ds_tree, &search, &where);
+	if (zds == NULL) {
+		zds = kmem_zalloc(sizeof (*zds), KM_SLEEP);
+		zds->zds_spa = spa;
+		zds->zds_objset = objset;
+		avl_insert(&zfetch_ds_tree, zds, where);
+	}
+	zds->zds_refcnt++;
+	mutex_exit(&zfetch_ds_lock);
+
+	return (zds);
+}
+
+void
+dmu_zfetch_ds_stats_rele(zfetch_ds_stats_t *zds)
+{
+	mutex_enter(&zfetch_ds_lock);
+	ASSERT3U(zds->zds_refcnt, >, 0);
+	if (--zds->zds_refcnt == 0) {
+		avl_remove(&zfetch_ds_tree, zds);
+		kmem_free(zds, sizeof (*zds));
+	}
+	mutex_exit(&zfetch_ds_lock);
 }
 
 /*
@@ -106,6 +201,10 @@ dmu_zfetch_init(zfetch_t *zf, dnode_t *dno)
 		return;
 
 	zf->zf_dnode = dno;
+	zf->zf_max_streams = zfetch_max_streams;
+	zf->zf_dist_shift = 0;
+	zf->zf_hits = 0;
+	zf->zf_misses = 0;
 
 	list_create(&zf->zf_stream, sizeof (zstream_t),
 	    offsetof(zstream_t, zs_node));
@@ -142,16 +241,75 @@ dmu_zfetch_fini(zfetch_t *zf)
 }
 
 /*
- * If there aren't too many streams already, create a new stream.
- * The "blkid" argument is the next block that we expect this stream to access.
+ * Returns the maximum number of bytes to prefetch ahead of a stream of
+ * this dnode, after adapting zfetch_max_distance to the dnode's hit rate.
+ */
+static uint64_t
+dmu_zfetch_max_distance(zfetch_t *zf)
+{
+	uint64_t dist = zfetch_max_distance;
+
+	ASSERT(MUTEX_HELD(&zf->zf_lock));
+
+	if (zf->zf_dist_shift >= 0)
+		dist <<= zf->zf_dist_shift;
+	else
+		dist >>= -zf->zf_dist_shift;
+
+	return (MAX(MIN(dist, zfetch_max_idistance),
+	    zf->zf_dnode->dn_datablksz));
+}
+
+/*
+ * Account an access as a hit or a miss, and at the end of each window
+ * adjust the prefetch distance of the dnode to the hit rate.
+ */
+static void
+dmu_zfetch_account(zfetch_t *zf, boolean_t hit)
+{
+	ASSERT(MUTEX_HELD(&zf->zf_lock));
+
+	if (hit)
+		zf->zf_hits++;
+	else
+		zf->zf_misses++;
+
+	uint32_t total = zf->zf_hits + zf->zf_misses;
+	if (total < ZFETCH_WINDOW)
+		return;
+
+	if (zf->zf_hits * 8 >= total * 7) {
+		zf->zf_dist_shift = MIN(zf->zf_dist_shift + 1,
+		    ZFETCH_DIST_SHIFT_MAX);
+	} else if (zf->zf_hits * 2 < total) {
+		zf->zf_dist_shift = MAX(zf->zf_dist_shift - 1,
+		    ZFETCH_DIST_SHIFT_MIN);
+	}
+	zf->zf_hits = 0;
+	zf->zf_misses = 0;
+}
+
+static void
+dmu_zfetch_issued(zfetch_t *zf, uint64_t nblks)
+{
+	zfetch_ds_stats_t *zds = zf->zf_dnode->dn_objset->os_zfetch_stats;
+
+	ZFETCHSTAT_INCR(zfetchstat_issued, nblks);
+	if (zds != NULL)
+		atomic_add_64(&zds->zds_issued, nblks);
+}
+
+/*
+ * If there aren't too many streams already, create a new stream for an
+ * access of nblks blocks at blkid, expecting the next access to follow it.
  * While we're here, clean up old streams (which haven't been
  * accessed for at least zfetch_min_sec_reap seconds).
  */
 static void
-dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
+dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid, uint64_t nblks)
 {
 	zstream_t *zs_next;
-	int numstreams = 0;
+	uint32_t numstreams = 0, numhit = 0;
 
 	ASSERT(MUTEX_HELD(&zf->zf_lock));
 
@@ -162,38 +320,171 @@ dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
 	    zs != NULL; zs = zs_next) {
 		zs_next = list_next(&zf->zf_stream, zs);
 		if (((gethrtime() - zs->zs_atime) / NANOSEC) >
-		    zfetch_min_sec_reap)
+		    zfetch_min_sec_reap) {
 			dmu_zfetch_stream_remove(zf, zs);
-		else
+		} else {
 			numstreams++;
+			if (zs->zs_hits != 0)
+				numhit++;
+		}
 	}
 
 	/*
-	 * The maximum number of streams is normally zfetch_max_streams,
-	 * but for small files we lower it such that it's at least possible
-	 * for all the streams to be non-overlapping.
+	 * The limit on streams grows below when readers outnumber them.
+	 * Shrink it back once most of those readers have gone away.
+	 */
+	uint32_t limit = MAX(zfetch_max_streams_limit, zfetch_max_streams);
+	zf->zf_max_streams = MIN(MAX(zf->zf_max_streams, zfetch_max_streams),
+	    limit);
+	if (numstreams * 4 <= zf->zf_max_streams)
+		zf->zf_max_streams = MAX(zf->zf_max_streams / 2,
+		    zfetch_max_streams);
+
+	/*
+	 * The maximum number of streams is normally zf_max_streams, but
+	 * for small files we lower it such that it's at least possible for
+	 * all the streams to be non-overlapping.
 	 *
 	 * If we are already at the maximum number of streams for this file,
-	 * even after removing old streams, then don't create this stream.
+	 * even after removing old streams, then don't create this stream,
+	 * unless every stream is being followed by a reader.  In that case
+	 * there are more concurrent readers than streams, and rather than
+	 * having them thrash we allow more streams.
 	 */
-	uint32_t max_streams = MAX(1, MIN(zfetch_max_streams,
+	uint64_t max_streams = MAX(1, MIN(limit,
 	    zf->zf_dnode->dn_maxblkid * zf->zf_dnode->dn_datablksz /
 	    zfetch_max_distance));
-	if (numstreams >= max_streams) {
-		ZFETCHSTAT_BUMP(zfetchstat_max_streams);
-		return;
+	if (numstreams >= MIN(max_streams, zf->zf_max_streams)) {
+		if (numhit < numstreams || numstreams >= max_streams) {
+			ZFETCHSTAT_BUMP(zfetchstat_max_streams);
+			return;
+		}
+		zf->zf_max_streams = MIN(zf->zf_max_streams * 2, limit);
 	}
 
 	zstream_t *zs = kmem_zalloc(sizeof (*zs), KM_SLEEP);
-	zs->zs_blkid = blkid;
-	zs->zs_pf_blkid = blkid;
-	zs->zs_ipf_blkid = blkid;
+	zs->zs_blkid = blkid + nblks;
+	zs->zs_pf_blkid = blkid + nblks;
+	zs->zs_ipf_blkid = blkid + nblks;
+	zs->zs_len = nblks;
+	zs->zs_last = blkid;
 	zs->zs_atime = gethrtime();
 	mutex_init(&zs->zs_lock, NULL, MUTEX_DEFAULT, NULL);
 
 	list_insert_head(&zf->zf_stream, zs);
 }
 
+/*
+ * Try to explain an access which matched no stream as part of a strided
+ * stream, that is one with a constant distance between the starts of its
+ * accesses.  A stream which has not been hit yet first records the
+ * distance to such an access as a candidate stride, and if the next access
+ * continues with the same stride the stream becomes strided.  Its
+ * following access will then be its first hit.  Confirming the stride
+ * before using it keeps concurrent sequential readers which are close to
+ * each other from stealing each other's new streams.
+ */
+static boolean_t
+dmu_zfetch_stream_train(zfetch_t *zf, uint64_t blkid, uint64_t nblks)
+{
+	int64_t max_stride = zfetch_max_stride >> zf->zf_dnode->dn_datablkshift;
+	zstream_t *cand = NULL;
+
+	ASSERT(MUTEX_HELD(&zf->zf_lock));
+
+	for (zstream_t *zs = list_head(&zf->zf_stream); zs != NULL;
+	    zs = list_next(&zf->zf_stream, zs)) {
+		if (zs->zs_hits != 0 || zs->zs_stride != 0 ||
+		    zs->zs_len != nblks)
+			continue;
+
+		if (zs->zs_cand_stride != 0 &&
+		    blkid == zs->zs_cand_last + zs->zs_cand_stride) {
+			mutex_enter(&zs->zs_lock);
+			zs->zs_stride = zs->zs_cand_stride;
+			zs->zs_blkid = blkid + zs->zs_stride;
+			zs->zs_pf_ahead = 0;
+			zs->zs_last = blkid;
+			zs->zs_atime = gethrtime();
+			mutex_exit(&zs->zs_lock);
+			return (B_TRUE);
+		}
+
+		/*
+		 * Strides shorter than an access would overlap, and forward
+		 * ones equal to it are handled as sequential streams.
+		 */
+		int64_t stride = (int64_t)(blkid - zs->zs_last);
+		if (cand == NULL && zs->zs_cand_stride == 0 &&
+		    stride != 0 && ABS(stride) <= max_stride &&
+		    (stride > 0 ? stride > (int64_t)nblks :
+		    -stride >= (int64_t)nblks))
+			cand = zs;
+	}
+
+	if (cand != NULL) {
+		mutex_enter(&cand->zs_lock);
+		cand->zs_cand_stride = (int64_t)(blkid - cand->zs_last);
+		cand->zs_cand_last = blkid;
+		mutex_exit(&cand->zs_lock);
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Issue further prefetches for a strided stream which has been hit by the
+ * access it expected, at zs_blkid.  Like for sequential streams, the
+ * number of accesses prefetched ahead of the reader doubles on every hit,
+ * up to the maximum distance.  Only the blocks of the accesses themselves
+ * are prefetched, or their L1 indirect blocks if we are not prefetching
+ * data.  Returns the number of accesses to prefetch starting at *pf_startp.
+ */
+static uint64_t
+dmu_zfetch_strided(zfetch_t *zf, zstream_t *zs, boolean_t fetch_data,
+    uint64_t *pf_startp)
+{
+	dnode_t *dn = zf->zf_dnode;
+	int64_t stride = zs->zs_stride;
+	uint64_t cur = zs->zs_blkid;
+	uint64_t max_ahead;
+
+	ASSERT(MUTEX_HELD(&zs->zs_lock));
+	ASSERT(stride != 0);
+
+	if (fetch_data) {
+		max_ahead = (dmu_zfetch_max_distance(zf) >>
+		    dn->dn_datablkshift) / zs->zs_len;
+	} else {
+		max_ahead = (zfetch_max_idistance >> dn->dn_datablkshift) /
+		    ABS(stride);
+	}
+	max_ahead = MAX(max_ahead, 1);
+
+	/*
+	 * zs_pf_ahead accesses starting with this one have been prefetched,
+	 * so double the number prefetched after it.
+	 */
+	uint64_t ahead = (zs->zs_pf_ahead > 0) ? zs->zs_pf_ahead - 1 : 0;
+	uint64_t target = MAX(MIN(2 * ahead + 1, max_ahead), ahead);
+	uint64_t pf_start = cur + (ahead + 1) * stride;
+	uint64_t pf_count = target - ahead;
+
+	/* Backward streams stop at the start of the object. */
+	if (stride < 0) {
+		uint64_t avail = (cur / -stride) > ahead ?
+		    (cur / -stride) - ahead : 0;
+		pf_count = MIN(pf_count, avail);
+	}
+
+	zs->zs_pf_ahead = ahead + pf_count;
+	zs->zs_last = cur;
+	zs->zs_blkid = cur + stride;
+	*pf_startp = pf_start;
+
+	return (pf_count);
+}
+
 /*
  * This is the predictive prefetch entry point.  It associates dnode access
  * specified with blkid and nblks arguments with prefetch stream, predicts
@@ -201,18 +492,24 @@ dmu_zfetch_stream_create(zfetch_t *zf, uint64_t blkid)
  * fetch_data argument specifies whether actual data blocks should be fetched:
  *   FALSE -- prefetch only indirect blocks for predicted data blocks;
  *   TRUE -- prefetch predicted data blocks plus following indirect blocks.
+ *
+ * Streams are sequential, or strided forward or backward.  A new stream
+ * starts out sequential, and becomes strided if the accesses which follow
+ * it keep the same distance from each other, as long as that distance is
+ * within zfetch_max_stride (see dmu_zfetch_stream_train()).
  */
 void
 dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data,
     boolean_t have_lock)
 {
 	zstream_t *zs;
+	dnode_t *dn = zf->zf_dnode;
 	int64_t pf_start, ipf_start, ipf_istart, ipf_iend;
 	int64_t pf_ahead_blks, max_blks;
 	int epbs, max_dist_blks, pf_nblks, ipf_nblks;
 	uint64_t end_of_access_blkid;
 	end_of_access_blkid = blkid + nblks;
-	spa_t *spa = zf->zf_dnode->dn_objset->os_spa;
+	spa_t *spa = dn->dn_objset->os_spa;
 
 	if (zfs_prefetch_disable)
 		return;
@@ -234,17 +531,23 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data,
 		return;
 
 	if (!have_lock)
-		rw_enter(&zf->zf_dnode->dn_struct_rwlock, RW_READER);
+		rw_enter(&dn->dn_struct_rwlock, RW_READER);
 	mutex_enter(&zf->zf_lock);
 
 	/*
 	 * Find matching prefetch stream.  Depending on whether the accesses
 	 * are block-aligned, first block of the new access may either follow
-	 * the last block of the previous access, or be equal to it.
+	 * the last block of the previous access, or be equal to it.  Strided
+	 * streams only match the exact access they expect.
 	 */
 	for (zs = list_head(&zf->zf_stream); zs != NULL;
 	    zs = list_next(&zf->zf_stream, zs)) {
-		if (blkid == zs->zs_blkid || blkid + 1 == zs->zs_blkid) {
+		if (zs->zs_stride != 0) {
+			if (blkid == zs->zs_blkid) {
+				mutex_enter(&zs->zs_lock);
+				break;
+			}
+		} else if (blkid == zs->zs_blkid || blkid + 1 == zs->zs_blkid) {
 			mutex_enter(&zs->zs_lock);
 			/*
 			 * zs_blkid could have changed before we
@@ -260,8 +563,7 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data,
 					mutex_exit(&zs->zs_lock);
 					mutex_exit(&zf->zf_lock);
 					if (!have_lock) {
-						rw_exit(&zf->zf_dnode->
-						    dn_struct_rwlock);
+						rw_exit(&dn->dn_struct_rwlock);
 					}
 					return;
 				}
@@ -273,15 +575,65 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data,
 
 	if (zs == NULL) {
 		/*
-		 * This access is not part of any existing stream.  Create
-		 * a new stream for it.
+		 * This access is not part of any existing stream.  Either
+		 * it reveals the stride of a stream, or we create a new
+		 * stream for it.
 		 */
-		ZFETCHSTAT_BUMP(zfetchstat_misses);
+		ZFETCH_BUMP(zf, zfetchstat_misses, zds_misses);
+		dmu_zfetch_account(zf, B_FALSE);
 
-		dmu_zfetch_stream_create(zf, end_of_access_blkid);
+		if (zfetch_max_stride == 0 ||
+		    !dmu_zfetch_stream_train(zf, blkid, nblks))
+			dmu_zfetch_stream_create(zf, blkid, nblks);
 		mutex_exit(&zf->zf_lock);
 		if (!have_lock)
-			rw_exit(&zf->zf_dnode->dn_struct_rwlock);
+			rw_exit(&dn->dn_struct_rwlock);
+		return;
+	}
+
+	dmu_zfetch_account(zf, B_TRUE);
+	zs->zs_hits++;
+	zs->zs_atime = gethrtime();
+
+	if (zs->zs_stride != 0) {
+		int64_t stride = zs->zs_stride;
+		uint64_t len = zs->zs_len;
+		uint64_t start, count;
+		uint64_t last_iblk = UINT64_MAX;
+
+		count = dmu_zfetch_strided(zf, zs, fetch_data, &start);
+		mutex_exit(&zs->zs_lock);
+		mutex_exit(&zf->zf_lock);
+
+		epbs = dn->dn_indblkshift - SPA_BLKPTRSHIFT;
+		for (uint64_t i = 0; i < count; i++) {
+			uint64_t first = start + i * stride;
+
+			for (uint64_t b = first; b < first + len; b++) {
+				if (fetch_data) {
+					dbuf_prefetch(dn, 0, b,
+					    ZIO_PRIORITY_ASYNC_READ,
+					    ARC_FLAG_PREDICTIVE_PREFETCH);
+				} else if ((b >> epbs) != last_iblk) {
+					last_iblk = b >> epbs;
+					dbuf_prefetch(dn, 1, last_iblk,
+					    ZIO_PRIORITY_ASYNC_READ,
+					    ARC_FLAG_PREDICTIVE_PREFETCH);
+				}
+			}
+		}
+		if (!have_lock)
+			rw_exit(&dn->dn_struct_rwlock);
+
+		ZFETCH_BUMP(zf, zfetchstat_hits, zds_hits);
+		if (stride < 0)
+			ZFETCH_BUMP(zf, zfetchstat_reverse_hits,
+			    zds_reverse_hits);
+		else
+			ZFETCH_BUMP(zf, zfetchstat_stride_hits,
+			    zds_stride_hits);
+		if (fetch_data)
+			dmu_zfetch_issued(zf, count * len);
 		return;
 	}
 
@@ -299,11 +651,11 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data,
 
 	/*
 	 * Double our amount of prefetched data, but don't let the
-	 * prefetch get further ahead than zfetch_max_distance.
+	 * prefetch get further ahead than the maximum distance.
 	 */
 	if (fetch_data) {
 		max_dist_blks =
-		    zfetch_max_distance >> zf->zf_dnode->dn_datablkshift;
+		    dmu_zfetch_max_distance(zf) >> dn->dn_datablkshift;
 		/*
 		 * Previously, we were (zs_pf_blkid - blkid) ahead.  We
 		 * want to now be double that, so read that amount again,
@@ -325,7 +677,7 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data,
 	 * that point to them).
 	 */
 	ipf_start = MAX(zs->zs_ipf_blkid, zs->zs_pf_blkid);
-	max_dist_blks = zfetch_max_idistance >> zf->zf_dnode->dn_datablkshift;
+	max_dist_blks = zfetch_max_idistance >> dn->dn_datablkshift;
 	/*
 	 * We want to double our distance ahead of the data prefetch
 	 * (or reader, if we are not prefetching data).  Previously, we
@@ -338,11 +690,11 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data,
 	ipf_nblks = MIN(pf_ahead_blks, max_blks);
 	zs->zs_ipf_blkid = ipf_start + ipf_nblks;
 
-	epbs = zf->zf_dnode->dn_indblkshift - SPA_BLKPTRSHIFT;
+	epbs = dn->dn_indblkshift - SPA_BLKPTRSHIFT;
 	ipf_istart = P2ROUNDUP(ipf_start, 1 << epbs) >> epbs;
 	ipf_iend = P2ROUNDUP(zs->zs_ipf_blkid, 1 << epbs) >> epbs;
 
-	zs->zs_atime = gethrtime();
+	zs->zs_last = blkid;
 	zs->zs_blkid = end_of_access_blkid;
 	mutex_exit(&zs->zs_lock);
 	mutex_exit(&zf->zf_lock);
@@ -354,16 +706,18 @@ dmu_zfetch(zfetch_t *zf, uint64_t blkid, uint64_t nblks, boolean_t fetch_data,
 	 */
 
 	for (int i = 0; i < pf_nblks; i++) {
-		dbuf_prefetch(zf->zf_dnode, 0, pf_start + i,
+		dbuf_prefetch(dn, 0, pf_start + i,
 		    ZIO_PRIORITY_ASYNC_READ, ARC_FLAG_PREDICTIVE_PREFETCH);
 	}
 	for (int64_t iblk = ipf_istart; iblk < ipf_iend; iblk++) {
-		dbuf_prefetch(zf->zf_dnode, 1, iblk,
+		dbuf_prefetch(dn, 1, iblk,
 		    ZIO_PRIORITY_ASYNC_READ, ARC_FLAG_PREDICTIVE_PREFETCH);
 	}
 	if (!have_lock)
-		rw_exit(&zf->zf_dnode->dn_struct_rwlock);
-	ZFETCHSTAT_BUMP(zfetchstat_hits);
+		rw_exit(&dn->dn_struct_rwlock);
+	ZFETCH_BUMP(zf, zfetchstat_hits, zds_hits);
+	if (pf_nblks > 0)
+		dmu_zfetch_issued(zf, pf_nblks);
 }
 
 /* BEGIN CSTYLED */
@@ -373,12 +727,18 @@ ZFS_MODULE_PARAM(zfs_prefetch, zfs_prefetch_, disable, INT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_prefetch, zfetch_, max_streams, UINT, ZMOD_RW,
 	"Max number of streams per zfetch");
 
+ZFS_MODULE_PARAM(zfs_prefetch, zfetch_, max_streams_limit, UINT, ZMOD_RW,
+	"Max number of streams per zfetch with many concurrent readers");
+
 ZFS_MODULE_PARAM(zfs_prefetch, zfetch_, min_sec_reap, UINT, ZMOD_RW,
 	"Min time before stream reclaim");
 
 ZFS_MODULE_PARAM(zfs_prefetch, zfetch_, max_distance, UINT, ZMOD_RW,
 	"Max bytes to prefetch per stream (default 8MB)");
 
+ZFS_MODULE_PARAM(zfs_prefetch, zfetch_, max_stride, UINT, ZMOD_RW,
+	"Max bytes between strided accesses to detect (default 16MB)");
+
 ZFS_MODULE_PARAM(zfs_prefetch, zfetch_, array_rd_sz, ULONG, ZMOD_RW,
 	"Number of bytes in a array_read");
 /* END CSTYLED */
@@ -62,6 +62,8 @@ dnode_stats_t dnode_stats = {
 	{ "dnode_alloc_next_chunk",		KSTAT_DATA_UINT64 },
 	{ "dnode_alloc_race",			KSTAT_DATA_UINT64 },
 	{ "dnode_alloc_next_block",		KSTAT_DATA_UINT64 },
+	{ "dnode_alloc_collision",		KSTAT_DATA_UINT64 },
+	{ "dnode_alloc_chunk_abandon",		KSTAT_DATA_UINT64 },
 	{ "dnode_move_invalid",			KSTAT_DATA_UINT64 },
 	{ "dnode_move_recheck1",		KSTAT_DATA_UINT64 },
 	{ "dnode_move_recheck2",		KSTAT_DATA_UINT64 },
@@ -2218,7 +2220,8 @@ done:
 	{
 	int txgoff = tx->tx_txg & TXG_MASK;
 	if (dn->dn_free_ranges[txgoff] == NULL) {
-		dn->dn_free_ranges[txgoff] = range_tree_create(NULL, NULL);
+		dn->dn_free_ranges[txgoff] = range_tree_create(NULL,
+		    RANGE_SEG64, NULL, 0, 0);
 	}
 	range_tree_clear(dn->dn_free_ranges[txgoff], blkid, nblks);
 	range_tree_add(dn->dn_free_ranges[txgoff], blkid, nblks);
@@ -30,6 +30,7 @@
 #include <sys/types.h>
 #include <sys/strings.h>
 #include <sys/qat.h>
+#include <sys/abd.h>
 
 #ifdef _KERNEL
 
@@ -37,6 +38,12 @@
 typedef size_t zlen_t;
 #define	compress_func	z_compress_level
 #define	uncompress_func	z_uncompress
+#define	deflate_init_func	z_deflate_init
+#define	deflate_func		zlib_deflate
+#define	deflate_end_func	z_deflate_end
+#define	inflate_init_func	z_inflate_init
+#define	inflate_func		zlib_inflate
+#define	inflate_end_func	z_inflate_end
 
 #else /* _KERNEL */
 
@@ -44,9 +51,26 @@ typedef size_t zlen_t;
 typedef uLongf zlen_t;
 #define	compress_func	compress2
 #define	uncompress_func	uncompress
+#define	deflate_init_func(s, l)	deflateInit(s, l)
+#define	deflate_func		deflate
+#define	deflate_end_func	deflateEnd
+#define	inflate_init_func(s)	inflateInit(s)
+#define	inflate_func		inflate
+#define	inflate_end_func	inflateEnd
 
 #endif
 
+/*
+ * State for the ABD variants below, which feed the (de)compressor one
+ * chunk of the source ABD at a time instead of copying the whole source
+ * into a linear buffer first.  gs_err holds the most recent zlib return
+ * code; iteration stops as soon as it is anything but Z_OK.
+ */
+typedef struct gzip_abd_stream {
+	z_stream	gs_stream;
+	int		gs_err;
+} gzip_abd_stream_t;
+
 size_t
 gzip_compress(void *s_start, void *d_start, size_t s_len, size_t d_len, int n)
 {
@@ -103,3 +127,103 @@ gzip_decompress(void *s_start, void *d_start, size_t s_len, size_t d_len, int n)
 
 	return (0);
 }
+
+static int
+gzip_deflate_cb(void *buf, size_t len, void *private)
+{
+	gzip_abd_stream_t *gs = private;
+	z_stream *zs = &gs->gs_stream;
+
+	zs->next_in = buf;
+	zs->avail_in = len;
+
+	/* Z_BUF_ERROR here means the output buffer is full */
+	while (zs->avail_in > 0 && gs->gs_err == Z_OK)
+		gs->gs_err = deflate_func(zs, Z_NO_FLUSH);
+
+	return (gs->gs_err != Z_OK);
+}
+
+size_t
+gzip_compress_abd(abd_t *src, void *d_start, size_t s_len, size_t d_len,
+    int n)
+{
+	gzip_abd_stream_t gs;
+	z_stream *zs = &gs.gs_stream;
+	size_t c_len = s_len;
+
+	ASSERT(d_len <= s_len);
+
+	/* The accelerator, if any, needs linear buffers */
+	if (qat_dc_use_accel(s_len)) {
+		void *tmp = abd_borrow_buf_copy(src, s_len);
+		c_len = gzip_compress(tmp, d_start, s_len, d_len, n);
+		abd_return_buf(src, tmp, s_len);
+		return (c_len);
+	}
+
+	bzero(&gs, sizeof (gs));
+	zs->next_out = d_start;
+	zs->avail_out = d_len;
+
+	gs.gs_err = deflate_init_func(zs, n);
+	if (gs.gs_err == Z_OK) {
+		(void) abd_iterate_func(src, 0, s_len, gzip_deflate_cb, &gs);
+		if (gs.gs_err == Z_OK &&
+		    deflate_func(zs, Z_FINISH) == Z_STREAM_END)
+			c_len = zs->total_out;
+		(void) deflate_end_func(zs);
+	}
+
+	if (c_len == s_len && d_len == s_len)
+		abd_copy_to_buf(d_start, src, s_len);
+
+	return (c_len);
+}
+
+static int
+gzip_inflate_cb(void *buf, size_t len, void *private)
+{
+	gzip_abd_stream_t *gs = private;
+	z_stream *zs = &gs->gs_stream;
+
+	zs->next_in = buf;
+	zs->avail_in = len;
+
+	while (zs->avail_in > 0 && gs->gs_err == Z_OK)
+		gs->gs_err = inflate_func(zs, Z_NO_FLUSH);
+
+	/* Anything following the end of the stream is padding */
+	return (gs->gs_err != Z_OK);
+}
+
+/*ARGSUSED*/
+int
+gzip_decompress_abd(abd_t *src, void *d_start, size_t s_len, size_t d_len,
+    int n)
+{
+	gzip_abd_stream_t gs;
+	z_stream *zs = &gs.gs_stream;
+
+	ASSERT(d_len >= s_len);
+
+	if (qat_dc_use_accel(d_len)) {
+		void *tmp = abd_borrow_buf_copy(src, s_len);
+		int err = gzip_decompress(tmp, d_start, s_len, d_len, n);
+		abd_return_buf(src, tmp, s_len);
+		return (err);
+	}
+
+	bzero(&gs, sizeof (gs));
+	zs->next_out = d_start;
+	zs->avail_out = d_len;
+
+	gs.gs_err = inflate_init_func(zs);
+	if (gs.gs_err != Z_OK)
+		return (-1);
+
+	(void) abd_iterate_func(src, 0, s_len, gzip_inflate_cb, &gs);
+	(void) inflate_end_func(zs);
+
+	return (gs.gs_err == Z_STREAM_END ? 0 : -1);
+}
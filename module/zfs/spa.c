@@ -52,12 +52,15 @@
 #include <sys/zap.h>
 #include <sys/zil.h>
 #include <sys/ddt.h>
+#include <sys/brt.h>
 #include <sys/vdev_impl.h>
 #include <sys/vdev_removal.h>
 #include <sys/vdev_indirect_mapping.h>
 #include <sys/vdev_indirect_births.h>
 #include <sys/vdev_initialize.h>
 #include <sys/vdev_trim.h>
+#include <sys/vdev_rebuild.h>
+#include <sys/vdev_raidz.h>
 #include <sys/vdev_disk.h>
 #include <sys/metaslab.h>
 #include <sys/metaslab_impl.h>
@@ -326,6 +329,12 @@ spa_prop_get_config(spa_t *spa, nvlist_t **nvp)
 
 		spa_prop_add_list(*nvp, ZPOOL_PROP_DEDUPRATIO, NULL,
 		    ddt_get_pool_dedup_ratio(spa), src);
+		spa_prop_add_list(*nvp, ZPOOL_PROP_BCLONEUSED, NULL,
+		    brt_get_used(spa), src);
+		spa_prop_add_list(*nvp, ZPOOL_PROP_BCLONESAVED, NULL,
+		    brt_get_saved(spa), src);
+		spa_prop_add_list(*nvp, ZPOOL_PROP_BCLONERATIO, NULL,
+		    brt_get_ratio(spa), src);
 
 		spa_prop_add_list(*nvp, ZPOOL_PROP_HEALTH, NULL,
 		    rvd->vdev_state, src);
@@ -708,6 +717,10 @@ spa_prop_validate(spa_t *spa, nvlist_t *props)
 				error = SET_ERROR(EINVAL);
 			break;
 
+		case ZPOOL_PROP_DEDUP_TABLE_QUOTA:
+			error = nvpair_value_uint64(elem, &intval);
+			break;
+
 		case ZPOOL_PROP_COMMENT:
 			if ((error = nvpair_value_string(elem, &strval)) != 0)
 				break;
@@ -1562,6 +1575,8 @@ spa_unload(spa_t *spa)
 		vdev_initialize_stop_all(root_vdev, VDEV_INITIALIZE_ACTIVE);
 		vdev_trim_stop_all(root_vdev, VDEV_TRIM_ACTIVE);
 		vdev_autotrim_stop_all(spa);
+		vdev_rebuild_stop_all(spa);
+		vdev_raidz_expand_stop_all(spa);
 	}
 
 	/*
@@ -1627,6 +1642,7 @@ spa_unload(spa_t *spa)
 	}
 
 	ddt_unload(spa);
+	brt_unload(spa);
 	spa_unload_log_sm_metadata(spa);
 
 	/*
@@ -4095,6 +4111,8 @@ spa_ld_get_props(spa_t *spa)
 		spa_prop_find(spa, ZPOOL_PROP_AUTOEXPAND, &spa->spa_autoexpand);
 		spa_prop_find(spa, ZPOOL_PROP_MULTIHOST, &spa->spa_multihost);
 		spa_prop_find(spa, ZPOOL_PROP_AUTOTRIM, &spa->spa_autotrim);
+		spa_prop_find(spa, ZPOOL_PROP_DEDUP_TABLE_QUOTA,
+		    &spa->spa_dedup_table_quota);
 		spa->spa_autoreplace = (autoreplace != 0);
 	}
 
@@ -4231,7 +4249,7 @@ spa_ld_load_vdev_metadata(spa_t *spa)
 	 * Propagate the leaf DTLs we just loaded all the way up the vdev tree.
 	 */
 	spa_config_enter(spa, SCL_ALL, FTAG, RW_WRITER);
-	vdev_dtl_reassess(rvd, 0, 0, B_FALSE);
+	vdev_dtl_reassess(rvd, 0, 0, B_FALSE, B_FALSE);
 	spa_config_exit(spa, SCL_ALL, FTAG);
 
 	return (0);
@@ -4252,6 +4270,21 @@ spa_ld_load_dedup_tables(spa_t *spa)
 	return (0);
 }
 
+static int
+spa_ld_load_brt(spa_t *spa)
+{
+	int error = 0;
+	vdev_t *rvd = spa->spa_root_vdev;
+
+	error = brt_load(spa);
+	if (error != 0) {
+		spa_load_failed(spa, "brt_load failed [error=%d]", error);
+		return (spa_vdev_err(rvd, VDEV_AUX_CORRUPT_DATA, EIO));
+	}
+
+	return (0);
+}
+
 static int
 spa_ld_verify_logs(spa_t *spa, spa_import_type_t type, char **ereport)
 {
@@ -4733,6 +4766,10 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 	if (error != 0)
 		return (error);
 
+	error = spa_ld_load_brt(spa);
+	if (error != 0)
+		return (error);
+
 	/*
 	 * Verify the logs now to make sure we don't have any unexpected errors
 	 * when we claim log blocks later.
@@ -4820,11 +4857,21 @@ spa_load_impl(spa_t *spa, spa_import_type_t type, char **ereport)
 		    update_config_cache);
 
 		/*
-		 * Check all DTLs to see if anything needs resilvering.
+		 * Check if a rebuild was in progress and if so resume it.
+		 * Then check all DTLs to see if anything needs resilvering.
+		 * The resilver will be deferred if a rebuild was started.
 		 */
-		if (!dsl_scan_resilvering(spa->spa_dsl_pool) &&
-		    vdev_resilver_needed(spa->spa_root_vdev, NULL, NULL))
+		if (vdev_rebuild_active(spa->spa_root_vdev)) {
+			vdev_rebuild_restart(spa);
+		} else if (!dsl_scan_resilvering(spa->spa_dsl_pool) &&
+		    vdev_resilver_needed(spa->spa_root_vdev, NULL, NULL)) {
 			spa_async_request(spa, SPA_ASYNC_RESILVER);
+		}
+
+		/*
+		 * Resume any raidz expansion which was in progress.
+		 */
+		vdev_raidz_expand_restart(spa);
 
 		/*
 		 * Log the fact that we booted up (so that we can detect if
@@ -5090,6 +5137,12 @@ spa_open_common(const char *pool, spa_t **spapp, void *tag, nvlist_t *nvpolicy,
 			*spapp = NULL;
 			return (error);
 		}
+
+		/*
+		 * Now that the pool is loaded, start rebuilding the
+		 * contents of its persistent cache devices.
+		 */
+		l2arc_spa_rebuild_start(spa);
 	}
 
 	spa_open_ref(spa, tag);
@@ -5792,6 +5845,11 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	 */
 	ddt_create(spa);
 
+	/*
+	 * Create BRT (block reference table).
+	 */
+	brt_create(spa);
+
 	spa_update_dspace(spa);
 
 	tx = dmu_tx_create_assigned(dp, txg);
@@ -5865,6 +5923,8 @@ spa_create(const char *pool, nvlist_t *nvroot, nvlist_t *props,
 	spa->spa_autoexpand = zpool_prop_default_numeric(ZPOOL_PROP_AUTOEXPAND);
 	spa->spa_multihost = zpool_prop_default_numeric(ZPOOL_PROP_MULTIHOST);
 	spa->spa_autotrim = zpool_prop_default_numeric(ZPOOL_PROP_AUTOTRIM);
+	spa->spa_dedup_table_quota =
+	    zpool_prop_default_numeric(ZPOOL_PROP_DEDUP_TABLE_QUOTA);
 
 	if (props != NULL) {
 		spa_configfile_set(spa, props, B_FALSE);
@@ -6046,6 +6106,11 @@ spa_import(char *pool, nvlist_t *config, nvlist_t *props, uint64_t flags)
 		spa->spa_l2cache.sav_sync = B_TRUE;
 	}
 
+	/*
+	 * Start the L2ARC rebuild of the (possibly re-added) cache devices.
+	 */
+	l2arc_spa_rebuild_start(spa);
+
 	/*
 	 * Check for any removed devices.
 	 */
@@ -6292,6 +6357,8 @@ spa_export_common(char *pool, int new_state, nvlist_t **oldconfig,
 			vdev_initialize_stop_all(rvd, VDEV_INITIALIZE_ACTIVE);
 			vdev_trim_stop_all(rvd, VDEV_TRIM_ACTIVE);
 			vdev_autotrim_stop_all(spa);
+			vdev_rebuild_stop_all(spa);
+			vdev_raidz_expand_stop_all(spa);
 		}
 
 		/*
@@ -6498,11 +6565,123 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
 	mutex_enter(&spa_namespace_lock);
 	spa_config_update(spa, SPA_CONFIG_UPDATE_POOL);
 	spa_event_notify(spa, NULL, NULL, ESC_ZFS_VDEV_ADD);
+	/* Cache devices re-added to the same pool can be rebuilt. */
+	if (nl2cache != 0)
+		l2arc_spa_rebuild_start(spa);
 	mutex_exit(&spa_namespace_lock);
 
 	return (0);
 }
 
+/*
+ * Attach a new device to a raidz vdev, expanding the vdev onto it.  The
+ * device becomes the last child of the vdev.  Its space is only usable once
+ * the existing data has been reflowed across all children, which
+ * vdev_raidz_expand_restart() starts from spa_vdev_exit().
+ */
+static int
+spa_vdev_attach_raidz(spa_t *spa, vdev_t *tvd, nvlist_t *nvroot, uint64_t txg)
+{
+	vdev_t *newrootvd, *newvd;
+	char *newvdpath;
+	int error;
+
+	ASSERT3P(tvd->vdev_ops, ==, &vdev_raidz_ops);
+	ASSERT3P(tvd, ==, tvd->vdev_top);
+
+	if (!spa_feature_is_enabled(spa, SPA_FEATURE_RAIDZ_EXPANSION) ||
+	    tvd->vdev_top_zap == 0)
+		return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
+
+	if (vdev_raidz_expand_active(spa->spa_root_vdev))
+		return (spa_vdev_exit(spa, NULL, txg,
+		    ZFS_ERR_RAIDZ_EXPAND_IN_PROGRESS));
+
+	if (dsl_scan_resilvering(spa_get_dsl(spa)))
+		return (spa_vdev_exit(spa, NULL, txg,
+		    ZFS_ERR_RESILVER_IN_PROGRESS));
+
+	if (vdev_rebuild_active(spa->spa_root_vdev))
+		return (spa_vdev_exit(spa, NULL, txg,
+		    ZFS_ERR_REBUILD_IN_PROGRESS));
+
+	/*
+	 * The reflow reads every existing child, and must not race with an
+	 * initialize or trim of one of them.
+	 */
+	if (tvd->vdev_state != VDEV_STATE_HEALTHY)
+		return (spa_vdev_exit(spa, NULL, txg, EBUSY));
+
+	for (uint64_t c = 0; c < tvd->vdev_children; c++) {
+		vdev_t *cvd = tvd->vdev_child[c];
+
+		if (cvd->vdev_initialize_thread != NULL ||
+		    cvd->vdev_trim_thread != NULL)
+			return (spa_vdev_exit(spa, NULL, txg, EBUSY));
+	}
+
+	if ((error = spa_config_parse(spa, &newrootvd, nvroot, NULL, 0,
+	    VDEV_ALLOC_ATTACH)) != 0)
+		return (spa_vdev_exit(spa, NULL, txg, EINVAL));
+
+	if (newrootvd->vdev_children != 1)
+		return (spa_vdev_exit(spa, newrootvd, txg, EINVAL));
+
+	newvd = newrootvd->vdev_child[0];
+
+	if (!newvd->vdev_ops->vdev_op_leaf)
+		return (spa_vdev_exit(spa, newrootvd, txg, EINVAL));
+
+	if (newvd->vdev_isspare)
+		return (spa_vdev_exit(spa, newrootvd, txg, ENOTSUP));
+
+	if ((error = vdev_create(newrootvd, txg, B_FALSE)) != 0)
+		return (spa_vdev_exit(spa, newrootvd, txg, error));
+
+	/*
+	 * Make sure the new device is big enough.
+	 */
+	if (newvd->vdev_asize < vdev_get_min_asize(tvd->vdev_child[0]))
+		return (spa_vdev_exit(spa, newrootvd, txg, EOVERFLOW));
+
+	/*
+	 * The new device cannot have a higher alignment requirement
+	 * than the top-level vdev.
+	 */
+	if (newvd->vdev_ashift > tvd->vdev_ashift)
+		return (spa_vdev_exit(spa, newrootvd, txg, EDOM));
+
+	/*
+	 * Extract the new device from its root and add it to the raidz.
+	 */
+	vdev_remove_child(newrootvd, newvd);
+	newvd->vdev_id = tvd->vdev_children;
+	newvd->vdev_crtxg = tvd->vdev_crtxg;
+	vdev_add_child(tvd, newvd);
+
+	vdev_propagate_state(tvd);
+	vdev_config_dirty(tvd);
+
+	vdev_raidz_expand_start(tvd);
+
+	newvdpath = spa_strdup(newvd->vdev_path);
+
+	spa_event_notify(spa, newvd, NULL, ESC_ZFS_VDEV_ATTACH);
+
+	/*
+	 * Commit the config
+	 */
+	(void) spa_vdev_exit(spa, newrootvd, txg, 0);
+
+	spa_history_log_internal(spa, "vdev attach", NULL,
+	    "expand vdev=%s to raidz%llu-%llu", newvdpath,
+	    (u_longlong_t)tvd->vdev_nparity, (u_longlong_t)tvd->vdev_id);
+
+	spa_strfree(newvdpath);
+
+	return (0);
+}
+
 /*
  * Attach a device to a mirror.  The arguments are the path to any device
  * in the mirror, and the nvroot for the new device.  If the path specifies
@@ -6515,12 +6694,17 @@ spa_vdev_add(spa_t *spa, nvlist_t *nvroot)
  * extra rules: you can't attach to it after it's been created, and upon
  * completion of resilvering, the first disk (the one being replaced)
  * is automatically detached.
+ *
+ * If 'rebuild' is specified, then sequential reconstruction (a.ka. rebuild)
+ * should be performed instead of traditional healing reconstruction.  From
+ * an administrators perspective these are both resilver operations.
  */
 int
-spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
+spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing,
+    int rebuild)
 {
 	uint64_t txg, dtl_max_txg;
-	ASSERTV(vdev_t *rvd = spa->spa_root_vdev);
+	vdev_t *rvd = spa->spa_root_vdev;
 	vdev_t *oldvd, *newvd, *newrootvd, *pvd, *tvd;
 	vdev_ops_t *pvops;
 	char *oldvdpath, *newvdpath;
@@ -6546,11 +6730,55 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 	if (oldvd == NULL)
 		return (spa_vdev_exit(spa, NULL, txg, ENODEV));
 
+	/*
+	 * Attaching to a raidz vdev itself expands it onto the new device.
+	 */
+	if (oldvd->vdev_ops == &vdev_raidz_ops) {
+		if (replacing || rebuild)
+			return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
+		return (spa_vdev_attach_raidz(spa, oldvd, nvroot, txg));
+	}
+
 	if (!oldvd->vdev_ops->vdev_op_leaf)
 		return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
 
 	pvd = oldvd->vdev_parent;
 
+	if (rebuild) {
+		if (!spa_feature_is_enabled(spa, SPA_FEATURE_DEVICE_REBUILD))
+			return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
+
+		/*
+		 * A sequential rebuild and a healing resilver cannot both
+		 * be repairing the pool.
+		 */
+		if (dsl_scan_resilvering(spa_get_dsl(spa)))
+			return (spa_vdev_exit(spa, NULL, txg,
+			    ZFS_ERR_RESILVER_IN_PROGRESS));
+
+		/*
+		 * The top-level vdev must allow its data to be reconstructed
+		 * using only the space maps, that is only mirrors (or a
+		 * single device which will become a mirror) are supported.
+		 */
+		tvd = pvd;
+		if (pvd->vdev_top != NULL)
+			tvd = pvd->vdev_top;
+
+		if (tvd->vdev_ops != &vdev_mirror_ops &&
+		    tvd->vdev_ops != &vdev_root_ops)
+			return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
+
+		for (vdev_t *vd = pvd; vd != tvd; vd = vd->vdev_parent) {
+			if (vd->vdev_ops == &vdev_raidz_ops)
+				return (spa_vdev_exit(spa, NULL, txg, ENOTSUP));
+		}
+	} else {
+		if (vdev_rebuild_active(rvd))
+			return (spa_vdev_exit(spa, NULL, txg,
+			    ZFS_ERR_REBUILD_IN_PROGRESS));
+	}
+
 	if ((error = spa_config_parse(spa, &newrootvd, nvroot, NULL, 0,
 	    VDEV_ALLOC_ATTACH)) != 0)
 		return (spa_vdev_exit(spa, NULL, txg, EINVAL));
@@ -6701,16 +6929,21 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 	vdev_dirty(tvd, VDD_DTL, newvd, txg);
 
 	/*
-	 * Schedule the resilver to restart in the future. We do this to
-	 * ensure that dmu_sync-ed blocks have been stitched into the
+	 * Schedule the resilver or rebuild to restart in the future. We do
+	 * this to ensure that dmu_sync-ed blocks have been stitched into the
 	 * respective datasets. We do not do this if resilvers have been
 	 * deferred.
 	 */
-	if (dsl_scan_resilvering(spa_get_dsl(spa)) &&
-	    spa_feature_is_enabled(spa, SPA_FEATURE_RESILVER_DEFER))
+	if (rebuild) {
+		newvd->vdev_rebuild_txg = txg;
+
+		vdev_rebuild(tvd);
+	} else if (dsl_scan_resilvering(spa_get_dsl(spa)) &&
+	    spa_feature_is_enabled(spa, SPA_FEATURE_RESILVER_DEFER)) {
 		vdev_set_deferred_resilver(spa, newvd);
-	else
+	} else {
 		dsl_resilver_restart(spa->spa_dsl_pool, dtl_max_txg);
+	}
 
 	if (spa->spa_bootfs)
 		spa_event_notify(spa, newvd, NULL, ESC_ZFS_BOOTFS_VDEV_ATTACH);
@@ -6723,10 +6956,11 @@ spa_vdev_attach(spa_t *spa, uint64_t guid, nvlist_t *nvroot, int replacing)
 	(void) spa_vdev_exit(spa, newrootvd, dtl_max_txg, 0);
 
 	spa_history_log_internal(spa, "vdev attach", NULL,
-	    "%s vdev=%s %s vdev=%s",
+	    "%s vdev=%s %s vdev=%s%s",
 	    replacing && newvd_isspare ? "spare in" :
 	    replacing ? "replace" : "attach", newvdpath,
-	    replacing ? "for" : "to", oldvdpath);
+	    replacing ? "for" : "to", oldvdpath,
+	    rebuild ? " (sequential)" : "");
 
 	spa_strfree(oldvdpath);
 	spa_strfree(newvdpath);
@@ -7027,7 +7261,8 @@ spa_vdev_initialize_impl(spa_t *spa, uint64_t guid, uint64_t cmd_type,
 	 */
 	if (cmd_type == POOL_INITIALIZE_START &&
 	    (vd->vdev_initialize_thread != NULL ||
-	    vd->vdev_top->vdev_removing)) {
+	    vd->vdev_top->vdev_removing ||
+	    vd->vdev_top->vdev_raidz_expanding)) {
 		mutex_exit(&vd->vdev_initialize_lock);
 		return (SET_ERROR(EBUSY));
 	} else if (cmd_type == POOL_INITIALIZE_CANCEL &&
@@ -7142,7 +7377,8 @@ spa_vdev_trim_impl(spa_t *spa, uint64_t guid, uint64_t cmd_type,
 	 * which has completed but the thread is not exited.
 	 */
 	if (cmd_type == POOL_TRIM_START &&
-	    (vd->vdev_trim_thread != NULL || vd->vdev_top->vdev_removing)) {
+	    (vd->vdev_trim_thread != NULL || vd->vdev_top->vdev_removing ||
+	    vd->vdev_top->vdev_raidz_expanding)) {
 		mutex_exit(&vd->vdev_trim_lock);
 		return (SET_ERROR(EBUSY));
 	} else if (cmd_type == POOL_TRIM_CANCEL &&
@@ -7270,6 +7506,13 @@ spa_vdev_split_mirror(spa_t *spa, char *newname, nvlist_t *config,
 	if (spa_lookup(newname) != NULL)
 		return (spa_vdev_exit(spa, NULL, txg, EEXIST));
 
+	/*
+	 * Splitting during a rebuild could leave the new pool with devices
+	 * which have not been fully rebuilt.
+	 */
+	if (vdev_rebuild_active(spa->spa_root_vdev))
+		return (spa_vdev_exit(spa, NULL, txg, EBUSY));
+
 	/*
 	 * scan through all the children to ensure they're all mirrors
 	 */
@@ -7942,12 +8185,46 @@ spa_async_thread(void *arg)
 		spa_vdev_resilver_done(spa);
 
 	/*
-	 * Kick off a resilver.
+	 * If any devices are done replacing, detach them.  Then if no
+	 * rebuilds remain active either resilver any devices which still
+	 * need it, or start a scrub to verify the checksums of the data
+	 * copied by the sequential rebuilds.
 	 */
-	if (tasks & SPA_ASYNC_RESILVER &&
-	    (!dsl_scan_resilvering(dp) ||
-	    !spa_feature_is_enabled(dp->dp_spa, SPA_FEATURE_RESILVER_DEFER)))
-		dsl_resilver_restart(dp, 0);
+	if (tasks & SPA_ASYNC_REBUILD_DONE) {
+		boolean_t rebuilding, resilver_needed;
+
+		spa_vdev_resilver_done(spa);
+
+		spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+		rebuilding = vdev_rebuild_active(spa->spa_root_vdev);
+		resilver_needed = vdev_resilver_needed(spa->spa_root_vdev,
+		    NULL, NULL);
+		spa_config_exit(spa, SCL_CONFIG, FTAG);
+
+		if (!rebuilding && resilver_needed) {
+			tasks |= SPA_ASYNC_RESILVER;
+		} else if (!rebuilding && zfs_rebuild_scrub_enabled &&
+		    !dsl_scan_scrubbing(dp) && !dsl_scan_resilvering(dp)) {
+			(void) dsl_scan(dp, POOL_SCAN_SCRUB);
+		}
+	}
+
+	/*
+	 * Kick off a resilver, unless a rebuild is in progress in which case
+	 * the resilver is started once all of the rebuilds have completed.
+	 */
+	if (tasks & SPA_ASYNC_RESILVER) {
+		boolean_t rebuilding;
+
+		spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+		rebuilding = vdev_rebuild_active(spa->spa_root_vdev);
+		spa_config_exit(spa, SCL_CONFIG, FTAG);
+
+		if (!rebuilding && (!dsl_scan_resilvering(dp) ||
+		    !spa_feature_is_enabled(dp->dp_spa,
+		    SPA_FEATURE_RESILVER_DEFER)))
+			dsl_resilver_restart(dp, 0);
+	}
 
 	if (tasks & SPA_ASYNC_INITIALIZE_RESTART) {
 		mutex_enter(&spa_namespace_lock);
@@ -8538,6 +8815,9 @@ spa_sync_props(void *arg, dmu_tx_t *tx)
 			case ZPOOL_PROP_MULTIHOST:
 				spa->spa_multihost = intval;
 				break;
+			case ZPOOL_PROP_DEDUP_TABLE_QUOTA:
+				spa->spa_dedup_table_quota = intval;
+				break;
 			default:
 				break;
 			}
@@ -8772,6 +9052,7 @@ spa_sync_iterate_to_convergence(spa_t *spa, dmu_tx_t *tx)
 
 		ddt_sync(spa, txg);
 		dsl_scan_sync(dp, tx);
+		brt_sync(spa, txg);
 		svr_sync(spa, tx);
 		spa_sync_upgrades(spa, tx);
 
@@ -8967,6 +9248,12 @@ spa_sync(spa_t *spa, uint64_t txg)
 
 	spa_sync_condense_indirect(spa, tx);
 
+	/*
+	 * Add the blocks cloned in this txg to the BRT before any of the
+	 * frees of this txg are processed.
+	 */
+	brt_pending_apply(spa, txg);
+
 	spa_sync_iterate_to_convergence(spa, tx);
 
 #ifdef ZFS_DEBUG
@@ -9413,6 +9700,16 @@ spa_activity_in_progress(spa_t *spa, zpool_wait_activity_t activity,
 		paused = dsl_scan_is_paused_scrub(scn);
 		*in_progress = (scanning && !paused &&
 		    is_scrub == (activity == ZPOOL_WAIT_SCRUB));
+
+		/* a sequential rebuild is reported as a resilver */
+		if (activity == ZPOOL_WAIT_RESILVER && !*in_progress) {
+			mutex_exit(&spa->spa_activities_lock);
+			spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+			mutex_enter(&spa->spa_activities_lock);
+
+			*in_progress = vdev_rebuild_active(spa->spa_root_vdev);
+			spa_config_exit(spa, SCL_CONFIG, FTAG);
+		}
 		break;
 	}
 	default:
@@ -145,6 +145,7 @@
 #include <sys/spa_impl.h>
 #include <sys/spa_checkpoint.h>
 #include <sys/vdev_impl.h>
+#include <sys/vdev_raidz.h>
 #include <sys/zap.h>
 #include <sys/zfeature.h>
 
@@ -464,6 +465,13 @@ spa_checkpoint_check(void *arg, dmu_tx_t *tx)
 	if (spa->spa_removing_phys.sr_state == DSS_SCANNING)
 		return (SET_ERROR(ZFS_ERR_DEVRM_IN_PROGRESS));
 
+	/*
+	 * The reflow of an expanding raidz overwrites data in place, so the
+	 * checkpointed state could not be rewound to.
+	 */
+	if (vdev_raidz_expand_active(spa->spa_root_vdev))
+		return (SET_ERROR(ZFS_ERR_RAIDZ_EXPAND_IN_PROGRESS));
+
 	if (spa->spa_checkpoint_txg != 0)
 		return (SET_ERROR(ZFS_ERR_CHECKPOINT_EXISTS));
 
@@ -40,12 +40,14 @@
 #include <sys/vdev_impl.h>
 #include <sys/vdev_initialize.h>
 #include <sys/vdev_trim.h>
+#include <sys/vdev_rebuild.h>
 #include <sys/vdev_file.h>
 #include <sys/vdev_raidz.h>
 #include <sys/metaslab.h>
 #include <sys/uberblock_impl.h>
 #include <sys/txg.h>
 #include <sys/avl.h>
+#include <sys/btree.h>
 #include <sys/unique.h>
 #include <sys/dsl_pool.h>
 #include <sys/dsl_dir.h>
@@ -56,6 +58,7 @@
 #include <sys/metaslab_impl.h>
 #include <sys/arc.h>
 #include <sys/ddt.h>
+#include <sys/brt.h>
 #include <sys/kstat.h>
 #include "zfs_prop.h"
 #include <sys/zfeature.h>
@@ -1159,6 +1162,8 @@ spa_vdev_enter(spa_t *spa)
 	mutex_enter(&spa_namespace_lock);
 
 	vdev_autotrim_stop_all(spa);
+	vdev_rebuild_stop_all(spa);
+	vdev_raidz_expand_stop_all(spa);
 
 	return (spa_vdev_config_enter(spa));
 }
@@ -1196,7 +1201,7 @@ spa_vdev_config_exit(spa_t *spa, vdev_t *vd, uint64_t txg, int error, char *tag)
 	/*
 	 * Reassess the DTLs.
 	 */
-	vdev_dtl_reassess(spa->spa_root_vdev, 0, 0, B_FALSE);
+	vdev_dtl_reassess(spa->spa_root_vdev, 0, 0, B_FALSE, B_FALSE);
 
 	if (error == 0 && !list_is_empty(&spa->spa_config_dirty_list)) {
 		config_changed = B_TRUE;
@@ -1269,6 +1274,8 @@ int
 spa_vdev_exit(spa_t *spa, vdev_t *vd, uint64_t txg, int error)
 {
 	vdev_autotrim_restart(spa);
+	vdev_rebuild_restart(spa);
+	vdev_raidz_expand_restart(spa);
 
 	spa_vdev_config_exit(spa, vd, txg, error, FTAG);
 	mutex_exit(&spa_namespace_lock);
@@ -1320,7 +1327,7 @@ spa_vdev_state_exit(spa_t *spa, vdev_t *vd, int error)
 	}
 
 	if (vd != NULL || error == 0)
-		vdev_dtl_reassess(vdev_top, 0, 0, B_FALSE);
+		vdev_dtl_reassess(vdev_top, 0, 0, B_FALSE, B_FALSE);
 
 	if (vd != NULL) {
 		if (vd != spa->spa_root_vdev)
@@ -1776,7 +1783,7 @@ void
 spa_update_dspace(spa_t *spa)
 {
 	spa->spa_dspace = metaslab_class_get_dspace(spa_normal_class(spa)) +
-	    ddt_get_dedup_dspace(spa);
+	    ddt_get_dedup_dspace(spa) + brt_get_saved(spa);
 	if (spa->spa_vdev_removal != NULL) {
 		/*
 		 * We can't allocate from the removing device, so
@@ -2318,9 +2325,10 @@ spa_init(int mode)
 	fm_init();
 	zfs_refcount_init();
 	unique_init();
-	range_tree_init();
+	zfs_btree_init();
 	metaslab_alloc_trace_init();
 	ddt_init();
+	brt_init();
 	zio_init();
 	dmu_init();
 	zil_init();
@@ -2332,7 +2340,6 @@ spa_init(int mode)
 	zpool_prop_init();
 	zpool_feature_init();
 	spa_config_load();
-	l2arc_start();
 	scan_init();
 	qat_init();
 	spa_import_progress_init();
@@ -2341,8 +2348,6 @@ spa_init(int mode)
 void
 spa_fini(void)
 {
-	l2arc_stop();
-
 	spa_evict_all();
 
 	vdev_file_fini();
@@ -2352,9 +2357,10 @@ spa_fini(void)
 	zil_fini();
 	dmu_fini();
 	zio_fini();
+	brt_fini();
 	ddt_fini();
 	metaslab_alloc_trace_fini();
-	range_tree_fini();
+	zfs_btree_fini();
 	unique_fini();
 	zfs_refcount_fini();
 	fm_fini();
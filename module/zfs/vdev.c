@@ -216,7 +216,7 @@ vdev_getops(const char *type)
 
 /* ARGSUSED */
 void
-vdev_default_xlate(vdev_t *vd, const range_seg_t *in, range_seg_t *res)
+vdev_default_xlate(vdev_t *vd, const range_seg64_t *in, range_seg64_t *res)
 {
 	res->rs_start = in->rs_start;
 	res->rs_end = in->rs_end;
@@ -246,13 +246,13 @@ vdev_derive_alloc_bias(const char *bias)
  * all children.  This is what's used by anything other than RAID-Z.
  */
 uint64_t
-vdev_default_asize(vdev_t *vd, uint64_t psize)
+vdev_default_asize(vdev_t *vd, uint64_t psize, uint64_t txg)
 {
 	uint64_t asize = P2ROUNDUP(psize, 1ULL << vd->vdev_top->vdev_ashift);
 	uint64_t csize;
 
 	for (int c = 0; c < vd->vdev_children; c++) {
-		csize = vdev_psize_to_asize(vd->vdev_child[c], psize);
+		csize = vdev_psize_to_asize_txg(vd->vdev_child[c], psize, txg);
 		asize = MAX(asize, csize);
 	}
 
@@ -288,9 +288,11 @@ vdev_get_min_asize(vdev_t *vd)
 	 * The allocatable space for a raidz vdev is N * sizeof(smallest child),
 	 * so each child must provide at least 1/Nth of its asize.
 	 */
-	if (pvd->vdev_ops == &vdev_raidz_ops)
-		return ((pvd->vdev_min_asize + pvd->vdev_children - 1) /
-		    pvd->vdev_children);
+	if (pvd->vdev_ops == &vdev_raidz_ops) {
+		uint64_t width = vdev_raidz_physical_width(pvd);
+
+		return ((pvd->vdev_min_asize + width - 1) / width);
+	}
 
 	return (pvd->vdev_min_asize);
 }
@@ -528,7 +530,8 @@ vdev_alloc_common(spa_t *spa, uint_t id, uint64_t guid, vdev_ops_t *ops)
 
 	rw_init(&vd->vdev_indirect_rwlock, NULL, RW_DEFAULT, NULL);
 	mutex_init(&vd->vdev_obsolete_lock, NULL, MUTEX_DEFAULT, NULL);
-	vd->vdev_obsolete_segments = range_tree_create(NULL, NULL);
+	vd->vdev_obsolete_segments = range_tree_create(NULL, RANGE_SEG64, NULL,
+	    0, 0);
 
 	/*
 	 * Initialize rate limit structs for events.  We rate limit ZIO delay
@@ -560,8 +563,19 @@ vdev_alloc_common(spa_t *spa, uint_t id, uint64_t guid, vdev_ops_t *ops)
 	cv_init(&vd->vdev_autotrim_cv, NULL, CV_DEFAULT, NULL);
 	cv_init(&vd->vdev_trim_io_cv, NULL, CV_DEFAULT, NULL);
 
+	mutex_init(&vd->vdev_rebuild_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&vd->vdev_rebuild_cv, NULL, CV_DEFAULT, NULL);
+	mutex_init(&vd->vdev_rebuild_config.vr_io_lock, NULL,
+	    MUTEX_DEFAULT, NULL);
+	cv_init(&vd->vdev_rebuild_config.vr_io_cv, NULL, CV_DEFAULT, NULL);
+
+	mutex_init(&vd->vdev_raidz_expand_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&vd->vdev_raidz_expand_cv, NULL, CV_DEFAULT, NULL);
+	rangelock_init(&vd->vdev_raidz_expand.vre_rangelock, NULL, NULL);
+
 	for (int t = 0; t < DTL_TYPES; t++) {
-		vd->vdev_dtl[t] = range_tree_create(NULL, NULL);
+		vd->vdev_dtl[t] = range_tree_create(NULL, RANGE_SEG64, NULL, 0,
+		    0);
 	}
 	txg_list_create(&vd->vdev_ms_list, spa,
 	    offsetof(struct metaslab, ms_txg_node));
@@ -705,6 +719,25 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 	if (top_level && alloc_bias != VDEV_BIAS_NONE)
 		vd->vdev_alloc_bias = alloc_bias;
 
+	/*
+	 * The geometry of an expanded raidz vdev is only trusted from an
+	 * existing config, never from a config supplied to create or add.
+	 */
+	if (ops == &vdev_raidz_ops && alloctype != VDEV_ALLOC_ADD) {
+		uint64_t expanding = 0, offset = 0;
+		uint64_t *txgs = NULL;
+		uint_t ntxgs = 0;
+
+		(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_RAIDZ_EXPANDING,
+		    &expanding);
+		(void) nvlist_lookup_uint64(nv,
+		    ZPOOL_CONFIG_RAIDZ_EXPAND_OFFSET, &offset);
+		(void) nvlist_lookup_uint64_array(nv,
+		    ZPOOL_CONFIG_RAIDZ_EXPAND_TXGS, &txgs, &ntxgs);
+		vdev_raidz_expand_config_init(vd, expanding, offset, txgs,
+		    ntxgs);
+	}
+
 	if (nvlist_lookup_string(nv, ZPOOL_CONFIG_PATH, &vd->vdev_path) == 0)
 		vd->vdev_path = spa_strdup(vd->vdev_path);
 
@@ -832,6 +865,9 @@ vdev_alloc(spa_t *spa, vdev_t **vdp, nvlist_t *nv, vdev_t *parent, uint_t id,
 		(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_RESILVER_TXG,
 		    &vd->vdev_resilver_txg);
 
+		(void) nvlist_lookup_uint64(nv, ZPOOL_CONFIG_REBUILD_TXG,
+		    &vd->vdev_rebuild_txg);
+
 		if (nvlist_exists(nv, ZPOOL_CONFIG_RESILVER_DEFER))
 			vdev_set_deferred_resilver(spa, vd);
 
@@ -887,6 +923,7 @@ vdev_free(vdev_t *vd)
 	ASSERT3P(vd->vdev_initialize_thread, ==, NULL);
 	ASSERT3P(vd->vdev_trim_thread, ==, NULL);
 	ASSERT3P(vd->vdev_autotrim_thread, ==, NULL);
+	ASSERT3P(vd->vdev_rebuild_thread, ==, NULL);
 
 	/*
 	 * Scan queues are normally destroyed at the end of a scan. If the
@@ -1006,6 +1043,16 @@ vdev_free(vdev_t *vd)
 	cv_destroy(&vd->vdev_autotrim_cv);
 	cv_destroy(&vd->vdev_trim_io_cv);
 
+	mutex_destroy(&vd->vdev_rebuild_lock);
+	cv_destroy(&vd->vdev_rebuild_cv);
+	mutex_destroy(&vd->vdev_rebuild_config.vr_io_lock);
+	cv_destroy(&vd->vdev_rebuild_config.vr_io_cv);
+
+	vdev_raidz_expand_fini(vd);
+	rangelock_fini(&vd->vdev_raidz_expand.vre_rangelock);
+	mutex_destroy(&vd->vdev_raidz_expand_lock);
+	cv_destroy(&vd->vdev_raidz_expand_cv);
+
 	zfs_ratelimit_fini(&vd->vdev_delay_rl);
 	zfs_ratelimit_fini(&vd->vdev_checksum_rl);
 
@@ -1115,6 +1162,25 @@ vdev_top_transfer(vdev_t *svd, vdev_t *tvd)
 	tvd->vdev_islog = svd->vdev_islog;
 	svd->vdev_islog = 0;
 
+	/*
+	 * Any rebuild thread was stopped by spa_vdev_enter(), carry over
+	 * the rebuild state so it can be resumed on the new top-level vdev.
+	 */
+	ASSERT3P(svd->vdev_rebuild_thread, ==, NULL);
+	ASSERT3P(tvd->vdev_rebuild_thread, ==, NULL);
+	mutex_enter(&svd->vdev_rebuild_lock);
+	mutex_enter(&tvd->vdev_rebuild_lock);
+	tvd->vdev_rebuild_config.vr_rebuild_phys =
+	    svd->vdev_rebuild_config.vr_rebuild_phys;
+	tvd->vdev_rebuilding = svd->vdev_rebuilding;
+	tvd->vdev_rebuild_reset_wanted = svd->vdev_rebuild_reset_wanted;
+	bzero(&svd->vdev_rebuild_config.vr_rebuild_phys,
+	    sizeof (vdev_rebuild_phys_t));
+	svd->vdev_rebuilding = B_FALSE;
+	svd->vdev_rebuild_reset_wanted = B_FALSE;
+	mutex_exit(&tvd->vdev_rebuild_lock);
+	mutex_exit(&svd->vdev_rebuild_lock);
+
 	dsl_scan_io_queue_vdev_xfer(svd, tvd);
 }
 
@@ -1628,14 +1694,16 @@ retry_sync:
  * Compute the raidz-deflation ratio.  Note, we hard-code
  * in 128k (1 << 17) because it is the "typical" blocksize.
  * Even though SPA_MAXBLOCKSIZE changed, this algorithm can not change,
- * otherwise it would inconsistently account for existing bp's.
+ * otherwise it would inconsistently account for existing bp's.  For the
+ * same reason an expanded raidz keeps the ratio of its original width.
  */
 static void
 vdev_set_deflate_ratio(vdev_t *vd)
 {
 	if (vd == vd->vdev_top && !vd->vdev_ishole && vd->vdev_ashift != 0) {
 		vd->vdev_deflate_ratio = (1 << 17) /
-		    (vdev_psize_to_asize(vd, 1 << 17) >> SPA_MINBLOCKSHIFT);
+		    (vdev_psize_to_asize_txg(vd, 1 << 17, TXG_INITIAL) >>
+		    SPA_MINBLOCKSHIFT);
 	}
 }
 
@@ -2283,8 +2351,10 @@ vdev_reopen(vdev_t *vd)
 		(void) vdev_validate_aux(vd);
 		if (vdev_readable(vd) && vdev_writeable(vd) &&
 		    vd->vdev_aux == &spa->spa_l2cache &&
-		    !l2arc_vdev_present(vd))
+		    !l2arc_vdev_present(vd)) {
 			l2arc_add_vdev(spa, vd);
+			l2arc_spa_rebuild_start(spa);
+		}
 	} else {
 		(void) vdev_validate(vd);
 	}
@@ -2539,14 +2609,11 @@ vdev_dtl_need_resilver(vdev_t *vd, uint64_t offset, size_t psize)
 static uint64_t
 vdev_dtl_min(vdev_t *vd)
 {
-	range_seg_t *rs;
-
 	ASSERT(MUTEX_HELD(&vd->vdev_dtl_lock));
 	ASSERT3U(range_tree_space(vd->vdev_dtl[DTL_MISSING]), !=, 0);
 	ASSERT0(vd->vdev_children);
 
-	rs = avl_first(&vd->vdev_dtl[DTL_MISSING]->rt_root);
-	return (rs->rs_start - 1);
+	return (range_tree_min(vd->vdev_dtl[DTL_MISSING]) - 1);
 }
 
 /*
@@ -2555,14 +2622,11 @@ vdev_dtl_min(vdev_t *vd)
 static uint64_t
 vdev_dtl_max(vdev_t *vd)
 {
-	range_seg_t *rs;
-
 	ASSERT(MUTEX_HELD(&vd->vdev_dtl_lock));
 	ASSERT3U(range_tree_space(vd->vdev_dtl[DTL_MISSING]), !=, 0);
 	ASSERT0(vd->vdev_children);
 
-	rs = avl_last(&vd->vdev_dtl[DTL_MISSING]->rt_root);
-	return (rs->rs_end);
+	return (range_tree_max(vd->vdev_dtl[DTL_MISSING]));
 }
 
 /*
@@ -2571,15 +2635,15 @@ vdev_dtl_max(vdev_t *vd)
  * scan then it should excise that range from its DTLs. Otherwise, this
  * vdev is considered partially resilvered and should leave its DTL
  * entries intact. The comment in vdev_dtl_reassess() describes how we
- * excise the DTLs.
+ * excise the DTLs.  After a sequential rebuild the same applies, using
+ * the txg range recorded in the top-level vdev's rebuild state.
  */
 static boolean_t
-vdev_dtl_should_excise(vdev_t *vd)
+vdev_dtl_should_excise(vdev_t *vd, boolean_t rebuild_done)
 {
 	spa_t *spa = vd->vdev_spa;
 	dsl_scan_t *scn = spa->spa_dsl_pool->dp_scan;
 
-	ASSERT0(scn->scn_phys.scn_errors);
 	ASSERT0(vd->vdev_children);
 
 	if (vd->vdev_state < VDEV_STATE_DEGRADED)
@@ -2588,8 +2652,32 @@ vdev_dtl_should_excise(vdev_t *vd)
 	if (vd->vdev_resilver_deferred)
 		return (B_FALSE);
 
-	if (vd->vdev_resilver_txg == 0 ||
-	    range_tree_is_empty(vd->vdev_dtl[DTL_MISSING]))
+	if (range_tree_is_empty(vd->vdev_dtl[DTL_MISSING]))
+		return (B_TRUE);
+
+	if (rebuild_done) {
+		vdev_rebuild_phys_t *vrp =
+		    &vd->vdev_top->vdev_rebuild_config.vr_rebuild_phys;
+
+		/*
+		 * A rebuild only repairs the devices which were attached
+		 * for it (their DTLs include TXG_INITIAL), any other missing
+		 * ranges are left for a healing resilver or scrub.
+		 */
+		if (vd->vdev_rebuild_txg == 0)
+			return (B_FALSE);
+
+		if (vdev_dtl_max(vd) <= vrp->vrp_max_txg) {
+			ASSERT3U(vrp->vrp_min_txg, <=, vdev_dtl_min(vd));
+			ASSERT3U(vd->vdev_rebuild_txg, <=, vrp->vrp_max_txg);
+			return (B_TRUE);
+		}
+		return (B_FALSE);
+	}
+
+	ASSERT0(scn->scn_phys.scn_errors);
+
+	if (vd->vdev_resilver_txg == 0)
 		return (B_TRUE);
 
 	/*
@@ -2609,11 +2697,12 @@ vdev_dtl_should_excise(vdev_t *vd)
 }
 
 /*
- * Reassess DTLs after a config change or scrub completion. If txg == 0 no
- * write operations will be issued to the pool.
+ * Reassess DTLs after a config change, scrub, or rebuild completion. If
+ * txg == 0 no write operations will be issued to the pool.
  */
 void
-vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg, int scrub_done)
+vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg,
+    boolean_t scrub_done, boolean_t rebuild_done)
 {
 	spa_t *spa = vd->vdev_spa;
 	avl_tree_t reftree;
@@ -2623,13 +2712,15 @@ vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg, int scrub_done)
 
 	for (int c = 0; c < vd->vdev_children; c++)
 		vdev_dtl_reassess(vd->vdev_child[c], txg,
-		    scrub_txg, scrub_done);
+		    scrub_txg, scrub_done, rebuild_done);
 
 	if (vd == spa->spa_root_vdev || !vdev_is_concrete(vd) || vd->vdev_aux)
 		return;
 
 	if (vd->vdev_ops->vdev_op_leaf) {
 		dsl_scan_t *scn = spa->spa_dsl_pool->dp_scan;
+		vdev_rebuild_t *vr = &vd->vdev_top->vdev_rebuild_config;
+		boolean_t check_excise = B_FALSE;
 
 		mutex_enter(&vd->vdev_dtl_lock);
 
@@ -2639,16 +2730,22 @@ vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg, int scrub_done)
 		if (zfs_scan_ignore_errors && scn)
 			scn->scn_phys.scn_errors = 0;
 
+		if (rebuild_done &&
+		    vr->vr_rebuild_phys.vrp_errors == 0) {
+			check_excise = B_TRUE;
+		} else if (!rebuild_done && (spa->spa_scrub_started ||
+		    (scn != NULL && scn->scn_phys.scn_errors == 0))) {
+			check_excise = B_TRUE;
+		}
+
 		/*
-		 * If we've completed a scan cleanly then determine
-		 * if this vdev should remove any DTLs. We only want to
-		 * excise regions on vdevs that were available during
-		 * the entire duration of this scan.
+		 * If we've completed a scan or rebuild cleanly then
+		 * determine if this vdev should remove any DTLs. We only
+		 * want to excise regions on vdevs that were available
+		 * during the entire duration of the scan or rebuild.
 		 */
-		if (scrub_txg != 0 &&
-		    (spa->spa_scrub_started ||
-		    (scn != NULL && scn->scn_phys.scn_errors == 0)) &&
-		    vdev_dtl_should_excise(vd)) {
+		if (scrub_txg != 0 && check_excise &&
+		    vdev_dtl_should_excise(vd, rebuild_done)) {
 			/*
 			 * We completed a scrub up to scrub_txg.  If we
 			 * did it without rebooting, then the scrub dtl
@@ -2689,15 +2786,21 @@ vdev_dtl_reassess(vdev_t *vd, uint64_t txg, uint64_t scrub_txg, int scrub_done)
 			    range_tree_add, vd->vdev_dtl[DTL_OUTAGE]);
 
 		/*
-		 * If the vdev was resilvering and no longer has any
-		 * DTLs then reset its resilvering flag and dirty
+		 * If the vdev was resilvering or rebuilding and no longer
+		 * has any DTLs then reset the appropriate flag and dirty
 		 * the top level so that we persist the change.
 		 */
-		if (txg != 0 && vd->vdev_resilver_txg != 0 &&
+		if (txg != 0 &&
 		    range_tree_is_empty(vd->vdev_dtl[DTL_MISSING]) &&
 		    range_tree_is_empty(vd->vdev_dtl[DTL_OUTAGE])) {
-			vd->vdev_resilver_txg = 0;
-			vdev_config_dirty(vd->vdev_top);
+			if (vd->vdev_resilver_txg != 0) {
+				vd->vdev_resilver_txg = 0;
+				vdev_config_dirty(vd->vdev_top);
+			}
+			if (vd->vdev_rebuild_txg != 0) {
+				vd->vdev_rebuild_txg = 0;
+				vdev_config_dirty(vd->vdev_top);
+			}
 		}
 
 		mutex_exit(&vd->vdev_dtl_lock);
@@ -2883,7 +2986,7 @@ vdev_dtl_sync(vdev_t *vd, uint64_t txg)
 		ASSERT(vd->vdev_dtl_sm != NULL);
 	}
 
-	rtsync = range_tree_create(NULL, NULL);
+	rtsync = range_tree_create(NULL, RANGE_SEG64, NULL, 0, 0);
 
 	mutex_enter(&vd->vdev_dtl_lock);
 	range_tree_walk(rt, range_tree_add, rtsync);
@@ -2933,10 +3036,10 @@ vdev_dtl_required(vdev_t *vd)
 	 * If not, we can safely offline/detach/remove the device.
 	 */
 	vd->vdev_cant_read = B_TRUE;
-	vdev_dtl_reassess(tvd, 0, 0, B_FALSE);
+	vdev_dtl_reassess(tvd, 0, 0, B_FALSE, B_FALSE);
 	required = !vdev_dtl_empty(tvd, DTL_OUTAGE);
 	vd->vdev_cant_read = cant_read;
-	vdev_dtl_reassess(tvd, 0, 0, B_FALSE);
+	vdev_dtl_reassess(tvd, 0, 0, B_FALSE, B_FALSE);
 
 	if (!required && zio_injection_enabled)
 		required = !!zio_handle_device_injection(vd, NULL, ECHILD);
@@ -3041,6 +3144,35 @@ vdev_load(vdev_t *vd)
 		}
 	}
 
+	/*
+	 * Load any rebuild state from the top-level vdev zap.
+	 */
+	if (vd == vd->vdev_top && vd->vdev_top_zap != 0) {
+		error = vdev_rebuild_load(vd);
+		if (error && error != ENOTSUP) {
+			vdev_set_state(vd, B_FALSE, VDEV_STATE_CANT_OPEN,
+			    VDEV_AUX_CORRUPT_DATA);
+			vdev_dbgmsg(vd, "vdev_load: vdev_rebuild_load "
+			    "failed [error=%d]", error);
+			return (error);
+		}
+	}
+
+	/*
+	 * Load any raidz expansion state from the top-level vdev zap.
+	 */
+	if (vd == vd->vdev_top && vd->vdev_top_zap != 0 &&
+	    vd->vdev_ops == &vdev_raidz_ops) {
+		error = vdev_raidz_expand_load(vd);
+		if (error != 0) {
+			vdev_set_state(vd, B_FALSE, VDEV_STATE_CANT_OPEN,
+			    VDEV_AUX_CORRUPT_DATA);
+			vdev_dbgmsg(vd, "vdev_load: vdev_raidz_expand_load "
+			    "failed [error=%d]", error);
+			return (error);
+		}
+	}
+
 	/*
 	 * If this is a top-level vdev, initialize its metaslabs.
 	 */
@@ -3327,7 +3459,19 @@ vdev_sync(vdev_t *vd, uint64_t txg)
 uint64_t
 vdev_psize_to_asize(vdev_t *vd, uint64_t psize)
 {
-	return (vd->vdev_ops->vdev_op_asize(vd, psize));
+	return (vd->vdev_ops->vdev_op_asize(vd, psize, 0));
+}
+
+/*
+ * Like vdev_psize_to_asize(), but for a block born in the given txg.  This
+ * only matters for a raidz vdev which has been expanded, where older blocks
+ * keep the narrower layout they were written with.  A txg of 0 means a new
+ * block.
+ */
+uint64_t
+vdev_psize_to_asize_txg(vdev_t *vd, uint64_t psize, uint64_t txg)
+{
+	return (vd->vdev_ops->vdev_op_asize(vd, psize, txg));
 }
 
 /*
@@ -4730,7 +4874,8 @@ vdev_set_deferred_resilver(spa_t *spa, vdev_t *vd)
  * translation function to do the real conversion.
  */
 void
-vdev_xlate(vdev_t *vd, const range_seg_t *logical_rs, range_seg_t *physical_rs)
+vdev_xlate(vdev_t *vd, const range_seg64_t *logical_rs,
+    range_seg64_t *physical_rs)
 {
 	/*
 	 * Walk up the vdev tree
@@ -4757,7 +4902,7 @@ vdev_xlate(vdev_t *vd, const range_seg_t *logical_rs, range_seg_t *physical_rs)
 	 * range into its physical components by calling the
 	 * vdev specific translate function.
 	 */
-	range_seg_t intermediate = { { { 0, 0 } } };
+	range_seg64_t intermediate = { 0 };
 	pvd->vdev_ops->vdev_op_xlate(vd, physical_rs, &intermediate);
 
 	physical_rs->rs_start = intermediate.rs_start;
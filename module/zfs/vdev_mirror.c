@@ -51,6 +51,9 @@ typedef struct mirror_stats {
 
 	kstat_named_t vdev_mirror_stat_preferred_found;
 	kstat_named_t vdev_mirror_stat_preferred_not_found;
+
+	kstat_named_t vdev_mirror_stat_hedged_reads;
+	kstat_named_t vdev_mirror_stat_hedged_wins;
 } mirror_stats_t;
 
 static mirror_stats_t mirror_stats = {
@@ -68,7 +71,10 @@ static mirror_stats_t mirror_stats = {
 	{ "preferred_found",			KSTAT_DATA_UINT64 },
 	/* Preferred child vdev not found or equal load  */
 	{ "preferred_not_found",		KSTAT_DATA_UINT64 },
-
+	/* Read issued to a second child because the first was slow */
+	{ "hedged_reads",			KSTAT_DATA_UINT64 },
+	/* Hedged read which completed before the original one */
+	{ "hedged_wins",			KSTAT_DATA_UINT64 },
 };
 
 #define	MIRROR_STAT(stat)		(mirror_stats.stat.value.ui64)
@@ -140,6 +146,46 @@ static int zfs_vdev_mirror_rotating_seek_offset = 1 * 1024 * 1024;
 static int zfs_vdev_mirror_non_rotating_inc = 0;
 static int zfs_vdev_mirror_non_rotating_seek_inc = 1;
 
+/*
+ * Scale the load of each child by the expected service time of its reads
+ * (see vdev_queue_read_latency()), so that reads are sent to the child
+ * expected to complete them first, rather than to the one with the
+ * fewest I/Os in flight. This matters for mirrors of devices of unequal
+ * speed, e.g. NVMe and SAS, or with a failing disk.
+ */
+static int zfs_vdev_mirror_latency_aware = 1;
+
+/*
+ * Hedged reads: when a synchronous read has not completed within this
+ * percentage of the time expected for it (the read service time of the
+ * child times the I/Os queued ahead of it, see vdev_queue_read_latency()),
+ * issue the same read to another child and complete the mirror I/O with
+ * whichever copy arrives first. This bounds the tail latency of reads from
+ * mirrors with a stalling member, at the cost of the extra reads. Zero
+ * disables hedging.
+ */
+static int zfs_vdev_mirror_hedge_pct = 0;
+
+/*
+ * State shared by the reads issued on behalf of a hedged mirror read.
+ * The reads are not children of the mirror zio, which is resumed as soon
+ * as the first of them succeeds (or all of them have failed); the slower
+ * ones finish against this structure alone. It holds SCL_ZIO as reader
+ * until the last of them is done, as the mirror zio's ancestors no longer
+ * do by then.
+ */
+typedef struct mirror_hedge {
+	kmutex_t	mh_lock;
+	spa_t		*mh_spa;
+	zio_t		*mh_zio;	/* mirror zio, until resumed */
+	vdev_t		*mh_primary;	/* child the read was first sent to */
+	taskqid_t	mh_tqid;	/* hedge timer */
+	int		mh_refs;	/* reads in flight + pending timer */
+	int		mh_inflight;	/* reads in flight */
+	boolean_t	mh_timer;	/* hedge timer pending */
+	boolean_t	mh_done;	/* mirror zio has been resumed */
+} mirror_hedge_t;
+
 static inline size_t
 vdev_mirror_map_size(int children)
 {
@@ -175,6 +221,54 @@ static const zio_vsd_ops_t vdev_mirror_vsd_ops = {
 	.vsd_cksum_report = zio_vsd_default_cksum_report
 };
 
+/*
+ * Return the expected service time of a read issued to a child; for an
+ * interior vdev (e.g. replacing or spare) that of its fastest child.
+ */
+static hrtime_t
+vdev_mirror_read_latency(vdev_t *vd)
+{
+	hrtime_t lat = 0;
+
+	if (vd->vdev_ops->vdev_op_leaf)
+		return (vdev_queue_read_latency(vd));
+
+	for (int c = 0; c < vd->vdev_children; c++) {
+		vdev_t *cvd = vd->vdev_child[c];
+
+		if (!vdev_readable(cvd))
+			continue;
+		hrtime_t clat = vdev_mirror_read_latency(cvd);
+		if (lat == 0 || clat < lat)
+			lat = clat;
+	}
+
+	return (lat);
+}
+
+/*
+ * Turn the load of a child, counted in I/Os, into the expected time to
+ * complete a read issued to it: the I/Os ahead of it, plus itself, times
+ * its average read service time. The service time is rounded up to a
+ * power of two microseconds, so that children of about the same speed
+ * keep being picked evenly (see vdev_mirror_preferred_child_randomize()),
+ * while a child that is several times slower is avoided. A child that
+ * hasn't served any reads yet is taken to be fast, so it gets measured.
+ */
+static int
+vdev_mirror_latency_load(vdev_t *vd, int load)
+{
+	uint64_t lat;
+
+	if (!zfs_vdev_mirror_latency_aware)
+		return (load);
+
+	lat = NSEC2USEC(vdev_mirror_read_latency(vd));
+	lat = 1ULL << highbit64(lat);
+
+	return ((int)MIN((uint64_t)(load + 1) * lat, INT_MAX));
+}
+
 static int
 vdev_mirror_load(mirror_map_t *mm, vdev_t *vd, uint64_t zio_offset)
 {
@@ -204,39 +298,42 @@ vdev_mirror_load(mirror_map_t *mm, vdev_t *vd, uint64_t zio_offset)
 		/* Non-rotating media. */
 		if (last_offset == zio_offset) {
 			MIRROR_BUMP(vdev_mirror_stat_non_rotating_linear);
-			return (load + zfs_vdev_mirror_non_rotating_inc);
+			load += zfs_vdev_mirror_non_rotating_inc;
+		} else {
+			/*
+			 * Apply a seek penalty even for non-rotating devices
+			 * as sequential I/O's can be aggregated into fewer
+			 * operations on the device, thus avoiding unnecessary
+			 * per-command overhead and boosting performance.
+			 */
+			MIRROR_BUMP(vdev_mirror_stat_non_rotating_seek);
+			load += zfs_vdev_mirror_non_rotating_seek_inc;
 		}
-
-		/*
-		 * Apply a seek penalty even for non-rotating devices as
-		 * sequential I/O's can be aggregated into fewer operations on
-		 * the device, thus avoiding unnecessary per-command overhead
-		 * and boosting performance.
-		 */
-		MIRROR_BUMP(vdev_mirror_stat_non_rotating_seek);
-		return (load + zfs_vdev_mirror_non_rotating_seek_inc);
+		return (vdev_mirror_latency_load(vd, load));
 	}
 
-	/* Rotating media I/O's which directly follow the last I/O. */
+	offset_diff = (int64_t)(last_offset - zio_offset);
 	if (last_offset == zio_offset) {
+		/*
+		 * Rotating media I/O's which directly follow the last I/O.
+		 */
 		MIRROR_BUMP(vdev_mirror_stat_rotating_linear);
-		return (load + zfs_vdev_mirror_rotating_inc);
-	}
-
-	/*
-	 * Apply half the seek increment to I/O's within seek offset
-	 * of the last I/O issued to this vdev as they should incur less
-	 * of a seek increment.
-	 */
-	offset_diff = (int64_t)(last_offset - zio_offset);
-	if (ABS(offset_diff) < zfs_vdev_mirror_rotating_seek_offset) {
+		load += zfs_vdev_mirror_rotating_inc;
+	} else if (ABS(offset_diff) < zfs_vdev_mirror_rotating_seek_offset) {
+		/*
+		 * Apply half the seek increment to I/O's within seek offset
+		 * of the last I/O issued to this vdev as they should incur
+		 * less of a seek increment.
+		 */
 		MIRROR_BUMP(vdev_mirror_stat_rotating_offset);
-		return (load + (zfs_vdev_mirror_rotating_seek_inc / 2));
+		load += zfs_vdev_mirror_rotating_seek_inc / 2;
+	} else {
+		/* Apply the full seek increment to all other I/O's. */
+		MIRROR_BUMP(vdev_mirror_stat_rotating_seek);
+		load += zfs_vdev_mirror_rotating_seek_inc;
 	}
 
-	/* Apply the full seek increment to all other I/O's. */
-	MIRROR_BUMP(vdev_mirror_stat_rotating_seek);
-	return (load + zfs_vdev_mirror_rotating_seek_inc);
+	return (vdev_mirror_latency_load(vd, load));
 }
 
 /*
@@ -559,6 +656,211 @@ vdev_mirror_child_select(zio_t *zio)
 	return (-1);
 }
 
+static void
+vdev_mirror_hedge_rele(mirror_hedge_t *mh)
+{
+	mutex_enter(&mh->mh_lock);
+	ASSERT3S(mh->mh_refs, >, 0);
+	if (--mh->mh_refs > 0) {
+		mutex_exit(&mh->mh_lock);
+		return;
+	}
+	mutex_exit(&mh->mh_lock);
+
+	spa_config_exit(mh->mh_spa, SCL_ZIO, mh);
+	mutex_destroy(&mh->mh_lock);
+	kmem_free(mh, sizeof (mirror_hedge_t));
+}
+
+/*
+ * Resume the mirror zio, which will find the outcome of the reads in its
+ * mirror map. Called with mh_lock held, which is dropped.
+ */
+static void
+vdev_mirror_hedge_resume(mirror_hedge_t *mh)
+{
+	zio_t *zio = mh->mh_zio;
+	boolean_t timer = mh->mh_timer;
+
+	ASSERT(MUTEX_HELD(&mh->mh_lock));
+	ASSERT(!mh->mh_done);
+
+	mh->mh_done = B_TRUE;
+	mh->mh_zio = NULL;
+	mutex_exit(&mh->mh_lock);
+
+	zio_interrupt(zio);
+
+	/*
+	 * If the timer could not be cancelled it is running, or has run,
+	 * and drops its own hold once it sees mh_done.
+	 */
+	if (timer && taskq_cancel_id(system_delay_taskq, mh->mh_tqid) == 0)
+		vdev_mirror_hedge_rele(mh);
+}
+
+static void
+vdev_mirror_hedge_done(zio_t *zio)
+{
+	mirror_hedge_t *mh = zio->io_private;
+
+	mutex_enter(&mh->mh_lock);
+	mh->mh_inflight--;
+	if (mh->mh_done) {
+		mutex_exit(&mh->mh_lock);
+	} else {
+		zio_t *pio = mh->mh_zio;
+		mirror_map_t *mm = pio->io_vsd;
+		mirror_child_t *mc = NULL;
+
+		for (int c = 0; c < mm->mm_children; c++) {
+			if (mm->mm_child[c].mc_vd == zio->io_vd)
+				mc = &mm->mm_child[c];
+		}
+		ASSERT3P(mc, !=, NULL);
+		mc->mc_error = zio->io_error;
+
+		if (zio->io_error == 0) {
+			abd_copy(pio->io_abd, zio->io_abd, pio->io_size);
+			if (zio->io_vd != mh->mh_primary)
+				MIRROR_BUMP(vdev_mirror_stat_hedged_wins);
+			vdev_mirror_hedge_resume(mh);
+		} else if (mh->mh_inflight == 0) {
+			/*
+			 * Everything issued so far failed; let
+			 * vdev_mirror_io_done() retry the remaining children.
+			 */
+			vdev_mirror_hedge_resume(mh);
+		} else {
+			mutex_exit(&mh->mh_lock);
+		}
+	}
+
+	abd_free(zio->io_abd);
+	vdev_mirror_hedge_rele(mh);
+}
+
+static zio_t *
+vdev_mirror_hedge_io(zio_t *zio, mirror_child_t *mc, mirror_hedge_t *mh)
+{
+	ASSERT(MUTEX_HELD(&mh->mh_lock));
+	ASSERT(mc->mc_vd->vdev_ops->vdev_op_leaf);
+
+	mc->mc_tried = 1;
+	mc->mc_error = 0;
+	mh->mh_refs++;
+	mh->mh_inflight++;
+
+	return (zio_vdev_delegated_io(mc->mc_vd,
+	    mc->mc_offset + VDEV_LABEL_START_SIZE,
+	    abd_alloc_sametype(zio->io_abd, zio->io_size), zio->io_size,
+	    ZIO_TYPE_READ, zio->io_priority, ZIO_VDEV_CHILD_FLAGS(zio),
+	    vdev_mirror_hedge_done, mh));
+}
+
+/*
+ * The read has taken longer than expected: send it to another child too.
+ */
+static void
+vdev_mirror_hedge_fire(void *arg)
+{
+	mirror_hedge_t *mh = arg;
+	zio_t *cio = NULL;
+
+	mutex_enter(&mh->mh_lock);
+	mh->mh_timer = B_FALSE;
+	if (!mh->mh_done) {
+		zio_t *zio = mh->mh_zio;
+		mirror_map_t *mm = zio->io_vsd;
+		int c = vdev_mirror_child_select(zio);
+
+		if (c != -1 && mm->mm_preferred_cnt > 0 &&
+		    mm->mm_child[c].mc_vd->vdev_ops->vdev_op_leaf)
+			cio = vdev_mirror_hedge_io(zio, &mm->mm_child[c], mh);
+	}
+	mutex_exit(&mh->mh_lock);
+
+	if (cio != NULL) {
+		MIRROR_BUMP(vdev_mirror_stat_hedged_reads);
+		zio_nowait(cio);
+	}
+	vdev_mirror_hedge_rele(mh);
+}
+
+/*
+ * Issue a read to child c as a hedged read, if it qualifies: it must be a
+ * synchronous read of a leaf with another healthy child to fall back on,
+ * and the child must have a read latency history to derive the timeout
+ * from. Returns B_FALSE if the read should be issued normally instead.
+ */
+static boolean_t
+vdev_mirror_hedge_start(zio_t *zio, int c)
+{
+	mirror_map_t *mm = zio->io_vsd;
+	mirror_child_t *mc = &mm->mm_child[c];
+	mirror_hedge_t *mh;
+	hrtime_t delay;
+	zio_t *cio;
+	int others = 0;
+
+	if (zfs_vdev_mirror_hedge_pct <= 0 || mm->mm_root ||
+	    mm->mm_resilvering || mm->mm_preferred_cnt == 0 ||
+	    zio->io_priority != ZIO_PRIORITY_SYNC_READ ||
+	    (zio->io_flags & (ZIO_FLAG_IO_RETRY | ZIO_FLAG_SCRUB |
+	    ZIO_FLAG_RESILVER)) ||
+	    !mc->mc_vd->vdev_ops->vdev_op_leaf)
+		return (B_FALSE);
+
+	for (int i = 0; i < mm->mm_children; i++) {
+		if (i != c && !mm->mm_child[i].mc_tried &&
+		    !mm->mm_child[i].mc_skipped)
+			others++;
+	}
+	if (others == 0)
+		return (B_FALSE);
+
+	delay = vdev_queue_read_latency(mc->mc_vd);
+	if (delay == 0)
+		return (B_FALSE);
+	delay = delay * (vdev_queue_length(mc->mc_vd) + 1) *
+	    zfs_vdev_mirror_hedge_pct / 100;
+
+	mh = kmem_zalloc(sizeof (mirror_hedge_t), KM_SLEEP);
+	mutex_init(&mh->mh_lock, NULL, MUTEX_DEFAULT, NULL);
+	mh->mh_spa = zio->io_spa;
+	mh->mh_zio = zio;
+	mh->mh_primary = mc->mc_vd;
+	mh->mh_refs = 1;
+	mh->mh_timer = B_TRUE;
+
+	/*
+	 * Never wait for the config lock here; we already hold it as
+	 * reader through the logical zio.
+	 */
+	if (!spa_config_tryenter(zio->io_spa, SCL_ZIO, mh, RW_READER)) {
+		mutex_destroy(&mh->mh_lock);
+		kmem_free(mh, sizeof (mirror_hedge_t));
+		return (B_FALSE);
+	}
+
+	mutex_enter(&mh->mh_lock);
+	mh->mh_tqid = taskq_dispatch_delay(system_delay_taskq,
+	    vdev_mirror_hedge_fire, mh, TQ_NOSLEEP,
+	    ddi_get_lbolt() + MAX(NSEC_TO_TICK(delay), 1));
+	if (mh->mh_tqid == TASKQID_INVALID) {
+		mutex_exit(&mh->mh_lock);
+		spa_config_exit(zio->io_spa, SCL_ZIO, mh);
+		mutex_destroy(&mh->mh_lock);
+		kmem_free(mh, sizeof (mirror_hedge_t));
+		return (B_FALSE);
+	}
+	cio = vdev_mirror_hedge_io(zio, mc, mh);
+	mutex_exit(&mh->mh_lock);
+
+	zio_nowait(cio);
+	return (B_TRUE);
+}
+
 static void
 vdev_mirror_io_start(zio_t *zio)
 {
@@ -602,6 +904,8 @@ vdev_mirror_io_start(zio_t *zio)
 		 * For normal reads just pick one child.
 		 */
 		c = vdev_mirror_child_select(zio);
+		if (c >= 0 && vdev_mirror_hedge_start(zio, c))
+			return;
 		children = (c >= 0);
 	} else {
 		ASSERT(zio->io_type == ZIO_TYPE_WRITE);
@@ -849,4 +1153,10 @@ ZFS_MODULE_PARAM(zfs_vdev_mirror, zfs_vdev_mirror_, non_rotating_inc, INT, ZMOD_
 
 ZFS_MODULE_PARAM(zfs_vdev_mirror, zfs_vdev_mirror_, non_rotating_seek_inc, INT, ZMOD_RW,
 	"Non-rotating media load increment for seeking I/O's");
+
+ZFS_MODULE_PARAM(zfs_vdev_mirror, zfs_vdev_mirror_, latency_aware, INT, ZMOD_RW,
+	"Scale mirror child load by its average read service time");
+
+ZFS_MODULE_PARAM(zfs_vdev_mirror, zfs_vdev_mirror_, hedge_pct, INT, ZMOD_RW,
+	"Percent of expected read time before a hedged read is issued");
 /* END CSTYLED */
@@ -205,6 +205,46 @@ int zfs_vdev_queue_depth_pct = 300;
  */
 int zfs_vdev_def_queue_depth = 32;
 
+/*
+ * Each leaf vdev keeps an exponentially weighted moving average of the
+ * service time of its reads, which vdev_mirror_load() uses to steer reads
+ * away from slow mirror children, and likewise of its writes, which the
+ * metaslab allocator uses to favor fast top-level vdevs. Every completed
+ * I/O moves the average by 1/2^zfs_vdev_read_ewma_shift of its difference
+ * from the average; a lower shift reacts faster, a higher one is less noisy.
+ */
+int zfs_vdev_read_ewma_shift = 3;
+
+/*
+ * Per leaf vdev read latency kstat, zfs/<pool>/vdev-0x<guid>-latency.
+ */
+typedef struct vdev_queue_stats {
+	kstat_named_t vqs_read_latency;
+	kstat_named_t vqs_read_ewma;
+	kstat_named_t vqs_read_samples;
+	kstat_named_t vqs_write_latency;
+	kstat_named_t vqs_write_ewma;
+	kstat_named_t vqs_write_samples;
+	kstat_named_t vqs_active;
+} vdev_queue_stats_t;
+
+static vdev_queue_stats_t vdev_queue_stats_template = {
+	/* Current estimate, as used by the mirror read selection (ns) */
+	{ "read_latency",			KSTAT_DATA_UINT64 },
+	/* Moving average as of the last read sampled (ns) */
+	{ "read_ewma",				KSTAT_DATA_UINT64 },
+	/* Reads sampled into the moving average */
+	{ "read_samples",			KSTAT_DATA_UINT64 },
+	/* Current estimate, as used by the metaslab allocator (ns) */
+	{ "write_latency",			KSTAT_DATA_UINT64 },
+	/* Moving average as of the last write sampled (ns) */
+	{ "write_ewma",				KSTAT_DATA_UINT64 },
+	/* Writes sampled into the moving average */
+	{ "write_samples",			KSTAT_DATA_UINT64 },
+	/* I/Os currently issued to the device */
+	{ "active",				KSTAT_DATA_UINT64 },
+};
+
 /*
  * Allow TRIM I/Os to be aggregated.  This should normally not be needed since
  * TRIM I/O for extents up to zfs_trim_extent_bytes_max (128M) can be submitted
@@ -394,6 +434,68 @@ vdev_queue_class_to_issue(vdev_queue_t *vq)
 	return (ZIO_PRIORITY_NUM_QUEUEABLE);
 }
 
+static int
+vdev_queue_kstat_update(kstat_t *ksp, int rw)
+{
+	vdev_t *vd = ksp->ks_private;
+	vdev_queue_t *vq = &vd->vdev_queue;
+	vdev_queue_stats_t *vqs = ksp->ks_data;
+
+	if (rw == KSTAT_WRITE)
+		return (SET_ERROR(EACCES));
+
+	vqs->vqs_read_latency.value.ui64 = vdev_queue_read_latency(vd);
+	vqs->vqs_read_ewma.value.ui64 = vq->vq_read_ewma;
+	vqs->vqs_read_samples.value.ui64 = vq->vq_read_samples;
+	vqs->vqs_write_latency.value.ui64 = vdev_queue_write_latency(vd);
+	vqs->vqs_write_ewma.value.ui64 = vq->vq_write_ewma;
+	vqs->vqs_write_samples.value.ui64 = vq->vq_write_samples;
+	vqs->vqs_active.value.ui64 = vdev_queue_length(vd);
+
+	return (0);
+}
+
+static void
+vdev_queue_kstat_init(vdev_t *vd)
+{
+	vdev_queue_t *vq = &vd->vdev_queue;
+	char *module = kmem_asprintf("zfs/%s", spa_name(vd->vdev_spa));
+	char *name = kmem_asprintf("vdev-0x%llx-latency",
+	    (u_longlong_t)vd->vdev_guid);
+	kstat_t *ksp;
+
+	ksp = kstat_create(module, 0, name, "misc", KSTAT_TYPE_NAMED,
+	    sizeof (vdev_queue_stats_t) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (ksp != NULL) {
+		ksp->ks_data = kmem_alloc(sizeof (vdev_queue_stats_t),
+		    KM_SLEEP);
+		bcopy(&vdev_queue_stats_template, ksp->ks_data,
+		    sizeof (vdev_queue_stats_t));
+		ksp->ks_private = vd;
+		ksp->ks_update = vdev_queue_kstat_update;
+		kstat_install(ksp);
+	}
+	vq->vq_ksp = ksp;
+
+	strfree(name);
+	strfree(module);
+}
+
+static void
+vdev_queue_kstat_fini(vdev_t *vd)
+{
+	vdev_queue_t *vq = &vd->vdev_queue;
+	kstat_t *ksp = vq->vq_ksp;
+
+	if (ksp == NULL)
+		return;
+
+	vq->vq_ksp = NULL;
+	kstat_delete(ksp);
+	kmem_free(ksp->ks_data, sizeof (vdev_queue_stats_t));
+}
+
 void
 vdev_queue_init(vdev_t *vd)
 {
@@ -436,6 +538,9 @@ vdev_queue_init(vdev_t *vd)
 	}
 
 	vq->vq_last_offset = 0;
+
+	if (vd->vdev_ops->vdev_op_leaf && !vd->vdev_ishole)
+		vdev_queue_kstat_init(vd);
 }
 
 void
@@ -443,6 +548,8 @@ vdev_queue_fini(vdev_t *vd)
 {
 	vdev_queue_t *vq = &vd->vdev_queue;
 
+	vdev_queue_kstat_fini(vd);
+
 	for (zio_priority_t p = 0; p < ZIO_PRIORITY_NUM_QUEUEABLE; p++)
 		avl_destroy(vdev_queue_class_tree(vq, p));
 	avl_destroy(&vq->vq_active_tree);
@@ -855,6 +962,17 @@ vdev_queue_io(zio_t *zio)
 	return (nio);
 }
 
+static void
+vdev_queue_ewma_add(hrtime_t *ewma, uint64_t *samples, hrtime_t delay)
+{
+	int shift = MIN(MAX(zfs_vdev_read_ewma_shift, 0), 16);
+
+	if ((*samples)++ == 0)
+		*ewma = delay;
+	else
+		*ewma += (delay - *ewma) / (1 << shift);
+}
+
 void
 vdev_queue_io_done(zio_t *zio)
 {
@@ -869,6 +987,16 @@ vdev_queue_io_done(zio_t *zio)
 	vq->vq_io_complete_ts = gethrtime();
 	vq->vq_io_delta_ts = vq->vq_io_complete_ts - zio->io_timestamp;
 
+	if (zio->io_type == ZIO_TYPE_READ && zio->io_delay != 0) {
+		vdev_queue_ewma_add(&vq->vq_read_ewma, &vq->vq_read_samples,
+		    zio->io_delay);
+		vq->vq_read_ewma_ts = vq->vq_io_complete_ts;
+	} else if (zio->io_type == ZIO_TYPE_WRITE && zio->io_delay != 0) {
+		vdev_queue_ewma_add(&vq->vq_write_ewma, &vq->vq_write_samples,
+		    zio->io_delay);
+		vq->vq_write_ewma_ts = vq->vq_io_complete_ts;
+	}
+
 	while ((nio = vdev_queue_io_to_issue(vq)) != NULL) {
 		mutex_exit(&vq->vq_lock);
 		if (nio->io_done == vdev_queue_agg_io_done) {
@@ -952,6 +1080,48 @@ vdev_queue_last_offset(vdev_t *vd)
 	return (vd->vdev_queue.vq_last_offset);
 }
 
+/*
+ * Return the current value of a service time average, or zero if nothing
+ * has been sampled into it yet. Without samples to refresh it, the average
+ * is halved for every second since the last one, so that a device which
+ * was slow for a while and hence got no I/O is eventually tried again,
+ * rather than avoided forever.
+ */
+static hrtime_t
+vdev_queue_ewma_latency(hrtime_t ewma, hrtime_t ts, uint64_t samples)
+{
+	hrtime_t idle = gethrtime() - ts;
+
+	if (samples == 0 || ewma <= 0)
+		return (0);
+
+	return (ewma >> MIN(MAX(idle, 0) / NANOSEC, 62));
+}
+
+/*
+ * Return the expected service time of a read issued to a leaf vdev.
+ */
+hrtime_t
+vdev_queue_read_latency(vdev_t *vd)
+{
+	vdev_queue_t *vq = &vd->vdev_queue;
+
+	return (vdev_queue_ewma_latency(vq->vq_read_ewma, vq->vq_read_ewma_ts,
+	    vq->vq_read_samples));
+}
+
+/*
+ * Return the expected service time of a write issued to a leaf vdev.
+ */
+hrtime_t
+vdev_queue_write_latency(vdev_t *vd)
+{
+	vdev_queue_t *vq = &vd->vdev_queue;
+
+	return (vdev_queue_ewma_latency(vq->vq_write_ewma,
+	    vq->vq_write_ewma_ts, vq->vq_write_samples));
+}
+
 /* BEGIN CSTYLED */
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, aggregation_limit, INT, ZMOD_RW,
 	"Max vdev I/O aggregation size");
@@ -1027,4 +1197,7 @@ ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, trim_min_active, INT, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, queue_depth_pct, INT, ZMOD_RW,
 	"Queue depth percentage for each top-level vdev");
+
+ZFS_MODULE_PARAM(zfs_vdev, zfs_vdev_, read_ewma_shift, INT, ZMOD_RW,
+	"Weight of new samples in the average read service time, as 1/2^n");
 /* END CSTYLED */
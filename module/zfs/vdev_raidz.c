@@ -35,6 +35,14 @@
 #include <sys/fm/fs/zfs.h>
 #include <sys/vdev_raidz.h>
 #include <sys/vdev_raidz_impl.h>
+#include <sys/zap.h>
+#include <sys/dmu_tx.h>
+#include <sys/dsl_pool.h>
+#include <sys/dsl_synctask.h>
+#include <sys/metaslab_impl.h>
+#include <sys/spa_impl.h>
+#include <sys/zfeature.h>
+#include <sys/zfs_rlock.h>
 
 #ifdef ZFS_DEBUG
 #include <sys/vdev.h>	/* For vdev_xlate() in vdev_raidz_io_verify() */
@@ -134,6 +142,73 @@
 	VDEV_RAIDZ_64MUL_2((x), mask); \
 }
 
+/*
+ * Upper bound on the data copied by each batch of a raidz expansion.
+ */
+unsigned long raidz_expand_max_copy_bytes = 16 * 1024 * 1024;
+
+/*
+ * When a raidz vdev has been expanded, the sectors of a block no longer lie
+ * in the columns that vdev_raidz_map_alloc() computes.  The map still holds
+ * the columns of the block's logical layout, which parity generation and
+ * reconstruction work on, and a raidz_xmap_t records where each sector of
+ * those columns is stored.  Sectors which are contiguous on a child are
+ * gathered into runs, each of which is a single child I/O.
+ */
+typedef struct raidz_xrun {
+	uint64_t	rr_devidx;	/* child vdev */
+	uint64_t	rr_offset;	/* offset on the child */
+	uint64_t	rr_size;	/* size of the I/O */
+	abd_t		*rr_abd;	/* data for the I/O */
+	int		rr_error;	/* I/O error */
+	uint8_t		rr_tried;	/* did we attempt this I/O? */
+	uint8_t		rr_skipped;	/* did we skip this I/O? */
+	uint8_t		rr_shadow;	/* copy to the pre-expansion location */
+} raidz_xrun_t;
+
+typedef struct raidz_xsect {
+	uint32_t	rs_run;		/* run holding this sector */
+	uint32_t	rs_index;	/* sector index within the run */
+	uint32_t	rs_shadow;	/* shadow run, or RAIDZ_XRUN_NONE */
+	uint32_t	rs_shadow_index; /* sector index within the shadow */
+	int		rs_error;	/* error for this sector */
+} raidz_xsect_t;
+
+#define	RAIDZ_XRUN_NONE		UINT32_MAX
+
+typedef struct raidz_xmap {
+	uint64_t	rx_ashift;	/* sector size */
+	uint64_t	rx_width;	/* logical width of the block */
+	uint64_t	rx_rows;	/* logical rows in the block */
+	uint64_t	rx_cols;	/* columns in the logical rows */
+	uint64_t	rx_nsect;	/* sectors in the block */
+	uint64_t	rx_nruns;	/* valid entries in rx_runs */
+	uint64_t	rx_maxruns;	/* allocated entries in rx_runs */
+	boolean_t	rx_swapped;	/* single parity columns swapped */
+	raidz_xrun_t	*rx_runs;	/* child I/Os */
+	raidz_xsect_t	*rx_sect;	/* indexed by sector within block */
+	abd_t		*rx_zero;	/* stands in for absent sectors */
+	raidz_map_t	*rx_row;	/* one row, for reconstruction */
+} raidz_xmap_t;
+
+static void
+vdev_raidz_xmap_free(raidz_xmap_t *xm)
+{
+	for (uint64_t r = 0; r < xm->rx_nruns; r++) {
+		if (xm->rx_runs[r].rr_abd != NULL)
+			abd_free(xm->rx_runs[r].rr_abd);
+	}
+	kmem_free(xm->rx_runs, xm->rx_maxruns * sizeof (raidz_xrun_t));
+	vmem_free(xm->rx_sect, xm->rx_nsect * sizeof (raidz_xsect_t));
+	if (xm->rx_zero != NULL)
+		abd_free(xm->rx_zero);
+	if (xm->rx_row != NULL) {
+		kmem_free(xm->rx_row,
+		    offsetof(raidz_map_t, rm_col[xm->rx_row->rm_scols]));
+	}
+	kmem_free(xm, sizeof (raidz_xmap_t));
+}
+
 void
 vdev_raidz_map_free(raidz_map_t *rm)
 {
@@ -152,6 +227,9 @@ vdev_raidz_map_free(raidz_map_t *rm)
 	if (rm->rm_abd_copy != NULL)
 		abd_free(rm->rm_abd_copy);
 
+	if (rm->rm_xmap != NULL)
+		vdev_raidz_xmap_free(rm->rm_xmap);
+
 	kmem_free(rm, offsetof(raidz_map_t, rm_col[rm->rm_scols]));
 }
 
@@ -160,6 +238,11 @@ vdev_raidz_map_free_vsd(zio_t *zio)
 {
 	raidz_map_t *rm = zio->io_vsd;
 
+	if (rm->rm_lr != NULL) {
+		rangelock_exit(rm->rm_lr);
+		rm->rm_lr = NULL;
+	}
+
 	ASSERT0(rm->rm_freed);
 	rm->rm_freed = 1;
 
@@ -326,6 +409,15 @@ static const zio_vsd_ops_t vdev_raidz_vsd_ops = {
 	.vsd_cksum_report = vdev_raidz_cksum_report
 };
 
+/*
+ * The columns of an expanded map are not what was read from each child, so
+ * checksum reports carry the whole block like they do for a mirror.
+ */
+static const zio_vsd_ops_t vdev_raidz_xmap_vsd_ops = {
+	.vsd_free = vdev_raidz_map_free_vsd,
+	.vsd_cksum_report = zio_vsd_default_cksum_report
+};
+
 /*
  * Divides the IO evenly across all child vdevs; usually, dcols is
  * the number of children in the target vdev.
@@ -396,6 +488,8 @@ vdev_raidz_map_alloc(zio_t *zio, uint64_t ashift, uint64_t dcols,
 	rm->rm_reports = 0;
 	rm->rm_freed = 0;
 	rm->rm_ecksuminjected = 0;
+	rm->rm_xmap = NULL;
+	rm->rm_lr = NULL;
 
 	asize = 0;
 
@@ -1552,6 +1646,79 @@ vdev_raidz_reconstruct(raidz_map_t *rm, const int *t, int nt)
 	return (code);
 }
 
+/*
+ * Return the width of the logical rows of a block born in the given txg,
+ * or of a new block if txg is 0.  Each expansion widens the rows of the
+ * blocks born after it completed; older blocks keep their width.
+ */
+uint64_t
+vdev_raidz_logical_width(vdev_t *vd, uint64_t txg)
+{
+	vdev_raidz_expand_t *vre = &vd->vdev_raidz_expand;
+	uint64_t ntxgs = vre->vre_ntxgs;
+	uint64_t width = vre->vre_width0;
+
+	/* Pairs with vdev_raidz_expand_complete_sync() */
+	membar_consumer();
+
+	if (width == 0) {
+		width = vd->vdev_children - ntxgs -
+		    (vd->vdev_raidz_expanding ? 1 : 0);
+	}
+	for (uint64_t i = 0; i < ntxgs; i++) {
+		if (txg == 0 || vre->vre_txgs[i] <= txg)
+			width++;
+	}
+
+	return (width);
+}
+
+/*
+ * Return the number of children the sectors of the vdev are spread over,
+ * which lags the number of children while an expansion is in progress.
+ */
+uint64_t
+vdev_raidz_physical_width(vdev_t *vd)
+{
+	return (vd->vdev_children - (vd->vdev_raidz_expanding ? 1 : 0));
+}
+
+/*
+ * Return the reflow offset which is known to be on disk.  Sectors between
+ * it and vre_offset may still be read from their old location after a
+ * crash, so writes to them must go to both locations.
+ */
+static uint64_t
+vdev_raidz_expand_durable(vdev_t *vd)
+{
+	vdev_raidz_expand_t *vre = &vd->vdev_raidz_expand;
+
+	ASSERT(MUTEX_HELD(&vd->vdev_raidz_expand_lock));
+
+	if (spa_last_synced_txg(vd->vdev_spa) >= vre->vre_offset_phys_txg)
+		return (vre->vre_offset_phys);
+	return (vre->vre_offset_prev);
+}
+
+/*
+ * Find the child and child offset holding the given sector of the vdev.
+ * Sectors below the reflow point are spread over all children, the rest
+ * over all but the child being added.  A shadow is the location a sector
+ * had before it was reflowed.
+ */
+static void
+vdev_raidz_sector_map(vdev_t *vd, uint64_t sector, uint64_t reflow,
+    boolean_t shadow, uint64_t *devidx, uint64_t *offset)
+{
+	uint64_t width = vd->vdev_children;
+
+	if (shadow || sector >= reflow)
+		width--;
+
+	*devidx = sector % width;
+	*offset = (sector / width) << vd->vdev_top->vdev_ashift;
+}
+
 static int
 vdev_raidz_open(vdev_t *vd, uint64_t *asize, uint64_t *max_asize,
     uint64_t *ashift)
@@ -1586,8 +1753,14 @@ vdev_raidz_open(vdev_t *vd, uint64_t *asize, uint64_t *max_asize,
 		*ashift = MAX(*ashift, cvd->vdev_ashift);
 	}
 
-	*asize *= vd->vdev_children;
-	*max_asize *= vd->vdev_children;
+	if (vd->vdev_raidz_expand.vre_width0 == 0) {
+		vd->vdev_raidz_expand.vre_width0 = vd->vdev_children -
+		    vd->vdev_raidz_expand.vre_ntxgs -
+		    (vd->vdev_raidz_expanding ? 1 : 0);
+	}
+
+	*asize *= vdev_raidz_physical_width(vd);
+	*max_asize *= vdev_raidz_physical_width(vd);
 
 	if (numerrors > nparity) {
 		vd->vdev_stat.vs_aux = VDEV_AUX_NO_REPLICAS;
@@ -1607,11 +1780,11 @@ vdev_raidz_close(vdev_t *vd)
 }
 
 static uint64_t
-vdev_raidz_asize(vdev_t *vd, uint64_t psize)
+vdev_raidz_asize(vdev_t *vd, uint64_t psize, uint64_t txg)
 {
 	uint64_t asize;
 	uint64_t ashift = vd->vdev_top->vdev_ashift;
-	uint64_t cols = vd->vdev_children;
+	uint64_t cols = vdev_raidz_logical_width(vd, txg);
 	uint64_t nparity = vd->vdev_nparity;
 
 	asize = ((psize - 1) >> ashift) + 1;
@@ -1638,10 +1811,9 @@ vdev_raidz_io_verify(zio_t *zio, raidz_map_t *rm, int col)
 	vdev_t *vd = zio->io_vd;
 	vdev_t *tvd = vd->vdev_top;
 
-	range_seg_t logical_rs, physical_rs;
+	range_seg64_t logical_rs, physical_rs;
 	logical_rs.rs_start = zio->io_offset;
-	logical_rs.rs_end = logical_rs.rs_start +
-	    vdev_raidz_asize(zio->io_vd, zio->io_size);
+	logical_rs.rs_end = logical_rs.rs_start + rm->rm_asize;
 
 	raidz_col_t *rc = &rm->rm_col[col];
 	vdev_t *cvd = vd->vdev_child[rc->rc_devidx];
@@ -1664,6 +1836,261 @@ vdev_raidz_io_verify(zio_t *zio, raidz_map_t *rm, int col)
 #endif
 }
 
+/*
+ * Find the column and row of the map holding the given sector of the block.
+ * The sectors of a block fill its logical rows in order, except that the
+ * first two columns are swapped in some single parity maps.
+ */
+static void
+vdev_raidz_xmap_locate(raidz_xmap_t *xm, uint64_t s, uint64_t *col,
+    uint64_t *row)
+{
+	uint64_t c = s % xm->rx_width;
+
+	if (xm->rx_swapped && c < 2)
+		c ^= 1;
+
+	*col = c;
+	*row = s / xm->rx_width;
+}
+
+/*
+ * Add a sector to the last run on the child holding it, or start a new run
+ * if the sector does not directly follow that run.
+ */
+static uint32_t
+vdev_raidz_xmap_add(raidz_xmap_t *xm, uint32_t *last, uint64_t devidx,
+    uint64_t offset, boolean_t shadow, uint32_t *index)
+{
+	uint64_t sectsz = 1ULL << xm->rx_ashift;
+	raidz_xrun_t *rr;
+
+	if (last[devidx] != RAIDZ_XRUN_NONE) {
+		rr = &xm->rx_runs[last[devidx]];
+		if (rr->rr_offset + rr->rr_size == offset) {
+			*index = rr->rr_size >> xm->rx_ashift;
+			rr->rr_size += sectsz;
+			return (last[devidx]);
+		}
+	}
+
+	VERIFY3U(xm->rx_nruns, <, xm->rx_maxruns);
+	last[devidx] = xm->rx_nruns++;
+
+	rr = &xm->rx_runs[last[devidx]];
+	rr->rr_devidx = devidx;
+	rr->rr_offset = offset;
+	rr->rr_size = sectsz;
+	rr->rr_shadow = shadow;
+	*index = 0;
+
+	return (last[devidx]);
+}
+
+/*
+ * Work out where each sector of the block is stored.  The sectors below
+ * the reflow point are in the expanded layout, the rest are still where
+ * they were before the expansion.  Writes to sectors which have been
+ * reflowed but whose new location isn't durable yet also go to the old
+ * location, which is where they would be read from after a crash.
+ */
+static raidz_xmap_t *
+vdev_raidz_xmap_alloc(zio_t *zio, raidz_map_t *rm, uint64_t width,
+    uint64_t reflow, uint64_t durable)
+{
+	vdev_t *vd = zio->io_vd;
+	uint64_t children = vd->vdev_children;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t b = zio->io_offset >> ashift;
+	raidz_xmap_t *xm;
+	uint32_t *last;
+
+	xm = kmem_zalloc(sizeof (raidz_xmap_t), KM_SLEEP);
+	xm->rx_ashift = ashift;
+	xm->rx_width = width;
+	xm->rx_rows = rm->rm_col[0].rc_size >> ashift;
+	xm->rx_cols = rm->rm_cols;
+	xm->rx_swapped = (rm->rm_firstdatacol == 1 &&
+	    (zio->io_offset & (1ULL << 20)));
+	for (int c = 0; c < rm->rm_cols; c++)
+		xm->rx_nsect += rm->rm_col[c].rc_size >> ashift;
+
+	/* Each child holds a reflowed, an old and a shadow run at most */
+	xm->rx_maxruns = 3 * children;
+	xm->rx_runs = kmem_zalloc(xm->rx_maxruns * sizeof (raidz_xrun_t),
+	    KM_SLEEP);
+	xm->rx_sect = vmem_alloc(xm->rx_nsect * sizeof (raidz_xsect_t),
+	    KM_SLEEP);
+
+	last = kmem_alloc(2 * children * sizeof (uint32_t), KM_SLEEP);
+	for (uint64_t i = 0; i < 2 * children; i++)
+		last[i] = RAIDZ_XRUN_NONE;
+
+	for (uint64_t s = 0; s < xm->rx_nsect; s++) {
+		raidz_xsect_t *rs = &xm->rx_sect[s];
+		uint64_t devidx, offset;
+
+		vdev_raidz_sector_map(vd, b + s, reflow, B_FALSE,
+		    &devidx, &offset);
+		rs->rs_run = vdev_raidz_xmap_add(xm, last, devidx, offset,
+		    B_FALSE, &rs->rs_index);
+		rs->rs_shadow = RAIDZ_XRUN_NONE;
+		rs->rs_shadow_index = 0;
+		rs->rs_error = 0;
+
+		if (zio->io_type == ZIO_TYPE_WRITE &&
+		    b + s >= durable && b + s < reflow) {
+			vdev_raidz_sector_map(vd, b + s, reflow, B_TRUE,
+			    &devidx, &offset);
+			rs->rs_shadow = vdev_raidz_xmap_add(xm, last + children,
+			    devidx, offset, B_TRUE, &rs->rs_shadow_index);
+		}
+	}
+
+	kmem_free(last, 2 * children * sizeof (uint32_t));
+
+	for (uint64_t r = 0; r < xm->rx_nruns; r++) {
+		xm->rx_runs[r].rr_abd =
+		    abd_alloc_for_io(xm->rx_runs[r].rr_size, B_FALSE);
+	}
+
+	if (zio->io_type == ZIO_TYPE_READ) {
+		raidz_map_t *row;
+
+		xm->rx_zero = abd_alloc_linear(1ULL << ashift, B_FALSE);
+		abd_zero(xm->rx_zero, 1ULL << ashift);
+
+		row = kmem_zalloc(offsetof(raidz_map_t, rm_col[rm->rm_cols]),
+		    KM_SLEEP);
+		row->rm_cols = rm->rm_cols;
+		row->rm_scols = rm->rm_cols;
+		row->rm_firstdatacol = rm->rm_firstdatacol;
+		row->rm_ops = rm->rm_ops;
+		xm->rx_row = row;
+	}
+
+	return (xm);
+}
+
+/*
+ * Copy the columns of the map into the runs, and into the shadow runs too
+ * if asked to.
+ */
+static void
+vdev_raidz_xmap_gather(raidz_map_t *rm, boolean_t shadows)
+{
+	raidz_xmap_t *xm = rm->rm_xmap;
+	uint64_t ashift = xm->rx_ashift;
+
+	for (uint64_t s = 0; s < xm->rx_nsect; s++) {
+		raidz_xsect_t *rs = &xm->rx_sect[s];
+		uint64_t c, k;
+
+		vdev_raidz_xmap_locate(xm, s, &c, &k);
+		abd_copy_off(xm->rx_runs[rs->rs_run].rr_abd,
+		    rm->rm_col[c].rc_abd, (uint64_t)rs->rs_index << ashift,
+		    k << ashift, 1ULL << ashift);
+
+		if (shadows && rs->rs_shadow != RAIDZ_XRUN_NONE) {
+			abd_copy_off(xm->rx_runs[rs->rs_shadow].rr_abd,
+			    rm->rm_col[c].rc_abd,
+			    (uint64_t)rs->rs_shadow_index << ashift,
+			    k << ashift, 1ULL << ashift);
+		}
+	}
+}
+
+/*
+ * Copy what was read into the columns of the map, noting the error of the
+ * run each sector came from.
+ */
+static void
+vdev_raidz_xmap_scatter(raidz_map_t *rm)
+{
+	raidz_xmap_t *xm = rm->rm_xmap;
+	uint64_t ashift = xm->rx_ashift;
+
+	for (uint64_t s = 0; s < xm->rx_nsect; s++) {
+		raidz_xsect_t *rs = &xm->rx_sect[s];
+		raidz_xrun_t *rr = &xm->rx_runs[rs->rs_run];
+		uint64_t c, k;
+
+		vdev_raidz_xmap_locate(xm, s, &c, &k);
+		abd_copy_off(rm->rm_col[c].rc_abd, rr->rr_abd, k << ashift,
+		    (uint64_t)rs->rs_index << ashift, 1ULL << ashift);
+		rs->rs_error = rr->rr_error;
+	}
+}
+
+static void
+vdev_raidz_xrun_done(zio_t *zio)
+{
+	raidz_xrun_t *rr = zio->io_private;
+
+	rr->rr_error = zio->io_error;
+	rr->rr_tried = 1;
+	rr->rr_skipped = 0;
+}
+
+/*
+ * Start an I/O to a block whose sectors are not laid out the way its
+ * columns are.  Parity is interleaved with data in the runs, so reads
+ * always read all of it.
+ */
+static void
+vdev_raidz_io_start_expanded(zio_t *zio, raidz_map_t *rm, uint64_t width,
+    uint64_t reflow, uint64_t durable)
+{
+	vdev_t *vd = zio->io_vd;
+	raidz_xmap_t *xm;
+
+	xm = vdev_raidz_xmap_alloc(zio, rm, width, reflow, durable);
+	rm->rm_xmap = xm;
+	zio->io_vsd_ops = &vdev_raidz_xmap_vsd_ops;
+
+	if (zio->io_type == ZIO_TYPE_WRITE) {
+		vdev_raidz_generate_parity(rm);
+		vdev_raidz_xmap_gather(rm, B_TRUE);
+
+		for (uint64_t r = 0; r < xm->rx_nruns; r++) {
+			raidz_xrun_t *rr = &xm->rx_runs[r];
+
+			zio_nowait(zio_vdev_child_io(zio, NULL,
+			    vd->vdev_child[rr->rr_devidx], rr->rr_offset,
+			    rr->rr_abd, rr->rr_size, zio->io_type,
+			    zio->io_priority, 0, vdev_raidz_xrun_done, rr));
+		}
+
+		zio_execute(zio);
+		return;
+	}
+
+	ASSERT(zio->io_type == ZIO_TYPE_READ);
+
+	for (uint64_t r = 0; r < xm->rx_nruns; r++) {
+		raidz_xrun_t *rr = &xm->rx_runs[r];
+		vdev_t *cvd = vd->vdev_child[rr->rr_devidx];
+
+		if (!vdev_readable(cvd)) {
+			rr->rr_error = SET_ERROR(ENXIO);
+			rr->rr_tried = 1;	/* don't even try */
+			rr->rr_skipped = 1;
+			continue;
+		}
+		if (vdev_dtl_contains(cvd, DTL_MISSING, zio->io_txg, 1)) {
+			rr->rr_error = SET_ERROR(ESTALE);
+			rr->rr_skipped = 1;
+			continue;
+		}
+		zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
+		    rr->rr_offset, rr->rr_abd, rr->rr_size,
+		    zio->io_type, zio->io_priority, 0,
+		    vdev_raidz_xrun_done, rr));
+	}
+
+	zio_execute(zio);
+}
+
 /*
  * Start an IO operation on a RAIDZ VDev
  *
@@ -1689,12 +2116,48 @@ vdev_raidz_io_start(zio_t *zio)
 	vdev_t *cvd;
 	raidz_map_t *rm;
 	raidz_col_t *rc;
+	locked_range_t *lr = NULL;
+	uint64_t txg = (zio->io_bp != NULL) ? BP_PHYSICAL_BIRTH(zio->io_bp) : 0;
+	uint64_t width = vdev_raidz_logical_width(vd, txg);
+	uint64_t reflow = UINT64_MAX;
+	uint64_t durable = UINT64_MAX;
+	uint64_t b = zio->io_offset >> tvd->vdev_ashift;
 	int c, i;
 
-	rm = vdev_raidz_map_alloc(zio, tvd->vdev_ashift, vd->vdev_children,
+	/*
+	 * While the vdev is being expanded, hold the range of the block so
+	 * the reflow can't move its sectors until this I/O is done.
+	 */
+	if (vd->vdev_raidz_expanding) {
+		lr = rangelock_enter(&vd->vdev_raidz_expand.vre_rangelock,
+		    zio->io_offset, vdev_psize_to_asize_txg(vd, zio->io_size,
+		    txg), RL_READER);
+		mutex_enter(&vd->vdev_raidz_expand_lock);
+		if (vd->vdev_raidz_expanding) {
+			reflow = vd->vdev_raidz_expand.vre_offset >>
+			    tvd->vdev_ashift;
+			durable = vdev_raidz_expand_durable(vd) >>
+			    tvd->vdev_ashift;
+		}
+		mutex_exit(&vd->vdev_raidz_expand_lock);
+	}
+
+	rm = vdev_raidz_map_alloc(zio, tvd->vdev_ashift, width,
 	    vd->vdev_nparity);
+	rm->rm_lr = lr;
+
+	ASSERT3U(rm->rm_asize, ==,
+	    vdev_psize_to_asize_txg(vd, zio->io_size, txg));
 
-	ASSERT3U(rm->rm_asize, ==, vdev_psize_to_asize(vd, zio->io_size));
+	/*
+	 * The columns are where the sectors are only if the rows of the
+	 * block span the vdev's physical width at the block's offset.
+	 */
+	if (reflow == UINT64_MAX ? width != vd->vdev_children :
+	    (width != vd->vdev_children - 1 || b < reflow)) {
+		vdev_raidz_io_start_expanded(zio, rm, width, reflow, durable);
+		return;
+	}
 
 	if (zio->io_type == ZIO_TYPE_WRITE) {
 		vdev_raidz_generate_parity(rm);
@@ -1706,7 +2169,8 @@ vdev_raidz_io_start(zio_t *zio)
 			/*
 			 * Verify physical to logical translation.
 			 */
-			vdev_raidz_io_verify(zio, rm, c);
+			if (reflow == UINT64_MAX)
+				vdev_raidz_io_verify(zio, rm, c);
 
 			zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
 			    rc->rc_offset, rc->rc_abd, rc->rc_size,
@@ -2033,387 +2497,1685 @@ done:
 }
 
 /*
- * Complete an IO operation on a RAIDZ VDev
- *
- * Outline:
- * - For write operations:
- *   1. Check for errors on the child IOs.
- *   2. Return, setting an error code if too few child VDevs were written
- *      to reconstruct the data later.  Note that partial writes are
- *      considered successful if they can be reconstructed at all.
- * - For read operations:
- *   1. Check for errors on the child IOs.
- *   2. If data errors occurred:
- *      a. Try to reassemble the data from the parity available.
- *      b. If we haven't yet read the parity drives, read them now.
- *      c. If all parity drives have been read but the data still doesn't
- *         reassemble with a correct checksum, then try combinatorial
- *         reconstruction.
- *      d. If that doesn't work, return an error.
- *   3. If there were unexpected errors or this is a resilver operation,
- *      rewrite the vdevs that had errors.
+ * Return the index within the block of the sector in the given column and
+ * row of the map.
  */
-static void
-vdev_raidz_io_done(zio_t *zio)
+static uint64_t
+vdev_raidz_xmap_sector(raidz_xmap_t *xm, uint64_t c, uint64_t k)
 {
-	vdev_t *vd = zio->io_vd;
-	vdev_t *cvd;
-	raidz_map_t *rm = zio->io_vsd;
-	raidz_col_t *rc = NULL;
-	int unexpected_errors = 0;
-	int parity_errors = 0;
-	int parity_untried = 0;
-	int data_errors = 0;
-	int total_errors = 0;
-	int n, c;
-	int tgts[VDEV_RAIDZ_MAXPARITY];
-	int code;
+	if (xm->rx_swapped && c < 2)
+		c ^= 1;
 
-	ASSERT(zio->io_bp != NULL);  /* XXX need to add code to enforce this */
+	return (k * xm->rx_width + c);
+}
 
-	ASSERT(rm->rm_missingparity <= rm->rm_firstdatacol);
-	ASSERT(rm->rm_missingdata <= rm->rm_cols - rm->rm_firstdatacol);
+/*
+ * Return the largest number of sectors with errors in any logical row of an
+ * expanded map.  Like the number of columns with errors in other maps, this
+ * decides whether the block can be reconstructed.
+ */
+static int
+vdev_raidz_xmap_row_errors(raidz_map_t *rm)
+{
+	raidz_xmap_t *xm = rm->rm_xmap;
+	int worst = 0;
 
-	for (c = 0; c < rm->rm_cols; c++) {
-		rc = &rm->rm_col[c];
+	for (uint64_t k = 0; k < xm->rx_rows; k++) {
+		int errors = 0;
 
-		if (rc->rc_error) {
-			ASSERT(rc->rc_error != ECKSUM);	/* child has no bp */
+		for (uint64_t c = 0; c < xm->rx_cols; c++) {
+			if ((k << xm->rx_ashift) >= rm->rm_col[c].rc_size)
+				continue;
+			if (xm->rx_sect[vdev_raidz_xmap_sector(xm, c, k)].
+			    rs_error != 0)
+				errors++;
+		}
+		worst = MAX(worst, errors);
+	}
 
-			if (c < rm->rm_firstdatacol)
-				parity_errors++;
-			else
-				data_errors++;
+	return (worst);
+}
 
-			if (!rc->rc_skipped)
-				unexpected_errors++;
+static int
+vdev_raidz_xmap_worst_error(raidz_xmap_t *xm)
+{
+	int error = 0;
 
-			total_errors++;
-		} else if (c < rm->rm_firstdatacol && !rc->rc_tried) {
-			parity_untried++;
-		}
+	for (uint64_t r = 0; r < xm->rx_nruns; r++) {
+		if (!xm->rx_runs[r].rr_shadow)
+			error = zio_worst_error(error, xm->rx_runs[r].rr_error);
 	}
 
-	if (zio->io_type == ZIO_TYPE_WRITE) {
-		/*
-		 * XXX -- for now, treat partial writes as a success.
-		 * (If we couldn't write enough columns to reconstruct
-		 * the data, the I/O failed.  Otherwise, good enough.)
-		 *
-		 * Now that we support write reallocation, it would be better
-		 * to treat partial failure as real failure unless there are
-		 * no non-degraded top-level vdevs left, and not update DTLs
-		 * if we intend to reallocate.
-		 */
-		/* XXPOLICY */
-		if (total_errors > rm->rm_firstdatacol)
-			zio->io_error = vdev_raidz_worst_error(rm);
+	return (error);
+}
 
-		return;
+/*
+ * Reconstruct the sectors of an expanded map which had errors, a logical
+ * row at a time.  Columns which are short in a row are treated as zeros,
+ * just like they are when the parity is generated.  Returns the number of
+ * rows with more errors than there is parity.
+ */
+static int
+vdev_raidz_xmap_reconstruct(raidz_map_t *rm)
+{
+	raidz_xmap_t *xm = rm->rm_xmap;
+	raidz_map_t *row = xm->rx_row;
+	uint64_t sectsz = 1ULL << xm->rx_ashift;
+	int failed = 0;
+
+	for (uint64_t k = 0; k < xm->rx_rows; k++) {
+		int errors = 0, data_errors = 0;
+
+		for (int c = 0; c < row->rm_cols; c++) {
+			raidz_col_t *rc = &row->rm_col[c];
+
+			rc->rc_size = sectsz;
+			rc->rc_error = 0;
+			if ((k << xm->rx_ashift) < rm->rm_col[c].rc_size) {
+				rc->rc_abd = abd_get_offset_size(
+				    rm->rm_col[c].rc_abd, k << xm->rx_ashift,
+				    sectsz);
+				rc->rc_error = xm->rx_sect[
+				    vdev_raidz_xmap_sector(xm, c, k)].rs_error;
+			} else {
+				rc->rc_abd = xm->rx_zero;
+			}
+
+			if (rc->rc_error != 0) {
+				errors++;
+				if (c >= row->rm_firstdatacol)
+					data_errors++;
+			}
+		}
+
+		if (errors > row->rm_firstdatacol)
+			failed++;
+		else if (data_errors > 0)
+			(void) vdev_raidz_reconstruct(row, NULL, 0);
+
+		for (int c = 0; c < row->rm_cols; c++) {
+			if (row->rm_col[c].rc_abd != xm->rx_zero)
+				abd_put(row->rm_col[c].rc_abd);
+			row->rm_col[c].rc_abd = NULL;
+		}
 	}
 
-	ASSERT(zio->io_type == ZIO_TYPE_READ);
-	/*
-	 * There are three potential phases for a read:
-	 *	1. produce valid data from the columns read
-	 *	2. read all disks and try again
-	 *	3. perform combinatorial reconstruction
-	 *
-	 * Each phase is progressively both more expensive and less likely to
-	 * occur. If we encounter more errors than we can repair or all phases
-	 * fail, we have no choice but to return an error.
-	 */
+	return (failed);
+}
+
+/*
+ * Copy the sectors of one run out of the columns of the map.
+ */
+static void
+vdev_raidz_xrun_gather(raidz_map_t *rm, uint64_t r, abd_t *abd)
+{
+	raidz_xmap_t *xm = rm->rm_xmap;
+	uint64_t ashift = xm->rx_ashift;
+
+	for (uint64_t s = 0; s < xm->rx_nsect; s++) {
+		raidz_xsect_t *rs = &xm->rx_sect[s];
+		uint64_t c, k;
+
+		if (rs->rs_run != r)
+			continue;
+
+		vdev_raidz_xmap_locate(xm, s, &c, &k);
+		abd_copy_off(abd, rm->rm_col[c].rc_abd,
+		    (uint64_t)rs->rs_index << ashift, k << ashift,
+		    1ULL << ashift);
+	}
+}
+
+/*
+ * Report a checksum error for a run of an expanded map, given what should
+ * have been read.
+ */
+static void
+vdev_raidz_xrun_checksum_error(zio_t *zio, raidz_xrun_t *rr, abd_t *good)
+{
+	vdev_t *vd = zio->io_vd->vdev_child[rr->rr_devidx];
+
+	if (!(zio->io_flags & ZIO_FLAG_SPECULATIVE)) {
+		zio_bad_cksum_t zbc;
+		raidz_map_t *rm = zio->io_vsd;
+
+		mutex_enter(&vd->vdev_stat_lock);
+		vd->vdev_stat.vs_checksum_errors++;
+		mutex_exit(&vd->vdev_stat_lock);
+
+		zbc.zbc_has_cksum = 0;
+		zbc.zbc_injected = rm->rm_ecksuminjected;
+
+		zfs_ereport_post_checksum(zio->io_spa, vd,
+		    &zio->io_bookmark, zio, rr->rr_offset, rr->rr_size,
+		    good, rr->rr_abd, &zbc);
+	}
+}
+
+/*
+ * Once the data of an expanded map is known to be good, find the runs which
+ * were read without error but hold something else, report them and mark
+ * them for repair.  If devs is not NULL, only runs on those children are
+ * checked.  Returns the number of such runs.
+ */
+static int
+vdev_raidz_xmap_blame(zio_t *zio, raidz_map_t *rm, const int *devs, int n)
+{
+	raidz_xmap_t *xm = rm->rm_xmap;
+	int ret = 0;
+
+	vdev_raidz_generate_parity(rm);
+
+	for (uint64_t r = 0; r < xm->rx_nruns; r++) {
+		raidz_xrun_t *rr = &xm->rx_runs[r];
+		boolean_t check = (devs == NULL);
+		abd_t *good;
+
+		for (int i = 0; i < n; i++) {
+			if (rr->rr_devidx == devs[i])
+				check = B_TRUE;
+		}
+		if (!check || !rr->rr_tried || rr->rr_error != 0)
+			continue;
+
+		good = abd_alloc_sametype(rr->rr_abd, rr->rr_size);
+		vdev_raidz_xrun_gather(rm, r, good);
+		if (abd_cmp(good, rr->rr_abd) != 0) {
+			vdev_raidz_xrun_checksum_error(zio, rr, good);
+			rr->rr_error = SET_ERROR(ECKSUM);
+			ret++;
+		}
+		abd_free(good);
+	}
+
+	return (ret);
+}
+
+/*
+ * Regenerate the parity of an expanded map from the good data and check it
+ * against the parity which was read.  Returns the number of runs which held
+ * bad parity.
+ */
+static int
+vdev_raidz_xmap_parity_verify(zio_t *zio, raidz_map_t *rm)
+{
+	blkptr_t *bp = zio->io_bp;
+	enum zio_checksum checksum = (bp == NULL ? zio->io_prop.zp_checksum :
+	    (BP_IS_GANG(bp) ? ZIO_CHECKSUM_GANG_HEADER : BP_GET_CHECKSUM(bp)));
+
+	if (checksum == ZIO_CHECKSUM_NOPARITY)
+		return (0);
+
+	return (vdev_raidz_xmap_blame(zio, rm, NULL, 0));
+}
+
+/*
+ * Attempt reconstruction of an expanded map assuming that everything read
+ * from the given children is bad.
+ */
+static boolean_t
+vdev_raidz_xmap_try(zio_t *zio, raidz_map_t *rm, const int *devs, int n)
+{
+	raidz_xmap_t *xm = rm->rm_xmap;
+
+	vdev_raidz_xmap_scatter(rm);
+
+	for (uint64_t s = 0; s < xm->rx_nsect; s++) {
+		raidz_xsect_t *rs = &xm->rx_sect[s];
+		uint64_t devidx = xm->rx_runs[rs->rs_run].rr_devidx;
+
+		for (int i = 0; i < n; i++) {
+			if (devidx == devs[i] && rs->rs_error == 0)
+				rs->rs_error = SET_ERROR(ECKSUM);
+		}
+	}
+
+	if (vdev_raidz_xmap_reconstruct(rm) != 0 ||
+	    raidz_checksum_verify(zio) != 0)
+		return (B_FALSE);
+
+	(void) vdev_raidz_xmap_blame(zio, rm, devs, n);
+
+	return (B_TRUE);
+}
+
+/*
+ * The counterpart of vdev_raidz_combrec() for expanded maps.  The sectors
+ * of a column are spread over several children, so rather than columns
+ * this iterates over all combinations of children which may have returned
+ * bad data.
+ */
+static boolean_t
+vdev_raidz_xmap_combrec(zio_t *zio, raidz_map_t *rm, int row_errors)
+{
+	int children = zio->io_vd->vdev_children;
+	int devs[VDEV_RAIDZ_MAXPARITY];
+
+	for (int n = 1; n <= rm->rm_firstdatacol - row_errors; n++) {
+		for (int i = 0; i < n; i++)
+			devs[i] = i;
+
+		for (;;) {
+			int i;
+
+			if (vdev_raidz_xmap_try(zio, rm, devs, n))
+				return (B_TRUE);
+
+			for (i = n - 1; i >= 0 && devs[i] == children - n + i;
+			    i--)
+				continue;
+			if (i < 0)
+				break;
+
+			devs[i]++;
+			for (int j = i + 1; j < n; j++)
+				devs[j] = devs[j - 1] + 1;
+		}
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Complete an I/O to an expanded map.  This follows the same phases as
+ * vdev_raidz_io_done(), except that all parity has been read up front and
+ * that errors are counted per logical row rather than per column.
+ */
+static void
+vdev_raidz_io_done_expanded(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	raidz_map_t *rm = zio->io_vsd;
+	raidz_xmap_t *xm = rm->rm_xmap;
+	int unexpected_errors = 0;
+	int row_errors;
+
+	if (zio->io_type == ZIO_TYPE_WRITE) {
+		for (uint64_t s = 0; s < xm->rx_nsect; s++) {
+			xm->rx_sect[s].rs_error =
+			    xm->rx_runs[xm->rx_sect[s].rs_run].rr_error;
+		}
+
+		/* XXPOLICY, as in vdev_raidz_io_done() */
+		if (vdev_raidz_xmap_row_errors(rm) > rm->rm_firstdatacol)
+			zio->io_error = vdev_raidz_xmap_worst_error(xm);
+
+		return;
+	}
+
+	ASSERT(zio->io_type == ZIO_TYPE_READ);
+
+	for (uint64_t r = 0; r < xm->rx_nruns; r++) {
+		raidz_xrun_t *rr = &xm->rx_runs[r];
+
+		if (rr->rr_error != 0 && !rr->rr_skipped)
+			unexpected_errors++;
+	}
+
+	vdev_raidz_xmap_scatter(rm);
+	if (vdev_raidz_xmap_reconstruct(rm) == 0 &&
+	    raidz_checksum_verify(zio) == 0)
+		goto done;
+
+	/*
+	 * Read whatever was skipped and try again.  If we've already been
+	 * through once before, we go on to combinatorial reconstruction.
+	 */
+	unexpected_errors = 1;
+
+	for (uint64_t r = 0; r < xm->rx_nruns; r++) {
+		if (xm->rx_runs[r].rr_tried)
+			continue;
+
+		zio_vdev_io_redone(zio);
+		do {
+			raidz_xrun_t *rr = &xm->rx_runs[r];
+
+			if (rr->rr_tried)
+				continue;
+			zio_nowait(zio_vdev_child_io(zio, NULL,
+			    vd->vdev_child[rr->rr_devidx],
+			    rr->rr_offset, rr->rr_abd, rr->rr_size,
+			    zio->io_type, zio->io_priority, 0,
+			    vdev_raidz_xrun_done, rr));
+		} while (++r < xm->rx_nruns);
+
+		return;
+	}
+
+	row_errors = vdev_raidz_xmap_row_errors(rm);
+	if (row_errors > rm->rm_firstdatacol) {
+		zio->io_error = vdev_raidz_xmap_worst_error(xm);
+	} else if (row_errors < rm->rm_firstdatacol &&
+	    vdev_raidz_xmap_combrec(zio, rm, row_errors)) {
+		/* vdev_raidz_xmap_blame() has reported the bad children */
+	} else {
+		zio->io_error = SET_ERROR(ECKSUM);
+
+		if (!(zio->io_flags & ZIO_FLAG_SPECULATIVE)) {
+			for (uint64_t r = 0; r < xm->rx_nruns; r++) {
+				raidz_xrun_t *rr = &xm->rx_runs[r];
+				vdev_t *cvd = vd->vdev_child[rr->rr_devidx];
+				zio_bad_cksum_t zbc;
+
+				if (rr->rr_error != 0)
+					continue;
+
+				zbc.zbc_has_cksum = 0;
+				zbc.zbc_injected = rm->rm_ecksuminjected;
+
+				mutex_enter(&cvd->vdev_stat_lock);
+				cvd->vdev_stat.vs_checksum_errors++;
+				mutex_exit(&cvd->vdev_stat_lock);
+
+				zfs_ereport_start_checksum(zio->io_spa, cvd,
+				    &zio->io_bookmark, zio, rr->rr_offset,
+				    rr->rr_size, NULL, &zbc);
+			}
+		}
+	}
+
+done:
+	zio_checksum_verified(zio);
+
+	if (zio->io_error == 0 && (unexpected_errors ||
+	    (zio->io_flags & (ZIO_FLAG_SCRUB | ZIO_FLAG_RESILVER))))
+		unexpected_errors += vdev_raidz_xmap_parity_verify(zio, rm);
+
+	if (zio->io_error == 0 && spa_writeable(zio->io_spa) &&
+	    (unexpected_errors || (zio->io_flags & ZIO_FLAG_RESILVER))) {
+		/*
+		 * Use the good data we have in hand to repair damaged
+		 * children, regenerating the parity they hold.
+		 */
+		vdev_raidz_generate_parity(rm);
+		vdev_raidz_xmap_gather(rm, B_FALSE);
+
+		for (uint64_t r = 0; r < xm->rx_nruns; r++) {
+			raidz_xrun_t *rr = &xm->rx_runs[r];
+
+			if (rr->rr_error == 0)
+				continue;
+
+			zio_nowait(zio_vdev_child_io(zio, NULL,
+			    vd->vdev_child[rr->rr_devidx],
+			    rr->rr_offset, rr->rr_abd, rr->rr_size,
+			    ZIO_TYPE_WRITE, ZIO_PRIORITY_ASYNC_WRITE,
+			    ZIO_FLAG_IO_REPAIR | (unexpected_errors ?
+			    ZIO_FLAG_SELF_HEAL : 0), NULL, NULL));
+		}
+	}
+}
+
+/*
+ * Complete an IO operation on a RAIDZ VDev
+ *
+ * Outline:
+ * - For write operations:
+ *   1. Check for errors on the child IOs.
+ *   2. Return, setting an error code if too few child VDevs were written
+ *      to reconstruct the data later.  Note that partial writes are
+ *      considered successful if they can be reconstructed at all.
+ * - For read operations:
+ *   1. Check for errors on the child IOs.
+ *   2. If data errors occurred:
+ *      a. Try to reassemble the data from the parity available.
+ *      b. If we haven't yet read the parity drives, read them now.
+ *      c. If all parity drives have been read but the data still doesn't
+ *         reassemble with a correct checksum, then try combinatorial
+ *         reconstruction.
+ *      d. If that doesn't work, return an error.
+ *   3. If there were unexpected errors or this is a resilver operation,
+ *      rewrite the vdevs that had errors.
+ */
+static void
+vdev_raidz_io_done(zio_t *zio)
+{
+	vdev_t *vd = zio->io_vd;
+	vdev_t *cvd;
+	raidz_map_t *rm = zio->io_vsd;
+	raidz_col_t *rc = NULL;
+	int unexpected_errors = 0;
+	int parity_errors = 0;
+	int parity_untried = 0;
+	int data_errors = 0;
+	int total_errors = 0;
+	int n, c;
+	int tgts[VDEV_RAIDZ_MAXPARITY];
+	int code;
+
+	ASSERT(zio->io_bp != NULL);  /* XXX need to add code to enforce this */
+
+	if (rm->rm_xmap != NULL) {
+		vdev_raidz_io_done_expanded(zio);
+		return;
+	}
+
+	ASSERT(rm->rm_missingparity <= rm->rm_firstdatacol);
+	ASSERT(rm->rm_missingdata <= rm->rm_cols - rm->rm_firstdatacol);
+
+	for (c = 0; c < rm->rm_cols; c++) {
+		rc = &rm->rm_col[c];
+
+		if (rc->rc_error) {
+			ASSERT(rc->rc_error != ECKSUM);	/* child has no bp */
+
+			if (c < rm->rm_firstdatacol)
+				parity_errors++;
+			else
+				data_errors++;
+
+			if (!rc->rc_skipped)
+				unexpected_errors++;
+
+			total_errors++;
+		} else if (c < rm->rm_firstdatacol && !rc->rc_tried) {
+			parity_untried++;
+		}
+	}
+
+	if (zio->io_type == ZIO_TYPE_WRITE) {
+		/*
+		 * XXX -- for now, treat partial writes as a success.
+		 * (If we couldn't write enough columns to reconstruct
+		 * the data, the I/O failed.  Otherwise, good enough.)
+		 *
+		 * Now that we support write reallocation, it would be better
+		 * to treat partial failure as real failure unless there are
+		 * no non-degraded top-level vdevs left, and not update DTLs
+		 * if we intend to reallocate.
+		 */
+		/* XXPOLICY */
+		if (total_errors > rm->rm_firstdatacol)
+			zio->io_error = vdev_raidz_worst_error(rm);
+
+		return;
+	}
+
+	ASSERT(zio->io_type == ZIO_TYPE_READ);
+	/*
+	 * There are three potential phases for a read:
+	 *	1. produce valid data from the columns read
+	 *	2. read all disks and try again
+	 *	3. perform combinatorial reconstruction
+	 *
+	 * Each phase is progressively both more expensive and less likely to
+	 * occur. If we encounter more errors than we can repair or all phases
+	 * fail, we have no choice but to return an error.
+	 */
+
+	/*
+	 * If the number of errors we saw was correctable -- less than or equal
+	 * to the number of parity disks read -- attempt to produce data that
+	 * has a valid checksum. Naturally, this case applies in the absence of
+	 * any errors.
+	 */
+	if (total_errors <= rm->rm_firstdatacol - parity_untried) {
+		if (data_errors == 0) {
+			if (raidz_checksum_verify(zio) == 0) {
+				/*
+				 * If we read parity information (unnecessarily
+				 * as it happens since no reconstruction was
+				 * needed) regenerate and verify the parity.
+				 * We also regenerate parity when resilvering
+				 * so we can write it out to the failed device
+				 * later.
+				 */
+				if (parity_errors + parity_untried <
+				    rm->rm_firstdatacol ||
+				    (zio->io_flags & ZIO_FLAG_RESILVER)) {
+					n = raidz_parity_verify(zio, rm);
+					unexpected_errors += n;
+					ASSERT(parity_errors + n <=
+					    rm->rm_firstdatacol);
+				}
+				goto done;
+			}
+		} else {
+			/*
+			 * We either attempt to read all the parity columns or
+			 * none of them. If we didn't try to read parity, we
+			 * wouldn't be here in the correctable case. There must
+			 * also have been fewer parity errors than parity
+			 * columns or, again, we wouldn't be in this code path.
+			 */
+			ASSERT(parity_untried == 0);
+			ASSERT(parity_errors < rm->rm_firstdatacol);
+
+			/*
+			 * Identify the data columns that reported an error.
+			 */
+			n = 0;
+			for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
+				rc = &rm->rm_col[c];
+				if (rc->rc_error != 0) {
+					ASSERT(n < VDEV_RAIDZ_MAXPARITY);
+					tgts[n++] = c;
+				}
+			}
+
+			ASSERT(rm->rm_firstdatacol >= n);
+
+			code = vdev_raidz_reconstruct(rm, tgts, n);
+
+			if (raidz_checksum_verify(zio) == 0) {
+				/*
+				 * If we read more parity disks than were used
+				 * for reconstruction, confirm that the other
+				 * parity disks produced correct data. This
+				 * routine is suboptimal in that it regenerates
+				 * the parity that we already used in addition
+				 * to the parity that we're attempting to
+				 * verify, but this should be a relatively
+				 * uncommon case, and can be optimized if it
+				 * becomes a problem. Note that we regenerate
+				 * parity when resilvering so we can write it
+				 * out to failed devices later.
+				 */
+				if (parity_errors < rm->rm_firstdatacol - n ||
+				    (zio->io_flags & ZIO_FLAG_RESILVER)) {
+					n = raidz_parity_verify(zio, rm);
+					unexpected_errors += n;
+					ASSERT(parity_errors + n <=
+					    rm->rm_firstdatacol);
+				}
+
+				goto done;
+			}
+		}
+	}
+
+	/*
+	 * This isn't a typical situation -- either we got a read error or
+	 * a child silently returned bad data. Read every block so we can
+	 * try again with as much data and parity as we can track down. If
+	 * we've already been through once before, all children will be marked
+	 * as tried so we'll proceed to combinatorial reconstruction.
+	 */
+	unexpected_errors = 1;
+	rm->rm_missingdata = 0;
+	rm->rm_missingparity = 0;
+
+	for (c = 0; c < rm->rm_cols; c++) {
+		if (rm->rm_col[c].rc_tried)
+			continue;
+
+		zio_vdev_io_redone(zio);
+		do {
+			rc = &rm->rm_col[c];
+			if (rc->rc_tried)
+				continue;
+			zio_nowait(zio_vdev_child_io(zio, NULL,
+			    vd->vdev_child[rc->rc_devidx],
+			    rc->rc_offset, rc->rc_abd, rc->rc_size,
+			    zio->io_type, zio->io_priority, 0,
+			    vdev_raidz_child_done, rc));
+		} while (++c < rm->rm_cols);
+
+		return;
+	}
+
+	/*
+	 * At this point we've attempted to reconstruct the data given the
+	 * errors we detected, and we've attempted to read all columns. There
+	 * must, therefore, be one or more additional problems -- silent errors
+	 * resulting in invalid data rather than explicit I/O errors resulting
+	 * in absent data. We check if there is enough additional data to
+	 * possibly reconstruct the data and then perform combinatorial
+	 * reconstruction over all possible combinations. If that fails,
+	 * we're cooked.
+	 */
+	if (total_errors > rm->rm_firstdatacol) {
+		zio->io_error = vdev_raidz_worst_error(rm);
+
+	} else if (total_errors < rm->rm_firstdatacol &&
+	    (code = vdev_raidz_combrec(zio, total_errors, data_errors)) != 0) {
+		/*
+		 * If we didn't use all the available parity for the
+		 * combinatorial reconstruction, verify that the remaining
+		 * parity is correct.
+		 */
+		if (code != (1 << rm->rm_firstdatacol) - 1)
+			(void) raidz_parity_verify(zio, rm);
+	} else {
+		/*
+		 * We're here because either:
+		 *
+		 *	total_errors == rm_first_datacol, or
+		 *	vdev_raidz_combrec() failed
+		 *
+		 * In either case, there is enough bad data to prevent
+		 * reconstruction.
+		 *
+		 * Start checksum ereports for all children which haven't
+		 * failed, and the IO wasn't speculative.
+		 */
+		zio->io_error = SET_ERROR(ECKSUM);
+
+		if (!(zio->io_flags & ZIO_FLAG_SPECULATIVE)) {
+			for (c = 0; c < rm->rm_cols; c++) {
+				vdev_t *cvd;
+				rc = &rm->rm_col[c];
+				cvd = vd->vdev_child[rc->rc_devidx];
+				if (rc->rc_error == 0) {
+					zio_bad_cksum_t zbc;
+					zbc.zbc_has_cksum = 0;
+					zbc.zbc_injected =
+					    rm->rm_ecksuminjected;
+
+					mutex_enter(&cvd->vdev_stat_lock);
+					cvd->vdev_stat.vs_checksum_errors++;
+					mutex_exit(&cvd->vdev_stat_lock);
+
+					zfs_ereport_start_checksum(
+					    zio->io_spa, cvd,
+					    &zio->io_bookmark, zio,
+					    rc->rc_offset, rc->rc_size,
+					    (void *)(uintptr_t)c, &zbc);
+				}
+			}
+		}
+	}
+
+done:
+	zio_checksum_verified(zio);
+
+	if (zio->io_error == 0 && spa_writeable(zio->io_spa) &&
+	    (unexpected_errors || (zio->io_flags & ZIO_FLAG_RESILVER))) {
+		/*
+		 * Use the good data we have in hand to repair damaged children.
+		 */
+		for (c = 0; c < rm->rm_cols; c++) {
+			rc = &rm->rm_col[c];
+			cvd = vd->vdev_child[rc->rc_devidx];
+
+			if (rc->rc_error == 0)
+				continue;
+
+			zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
+			    rc->rc_offset, rc->rc_abd, rc->rc_size,
+			    ZIO_TYPE_WRITE, ZIO_PRIORITY_ASYNC_WRITE,
+			    ZIO_FLAG_IO_REPAIR | (unexpected_errors ?
+			    ZIO_FLAG_SELF_HEAL : 0), NULL, NULL));
+		}
+	}
+}
+
+static void
+vdev_raidz_state_change(vdev_t *vd, int faulted, int degraded)
+{
+	if (faulted > vd->vdev_nparity)
+		vdev_set_state(vd, B_FALSE, VDEV_STATE_CANT_OPEN,
+		    VDEV_AUX_NO_REPLICAS);
+	else if (degraded + faulted != 0)
+		vdev_set_state(vd, B_FALSE, VDEV_STATE_DEGRADED, VDEV_AUX_NONE);
+	else
+		vdev_set_state(vd, B_FALSE, VDEV_STATE_HEALTHY, VDEV_AUX_NONE);
+}
+
+/*
+ * Determine if any portion of the provided block resides on a child vdev
+ * with a dirty DTL and therefore needs to be resilvered.  The function
+ * assumes that at least one DTL is dirty which implies that full stripe
+ * width blocks must be resilvered.
+ */
+static boolean_t
+vdev_raidz_need_resilver(vdev_t *vd, uint64_t offset, size_t psize)
+{
+	uint64_t dcols = vd->vdev_children;
+	uint64_t nparity = vd->vdev_nparity;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	/* The starting RAIDZ (parent) vdev sector of the block. */
+	uint64_t b = offset >> ashift;
+	/* The zio's size in units of the vdev's minimum sector size. */
+	uint64_t s = ((psize - 1) >> ashift) + 1;
+	/* The first column for this stripe. */
+	uint64_t f = b % dcols;
+
+	/*
+	 * The children holding the sectors of a block in an expanded vdev
+	 * depend on its birth txg, which isn't known here.
+	 */
+	if (vd->vdev_raidz_expanding || vd->vdev_raidz_expand.vre_ntxgs > 0)
+		return (B_TRUE);
+
+	if (s + nparity >= dcols)
+		return (B_TRUE);
+
+	for (uint64_t c = 0; c < s + nparity; c++) {
+		uint64_t devidx = (f + c) % dcols;
+		vdev_t *cvd = vd->vdev_child[devidx];
+
+		/*
+		 * dsl_scan_need_resilver() already checked vd with
+		 * vdev_dtl_contains(). So here just check cvd with
+		 * vdev_dtl_empty(), cheaper and a good approximation.
+		 */
+		if (!vdev_dtl_empty(cvd, DTL_PARTIAL))
+			return (B_TRUE);
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * Return the number of rows of the given width in which a child holds a
+ * sector below the given vdev sector.
+ */
+static uint64_t
+vdev_raidz_xlate_rows(uint64_t tgt_col, uint64_t b, uint64_t width)
+{
+	if (b <= tgt_col) /* avoid underflow */
+		return (0);
+	return (((b - tgt_col - 1) / width) + 1);
+}
+
+static void
+vdev_raidz_xlate(vdev_t *cvd, const range_seg64_t *in, range_seg64_t *res)
+{
+	vdev_t *raidvd = cvd->vdev_parent;
+	ASSERT(raidvd->vdev_ops == &vdev_raidz_ops);
+
+	uint64_t width = raidvd->vdev_children;
+	uint64_t tgt_col = cvd->vdev_id;
+	uint64_t ashift = raidvd->vdev_top->vdev_ashift;
+
+	/* make sure the offsets are block-aligned */
+	ASSERT0(in->rs_start % (1 << ashift));
+	ASSERT0(in->rs_end % (1 << ashift));
+	uint64_t b_start = in->rs_start >> ashift;
+	uint64_t b_end = in->rs_end >> ashift;
+	uint64_t reflow = UINT64_MAX;
+
+	if (raidvd->vdev_raidz_expanding) {
+		mutex_enter(&raidvd->vdev_raidz_expand_lock);
+		if (raidvd->vdev_raidz_expanding) {
+			reflow = raidvd->vdev_raidz_expand.vre_offset >>
+			    ashift;
+		}
+		mutex_exit(&raidvd->vdev_raidz_expand_lock);
+	}
+
+	if (reflow == UINT64_MAX) {
+		uint64_t start_row = vdev_raidz_xlate_rows(tgt_col, b_start,
+		    width);
+		uint64_t end_row = vdev_raidz_xlate_rows(tgt_col, b_end,
+		    width);
+
+		res->rs_start = start_row << ashift;
+		res->rs_end = end_row << ashift;
+
+		ASSERT3U(res->rs_start, <=, in->rs_start);
+		ASSERT3U(res->rs_end - res->rs_start, <=,
+		    in->rs_end - in->rs_start);
+		return;
+	}
 
 	/*
-	 * If the number of errors we saw was correctable -- less than or equal
-	 * to the number of parity disks read -- attempt to produce data that
-	 * has a valid checksum. Naturally, this case applies in the absence of
-	 * any errors.
+	 * During an expansion the part of the range below the reflow point
+	 * is spread over all children and the rest over all but the last.
+	 * The result spans the child's rows of both parts, and so may cover
+	 * rows in between which belong to other sectors.
 	 */
-	if (total_errors <= rm->rm_firstdatacol - parity_untried) {
-		if (data_errors == 0) {
-			if (raidz_checksum_verify(zio) == 0) {
-				/*
-				 * If we read parity information (unnecessarily
-				 * as it happens since no reconstruction was
-				 * needed) regenerate and verify the parity.
-				 * We also regenerate parity when resilvering
-				 * so we can write it out to the failed device
-				 * later.
-				 */
-				if (parity_errors + parity_untried <
-				    rm->rm_firstdatacol ||
-				    (zio->io_flags & ZIO_FLAG_RESILVER)) {
-					n = raidz_parity_verify(zio, rm);
-					unexpected_errors += n;
-					ASSERT(parity_errors + n <=
-					    rm->rm_firstdatacol);
-				}
-				goto done;
-			}
-		} else {
-			/*
-			 * We either attempt to read all the parity columns or
-			 * none of them. If we didn't try to read parity, we
-			 * wouldn't be here in the correctable case. There must
-			 * also have been fewer parity errors than parity
-			 * columns or, again, we wouldn't be in this code path.
-			 */
-			ASSERT(parity_untried == 0);
-			ASSERT(parity_errors < rm->rm_firstdatacol);
+	uint64_t start_row = vdev_raidz_xlate_rows(tgt_col, b_start, width);
+	uint64_t end_row = start_row;
+	boolean_t empty = B_TRUE;
+
+	if (b_start < MIN(b_end, reflow)) {
+		end_row = vdev_raidz_xlate_rows(tgt_col, MIN(b_end, reflow),
+		    width);
+		empty = (start_row == end_row);
+	}
+	if (tgt_col < width - 1 && MAX(b_start, reflow) < b_end) {
+		uint64_t old_start = vdev_raidz_xlate_rows(tgt_col,
+		    MAX(b_start, reflow), width - 1);
+		uint64_t old_end = vdev_raidz_xlate_rows(tgt_col, b_end,
+		    width - 1);
+
+		if (old_start != old_end) {
+			if (empty)
+				start_row = old_start;
+			end_row = old_end;
+			empty = B_FALSE;
+		}
+	}
+	if (empty)
+		end_row = start_row;
 
-			/*
-			 * Identify the data columns that reported an error.
-			 */
-			n = 0;
-			for (c = rm->rm_firstdatacol; c < rm->rm_cols; c++) {
-				rc = &rm->rm_col[c];
-				if (rc->rc_error != 0) {
-					ASSERT(n < VDEV_RAIDZ_MAXPARITY);
-					tgts[n++] = c;
-				}
+	res->rs_start = start_row << ashift;
+	res->rs_end = end_row << ashift;
+
+	ASSERT3U(res->rs_start, <=, in->rs_start);
+}
+
+vdev_ops_t vdev_raidz_ops = {
+	.vdev_op_open = vdev_raidz_open,
+	.vdev_op_close = vdev_raidz_close,
+	.vdev_op_asize = vdev_raidz_asize,
+	.vdev_op_io_start = vdev_raidz_io_start,
+	.vdev_op_io_done = vdev_raidz_io_done,
+	.vdev_op_state_change = vdev_raidz_state_change,
+	.vdev_op_need_resilver = vdev_raidz_need_resilver,
+	.vdev_op_hold = NULL,
+	.vdev_op_rele = NULL,
+	.vdev_op_remap = NULL,
+	.vdev_op_xlate = vdev_raidz_xlate,
+	.vdev_op_type = VDEV_TYPE_RAIDZ,	/* name of this vdev type */
+	.vdev_op_leaf = B_FALSE			/* not a leaf vdev */
+};
+
+/*
+ * RAIDZ expansion
+ *
+ * A disk attached to a raidz vdev becomes its last child.  The existing
+ * sectors are then reflowed in order from rows spanning the old children to
+ * rows spanning all of them, by vdev_raidz_expand_thread().  Blocks keep the
+ * logical layout they were written with, and vdev_raidz_io_start() finds
+ * their sectors on either side of the reflow point.  Once every sector has
+ * been moved the vdev is reopened to make the new child's space available,
+ * and blocks born after that use the wider rows.
+ *
+ * There is no scratch area, so a sector may only be copied over the old
+ * location of a sector whose new location is durable.  The reflow offset
+ * is therefore persisted every txg, and each txg can advance it by the
+ * ratio of the new width to the old one.
+ */
+
+static void vdev_raidz_expand_thread(void *arg);
+
+static boolean_t
+vdev_raidz_expand_should_stop(vdev_t *vd)
+{
+	return (vd->vdev_raidz_expand_exit_wanted || !vdev_writeable(vd) ||
+	    vd->vdev_removing);
+}
+
+/*
+ * Write the in-core expansion state to the top-level vdev ZAP.  Caller must
+ * hold vdev_raidz_expand_lock.
+ */
+static void
+vdev_raidz_expand_zap_update(vdev_t *vd, dmu_tx_t *tx)
+{
+	ASSERT(MUTEX_HELD(&vd->vdev_raidz_expand_lock));
+	ASSERT(vd->vdev_top_zap != 0);
+
+	VERIFY0(zap_update(vd->vdev_spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_RAIDZ_EXPAND_PHYS, sizeof (uint64_t),
+	    RAIDZ_EXPAND_PHYS_ENTRIES, &vd->vdev_raidz_expand.vre_phys, tx));
+}
+
+static vdev_t *
+vdev_raidz_expand_lookup_top(dmu_tx_t *tx, void *arg)
+{
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	uint64_t vdev_id = (uintptr_t)arg;
+
+	if (vdev_id >= spa->spa_root_vdev->vdev_children)
+		return (NULL);
+
+	vdev_t *vd = spa->spa_root_vdev->vdev_child[vdev_id];
+	if (vd->vdev_top_zap == 0 || vd->vdev_ops != &vdev_raidz_ops)
+		return (NULL);
+
+	return (vd);
+}
+
+/*
+ * Persist the reflow offset reached in this txg.  The copies below it were
+ * flushed before it was handed over.  The offset is kept in the vdev config,
+ * which is written in the same txg, since that is all there is to go on
+ * when reading the MOS.
+ */
+static void
+vdev_raidz_expand_update_sync(void *arg, dmu_tx_t *tx)
+{
+	vdev_t *vd = vdev_raidz_expand_lookup_top(tx, arg);
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	if (vd == NULL)
+		return;
+
+	vdev_raidz_expand_t *vre = &vd->vdev_raidz_expand;
+
+	mutex_enter(&vd->vdev_raidz_expand_lock);
+	if (vre->vre_offset_pertxg[txg & TXG_MASK] != 0) {
+		vre->vre_offset_prev = vre->vre_offset_phys;
+		vre->vre_offset_phys = vre->vre_offset_pertxg[txg & TXG_MASK];
+		vre->vre_offset_phys_txg = txg;
+		vre->vre_offset_pertxg[txg & TXG_MASK] = 0;
+		vdev_config_dirty(vd);
+	}
+	vdev_raidz_expand_zap_update(vd, tx);
+	mutex_exit(&vd->vdev_raidz_expand_lock);
+}
+
+/*
+ * Mark the expansion active on disk.  vdev_raidz_expand_restart() may
+ * dispatch this more than once before it runs.
+ */
+static void
+vdev_raidz_expand_initiate_sync(void *arg, dmu_tx_t *tx)
+{
+	vdev_t *vd = vdev_raidz_expand_lookup_top(tx, arg);
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+
+	if (vd == NULL)
+		return;
+
+	vdev_raidz_expand_phys_t *vrep = &vd->vdev_raidz_expand.vre_phys;
+
+	mutex_enter(&vd->vdev_raidz_expand_lock);
+	if (!vd->vdev_raidz_expanding ||
+	    vrep->vrep_state == VDEV_RAIDZ_EXPAND_ACTIVE) {
+		mutex_exit(&vd->vdev_raidz_expand_lock);
+		return;
+	}
+
+	spa_feature_incr(spa, SPA_FEATURE_RAIDZ_EXPANSION, tx);
+
+	vrep->vrep_state = VDEV_RAIDZ_EXPAND_ACTIVE;
+	vrep->vrep_start_time = gethrestime_sec();
+	vrep->vrep_end_time = 0;
+	vrep->vrep_bytes_to_reflow = vd->vdev_stat.vs_alloc;
+	vrep->vrep_children = vd->vdev_children;
+	vdev_raidz_expand_zap_update(vd, tx);
+
+	spa_history_log_internal(spa, "raidz expand", tx,
+	    "vdev_id=%llu vdev_guid=%llu children=%llu started",
+	    (u_longlong_t)vd->vdev_id, (u_longlong_t)vd->vdev_guid,
+	    (u_longlong_t)vd->vdev_children);
+	mutex_exit(&vd->vdev_raidz_expand_lock);
+}
+
+/*
+ * Switch the vdev to the expanded layout.  The feature stays active since
+ * the sectors of existing blocks have moved for good.
+ */
+static void
+vdev_raidz_expand_complete_sync(void *arg, dmu_tx_t *tx)
+{
+	vdev_t *vd = vdev_raidz_expand_lookup_top(tx, arg);
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	if (vd == NULL)
+		return;
+
+	vdev_raidz_expand_t *vre = &vd->vdev_raidz_expand;
+	vdev_raidz_expand_phys_t *vrep = &vre->vre_phys;
+
+	mutex_enter(&vd->vdev_raidz_expand_lock);
+	ASSERT(vd->vdev_raidz_expanding);
+	ASSERT3U(vre->vre_ntxgs, <, vre->vre_txgs_max);
+
+	/*
+	 * Blocks in the txgs which are already open were allocated for the
+	 * old width, so the new width starts with the first one which isn't.
+	 */
+	vre->vre_txgs[vre->vre_ntxgs] = txg + TXG_CONCURRENT_STATES;
+	membar_producer();
+	vre->vre_ntxgs++;
+
+	vre->vre_offset = UINT64_MAX;
+	vre->vre_offset_phys = UINT64_MAX;
+	vre->vre_offset_prev = UINT64_MAX;
+	vd->vdev_raidz_expanding = B_FALSE;
+
+	vrep->vrep_state = VDEV_RAIDZ_EXPAND_COMPLETE;
+	vrep->vrep_end_time = gethrestime_sec();
+	vdev_raidz_expand_zap_update(vd, tx);
+	vdev_config_dirty(vd);
+
+	spa_history_log_internal(spa, "raidz expand", tx,
+	    "vdev_id=%llu vdev_guid=%llu complete, errors=%llu",
+	    (u_longlong_t)vd->vdev_id, (u_longlong_t)vd->vdev_guid,
+	    (u_longlong_t)vrep->vrep_errors);
+	mutex_exit(&vd->vdev_raidz_expand_lock);
+
+	/* Autotrim stands down while the vdev is expanding */
+	spa_async_request(spa, SPA_ASYNC_AUTOTRIM_RESTART);
+}
+
+/*
+ * Load the allocated ranges of the metaslab which are above the reflow
+ * offset.  The metaslab is disabled, so once the allocations in flight
+ * have synced nothing else can be allocated from it.
+ */
+static void
+vdev_raidz_expand_load_ranges(vdev_t *vd, metaslab_t *msp, range_tree_t *rt)
+{
+	mutex_enter(&msp->ms_sync_lock);
+	mutex_enter(&msp->ms_lock);
+
+	for (int j = 0; j < TXG_SIZE; j++) {
+		if (range_tree_space(msp->ms_allocating[j]) != 0) {
+			mutex_exit(&msp->ms_lock);
+			mutex_exit(&msp->ms_sync_lock);
+			txg_wait_synced(spa_get_dsl(vd->vdev_spa), 0);
+			mutex_enter(&msp->ms_sync_lock);
+			mutex_enter(&msp->ms_lock);
+			break;
+		}
+	}
+
+	if (msp->ms_sm != NULL) {
+		VERIFY0(space_map_load(msp->ms_sm, rt, SM_ALLOC));
+		range_tree_walk(msp->ms_unflushed_allocs, range_tree_add, rt);
+		range_tree_walk(msp->ms_unflushed_frees, range_tree_remove, rt);
+		range_tree_clear(rt, 0, vd->vdev_raidz_expand.vre_offset);
+	}
+
+	mutex_exit(&msp->ms_lock);
+	mutex_exit(&msp->ms_sync_lock);
+}
+
+typedef struct raidz_reflow_io {
+	abd_t	*rri_abd;
+	int	rri_error;
+} raidz_reflow_io_t;
+
+static void
+vdev_raidz_reflow_io_done(zio_t *zio)
+{
+	raidz_reflow_io_t *rri = zio->io_private;
+
+	rri->rri_error = zio->io_error;
+}
+
+/*
+ * Copy the vdev sectors [ps, pe) from their rows across the old children
+ * to their rows across all children.  Everything is read before anything
+ * is written, since the new location of a sector may be the old location
+ * of another in the range.  Sectors are only copied while all of the old
+ * children can provide them, reconstruction is left to a later scrub.
+ */
+static int
+vdev_raidz_reflow_copy_range(vdev_t *vd, uint64_t ps, uint64_t pe)
+{
+	spa_t *spa = vd->vdev_spa;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t width = vd->vdev_children;
+	uint64_t oldwidth = width - 1;
+	uint64_t r0 = ps / oldwidth;
+	uint64_t rows = (pe - 1) / oldwidth - r0 + 1;
+	raidz_reflow_io_t *rd, *wr;
+	zio_t *rio;
+	int error = 0;
+
+	ASSERT3U(ps, <, pe);
+
+	for (uint64_t c = 0; c < width; c++) {
+		vdev_t *cvd = vd->vdev_child[c];
+
+		if (!vdev_writeable(cvd) || (c < oldwidth &&
+		    (!vdev_readable(cvd) || !vdev_dtl_empty(cvd, DTL_MISSING))))
+			return (SET_ERROR(ENXIO));
+	}
+
+	rd = kmem_zalloc(oldwidth * sizeof (raidz_reflow_io_t), KM_SLEEP);
+	wr = kmem_zalloc(width * sizeof (raidz_reflow_io_t), KM_SLEEP);
+
+	rio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+	for (uint64_t c = 0; c < oldwidth; c++) {
+		rd[c].rri_abd = abd_alloc_for_io(rows << ashift, B_FALSE);
+		zio_nowait(zio_vdev_child_io(rio, NULL, vd->vdev_child[c],
+		    r0 << ashift, rd[c].rri_abd, rows << ashift,
+		    ZIO_TYPE_READ, ZIO_PRIORITY_REMOVAL, ZIO_FLAG_CANFAIL,
+		    vdev_raidz_reflow_io_done, &rd[c]));
+	}
+	(void) zio_wait(rio);
+
+	for (uint64_t c = 0; c < oldwidth; c++) {
+		if (rd[c].rri_error != 0)
+			error = SET_ERROR(EIO);
+	}
+
+	if (error == 0) {
+		rio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+		for (uint64_t c = 0; c < width; c++) {
+			uint64_t first = ps + (c + width - ps % width) % width;
+			uint64_t n;
+
+			if (first >= pe)
+				continue;
+
+			n = (pe - 1 - first) / width + 1;
+			wr[c].rri_abd = abd_alloc_for_io(n << ashift, B_FALSE);
+			for (uint64_t i = 0; i < n; i++) {
+				uint64_t s = first + i * width;
+
+				abd_copy_off(wr[c].rri_abd,
+				    rd[s % oldwidth].rri_abd, i << ashift,
+				    (s / oldwidth - r0) << ashift,
+				    1ULL << ashift);
 			}
+			zio_nowait(zio_vdev_child_io(rio, NULL,
+			    vd->vdev_child[c], (first / width) << ashift,
+			    wr[c].rri_abd, n << ashift, ZIO_TYPE_WRITE,
+			    ZIO_PRIORITY_REMOVAL, ZIO_FLAG_CANFAIL,
+			    vdev_raidz_reflow_io_done, &wr[c]));
+		}
+		(void) zio_wait(rio);
 
-			ASSERT(rm->rm_firstdatacol >= n);
+		for (uint64_t c = 0; c < width; c++) {
+			if (wr[c].rri_error != 0)
+				error = SET_ERROR(EIO);
+		}
+	}
 
-			code = vdev_raidz_reconstruct(rm, tgts, n);
+	for (uint64_t c = 0; c < oldwidth; c++)
+		abd_free(rd[c].rri_abd);
+	for (uint64_t c = 0; c < width; c++) {
+		if (wr[c].rri_abd != NULL)
+			abd_free(wr[c].rri_abd);
+	}
+	kmem_free(rd, oldwidth * sizeof (raidz_reflow_io_t));
+	kmem_free(wr, width * sizeof (raidz_reflow_io_t));
 
-			if (raidz_checksum_verify(zio) == 0) {
-				/*
-				 * If we read more parity disks than were used
-				 * for reconstruction, confirm that the other
-				 * parity disks produced correct data. This
-				 * routine is suboptimal in that it regenerates
-				 * the parity that we already used in addition
-				 * to the parity that we're attempting to
-				 * verify, but this should be a relatively
-				 * uncommon case, and can be optimized if it
-				 * becomes a problem. Note that we regenerate
-				 * parity when resilvering so we can write it
-				 * out to failed devices later.
-				 */
-				if (parity_errors < rm->rm_firstdatacol - n ||
-				    (zio->io_flags & ZIO_FLAG_RESILVER)) {
-					n = raidz_parity_verify(zio, rm);
-					unexpected_errors += n;
-					ASSERT(parity_errors + n <=
-					    rm->rm_firstdatacol);
-				}
+	return (error);
+}
+
+/*
+ * Reflow the next batch of the metaslab and hand the new offset to the
+ * current txg, which is returned in txgp.  A batch stops short of the first
+ * sector whose new location is the old location of a sector which is not
+ * durably reflowed yet, and returns EAGAIN if it can't start at all.  The
+ * whole of the first row can always be copied since it doesn't move.
+ */
+static int
+vdev_raidz_reflow_batch(vdev_t *vd, metaslab_t *msp, range_tree_t *rt,
+    uint64_t *txgp)
+{
+	spa_t *spa = vd->vdev_spa;
+	vdev_raidz_expand_t *vre = &vd->vdev_raidz_expand;
+	uint64_t ashift = vd->vdev_top->vdev_ashift;
+	uint64_t width = vd->vdev_children;
+	uint64_t oldwidth = width - 1;
+	uint64_t max_copy, start, limit, end, durable, copied = 0;
+	zfs_btree_index_t idx;
+	locked_range_t *lr;
+	int error = 0;
+
+	max_copy = P2ROUNDUP(MAX(raidz_expand_max_copy_bytes, 1),
+	    1ULL << ashift);
+
+	mutex_enter(&vd->vdev_raidz_expand_lock);
+	start = MAX(vre->vre_offset, msp->ms_start);
+	durable = vdev_raidz_expand_durable(vd) >> ashift;
+	mutex_exit(&vd->vdev_raidz_expand_lock);
+
+	limit = MAX(width, (durable / oldwidth) * width + durable % oldwidth);
+	limit = MIN(limit << ashift, msp->ms_start + msp->ms_size);
+	if (limit <= start)
+		return (SET_ERROR(EAGAIN));
+
+	/*
+	 * Besides the sectors being moved, hold off I/O to the sectors whose
+	 * old location they are moved onto, since writes to those may still
+	 * go to the old location as well.
+	 */
+	spa_config_enter(spa, SCL_STATE_ALL, FTAG, RW_READER);
+	uint64_t lock_start = (((start >> ashift) / width) * oldwidth) <<
+	    ashift;
+	lr = rangelock_enter(&vre->vre_rangelock, lock_start,
+	    limit - lock_start, RL_WRITER);
+
+	end = limit;
+	for (range_seg_t *rs = zfs_btree_first(&rt->rt_root, &idx);
+	    rs != NULL; rs = zfs_btree_next(&rt->rt_root, &idx, &idx)) {
+		uint64_t rstart = MAX(rs_get_start(rs, rt), start);
+		uint64_t rend = MIN(rs_get_end(rs, rt), limit);
+
+		if (rstart >= limit)
+			break;
+		if (rend <= rstart)
+			continue;
+
+		if (copied + (rend - rstart) >= max_copy) {
+			rend = rstart + (max_copy - copied);
+			end = rend;
+		}
+
+		error = vdev_raidz_reflow_copy_range(vd, rstart >> ashift,
+		    rend >> ashift);
+		if (error != 0)
+			break;
+
+		copied += rend - rstart;
+		if (copied >= max_copy)
+			break;
+	}
+
+	if (error == 0) {
+		zio_t *fio = zio_root(spa, NULL, NULL, ZIO_FLAG_CANFAIL);
+		zio_flush(fio, vd);
+		(void) zio_wait(fio);
+
+		mutex_enter(&vd->vdev_raidz_expand_lock);
+		vre->vre_offset = end;
+		vre->vre_phys.vrep_bytes_reflowed += copied;
+		mutex_exit(&vd->vdev_raidz_expand_lock);
+
+		range_tree_clear(rt, msp->ms_start, end - msp->ms_start);
+	}
 
-				goto done;
-			}
-		}
+	rangelock_exit(lr);
+	spa_config_exit(spa, SCL_STATE_ALL, FTAG);
+
+	if (error != 0)
+		return (error);
+
+	dmu_tx_t *tx = dmu_tx_create_dd(spa_get_dsl(spa)->dp_mos_dir);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	mutex_enter(&vd->vdev_raidz_expand_lock);
+	if (vre->vre_offset_pertxg[txg & TXG_MASK] == 0) {
+		dsl_sync_task_nowait(spa_get_dsl(spa),
+		    vdev_raidz_expand_update_sync,
+		    (void *)(uintptr_t)vd->vdev_id, 2,
+		    ZFS_SPACE_CHECK_RESERVED, tx);
 	}
+	vre->vre_offset_pertxg[txg & TXG_MASK] = end;
+	mutex_exit(&vd->vdev_raidz_expand_lock);
 
-	/*
-	 * This isn't a typical situation -- either we got a read error or
-	 * a child silently returned bad data. Read every block so we can
-	 * try again with as much data and parity as we can track down. If
-	 * we've already been through once before, all children will be marked
-	 * as tried so we'll proceed to combinatorial reconstruction.
-	 */
-	unexpected_errors = 1;
-	rm->rm_missingdata = 0;
-	rm->rm_missingparity = 0;
+	dmu_tx_commit(tx);
 
-	for (c = 0; c < rm->rm_cols; c++) {
-		if (rm->rm_col[c].rc_tried)
+	*txgp = txg;
+	return (0);
+}
+
+static void
+vdev_raidz_expand_thread(void *arg)
+{
+	vdev_t *vd = arg;
+	spa_t *spa = vd->vdev_spa;
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	vdev_raidz_expand_t *vre = &vd->vdev_raidz_expand;
+	range_tree_t *rt = range_tree_create(NULL, RANGE_SEG64, NULL, 0, 0);
+	uint64_t txg = 0;
+	int error = 0;
+
+	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+
+	for (uint64_t i = 0; i < vd->vdev_ms_count; i++) {
+		metaslab_t *msp = vd->vdev_ms[i];
+		uint64_t ms_end = msp->ms_start + msp->ms_size;
+
+		if (vdev_raidz_expand_should_stop(vd)) {
+			error = SET_ERROR(EINTR);
+			break;
+		}
+
+		/* Skip metaslabs which were reflowed before an export. */
+		if (ms_end <= vre->vre_offset)
 			continue;
 
-		zio_vdev_io_redone(zio);
-		do {
-			rc = &rm->rm_col[c];
-			if (rc->rc_tried)
-				continue;
-			zio_nowait(zio_vdev_child_io(zio, NULL,
-			    vd->vdev_child[rc->rc_devidx],
-			    rc->rc_offset, rc->rc_abd, rc->rc_size,
-			    zio->io_type, zio->io_priority, 0,
-			    vdev_raidz_child_done, rc));
-		} while (++c < rm->rm_cols);
+		spa_config_exit(spa, SCL_CONFIG, FTAG);
+		metaslab_disable(msp);
+		vdev_raidz_expand_load_ranges(vd, msp, rt);
 
-		return;
+		while (vre->vre_offset < ms_end) {
+			if (vdev_raidz_expand_should_stop(vd)) {
+				error = SET_ERROR(EINTR);
+				break;
+			}
+
+			int err = vdev_raidz_reflow_batch(vd, msp, rt, &txg);
+			if (err == EAGAIN) {
+				/* Wait for the last offset to be durable */
+				txg_wait_synced(dp, txg);
+			} else if (err == ENXIO) {
+				/* Wait for the missing child to come back */
+				delay(hz);
+			} else if (err != 0) {
+				mutex_enter(&vd->vdev_raidz_expand_lock);
+				vre->vre_phys.vrep_errors++;
+				mutex_exit(&vd->vdev_raidz_expand_lock);
+				delay(hz);
+			}
+		}
+
+		range_tree_vacate(rt, NULL, NULL);
+		metaslab_enable(msp, B_FALSE, B_FALSE);
+		spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+
+		if (error != 0)
+			break;
 	}
 
-	/*
-	 * At this point we've attempted to reconstruct the data given the
-	 * errors we detected, and we've attempted to read all columns. There
-	 * must, therefore, be one or more additional problems -- silent errors
-	 * resulting in invalid data rather than explicit I/O errors resulting
-	 * in absent data. We check if there is enough additional data to
-	 * possibly reconstruct the data and then perform combinatorial
-	 * reconstruction over all possible combinations. If that fails,
-	 * we're cooked.
-	 */
-	if (total_errors > rm->rm_firstdatacol) {
-		zio->io_error = vdev_raidz_worst_error(rm);
+	spa_config_exit(spa, SCL_CONFIG, FTAG);
+	range_tree_destroy(rt);
 
-	} else if (total_errors < rm->rm_firstdatacol &&
-	    (code = vdev_raidz_combrec(zio, total_errors, data_errors)) != 0) {
+	if (error == 0 && !vdev_raidz_expand_should_stop(vd)) {
 		/*
-		 * If we didn't use all the available parity for the
-		 * combinatorial reconstruction, verify that the remaining
-		 * parity is correct.
+		 * Wait for the final offset to be durable, after which no
+		 * new writes go to old locations, then for any such writes
+		 * still in flight.  Those locations are free space in the
+		 * expanded layout.
 		 */
-		if (code != (1 << rm->rm_firstdatacol) - 1)
-			(void) raidz_parity_verify(zio, rm);
-	} else {
+		txg_wait_synced(dp, txg);
+		locked_range_t *lr = rangelock_enter(&vre->vre_rangelock, 0,
+		    UINT64_MAX, RL_WRITER);
+		rangelock_exit(lr);
+
+		dmu_tx_t *tx = dmu_tx_create_dd(dp->dp_mos_dir);
+		VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+		dsl_sync_task_nowait(dp, vdev_raidz_expand_complete_sync,
+		    (void *)(uintptr_t)vd->vdev_id, 0, ZFS_SPACE_CHECK_NONE,
+		    tx);
+		txg = dmu_tx_get_txg(tx);
+		dmu_tx_commit(tx);
+		txg_wait_synced(dp, txg);
+
 		/*
-		 * We're here because either:
-		 *
-		 *	total_errors == rm_first_datacol, or
-		 *	vdev_raidz_combrec() failed
-		 *
-		 * In either case, there is enough bad data to prevent
-		 * reconstruction.
-		 *
-		 * Start checksum ereports for all children which haven't
-		 * failed, and the IO wasn't speculative.
+		 * Grow the vdev onto the new child now that every row spans
+		 * it.  SPA_ASYNC_CONFIG_UPDATE then adds the metaslabs.
 		 */
-		zio->io_error = SET_ERROR(ECKSUM);
-
-		if (!(zio->io_flags & ZIO_FLAG_SPECULATIVE)) {
-			for (c = 0; c < rm->rm_cols; c++) {
-				vdev_t *cvd;
-				rc = &rm->rm_col[c];
-				cvd = vd->vdev_child[rc->rc_devidx];
-				if (rc->rc_error == 0) {
-					zio_bad_cksum_t zbc;
-					zbc.zbc_has_cksum = 0;
-					zbc.zbc_injected =
-					    rm->rm_ecksuminjected;
+		spa_config_enter(spa, SCL_STATE_ALL, FTAG, RW_WRITER);
+		vd->vdev_expanding = B_TRUE;
+		vdev_reopen(vd);
+		vd->vdev_expanding = B_FALSE;
+		spa_config_exit(spa, SCL_STATE_ALL, FTAG);
+		spa_async_request(spa, SPA_ASYNC_CONFIG_UPDATE);
+	}
 
-					mutex_enter(&cvd->vdev_stat_lock);
-					cvd->vdev_stat.vs_checksum_errors++;
-					mutex_exit(&cvd->vdev_stat_lock);
+	mutex_enter(&vd->vdev_raidz_expand_lock);
+	vd->vdev_raidz_expand_thread = NULL;
+	cv_broadcast(&vd->vdev_raidz_expand_cv);
+	mutex_exit(&vd->vdev_raidz_expand_lock);
+}
 
-					zfs_ereport_start_checksum(
-					    zio->io_spa, cvd,
-					    &zio->io_bookmark, zio,
-					    rc->rc_offset, rc->rc_size,
-					    (void *)(uintptr_t)c, &zbc);
-				}
-			}
+/*
+ * Start expanding a raidz vdev onto the child just attached as its last
+ * child.  Caller must hold the spa config lock as writer, normally via
+ * spa_vdev_enter(), so that no I/O sees the geometry change.  The reflow is
+ * started by vdev_raidz_expand_restart() once spa_vdev_exit() has written
+ * the new config.
+ */
+void
+vdev_raidz_expand_start(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	vdev_raidz_expand_t *vre = &vd->vdev_raidz_expand;
+
+	ASSERT(vd == vd->vdev_top);
+	ASSERT3P(vd->vdev_ops, ==, &vdev_raidz_ops);
+	ASSERT(spa_config_held(spa, SCL_ALL, RW_WRITER) == SCL_ALL);
+	ASSERT(spa_feature_is_enabled(spa, SPA_FEATURE_RAIDZ_EXPANSION));
+	ASSERT(!vd->vdev_raidz_expanding);
+
+	mutex_enter(&vd->vdev_raidz_expand_lock);
+	ASSERT3P(vd->vdev_raidz_expand_thread, ==, NULL);
+
+	if (vre->vre_width0 == 0)
+		vre->vre_width0 = vd->vdev_children - 1 - vre->vre_ntxgs;
+
+	if (vre->vre_ntxgs == vre->vre_txgs_max) {
+		uint64_t *txgs = kmem_zalloc((vre->vre_txgs_max + 1) *
+		    sizeof (uint64_t), KM_SLEEP);
+
+		if (vre->vre_txgs != NULL) {
+			bcopy(vre->vre_txgs, txgs,
+			    vre->vre_ntxgs * sizeof (uint64_t));
+			kmem_free(vre->vre_txgs,
+			    vre->vre_txgs_max * sizeof (uint64_t));
 		}
+		vre->vre_txgs = txgs;
+		vre->vre_txgs_max++;
 	}
 
-done:
-	zio_checksum_verified(zio);
+	vre->vre_offset = 0;
+	vre->vre_offset_phys = 0;
+	vre->vre_offset_phys_txg = 0;
+	vre->vre_offset_prev = 0;
+	for (int i = 0; i < TXG_SIZE; i++)
+		vre->vre_offset_pertxg[i] = 0;
+	bzero(&vre->vre_phys, sizeof (vdev_raidz_expand_phys_t));
+	vd->vdev_raidz_expanding = B_TRUE;
+	mutex_exit(&vd->vdev_raidz_expand_lock);
+}
 
-	if (zio->io_error == 0 && spa_writeable(zio->io_spa) &&
-	    (unexpected_errors || (zio->io_flags & ZIO_FLAG_RESILVER))) {
-		/*
-		 * Use the good data we have in hand to repair damaged children.
-		 */
-		for (c = 0; c < rm->rm_cols; c++) {
-			rc = &rm->rm_col[c];
-			cvd = vd->vdev_child[rc->rc_devidx];
+static void
+vdev_raidz_expand_restart_impl(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	boolean_t initiate = B_FALSE;
 
-			if (rc->rc_error == 0)
-				continue;
+	if (vd == spa->spa_root_vdev) {
+		for (uint64_t i = 0; i < vd->vdev_children; i++)
+			vdev_raidz_expand_restart_impl(vd->vdev_child[i]);
+		return;
+	}
 
-			zio_nowait(zio_vdev_child_io(zio, NULL, cvd,
-			    rc->rc_offset, rc->rc_abd, rc->rc_size,
-			    ZIO_TYPE_WRITE, ZIO_PRIORITY_ASYNC_WRITE,
-			    ZIO_FLAG_IO_REPAIR | (unexpected_errors ?
-			    ZIO_FLAG_SELF_HEAL : 0), NULL, NULL));
+	if (vd->vdev_top_zap == 0 || vd->vdev_ops != &vdev_raidz_ops)
+		return;
+
+	mutex_enter(&vd->vdev_raidz_expand_lock);
+	if (vd->vdev_raidz_expanding && vdev_writeable(vd) &&
+	    !vd->vdev_removing && vd->vdev_raidz_expand_thread == NULL) {
+		ASSERT(!vd->vdev_raidz_expand_exit_wanted);
+		initiate = (vd->vdev_raidz_expand.vre_phys.vrep_state !=
+		    VDEV_RAIDZ_EXPAND_ACTIVE);
+		vd->vdev_raidz_expand_thread = thread_create(NULL, 0,
+		    vdev_raidz_expand_thread, vd, 0, &p0, TS_RUN,
+		    maxclsyspri);
+	}
+	mutex_exit(&vd->vdev_raidz_expand_lock);
+
+	if (initiate) {
+		dmu_tx_t *tx = dmu_tx_create_dd(spa_get_dsl(spa)->dp_mos_dir);
+		VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+		dsl_sync_task_nowait(spa_get_dsl(spa),
+		    vdev_raidz_expand_initiate_sync,
+		    (void *)(uintptr_t)vd->vdev_id, 0,
+		    ZFS_SPACE_CHECK_NONE, tx);
+		dmu_tx_commit(tx);
+	}
+}
+
+/*
+ * Resume any expansions which do not currently have a running thread.
+ * Called after the pool is imported and after every configuration change
+ * made under spa_vdev_enter(), which is how a new expansion gets going.
+ */
+void
+vdev_raidz_expand_restart(spa_t *spa)
+{
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+
+	if (!spa_writeable(spa))
+		return;
+
+	vdev_raidz_expand_restart_impl(spa->spa_root_vdev);
+}
+
+/*
+ * Stop the expansion thread for a top-level vdev and wait for it to exit.
+ * The expansion stays in progress and is resumed by a later restart.  The
+ * caller must not hold the spa config lock as writer.
+ */
+void
+vdev_raidz_expand_stop_wait(vdev_t *vd)
+{
+	ASSERT(!spa_config_held(vd->vdev_spa, SCL_CONFIG | SCL_STATE,
+	    RW_WRITER));
+	ASSERT(vd == vd->vdev_top);
+
+	mutex_enter(&vd->vdev_raidz_expand_lock);
+	if (vd->vdev_raidz_expand_thread != NULL) {
+		vd->vdev_raidz_expand_exit_wanted = B_TRUE;
+		while (vd->vdev_raidz_expand_thread != NULL) {
+			cv_wait(&vd->vdev_raidz_expand_cv,
+			    &vd->vdev_raidz_expand_lock);
 		}
+		vd->vdev_raidz_expand_exit_wanted = B_FALSE;
 	}
+	mutex_exit(&vd->vdev_raidz_expand_lock);
 }
 
-static void
-vdev_raidz_state_change(vdev_t *vd, int faulted, int degraded)
+/*
+ * Stop all of the expansion threads associated with the pool.
+ */
+void
+vdev_raidz_expand_stop_all(spa_t *spa)
 {
-	if (faulted > vd->vdev_nparity)
-		vdev_set_state(vd, B_FALSE, VDEV_STATE_CANT_OPEN,
-		    VDEV_AUX_NO_REPLICAS);
-	else if (degraded + faulted != 0)
-		vdev_set_state(vd, B_FALSE, VDEV_STATE_DEGRADED, VDEV_AUX_NONE);
-	else
-		vdev_set_state(vd, B_FALSE, VDEV_STATE_HEALTHY, VDEV_AUX_NONE);
+	vdev_t *root_vd = spa->spa_root_vdev;
+
+	for (uint64_t i = 0; i < root_vd->vdev_children; i++)
+		vdev_raidz_expand_stop_wait(root_vd->vdev_child[i]);
 }
 
 /*
- * Determine if any portion of the provided block resides on a child vdev
- * with a dirty DTL and therefore needs to be resilvered.  The function
- * assumes that at least one DTL is dirty which implies that full stripe
- * width blocks must be resilvered.
+ * Returns B_TRUE if the top-level vdev is being expanded, or when passed
+ * the root vdev, if any top-level vdev in the pool is.
  */
-static boolean_t
-vdev_raidz_need_resilver(vdev_t *vd, uint64_t offset, size_t psize)
+boolean_t
+vdev_raidz_expand_active(vdev_t *vd)
 {
-	uint64_t dcols = vd->vdev_children;
-	uint64_t nparity = vd->vdev_nparity;
-	uint64_t ashift = vd->vdev_top->vdev_ashift;
-	/* The starting RAIDZ (parent) vdev sector of the block. */
-	uint64_t b = offset >> ashift;
-	/* The zio's size in units of the vdev's minimum sector size. */
-	uint64_t s = ((psize - 1) >> ashift) + 1;
-	/* The first column for this stripe. */
-	uint64_t f = b % dcols;
+	spa_t *spa = vd->vdev_spa;
+	boolean_t ret = B_FALSE;
 
-	if (s + nparity >= dcols)
-		return (B_TRUE);
+	if (vd == spa->spa_root_vdev) {
+		for (uint64_t i = 0; i < vd->vdev_children && !ret; i++)
+			ret = vdev_raidz_expand_active(vd->vdev_child[i]);
+	} else {
+		ret = vd->vdev_raidz_expanding;
+	}
 
-	for (uint64_t c = 0; c < s + nparity; c++) {
-		uint64_t devidx = (f + c) % dcols;
-		vdev_t *cvd = vd->vdev_child[devidx];
+	return (ret);
+}
 
-		/*
-		 * dsl_scan_need_resilver() already checked vd with
-		 * vdev_dtl_contains(). So here just check cvd with
-		 * vdev_dtl_empty(), cheaper and a good approximation.
-		 */
-		if (!vdev_dtl_empty(cvd, DTL_PARTIAL))
-			return (B_TRUE);
+/*
+ * Load the expansion state from the top-level vdev ZAP.  A missing entry
+ * means the vdev has never been expanded.
+ */
+int
+vdev_raidz_expand_load(vdev_t *vd)
+{
+	vdev_raidz_expand_phys_t *vrep = &vd->vdev_raidz_expand.vre_phys;
+	int err;
+
+	ASSERT(vd == vd->vdev_top);
+
+	mutex_enter(&vd->vdev_raidz_expand_lock);
+	err = zap_lookup(vd->vdev_spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_RAIDZ_EXPAND_PHYS, sizeof (uint64_t),
+	    RAIDZ_EXPAND_PHYS_ENTRIES, vrep);
+	if (err == ENOENT) {
+		bzero(vrep, sizeof (vdev_raidz_expand_phys_t));
+		err = 0;
 	}
+	mutex_exit(&vd->vdev_raidz_expand_lock);
 
-	return (B_FALSE);
+	return (err);
 }
 
-static void
-vdev_raidz_xlate(vdev_t *cvd, const range_seg_t *in, range_seg_t *res)
+/*
+ * Report the expansion statistics for a top-level vdev.  Returns ENOENT
+ * when the vdev has never been expanded.
+ */
+int
+vdev_raidz_expand_get_stats(vdev_t *vd, vdev_raidz_expand_stat_t *vres)
 {
-	vdev_t *raidvd = cvd->vdev_parent;
-	ASSERT(raidvd->vdev_ops == &vdev_raidz_ops);
+	vdev_raidz_expand_t *vre = &vd->vdev_raidz_expand;
+	vdev_raidz_expand_phys_t *vrep = &vre->vre_phys;
 
-	uint64_t width = raidvd->vdev_children;
-	uint64_t tgt_col = cvd->vdev_id;
-	uint64_t ashift = raidvd->vdev_top->vdev_ashift;
+	bzero(vres, sizeof (vdev_raidz_expand_stat_t));
 
-	/* make sure the offsets are block-aligned */
-	ASSERT0(in->rs_start % (1 << ashift));
-	ASSERT0(in->rs_end % (1 << ashift));
-	uint64_t b_start = in->rs_start >> ashift;
-	uint64_t b_end = in->rs_end >> ashift;
+	if (vd->vdev_ops != &vdev_raidz_ops)
+		return (SET_ERROR(ENOENT));
 
-	uint64_t start_row = 0;
-	if (b_start > tgt_col) /* avoid underflow */
-		start_row = ((b_start - tgt_col - 1) / width) + 1;
+	mutex_enter(&vd->vdev_raidz_expand_lock);
+	if (vrep->vrep_state == VDEV_RAIDZ_EXPAND_NONE) {
+		mutex_exit(&vd->vdev_raidz_expand_lock);
+		return (SET_ERROR(ENOENT));
+	}
 
-	uint64_t end_row = 0;
-	if (b_end > tgt_col)
-		end_row = ((b_end - tgt_col - 1) / width) + 1;
+	vres->vres_state = vrep->vrep_state;
+	vres->vres_start_time = vrep->vrep_start_time;
+	vres->vres_end_time = vrep->vrep_end_time;
+	vres->vres_to_reflow = vrep->vrep_bytes_to_reflow;
+	vres->vres_reflowed = vrep->vrep_bytes_reflowed;
+	vres->vres_offset = vd->vdev_raidz_expanding ? vre->vre_offset : 0;
+	vres->vres_errors = vrep->vrep_errors;
+	vres->vres_children = vrep->vrep_children;
+	mutex_exit(&vd->vdev_raidz_expand_lock);
 
-	res->rs_start = start_row << ashift;
-	res->rs_end = end_row << ashift;
+	return (0);
+}
 
-	ASSERT3U(res->rs_start, <=, in->rs_start);
-	ASSERT3U(res->rs_end - res->rs_start, <=, in->rs_end - in->rs_start);
+/*
+ * Set up the geometry of a raidz vdev from its config.
+ */
+void
+vdev_raidz_expand_config_init(vdev_t *vd, uint64_t expanding,
+    uint64_t offset, uint64_t *txgs, uint_t ntxgs)
+{
+	vdev_raidz_expand_t *vre = &vd->vdev_raidz_expand;
+
+	vd->vdev_raidz_expanding = (expanding != 0);
+	vre->vre_offset = expanding ? offset : UINT64_MAX;
+	vre->vre_offset_phys = vre->vre_offset;
+	vre->vre_offset_prev = vre->vre_offset;
+	vre->vre_offset_phys_txg = 0;
+
+	if (ntxgs > 0) {
+		vre->vre_txgs = kmem_alloc(ntxgs * sizeof (uint64_t),
+		    KM_SLEEP);
+		bcopy(txgs, vre->vre_txgs, ntxgs * sizeof (uint64_t));
+		vre->vre_ntxgs = ntxgs;
+		vre->vre_txgs_max = ntxgs;
+	}
 }
 
-vdev_ops_t vdev_raidz_ops = {
-	.vdev_op_open = vdev_raidz_open,
-	.vdev_op_close = vdev_raidz_close,
-	.vdev_op_asize = vdev_raidz_asize,
-	.vdev_op_io_start = vdev_raidz_io_start,
-	.vdev_op_io_done = vdev_raidz_io_done,
-	.vdev_op_state_change = vdev_raidz_state_change,
-	.vdev_op_need_resilver = vdev_raidz_need_resilver,
-	.vdev_op_hold = NULL,
-	.vdev_op_rele = NULL,
-	.vdev_op_remap = NULL,
-	.vdev_op_xlate = vdev_raidz_xlate,
-	.vdev_op_type = VDEV_TYPE_RAIDZ,	/* name of this vdev type */
-	.vdev_op_leaf = B_FALSE			/* not a leaf vdev */
-};
+/*
+ * Add the geometry of a raidz vdev to its config.  Only the durable reflow
+ * offset is recorded, sectors above it may still be read from their old
+ * location.
+ */
+void
+vdev_raidz_expand_config_generate(vdev_t *vd, nvlist_t *nv)
+{
+	vdev_raidz_expand_t *vre = &vd->vdev_raidz_expand;
+
+	mutex_enter(&vd->vdev_raidz_expand_lock);
+	if (vd->vdev_raidz_expanding) {
+		fnvlist_add_uint64(nv, ZPOOL_CONFIG_RAIDZ_EXPANDING, 1);
+		fnvlist_add_uint64(nv, ZPOOL_CONFIG_RAIDZ_EXPAND_OFFSET,
+		    vre->vre_offset_phys);
+	}
+	if (vre->vre_ntxgs > 0) {
+		fnvlist_add_uint64_array(nv, ZPOOL_CONFIG_RAIDZ_EXPAND_TXGS,
+		    vre->vre_txgs, vre->vre_ntxgs);
+	}
+	mutex_exit(&vd->vdev_raidz_expand_lock);
+}
+
+void
+vdev_raidz_expand_fini(vdev_t *vd)
+{
+	vdev_raidz_expand_t *vre = &vd->vdev_raidz_expand;
+
+	ASSERT3P(vd->vdev_raidz_expand_thread, ==, NULL);
+
+	if (vre->vre_txgs != NULL) {
+		kmem_free(vre->vre_txgs,
+		    vre->vre_txgs_max * sizeof (uint64_t));
+		vre->vre_txgs = NULL;
+		vre->vre_ntxgs = 0;
+		vre->vre_txgs_max = 0;
+	}
+}
+
+EXPORT_SYMBOL(vdev_raidz_expand_start);
+EXPORT_SYMBOL(vdev_raidz_expand_restart);
+EXPORT_SYMBOL(vdev_raidz_expand_stop_wait);
+EXPORT_SYMBOL(vdev_raidz_expand_stop_all);
+EXPORT_SYMBOL(vdev_raidz_expand_active);
+
+/* BEGIN CSTYLED */
+ZFS_MODULE_PARAM(zfs_vdev, raidz_, expand_max_copy_bytes, ULONG, ZMOD_RW,
+	"Max amount of data reflowed per batch by raidz expansion");
+/* END CSTYLED */
@@ -0,0 +1,882 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+#include <sys/vdev_impl.h>
+#include <sys/vdev_rebuild.h>
+#include <sys/spa_impl.h>
+#include <sys/metaslab_impl.h>
+#include <sys/dsl_pool.h>
+#include <sys/dsl_synctask.h>
+#include <sys/dmu_tx.h>
+#include <sys/zap.h>
+#include <sys/zio.h>
+#include <sys/zfeature.h>
+
+/*
+ * This file contains the sequential reconstruction implementation for
+ * resilvering.  This form of resilvering is internally referred to as device
+ * rebuild to avoid conflating it with the traditional healing reconstruction
+ * performed by the dsl scan code.
+ *
+ * When replacing or attaching a device to a mirror the data which must be
+ * copied to the new device is everything which is allocated on the top-level
+ * vdev.  Rather than traversing the block pointer tree, as a healing
+ * resilver does, the allocated ranges are read directly from the metaslab
+ * space maps and copied in LBA order.  This results in large sequential
+ * I/Os to both the source and destination devices, which is substantially
+ * faster than the mostly random I/O generated by a block pointer traversal
+ * on a fragmented pool.
+ *
+ * The cost is that a rebuild has no block pointers and therefore cannot
+ * verify checksums while copying.  Instead, once every rebuild in the pool
+ * has completed, a normal scrub is automatically started to verify the
+ * checksums of all blocks (see zfs_rebuild_scrub_enabled).  The redundancy
+ * of the pool is restored as soon as the rebuild completes, which is well
+ * before the scrub finishes.
+ *
+ * Each top-level vdev may have one active rebuild, its progress is stored
+ * in the top-level vdev ZAP as VDEV_TOP_ZAP_VDEV_REBUILD_PHYS so it can
+ * be resumed after the pool is exported or the system reboots.  When an
+ * additional device is attached while a rebuild is in progress the
+ * rebuild is restarted from the beginning of the vdev.
+ *
+ * Only mirror top-level vdevs (and the replacing and spare vdevs which may
+ * exist beneath them) can be rebuilt, since only for those can the data
+ * for a missing child be reconstructed from the space maps alone.
+ */
+
+/*
+ * Maximum size of each rebuild I/O.  Allocated segments larger than this
+ * are split, smaller adjacent segments are never merged.
+ */
+unsigned long zfs_rebuild_max_segment = 1024 * 1024;
+
+/*
+ * Maximum number of bytes of rebuild I/O in flight per child of the
+ * top-level vdev being rebuilt.
+ */
+unsigned long zfs_rebuild_vdev_limit = 32 << 20;
+
+/*
+ * Automatically start a scrub once all rebuilds in the pool have completed
+ * to verify the checksums of the reconstructed data.
+ */
+int zfs_rebuild_scrub_enabled = 1;
+
+static void vdev_rebuild_thread(void *arg);
+
+static boolean_t
+vdev_rebuild_should_stop(vdev_t *vd)
+{
+	return (vd->vdev_rebuild_exit_wanted || !vdev_writeable(vd) ||
+	    vd->vdev_removing || vd->vdev_rebuild_reset_wanted);
+}
+
+/*
+ * Write the in-core rebuild state to the top-level vdev ZAP.  Caller must
+ * hold vdev_rebuild_lock.
+ */
+static void
+vdev_rebuild_zap_update(vdev_t *vd, dmu_tx_t *tx)
+{
+	ASSERT(MUTEX_HELD(&vd->vdev_rebuild_lock));
+	ASSERT(vd->vdev_top_zap != 0);
+
+	VERIFY0(zap_update(vd->vdev_spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_VDEV_REBUILD_PHYS, sizeof (uint64_t),
+	    REBUILD_PHYS_ENTRIES, &vd->vdev_rebuild_config.vr_rebuild_phys,
+	    tx));
+}
+
+/*
+ * The top-level vdev is passed by its id rather than by pointer since a
+ * detach may collapse the mirror and replace the vdev_t before the sync
+ * task runs.  In that case the rebuild state has been transferred to the
+ * new top-level vdev by vdev_top_transfer().
+ */
+static vdev_t *
+vdev_rebuild_lookup_top(dmu_tx_t *tx, void *arg)
+{
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+	uint64_t vdev_id = (uintptr_t)arg;
+
+	if (vdev_id >= spa->spa_root_vdev->vdev_children)
+		return (NULL);
+
+	vdev_t *vd = spa->spa_root_vdev->vdev_child[vdev_id];
+	if (vd->vdev_top_zap == 0 || !vdev_is_concrete(vd))
+		return (NULL);
+
+	return (vd);
+}
+
+/*
+ * Persist the rebuild progress for this txg.  Since spa_sync() waits on
+ * spa_txg_zio before running sync tasks, all the rebuild I/O issued in
+ * this txg has completed by the time the new offset is recorded.
+ */
+static void
+vdev_rebuild_update_sync(void *arg, dmu_tx_t *tx)
+{
+	vdev_t *vd = vdev_rebuild_lookup_top(tx, arg);
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	if (vd == NULL)
+		return;
+
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	if (vr->vr_scan_offset[txg & TXG_MASK] > 0) {
+		vrp->vrp_last_offset = vr->vr_scan_offset[txg & TXG_MASK];
+		vr->vr_scan_offset[txg & TXG_MASK] = 0;
+	}
+	if (vd->vdev_rebuild_thread != NULL) {
+		vrp->vrp_scan_time_ms = vr->vr_prev_scan_time_ms +
+		    NSEC2MSEC(gethrtime() - vr->vr_pass_start_time);
+	}
+	vdev_rebuild_zap_update(vd, tx);
+	mutex_exit(&vd->vdev_rebuild_lock);
+}
+
+/*
+ * Reset the rebuild progress so it restarts from the beginning of the
+ * top-level vdev.  All of the devices which need to be rebuilt, including
+ * any just attached, will be covered by the new pass.
+ */
+static void
+vdev_rebuild_reset_phys(vdev_t *vd, uint64_t txg)
+{
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+	uint64_t min_txg, max_txg;
+
+	ASSERT(MUTEX_HELD(&vd->vdev_rebuild_lock));
+
+	bzero(vrp, sizeof (uint64_t) * REBUILD_PHYS_ENTRIES);
+	vrp->vrp_rebuild_state = VDEV_REBUILD_ACTIVE;
+	vrp->vrp_start_time = gethrestime_sec();
+	vrp->vrp_max_txg = txg;
+	if (vdev_resilver_needed(vd, &min_txg, &max_txg)) {
+		vrp->vrp_min_txg = min_txg;
+		vrp->vrp_max_txg = MAX(txg, max_txg);
+	}
+
+	for (int i = 0; i < TXG_SIZE; i++)
+		vr->vr_scan_offset[i] = 0;
+	vr->vr_prev_scan_time_ms = 0;
+}
+
+static void
+vdev_rebuild_initiate_sync(void *arg, dmu_tx_t *tx)
+{
+	vdev_t *vd = vdev_rebuild_lookup_top(tx, arg);
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+
+	VERIFY3P(vd, !=, NULL);
+	vdev_rebuild_phys_t *vrp = &vd->vdev_rebuild_config.vr_rebuild_phys;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	ASSERT3P(vd->vdev_rebuild_thread, ==, NULL);
+	ASSERT(vd->vdev_rebuilding);
+
+	/* A suspended rebuild already holds a feature reference. */
+	if (vrp->vrp_rebuild_state != VDEV_REBUILD_ACTIVE)
+		spa_feature_incr(spa, SPA_FEATURE_DEVICE_REBUILD, tx);
+
+	vd->vdev_rebuild_reset_wanted = B_FALSE;
+	vdev_rebuild_reset_phys(vd, dmu_tx_get_txg(tx));
+	vdev_rebuild_zap_update(vd, tx);
+
+	spa_history_log_internal(spa, "rebuild", tx,
+	    "vdev_id=%llu vdev_guid=%llu started",
+	    (u_longlong_t)vd->vdev_id, (u_longlong_t)vd->vdev_guid);
+
+	vd->vdev_rebuild_thread = thread_create(NULL, 0,
+	    vdev_rebuild_thread, vd, 0, &p0, TS_RUN, maxclsyspri);
+	mutex_exit(&vd->vdev_rebuild_lock);
+}
+
+static void
+vdev_rebuild_reset_sync(void *arg, dmu_tx_t *tx)
+{
+	vdev_t *vd = vdev_rebuild_lookup_top(tx, arg);
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+
+	if (vd == NULL)
+		return;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	ASSERT3P(vd->vdev_rebuild_thread, ==, NULL);
+	ASSERT3U(vd->vdev_rebuild_config.vr_rebuild_phys.vrp_rebuild_state,
+	    ==, VDEV_REBUILD_ACTIVE);
+
+	vd->vdev_rebuild_reset_wanted = B_FALSE;
+	vdev_rebuild_reset_phys(vd, dmu_tx_get_txg(tx));
+	vdev_rebuild_zap_update(vd, tx);
+
+	spa_history_log_internal(spa, "rebuild", tx,
+	    "vdev_id=%llu vdev_guid=%llu reset",
+	    (u_longlong_t)vd->vdev_id, (u_longlong_t)vd->vdev_guid);
+
+	/*
+	 * Only restart the thread when the rebuild was not suspended while
+	 * waiting for this sync task, it will otherwise be resumed by
+	 * vdev_rebuild_restart().
+	 */
+	if (vd->vdev_rebuilding && vdev_writeable(vd)) {
+		vd->vdev_rebuild_thread = thread_create(NULL, 0,
+		    vdev_rebuild_thread, vd, 0, &p0, TS_RUN, maxclsyspri);
+	} else {
+		vd->vdev_rebuilding = B_FALSE;
+	}
+	mutex_exit(&vd->vdev_rebuild_lock);
+}
+
+static void
+vdev_rebuild_complete_sync(void *arg, dmu_tx_t *tx)
+{
+	vdev_t *vd = vdev_rebuild_lookup_top(tx, arg);
+	spa_t *spa = dmu_tx_pool(tx)->dp_spa;
+
+	if (vd == NULL)
+		return;
+
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+
+	/*
+	 * A device was attached after the rebuild thread exited but before
+	 * this sync task ran, restart the rebuild to include it.
+	 */
+	if (vd->vdev_rebuild_reset_wanted) {
+		mutex_exit(&vd->vdev_rebuild_lock);
+		vdev_rebuild_reset_sync(arg, tx);
+		return;
+	}
+
+	vrp->vrp_rebuild_state = VDEV_REBUILD_COMPLETE;
+	vrp->vrp_end_time = gethrestime_sec();
+	vdev_rebuild_zap_update(vd, tx);
+
+	/*
+	 * Excise the rebuilt ranges from the DTLs of the devices which were
+	 * attached for this rebuild.  This restores the redundancy of the
+	 * vdev; the checksums are verified separately by the scrub which is
+	 * started by the SPA_ASYNC_REBUILD_DONE handler.
+	 */
+	vdev_dtl_reassess(vd, dmu_tx_get_txg(tx), vrp->vrp_max_txg,
+	    B_FALSE, B_TRUE);
+
+	spa_feature_decr(spa, SPA_FEATURE_DEVICE_REBUILD, tx);
+
+	spa_history_log_internal(spa, "rebuild", tx,
+	    "vdev_id=%llu vdev_guid=%llu complete, errors=%llu",
+	    (u_longlong_t)vd->vdev_id, (u_longlong_t)vd->vdev_guid,
+	    (u_longlong_t)vrp->vrp_errors);
+
+	vd->vdev_rebuilding = B_FALSE;
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	spa_notify_waiters(spa);
+	spa_async_request(spa, SPA_ASYNC_REBUILD_DONE);
+}
+
+static void
+vdev_rebuild_cb(zio_t *zio)
+{
+	vdev_rebuild_t *vr = zio->io_private;
+	vdev_t *vd = vr->vr_top_vdev;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	if (zio->io_error != 0) {
+		/*
+		 * Errors are counted but otherwise ignored, a rebuild which
+		 * encountered errors does not excise any DTLs and the
+		 * remaining damage is left for the following scrub.
+		 */
+		vr->vr_rebuild_phys.vrp_errors++;
+	} else {
+		vr->vr_rebuild_phys.vrp_bytes_rebuilt += zio->io_size;
+	}
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	abd_free(zio->io_abd);
+
+	mutex_enter(&vr->vr_io_lock);
+	ASSERT3U(vr->vr_bytes_inflight, >=, zio->io_size);
+	vr->vr_bytes_inflight -= zio->io_size;
+	cv_broadcast(&vr->vr_io_cv);
+	mutex_exit(&vr->vr_io_lock);
+
+	spa_config_exit(vd->vdev_spa, SCL_STATE_ALL, vd);
+}
+
+/*
+ * Issue a rebuild I/O for a single allocated range.  A read of the range
+ * is issued to the top-level vdev with ZIO_FLAG_RESILVER.  The mirror
+ * will read from a healthy child and then write the data back to each
+ * child whose DTL indicates it is missing the range.  Since the block
+ * pointer is synthesized the birth txg is set to TXG_INITIAL, which is
+ * covered by the DTL of any newly attached device.
+ */
+static int
+vdev_rebuild_range(vdev_rebuild_t *vr, uint64_t start, uint64_t size)
+{
+	vdev_t *vd = vr->vr_top_vdev;
+	spa_t *spa = vd->vdev_spa;
+	blkptr_t blk, *bp = &blk;
+
+	ASSERT3U(size, <=, SPA_MAXBLOCKSIZE);
+
+	/* Limit the rebuild I/O in flight. */
+	mutex_enter(&vr->vr_io_lock);
+	while (vr->vr_bytes_inflight >= vr->vr_bytes_inflight_max)
+		cv_wait(&vr->vr_io_cv, &vr->vr_io_lock);
+	vr->vr_bytes_inflight += size;
+	mutex_exit(&vr->vr_io_lock);
+
+	dmu_tx_t *tx = dmu_tx_create_dd(spa_get_dsl(spa)->dp_mos_dir);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+	uint64_t txg = dmu_tx_get_txg(tx);
+
+	spa_config_enter(spa, SCL_STATE_ALL, vd, RW_READER);
+	mutex_enter(&vd->vdev_rebuild_lock);
+
+	/*
+	 * We know the vdev struct will still be around since all consumers
+	 * of vdev_free must stop the rebuild first.
+	 */
+	if (vdev_rebuild_should_stop(vd)) {
+		mutex_enter(&vr->vr_io_lock);
+		vr->vr_bytes_inflight -= size;
+		mutex_exit(&vr->vr_io_lock);
+		spa_config_exit(spa, SCL_STATE_ALL, vd);
+		mutex_exit(&vd->vdev_rebuild_lock);
+		dmu_tx_commit(tx);
+		return (SET_ERROR(EINTR));
+	}
+
+	/* This is the first I/O for this txg. */
+	if (vr->vr_scan_offset[txg & TXG_MASK] == 0) {
+		dsl_sync_task_nowait(spa_get_dsl(spa),
+		    vdev_rebuild_update_sync, (void *)(uintptr_t)vd->vdev_id,
+		    2, ZFS_SPACE_CHECK_RESERVED, tx);
+	}
+	vr->vr_scan_offset[txg & TXG_MASK] = start + size;
+	vr->vr_rebuild_phys.vrp_bytes_issued += size;
+	vr->vr_pass_bytes_issued += size;
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	BP_ZERO(bp);
+	DVA_SET_VDEV(&bp->blk_dva[0], vd->vdev_id);
+	DVA_SET_OFFSET(&bp->blk_dva[0], start);
+	DVA_SET_GANG(&bp->blk_dva[0], 0);
+	DVA_SET_ASIZE(&bp->blk_dva[0], size);
+
+	BP_SET_BIRTH(bp, TXG_INITIAL, TXG_INITIAL);
+	BP_SET_LSIZE(bp, size);
+	BP_SET_PSIZE(bp, size);
+	BP_SET_COMPRESS(bp, ZIO_COMPRESS_OFF);
+	BP_SET_CHECKSUM(bp, ZIO_CHECKSUM_OFF);
+	BP_SET_TYPE(bp, DMU_OT_NONE);
+	BP_SET_LEVEL(bp, 0);
+	BP_SET_DEDUP(bp, 0);
+	BP_SET_BYTEORDER(bp, ZFS_HOST_BYTEORDER);
+
+	/* vdev_rebuild_cb releases SCL_STATE_ALL */
+	zio_nowait(zio_read(spa->spa_txg_zio[txg & TXG_MASK], spa, bp,
+	    abd_alloc(size, B_FALSE), size, vdev_rebuild_cb, vr,
+	    ZIO_PRIORITY_SCRUB, ZIO_FLAG_RAW | ZIO_FLAG_CANFAIL |
+	    ZIO_FLAG_RESILVER, NULL));
+
+	dmu_tx_commit(tx);
+
+	return (0);
+}
+
+/*
+ * Issue rebuild I/Os for all of the ranges in the current metaslab, in
+ * LBA order, splitting them to no more than zfs_rebuild_max_segment.
+ */
+static int
+vdev_rebuild_ranges(vdev_rebuild_t *vr)
+{
+	vdev_t *vd = vr->vr_top_vdev;
+	zfs_btree_t *t = &vr->vr_scan_tree->rt_root;
+	zfs_btree_index_t idx;
+	uint64_t max_segment;
+	int error;
+
+	max_segment = P2ROUNDUP(MAX(zfs_rebuild_max_segment, 1),
+	    1ULL << vd->vdev_ashift);
+	max_segment = MIN(max_segment, SPA_MAXBLOCKSIZE);
+
+	for (range_seg_t *rs = zfs_btree_first(t, &idx); rs != NULL;
+	    rs = zfs_btree_next(t, &idx, &idx)) {
+		uint64_t start = rs_get_start(rs, vr->vr_scan_tree);
+		uint64_t size = rs_get_end(rs, vr->vr_scan_tree) - start;
+
+		while (size > 0) {
+			uint64_t chunk_size = MIN(size, max_segment);
+
+			error = vdev_rebuild_range(vr, start, chunk_size);
+			if (error != 0)
+				return (error);
+
+			size -= chunk_size;
+			start += chunk_size;
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Load the allocated ranges of the metaslab in to the scan tree.  The
+ * space map, plus any allocations and frees which have not yet been
+ * flushed from the log space map, describes every range which may hold
+ * data needing to be copied.
+ */
+static void
+vdev_rebuild_load_ranges(vdev_rebuild_t *vr, metaslab_t *msp)
+{
+	vdev_t *vd = vr->vr_top_vdev;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+	mutex_enter(&msp->ms_sync_lock);
+	mutex_enter(&msp->ms_lock);
+
+	/*
+	 * Wait for any outstanding allocations to be synced so all of the
+	 * allocated ranges are described by the space map.
+	 */
+	for (int j = 0; j < TXG_SIZE; j++) {
+		if (range_tree_space(msp->ms_allocating[j]) != 0) {
+			mutex_exit(&msp->ms_lock);
+			mutex_exit(&msp->ms_sync_lock);
+			txg_wait_synced(spa_get_dsl(vd->vdev_spa), 0);
+			mutex_enter(&msp->ms_sync_lock);
+			mutex_enter(&msp->ms_lock);
+			break;
+		}
+	}
+
+	if (msp->ms_sm != NULL) {
+		VERIFY0(space_map_load(msp->ms_sm, vr->vr_scan_tree, SM_ALLOC));
+		range_tree_walk(msp->ms_unflushed_allocs, range_tree_add,
+		    vr->vr_scan_tree);
+		range_tree_walk(msp->ms_unflushed_frees, range_tree_remove,
+		    vr->vr_scan_tree);
+
+		/*
+		 * Remove the ranges which have already been rebuilt, this
+		 * happens when a rebuild is resumed after the pool was
+		 * exported or the rebuild was otherwise suspended.
+		 */
+		range_tree_clear(vr->vr_scan_tree, 0, vrp->vrp_last_offset);
+	}
+
+	mutex_exit(&msp->ms_lock);
+	mutex_exit(&msp->ms_sync_lock);
+}
+
+static void
+vdev_rebuild_thread(void *arg)
+{
+	vdev_t *vd = arg;
+	spa_t *spa = vd->vdev_spa;
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+	int error = 0;
+
+	ASSERT(vdev_is_concrete(vd));
+
+	/*
+	 * The DTL of a newly attached device extends a few txgs past the
+	 * attach to account for dmu_sync-ed blocks.  Wait for those txgs to
+	 * sync so every block which may be missing is in the space maps.
+	 */
+	txg_wait_synced(spa_get_dsl(spa), vrp->vrp_max_txg);
+
+	spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	vr->vr_top_vdev = vd;
+	vr->vr_scan_msp = NULL;
+	vr->vr_scan_tree = range_tree_create(NULL, RANGE_SEG64, NULL, 0, 0);
+	vr->vr_prev_scan_time_ms = vrp->vrp_scan_time_ms;
+	vr->vr_pass_start_time = gethrtime();
+	vr->vr_pass_bytes_scanned = 0;
+	vr->vr_pass_bytes_issued = 0;
+	vr->vr_bytes_inflight_max = MAX(1ULL << 20,
+	    zfs_rebuild_vdev_limit * vd->vdev_children);
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	/*
+	 * A collapsed mirror (the result of detaching all but one child) has
+	 * nothing left to copy the data to and is trivially complete.
+	 */
+	for (uint64_t i = 0; vd->vdev_children > 0 &&
+	    i < vd->vdev_ms_count; i++) {
+		metaslab_t *msp = vd->vdev_ms[i];
+
+		if (vdev_rebuild_should_stop(vd)) {
+			error = SET_ERROR(EINTR);
+			break;
+		}
+
+		/* Skip metaslabs which were rebuilt in a previous pass. */
+		if (msp->ms_start + msp->ms_size <= vrp->vrp_last_offset)
+			continue;
+
+		mutex_enter(&vd->vdev_rebuild_lock);
+		vr->vr_scan_msp = msp;
+		vrp->vrp_bytes_est = vd->vdev_stat.vs_alloc;
+		mutex_exit(&vd->vdev_rebuild_lock);
+
+		spa_config_exit(spa, SCL_CONFIG, FTAG);
+		metaslab_disable(msp);
+
+		vdev_rebuild_load_ranges(vr, msp);
+
+		uint64_t scanned = range_tree_space(vr->vr_scan_tree);
+		mutex_enter(&vd->vdev_rebuild_lock);
+		vrp->vrp_bytes_scanned += scanned;
+		vr->vr_pass_bytes_scanned += scanned;
+		mutex_exit(&vd->vdev_rebuild_lock);
+
+		error = vdev_rebuild_ranges(vr);
+		range_tree_vacate(vr->vr_scan_tree, NULL, NULL);
+
+		metaslab_enable(msp, B_FALSE, B_FALSE);
+		spa_config_enter(spa, SCL_CONFIG, FTAG, RW_READER);
+
+		if (error != 0)
+			break;
+	}
+
+	spa_config_exit(spa, SCL_CONFIG, FTAG);
+
+	/* Wait for any remaining rebuild I/O to complete. */
+	mutex_enter(&vr->vr_io_lock);
+	while (vr->vr_bytes_inflight > 0)
+		cv_wait(&vr->vr_io_cv, &vr->vr_io_lock);
+	mutex_exit(&vr->vr_io_lock);
+
+	range_tree_destroy(vr->vr_scan_tree);
+	vr->vr_scan_tree = NULL;
+
+	dsl_pool_t *dp = spa_get_dsl(spa);
+	dmu_tx_t *tx = dmu_tx_create_dd(dp->dp_mos_dir);
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	vr->vr_scan_msp = NULL;
+	if (error == 0 && !vdev_rebuild_should_stop(vd)) {
+		dsl_sync_task_nowait(dp, vdev_rebuild_complete_sync,
+		    (void *)(uintptr_t)vd->vdev_id, 0, ZFS_SPACE_CHECK_NONE,
+		    tx);
+	} else if (vd->vdev_rebuild_reset_wanted) {
+		/*
+		 * When the rebuild is also being stopped leave it suspended
+		 * after the reset, vdev_rebuild_restart() will resume it.
+		 */
+		if (vd->vdev_rebuild_exit_wanted)
+			vd->vdev_rebuilding = B_FALSE;
+		dsl_sync_task_nowait(dp, vdev_rebuild_reset_sync,
+		    (void *)(uintptr_t)vd->vdev_id, 0, ZFS_SPACE_CHECK_NONE,
+		    tx);
+	} else {
+		/*
+		 * The rebuild was stopped, leave it in the active state so
+		 * it is resumed by vdev_rebuild_restart().
+		 */
+		vd->vdev_rebuilding = B_FALSE;
+	}
+
+	vd->vdev_rebuild_thread = NULL;
+	cv_broadcast(&vd->vdev_rebuild_cv);
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	dmu_tx_commit(tx);
+}
+
+/*
+ * Start a rebuild of the top-level vdev.  Caller must hold the spa config
+ * lock as writer, normally via spa_vdev_enter().  If the vdev is already
+ * being rebuilt the rebuild is restarted so the newly attached devices are
+ * included.
+ */
+void
+vdev_rebuild(vdev_t *tvd)
+{
+	spa_t *spa = tvd->vdev_spa;
+
+	ASSERT(tvd == tvd->vdev_top);
+	ASSERT(vdev_is_concrete(tvd));
+	ASSERT(!tvd->vdev_removing);
+	ASSERT(spa_config_held(spa, SCL_ALL, RW_WRITER) == SCL_ALL);
+	ASSERT(spa_feature_is_enabled(spa, SPA_FEATURE_DEVICE_REBUILD));
+
+	mutex_enter(&tvd->vdev_rebuild_lock);
+	if (tvd->vdev_rebuilding) {
+		ASSERT3U(tvd->vdev_rebuild_config.vr_rebuild_phys.
+		    vrp_rebuild_state, ==, VDEV_REBUILD_ACTIVE);
+
+		/*
+		 * The rebuild thread will notice reset_wanted at its next
+		 * I/O and dispatch vdev_rebuild_reset_sync().
+		 */
+		tvd->vdev_rebuild_reset_wanted = B_TRUE;
+	} else {
+		dmu_tx_t *tx = dmu_tx_create_dd(spa_get_dsl(spa)->dp_mos_dir);
+		VERIFY0(dmu_tx_assign(tx, TXG_WAIT));
+
+		tvd->vdev_rebuilding = B_TRUE;
+		tvd->vdev_rebuild_reset_wanted = B_FALSE;
+		dsl_sync_task_nowait(spa_get_dsl(spa),
+		    vdev_rebuild_initiate_sync,
+		    (void *)(uintptr_t)tvd->vdev_id, 0,
+		    ZFS_SPACE_CHECK_NONE, tx);
+		dmu_tx_commit(tx);
+	}
+	mutex_exit(&tvd->vdev_rebuild_lock);
+}
+
+static void
+vdev_rebuild_restart_impl(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+
+	if (vd == spa->spa_root_vdev) {
+		for (uint64_t i = 0; i < vd->vdev_children; i++)
+			vdev_rebuild_restart_impl(vd->vdev_child[i]);
+		return;
+	}
+
+	if (vd->vdev_top_zap == 0 || !vdev_is_concrete(vd))
+		return;
+
+	vdev_rebuild_phys_t *vrp = &vd->vdev_rebuild_config.vr_rebuild_phys;
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	if (vrp->vrp_rebuild_state == VDEV_REBUILD_ACTIVE &&
+	    vdev_writeable(vd) && !vd->vdev_removing &&
+	    !vd->vdev_rebuilding && vd->vdev_rebuild_thread == NULL) {
+		ASSERT(!vd->vdev_rebuild_exit_wanted);
+		vd->vdev_rebuilding = B_TRUE;
+		vd->vdev_rebuild_thread = thread_create(NULL, 0,
+		    vdev_rebuild_thread, vd, 0, &p0, TS_RUN, maxclsyspri);
+	}
+	mutex_exit(&vd->vdev_rebuild_lock);
+}
+
+/*
+ * Resume any rebuilds which are active but do not currently have a
+ * running thread.  Called after the pool is imported and after every
+ * configuration change made under spa_vdev_enter().
+ */
+void
+vdev_rebuild_restart(spa_t *spa)
+{
+	ASSERT(MUTEX_HELD(&spa_namespace_lock));
+
+	if (!spa_writeable(spa))
+		return;
+
+	vdev_rebuild_restart_impl(spa->spa_root_vdev);
+}
+
+/*
+ * Stop the rebuild thread for a top-level vdev and wait for it to exit.
+ * The rebuild is left active so it may later be resumed.  When a sync task
+ * which will start the thread is pending, wait for it to run and then stop
+ * the new thread.  The caller must not hold the spa config lock as writer,
+ * since the rebuild thread may be waiting to acquire it as a reader.
+ */
+void
+vdev_rebuild_stop_wait(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+
+	ASSERT(!spa_config_held(spa, SCL_CONFIG | SCL_STATE, RW_WRITER));
+	ASSERT(vd == vd->vdev_top);
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	for (;;) {
+		if (vd->vdev_rebuild_thread != NULL) {
+			vd->vdev_rebuild_exit_wanted = B_TRUE;
+
+			while (vd->vdev_rebuild_thread != NULL) {
+				cv_wait(&vd->vdev_rebuild_cv,
+				    &vd->vdev_rebuild_lock);
+			}
+
+			ASSERT3P(vd->vdev_rebuild_thread, ==, NULL);
+			vd->vdev_rebuild_exit_wanted = B_FALSE;
+		}
+
+		if (!vd->vdev_rebuilding || !spa->spa_sync_on)
+			break;
+
+		mutex_exit(&vd->vdev_rebuild_lock);
+		txg_wait_synced(spa_get_dsl(spa), 0);
+		mutex_enter(&vd->vdev_rebuild_lock);
+	}
+	mutex_exit(&vd->vdev_rebuild_lock);
+}
+
+/*
+ * Stop all of the rebuild threads associated with the pool.
+ */
+void
+vdev_rebuild_stop_all(spa_t *spa)
+{
+	vdev_t *root_vd = spa->spa_root_vdev;
+
+	for (uint64_t i = 0; i < root_vd->vdev_children; i++)
+		vdev_rebuild_stop_wait(root_vd->vdev_child[i]);
+}
+
+/*
+ * Returns B_TRUE if a rebuild is active for the top-level vdev, or when
+ * passed the root vdev, for any top-level vdev in the pool.  A suspended
+ * rebuild is considered to be active.
+ */
+boolean_t
+vdev_rebuild_active(vdev_t *vd)
+{
+	spa_t *spa = vd->vdev_spa;
+	boolean_t ret = B_FALSE;
+
+	if (vd == spa->spa_root_vdev) {
+		for (uint64_t i = 0; i < vd->vdev_children && !ret; i++)
+			ret = vdev_rebuild_active(vd->vdev_child[i]);
+	} else if (vd->vdev_top_zap != 0) {
+		vdev_rebuild_phys_t *vrp =
+		    &vd->vdev_rebuild_config.vr_rebuild_phys;
+
+		mutex_enter(&vd->vdev_rebuild_lock);
+		ret = (vrp->vrp_rebuild_state == VDEV_REBUILD_ACTIVE);
+		mutex_exit(&vd->vdev_rebuild_lock);
+	}
+
+	return (ret);
+}
+
+/*
+ * Load the rebuild state from the top-level vdev ZAP.  A missing entry
+ * means the vdev has never been rebuilt.
+ */
+int
+vdev_rebuild_load(vdev_t *vd)
+{
+	vdev_rebuild_t *vr = &vd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+	spa_t *spa = vd->vdev_spa;
+	int err = 0;
+
+	ASSERT(vd == vd->vdev_top);
+
+	mutex_enter(&vd->vdev_rebuild_lock);
+	vd->vdev_rebuilding = B_FALSE;
+	vr->vr_top_vdev = vd;
+
+	if (!spa_feature_is_enabled(spa, SPA_FEATURE_DEVICE_REBUILD)) {
+		bzero(vrp, sizeof (uint64_t) * REBUILD_PHYS_ENTRIES);
+		mutex_exit(&vd->vdev_rebuild_lock);
+		return (SET_ERROR(ENOTSUP));
+	}
+
+	err = zap_lookup(spa->spa_meta_objset, vd->vdev_top_zap,
+	    VDEV_TOP_ZAP_VDEV_REBUILD_PHYS, sizeof (uint64_t),
+	    REBUILD_PHYS_ENTRIES, vrp);
+
+	if (err == ENOENT) {
+		bzero(vrp, sizeof (uint64_t) * REBUILD_PHYS_ENTRIES);
+		err = 0;
+	}
+	mutex_exit(&vd->vdev_rebuild_lock);
+
+	return (err);
+}
+
+/*
+ * Report the rebuild statistics for a top-level vdev.  Returns ENOENT when
+ * the vdev has never been rebuilt.
+ */
+int
+vdev_rebuild_get_stats(vdev_t *tvd, vdev_rebuild_stat_t *vrs)
+{
+	vdev_rebuild_t *vr = &tvd->vdev_rebuild_config;
+	vdev_rebuild_phys_t *vrp = &vr->vr_rebuild_phys;
+
+	ASSERT(tvd == tvd->vdev_top);
+
+	bzero(vrs, sizeof (vdev_rebuild_stat_t));
+
+	mutex_enter(&tvd->vdev_rebuild_lock);
+	if (vrp->vrp_rebuild_state == VDEV_REBUILD_NONE) {
+		mutex_exit(&tvd->vdev_rebuild_lock);
+		return (SET_ERROR(ENOENT));
+	}
+
+	vrs->vrs_state = vrp->vrp_rebuild_state;
+	vrs->vrs_start_time = vrp->vrp_start_time;
+	vrs->vrs_end_time = vrp->vrp_end_time;
+	vrs->vrs_scan_time_ms = vrp->vrp_scan_time_ms;
+	vrs->vrs_bytes_scanned = vrp->vrp_bytes_scanned;
+	vrs->vrs_bytes_issued = vrp->vrp_bytes_issued;
+	vrs->vrs_bytes_rebuilt = vrp->vrp_bytes_rebuilt;
+	vrs->vrs_bytes_est = vrp->vrp_bytes_est;
+	vrs->vrs_errors = vrp->vrp_errors;
+
+	if (tvd->vdev_rebuild_thread != NULL) {
+		vrs->vrs_pass_time_ms = NSEC2MSEC(gethrtime() -
+		    vr->vr_pass_start_time);
+		vrs->vrs_pass_bytes_scanned = vr->vr_pass_bytes_scanned;
+		vrs->vrs_pass_bytes_issued = vr->vr_pass_bytes_issued;
+	}
+	mutex_exit(&tvd->vdev_rebuild_lock);
+
+	return (0);
+}
+
+EXPORT_SYMBOL(vdev_rebuild);
+EXPORT_SYMBOL(vdev_rebuild_restart);
+EXPORT_SYMBOL(vdev_rebuild_stop_wait);
+EXPORT_SYMBOL(vdev_rebuild_stop_all);
+EXPORT_SYMBOL(vdev_rebuild_active);
+
+/* BEGIN CSTYLED */
+ZFS_MODULE_PARAM(zfs, zfs_, rebuild_max_segment, ULONG, ZMOD_RW,
+	"Max segment size in bytes of rebuild reads");
+
+ZFS_MODULE_PARAM(zfs, zfs_, rebuild_vdev_limit, ULONG, ZMOD_RW,
+	"Max bytes in flight per leaf vdev for sequential resilvers");
+
+ZFS_MODULE_PARAM(zfs, zfs_, rebuild_scrub_enabled, INT, ZMOD_RW,
+	"Automatically scrub after sequential resilver completes");
+/* END CSTYLED */
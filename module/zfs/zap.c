@@ -83,7 +83,7 @@ int fzap_default_block_shift = 14; /* 16k blocksize */
 
 extern inline zap_phys_t *zap_f_phys(zap_t *zap);
 
-static uint64_t zap_allocate_blocks(zap_t *zap, int nblocks);
+static uint64_t zap_allocate_blocks(zap_t *zap, int nblocks, dmu_tx_t *tx);
 
 void
 fzap_byteswap(void *vbuf, size_t size)
@@ -182,7 +182,7 @@ zap_table_grow(zap_t *zap, zap_table_phys_t *tbl,
 	if (tbl->zt_nextblk != 0) {
 		newblk = tbl->zt_nextblk;
 	} else {
-		newblk = zap_allocate_blocks(zap, tbl->zt_numblks * 2);
+		newblk = zap_allocate_blocks(zap, tbl->zt_numblks * 2, tx);
 		tbl->zt_nextblk = newblk;
 		ASSERT0(tbl->zt_blks_copied);
 		dmu_prefetch(zap->zap_objset, zap->zap_object, 0,
@@ -367,7 +367,7 @@ zap_grow_ptrtbl(zap_t *zap, dmu_tx_t *tx)
 		    ZAP_EMBEDDED_PTRTBL_SHIFT(zap));
 		ASSERT0(zap_f_phys(zap)->zap_ptrtbl.zt_blk);
 
-		uint64_t newblk = zap_allocate_blocks(zap, 1);
+		uint64_t newblk = zap_allocate_blocks(zap, 1, tx);
 		dmu_buf_t *db_new;
 		int err = dmu_buf_hold(zap->zap_objset, zap->zap_object,
 		    newblk << FZAP_BLOCK_SHIFT(zap), FTAG, &db_new,
@@ -405,11 +405,14 @@ zap_increment_num_entries(zap_t *zap, int delta, dmu_tx_t *tx)
 }
 
 static uint64_t
-zap_allocate_blocks(zap_t *zap, int nblocks)
+zap_allocate_blocks(zap_t *zap, int nblocks, dmu_tx_t *tx)
 {
-	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
+	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
+	dmu_buf_will_dirty(zap->zap_dbuf, tx);
+	mutex_enter(&zap->zap_f.zap_num_entries_mtx);
 	uint64_t newblk = zap_f_phys(zap)->zap_freeblk;
 	zap_f_phys(zap)->zap_freeblk += nblocks;
+	mutex_exit(&zap->zap_f.zap_num_entries_mtx);
 	return (newblk);
 }
 
@@ -427,11 +430,11 @@ zap_create_leaf(zap_t *zap, dmu_tx_t *tx)
 {
 	zap_leaf_t *l = kmem_zalloc(sizeof (zap_leaf_t), KM_SLEEP);
 
-	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
+	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
 
 	rw_init(&l->l_rwlock, NULL, RW_NOLOCKDEP, NULL);
 	rw_enter(&l->l_rwlock, RW_WRITER);
-	l->l_blkid = zap_allocate_blocks(zap, 1);
+	l->l_blkid = zap_allocate_blocks(zap, 1, tx);
 	l->l_dbuf = NULL;
 
 	VERIFY0(dmu_buf_hold(zap->zap_objset, zap->zap_object,
@@ -443,7 +446,9 @@ zap_create_leaf(zap_t *zap, dmu_tx_t *tx)
 
 	zap_leaf_init(l, zap->zap_normflags != 0);
 
+	mutex_enter(&zap->zap_f.zap_num_entries_mtx);
 	zap_f_phys(zap)->zap_num_leafs++;
+	mutex_exit(&zap->zap_f.zap_num_entries_mtx);
 
 	return (l);
 }
@@ -583,13 +588,21 @@ zap_idx_to_blk(zap_t *zap, uint64_t idx, uint64_t *valp)
 	}
 }
 
+/*
+ * The caller must either hold zap_rwlock as writer, or hold as writer the
+ * leaf which idx currently points to.  Each leaf owns the range of ptrtbl
+ * entries matching its prefix, so concurrent leaf splits never store to
+ * the same entry, and the table itself can only be resized by
+ * zap_grow_ptrtbl(), which requires the writer lock.
+ */
 static int
 zap_set_idx_to_blk(zap_t *zap, uint64_t idx, uint64_t blk, dmu_tx_t *tx)
 {
 	ASSERT(tx != NULL);
-	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
+	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
 
 	if (zap_f_phys(zap)->zap_ptrtbl.zt_blk == 0) {
+		dmu_buf_will_dirty(zap->zap_dbuf, tx);
 		ZAP_EMBEDDED_PTRTBL_ENT(zap, idx) = blk;
 		return (0);
 	} else {
@@ -614,15 +627,36 @@ zap_deref_leaf(zap_t *zap, uint64_t h, dmu_tx_t *tx, krw_t lt, zap_leaf_t **lp)
 	}
 
 	uint64_t idx = ZAP_HASH_IDX(h, zap_f_phys(zap)->zap_ptrtbl.zt_shift);
-	int err = zap_idx_to_blk(zap, idx, &blk);
-	if (err != 0)
-		return (err);
-	err = zap_get_leaf_byblk(zap, blk, tx, lt, lp);
+	uint64_t prevblk = 0;
+	zap_leaf_t *l;
+	for (;;) {
+		int err = zap_idx_to_blk(zap, idx, &blk);
+		if (err != 0)
+			return (err);
+		err = zap_get_leaf_byblk(zap, blk, tx, lt, &l);
+		if (err != 0)
+			return (err);
 
-	ASSERT(err ||
-	    ZAP_HASH_IDX(h, zap_leaf_phys(*lp)->l_hdr.lh_prefix_len) ==
-	    zap_leaf_phys(*lp)->l_hdr.lh_prefix);
-	return (err);
+		if (ZAP_HASH_IDX(h, zap_leaf_phys(l)->l_hdr.lh_prefix_len) ==
+		    zap_leaf_phys(l)->l_hdr.lh_prefix)
+			break;
+
+		/*
+		 * With zap_rwlock held as reader, the leaf may have been
+		 * split by zap_expand_leaf() between reading the ptrtbl
+		 * and locking the leaf.  The split updates the ptrtbl
+		 * before dropping the leaf lock, so it is enough to look
+		 * the block up again.  If the ptrtbl still points at the
+		 * same leaf, the zap is damaged.
+		 */
+		zap_put_leaf(l);
+		if (RW_WRITE_HELD(&zap->zap_rwlock) || blk == prevblk)
+			return (SET_ERROR(EIO));
+		prevblk = blk;
+	}
+
+	*lp = l;
+	return (0);
 }
 
 static int
@@ -640,9 +674,16 @@ zap_expand_leaf(zap_name_t *zn, zap_leaf_t *l,
 	ASSERT3U(ZAP_HASH_IDX(hash, old_prefix_len), ==,
 	    zap_leaf_phys(l)->l_hdr.lh_prefix);
 
-	if (zap_tryupgradedir(zap, tx) == 0 ||
-	    old_prefix_len == zap_f_phys(zap)->zap_ptrtbl.zt_shift) {
-		/* We failed to upgrade, or need to grow the pointer table */
+	/*
+	 * Splitting a leaf only modifies the leaf itself, the new leaf, and
+	 * the ptrtbl entries pointing at the leaf, all of which are covered
+	 * by the leaf's lock.  Only if the leaf already uses every bit of
+	 * the ptrtbl index do we need to grow the ptrtbl, which requires
+	 * the writer lock on the whole zap.
+	 */
+	if (old_prefix_len == zap_f_phys(zap)->zap_ptrtbl.zt_shift &&
+	    zap_tryupgradedir(zap, tx) == 0) {
+		/* We need to grow the pointer table, but failed to upgrade */
 		objset_t *os = zap->zap_objset;
 		uint64_t object = zap->zap_object;
 
@@ -671,8 +712,19 @@ zap_expand_leaf(zap_name_t *zn, zap_leaf_t *l,
 			*lp = l;
 			return (0);
 		}
+	} else {
+		while (old_prefix_len ==
+		    zap_f_phys(zap)->zap_ptrtbl.zt_shift) {
+			ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
+			err = zap_grow_ptrtbl(zap, tx);
+			if (err != 0) {
+				zap_put_leaf(l);
+				return (err);
+			}
+		}
 	}
-	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
+	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
+	ASSERT(RW_WRITE_HELD(&l->l_rwlock));
 	ASSERT3U(old_prefix_len, <, zap_f_phys(zap)->zap_ptrtbl.zt_shift);
 	ASSERT3U(ZAP_HASH_IDX(hash, old_prefix_len), ==,
 	    zap_leaf_phys(l)->l_hdr.lh_prefix);
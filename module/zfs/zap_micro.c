@@ -34,7 +34,6 @@
 #include <sys/refcount.h>
 #include <sys/zap_impl.h>
 #include <sys/zap_leaf.h>
-#include <sys/avl.h>
 #include <sys/arc.h>
 #include <sys/dmu_objset.h>
 
@@ -274,17 +273,112 @@ zap_byteswap(void *buf, size_t size)
 	}
 }
 
+static inline uint_t
+mze_home(zap_t *zap, uint32_t hash32)
+{
+	return (hash32 >> (32 - zap->zap_m.zap_mze_shift));
+}
+
+static inline uint_t
+mze_next(zap_t *zap, uint_t slot)
+{
+	return ((slot + 1) & ((1U << zap->zap_m.zap_mze_shift) - 1));
+}
+
+/*
+ * Place an entry in the first free slot at or after its home slot.  The
+ * table must have room for it.
+ */
+static void
+mze_place(zap_t *zap, mzap_ent_t *mze)
+{
+	mzap_ent_t *tbl = zap->zap_m.zap_mze_tbl;
+	uint_t slot = mze_home(zap, mze->mze_hash);
+
+	while (tbl[slot].mze_chunkid != 0)
+		slot = mze_next(zap, slot);
+	tbl[slot] = *mze;
+}
+
+static void
+mze_resize(zap_t *zap, int shift)
+{
+	mzap_ent_t *otbl = zap->zap_m.zap_mze_tbl;
+	int oshift = zap->zap_m.zap_mze_shift;
+
+	zap->zap_m.zap_mze_tbl =
+	    kmem_zalloc(sizeof (mzap_ent_t) << shift, KM_SLEEP);
+	zap->zap_m.zap_mze_shift = shift;
+
+	for (uint_t i = 0; i < (1U << oshift); i++) {
+		if (otbl[i].mze_chunkid != 0)
+			mze_place(zap, &otbl[i]);
+	}
+	kmem_free(otbl, sizeof (mzap_ent_t) << oshift);
+}
+
+/*
+ * Return the smallest table shift which keeps nents entries at most half
+ * of the slots.
+ */
 static int
-mze_compare(const void *arg1, const void *arg2)
+mze_tbl_shift(int nents)
 {
-	const mzap_ent_t *mze1 = arg1;
-	const mzap_ent_t *mze2 = arg2;
+	int shift = MZE_TBL_MIN_SHIFT;
 
-	int cmp = AVL_CMP(mze1->mze_hash, mze2->mze_hash);
-	if (likely(cmp))
-		return (cmp);
+	while ((1 << shift) < 2 * nents)
+		shift++;
+	return (shift);
+}
 
-	return (AVL_CMP(mze1->mze_cd, mze2->mze_cd));
+/*
+ * Build the index on first use.  Hashing every name is the expensive part
+ * of opening a microzap, so this is deferred until a lookup, add, remove
+ * or cursor actually needs it; zap_count() and zap_get_stats() never do.
+ */
+static mzap_ent_t *
+mze_tbl(zap_t *zap)
+{
+	ASSERT(zap->zap_ismicro);
+	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
+
+	mzap_ent_t *tbl = zap->zap_m.zap_mze_tbl;
+	if (tbl != NULL) {
+		membar_consumer();
+		return (tbl);
+	}
+
+	mutex_enter(&zap->zap_m.zap_mze_lock);
+	if (zap->zap_m.zap_mze_tbl == NULL) {
+		int shift = mze_tbl_shift(zap->zap_m.zap_num_entries + 1);
+
+		tbl = kmem_zalloc(sizeof (mzap_ent_t) << shift, KM_SLEEP);
+		for (int i = 0; i < zap->zap_m.zap_num_chunks; i++) {
+			mzap_ent_phys_t *mzep = &zap_m_phys(zap)->mz_chunk[i];
+			if (mzep->mze_name[0] == 0)
+				continue;
+
+			zap_name_t *zn = zap_name_alloc(zap, mzep->mze_name, 0);
+			ASSERT3U(mzep->mze_cd, <=, UINT16_MAX);
+			mzap_ent_t mze = {
+				.mze_hash = zn->zn_hash >> 32,
+				.mze_cd = mzep->mze_cd,
+				.mze_chunkid = i + 1,
+			};
+			zap_name_free(zn);
+
+			uint_t slot = mze.mze_hash >> (32 - shift);
+			while (tbl[slot].mze_chunkid != 0)
+				slot = (slot + 1) & ((1U << shift) - 1);
+			tbl[slot] = mze;
+		}
+		zap->zap_m.zap_mze_shift = shift;
+		membar_producer();
+		zap->zap_m.zap_mze_tbl = tbl;
+	}
+	mutex_exit(&zap->zap_m.zap_mze_lock);
+
+	return (zap->zap_m.zap_mze_tbl);
 }
 
 static void
@@ -293,64 +387,133 @@ mze_insert(zap_t *zap, int chunkid, uint64_t hash)
 	ASSERT(zap->zap_ismicro);
 	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
 
-	mzap_ent_t *mze = kmem_alloc(sizeof (mzap_ent_t), KM_SLEEP);
-	mze->mze_chunkid = chunkid;
-	mze->mze_hash = hash;
-	mze->mze_cd = MZE_PHYS(zap, mze)->mze_cd;
-	ASSERT(MZE_PHYS(zap, mze)->mze_name[0] != 0);
-	avl_add(&zap->zap_m.zap_avl, mze);
+	/* If the index is not built yet it will pick up the new chunk */
+	if (zap->zap_m.zap_mze_tbl == NULL)
+		return;
+
+	if (2 * zap->zap_m.zap_num_entries > (1 << zap->zap_m.zap_mze_shift))
+		mze_resize(zap, zap->zap_m.zap_mze_shift + 1);
+
+	mzap_ent_t mze;
+	mze.mze_hash = hash >> 32;
+	mze.mze_cd = zap_m_phys(zap)->mz_chunk[chunkid].mze_cd;
+	mze.mze_chunkid = chunkid + 1;
+	ASSERT3U(zap_m_phys(zap)->mz_chunk[chunkid].mze_cd, <=, UINT16_MAX);
+	ASSERT(MZE_PHYS(zap, &mze)->mze_name[0] != 0);
+	mze_place(zap, &mze);
 }
 
+/*
+ * Entries with the same hash are all in the run of occupied slots which
+ * starts at their home slot.  Iterate over them, starting with *slotp set
+ * to -1U, until NULL is returned.
+ */
 static mzap_ent_t *
-mze_find(zap_name_t *zn)
+mze_walk_hash(zap_t *zap, uint64_t hash, uint_t *slotp)
 {
-	mzap_ent_t mze_tofind;
-	mzap_ent_t *mze;
-	avl_index_t idx;
-	avl_tree_t *avl = &zn->zn_zap->zap_m.zap_avl;
+	mzap_ent_t *tbl = mze_tbl(zap);
+	uint32_t hash32 = hash >> 32;
+	uint_t slot = (*slotp == -1U) ?
+	    mze_home(zap, hash32) : mze_next(zap, *slotp);
 
-	ASSERT(zn->zn_zap->zap_ismicro);
-	ASSERT(RW_LOCK_HELD(&zn->zn_zap->zap_rwlock));
+	for (; tbl[slot].mze_chunkid != 0; slot = mze_next(zap, slot)) {
+		if (tbl[slot].mze_hash == hash32) {
+			*slotp = slot;
+			return (&tbl[slot]);
+		}
+	}
+	return (NULL);
+}
 
-	mze_tofind.mze_hash = zn->zn_hash;
-	mze_tofind.mze_cd = 0;
+static mzap_ent_t *
+mze_find(zap_name_t *zn)
+{
+	zap_t *zap = zn->zn_zap;
+	mzap_ent_t *mze, *found = NULL;
+	uint_t slot = -1U;
 
-	mze = avl_find(avl, &mze_tofind, &idx);
-	if (mze == NULL)
-		mze = avl_nearest(avl, idx, AVL_AFTER);
-	for (; mze && mze->mze_hash == zn->zn_hash; mze = AVL_NEXT(avl, mze)) {
-		ASSERT3U(mze->mze_cd, ==, MZE_PHYS(zn->zn_zap, mze)->mze_cd);
-		if (zap_match(zn, MZE_PHYS(zn->zn_zap, mze)->mze_name))
-			return (mze);
+	ASSERT(zap->zap_ismicro);
+	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
+
+	/*
+	 * Entries with the same hash are not sorted by cd within the
+	 * table, so keep looking to return the same (lowest cd) match
+	 * that a normalization-insensitive lookup always returned.
+	 */
+	while ((mze = mze_walk_hash(zap, zn->zn_hash, &slot)) != NULL) {
+		ASSERT3U(mze->mze_cd, ==, MZE_PHYS(zap, mze)->mze_cd);
+		if ((found == NULL || mze->mze_cd < found->mze_cd) &&
+		    zap_match(zn, MZE_PHYS(zap, mze)->mze_name)) {
+			found = mze;
+			if (zn->zn_matchtype == 0)
+				break;
+		}
 	}
 
-	return (NULL);
+	return (found);
 }
 
 static uint32_t
 mze_find_unused_cd(zap_t *zap, uint64_t hash)
 {
-	mzap_ent_t mze_tofind;
-	avl_index_t idx;
-	avl_tree_t *avl = &zap->zap_m.zap_avl;
-
 	ASSERT(zap->zap_ismicro);
 	ASSERT(RW_LOCK_HELD(&zap->zap_rwlock));
 
-	mze_tofind.mze_hash = hash;
-	mze_tofind.mze_cd = 0;
-
 	uint32_t cd = 0;
-	for (mzap_ent_t *mze = avl_find(avl, &mze_tofind, &idx);
-	    mze && mze->mze_hash == hash; mze = AVL_NEXT(avl, mze)) {
-		if (mze->mze_cd != cd)
-			break;
-		cd++;
-	}
+	boolean_t used;
+	do {
+		mzap_ent_t *mze;
+		uint_t slot = -1U;
+
+		used = B_FALSE;
+		while ((mze = mze_walk_hash(zap, hash, &slot)) != NULL) {
+			if (mze->mze_cd == cd) {
+				used = B_TRUE;
+				cd++;
+				break;
+			}
+		}
+	} while (used);
 
 	return (cd);
 }
 
+/*
+ * Return the entry with the smallest (hash, cd) which is not less than
+ * (hash, cd), or NULL.  Such an entry lives between its home slot, which
+ * is not before the home slot of hash, and the next free slot.  So once a
+ * candidate has been found, no better one can follow the first free slot
+ * past the candidate's home slot.
+ */
+static mzap_ent_t *
+mze_find_next(zap_t *zap, uint64_t hash, uint32_t cd)
+{
+	mzap_ent_t *tbl = mze_tbl(zap);
+	uint32_t hash32 = hash >> 32;
+	uint_t start = mze_home(zap, hash32);
+	uint_t size = 1U << zap->zap_m.zap_mze_shift;
+	mzap_ent_t *best = NULL;
+
+	for (uint_t pos = start; pos < start + size; pos++) {
+		mzap_ent_t *mze = &tbl[pos & (size - 1)];
+
+		if (mze->mze_chunkid == 0) {
+			if (best != NULL && pos > mze_home(zap, best->mze_hash))
+				break;
+			continue;
+		}
+		if (mze->mze_hash < hash32 ||
+		    (mze->mze_hash == hash32 && mze->mze_cd < cd))
+			continue;
+		if (best == NULL || mze->mze_hash < best->mze_hash ||
+		    (mze->mze_hash == best->mze_hash &&
+		    mze->mze_cd < best->mze_cd))
+			best = mze;
+	}
+
+	return (best);
+}
+
 /*
  * Each mzap entry requires at max : 4 chunks
  * 3 chunks for names + 1 chunk for value.
@@ -366,19 +529,11 @@ static boolean_t
 mze_canfit_fzap_leaf(zap_name_t *zn, uint64_t hash)
 {
 	zap_t *zap = zn->zn_zap;
-	mzap_ent_t mze_tofind;
-	mzap_ent_t *mze;
-	avl_index_t idx;
-	avl_tree_t *avl = &zap->zap_m.zap_avl;
+	uint_t slot = -1U;
 	uint32_t mzap_ents = 0;
 
-	mze_tofind.mze_hash = hash;
-	mze_tofind.mze_cd = 0;
-
-	for (mze = avl_find(avl, &mze_tofind, &idx);
-	    mze && mze->mze_hash == hash; mze = AVL_NEXT(avl, mze)) {
+	while (mze_walk_hash(zap, hash, &slot) != NULL)
 		mzap_ents++;
-	}
 
 	/* Include the new entry being added */
 	mzap_ents++;
@@ -386,25 +541,48 @@ mze_canfit_fzap_leaf(zap_name_t *zn, uint64_t hash)
 	return (ZAP_LEAF_NUMCHUNKS_DEF > (mzap_ents * MZAP_ENT_CHUNKS));
 }
 
+/*
+ * Remove an entry, moving later entries of its run back so that every
+ * entry remains reachable from its home slot without tombstones.
+ */
 static void
 mze_remove(zap_t *zap, mzap_ent_t *mze)
 {
 	ASSERT(zap->zap_ismicro);
 	ASSERT(RW_WRITE_HELD(&zap->zap_rwlock));
 
-	avl_remove(&zap->zap_m.zap_avl, mze);
-	kmem_free(mze, sizeof (mzap_ent_t));
+	mzap_ent_t *tbl = zap->zap_m.zap_mze_tbl;
+	uint_t hole = mze - tbl;
+	uint_t slot = hole;
+
+	for (;;) {
+		tbl[hole].mze_chunkid = 0;
+		for (;;) {
+			slot = mze_next(zap, slot);
+			if (tbl[slot].mze_chunkid == 0)
+				return;
+
+			/* Leave the entry if its home is in (hole, slot] */
+			uint_t home = mze_home(zap, tbl[slot].mze_hash);
+			if (hole <= slot ? (hole < home && home <= slot) :
+			    (hole < home || home <= slot))
+				continue;
+			break;
+		}
+		tbl[hole] = tbl[slot];
+		hole = slot;
+	}
 }
 
 static void
 mze_destroy(zap_t *zap)
 {
-	mzap_ent_t *mze;
-	void *avlcookie = NULL;
-
-	while ((mze = avl_destroy_nodes(&zap->zap_m.zap_avl, &avlcookie)))
-		kmem_free(mze, sizeof (mzap_ent_t));
-	avl_destroy(&zap->zap_m.zap_avl);
+	if (zap->zap_m.zap_mze_tbl != NULL) {
+		kmem_free(zap->zap_m.zap_mze_tbl,
+		    sizeof (mzap_ent_t) << zap->zap_m.zap_mze_shift);
+		zap->zap_m.zap_mze_tbl = NULL;
+	}
+	mutex_destroy(&zap->zap_m.zap_mze_lock);
 }
 
 static zap_t *
@@ -434,6 +612,7 @@ mzap_open(objset_t *os, uint64_t obj, dmu_buf_t *db)
 		}
 	} else {
 		zap->zap_ismicro = TRUE;
+		mutex_init(&zap->zap_m.zap_mze_lock, NULL, MUTEX_DEFAULT, NULL);
 	}
 
 	/*
@@ -451,20 +630,11 @@ mzap_open(objset_t *os, uint64_t obj, dmu_buf_t *db)
 		zap->zap_salt = zap_m_phys(zap)->mz_salt;
 		zap->zap_normflags = zap_m_phys(zap)->mz_normflags;
 		zap->zap_m.zap_num_chunks = db->db_size / MZAP_ENT_LEN - 1;
-		avl_create(&zap->zap_m.zap_avl, mze_compare,
-		    sizeof (mzap_ent_t), offsetof(mzap_ent_t, mze_node));
 
+		/* The index is built by mze_tbl() when first needed */
 		for (int i = 0; i < zap->zap_m.zap_num_chunks; i++) {
-			mzap_ent_phys_t *mze =
-			    &zap_m_phys(zap)->mz_chunk[i];
-			if (mze->mze_name[0]) {
-				zap_name_t *zn;
-
+			if (zap_m_phys(zap)->mz_chunk[i].mze_name[0])
 				zap->zap_m.zap_num_entries++;
-				zn = zap_name_alloc(zap, mze->mze_name, 0);
-				mze_insert(zap, i, zn->zn_hash);
-				zap_name_free(zn);
-			}
 		}
 	} else {
 		zap->zap_salt = zap_f_phys(zap)->zap_salt;
@@ -497,6 +667,8 @@ handle_winner:
 	rw_destroy(&zap->zap_rwlock);
 	if (!zap->zap_ismicro)
 		mutex_destroy(&zap->zap_f.zap_num_entries_mtx);
+	else
+		mutex_destroy(&zap->zap_m.zap_mze_lock);
 	kmem_free(zap, sizeof (zap_t));
 	return (winner);
 }
@@ -658,7 +830,6 @@ mzap_upgrade(zap_t **zapp, void *tag, dmu_tx_t *tx, zap_flags_t flags)
 
 	dprintf("upgrading obj=%llu with %u chunks\n",
 	    zap->zap_object, nchunks);
-	/* XXX destroy the avl later, so we can use the stored hash value */
 	mze_destroy(zap);
 
 	fzap_upgrade(zap, tx, flags);
@@ -919,16 +1090,17 @@ zap_count(objset_t *os, uint64_t zapobj, uint64_t *count)
 static boolean_t
 mzap_normalization_conflict(zap_t *zap, zap_name_t *zn, mzap_ent_t *mze)
 {
-	int direction = AVL_BEFORE;
 	boolean_t allocdzn = B_FALSE;
+	boolean_t conflict = B_FALSE;
+	mzap_ent_t *other;
+	uint_t slot = -1U;
 
 	if (zap->zap_normflags == 0)
 		return (B_FALSE);
 
-again:
-	for (mzap_ent_t *other = avl_walk(&zap->zap_m.zap_avl, mze, direction);
-	    other && other->mze_hash == mze->mze_hash;
-	    other = avl_walk(&zap->zap_m.zap_avl, other, direction)) {
+	while ((other = mze_walk_hash(zap, MZE_HASH(mze), &slot)) != NULL) {
+		if (other == mze)
+			continue;
 
 		if (zn == NULL) {
 			zn = zap_name_alloc(zap, MZE_PHYS(zap, mze)->mze_name,
@@ -936,20 +1108,14 @@ again:
 			allocdzn = B_TRUE;
 		}
 		if (zap_match(zn, MZE_PHYS(zap, other)->mze_name)) {
-			if (allocdzn)
-				zap_name_free(zn);
-			return (B_TRUE);
+			conflict = B_TRUE;
+			break;
 		}
 	}
 
-	if (direction == AVL_BEFORE) {
-		direction = AVL_AFTER;
-		goto again;
-	}
-
 	if (allocdzn)
 		zap_name_free(zn);
-	return (B_FALSE);
+	return (conflict);
 }
 
 /*
@@ -1582,18 +1748,8 @@ zap_cursor_retrieve(zap_cursor_t *zc, zap_attribute_t *za)
 	if (!zc->zc_zap->zap_ismicro) {
 		err = fzap_cursor_retrieve(zc->zc_zap, zc, za);
 	} else {
-		avl_index_t idx;
-		mzap_ent_t mze_tofind;
-
-		mze_tofind.mze_hash = zc->zc_hash;
-		mze_tofind.mze_cd = zc->zc_cd;
-
 		mzap_ent_t *mze =
-		    avl_find(&zc->zc_zap->zap_m.zap_avl, &mze_tofind, &idx);
-		if (mze == NULL) {
-			mze = avl_nearest(&zc->zc_zap->zap_m.zap_avl,
-			    idx, AVL_AFTER);
-		}
+		    mze_find_next(zc->zc_zap, zc->zc_hash, zc->zc_cd);
 		if (mze) {
 			mzap_ent_phys_t *mzep = MZE_PHYS(zc->zc_zap, mze);
 			ASSERT3U(mze->mze_cd, ==, mzep->mze_cd);
@@ -1603,7 +1759,7 @@ zap_cursor_retrieve(zap_cursor_t *zc, zap_attribute_t *za)
 			za->za_num_integers = 1;
 			za->za_first_integer = mzep->mze_value;
 			(void) strcpy(za->za_name, mzep->mze_name);
-			zc->zc_hash = mze->mze_hash;
+			zc->zc_hash = MZE_HASH(mze);
 			zc->zc_cd = mze->mze_cd;
 			err = 0;
 		} else {
@@ -167,6 +167,7 @@
 #include <sys/zap.h>
 #include <sys/spa.h>
 #include <sys/spa_impl.h>
+#include <sys/ddt.h>
 #include <sys/vdev.h>
 #include <sys/vdev_impl.h>
 #include <sys/dmu.h>
@@ -1940,6 +1941,7 @@ zfs_ioc_vdev_attach(zfs_cmd_t *zc)
 {
 	spa_t *spa;
 	int replacing = zc->zc_cookie;
+	int rebuild = zc->zc_simple;
 	nvlist_t *config;
 	int error;
 
@@ -1948,7 +1950,8 @@ zfs_ioc_vdev_attach(zfs_cmd_t *zc)
 
 	if ((error = get_nvlist(zc->zc_nvlist_conf, zc->zc_nvlist_conf_size,
 	    zc->zc_iflags, &config)) == 0) {
-		error = spa_vdev_attach(spa, zc->zc_guid, config, replacing);
+		error = spa_vdev_attach(spa, zc->zc_guid, config, replacing,
+		    rebuild);
 		nvlist_free(config);
 	}
 
@@ -4086,6 +4089,41 @@ zfs_ioc_wait(const char *name, nvlist_t *innvl, nvlist_t *outnvl)
 	return (error);
 }
 
+/*
+ * Remove the oldest unique (single reference) entries from the pool's DDTs.
+ * Their blocks are kept, but are no longer deduplicated.
+ *
+ * innvl: {
+ *     "ddt_prune_percentage" -> uint64_t (1-100)
+ * }
+ *
+ * outnvl: empty
+ */
+static const zfs_ioc_key_t zfs_keys_ddt_prune[] = {
+	{ZPOOL_DDT_PRUNE_PERCENTAGE,	DATA_TYPE_UINT64,	0},
+};
+
+/* ARGSUSED */
+static int
+zfs_ioc_ddt_prune(const char *poolname, nvlist_t *innvl, nvlist_t *outnvl)
+{
+	uint64_t percentage;
+	spa_t *spa;
+	int error;
+
+	if (nvlist_lookup_uint64(innvl, ZPOOL_DDT_PRUNE_PERCENTAGE,
+	    &percentage) != 0)
+		return (SET_ERROR(EINVAL));
+
+	if ((error = spa_open(poolname, &spa, FTAG)) != 0)
+		return (error);
+
+	error = ddt_prune_unique_entries(spa, percentage);
+	spa_close(spa, FTAG);
+
+	return (error);
+}
+
 /*
  * fsname is name of dataset to rollback (to most recent snapshot)
  *
@@ -4337,6 +4375,9 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 		 * we'll catch them later.
 		 */
 		if (nvpair_value_uint64(pair, &intval) == 0) {
+			uint64_t compval = ZIO_COMPRESS_ALGO(intval);
+			spa_feature_t feature;
+
 			if (intval >= ZIO_COMPRESS_GZIP_1 &&
 			    intval <= ZIO_COMPRESS_GZIP_9 &&
 			    zfs_earlier_version(dsname,
@@ -4363,6 +4404,20 @@ zfs_check_settable(const char *dsname, nvpair_t *pair, cred_t *cr)
 				spa_close(spa, FTAG);
 			}
 
+			feature = zio_compress_to_feature(compval);
+			if (feature != SPA_FEATURE_NONE) {
+				spa_t *spa;
+
+				if ((err = spa_open(dsname, &spa, FTAG)) != 0)
+					return (err);
+
+				if (!spa_feature_is_enabled(spa, feature)) {
+					spa_close(spa, FTAG);
+					return (SET_ERROR(ENOTSUP));
+				}
+				spa_close(spa, FTAG);
+			}
+
 			/*
 			 * If this is a bootable dataset then
 			 * verify that the compression algorithm
@@ -6927,6 +6982,11 @@ zfs_ioctl_init(void)
 	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_FALSE, B_FALSE,
 	    zfs_keys_pool_wait, ARRAY_SIZE(zfs_keys_pool_wait));
 
+	zfs_ioctl_register("ddt_prune", ZFS_IOC_DDT_PRUNE,
+	    zfs_ioc_ddt_prune, zfs_secpolicy_config, POOL_NAME,
+	    POOL_CHECK_SUSPENDED | POOL_CHECK_READONLY, B_TRUE, B_TRUE,
+	    zfs_keys_ddt_prune, ARRAY_SIZE(zfs_keys_ddt_prune));
+
 	/* IOCTLS that use the legacy function signature */
 
 	zfs_ioctl_register_legacy(ZFS_IOC_POOL_FREEZE, zfs_ioc_pool_freeze,
@@ -137,8 +137,76 @@ static kmem_cache_t *zil_zcw_cache;
 
 static void zil_async_to_sync(zilog_t *zilog, uint64_t foid);
 
-#define	LWB_EMPTY(lwb) ((BP_GET_LSIZE(&lwb->lwb_blk) - \
-    sizeof (zil_chain_t)) == (lwb->lwb_sz - lwb->lwb_nused))
+#define	LWB_EMPTY(lwb) ((lwb)->lwb_nused == \
+	((lwb)->lwb_slim ? sizeof (zil_chain_t) : 0))
+
+static const char *zil_lat_stage_names[ZIL_LAT_STAGES] = {
+	"commit",
+	"commit_list",
+	"assign",
+	"alloc",
+	"write",
+	"flush",
+};
+
+/*
+ * Name and zero the ZIL_LAT_NSTATS entries of a latency histogram kstat.
+ * Each entry is named after its stage and the upper bound of its bucket,
+ * e.g. "flush_512us"; the last bucket of each stage has no upper bound.
+ */
+void
+zil_lat_kstat_init(kstat_named_t *ks)
+{
+	for (int s = 0; s < ZIL_LAT_STAGES; s++) {
+		for (int b = 0; b < ZIL_LAT_BUCKETS; b++, ks++) {
+			ks->data_type = KSTAT_DATA_UINT64;
+			ks->value.ui64 = 0;
+			(void) snprintf(ks->name, KSTAT_STRLEN, "%s_%lluus",
+			    zil_lat_stage_names[s], (u_longlong_t)1 << b);
+		}
+	}
+}
+
+/*
+ * When the kstat is written zero all buckets.
+ */
+int
+zil_lat_kstat_update(kstat_t *ksp, int rw)
+{
+	kstat_named_t *ks = ksp->ks_data;
+
+	if (rw == KSTAT_WRITE) {
+		for (int i = 0; i < ZIL_LAT_NSTATS; i++)
+			ks[i].value.ui64 = 0;
+	}
+
+	return (0);
+}
+
+void
+zil_lat_kstat_add(kstat_named_t *ks, zil_lat_stage_t stage, hrtime_t nsecs)
+{
+	uint64_t usecs = NSEC2USEC(MAX(nsecs, 0));
+	int b = (usecs <= 1) ? 0 : highbit64(usecs - 1);
+
+	b = MIN(b, ZIL_LAT_BUCKETS - 1);
+	atomic_inc_64(&ks[stage * ZIL_LAT_BUCKETS + b].value.ui64);
+}
+
+/*
+ * Account the latency of a commit stage to both the pool's and, while
+ * the ZIL is open, the dataset's histograms.
+ */
+static void
+zil_lat_add(zilog_t *zilog, zil_lat_stage_t stage, hrtime_t nsecs)
+{
+	kstat_t *ksp = zilog->zl_lat_kstat;
+
+	zil_lat_kstat_add(zilog->zl_spa->spa_stats.zil_latency.private,
+	    stage, nsecs);
+	if (ksp != NULL)
+		zil_lat_kstat_add(ksp->ks_data, stage, nsecs);
+}
 
 static int
 zil_bp_compare(const void *x1, const void *x2)
@@ -538,30 +606,47 @@ zil_lwb_vdev_compare(const void *x1, const void *x2)
 	return (AVL_CMP(v1, v2));
 }
 
+/*
+ * Allocate an lwb of the given block size. If "bp" is NULL, the lwb's
+ * block will be allocated later, when the previous lwb in the chain is
+ * issued; see zil_lwb_write_issue().
+ */
 static lwb_t *
-zil_alloc_lwb(zilog_t *zilog, blkptr_t *bp, boolean_t slog, uint64_t txg,
-    boolean_t fastwrite)
+zil_alloc_lwb(zilog_t *zilog, int sz, blkptr_t *bp, boolean_t slog,
+    uint64_t txg, boolean_t fastwrite)
 {
 	lwb_t *lwb;
 
 	lwb = kmem_cache_alloc(zil_lwb_cache, KM_SLEEP);
 	lwb->lwb_zilog = zilog;
-	lwb->lwb_blk = *bp;
+	if (bp != NULL) {
+		lwb->lwb_blk = *bp;
+		lwb->lwb_slim = (BP_GET_CHECKSUM(bp) == ZIO_CHECKSUM_ZILOG2);
+		sz = BP_GET_LSIZE(bp);
+	} else {
+		BP_ZERO(&lwb->lwb_blk);
+		lwb->lwb_slim = (spa_version(zilog->zl_spa) >=
+		    SPA_VERSION_SLIM_ZIL);
+	}
 	lwb->lwb_fastwrite = fastwrite;
 	lwb->lwb_slog = slog;
-	lwb->lwb_state = LWB_STATE_CLOSED;
-	lwb->lwb_buf = zio_buf_alloc(BP_GET_LSIZE(bp));
+	lwb->lwb_error = 0;
+	lwb->lwb_state = LWB_STATE_NEW;
+	lwb->lwb_buf = zio_buf_alloc(sz);
+	lwb->lwb_alloc_txg = txg;
 	lwb->lwb_max_txg = txg;
+	lwb->lwb_child_zio = NULL;
 	lwb->lwb_write_zio = NULL;
 	lwb->lwb_root_zio = NULL;
 	lwb->lwb_tx = NULL;
 	lwb->lwb_issued_timestamp = 0;
-	if (BP_GET_CHECKSUM(bp) == ZIO_CHECKSUM_ZILOG2) {
-		lwb->lwb_nused = sizeof (zil_chain_t);
-		lwb->lwb_sz = BP_GET_LSIZE(bp);
+	lwb->lwb_write_done_timestamp = 0;
+	if (lwb->lwb_slim) {
+		lwb->lwb_nused = lwb->lwb_nfilled = sizeof (zil_chain_t);
+		lwb->lwb_sz = sz;
 	} else {
-		lwb->lwb_nused = 0;
-		lwb->lwb_sz = BP_GET_LSIZE(bp) - sizeof (zil_chain_t);
+		lwb->lwb_nused = lwb->lwb_nfilled = 0;
+		lwb->lwb_sz = sz - sizeof (zil_chain_t);
 	}
 
 	mutex_enter(&zilog->zl_lock);
@@ -584,10 +669,11 @@ zil_free_lwb(zilog_t *zilog, lwb_t *lwb)
 	VERIFY(list_is_empty(&lwb->lwb_waiters));
 	VERIFY(list_is_empty(&lwb->lwb_itxs));
 	ASSERT(avl_is_empty(&lwb->lwb_vdev_tree));
+	ASSERT3P(lwb->lwb_child_zio, ==, NULL);
 	ASSERT3P(lwb->lwb_write_zio, ==, NULL);
 	ASSERT3P(lwb->lwb_root_zio, ==, NULL);
 	ASSERT3U(lwb->lwb_max_txg, <=, spa_syncing_txg(zilog->zl_spa));
-	ASSERT(lwb->lwb_state == LWB_STATE_CLOSED ||
+	ASSERT(lwb->lwb_state == LWB_STATE_NEW ||
 	    lwb->lwb_state == LWB_STATE_FLUSH_DONE);
 
 	/*
@@ -709,7 +795,7 @@ zil_create(zilog_t *zilog)
 	 * Allocate a log write block (lwb) for the first log block.
 	 */
 	if (error == 0)
-		lwb = zil_alloc_lwb(zilog, &blk, slog, txg, fastwrite);
+		lwb = zil_alloc_lwb(zilog, 0, &blk, slog, txg, fastwrite);
 
 	/*
 	 * If we just allocated the first log block, commit our transaction
@@ -776,7 +862,8 @@ zil_destroy(zilog_t *zilog, boolean_t keep_first)
 			list_remove(&zilog->zl_lwb_list, lwb);
 			if (lwb->lwb_buf != NULL)
 				zio_buf_free(lwb->lwb_buf, lwb->lwb_sz);
-			zio_free(zilog->zl_spa, txg, &lwb->lwb_blk);
+			if (!BP_IS_HOLE(&lwb->lwb_blk))
+				zio_free(zilog->zl_spa, txg, &lwb->lwb_blk);
 			zil_free_lwb(zilog, lwb);
 		}
 	} else if (!keep_first) {
@@ -1011,6 +1098,8 @@ zil_commit_waiter_link_lwb(zil_commit_waiter_t *zcw, lwb_t *lwb)
 	ASSERT3P(zcw->zcw_lwb, ==, NULL);
 	ASSERT3P(lwb, !=, NULL);
 	ASSERT(lwb->lwb_state == LWB_STATE_OPENED ||
+	    lwb->lwb_state == LWB_STATE_CLOSED ||
+	    lwb->lwb_state == LWB_STATE_READY ||
 	    lwb->lwb_state == LWB_STATE_ISSUED ||
 	    lwb->lwb_state == LWB_STATE_WRITE_DONE);
 
@@ -1123,6 +1212,7 @@ zil_lwb_flush_vdevs_done(zio_t *zio)
 	dmu_tx_t *tx = lwb->lwb_tx;
 	zil_commit_waiter_t *zcw;
 	itx_t *itx;
+	int error;
 
 	spa_config_exit(zilog->zl_spa, SCL_STATE, lwb);
 
@@ -1143,6 +1233,10 @@ zil_lwb_flush_vdevs_done(zio_t *zio)
 
 	ASSERT3U(lwb->lwb_issued_timestamp, >, 0);
 	zilog->zl_last_lwb_latency = gethrtime() - lwb->lwb_issued_timestamp;
+	if (lwb->lwb_error == 0) {
+		zil_lat_add(zilog, ZIL_LAT_FLUSH,
+		    gethrtime() - lwb->lwb_write_done_timestamp);
+	}
 
 	lwb->lwb_root_zio = NULL;
 
@@ -1164,6 +1258,12 @@ zil_lwb_flush_vdevs_done(zio_t *zio)
 		zil_itx_destroy(itx);
 	}
 
+	/*
+	 * An lwb whose block couldn't be allocated was never written, so
+	 * its waiters have to rely on spa_sync() just like on an I/O error.
+	 */
+	error = (zio->io_error != 0) ? zio->io_error : lwb->lwb_error;
+
 	while ((zcw = list_head(&lwb->lwb_waiters)) != NULL) {
 		mutex_enter(&zcw->zcw_lock);
 
@@ -1173,7 +1273,7 @@ zil_lwb_flush_vdevs_done(zio_t *zio)
 		ASSERT3P(zcw->zcw_lwb, ==, lwb);
 		zcw->zcw_lwb = NULL;
 
-		zcw->zcw_zio_error = zio->io_error;
+		zcw->zcw_zio_error = error;
 
 		ASSERT3B(zcw->zcw_done, ==, B_FALSE);
 		zcw->zcw_done = B_TRUE;
@@ -1228,9 +1328,14 @@ zil_lwb_write_done(zio_t *zio)
 
 	abd_put(zio->io_abd);
 
+	lwb->lwb_write_done_timestamp = gethrtime();
+	zil_lat_add(zilog, ZIL_LAT_WRITE,
+	    lwb->lwb_write_done_timestamp - lwb->lwb_issued_timestamp);
+
 	mutex_enter(&zilog->zl_lock);
 	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_ISSUED);
 	lwb->lwb_state = LWB_STATE_WRITE_DONE;
+	lwb->lwb_child_zio = NULL;
 	lwb->lwb_write_zio = NULL;
 	lwb->lwb_fastwrite = FALSE;
 	nlwb = list_next(&zilog->zl_lwb_list, lwb);
@@ -1281,21 +1386,53 @@ zil_lwb_write_done(zio_t *zio)
 	}
 }
 
+/*
+ * This is the completion callback of the null zio that stands in for
+ * the write zio of an lwb that has no block to be written to, because
+ * the allocation of its block failed (see zil_lwb_write_issue()). The
+ * lwb's waiters are handed the allocation error in
+ * zil_lwb_flush_vdevs_done(), so they fall back to txg_wait_synced();
+ * the flushes that may have been deferred to this lwb are simply
+ * dropped.
+ */
+static void
+zil_lwb_null_write_done(zio_t *zio)
+{
+	lwb_t *lwb = zio->io_private;
+	zilog_t *zilog = lwb->lwb_zilog;
+	avl_tree_t *t = &lwb->lwb_vdev_tree;
+	void *cookie = NULL;
+	zil_vdev_node_t *zv;
+
+	ASSERT3S(lwb->lwb_error, !=, 0);
+
+	mutex_enter(&zilog->zl_lock);
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_ISSUED);
+	lwb->lwb_state = LWB_STATE_WRITE_DONE;
+	lwb->lwb_child_zio = NULL;
+	lwb->lwb_write_zio = NULL;
+	mutex_exit(&zilog->zl_lock);
+
+	while ((zv = avl_destroy_nodes(t, &cookie)) != NULL)
+		kmem_free(zv, sizeof (*zv));
+}
+
 static void
 zil_lwb_set_zio_dependency(zilog_t *zilog, lwb_t *lwb)
 {
-	lwb_t *last_lwb_opened = zilog->zl_last_lwb_opened;
+	lwb_t *prev = list_prev(&zilog->zl_lwb_list, lwb);
 
-	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
 	ASSERT(MUTEX_HELD(&zilog->zl_lock));
 
 	/*
-	 * The zilog's "zl_last_lwb_opened" field is used to build the
-	 * lwb/zio dependency chain, which is used to preserve the
-	 * ordering of lwb completions that is required by the semantics
-	 * of the ZIL. Each new lwb zio becomes a parent of the
+	 * The order of the lwbs on the zilog's "zl_lwb_list" is used to
+	 * build the lwb/zio dependency chain, which is used to preserve
+	 * the ordering of lwb completions that is required by the
+	 * semantics of the ZIL. Each new lwb zio becomes a parent of the
 	 * "previous" lwb zio, such that the new lwb's zio cannot
-	 * complete until the "previous" lwb's zio completes.
+	 * complete until the "previous" lwb's zio completes. Since lwbs
+	 * are issued in chain order, the previous lwb's zios have always
+	 * been created by the time this is called.
 	 *
 	 * This is required by the semantics of zil_commit(); the commit
 	 * waiters attached to the lwbs will be woken in the lwb zio's
@@ -1303,15 +1440,12 @@ zil_lwb_set_zio_dependency(zilog_t *zilog, lwb_t *lwb)
 	 * waiters are woken in the correct order (the same order the
 	 * lwbs were created).
 	 */
-	if (last_lwb_opened != NULL &&
-	    last_lwb_opened->lwb_state != LWB_STATE_FLUSH_DONE) {
-		ASSERT(last_lwb_opened->lwb_state == LWB_STATE_OPENED ||
-		    last_lwb_opened->lwb_state == LWB_STATE_ISSUED ||
-		    last_lwb_opened->lwb_state == LWB_STATE_WRITE_DONE);
+	if (prev != NULL && prev->lwb_state != LWB_STATE_FLUSH_DONE) {
+		ASSERT(prev->lwb_state == LWB_STATE_ISSUED ||
+		    prev->lwb_state == LWB_STATE_WRITE_DONE);
 
-		ASSERT3P(last_lwb_opened->lwb_root_zio, !=, NULL);
-		zio_add_child(lwb->lwb_root_zio,
-		    last_lwb_opened->lwb_root_zio);
+		ASSERT3P(prev->lwb_root_zio, !=, NULL);
+		zio_add_child(lwb->lwb_root_zio, prev->lwb_root_zio);
 
 		/*
 		 * If the previous lwb's write hasn't already completed,
@@ -1336,13 +1470,10 @@ zil_lwb_set_zio_dependency(zilog_t *zilog, lwb_t *lwb)
 		 * vdevs are flushed in the lwb write zio's completion
 		 * handler, zil_lwb_write_done()).
 		 */
-		if (last_lwb_opened->lwb_state != LWB_STATE_WRITE_DONE) {
-			ASSERT(last_lwb_opened->lwb_state == LWB_STATE_OPENED ||
-			    last_lwb_opened->lwb_state == LWB_STATE_ISSUED);
-
-			ASSERT3P(last_lwb_opened->lwb_write_zio, !=, NULL);
-			zio_add_child(lwb->lwb_write_zio,
-			    last_lwb_opened->lwb_write_zio);
+		if (prev->lwb_state != LWB_STATE_WRITE_DONE) {
+			ASSERT3S(prev->lwb_state, ==, LWB_STATE_ISSUED);
+			ASSERT3P(prev->lwb_write_zio, !=, NULL);
+			zio_add_child(lwb->lwb_write_zio, prev->lwb_write_zio);
 		}
 	}
 }
@@ -1350,79 +1481,27 @@ zil_lwb_set_zio_dependency(zilog_t *zilog, lwb_t *lwb)
 
 /*
  * This function's purpose is to "open" an lwb such that it is ready to
- * accept new itxs being committed to it. To do this, the lwb's zio
- * structures are created, and linked to the lwb. This function is
- * idempotent; if the passed in lwb has already been opened, this
- * function is essentially a no-op.
+ * accept new itxs being assigned to it. This function is idempotent; if
+ * the passed in lwb has already been opened, this function is
+ * essentially a no-op.
  */
 static void
 zil_lwb_write_open(zilog_t *zilog, lwb_t *lwb)
 {
-	zbookmark_phys_t zb;
-	zio_priority_t prio;
-
 	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
 	ASSERT3P(lwb, !=, NULL);
-	EQUIV(lwb->lwb_root_zio == NULL, lwb->lwb_state == LWB_STATE_CLOSED);
-	EQUIV(lwb->lwb_root_zio != NULL, lwb->lwb_state == LWB_STATE_OPENED);
 
-	SET_BOOKMARK(&zb, lwb->lwb_blk.blk_cksum.zc_word[ZIL_ZC_OBJSET],
-	    ZB_ZIL_OBJECT, ZB_ZIL_LEVEL,
-	    lwb->lwb_blk.blk_cksum.zc_word[ZIL_ZC_SEQ]);
+	if (lwb->lwb_state != LWB_STATE_NEW) {
+		ASSERT3S(lwb->lwb_state, ==, LWB_STATE_OPENED);
+		return;
+	}
 
-	/* Lock so zil_sync() doesn't fastwrite_unmark after zio is created */
 	mutex_enter(&zilog->zl_lock);
-	if (lwb->lwb_root_zio == NULL) {
-		abd_t *lwb_abd = abd_get_from_buf(lwb->lwb_buf,
-		    BP_GET_LSIZE(&lwb->lwb_blk));
-
-		if (!lwb->lwb_fastwrite) {
-			metaslab_fastwrite_mark(zilog->zl_spa, &lwb->lwb_blk);
-			lwb->lwb_fastwrite = 1;
-		}
-
-		if (!lwb->lwb_slog || zilog->zl_cur_used <= zil_slog_bulk)
-			prio = ZIO_PRIORITY_SYNC_WRITE;
-		else
-			prio = ZIO_PRIORITY_ASYNC_WRITE;
-
-		lwb->lwb_root_zio = zio_root(zilog->zl_spa,
-		    zil_lwb_flush_vdevs_done, lwb, ZIO_FLAG_CANFAIL);
-		ASSERT3P(lwb->lwb_root_zio, !=, NULL);
-
-		lwb->lwb_write_zio = zio_rewrite(lwb->lwb_root_zio,
-		    zilog->zl_spa, 0, &lwb->lwb_blk, lwb_abd,
-		    BP_GET_LSIZE(&lwb->lwb_blk), zil_lwb_write_done, lwb,
-		    prio, ZIO_FLAG_CANFAIL | ZIO_FLAG_DONT_PROPAGATE |
-		    ZIO_FLAG_FASTWRITE, &zb);
-		ASSERT3P(lwb->lwb_write_zio, !=, NULL);
-
-		lwb->lwb_state = LWB_STATE_OPENED;
-
-		zil_lwb_set_zio_dependency(zilog, lwb);
-		zilog->zl_last_lwb_opened = lwb;
-	}
+	lwb->lwb_state = LWB_STATE_OPENED;
+	zilog->zl_last_lwb_opened = lwb;
 	mutex_exit(&zilog->zl_lock);
-
-	ASSERT3P(lwb->lwb_root_zio, !=, NULL);
-	ASSERT3P(lwb->lwb_write_zio, !=, NULL);
-	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_OPENED);
 }
 
-/*
- * Define a limited set of intent log block sizes.
- *
- * These must be a multiple of 4KB. Note only the amount used (again
- * aligned to 4KB) actually gets written. However, we can't always just
- * allocate SPA_OLD_MAXBLOCKSIZE as the slog space could be exhausted.
- */
-uint64_t zil_block_buckets[] = {
-    4096,		/* non TX_WRITE */
-    8192+4096,		/* data base */
-    32*1024 + 4096, 	/* NFS writes */
-    UINT64_MAX
-};
-
 /*
  * Maximum block size used by the ZIL.  This is picked up when the ZIL is
  * initialized.  Otherwise this should not be used directly; see
@@ -1431,140 +1510,97 @@ uint64_t zil_block_buckets[] = {
 int zil_maxblocksize = SPA_OLD_MAXBLOCKSIZE;
 
 /*
- * Start a log block write and advance to the next log block.
+ * Maximum block size used by the ZIL on pools with separate log devices,
+ * where large log blocks don't compete with the pool's data for space.
+ * Large commits then need fewer log blocks, and thus fewer writes. It is
+ * capped by the pool's maximum block size, and never lowers the limit
+ * set by zil_maxblocksize.
+ */
+int zil_slog_maxblocksize = 1024 * 1024;
+
+/*
+ * Pick the size of the next log block from the sizes of the recent
+ * commits. Ideally each commit is written out in as few lwbs as
+ * possible, without leaving much unused space at their ends (unused
+ * space of slim lwbs isn't written, but it still has to be allocated,
+ * and that of the other lwbs is written as zeroes):
+ * - the largest of the recent commits, less what the current commit
+ *   has already been assigned, is taken as the amount of log data still
+ *   to come. Taking the largest lessens the picket fence effect of
+ *   wrongly guessing the size if we have a stream of say 2k, 64k, 2k,
+ *   64k commits. A commit larger than any recent one is expected to
+ *   keep going for as much again.
+ * - if that doesn't fit in one block of the maximum size, it is spread
+ *   evenly over the fewest blocks it fits in, rather than leaving a
+ *   small tail for the last one.
+ * - the block must be able to hold the largest record of the current
+ *   commit, as the record which made us close the previous lwb has to
+ *   fit in this one.
+ *
+ * We can't just allocate the maximum block size because we can exhaust
+ * the available pool log space.
+ */
+static uint64_t
+zil_lwb_predict(zilog_t *zilog)
+{
+	uint64_t expect = 0, max_data, nblks, blksz;
+
+	for (int i = 0; i < ZIL_PREV_COMMITS; i++)
+		expect = MAX(expect, zilog->zl_prev_commits[i]);
+	if (expect > zilog->zl_cur_size)
+		expect -= zilog->zl_cur_size;
+	else
+		expect = zilog->zl_cur_size;
+
+	max_data = zilog->zl_max_block_size - sizeof (zil_chain_t);
+	nblks = MAX(howmany(expect, max_data), 1);
+	blksz = MAX(expect / nblks, zilog->zl_cur_max) + sizeof (zil_chain_t);
+	blksz = P2ROUNDUP_TYPED(blksz, ZIL_MIN_BLKSZ, uint64_t);
+
+	return (MIN(blksz, zilog->zl_max_block_size));
+}
+
+/*
+ * Close the lwb to further itx assignments and advance to the next log
+ * block, which will be sized based on the amount of log data recently
+ * committed. The closed lwb is appended to "ilwbs"; the caller must
+ * pass it to zil_lwb_write_issue() once it has dropped zl_issuer_lock.
  * Calls are serialized.
  */
 static lwb_t *
-zil_lwb_write_issue(zilog_t *zilog, lwb_t *lwb)
+zil_lwb_write_close(zilog_t *zilog, lwb_t *lwb, list_t *ilwbs)
 {
-	lwb_t *nlwb = NULL;
-	zil_chain_t *zilc;
-	spa_t *spa = zilog->zl_spa;
-	blkptr_t *bp;
-	dmu_tx_t *tx;
-	uint64_t txg;
-	uint64_t zil_blksz, wsz;
-	int i, error;
-	boolean_t slog;
+	int error;
 
 	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
-	ASSERT3P(lwb->lwb_root_zio, !=, NULL);
-	ASSERT3P(lwb->lwb_write_zio, !=, NULL);
 	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_OPENED);
-
-	if (BP_GET_CHECKSUM(&lwb->lwb_blk) == ZIO_CHECKSUM_ZILOG2) {
-		zilc = (zil_chain_t *)lwb->lwb_buf;
-		bp = &zilc->zc_next_blk;
-	} else {
-		zilc = (zil_chain_t *)(lwb->lwb_buf + lwb->lwb_sz);
-		bp = &zilc->zc_next_blk;
-	}
-
 	ASSERT(lwb->lwb_nused <= lwb->lwb_sz);
 
-	/*
-	 * Allocate the next block and save its address in this block
-	 * before writing it in order to establish the log chain.
-	 * Note that if the allocation of nlwb synced before we wrote
-	 * the block that points at it (lwb), we'd leak it if we crashed.
-	 * Therefore, we don't do dmu_tx_commit() until zil_lwb_write_done().
-	 * We dirty the dataset to ensure that zil_sync() will be called
-	 * to clean up in the event of allocation failure or I/O failure.
-	 */
-
-	tx = dmu_tx_create(zilog->zl_os);
-
-	/*
-	 * Since we are not going to create any new dirty data, and we
-	 * can even help with clearing the existing dirty data, we
-	 * should not be subject to the dirty data based delays. We
-	 * use TXG_NOTHROTTLE to bypass the delay mechanism.
-	 */
-	VERIFY0(dmu_tx_assign(tx, TXG_WAIT | TXG_NOTHROTTLE));
-
-	dsl_dataset_dirty(dmu_objset_ds(zilog->zl_os), tx);
-	txg = dmu_tx_get_txg(tx);
-
-	lwb->lwb_tx = tx;
-
-	/*
-	 * Log blocks are pre-allocated. Here we select the size of the next
-	 * block, based on size used in the last block.
-	 * - first find the smallest bucket that will fit the block from a
-	 *   limited set of block sizes. This is because it's faster to write
-	 *   blocks allocated from the same metaslab as they are adjacent or
-	 *   close.
-	 * - next find the maximum from the new suggested size and an array of
-	 *   previous sizes. This lessens a picket fence effect of wrongly
-	 *   guessing the size if we have a stream of say 2k, 64k, 2k, 64k
-	 *   requests.
-	 *
-	 * Note we only write what is used, but we can't just allocate
-	 * the maximum block size because we can exhaust the available
-	 * pool log space.
-	 */
-	zil_blksz = zilog->zl_cur_used + sizeof (zil_chain_t);
-	for (i = 0; zil_blksz > zil_block_buckets[i]; i++)
-		continue;
-	zil_blksz = MIN(zil_block_buckets[i], zilog->zl_max_block_size);
-	zilog->zl_prev_blks[zilog->zl_prev_rotor] = zil_blksz;
-	for (i = 0; i < ZIL_PREV_BLKS; i++)
-		zil_blksz = MAX(zil_blksz, zilog->zl_prev_blks[i]);
-	zilog->zl_prev_rotor = (zilog->zl_prev_rotor + 1) & (ZIL_PREV_BLKS - 1);
-
-	BP_ZERO(bp);
-	error = zio_alloc_zil(spa, zilog->zl_os, txg, bp, zil_blksz, &slog);
-	if (slog) {
-		ZIL_STAT_BUMP(zil_itx_metaslab_slog_count);
-		ZIL_STAT_INCR(zil_itx_metaslab_slog_bytes, lwb->lwb_nused);
-	} else {
-		ZIL_STAT_BUMP(zil_itx_metaslab_normal_count);
-		ZIL_STAT_INCR(zil_itx_metaslab_normal_bytes, lwb->lwb_nused);
-	}
-	if (error == 0) {
-		ASSERT3U(bp->blk_birth, ==, txg);
-		bp->blk_cksum = lwb->lwb_blk.blk_cksum;
-		bp->blk_cksum.zc_word[ZIL_ZC_SEQ]++;
-
-		/*
-		 * Allocate a new log write block (lwb).
-		 */
-		nlwb = zil_alloc_lwb(zilog, bp, slog, txg, TRUE);
-	}
-
-	if (BP_GET_CHECKSUM(&lwb->lwb_blk) == ZIO_CHECKSUM_ZILOG2) {
-		/* For Slim ZIL only write what is used. */
-		wsz = P2ROUNDUP_TYPED(lwb->lwb_nused, ZIL_MIN_BLKSZ, uint64_t);
-		ASSERT3U(wsz, <=, lwb->lwb_sz);
-		zio_shrink(lwb->lwb_write_zio, wsz);
-
-	} else {
-		wsz = lwb->lwb_sz;
-	}
+	mutex_enter(&zilog->zl_lock);
+	lwb->lwb_state = LWB_STATE_CLOSED;
+	error = lwb->lwb_error;
+	mutex_exit(&zilog->zl_lock);
 
-	zilc->zc_pad = 0;
-	zilc->zc_nused = lwb->lwb_nused;
-	zilc->zc_eck.zec_cksum = lwb->lwb_blk.blk_cksum;
+	list_insert_tail(ilwbs, lwb);
 
 	/*
-	 * clear unused data for security
+	 * If the allocation of this lwb's block has already failed, there
+	 * is no point in starting another one; returning NULL forces the
+	 * caller to call zil_commit_writer_stall(). This is inherently
+	 * racy, since the allocation may not have happened yet; if it
+	 * fails later, the error is propagated along the chain of lwbs
+	 * by zil_lwb_write_issue().
 	 */
-	bzero(lwb->lwb_buf + lwb->lwb_nused, wsz - lwb->lwb_nused);
-
-	spa_config_enter(zilog->zl_spa, SCL_STATE, lwb, RW_READER);
-
-	zil_lwb_add_block(lwb, &lwb->lwb_blk);
-	lwb->lwb_issued_timestamp = gethrtime();
-	lwb->lwb_state = LWB_STATE_ISSUED;
-
-	zio_nowait(lwb->lwb_root_zio);
-	zio_nowait(lwb->lwb_write_zio);
+	if (error != 0)
+		return (NULL);
 
 	/*
-	 * If there was an allocation failure then nlwb will be null which
-	 * forces a txg_wait_synced().
+	 * Allocate a new log write block (lwb), sized by
+	 * zil_lwb_predict(). Its on-disk block will be allocated when
+	 * this lwb is issued.
 	 */
-	return (nlwb);
+	return (zil_alloc_lwb(zilog, zil_lwb_predict(zilog), NULL, B_FALSE,
+	    0, B_FALSE));
 }
 
 /*
@@ -1592,22 +1628,51 @@ zil_max_waste_space(zilog_t *zilog)
  * must fall back to WR_NEED_COPY if we can't fit the entire record into one
  * maximum sized log block, because each WR_COPIED record must fit in a
  * single log block.  For space efficiency, we want to fit two records into a
- * max-sized log block.
+ * max-sized log block.  The larger log blocks used on separate log devices
+ * don't raise this limit, so as not to hold more data in the itxs.
  */
 uint64_t
 zil_max_copied_data(zilog_t *zilog)
 {
-	return ((zilog->zl_max_block_size - sizeof (zil_chain_t)) / 2 -
-	    sizeof (lr_write_t));
+	uint64_t blksz = MIN(zilog->zl_max_block_size,
+	    MAX(zil_maxblocksize, SPA_OLD_MAXBLOCKSIZE));
+
+	return ((blksz - sizeof (zil_chain_t)) / 2 - sizeof (lr_write_t));
+}
+
+/*
+ * Create a copy of a WR_NEED_COPY itx, so that its data can be split
+ * across multiple lwbs; each lwb gets its own itx for its part of the
+ * data. Only the original itx keeps the callback, which is called once
+ * the last part of the data is committed.
+ */
+static itx_t *
+zil_itx_clone(itx_t *oitx)
+{
+	itx_t *itx = zio_data_buf_alloc(oitx->itx_size);
+
+	bcopy(oitx, itx, oitx->itx_size);
+	list_link_init(&itx->itx_node);
+	itx->itx_callback = NULL;
+	itx->itx_callback_data = NULL;
+
+	return (itx);
 }
 
+/*
+ * Assign an itx to the lwb, i.e. reserve space in the lwb's buffer for
+ * its log record and assign it a log record sequence number. The record
+ * itself is only copied into the buffer by zil_lwb_commit(), once the
+ * lwb has been closed. Any lwbs that get closed while doing this are
+ * appended to "ilwbs", in chain order.
+ */
 static lwb_t *
-zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
+zil_lwb_assign(zilog_t *zilog, lwb_t *lwb, itx_t *itx, list_t *ilwbs)
 {
-	lr_t *lrcb, *lrc;
-	lr_write_t *lrwb, *lrw;
-	char *lr_buf;
-	uint64_t dlen, dnow, lwb_sp, reclen, txg, max_log_data;
+	itx_t *citx;
+	lr_t *lrc;
+	lr_write_t *lrw, *clrw;
+	uint64_t dlen, dnow, lwb_sp, reclen, max_log_data;
 
 	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
 	ASSERT3P(lwb, !=, NULL);
@@ -1635,6 +1700,21 @@ zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
 		zil_commit_waiter_link_lwb(itx->itx_private, lwb);
 		itx->itx_private = NULL;
 		mutex_exit(&zilog->zl_lock);
+		list_insert_tail(&lwb->lwb_itxs, itx);
+
+		/*
+		 * This ends a commit; remember its size for
+		 * zil_lwb_predict(). Consecutive commit itxs end the
+		 * same commit.
+		 */
+		if (zilog->zl_cur_size != 0) {
+			zilog->zl_prev_commits[zilog->zl_prev_rotor] =
+			    zilog->zl_cur_size;
+			zilog->zl_prev_rotor = (zilog->zl_prev_rotor + 1) &
+			    (ZIL_PREV_COMMITS - 1);
+			zilog->zl_cur_size = 0;
+			zilog->zl_cur_max = 0;
+		}
 		return (lwb);
 	}
 
@@ -1646,7 +1726,8 @@ zil_lwb_commit(zilog_t *zilog, itx_t *itx, lwb_t *lwb)
 	}
 	reclen = lrc->lrc_reclen;
 	zilog->zl_cur_used += (reclen + dlen);
-	txg = lrc->lrc_txg;
+	zilog->zl_cur_size += (reclen + dlen);
+	zilog->zl_cur_max = MAX(zilog->zl_cur_max, reclen + dlen);
 
 	ASSERT3U(zilog->zl_cur_used, <, UINT64_MAX - (reclen + dlen));
 
@@ -1661,7 +1742,7 @@ cont:
 	    lwb_sp < zil_max_waste_space(zilog) &&
 	    (dlen % max_log_data == 0 ||
 	    lwb_sp < reclen + dlen % max_log_data))) {
-		lwb = zil_lwb_write_issue(zilog, lwb);
+		lwb = zil_lwb_write_close(zilog, lwb, ilwbs);
 		if (lwb == NULL)
 			return (NULL);
 		zil_lwb_write_open(zilog, lwb);
@@ -1680,8 +1761,83 @@ cont:
 		ASSERT3U(reclen + MIN(dlen, sizeof (uint64_t)), <=, lwb_sp);
 	}
 
+	/*
+	 * If the data doesn't fit into this lwb, split off the part that
+	 * does into a copy of the itx, and continue with the rest.
+	 */
 	dnow = MIN(dlen, lwb_sp - reclen);
-	lr_buf = lwb->lwb_buf + lwb->lwb_nused;
+	if (dlen > dnow) {
+		ASSERT3U(lrc->lrc_txtype, ==, TX_WRITE);
+		ASSERT3U(itx->itx_wr_state, ==, WR_NEED_COPY);
+		citx = zil_itx_clone(itx);
+		clrw = (lr_write_t *)&citx->itx_lr;
+		clrw->lr_length = dnow;
+		lrw->lr_offset += dnow;
+		lrw->lr_length -= dnow;
+	} else {
+		citx = itx;
+	}
+
+	/*
+	 * We're actually making an entry, so update lrc_seq to be the
+	 * log record sequence number.  Note that this is generally not
+	 * equal to the itx sequence number because not all transactions
+	 * are synchronous, and sometimes spa_sync() gets there first.
+	 */
+	citx->itx_lr.lrc_seq = ++zilog->zl_lr_seq;
+	lwb->lwb_nused += reclen + dnow;
+
+	zil_lwb_add_txg(lwb, lrc->lrc_txg);
+	list_insert_tail(&lwb->lwb_itxs, citx);
+
+	ASSERT3U(lwb->lwb_nused, <=, lwb->lwb_sz);
+	ASSERT0(P2PHASE(lwb->lwb_nused, sizeof (uint64_t)));
+
+	dlen -= dnow;
+	if (dlen > 0) {
+		zilog->zl_cur_used += reclen;
+		zilog->zl_cur_size += reclen;
+		goto cont;
+	}
+
+	return (lwb);
+}
+
+/*
+ * Copy the log record of an itx assigned to the lwb into the lwb's
+ * buffer, and fetch its data or get its blkptr as appropriate. This is
+ * called for each of the lwb's itxs, in the order they were assigned,
+ * without holding the zl_issuer_lock; if the data can't be fetched, the
+ * record is dropped and the following records move up in the buffer.
+ */
+static void
+zil_lwb_commit(zilog_t *zilog, lwb_t *lwb, itx_t *itx)
+{
+	lr_t *lrcb, *lrc;
+	lr_write_t *lrwb, *lrw;
+	char *lr_buf;
+	uint64_t dlen, reclen, txg;
+
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_CLOSED);
+
+	lrc = &itx->itx_lr;
+	lrw = (lr_write_t *)lrc;
+
+	if (lrc->lrc_txtype == TX_COMMIT)
+		return;
+
+	if (lrc->lrc_txtype == TX_WRITE && itx->itx_wr_state == WR_NEED_COPY) {
+		dlen = P2ROUNDUP_TYPED(
+		    lrw->lr_length, sizeof (uint64_t), uint64_t);
+	} else {
+		dlen = 0;
+	}
+	reclen = lrc->lrc_reclen;
+	txg = lrc->lrc_txg;
+
+	ASSERT3U(lwb->lwb_nfilled + reclen + dlen, <=, lwb->lwb_nused);
+
+	lr_buf = lwb->lwb_buf + lwb->lwb_nfilled;
 	bcopy(lrc, lr_buf, reclen);
 	lrcb = (lr_t *)lr_buf;		/* Like lrc, but inside lwb. */
 	lrwb = (lr_write_t *)lrcb;	/* Like lrw, but inside lwb. */
@@ -1703,13 +1859,9 @@ cont:
 
 			if (itx->itx_wr_state == WR_NEED_COPY) {
 				dbuf = lr_buf + reclen;
-				lrcb->lrc_reclen += dnow;
-				if (lrwb->lr_length > dnow)
-					lrwb->lr_length = dnow;
-				lrw->lr_offset += dnow;
-				lrw->lr_length -= dnow;
+				lrcb->lrc_reclen += dlen;
 				ZIL_STAT_BUMP(zil_itx_needcopy_count);
-				ZIL_STAT_INCR(zil_itx_needcopy_bytes, dnow);
+				ZIL_STAT_INCR(zil_itx_needcopy_bytes, dlen);
 			} else {
 				ASSERT3S(itx->itx_wr_state, ==, WR_INDIRECT);
 				dbuf = NULL;
@@ -1719,56 +1871,256 @@ cont:
 			}
 
 			/*
-			 * We pass in the "lwb_write_zio" rather than
-			 * "lwb_root_zio" so that the "lwb_write_zio"
-			 * becomes the parent of any zio's created by
-			 * the "zl_get_data" callback. The vdevs are
-			 * flushed after the "lwb_write_zio" completes,
-			 * so we want to make sure that completion
-			 * callback waits for these additional zio's,
-			 * such that the vdevs used by those zio's will
-			 * be included in the lwb's vdev tree, and those
-			 * vdevs will be properly flushed. If we passed
-			 * in "lwb_root_zio" here, then these additional
-			 * vdevs may not be flushed; e.g. if these zio's
-			 * completed after "lwb_write_zio" completed.
+			 * The lwb's write zio can't be created until its
+			 * block is allocated, so we pass in the
+			 * "lwb_child_zio" instead, which will become a child
+			 * of the "lwb_write_zio" once it's issued. This way,
+			 * the "lwb_write_zio" becomes the parent of any zio's
+			 * created by the "zl_get_data" callback. The vdevs
+			 * are flushed after the "lwb_write_zio" completes,
+			 * so we want to make sure that completion callback
+			 * waits for these additional zio's, such that the
+			 * vdevs used by those zio's will be included in the
+			 * lwb's vdev tree, and those vdevs will be properly
+			 * flushed. If we passed in "lwb_root_zio" here, then
+			 * these additional vdevs may not be flushed; e.g. if
+			 * these zio's completed after "lwb_write_zio"
+			 * completed.
 			 */
+			if (lwb->lwb_child_zio == NULL) {
+				lwb->lwb_child_zio = zio_null(NULL,
+				    zilog->zl_spa, NULL, NULL, NULL,
+				    ZIO_FLAG_CANFAIL);
+			}
+
 			error = zilog->zl_get_data(itx->itx_private,
-			    lrwb, dbuf, lwb, lwb->lwb_write_zio);
+			    lrwb, dbuf, lwb, lwb->lwb_child_zio);
 
 			if (error == EIO) {
 				txg_wait_synced(zilog->zl_dmu_pool, txg);
-				return (lwb);
+				return;
 			}
 			if (error != 0) {
 				ASSERT(error == ENOENT || error == EEXIST ||
 				    error == EALREADY);
-				return (lwb);
+				return;
 			}
 		}
 	}
 
+	lwb->lwb_nfilled += reclen + dlen;
+
+	ASSERT3U(lwb->lwb_nfilled, <=, lwb->lwb_nused);
+	ASSERT0(P2PHASE(lwb->lwb_nfilled, sizeof (uint64_t)));
+}
+
+/*
+ * Fill a closed lwb with the log records assigned to it, and start its
+ * write if its block has already been allocated. Otherwise the lwb is
+ * left "ready", and is issued by the thread issuing the previous lwb in
+ * the chain, right after allocating the block for it. This keeps the
+ * lwbs issued in chain order, while letting several threads fill the
+ * lwbs they have closed concurrently; as issuing an lwb allocates the
+ * block of the next one, a single call may issue a run of lwbs.
+ */
+static void
+zil_lwb_write_issue(zilog_t *zilog, lwb_t *lwb)
+{
+	spa_t *spa = zilog->zl_spa;
+	zil_chain_t *zilc;
+	zbookmark_phys_t zb;
+	zio_priority_t prio;
+	blkptr_t *bp;
+	dmu_tx_t *tx;
+	lwb_t *nlwb;
+	itx_t *itx;
+	uint64_t txg, wsz;
+	boolean_t slog;
+	int error;
+
+	ASSERT(!MUTEX_HELD(&zilog->zl_lock));
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_CLOSED);
+
+	for (itx = list_head(&lwb->lwb_itxs); itx != NULL;
+	    itx = list_next(&lwb->lwb_itxs, itx))
+		zil_lwb_commit(zilog, lwb, itx);
+	lwb->lwb_nused = lwb->lwb_nfilled;
+
+	mutex_enter(&zilog->zl_lock);
+	lwb->lwb_state = LWB_STATE_READY;
+	if (BP_IS_HOLE(&lwb->lwb_blk) && lwb->lwb_error == 0) {
+		mutex_exit(&zilog->zl_lock);
+		return;
+	}
+	mutex_exit(&zilog->zl_lock);
+
+next_lwb:
+	if (lwb->lwb_slim) {
+		zilc = (zil_chain_t *)lwb->lwb_buf;
+		bp = &zilc->zc_next_blk;
+	} else {
+		zilc = (zil_chain_t *)(lwb->lwb_buf + lwb->lwb_sz);
+		bp = &zilc->zc_next_blk;
+	}
+
+	ASSERT(lwb->lwb_nused <= lwb->lwb_sz);
+
 	/*
-	 * We're actually making an entry, so update lrc_seq to be the
-	 * log record sequence number.  Note that this is generally not
-	 * equal to the itx sequence number because not all transactions
-	 * are synchronous, and sometimes spa_sync() gets there first.
+	 * Allocate the next block and save its address in this block
+	 * before writing it in order to establish the log chain.
+	 * Note that if the allocation of nlwb synced before we wrote
+	 * the block that points at it (lwb), we'd leak it if we crashed.
+	 * Therefore, we don't do dmu_tx_commit() until zil_lwb_write_done().
+	 * We dirty the dataset to ensure that zil_sync() will be called
+	 * to clean up in the event of allocation failure or I/O failure.
 	 */
-	lrcb->lrc_seq = ++zilog->zl_lr_seq;
-	lwb->lwb_nused += reclen + dnow;
 
-	zil_lwb_add_txg(lwb, txg);
+	tx = dmu_tx_create(zilog->zl_os);
 
-	ASSERT3U(lwb->lwb_nused, <=, lwb->lwb_sz);
-	ASSERT0(P2PHASE(lwb->lwb_nused, sizeof (uint64_t)));
+	/*
+	 * Since we are not going to create any new dirty data, and we
+	 * can even help with clearing the existing dirty data, we
+	 * should not be subject to the dirty data based delays. We
+	 * use TXG_NOTHROTTLE to bypass the delay mechanism.
+	 */
+	VERIFY0(dmu_tx_assign(tx, TXG_WAIT | TXG_NOTHROTTLE));
 
-	dlen -= dnow;
-	if (dlen > 0) {
-		zilog->zl_cur_used += reclen;
-		goto cont;
+	dsl_dataset_dirty(dmu_objset_ds(zilog->zl_os), tx);
+	txg = dmu_tx_get_txg(tx);
+
+	lwb->lwb_tx = tx;
+
+	mutex_enter(&zilog->zl_lock);
+	nlwb = list_next(&zilog->zl_lwb_list, lwb);
+	mutex_exit(&zilog->zl_lock);
+
+	/*
+	 * If this lwb has no block, neither will the next one; the error
+	 * is passed along the chain so the waiters of all these lwbs fall
+	 * back to txg_wait_synced(), and zil_lwb_write_close() eventually
+	 * stalls the ZIL writer.
+	 */
+	BP_ZERO(bp);
+	slog = B_FALSE;
+	error = lwb->lwb_error;
+	IMPLY(error == 0, nlwb != NULL);
+	if (error == 0) {
+		hrtime_t start = gethrtime();
+		error = zio_alloc_zil(spa, zilog->zl_os, txg, bp,
+		    nlwb->lwb_slim ? nlwb->lwb_sz :
+		    nlwb->lwb_sz + sizeof (zil_chain_t), &slog);
+		zil_lat_add(zilog, ZIL_LAT_ALLOC, gethrtime() - start);
+	}
+	if (error == 0) {
+		ASSERT3U(bp->blk_birth, ==, txg);
+		BP_SET_CHECKSUM(bp, nlwb->lwb_slim ?
+		    ZIO_CHECKSUM_ZILOG2 : ZIO_CHECKSUM_ZILOG);
+		bp->blk_cksum = lwb->lwb_blk.blk_cksum;
+		bp->blk_cksum.zc_word[ZIL_ZC_SEQ]++;
 	}
 
-	return (lwb);
+	if (lwb->lwb_slim) {
+		/* For Slim ZIL only write what is used. */
+		wsz = P2ROUNDUP_TYPED(lwb->lwb_nused, ZIL_MIN_BLKSZ, uint64_t);
+		ASSERT3U(wsz, <=, lwb->lwb_sz);
+	} else {
+		wsz = lwb->lwb_sz;
+	}
+
+	zilc->zc_pad = 0;
+	zilc->zc_nused = lwb->lwb_nused;
+	zilc->zc_eck.zec_cksum = lwb->lwb_blk.blk_cksum;
+
+	/*
+	 * clear unused data for security
+	 */
+	bzero(lwb->lwb_buf + lwb->lwb_nused, wsz - lwb->lwb_nused);
+
+	if (!lwb->lwb_slog || zilog->zl_cur_used <= zil_slog_bulk)
+		prio = ZIO_PRIORITY_SYNC_WRITE;
+	else
+		prio = ZIO_PRIORITY_ASYNC_WRITE;
+
+	SET_BOOKMARK(&zb, lwb->lwb_blk.blk_cksum.zc_word[ZIL_ZC_OBJSET],
+	    ZB_ZIL_OBJECT, ZB_ZIL_LEVEL,
+	    lwb->lwb_blk.blk_cksum.zc_word[ZIL_ZC_SEQ]);
+
+	spa_config_enter(spa, SCL_STATE, lwb, RW_READER);
+
+	if (lwb->lwb_error == 0)
+		zil_lwb_add_block(lwb, &lwb->lwb_blk);
+
+	/* Lock so zil_sync() doesn't fastwrite_unmark after zio is created */
+	mutex_enter(&zilog->zl_lock);
+	lwb->lwb_root_zio = zio_root(spa, zil_lwb_flush_vdevs_done, lwb,
+	    ZIO_FLAG_CANFAIL);
+	ASSERT3P(lwb->lwb_root_zio, !=, NULL);
+
+	if (lwb->lwb_error == 0) {
+		abd_t *lwb_abd = abd_get_from_buf(lwb->lwb_buf,
+		    BP_GET_LSIZE(&lwb->lwb_blk));
+
+		if (!lwb->lwb_fastwrite) {
+			metaslab_fastwrite_mark(spa, &lwb->lwb_blk);
+			lwb->lwb_fastwrite = 1;
+		}
+
+		lwb->lwb_write_zio = zio_rewrite(lwb->lwb_root_zio, spa, 0,
+		    &lwb->lwb_blk, lwb_abd, BP_GET_LSIZE(&lwb->lwb_blk),
+		    zil_lwb_write_done, lwb, prio, ZIO_FLAG_CANFAIL |
+		    ZIO_FLAG_DONT_PROPAGATE | ZIO_FLAG_FASTWRITE, &zb);
+		if (lwb->lwb_slim)
+			zio_shrink(lwb->lwb_write_zio, wsz);
+	} else {
+		/*
+		 * We can't write the lwb if its block couldn't be
+		 * allocated, so create a null zio instead, just to
+		 * maintain the dependencies.
+		 */
+		lwb->lwb_write_zio = zio_null(lwb->lwb_root_zio, spa, NULL,
+		    zil_lwb_null_write_done, lwb, ZIO_FLAG_CANFAIL);
+	}
+	ASSERT3P(lwb->lwb_write_zio, !=, NULL);
+
+	if (lwb->lwb_child_zio != NULL)
+		zio_add_child(lwb->lwb_write_zio, lwb->lwb_child_zio);
+
+	zil_lwb_set_zio_dependency(zilog, lwb);
+	lwb->lwb_issued_timestamp = gethrtime();
+	lwb->lwb_state = LWB_STATE_ISSUED;
+
+	/*
+	 * Hand the block we just allocated over to the next lwb. If that
+	 * lwb is already filled, it is on us to issue it as well.
+	 */
+	if (nlwb != NULL) {
+		nlwb->lwb_blk = *bp;
+		nlwb->lwb_error = error;
+		nlwb->lwb_slog = slog;
+		nlwb->lwb_fastwrite = (error == 0);
+		nlwb->lwb_alloc_txg = txg;
+		if (nlwb->lwb_state != LWB_STATE_READY)
+			nlwb = NULL;
+	}
+	mutex_exit(&zilog->zl_lock);
+
+	if (lwb->lwb_slog) {
+		ZIL_STAT_BUMP(zil_itx_metaslab_slog_count);
+		ZIL_STAT_INCR(zil_itx_metaslab_slog_bytes, lwb->lwb_nused);
+	} else {
+		ZIL_STAT_BUMP(zil_itx_metaslab_normal_count);
+		ZIL_STAT_INCR(zil_itx_metaslab_normal_bytes, lwb->lwb_nused);
+	}
+
+	if (lwb->lwb_child_zio != NULL)
+		zio_nowait(lwb->lwb_child_zio);
+	zio_nowait(lwb->lwb_root_zio);
+	zio_nowait(lwb->lwb_write_zio);
+
+	if (nlwb != NULL) {
+		lwb = nlwb;
+		goto next_lwb;
+	}
 }
 
 itx_t *
@@ -1822,7 +2174,7 @@ zil_itxg_clean(itxs_t *itxs)
 		/*
 		 * In the general case, commit itxs will not be found
 		 * here, as they'll be committed to an lwb via
-		 * zil_lwb_commit(), and free'd in that function. Having
+		 * zil_lwb_assign(), and free'd when it's done. Having
 		 * said that, it is still possible for commit itxs to be
 		 * found here, due to the following race:
 		 *
@@ -1920,6 +2272,20 @@ zil_remove_async(zilog_t *zilog, uint64_t oid)
 	list_destroy(&clean_list);
 }
 
+/*
+ * Record a change made in the given txg which has no log record (e.g. a
+ * block clone).  zil_commit() makes it stable by waiting for the txg to
+ * sync.
+ */
+void
+zil_add_unlogged_txg(zilog_t *zilog, uint64_t txg)
+{
+	mutex_enter(&zilog->zl_lock);
+	if (txg > zilog->zl_unlogged_txg)
+		zilog->zl_unlogged_txg = txg;
+	mutex_exit(&zilog->zl_lock);
+}
+
 void
 zil_itx_assign(zilog_t *zilog, itx_t *itx, dmu_tx_t *tx)
 {
@@ -2210,7 +2576,9 @@ zil_commit_writer_stall(zilog_t *zilog)
 	 * We must hold the zilog's zl_issuer_lock while we do this, to
 	 * ensure no new threads enter zil_process_commit_list() until
 	 * all lwb's in the zl_lwb_list have been synced and freed
-	 * (which is achieved via the txg_wait_synced() call).
+	 * (which is achieved via the txg_wait_synced() call). The lwbs
+	 * closed by the calling thread must have been issued already, or
+	 * they would never be freed.
 	 */
 	ASSERT(MUTEX_HELD(&zilog->zl_issuer_lock));
 	txg_wait_synced(zilog->zl_dmu_pool, 0);
@@ -2219,12 +2587,14 @@ zil_commit_writer_stall(zilog_t *zilog)
 
 /*
  * This function will traverse the commit list, creating new lwbs as
- * needed, and committing the itxs from the commit list to these newly
+ * needed, and assigning the itxs from the commit list to these newly
  * created lwbs. Additionally, as a new lwb is created, the previous
- * lwb will be issued to the zio layer to be written to disk.
+ * lwb is closed and appended to "ilwbs"; the caller is responsible for
+ * issuing those to the zio layer via zil_lwb_write_issue(), after
+ * dropping the zl_issuer_lock.
  */
 static void
-zil_process_commit_list(zilog_t *zilog)
+zil_process_commit_list(zilog_t *zilog, list_t *ilwbs)
 {
 	spa_t *spa = zilog->zl_spa;
 	list_t nolwb_itxs;
@@ -2249,9 +2619,8 @@ zil_process_commit_list(zilog_t *zilog)
 	if (lwb == NULL) {
 		lwb = zil_create(zilog);
 	} else {
-		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_ISSUED);
-		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_WRITE_DONE);
-		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_FLUSH_DONE);
+		ASSERT(lwb->lwb_state == LWB_STATE_NEW ||
+		    lwb->lwb_state == LWB_STATE_OPENED);
 	}
 
 	while ((itx = list_head(&zilog->zl_itx_commit_list)) != NULL) {
@@ -2319,12 +2688,10 @@ zil_process_commit_list(zilog_t *zilog)
 		 */
 		if (frozen || !synced || lrc->lrc_txtype == TX_COMMIT) {
 			if (lwb != NULL) {
-				lwb = zil_lwb_commit(zilog, itx, lwb);
+				lwb = zil_lwb_assign(zilog, lwb, itx, ilwbs);
 
 				if (lwb == NULL)
 					list_insert_tail(&nolwb_itxs, itx);
-				else
-					list_insert_tail(&lwb->lwb_itxs, itx);
 			} else {
 				if (lrc->lrc_txtype == TX_COMMIT) {
 					zil_commit_waiter_link_nolwb(
@@ -2344,8 +2711,14 @@ zil_process_commit_list(zilog_t *zilog)
 		 * This indicates zio_alloc_zil() failed to allocate the
 		 * "next" lwb on-disk. When this happens, we must stall
 		 * the ZIL write pipeline; see the comment within
-		 * zil_commit_writer_stall() for more details.
+		 * zil_commit_writer_stall() for more details. The lwbs
+		 * we've closed have to be issued first, so they can
+		 * complete.
 		 */
+		while ((lwb = list_head(ilwbs)) != NULL) {
+			list_remove(ilwbs, lwb);
+			zil_lwb_write_issue(zilog, lwb);
+		}
 		zil_commit_writer_stall(zilog);
 
 		/*
@@ -2372,16 +2745,15 @@ zil_process_commit_list(zilog_t *zilog)
 	} else {
 		ASSERT(list_is_empty(&nolwb_waiters));
 		ASSERT3P(lwb, !=, NULL);
-		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_ISSUED);
-		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_WRITE_DONE);
-		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_FLUSH_DONE);
+		ASSERT(lwb->lwb_state == LWB_STATE_NEW ||
+		    lwb->lwb_state == LWB_STATE_OPENED);
 
 		/*
 		 * At this point, the ZIL block pointed at by the "lwb"
-		 * variable is in one of the following states: "closed"
+		 * variable is in one of the following states: "new"
 		 * or "open".
 		 *
-		 * If it's "closed", then no itxs have been committed to
+		 * If it's "new", then no itxs have been committed to
 		 * it, so there's no point in issuing its zio (i.e. it's
 		 * "empty").
 		 *
@@ -2394,14 +2766,14 @@ zil_process_commit_list(zilog_t *zilog)
 		 * 1. Ideally, there will be more ZIL activity occurring
 		 * on the system, such that this function will be
 		 * immediately called again (not necessarily by the same
-		 * thread) and this lwb's zio will be issued via
-		 * zil_lwb_commit(). This way, the lwb is guaranteed to
+		 * thread) and this lwb will be closed and issued via
+		 * zil_lwb_assign(). This way, the lwb is guaranteed to
 		 * be "full" when it is issued to disk, and we'll make
 		 * use of the lwb's size the best we can.
 		 *
 		 * 2. If there isn't sufficient ZIL activity occurring on
 		 * the system, such that this lwb's zio isn't issued via
-		 * zil_lwb_commit(), zil_commit_waiter() will issue the
+		 * zil_lwb_assign(), zil_commit_waiter() will issue the
 		 * lwb's zio. If this occurs, the lwb is not guaranteed
 		 * to be "full" by the time its zio is issued, and means
 		 * the size of the lwb was "too large" given the amount
@@ -2443,9 +2815,14 @@ zil_process_commit_list(zilog_t *zilog)
 static void
 zil_commit_writer(zilog_t *zilog, zil_commit_waiter_t *zcw)
 {
+	list_t ilwbs;
+	lwb_t *lwb;
+	hrtime_t start;
+
 	ASSERT(!MUTEX_HELD(&zilog->zl_lock));
 	ASSERT(spa_writeable(zilog->zl_spa));
 
+	list_create(&ilwbs, sizeof (lwb_t), offsetof(lwb_t, lwb_issue_node));
 	mutex_enter(&zilog->zl_issuer_lock);
 
 	if (zcw->zcw_lwb != NULL || zcw->zcw_done) {
@@ -2470,39 +2847,56 @@ zil_commit_writer(zilog_t *zilog, zil_commit_waiter_t *zcw)
 
 	ZIL_STAT_BUMP(zil_commit_writer_count);
 
+	start = gethrtime();
 	zil_get_commit_list(zilog);
+	zil_lat_add(zilog, ZIL_LAT_COMMIT_LIST, gethrtime() - start);
+
+	start = gethrtime();
 	zil_prune_commit_list(zilog);
-	zil_process_commit_list(zilog);
+	zil_process_commit_list(zilog, &ilwbs);
+	zil_lat_add(zilog, ZIL_LAT_ASSIGN, gethrtime() - start);
 
 out:
 	mutex_exit(&zilog->zl_issuer_lock);
+
+	/*
+	 * Now that other threads can assign their itxs to the following
+	 * lwbs, copy the log records into the lwbs we've closed, and
+	 * issue them.
+	 */
+	while ((lwb = list_head(&ilwbs)) != NULL) {
+		list_remove(&ilwbs, lwb);
+		zil_lwb_write_issue(zilog, lwb);
+	}
+	list_destroy(&ilwbs);
 }
 
 static void
 zil_commit_waiter_timeout(zilog_t *zilog, zil_commit_waiter_t *zcw)
 {
+	list_t ilwbs;
+
 	ASSERT(!MUTEX_HELD(&zilog->zl_issuer_lock));
 	ASSERT(MUTEX_HELD(&zcw->zcw_lock));
 	ASSERT3B(zcw->zcw_done, ==, B_FALSE);
 
 	lwb_t *lwb = zcw->zcw_lwb;
 	ASSERT3P(lwb, !=, NULL);
-	ASSERT3S(lwb->lwb_state, !=, LWB_STATE_CLOSED);
+	ASSERT3S(lwb->lwb_state, !=, LWB_STATE_NEW);
 
 	/*
-	 * If the lwb has already been issued by another thread, we can
+	 * If the lwb has already been closed by another thread, we can
 	 * immediately return since there's no work to be done (the
-	 * point of this function is to issue the lwb). Additionally, we
-	 * do this prior to acquiring the zl_issuer_lock, to avoid
-	 * acquiring it when it's not necessary to do so.
+	 * point of this function is to close and issue the lwb; once
+	 * closed, the lwb is issued by the thread that closed it).
+	 * Additionally, we do this prior to acquiring the zl_issuer_lock,
+	 * to avoid acquiring it when it's not necessary to do so.
 	 */
-	if (lwb->lwb_state == LWB_STATE_ISSUED ||
-	    lwb->lwb_state == LWB_STATE_WRITE_DONE ||
-	    lwb->lwb_state == LWB_STATE_FLUSH_DONE)
+	if (lwb->lwb_state != LWB_STATE_OPENED)
 		return;
 
 	/*
-	 * In order to call zil_lwb_write_issue() we must hold the
+	 * In order to call zil_lwb_write_close() we must hold the
 	 * zilog's "zl_issuer_lock". We can't simply acquire that lock,
 	 * since we're already holding the commit waiter's "zcw_lock",
 	 * and those two locks are acquired in the opposite order
@@ -2520,8 +2914,10 @@ zil_commit_waiter_timeout(zilog_t *zilog, zil_commit_waiter_t *zcw)
 	 * the waiter is marked "done"), so without this check we could
 	 * wind up with a use-after-free error below.
 	 */
-	if (zcw->zcw_done)
-		goto out;
+	if (zcw->zcw_done) {
+		mutex_exit(&zilog->zl_issuer_lock);
+		return;
+	}
 
 	ASSERT3P(lwb, ==, zcw->zcw_lwb);
 
@@ -2531,26 +2927,24 @@ zil_commit_waiter_timeout(zilog_t *zilog, zil_commit_waiter_t *zcw)
 	 * second time while holding the lock.
 	 *
 	 * We don't need to hold the zl_lock since the lwb cannot transition
-	 * from OPENED to ISSUED while we hold the zl_issuer_lock. The lwb
-	 * _can_ transition from ISSUED to DONE, but it's OK to race with
-	 * that transition since we treat the lwb the same, whether it's in
-	 * the ISSUED or DONE states.
+	 * from OPENED to CLOSED while we hold the zl_issuer_lock. The lwb
+	 * _can_ transition from CLOSED to ISSUED and DONE, but it's OK to
+	 * race with that transition since we treat the lwb the same,
+	 * whether it's in the CLOSED, ISSUED or DONE states.
 	 *
 	 * The important thing, is we treat the lwb differently depending on
-	 * if it's ISSUED or OPENED, and block any other threads that might
-	 * attempt to issue this lwb. For that reason we hold the
+	 * if it's CLOSED or OPENED, and block any other threads that might
+	 * attempt to close this lwb. For that reason we hold the
 	 * zl_issuer_lock when checking the lwb_state; we must not call
-	 * zil_lwb_write_issue() if the lwb had already been issued.
+	 * zil_lwb_write_close() if the lwb had already been closed.
 	 *
 	 * See the comment above the lwb_state_t structure definition for
 	 * more details on the lwb states, and locking requirements.
 	 */
-	if (lwb->lwb_state == LWB_STATE_ISSUED ||
-	    lwb->lwb_state == LWB_STATE_WRITE_DONE ||
-	    lwb->lwb_state == LWB_STATE_FLUSH_DONE)
-		goto out;
-
-	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_OPENED);
+	if (lwb->lwb_state != LWB_STATE_OPENED) {
+		mutex_exit(&zilog->zl_issuer_lock);
+		return;
+	}
 
 	/*
 	 * As described in the comments above zil_commit_waiter() and
@@ -2558,55 +2952,63 @@ zil_commit_waiter_timeout(zilog_t *zilog, zil_commit_waiter_t *zcw)
 	 * since we've reached the commit waiter's timeout and it still
 	 * hasn't been issued.
 	 */
-	lwb_t *nlwb = zil_lwb_write_issue(zilog, lwb);
+	list_create(&ilwbs, sizeof (lwb_t), offsetof(lwb_t, lwb_issue_node));
+	lwb_t *nlwb = zil_lwb_write_close(zilog, lwb, &ilwbs);
+	VERIFY3P(list_remove_head(&ilwbs), ==, lwb);
+	list_destroy(&ilwbs);
 
-	IMPLY(nlwb != NULL, lwb->lwb_state != LWB_STATE_OPENED);
+	ASSERT3S(lwb->lwb_state, ==, LWB_STATE_CLOSED);
 
 	/*
 	 * Since the lwb's zio hadn't been issued by the time this thread
-	 * reached its timeout, we reset the zilog's "zl_cur_used" field
-	 * to influence the zil block size selection algorithm.
+	 * reached its timeout, we reset the zilog's "zl_cur_used" field,
+	 * so the following lwbs are written with synchronous priority
+	 * again (see zil_slog_bulk).
 	 *
 	 * By having to issue the lwb's zio here, it means the size of the
-	 * lwb was too large, given the incoming throughput of itxs.  By
-	 * setting "zl_cur_used" to zero, we communicate this fact to the
-	 * block size selection algorithm, so it can take this information
-	 * into account, and potentially select a smaller size for the
-	 * next lwb block that is allocated.
+	 * lwb was too large, given the incoming throughput of itxs. The
+	 * block size selection algorithm (see zil_lwb_predict()) already
+	 * takes this into account, as it follows the sizes of the recent
+	 * commits rather than that of the lwbs.
 	 */
 	zilog->zl_cur_used = 0;
 
+	/*
+	 * We must drop the commit waiter's lock prior to issuing the lwb
+	 * or calling zil_commit_writer_stall(), or else we can wind up
+	 * with the following deadlock:
+	 *
+	 * - This thread is waiting for the txg to sync while holding
+	 *   the waiter's lock; txg_wait_synced() is used within
+	 *   zil_commit_writer_stall(), and when copying the log records
+	 *   of itxs whose data couldn't be read into the lwb.
+	 *
+	 * - The txg can't sync because it is waiting for a previous
+	 *   lwb's zio callback to call dmu_tx_commit().
+	 *
+	 * - The lwb's zio callback can't call dmu_tx_commit() because
+	 *   it's blocked trying to acquire the waiter's lock, which
+	 *   occurs prior to calling dmu_tx_commit()
+	 */
+	mutex_exit(&zcw->zcw_lock);
+
 	if (nlwb == NULL) {
 		/*
-		 * When zil_lwb_write_issue() returns NULL, this
+		 * When zil_lwb_write_close() returns NULL, this
 		 * indicates zio_alloc_zil() failed to allocate the
 		 * "next" lwb on-disk. When this occurs, the ZIL write
 		 * pipeline must be stalled; see the comment within the
 		 * zil_commit_writer_stall() function for more details.
-		 *
-		 * We must drop the commit waiter's lock prior to
-		 * calling zil_commit_writer_stall() or else we can wind
-		 * up with the following deadlock:
-		 *
-		 * - This thread is waiting for the txg to sync while
-		 *   holding the waiter's lock; txg_wait_synced() is
-		 *   used within txg_commit_writer_stall().
-		 *
-		 * - The txg can't sync because it is waiting for this
-		 *   lwb's zio callback to call dmu_tx_commit().
-		 *
-		 * - The lwb's zio callback can't call dmu_tx_commit()
-		 *   because it's blocked trying to acquire the waiter's
-		 *   lock, which occurs prior to calling dmu_tx_commit()
 		 */
-		mutex_exit(&zcw->zcw_lock);
+		zil_lwb_write_issue(zilog, lwb);
 		zil_commit_writer_stall(zilog);
-		mutex_enter(&zcw->zcw_lock);
+		mutex_exit(&zilog->zl_issuer_lock);
+	} else {
+		mutex_exit(&zilog->zl_issuer_lock);
+		zil_lwb_write_issue(zilog, lwb);
 	}
 
-out:
-	mutex_exit(&zilog->zl_issuer_lock);
-	ASSERT(MUTEX_HELD(&zcw->zcw_lock));
+	mutex_enter(&zcw->zcw_lock);
 }
 
 /*
@@ -2620,10 +3022,10 @@ out:
  *    waited "long enough" and the lwb is still in the "open" state.
  *
  * Given a sufficient amount of itxs being generated and written using
- * the ZIL, the lwb's zio will be issued via the zil_lwb_commit()
- * function. If this does not occur, this secondary responsibility will
- * ensure the lwb is issued even if there is not other synchronous
- * activity on the system.
+ * the ZIL, the lwb will be closed via the zil_lwb_assign() function,
+ * and issued by the thread that closed it. If this does not occur,
+ * this secondary responsibility will ensure the lwb is issued even if
+ * there is not other synchronous activity on the system.
  *
  * For more details, see zil_process_commit_list(); more specifically,
  * the comment at the bottom of that function.
@@ -2671,7 +3073,7 @@ zil_commit_waiter(zilog_t *zilog, zil_commit_waiter_t *zcw)
 		 * where it's "zcw_lwb" field is NULL, and it hasn't yet
 		 * been skipped, so it's "zcw_done" field is still B_FALSE.
 		 */
-		IMPLY(lwb != NULL, lwb->lwb_state != LWB_STATE_CLOSED);
+		IMPLY(lwb != NULL, lwb->lwb_state != LWB_STATE_NEW);
 
 		if (lwb != NULL && lwb->lwb_state == LWB_STATE_OPENED) {
 			ASSERT3B(timedout, ==, B_FALSE);
@@ -2708,7 +3110,8 @@ zil_commit_waiter(zilog_t *zilog, zil_commit_waiter_t *zcw)
 		} else {
 			/*
 			 * If the lwb isn't open, then it must have already
-			 * been issued. In that case, there's no need to
+			 * been closed, and will be issued by the thread that
+			 * closed it. In that case, there's no need to
 			 * use a timeout when waiting for the lwb to
 			 * complete.
 			 *
@@ -2719,6 +3122,8 @@ zil_commit_waiter(zilog_t *zilog, zil_commit_waiter_t *zcw)
 			 */
 
 			IMPLY(lwb != NULL,
+			    lwb->lwb_state == LWB_STATE_CLOSED ||
+			    lwb->lwb_state == LWB_STATE_READY ||
 			    lwb->lwb_state == LWB_STATE_ISSUED ||
 			    lwb->lwb_state == LWB_STATE_WRITE_DONE ||
 			    lwb->lwb_state == LWB_STATE_FLUSH_DONE);
@@ -2927,6 +3332,16 @@ zil_commit(zilog_t *zilog, uint64_t foid)
 		return;
 	}
 
+	/*
+	 * Changes without a log record are only stable once their txg
+	 * has synced (see zil_add_unlogged_txg()).
+	 */
+	mutex_enter(&zilog->zl_lock);
+	uint64_t unlogged_txg = zilog->zl_unlogged_txg;
+	mutex_exit(&zilog->zl_lock);
+	if (unlogged_txg > spa_last_synced_txg(zilog->zl_spa))
+		txg_wait_synced(zilog->zl_dmu_pool, unlogged_txg);
+
 	/*
 	 * If the ZIL is suspended, we don't want to dirty it by calling
 	 * zil_commit_itx_assign() below, nor can we write out
@@ -2945,6 +3360,8 @@ zil_commit(zilog_t *zilog, uint64_t foid)
 void
 zil_commit_impl(zilog_t *zilog, uint64_t foid)
 {
+	hrtime_t start = gethrtime();
+
 	ZIL_STAT_BUMP(zil_commit_count);
 
 	/*
@@ -2994,6 +3411,8 @@ zil_commit_impl(zilog_t *zilog, uint64_t foid)
 	}
 
 	zil_free_commit_waiter(zcw);
+
+	zil_lat_add(zilog, ZIL_LAT_COMMIT, gethrtime() - start);
 }
 
 /*
@@ -3049,10 +3468,12 @@ zil_sync(zilog_t *zilog, dmu_tx_t *tx)
 
 	while ((lwb = list_head(&zilog->zl_lwb_list)) != NULL) {
 		zh->zh_log = lwb->lwb_blk;
-		if (lwb->lwb_buf != NULL || lwb->lwb_max_txg > txg)
+		if (lwb->lwb_buf != NULL || lwb->lwb_max_txg > txg ||
+		    lwb->lwb_alloc_txg > txg)
 			break;
 		list_remove(&zilog->zl_lwb_list, lwb);
-		zio_free(spa, txg, &lwb->lwb_blk);
+		if (!BP_IS_HOLE(&lwb->lwb_blk))
+			zio_free(spa, txg, &lwb->lwb_blk);
 		zil_free_lwb(zilog, lwb);
 
 		/*
@@ -3166,6 +3587,11 @@ zil_alloc(objset_t *os, zil_header_t *zh_phys)
 	zilog->zl_last_lwb_opened = NULL;
 	zilog->zl_last_lwb_latency = 0;
 	zilog->zl_max_block_size = zil_maxblocksize;
+	if (spa_has_slogs(zilog->zl_spa)) {
+		zilog->zl_max_block_size = MAX(zilog->zl_max_block_size,
+		    MIN(zil_slog_maxblocksize,
+		    spa_maxblocksize(zilog->zl_spa)));
+	}
 
 	mutex_init(&zilog->zl_lock, NULL, MUTEX_DEFAULT, NULL);
 	mutex_init(&zilog->zl_issuer_lock, NULL, MUTEX_DEFAULT, NULL);
@@ -3223,6 +3649,46 @@ zil_free(zilog_t *zilog)
 	kmem_free(zilog, sizeof (zilog_t));
 }
 
+/*
+ * Install the per-dataset latency histograms of an open intent log.
+ */
+static void
+zil_lat_kstat_create(zilog_t *zilog)
+{
+	char *module = kmem_asprintf("zfs/%s", spa_name(zilog->zl_spa));
+	char *name = kmem_asprintf("objset-0x%llx-zil",
+	    (u_longlong_t)dmu_objset_id(zilog->zl_os));
+	kstat_t *ksp;
+
+	ksp = kstat_create(module, 0, name, "misc", KSTAT_TYPE_NAMED,
+	    ZIL_LAT_NSTATS, KSTAT_FLAG_VIRTUAL);
+	if (ksp != NULL) {
+		ksp->ks_data = kmem_alloc(ZIL_LAT_NSTATS *
+		    sizeof (kstat_named_t), KM_SLEEP);
+		zil_lat_kstat_init(ksp->ks_data);
+		ksp->ks_private = zilog;
+		ksp->ks_update = zil_lat_kstat_update;
+		kstat_install(ksp);
+	}
+	zilog->zl_lat_kstat = ksp;
+
+	strfree(name);
+	strfree(module);
+}
+
+static void
+zil_lat_kstat_destroy(zilog_t *zilog)
+{
+	kstat_t *ksp = zilog->zl_lat_kstat;
+
+	if (ksp == NULL)
+		return;
+
+	zilog->zl_lat_kstat = NULL;
+	kstat_delete(ksp);
+	kmem_free(ksp->ks_data, ZIL_LAT_NSTATS * sizeof (kstat_named_t));
+}
+
 /*
  * Open an intent log.
  */
@@ -3236,6 +3702,7 @@ zil_open(objset_t *os, zil_get_data_t *get_data)
 	ASSERT(list_is_empty(&zilog->zl_lwb_list));
 
 	zilog->zl_get_data = get_data;
+	zil_lat_kstat_create(zilog);
 
 	return (zilog);
 }
@@ -3259,10 +3726,12 @@ zil_close(zilog_t *zilog)
 
 	mutex_enter(&zilog->zl_lock);
 	lwb = list_tail(&zilog->zl_lwb_list);
-	if (lwb == NULL)
+	if (lwb == NULL) {
 		txg = zilog->zl_dirty_max_txg;
-	else
+	} else {
 		txg = MAX(zilog->zl_dirty_max_txg, lwb->lwb_max_txg);
+		txg = MAX(txg, lwb->lwb_alloc_txg);
+	}
 	mutex_exit(&zilog->zl_lock);
 
 	/*
@@ -3279,6 +3748,7 @@ zil_close(zilog_t *zilog)
 		VERIFY(!zilog_is_dirty(zilog));
 
 	zilog->zl_get_data = NULL;
+	zil_lat_kstat_destroy(zilog);
 
 	/*
 	 * We should have only one lwb left on the list; remove it now.
@@ -3287,7 +3757,7 @@ zil_close(zilog_t *zilog)
 	lwb = list_head(&zilog->zl_lwb_list);
 	if (lwb != NULL) {
 		ASSERT3P(lwb, ==, list_tail(&zilog->zl_lwb_list));
-		ASSERT3S(lwb->lwb_state, !=, LWB_STATE_ISSUED);
+		ASSERT3S(lwb->lwb_state, ==, LWB_STATE_NEW);
 
 		if (lwb->lwb_fastwrite)
 			metaslab_fastwrite_unmark(zilog->zl_spa, &lwb->lwb_blk);
@@ -3654,6 +4124,7 @@ EXPORT_SYMBOL(zil_destroy_sync);
 EXPORT_SYMBOL(zil_itx_create);
 EXPORT_SYMBOL(zil_itx_destroy);
 EXPORT_SYMBOL(zil_itx_assign);
+EXPORT_SYMBOL(zil_add_unlogged_txg);
 EXPORT_SYMBOL(zil_commit);
 EXPORT_SYMBOL(zil_claim);
 EXPORT_SYMBOL(zil_check_log_chain);
@@ -3681,4 +4152,7 @@ ZFS_MODULE_PARAM(zfs_zil, zil_, slog_bulk, ULONG, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_zil, zil_, maxblocksize, INT, ZMOD_RW,
 	"Limit in bytes of ZIL log block size");
+
+ZFS_MODULE_PARAM(zfs_zil, zil_, slog_maxblocksize, INT, ZMOD_RW,
+	"Limit in bytes of ZIL log block size with separate log devices");
 /* END CSTYLED */
@@ -39,6 +39,7 @@
 #include <sys/dmu_objset.h>
 #include <sys/arc.h>
 #include <sys/ddt.h>
+#include <sys/brt.h>
 #include <sys/blkptr.h>
 #include <sys/zfeature.h>
 #include <sys/dsl_scan.h>
@@ -398,7 +399,8 @@ zio_decompress(zio_t *zio, abd_t *data, uint64_t size)
 	if (zio->io_error == 0) {
 		void *tmp = abd_borrow_buf(data, size);
 		int ret = zio_decompress_data(BP_GET_COMPRESS(zio->io_bp),
-		    zio->io_abd, tmp, zio->io_size, size);
+		    zio->io_abd, tmp, zio->io_size, size,
+		    &zio->io_prop.zp_complevel);
 		abd_return_buf_copy(data, tmp, size);
 
 		if (zio_injection_enabled && ret == 0)
@@ -448,7 +450,7 @@ zio_decrypt(zio_t *zio, abd_t *data, uint64_t size)
 			 */
 			tmp = zio_buf_alloc(lsize);
 			ret = zio_decompress_data(BP_GET_COMPRESS(bp),
-			    zio->io_abd, tmp, zio->io_size, lsize);
+			    zio->io_abd, tmp, zio->io_size, lsize, NULL);
 			if (ret != 0) {
 				ret = SET_ERROR(EIO);
 				goto error;
@@ -965,8 +967,10 @@ zfs_blkptr_verify(spa_t *spa, const blkptr_t *bp, boolean_t config_held)
 		}
 		uint64_t offset = DVA_GET_OFFSET(&bp->blk_dva[i]);
 		uint64_t asize = DVA_GET_ASIZE(&bp->blk_dva[i]);
-		if (BP_IS_GANG(bp))
-			asize = vdev_psize_to_asize(vd, SPA_GANGBLOCKSIZE);
+		if (BP_IS_GANG(bp)) {
+			asize = vdev_psize_to_asize_txg(vd, SPA_GANGBLOCKSIZE,
+			    BP_PHYSICAL_BIRTH(bp));
+		}
 		if (offset + asize > vd->vdev_asize) {
 			zfs_panic_recover("blkptr at %p DVA %u has invalid "
 			    "OFFSET %llu",
@@ -999,8 +1003,10 @@ zfs_dva_valid(spa_t *spa, const dva_t *dva, const blkptr_t *bp)
 	uint64_t offset = DVA_GET_OFFSET(dva);
 	uint64_t asize = DVA_GET_ASIZE(dva);
 
-	if (BP_IS_GANG(bp))
-		asize = vdev_psize_to_asize(vd, SPA_GANGBLOCKSIZE);
+	if (BP_IS_GANG(bp)) {
+		asize = vdev_psize_to_asize_txg(vd, SPA_GANGBLOCKSIZE,
+		    BP_PHYSICAL_BIRTH(bp));
+	}
 	if (offset + asize > vd->vdev_asize)
 		return (B_FALSE);
 
@@ -1152,6 +1158,12 @@ zio_free_sync(zio_t *pio, spa_t *spa, uint64_t txg, const blkptr_t *bp,
 	if (BP_IS_EMBEDDED(bp))
 		return (zio_null(pio, spa, NULL, NULL, NULL, 0));
 
+	/*
+	 * A cloned block is only freed when its last reference goes away.
+	 */
+	if (brt_maybe_exists(spa, bp) && !brt_entry_decref(spa, bp))
+		return (zio_null(pio, spa, NULL, NULL, NULL, 0));
+
 	metaslab_check_free(spa, bp);
 	arc_freed(spa, bp);
 	dsl_scan_freed(spa, bp);
@@ -1607,7 +1619,8 @@ zio_write_compress(zio_t *zio)
 	if (compress != ZIO_COMPRESS_OFF &&
 	    !(zio->io_flags & ZIO_FLAG_RAW_COMPRESS)) {
 		void *cbuf = zio_buf_alloc(lsize);
-		psize = zio_compress_data(compress, zio->io_abd, cbuf, lsize);
+		psize = zio_compress_data(compress, zio->io_abd, cbuf, lsize,
+		    zp->zp_complevel);
 		if (psize == 0 || psize == lsize) {
 			compress = ZIO_COMPRESS_OFF;
 			zio_buf_free(cbuf, lsize);
@@ -1670,7 +1683,7 @@ zio_write_compress(zio_t *zio)
 		 * to a hole.
 		 */
 		psize = zio_compress_data(ZIO_COMPRESS_EMPTY,
-		    zio->io_abd, NULL, lsize);
+		    zio->io_abd, NULL, lsize, 0);
 		if (psize == 0)
 			compress = ZIO_COMPRESS_OFF;
 	} else {
@@ -2757,6 +2770,7 @@ zio_write_gang_block(zio_t *pio)
 
 		zp.zp_checksum = gio->io_prop.zp_checksum;
 		zp.zp_compress = ZIO_COMPRESS_OFF;
+		zp.zp_complevel = gio->io_prop.zp_complevel;
 		zp.zp_type = DMU_OT_NONE;
 		zp.zp_level = 0;
 		zp.zp_copies = gio->io_prop.zp_copies;
@@ -2926,7 +2940,6 @@ zio_ddt_read_start(zio_t *zio)
 	if (zio->io_child_error[ZIO_CHILD_DDT]) {
 		ddt_t *ddt = ddt_select(zio->io_spa, bp);
 		ddt_entry_t *dde = ddt_repair_start(ddt, bp);
-		ddt_phys_t *ddp = dde->dde_phys;
 		ddt_phys_t *ddp_self = ddt_phys_select(dde, bp);
 		blkptr_t blk;
 
@@ -2936,8 +2949,11 @@ zio_ddt_read_start(zio_t *zio)
 		if (ddp_self == NULL)
 			return (zio);
 
-		for (int p = 0; p < DDT_PHYS_TYPES; p++, ddp++) {
-			if (ddp->ddp_phys_birth == 0 || ddp == ddp_self)
+		for (int p = 0; p < DDT_PHYS_TYPES; p++) {
+			ddt_phys_t *ddp = dde->dde_phys[p];
+
+			if (ddp == NULL || ddp->ddp_phys_birth == 0 ||
+			    ddp == ddp_self)
 				continue;
 			ddt_bp_create(ddt->ddt_checksum, &dde->dde_key, ddp,
 			    &blk);
@@ -3029,7 +3045,10 @@ zio_ddt_collision(zio_t *zio, ddt_t *ddt, ddt_entry_t *dde)
 	}
 
 	for (int p = DDT_PHYS_SINGLE; p <= DDT_PHYS_TRIPLE; p++) {
-		ddt_phys_t *ddp = &dde->dde_phys[p];
+		ddt_phys_t *ddp = dde->dde_phys[p];
+
+		if (ddp == NULL)
+			continue;
 
 		if (ddp->ddp_phys_birth != 0 && do_raw) {
 			blkptr_t blk = *zio->io_bp;
@@ -3099,7 +3118,7 @@ zio_ddt_child_write_ready(zio_t *zio)
 	int p = zio->io_prop.zp_copies;
 	ddt_t *ddt = ddt_select(zio->io_spa, zio->io_bp);
 	ddt_entry_t *dde = zio->io_private;
-	ddt_phys_t *ddp = &dde->dde_phys[p];
+	ddt_phys_t *ddp = dde->dde_phys[p];
 	zio_t *pio;
 
 	if (zio->io_error)
@@ -3124,7 +3143,7 @@ zio_ddt_child_write_done(zio_t *zio)
 	int p = zio->io_prop.zp_copies;
 	ddt_t *ddt = ddt_select(zio->io_spa, zio->io_bp);
 	ddt_entry_t *dde = zio->io_private;
-	ddt_phys_t *ddp = &dde->dde_phys[p];
+	ddt_phys_t *ddp = dde->dde_phys[p];
 
 	ddt_enter(ddt);
 
@@ -3163,7 +3182,6 @@ zio_ddt_write(zio_t *zio)
 
 	ddt_enter(ddt);
 	dde = ddt_lookup(ddt, bp, B_TRUE);
-	ddp = &dde->dde_phys[p];
 
 	if (zp->zp_dedup_verify && zio_ddt_collision(zio, ddt, dde)) {
 		/*
@@ -3188,6 +3206,21 @@ zio_ddt_write(zio_t *zio)
 		return (zio);
 	}
 
+	/*
+	 * Once the DDT has reached its quota, blocks without an entry are
+	 * written as ordinary blocks rather than growing the table further.
+	 */
+	if (dde->dde_type == DDT_TYPES && dde->dde_lead_zio[p] == NULL &&
+	    zio->io_bp_override == NULL && ddt_over_quota(spa)) {
+		zp->zp_dedup = B_FALSE;
+		BP_SET_DEDUP(bp, B_FALSE);
+		zio->io_pipeline = ZIO_WRITE_PIPELINE;
+		ddt_exit(ddt);
+		return (zio);
+	}
+
+	ddp = ddt_phys_slot(dde, p);
+
 	if (ddp->ddp_phys_birth != 0 || dde->dde_lead_zio[p] != NULL) {
 		if (ddp->ddp_phys_birth != 0)
 			ddt_bp_fill(ddp, bp, txg);
@@ -3235,13 +3268,18 @@ zio_ddt_free(zio_t *zio)
 
 	ddt_enter(ddt);
 	freedde = dde = ddt_lookup(ddt, bp, B_TRUE);
-	if (dde) {
-		ddp = ddt_phys_select(dde, bp);
-		if (ddp)
-			ddt_phys_decref(ddp);
-	}
+	ddp = ddt_phys_select(dde, bp);
+	if (ddp)
+		ddt_phys_decref(ddp);
 	ddt_exit(ddt);
 
+	/*
+	 * Without a matching entry the block's entry was pruned, so the
+	 * block is no longer shared and can be freed right away.
+	 */
+	if (ddp == NULL)
+		zio->io_pipeline |= ZIO_STAGE_DVA_FREE;
+
 	return (zio);
 }
 
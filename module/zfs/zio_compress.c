@@ -36,6 +36,7 @@
 #include <sys/zfeature.h>
 #include <sys/zio.h>
 #include <sys/zio_compress.h>
+#include <sys/zstd/zstd.h>
 
 /*
  * If nonzero, every 1/X decompression attempts will fail, simulating
@@ -47,24 +48,54 @@ unsigned long zio_decompress_fail_fraction = 0;
  * Compression vectors.
  */
 zio_compress_info_t zio_compress_table[ZIO_COMPRESS_FUNCTIONS] = {
-	{"inherit",		0,	NULL,		NULL},
-	{"on",			0,	NULL,		NULL},
-	{"uncompressed",	0,	NULL,		NULL},
-	{"lzjb",		0,	lzjb_compress,	lzjb_decompress},
-	{"empty",		0,	NULL,		NULL},
-	{"gzip-1",		1,	gzip_compress,	gzip_decompress},
-	{"gzip-2",		2,	gzip_compress,	gzip_decompress},
-	{"gzip-3",		3,	gzip_compress,	gzip_decompress},
-	{"gzip-4",		4,	gzip_compress,	gzip_decompress},
-	{"gzip-5",		5,	gzip_compress,	gzip_decompress},
-	{"gzip-6",		6,	gzip_compress,	gzip_decompress},
-	{"gzip-7",		7,	gzip_compress,	gzip_decompress},
-	{"gzip-8",		8,	gzip_compress,	gzip_decompress},
-	{"gzip-9",		9,	gzip_compress,	gzip_decompress},
-	{"zle",			64,	zle_compress,	zle_decompress},
-	{"lz4",			0,	lz4_compress_zfs, lz4_decompress_zfs}
+	{"inherit",	0,	NULL,		NULL, NULL, NULL, NULL},
+	{"on",		0,	NULL,		NULL, NULL, NULL, NULL},
+	{"uncompressed", 0,	NULL,		NULL, NULL, NULL, NULL},
+	{"lzjb",	0,	lzjb_compress,	lzjb_decompress, NULL,
+	    NULL, NULL},
+	{"empty",	0,	NULL,		NULL, NULL, NULL, NULL},
+	{"gzip-1",	1,	gzip_compress,	gzip_decompress, NULL,
+	    gzip_compress_abd, gzip_decompress_abd},
+	{"gzip-2",	2,	gzip_compress,	gzip_decompress, NULL,
+	    gzip_compress_abd, gzip_decompress_abd},
+	{"gzip-3",	3,	gzip_compress,	gzip_decompress, NULL,
+	    gzip_compress_abd, gzip_decompress_abd},
+	{"gzip-4",	4,	gzip_compress,	gzip_decompress, NULL,
+	    gzip_compress_abd, gzip_decompress_abd},
+	{"gzip-5",	5,	gzip_compress,	gzip_decompress, NULL,
+	    gzip_compress_abd, gzip_decompress_abd},
+	{"gzip-6",	6,	gzip_compress,	gzip_decompress, NULL,
+	    gzip_compress_abd, gzip_decompress_abd},
+	{"gzip-7",	7,	gzip_compress,	gzip_decompress, NULL,
+	    gzip_compress_abd, gzip_decompress_abd},
+	{"gzip-8",	8,	gzip_compress,	gzip_decompress, NULL,
+	    gzip_compress_abd, gzip_decompress_abd},
+	{"gzip-9",	9,	gzip_compress,	gzip_decompress, NULL,
+	    gzip_compress_abd, gzip_decompress_abd},
+	{"zle",		64,	zle_compress,	zle_decompress, NULL,
+	    NULL, NULL},
+	{"lz4",		0,	lz4_compress_zfs, lz4_decompress_zfs, NULL,
+	    NULL, NULL},
+	{"zstd",	ZIO_ZSTD_LEVEL_DEFAULT,	zfs_zstd_compress,
+	    zfs_zstd_decompress, zfs_zstd_decompress_level, NULL, NULL},
 };
 
+uint8_t
+zio_complevel_select(spa_t *spa, enum zio_compress compress, uint8_t child,
+    uint8_t parent)
+{
+	uint8_t result;
+
+	if (!ZIO_COMPRESS_HASLEVEL(compress))
+		return (0);
+
+	result = child;
+	if (result == ZIO_COMPLEVEL_INHERIT)
+		result = parent;
+
+	return (result);
+}
+
 enum zio_compress
 zio_compress_select(spa_t *spa, enum zio_compress child,
     enum zio_compress parent)
@@ -102,9 +133,11 @@ zio_compress_zeroed_cb(void *data, size_t len, void *private)
 }
 
 size_t
-zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len)
+zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len,
+    uint8_t level)
 {
 	size_t c_len, d_len;
+	uint8_t complevel;
 	zio_compress_info_t *ci = &zio_compress_table[c];
 
 	ASSERT((uint_t)c < ZIO_COMPRESS_FUNCTIONS);
@@ -123,10 +156,36 @@ zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len)
 	/* Compress at least 12.5% */
 	d_len = s_len - (s_len >> 3);
 
-	/* No compression algorithms can read from ABDs directly */
-	void *tmp = abd_borrow_buf_copy(src, s_len);
-	c_len = ci->ci_compress(tmp, dst, s_len, d_len, ci->ci_level);
-	abd_return_buf(src, tmp, s_len);
+	/*
+	 * If the caller did not request a specific level, fall back to
+	 * the one the algorithm was registered with.
+	 */
+	complevel = ci->ci_level;
+	if (c == ZIO_COMPRESS_ZSTD) {
+		/* If we don't know the level, we can't compress it */
+		if (level == ZIO_COMPLEVEL_INHERIT)
+			return (s_len);
+
+		if (level == ZIO_COMPLEVEL_DEFAULT)
+			complevel = ZIO_ZSTD_LEVEL_DEFAULT;
+		else
+			complevel = level;
+
+		ASSERT3U(complevel, !=, ZIO_COMPLEVEL_INHERIT);
+	}
+
+	/*
+	 * A linear ABD can be handed to any algorithm as is.  Scatter ABDs
+	 * are streamed by the algorithms which support it and copied into
+	 * a linear buffer for the rest.
+	 */
+	if (ci->ci_compress_abd != NULL && !abd_is_linear(src)) {
+		c_len = ci->ci_compress_abd(src, dst, s_len, d_len, complevel);
+	} else {
+		void *tmp = abd_borrow_buf_copy(src, s_len);
+		c_len = ci->ci_compress(tmp, dst, s_len, d_len, complevel);
+		abd_return_buf(src, tmp, s_len);
+	}
 
 	if (c_len > d_len)
 		return (s_len);
@@ -135,24 +194,43 @@ zio_compress_data(enum zio_compress c, abd_t *src, void *dst, size_t s_len)
 	return (c_len);
 }
 
+/*
+ * Decompress a buffer.  Algorithms which record their level inside the
+ * compressed payload report it through the optional "level" argument, so
+ * that the exact level a block was written with can be carried along with
+ * it (e.g. into the L2ARC or a compressed send stream).
+ */
 int
 zio_decompress_data_buf(enum zio_compress c, void *src, void *dst,
-    size_t s_len, size_t d_len)
+    size_t s_len, size_t d_len, uint8_t *level)
 {
 	zio_compress_info_t *ci = &zio_compress_table[c];
 	if ((uint_t)c >= ZIO_COMPRESS_FUNCTIONS || ci->ci_decompress == NULL)
 		return (SET_ERROR(EINVAL));
 
+	if (ci->ci_decompress_level != NULL && level != NULL)
+		return (ci->ci_decompress_level(src, dst, s_len, d_len, level));
+
 	return (ci->ci_decompress(src, dst, s_len, d_len, ci->ci_level));
 }
 
 int
 zio_decompress_data(enum zio_compress c, abd_t *src, void *dst,
-    size_t s_len, size_t d_len)
+    size_t s_len, size_t d_len, uint8_t *level)
 {
-	void *tmp = abd_borrow_buf_copy(src, s_len);
-	int ret = zio_decompress_data_buf(c, tmp, dst, s_len, d_len);
-	abd_return_buf(src, tmp, s_len);
+	zio_compress_info_t *ci = &zio_compress_table[c];
+	int ret;
+
+	if ((uint_t)c < ZIO_COMPRESS_FUNCTIONS &&
+	    ci->ci_decompress_abd != NULL && !abd_is_linear(src) &&
+	    (ci->ci_decompress_level == NULL || level == NULL)) {
+		ret = ci->ci_decompress_abd(src, dst, s_len, d_len,
+		    ci->ci_level);
+	} else {
+		void *tmp = abd_borrow_buf_copy(src, s_len);
+		ret = zio_decompress_data_buf(c, tmp, dst, s_len, d_len, level);
+		abd_return_buf(src, tmp, s_len);
+	}
 
 	/*
 	 * Decompression shouldn't fail, because we've already verified
@@ -166,3 +244,15 @@ zio_decompress_data(enum zio_compress c, abd_t *src, void *dst,
 
 	return (ret);
 }
+
+int
+zio_compress_to_feature(enum zio_compress comp)
+{
+	switch (comp) {
+	case ZIO_COMPRESS_ZSTD:
+		return (SPA_FEATURE_ZSTD_COMPRESS);
+	default:
+		break;
+	}
+	return (SPA_FEATURE_NONE);
+}
@@ -28,6 +28,7 @@ KMOD_ZUNICODE=${KMOD_ZUNICODE:-zunicode}
 KMOD_ZCOMMON=${KMOD_ZCOMMON:-zcommon}
 KMOD_ZLUA=${KMOD_ZLUA:-zlua}
 KMOD_ICP=${KMOD_ICP:-icp}
+KMOD_ZZSTD=${KMOD_ZZSTD:-zzstd}
 KMOD_ZFS=${KMOD_ZFS:-zfs}
 
 
@@ -81,7 +82,8 @@ check_modules() {
 	MISSING_MODULES=""
 
 	for KMOD in $KMOD_SPL $KMOD_ZAVL $KMOD_ZNVPAIR \
-	    $KMOD_ZUNICODE $KMOD_ZCOMMON $KMOD_ZLUA $KMOD_ICP $KMOD_ZFS; do
+	    $KMOD_ZUNICODE $KMOD_ZCOMMON $KMOD_ZLUA $KMOD_ICP $KMOD_ZZSTD \
+	    $KMOD_ZFS; do
 		NAME=$(basename "$KMOD" .ko)
 
 		if lsmod | grep -E -q "^${NAME}"; then
@@ -140,7 +142,8 @@ load_modules() {
 	fi
 
 	for KMOD in $KMOD_SPL $KMOD_ZAVL $KMOD_ZNVPAIR \
-	    $KMOD_ZUNICODE $KMOD_ZCOMMON $KMOD_ZLUA $KMOD_ICP $KMOD_ZFS; do
+	    $KMOD_ZUNICODE $KMOD_ZCOMMON $KMOD_ZLUA $KMOD_ICP $KMOD_ZZSTD \
+	    $KMOD_ZFS; do
 		load_module "$KMOD" || return 1
 	done
 
@@ -168,8 +171,8 @@ unload_module() {
 }
 
 unload_modules() {
-	for KMOD in $KMOD_ZFS $KMOD_ICP $KMOD_ZLUA $KMOD_ZCOMMON $KMOD_ZUNICODE \
-	    $KMOD_ZNVPAIR  $KMOD_ZAVL $KMOD_SPL; do
+	for KMOD in $KMOD_ZFS $KMOD_ZZSTD $KMOD_ICP $KMOD_ZLUA $KMOD_ZCOMMON \
+	    $KMOD_ZUNICODE $KMOD_ZNVPAIR  $KMOD_ZAVL $KMOD_SPL; do
 		NAME=$(basename "$KMOD" .ko)
 		USE_COUNT=$(lsmod | grep -E "^${NAME} " | awk '{print $3}')
 
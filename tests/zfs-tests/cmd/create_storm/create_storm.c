@@ -0,0 +1,308 @@
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ */
+
+/*
+ * Create a large number of empty files in a single directory from many
+ * threads at once, and report the aggregate create rate.  This exercises
+ * concurrent modification of one large (fat) ZAP.  With -b the files are
+ * created in batches through lzc_create_files() rather than open(2).
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libzfs_core.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static char *dir = NULL;
+static int nthreads = 0;
+static long nfiles = 0;
+static int do_unlink = 0;
+static long batch = 0;
+static char *fsname = NULL;
+static uint64_t dirobj = 0;
+static char *execname = "create_storm";
+
+static pthread_barrier_t start_barrier;
+
+static void usage(void);
+static void parse_options(int argc, char *argv[]);
+
+static void
+usage(void)
+{
+	(void) fprintf(stderr,
+	    "usage: %s -d directory -t threads -n files [-u] "
+	    "[-b batch -f filesystem]\n"
+	    "\n"
+	    "Create files in a single directory from many threads and\n"
+	    "report the number of creates per second.\n"
+	    "\n"
+	    "    directory: Directory to create the files in\n"
+	    "    threads:   Number of threads creating files\n"
+	    "    files:     Number of files created by each thread\n"
+	    "    -u:        Also time removing the files afterwards\n"
+	    "    batch:     Create this many files per lzc_create_files()\n"
+	    "    filesystem: Name of the filesystem containing directory\n",
+	    execname);
+	(void) exit(1);
+}
+
+static void
+parse_options(int argc, char *argv[])
+{
+	int c;
+	int errflag = 0;
+
+	execname = argv[0];
+
+	extern char *optarg;
+	extern int optind, optopt;
+
+	while ((c = getopt(argc, argv, ":d:t:n:ub:f:")) != -1) {
+		switch (c) {
+			case 'd':
+				dir = optarg;
+				break;
+
+			case 't':
+				nthreads = atoi(optarg);
+				break;
+
+			case 'n':
+				nfiles = atol(optarg);
+				break;
+
+			case 'u':
+				do_unlink = 1;
+				break;
+
+			case 'b':
+				batch = atol(optarg);
+				break;
+
+			case 'f':
+				fsname = optarg;
+				break;
+
+			case ':':
+				(void) fprintf(stderr,
+				    "Option -%c requires an operand\n", optopt);
+				errflag++;
+				break;
+
+			case '?':
+			default:
+				(void) fprintf(stderr,
+				    "Unrecognized option: -%c\n", optopt);
+				errflag++;
+				break;
+		}
+
+		if (errflag) {
+			(void) usage();
+		}
+	}
+
+	if (dir == NULL || nthreads <= 0 || nfiles <= 0 || batch < 0 ||
+	    (batch > 0 && fsname == NULL)) {
+		(void) fprintf(stderr,
+		    "Required parameter(s) missing or invalid.\n");
+		(void) usage();
+	}
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void *
+creator(void *arg)
+{
+	int id = (int)(uintptr_t)arg;
+	char path[MAXPATHLEN];
+
+	(void) pthread_barrier_wait(&start_barrier);
+
+	for (long i = 0; i < nfiles; i++) {
+		(void) snprintf(path, sizeof (path), "%s/t%d.%ld", dir, id, i);
+		int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (fd == -1) {
+			(void) fprintf(stderr, "%s: %s: ", execname, path);
+			perror("open");
+			exit(2);
+		}
+		(void) close(fd);
+	}
+
+	return (NULL);
+}
+
+static void *
+batch_creator(void *arg)
+{
+	int id = (int)(uintptr_t)arg;
+	char **names = calloc(batch, sizeof (char *));
+	nvlist_t *result;
+
+	if (names == NULL) {
+		perror("calloc");
+		exit(2);
+	}
+	for (long i = 0; i < batch; i++) {
+		names[i] = malloc(MAXNAMELEN);
+		if (names[i] == NULL) {
+			perror("malloc");
+			exit(2);
+		}
+	}
+
+	(void) pthread_barrier_wait(&start_barrier);
+
+	for (long i = 0; i < nfiles; i += batch) {
+		long n = MIN(batch, nfiles - i);
+
+		for (long j = 0; j < n; j++) {
+			(void) snprintf(names[j], MAXNAMELEN, "t%d.%ld",
+			    id, i + j);
+		}
+
+		result = NULL;
+		int err = lzc_create_files(fsname, dirobj, names, n, 0644,
+		    &result);
+		if (err == 0 && result != NULL &&
+		    fnvlist_lookup_uint64(result, "failed") != 0)
+			err = EEXIST;
+		nvlist_free(result);
+		if (err != 0) {
+			(void) fprintf(stderr, "%s: %s: lzc_create_files: "
+			    "%s\n", execname, dir, strerror(err));
+			exit(2);
+		}
+	}
+
+	for (long i = 0; i < batch; i++)
+		free(names[i]);
+	free(names);
+
+	return (NULL);
+}
+
+static void *
+remover(void *arg)
+{
+	int id = (int)(uintptr_t)arg;
+	char path[MAXPATHLEN];
+
+	(void) pthread_barrier_wait(&start_barrier);
+
+	for (long i = 0; i < nfiles; i++) {
+		(void) snprintf(path, sizeof (path), "%s/t%d.%ld", dir, id, i);
+		if (unlink(path) == -1) {
+			(void) fprintf(stderr, "%s: %s: ", execname, path);
+			perror("unlink");
+			exit(2);
+		}
+	}
+
+	return (NULL);
+}
+
+static double
+run_threads(void *(*func)(void *))
+{
+	pthread_t *tids = calloc(nthreads, sizeof (pthread_t));
+	if (tids == NULL) {
+		perror("calloc");
+		exit(2);
+	}
+
+	/* The main thread also waits so the clock starts with everyone */
+	int err = pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+	if (err != 0) {
+		(void) fprintf(stderr, "%s: pthread_barrier_init: %s\n",
+		    execname, strerror(err));
+		exit(2);
+	}
+	for (int i = 0; i < nthreads; i++) {
+		err = pthread_create(&tids[i], NULL, func,
+		    (void *)(uintptr_t)i);
+		if (err != 0) {
+			(void) fprintf(stderr, "%s: pthread_create: %s\n",
+			    execname, strerror(err));
+			exit(2);
+		}
+	}
+
+	(void) pthread_barrier_wait(&start_barrier);
+	double start = now();
+	for (int i = 0; i < nthreads; i++)
+		(void) pthread_join(tids[i], NULL);
+	double elapsed = now() - start;
+
+	(void) pthread_barrier_destroy(&start_barrier);
+	free(tids);
+
+	return (elapsed);
+}
+
+int
+main(int argc, char *argv[])
+{
+	parse_options(argc, argv);
+
+	if (batch > 0) {
+		struct stat64 st;
+
+		if (stat64(dir, &st) != 0) {
+			(void) fprintf(stderr, "%s: %s: ", execname, dir);
+			perror("stat");
+			exit(2);
+		}
+		dirobj = st.st_ino;
+
+		if (libzfs_core_init() != 0) {
+			(void) fprintf(stderr, "%s: libzfs_core_init failed\n",
+			    execname);
+			exit(2);
+		}
+	}
+
+	long total = nthreads * nfiles;
+	double elapsed = run_threads(batch > 0 ? batch_creator : creator);
+	(void) printf("threads %d creates %ld seconds %.3f creates/sec %.0f\n",
+	    nthreads, total, elapsed, total / elapsed);
+
+	if (do_unlink) {
+		elapsed = run_threads(remover);
+		(void) printf("threads %d removes %ld seconds %.3f "
+		    "removes/sec %.0f\n", nthreads, total, elapsed,
+		    total / elapsed);
+	}
+
+	if (batch > 0)
+		libzfs_core_fini();
+
+	return (0);
+}
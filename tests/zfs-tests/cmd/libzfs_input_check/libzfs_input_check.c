@@ -734,6 +734,25 @@ test_wait(const char *pool)
 	nvlist_free(optional);
 }
 
+static void
+test_create_files(const char *dataset)
+{
+	nvlist_t *required = fnvlist_alloc();
+	nvlist_t *optional = fnvlist_alloc();
+	char *names[] = { "file1", "file2" };
+
+	fnvlist_add_uint64(required, "dir_obj", 34);
+	fnvlist_add_string_array(required, "names", names, 2);
+	fnvlist_add_uint64(optional, "mode", 0644);
+
+	/* the dataset is not mounted */
+	IOC_INPUT_TEST(ZFS_IOC_CREATE_FILES, dataset, required, optional,
+	    ESRCH);
+
+	nvlist_free(required);
+	nvlist_free(optional);
+}
+
 static void
 zfs_ioc_input_tests(const char *pool)
 {
@@ -822,6 +841,8 @@ zfs_ioc_input_tests(const char *pool)
 
 	test_wait(pool);
 
+	test_create_files(dataset);
+
 	/*
 	 * cleanup
 	 */
@@ -975,6 +996,7 @@ validate_ioc_values(void)
 	CHECK(LINUX_IOC_BASE + 1 == ZFS_IOC_EVENTS_NEXT);
 	CHECK(LINUX_IOC_BASE + 2 == ZFS_IOC_EVENTS_CLEAR);
 	CHECK(LINUX_IOC_BASE + 3 == ZFS_IOC_EVENTS_SEEK);
+	CHECK(LINUX_IOC_BASE + 4 == ZFS_IOC_CREATE_FILES);
 
 #undef CHECK
 